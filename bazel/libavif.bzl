@@ -0,0 +1,24 @@
+libavif_build_rule = """
+# Description:
+#   AVIF (AV1 Image File Format) library, encoding through libaom. Both come
+#   from the system (libavif-dev, which pulls in libaom-dev), so they are
+#   verified by its package manager and libaom keeps the SIMD and runtime CPU
+#   detection it is packaged with. Only the single-image avifEncoderWrite()
+#   API is used, which every packaged libavif (0.8 and later) provides.
+#   Nothing depends on this unless building with --define avif=enabled, so
+#   the default build does not need libavif-dev installed.
+
+licenses(["notice"])  # BSD 2-clause
+
+cc_library(
+    name = "libavif",
+    hdrs = [
+        "include/avif/avif.h",
+    ],
+    linkopts = [
+        "-lavif",
+    ],
+    strip_include_prefix = "include",
+    visibility = ["//visibility:public"],
+)
+"""
@@ -3,6 +3,7 @@ load(":hiredis.bzl", "hiredis_build_rule")
 load(":jsoncpp.bzl", "jsoncpp_build_rule")
 load(":libpng.bzl", "libpng_build_rule")
 load(":libwebp.bzl", "libwebp_build_rule")
+load(":libavif.bzl", "libavif_build_rule")
 load(":google_sparsehash.bzl", "google_sparsehash_build_rule")
 load(":drp.bzl", "drp_build_rule")
 load(":giflib.bzl", "giflib_build_rule")
@@ -109,6 +110,14 @@ def mod_pagespeed_dependencies():
         build_file_content = libwebp_build_rule,
     )
 
+    # libavif and libaom are linked from the system, and only with
+    # --define avif=enabled; see libavif.bzl.
+    native.new_local_repository(
+        name = "libavif",
+        path = "/usr",
+        build_file_content = libavif_build_rule,
+    )
+
     http_archive(
         name = "google_sparsehash",
         strip_prefix = "sparsehash-%s" % GOOGLE_SPARSEHASH_COMMIT,
@@ -18,31 +18,52 @@
  */
 
 //
-// Tests the overhead of the CompressedCache adapter, using 1k/1M insert sizes,
-// with two different levels of entropy.  For high entropy we use a big block
-// of randomly generated bytes.  For low entropy we use a smaller block of
-// randomly generated bytes, concatenated together to form the total size
-// we want.
+// Tests the overhead of the CompressedCache adapter for each codec, using
+// 1k/1M insert sizes, with two different levels of entropy.  For high entropy
+// we use a big block of randomly generated bytes.  For low entropy we use a
+// smaller block of randomly generated bytes, concatenated together to form
+// the total size we want.  The Metadata benchmarks cycle through small values
+// that resemble each other, like cached rewrite results, with and without a
+// trained dictionary (training is not timed).
 //
+// Each iteration is one Put and one Get.  Ratio is uncompressed bytes over
+// stored bytes, measured separately.
 //
-// Benchmark                  Time(ns)    CPU(ns) Iterations
-// ---------------------------------------------------------
-// BM_Compress1MHighEntropy   38755898   38600000        100
-// BM_Compress1KHighEntropy      62425      63000      10000
-// BM_Compress1MLowEntropy     7175143    7100000        100
-// BM_Compress1KLowEntropy       16620      16514      41176
+// Benchmark                     Time/iter   Ratio
+// -----------------------------------------------
+// BM_Deflate1MHighEntropy        24.8 ms     1.00
+// BM_Brotli1MHighEntropy          3.8 ms     1.00
+// BM_Lz1MHighEntropy             0.92 ms     1.00
+// BM_Deflate1KHighEntropy        23.5 us     0.99
+// BM_Brotli1KHighEntropy         21.5 us     0.99
+// BM_Lz1KHighEntropy              2.2 us     0.98
+// BM_Deflate1MLowEntropy          4.1 ms      166
+// BM_Brotli1MLowEntropy           1.8 ms      967
+// BM_Lz1MLowEntropy              0.82 ms      202
+// BM_Deflate1KLowEntropy          8.3 us     13.3
+// BM_Brotli1KLowEntropy          13.5 us     12.4
+// BM_Lz1KLowEntropy               1.4 us     14.3
+// BM_DeflateMetadata             18.3 us     1.10
+// BM_DeflateMetadataDictionary   11.4 us     4.85
+// BM_BrotliMetadata              23.1 us     1.21
+// BM_LzMetadata                   1.4 us     0.98
+// BM_LzMetadataDictionary         1.3 us     3.38
 //
 // Disclaimer: comparing runs over time and across different machines
 // can be misleading.  When contemplating an algorithm change, always do
 // interleaved runs with the old & new algorithm.
 
+#include <vector>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/cache_interface.h"
 #include "pagespeed/kernel/base/null_mutex.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/compressed_cache.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/util/platform.h"
@@ -54,6 +75,8 @@
 
 namespace {
 
+using net_instaweb::CacheCodec;
+
 class EmptyCallback : public net_instaweb::CacheInterface::Callback {
  public:
   EmptyCallback() {}
@@ -64,7 +87,10 @@ class EmptyCallback : public net_instaweb::CacheInterface::Callback {
   DISALLOW_COPY_AND_ASSIGN(EmptyCallback);
 };
 
-void TestCachePayload(int payload_size, int chunk_size, int iters) {
+// Puts and gets a payload of payload_size bytes, made of repeated random
+// chunks of chunk_size bytes.
+void TestCachePayload(int payload_size, int chunk_size, CacheCodec::Type codec,
+                      benchmark::State& state) {
   GoogleString value;
   net_instaweb::SimpleRandom random(new net_instaweb::NullMutex);
   GoogleString chunk = random.GenerateHighEntropyString(chunk_size);
@@ -77,34 +103,144 @@ void TestCachePayload(int payload_size, int chunk_size, int iters) {
   net_instaweb::CompressedCache::InitStats(&stats);
   net_instaweb::LRUCache* lru_cache =
       new net_instaweb::LRUCache(value.size() * 2);
-  net_instaweb::CompressedCache compressed_cache(lru_cache, &stats);
+  net_instaweb::CompressedCache compressed_cache(lru_cache, codec,
+                                                 thread_system.get(), &stats);
   EmptyCallback empty_callback;
   net_instaweb::SharedString str(value);
-  for (int i = 0; i < iters; ++i) {
+  for (int i = 0; i < state.iterations(); ++i) {
     compressed_cache.Put("key", str);
     compressed_cache.Get("key", &empty_callback);
   }
+  state.SetBytesProcessed(static_cast<int64>(state.iterations()) *
+                          value.size());
+}
+
+static void BM_Deflate1MHighEntropy(benchmark::State& state) {
+  TestCachePayload(1000 * 1000, 1000 * 1000, CacheCodec::kDeflate, state);
+}
+
+static void BM_Brotli1MHighEntropy(benchmark::State& state) {
+  TestCachePayload(1000 * 1000, 1000 * 1000, CacheCodec::kBrotli, state);
+}
+
+static void BM_Lz1MHighEntropy(benchmark::State& state) {
+  TestCachePayload(1000 * 1000, 1000 * 1000, CacheCodec::kLz, state);
+}
+
+static void BM_Deflate1KHighEntropy(benchmark::State& state) {
+  TestCachePayload(1000, 1000, CacheCodec::kDeflate, state);
+}
+
+static void BM_Brotli1KHighEntropy(benchmark::State& state) {
+  TestCachePayload(1000, 1000, CacheCodec::kBrotli, state);
+}
+
+static void BM_Lz1KHighEntropy(benchmark::State& state) {
+  TestCachePayload(1000, 1000, CacheCodec::kLz, state);
+}
+
+static void BM_Deflate1MLowEntropy(benchmark::State& state) {
+  TestCachePayload(1000 * 1000, 1000, CacheCodec::kDeflate, state);
+}
+
+static void BM_Brotli1MLowEntropy(benchmark::State& state) {
+  TestCachePayload(1000 * 1000, 1000, CacheCodec::kBrotli, state);
+}
+
+static void BM_Lz1MLowEntropy(benchmark::State& state) {
+  TestCachePayload(1000 * 1000, 1000, CacheCodec::kLz, state);
+}
+
+static void BM_Deflate1KLowEntropy(benchmark::State& state) {
+  TestCachePayload(1000, 50, CacheCodec::kDeflate, state);
+}
+
+static void BM_Brotli1KLowEntropy(benchmark::State& state) {
+  TestCachePayload(1000, 50, CacheCodec::kBrotli, state);
+}
+
+static void BM_Lz1KLowEntropy(benchmark::State& state) {
+  TestCachePayload(1000, 50, CacheCodec::kLz, state);
+}
+
+// Small values that share structure with each other but not much within
+// themselves, like cached rewrite metadata, with and without a trained
+// dictionary.
+void TestMetadataPayload(CacheCodec::Type codec, bool train,
+                         benchmark::State& state) {
+  net_instaweb::SimpleRandom random(new net_instaweb::NullMutex);
+  std::vector<net_instaweb::SharedString> values;
+  for (int i = 0; i < 200; ++i) {
+    values.push_back(net_instaweb::SharedString(StrCat(
+        "{\"url\": \"http://www.example.com/",
+        random.GenerateHighEntropyString(8), "/photo.jpg\", ",
+        "\"content-type\": \"image/jpeg\", \"cache-control\": ",
+        "\"max-age=31536000, public\", \"hash\": \"",
+        random.GenerateHighEntropyString(10), "\", \"width\": 640, ",
+        "\"height\": 480, \"inlined\": false}")));
+  }
+  std::unique_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::SimpleStats stats(thread_system.get());
+  net_instaweb::CompressedCache::InitStats(&stats);
+  net_instaweb::LRUCache* lru_cache = new net_instaweb::LRUCache(1000 * 1000);
+  net_instaweb::CompressedCache compressed_cache(lru_cache, codec,
+                                                 thread_system.get(), &stats);
+  if (train) {
+    StopBenchmarkTiming();
+    compressed_cache.EnableDictionaryTraining(values.size(), 4096);
+    for (const net_instaweb::SharedString& value : values) {
+      compressed_cache.Put("sample", value);
+    }
+    StartBenchmarkTiming();
+  }
+  EmptyCallback empty_callback;
+  int64 bytes = 0;
+  for (int i = 0; i < state.iterations(); ++i) {
+    const net_instaweb::SharedString& value = values[i % values.size()];
+    compressed_cache.Put("key", value);
+    compressed_cache.Get("key", &empty_callback);
+    bytes += value.size();
+  }
+  state.SetBytesProcessed(bytes);
+}
+
+static void BM_DeflateMetadata(benchmark::State& state) {
+  TestMetadataPayload(CacheCodec::kDeflate, false, state);
 }
 
-static void BM_Compress1MHighEntropy(benchmark::State& state) {
-  TestCachePayload(1000 * 1000, 1000 * 1000, state.iterations());
+static void BM_DeflateMetadataDictionary(benchmark::State& state) {
+  TestMetadataPayload(CacheCodec::kDeflate, true, state);
 }
 
-static void BM_Compress1KHighEntropy(benchmark::State& state) {
-  TestCachePayload(1000, 1000, state.iterations());
+static void BM_BrotliMetadata(benchmark::State& state) {
+  TestMetadataPayload(CacheCodec::kBrotli, false, state);
 }
 
-static void BM_Compress1MLowEntropy(benchmark::State& state) {
-  TestCachePayload(1000 * 1000, 1000, state.iterations());
+static void BM_LzMetadata(benchmark::State& state) {
+  TestMetadataPayload(CacheCodec::kLz, false, state);
 }
 
-static void BM_Compress1KLowEntropy(benchmark::State& state) {
-  TestCachePayload(1000, 50, state.iterations());
+static void BM_LzMetadataDictionary(benchmark::State& state) {
+  TestMetadataPayload(CacheCodec::kLz, true, state);
 }
 
 }  // namespace
 
-BENCHMARK(BM_Compress1MHighEntropy);
-BENCHMARK(BM_Compress1KHighEntropy);
-BENCHMARK(BM_Compress1MLowEntropy);
-BENCHMARK(BM_Compress1KLowEntropy);
+BENCHMARK(BM_Deflate1MHighEntropy);
+BENCHMARK(BM_Brotli1MHighEntropy);
+BENCHMARK(BM_Lz1MHighEntropy);
+BENCHMARK(BM_Deflate1KHighEntropy);
+BENCHMARK(BM_Brotli1KHighEntropy);
+BENCHMARK(BM_Lz1KHighEntropy);
+BENCHMARK(BM_Deflate1MLowEntropy);
+BENCHMARK(BM_Brotli1MLowEntropy);
+BENCHMARK(BM_Lz1MLowEntropy);
+BENCHMARK(BM_Deflate1KLowEntropy);
+BENCHMARK(BM_Brotli1KLowEntropy);
+BENCHMARK(BM_Lz1KLowEntropy);
+BENCHMARK(BM_DeflateMetadata);
+BENCHMARK(BM_DeflateMetadataDictionary);
+BENCHMARK(BM_BrotliMetadata);
+BENCHMARK(BM_LzMetadata);
+BENCHMARK(BM_LzMetadataDictionary);
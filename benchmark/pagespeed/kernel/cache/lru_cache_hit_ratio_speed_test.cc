@@ -0,0 +1,168 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Replays a synthetic request trace against LRUCache with and without the
+// W-TinyLFU admission policy, and logs the hit ratio of each.
+//
+// The trace draws kTraceLength keys from a Zipfian distribution (s = 0.9)
+// over kNumKeys keys, with the cache sized for kCacheEntries of them.
+// Every kScanInterval requests a burst of kScanLength never-repeated keys
+// is interleaved, as a crawler or a purge storm would.  Each request is a
+// Get, followed by a Put on a miss.  "Zipf hits" only counts the Zipfian
+// requests, which is what users see; the scan keys can never hit.
+//
+// Benchmark              Zipf hits   Overall hits
+// -----------------------------------------------
+// LRUHitRatioPlain          46.2%        39.2%
+// LRUHitRatioAdmission      56.3%        47.7%
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/util/simple_random.h"
+// clang-format off
+#include "benchmark/benchmark.h"
+// clang-format on
+
+namespace {
+
+const int kNumKeys = 50000;
+const int kCacheEntries = 2000;
+const int kTraceLength = 500000;
+const int kScanInterval = 50000;
+const int kScanLength = 10000;
+const double kZipfExponent = 0.9;
+const int kValueSize = 100;
+
+// Key indices at or above kNumKeys are scan keys.
+class Trace {
+ public:
+  Trace() : random_(new net_instaweb::NullMutex) {
+    std::vector<double> cdf(kNumKeys);
+    double sum = 0;
+    for (int k = 0; k < kNumKeys; ++k) {
+      sum += 1.0 / std::pow(k + 1, kZipfExponent);
+      cdf[k] = sum;
+    }
+    int next_scan_key = kNumKeys;
+    for (int i = 0; i < kTraceLength; ++i) {
+      if ((i > 0) && ((i % kScanInterval) == 0)) {
+        for (int j = 0; j < kScanLength; ++j) {
+          requests_.push_back(next_scan_key++);
+        }
+      }
+      double target = sum * random_.Next() / 4294967296.0;
+      requests_.push_back(
+          std::lower_bound(cdf.begin(), cdf.end(), target) - cdf.begin());
+    }
+    for (int k = 0; k < next_scan_key; ++k) {
+      keys_.push_back(StrCat("http://example.com/resource/",
+                             net_instaweb::IntegerToString(k)));
+    }
+  }
+
+  const std::vector<int>& requests() const { return requests_; }
+  const GoogleString& key(int index) const { return keys_[index]; }
+
+ private:
+  net_instaweb::SimpleRandom random_;
+  std::vector<int> requests_;
+  net_instaweb::StringVector keys_;
+
+  DISALLOW_COPY_AND_ASSIGN(Trace);
+};
+
+class HitCallback : public net_instaweb::CacheInterface::Callback {
+ public:
+  HitCallback() : hit_(false) {}
+  ~HitCallback() override {}
+  void Done(net_instaweb::CacheInterface::KeyState state) override {
+    hit_ = (state == net_instaweb::CacheInterface::kAvailable);
+  }
+  bool hit() const { return hit_; }
+
+ private:
+  bool hit_;
+
+  DISALLOW_COPY_AND_ASSIGN(HitCallback);
+};
+
+static void ReplayTrace(benchmark::State& state, bool admission_policy,
+                        const char* name) {
+  StopBenchmarkTiming();
+  Trace trace;
+  net_instaweb::SharedString value(GoogleString(kValueSize, 'v'));
+  int entry_size = trace.key(0).size() + kValueSize;
+  StartBenchmarkTiming();
+
+  int64 zipf_hits = 0, zipf_requests = 0, hits = 0, requests = 0;
+  for (int i = 0; i < state.iterations(); ++i) {
+    net_instaweb::LRUCache cache(kCacheEntries * entry_size);
+    if (admission_policy) {
+      cache.EnableAdmissionPolicy();
+    }
+    for (int index : trace.requests()) {
+      const GoogleString& key = trace.key(index);
+      HitCallback callback;
+      cache.Get(key, &callback);
+      if (callback.hit()) {
+        ++hits;
+      } else {
+        cache.Put(key, value);
+      }
+      ++requests;
+      if (index < kNumKeys) {
+        ++zipf_requests;
+        if (callback.hit()) {
+          ++zipf_hits;
+        }
+      }
+    }
+  }
+
+  LOG(INFO) << name << ": Zipf hits " << (100.0 * zipf_hits / zipf_requests)
+            << "%, overall hits " << (100.0 * hits / requests) << "%";
+}
+
+static void LRUHitRatioPlain(benchmark::State& state) {
+  ReplayTrace(state, false, "LRUHitRatioPlain");
+}
+
+static void LRUHitRatioAdmission(benchmark::State& state) {
+  ReplayTrace(state, true, "LRUHitRatioAdmission");
+}
+
+}  // namespace
+
+BENCHMARK(LRUHitRatioPlain);
+BENCHMARK(LRUHitRatioAdmission);
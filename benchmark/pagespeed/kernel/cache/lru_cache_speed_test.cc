@@ -30,10 +30,17 @@
 // LRUFailedGets         16068878   16000000        100
 // LRUEvictions         143558421  143200000        100
 //
+// The contention benchmarks run kNumContentionThreads threads doing a
+// 90/10 mix of Gets and Puts against one shared cache, comparing the
+// single-mutex ThreadsafeCache(LRUCache) with ShardedLRUCache.  Only
+// multi-core machines show the difference; on a single core the sharded
+// cache merely pays for its hashing.
+//
 // Disclaimer: comparing runs over time and across different machines
 // can be misleading.  When contemplating an algorithm change, always do
 // interleaved runs with the old & new algorithm.
 
+#include <memory>
 #include <vector>
 
 #include "base/logging.h"
@@ -43,7 +50,12 @@
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
+#include "pagespeed/kernel/cache/threadsafe_cache.h"
+#include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/util/simple_random.h"
 // clang-format off
 #include "benchmark/benchmark.h"
@@ -192,8 +204,103 @@ static void LRUEvictions(benchmark::State& state) {
   CHECK_LT(0, static_cast<int>(payload.lru_cache()->num_evictions()));
 }
 
+const int kNumContentionThreads = 16;
+const int kContentionOpsPerThread = 20000;
+const int kContentionShards = 16;
+
+// Hammers a shared cache with Gets, and an occasional Put, over a shared
+// set of keys.
+class ContentionThread : public net_instaweb::ThreadSystem::Thread {
+ public:
+  ContentionThread(net_instaweb::ThreadSystem* thread_system,
+                   net_instaweb::CacheInterface* cache,
+                   const net_instaweb::StringVector* keys,
+                   const std::vector<net_instaweb::SharedString>* values,
+                   int index)
+      : Thread(thread_system, "contention",
+               net_instaweb::ThreadSystem::kJoinable),
+        cache_(cache),
+        keys_(keys),
+        values_(values),
+        index_(index) {}
+
+ protected:
+  void Run() override {
+    int num_keys = keys_->size();
+    // Stride through the keys from a per-thread starting point so threads
+    // do not touch the same key in lock-step.
+    int k = (index_ * 7919) % num_keys;
+    for (int i = 0; i < kContentionOpsPerThread; ++i) {
+      if ((i % 10) == 0) {
+        cache_->Put((*keys_)[k], (*values_)[k]);
+      } else {
+        cache_->Get((*keys_)[k], &empty_callback_);
+      }
+      k = (k + 31) % num_keys;
+    }
+  }
+
+ private:
+  net_instaweb::CacheInterface* cache_;
+  const net_instaweb::StringVector* keys_;
+  const std::vector<net_instaweb::SharedString>* values_;
+  int index_;
+  EmptyCallback empty_callback_;
+
+  DISALLOW_COPY_AND_ASSIGN(ContentionThread);
+};
+
+static void RunContention(benchmark::State& state,
+                          net_instaweb::ThreadSystem* thread_system,
+                          net_instaweb::CacheInterface* cache) {
+  StopBenchmarkTiming();
+  net_instaweb::SimpleRandom random(new net_instaweb::NullMutex);
+  GoogleString value_prefix = random.GenerateHighEntropyString(kPayloadSize);
+  net_instaweb::StringVector keys(kNumKeys);
+  std::vector<net_instaweb::SharedString> values(kNumKeys);
+  for (int k = 0; k < kNumKeys; ++k) {
+    keys[k] = StrCat(random.GenerateHighEntropyString(kKeySize),
+                     net_instaweb::IntegerToString(k));
+    values[k].Assign(value_prefix);
+    cache->Put(keys[k], values[k]);
+  }
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < state.iterations(); ++i) {
+    std::vector<std::unique_ptr<ContentionThread>> threads;
+    for (int t = 0; t < kNumContentionThreads; ++t) {
+      threads.emplace_back(
+          new ContentionThread(thread_system, cache, &keys, &values, t));
+      CHECK(threads.back()->Start());
+    }
+    for (const auto& thread : threads) {
+      thread->Join();
+    }
+  }
+}
+
+static void LRUContentionThreadsafe(benchmark::State& state) {
+  std::unique_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::LRUCache lru_cache((kKeySize + kPayloadSize) * kNumKeys * 2);
+  net_instaweb::ThreadsafeCache cache(&lru_cache, thread_system->NewMutex());
+  RunContention(state, thread_system.get(), &cache);
+}
+
+static void LRUContentionSharded(benchmark::State& state) {
+  std::unique_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::ShardedLRUCache cache(
+      (kKeySize + kPayloadSize) * kNumKeys * 2, kContentionShards,
+      thread_system.get());
+  RunContention(state, thread_system.get(), &cache);
+}
+
 }  // namespace
 
+BENCHMARK(LRUContentionThreadsafe);
+BENCHMARK(LRUContentionSharded);
+
 // TODO(XXX): this leaks and crashes. look into that.
 //BENCHMARK(LRUPuts);
 //BENCHMARK(LRUReplaceSameValue);
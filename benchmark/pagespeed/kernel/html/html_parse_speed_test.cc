@@ -26,6 +26,15 @@
 // BM_ParseAndSerializeReuseParser           433498     436118       1628
 // BM_ParseAndSerializeReuseParserX50      22954185   22900000        100
 //
+// BM_ParseAndSerializeReuseParserX50NoFastScan runs the same workload with
+// the lexer's vectorized skipping of inert text disabled; compare the
+// bytes/sec reported for the two to see the effect of HtmlLexerScan.
+//
+// BM_ParseAndSerializeFlushEvery4K parses the same text but flushes after
+// every 4KB, as a server streaming a response would, so that events and
+// attributes turn over once per flush window.  The NoObjectPool variant
+// sends those allocations to the heap rather than HtmlObjectPool.
+//
 // Disclaimer: comparing runs over time and across different machines
 // can be misleading.  When contemplating an algorithm change, always do
 // interleaved runs with the old & new algorithm.
@@ -139,7 +148,10 @@ static void BM_ParseAndSerializeReuseParser(benchmark::State& state) {
 }
 BENCHMARK(BM_ParseAndSerializeReuseParser);
 
-static void BM_ParseAndSerializeReuseParserX50(benchmark::State& state) {
+// Parses ~1.5M of HTML repeatedly with one parser, reporting throughput.
+// fast_scan controls whether the lexer skips over runs of inert text with
+// vectorized scans or dispatches every byte through its state machine.
+void ParseAndSerializeX50(benchmark::State& state, bool fast_scan) {
   StopBenchmarkTiming();
   StringPiece orig = GetHtmlText();
   if (orig.empty()) {
@@ -158,6 +170,7 @@ static void BM_ParseAndSerializeReuseParserX50(benchmark::State& state) {
   HtmlWriterFilter writer_filter(&parser);
   parser.AddFilter(&writer_filter);
   writer_filter.set_writer(&writer);
+  parser.set_lexer_fast_scan_enabled(fast_scan);
 
   StartBenchmarkTiming();
   for (int i = 0; i < state.iterations(); ++i) {
@@ -165,9 +178,64 @@ static void BM_ParseAndSerializeReuseParserX50(benchmark::State& state) {
     parser.ParseText(text);
     parser.FinishParse();
   }
+  state.SetBytesProcessed(static_cast<int64>(state.iterations()) *
+                          text.size());
+}
+
+static void BM_ParseAndSerializeReuseParserX50(benchmark::State& state) {
+  ParseAndSerializeX50(state, true);
 }
 BENCHMARK(BM_ParseAndSerializeReuseParserX50);
 
+static void BM_ParseAndSerializeReuseParserX50NoFastScan(
+    benchmark::State& state) {
+  ParseAndSerializeX50(state, false);
+}
+BENCHMARK(BM_ParseAndSerializeReuseParserX50NoFastScan);
+
+// Parses the text in 4KB pieces, flushing after each one.  object_pool
+// controls whether events, event-list nodes and attributes are recycled
+// through the parser's HtmlObjectPool or allocated from the heap.
+void ParseAndSerializeFlushing(benchmark::State& state, bool object_pool) {
+  StopBenchmarkTiming();
+  StringPiece text = GetHtmlText();
+  if (text.empty()) {
+    return;
+  }
+  static const size_t kFlushBytes = 4096;
+
+  NullWriter writer;
+  NullMessageHandler handler;
+  HtmlParse parser(&handler);
+  HtmlWriterFilter writer_filter(&parser);
+  parser.AddFilter(&writer_filter);
+  writer_filter.set_writer(&writer);
+  parser.set_object_pool_enabled(object_pool);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < state.iterations(); ++i) {
+    parser.StartParse("http://example.com/benchmark");
+    for (size_t pos = 0; pos < text.size(); pos += kFlushBytes) {
+      parser.ParseText(text.substr(pos, kFlushBytes));
+      parser.Flush();
+    }
+    parser.FinishParse();
+  }
+  state.SetBytesProcessed(static_cast<int64>(state.iterations()) *
+                          text.size());
+}
+
+static void BM_ParseAndSerializeFlushEvery4K(benchmark::State& state) {
+  ParseAndSerializeFlushing(state, true);
+}
+BENCHMARK(BM_ParseAndSerializeFlushEvery4K);
+
+static void BM_ParseAndSerializeFlushEvery4KNoObjectPool(
+    benchmark::State& state) {
+  ParseAndSerializeFlushing(state, false);
+}
+BENCHMARK(BM_ParseAndSerializeFlushEvery4KNoObjectPool);
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -0,0 +1,262 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Compares the two SharedMemCache directory layouts: 4-way skew associative,
+// and 16-way buckets probed through key tags.
+//
+// The HitRatio benchmarks replay a synthetic trace and log the hit ratio.
+// The trace draws keys from a Zipfian distribution (s = 0.9) over kNumKeys
+// keys, with the directory having kCacheEntries entries in kSectors sectors
+// and enough blocks that only directory conflicts cause evictions.  Every
+// kScanInterval requests a burst of kScanLength never-repeated keys churns
+// the directory.  Each request is a Get, followed by a Put on a miss.
+//
+// The Get benchmarks time lookups of kLookupKeys keys, all inserted for
+// GetHit and all absent for GetMiss, in a directory kept half full.
+//
+// Benchmark                 ns/Get    Hits
+// ----------------------------------------
+// HitRatioSkewAssociative             52.8%
+// HitRatioTaggedBuckets               53.1%
+// GetHitSkewAssociative       343     98.8%
+// GetHitTaggedBuckets         343    100.0%
+// GetMissSkewAssociative      209
+// GetMissTaggedBuckets        197
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/sharedmem/inprocess_shared_mem.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_random.h"
+#include "test/pagespeed/kernel/base/mock_timer.h"
+// clang-format off
+#include "benchmark/benchmark.h"
+// clang-format on
+
+namespace {
+
+typedef net_instaweb::SharedMemCache<64> ShmCache;
+
+const char kSegment[] = "shm_cache_speed_test";
+const int kSectors = 4;
+const int kCacheEntries = 8192;
+const int kBlocksPerEntry = 4;
+const int kValueSize = 100;
+
+const int kNumKeys = 50000;
+const int kTraceLength = 300000;
+const int kScanInterval = 30000;
+const int kScanLength = 5000;
+const double kZipfExponent = 0.9;
+
+const int kLookupKeys = kCacheEntries / 2;
+
+GoogleString Key(int index) {
+  return StrCat("http://example.com/resource/",
+                net_instaweb::IntegerToString(index));
+}
+
+class HitCallback : public net_instaweb::CacheInterface::Callback {
+ public:
+  HitCallback() : hit_(false) {}
+  ~HitCallback() override {}
+  void Done(net_instaweb::CacheInterface::KeyState state) override {
+    hit_ = (state == net_instaweb::CacheInterface::kAvailable);
+  }
+  bool hit() const { return hit_; }
+
+ private:
+  bool hit_;
+
+  DISALLOW_COPY_AND_ASSIGN(HitCallback);
+};
+
+// A freshly formatted cache, with its own shared memory.
+class CacheHolder {
+ public:
+  explicit CacheHolder(ShmCache::DirectoryLayout layout)
+      : thread_system_(net_instaweb::Platform::CreateThreadSystem()),
+        shm_(thread_system_.get()),
+        timer_(new net_instaweb::NullMutex, 1) {
+    cache_.reset(new ShmCache(&shm_, kSegment, &timer_, &hasher_, kSectors,
+                              kCacheEntries / kSectors,
+                              kCacheEntries * kBlocksPerEntry / kSectors,
+                              &handler_));
+    cache_->set_directory_layout(layout);
+    CHECK(cache_->Initialize());
+  }
+
+  ~CacheHolder() {
+    cache_.reset();
+    ShmCache::GlobalCleanup(&shm_, kSegment, &handler_);
+  }
+
+  ShmCache* cache() { return cache_.get(); }
+  net_instaweb::MockTimer* timer() { return &timer_; }
+
+ private:
+  std::unique_ptr<net_instaweb::ThreadSystem> thread_system_;
+  net_instaweb::InProcessSharedMem shm_;
+  net_instaweb::MockTimer timer_;
+  net_instaweb::MD5Hasher hasher_;
+  net_instaweb::NullMessageHandler handler_;
+  std::unique_ptr<ShmCache> cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(CacheHolder);
+};
+
+// Key indices at or above kNumKeys are scan keys.
+std::vector<int> ZipfTraceWithScans() {
+  net_instaweb::SimpleRandom random(new net_instaweb::NullMutex);
+  std::vector<double> cdf(kNumKeys);
+  double sum = 0;
+  for (int k = 0; k < kNumKeys; ++k) {
+    sum += 1.0 / std::pow(k + 1, kZipfExponent);
+    cdf[k] = sum;
+  }
+  std::vector<int> requests;
+  int next_scan_key = kNumKeys;
+  for (int i = 0; i < kTraceLength; ++i) {
+    if ((i > 0) && ((i % kScanInterval) == 0)) {
+      for (int j = 0; j < kScanLength; ++j) {
+        requests.push_back(next_scan_key++);
+      }
+    }
+    double target = sum * random.Next() / 4294967296.0;
+    requests.push_back(std::lower_bound(cdf.begin(), cdf.end(), target) -
+                       cdf.begin());
+  }
+  return requests;
+}
+
+void ReplayTrace(benchmark::State& state, ShmCache::DirectoryLayout layout,
+                 const char* name) {
+  StopBenchmarkTiming();
+  std::vector<int> requests = ZipfTraceWithScans();
+  net_instaweb::StringVector keys;
+  for (int index : requests) {
+    keys.push_back(Key(index));
+  }
+  net_instaweb::SharedString value(GoogleString(kValueSize, 'v'));
+  StartBenchmarkTiming();
+
+  int64 hits = 0, total = 0;
+  for (int i = 0; i < state.iterations(); ++i) {
+    StopBenchmarkTiming();
+    CacheHolder holder(layout);
+    StartBenchmarkTiming();
+    for (const GoogleString& key : keys) {
+      holder.timer()->AdvanceMs(1);
+      HitCallback callback;
+      holder.cache()->Get(key, &callback);
+      if (callback.hit()) {
+        ++hits;
+      } else {
+        holder.cache()->Put(key, value);
+      }
+      ++total;
+    }
+  }
+  LOG(INFO) << name << ": hits " << (100.0 * hits / total) << "%";
+}
+
+void TimeGets(benchmark::State& state, ShmCache::DirectoryLayout layout,
+              bool present) {
+  StopBenchmarkTiming();
+  CacheHolder holder(layout);
+  net_instaweb::SharedString value(GoogleString(kValueSize, 'v'));
+  net_instaweb::StringVector keys;
+  for (int k = 0; k < kLookupKeys; ++k) {
+    keys.push_back(Key(k));
+    holder.timer()->AdvanceMs(1);
+    holder.cache()->Put(keys.back(), value);
+  }
+  if (!present) {
+    for (int k = 0; k < kLookupKeys; ++k) {
+      keys[k] = Key(kLookupKeys + k);
+    }
+  }
+  StartBenchmarkTiming();
+
+  int64 hits = 0;
+  for (int i = 0; i < state.iterations(); ++i) {
+    for (const GoogleString& key : keys) {
+      HitCallback callback;
+      holder.cache()->Get(key, &callback);
+      hits += callback.hit();
+    }
+  }
+  if (!present) {
+    CHECK_EQ(0, hits);
+  }
+  LOG(INFO) << (present ? "GetHit" : "GetMiss") << ": hits "
+            << (100.0 * hits / (state.iterations() * kLookupKeys)) << "%";
+}
+
+static void HitRatioSkewAssociative(benchmark::State& state) {
+  ReplayTrace(state, ShmCache::kSkewAssociative, "HitRatioSkewAssociative");
+}
+
+static void HitRatioTaggedBuckets(benchmark::State& state) {
+  ReplayTrace(state, ShmCache::kTaggedBuckets, "HitRatioTaggedBuckets");
+}
+
+static void GetHitSkewAssociative(benchmark::State& state) {
+  TimeGets(state, ShmCache::kSkewAssociative, true);
+}
+
+static void GetHitTaggedBuckets(benchmark::State& state) {
+  TimeGets(state, ShmCache::kTaggedBuckets, true);
+}
+
+static void GetMissSkewAssociative(benchmark::State& state) {
+  TimeGets(state, ShmCache::kSkewAssociative, false);
+}
+
+static void GetMissTaggedBuckets(benchmark::State& state) {
+  TimeGets(state, ShmCache::kTaggedBuckets, false);
+}
+
+}  // namespace
+
+BENCHMARK(HitRatioSkewAssociative);
+BENCHMARK(HitRatioTaggedBuckets);
+BENCHMARK(GetHitSkewAssociative);
+BENCHMARK(GetHitTaggedBuckets);
+BENCHMARK(GetMissSkewAssociative);
+BENCHMARK(GetMissTaggedBuckets);
@@ -0,0 +1,218 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Measures how fast QueuedWorkerPool can schedule tiny functions, with and
+// without work stealing, on a pool of kWorkers threads.
+//
+// ScheduleExternal*: the benchmark thread adds kFunctions functions,
+// round-robin, to kSequences sequences, as request threads do.
+//
+// ScheduleFromWorkers*: kChains functions each hop kHops times from one
+// sequence to another, adding the next hop from within the worker thread,
+// as cache callbacks and rewrite contexts do.
+//
+// Benchmark                      ms/iteration
+// -------------------------------------------
+// ScheduleExternalClassic                7.32
+// ScheduleExternalStealing               9.67
+// ScheduleFromWorkersClassic             2.30
+// ScheduleFromWorkersStealing            3.18
+//
+// These are medians of three runs on a single-CPU VM, where the pool's
+// threads only take turns and so never contend for locks or steal from
+// each other while running; the stealing runs varied by a factor of two.
+// The classic pool's Sequences keep their mutex-protected deque, and only
+// work-stealing pools use the lock-free Sequence queue, whose uncontended
+// Add takes about 55ns against 39ns for the deque.  Rerun this on a
+// multi-core machine before enabling work stealing in production.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/util/platform.h"
+// clang-format off
+#include "benchmark/benchmark.h"
+// clang-format on
+
+namespace {
+
+const int kWorkers = 4;
+const int kSequences = 64;
+const int kFunctions = 20000;
+const int kChains = 64;
+const int kHops = 300;
+
+// Lets the benchmark thread wait for a number of functions to run.  The
+// last function may still be unlocking the mutex after Wait returns, so a
+// Countdown is reused across iterations rather than destroyed.
+class Countdown {
+ public:
+  explicit Countdown(net_instaweb::ThreadSystem* thread_system)
+      : mutex_(thread_system->NewMutex()),
+        condvar_(mutex_->NewCondvar()),
+        remaining_(0),
+        done_(false) {}
+
+  void Reset(int count) {
+    net_instaweb::ScopedMutex lock(mutex_.get());
+    remaining_ = count;
+    done_ = false;
+  }
+
+  void Decrement() {
+    if (--remaining_ == 0) {
+      net_instaweb::ScopedMutex lock(mutex_.get());
+      done_ = true;
+      condvar_->Signal();
+    }
+  }
+
+  void Wait() {
+    net_instaweb::ScopedMutex lock(mutex_.get());
+    while (!done_) {
+      condvar_->Wait();
+    }
+  }
+
+ private:
+  std::unique_ptr<net_instaweb::ThreadSystem::CondvarCapableMutex> mutex_;
+  std::unique_ptr<net_instaweb::ThreadSystem::Condvar> condvar_;
+  std::atomic<int> remaining_;
+  bool done_;
+
+  DISALLOW_COPY_AND_ASSIGN(Countdown);
+};
+
+class Tick : public net_instaweb::Function {
+ public:
+  explicit Tick(Countdown* countdown) : countdown_(countdown) {}
+
+ protected:
+  void Run() override { countdown_->Decrement(); }
+
+ private:
+  Countdown* countdown_;
+
+  DISALLOW_COPY_AND_ASSIGN(Tick);
+};
+
+typedef std::vector<net_instaweb::QueuedWorkerPool::Sequence*> SequenceVector;
+
+// Adds its successor to the next sequence over, until it runs out of hops.
+class Hop : public net_instaweb::Function {
+ public:
+  Hop(const SequenceVector* sequences, int index, int hops_left,
+      Countdown* countdown)
+      : sequences_(sequences),
+        index_(index),
+        hops_left_(hops_left),
+        countdown_(countdown) {}
+
+ protected:
+  void Run() override {
+    if (hops_left_ == 0) {
+      countdown_->Decrement();
+    } else {
+      int next = (index_ + 1) % sequences_->size();
+      (*sequences_)[next]->Add(
+          new Hop(sequences_, next, hops_left_ - 1, countdown_));
+    }
+  }
+
+ private:
+  const SequenceVector* sequences_;
+  int index_;
+  int hops_left_;
+  Countdown* countdown_;
+
+  DISALLOW_COPY_AND_ASSIGN(Hop);
+};
+
+static void Schedule(benchmark::State& state, bool work_stealing,
+                     bool from_workers) {
+  StopBenchmarkTiming();
+  std::unique_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  Countdown countdown(thread_system.get());
+  net_instaweb::QueuedWorkerPool pool(kWorkers, "bench", thread_system.get());
+  if (work_stealing) {
+    pool.EnableWorkStealing();
+  }
+  SequenceVector sequences;
+  for (int i = 0; i < kSequences; ++i) {
+    sequences.push_back(pool.NewSequence());
+  }
+  StartBenchmarkTiming();
+
+  for (int i = 0; i < state.iterations(); ++i) {
+    if (from_workers) {
+      countdown.Reset(kChains);
+      for (int c = 0; c < kChains; ++c) {
+        int index = c % kSequences;
+        sequences[index]->Add(new Hop(&sequences, index, kHops, &countdown));
+      }
+      countdown.Wait();
+    } else {
+      countdown.Reset(kFunctions);
+      for (int f = 0; f < kFunctions; ++f) {
+        sequences[f % kSequences]->Add(new Tick(&countdown));
+      }
+      countdown.Wait();
+    }
+  }
+
+  StopBenchmarkTiming();
+  pool.ShutDown();
+  StartBenchmarkTiming();
+}
+
+static void ScheduleExternalClassic(benchmark::State& state) {
+  Schedule(state, false, false);
+}
+
+static void ScheduleExternalStealing(benchmark::State& state) {
+  Schedule(state, true, false);
+}
+
+static void ScheduleFromWorkersClassic(benchmark::State& state) {
+  Schedule(state, false, true);
+}
+
+static void ScheduleFromWorkersStealing(benchmark::State& state) {
+  Schedule(state, true, true);
+}
+
+}  // namespace
+
+BENCHMARK(ScheduleExternalClassic);
+BENCHMARK(ScheduleExternalStealing);
+BENCHMARK(ScheduleFromWorkersClassic);
+BENCHMARK(ScheduleFromWorkersStealing);
@@ -0,0 +1,181 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//
+// Measures contended increments of a single statistics Variable from
+// kThreads threads, each adding 1 kAddsPerThread times, as request threads
+// bump hot counters like cache hits.
+//
+// Mutexed: the previous SimpleStats implementation, a scalar guarded by a
+// mutex.
+// Atomic: a single std::atomic<int64>, for comparison.
+// Sharded: SimpleStats, which adds to per-thread shards.
+//
+// Benchmark                      ms/iteration
+// -------------------------------------------
+// Mutexed                               16.6
+// Atomic                                 9.0
+// Sharded                                8.6
+//
+// These were measured on a single-CPU VM, where the threads take turns and
+// never actually contend for the cache line, so they only show the fixed
+// cost of each scheme.  Sharded was 12.3 when Add summed the shards to
+// return the new total; it now returns just the delta.  The point of
+// sharding is that on a multi-core machine the adds stop serializing on one
+// lock or one cache line; rerun this there before drawing conclusions.
+//
+// Disclaimer: comparing runs over time and across different machines
+// can be misleading.  When contemplating an algorithm change, always do
+// interleaved runs with the old & new algorithm.
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+// clang-format off
+#include "benchmark/benchmark.h"
+// clang-format on
+
+namespace {
+
+const int kThreads = 8;
+const int kAddsPerThread = 100000;
+
+class MutexedVariable : public net_instaweb::Variable {
+ public:
+  explicit MutexedVariable(net_instaweb::AbstractMutex* mutex)
+      : mutex_(mutex), value_(0) {}
+
+  int64 Get() const override {
+    net_instaweb::ScopedMutex lock(mutex_.get());
+    return value_;
+  }
+  StringPiece GetName() const override { return StringPiece(); }
+  void Clear() override {
+    net_instaweb::ScopedMutex lock(mutex_.get());
+    value_ = 0;
+  }
+
+ protected:
+  int64 AddHelper(int64 delta) override {
+    net_instaweb::ScopedMutex lock(mutex_.get());
+    value_ += delta;
+    return value_;
+  }
+
+ private:
+  std::unique_ptr<net_instaweb::AbstractMutex> mutex_;
+  int64 value_;
+
+  DISALLOW_COPY_AND_ASSIGN(MutexedVariable);
+};
+
+class AtomicVariable : public net_instaweb::Variable {
+ public:
+  AtomicVariable() : value_(0) {}
+
+  int64 Get() const override { return value_.load(); }
+  StringPiece GetName() const override { return StringPiece(); }
+  void Clear() override { value_.store(0); }
+
+ protected:
+  int64 AddHelper(int64 delta) override { return value_ += delta; }
+
+ private:
+  std::atomic<int64> value_;
+
+  DISALLOW_COPY_AND_ASSIGN(AtomicVariable);
+};
+
+class AddThread : public net_instaweb::ThreadSystem::Thread {
+ public:
+  AddThread(net_instaweb::ThreadSystem* thread_system,
+            net_instaweb::Variable* var)
+      : Thread(thread_system, "add", net_instaweb::ThreadSystem::kJoinable),
+        var_(var) {}
+
+  void Run() override {
+    for (int i = 0; i < kAddsPerThread; ++i) {
+      var_->Add(1);
+    }
+  }
+
+ private:
+  net_instaweb::Variable* var_;
+
+  DISALLOW_COPY_AND_ASSIGN(AddThread);
+};
+
+static void ContendedAdds(benchmark::State& state,
+                          net_instaweb::ThreadSystem* thread_system,
+                          net_instaweb::Variable* var) {
+  for (int iter = 0; iter < state.iterations(); ++iter) {
+    std::vector<std::unique_ptr<AddThread>> threads;
+    for (int i = 0; i < kThreads; ++i) {
+      threads.emplace_back(new AddThread(thread_system, var));
+      CHECK(threads.back()->Start());
+    }
+    for (int i = 0; i < kThreads; ++i) {
+      threads[i]->Join();
+    }
+  }
+  CHECK_EQ(state.iterations() * kThreads * kAddsPerThread, var->Get());
+}
+
+static void Mutexed(benchmark::State& state) {
+  StopBenchmarkTiming();
+  std::unique_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  MutexedVariable var(thread_system->NewMutex());
+  StartBenchmarkTiming();
+  ContendedAdds(state, thread_system.get(), &var);
+}
+
+static void Atomic(benchmark::State& state) {
+  StopBenchmarkTiming();
+  std::unique_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  AtomicVariable var;
+  StartBenchmarkTiming();
+  ContendedAdds(state, thread_system.get(), &var);
+}
+
+static void Sharded(benchmark::State& state) {
+  StopBenchmarkTiming();
+  std::unique_ptr<net_instaweb::ThreadSystem> thread_system(
+      net_instaweb::Platform::CreateThreadSystem());
+  net_instaweb::SimpleStats stats(thread_system.get());
+  net_instaweb::Variable* var = stats.AddVariable("var");
+  StartBenchmarkTiming();
+  ContendedAdds(state, thread_system.get(), var);
+}
+
+BENCHMARK(Mutexed);
+BENCHMARK(Atomic);
+BENCHMARK(Sharded);
+
+}  // namespace
@@ -22,6 +22,7 @@
 #include "base/logging.h"
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/async_fetch_with_lock.h"
+#include "net/instaweb/http/public/fetch_coalescer.h"
 #include "net/instaweb/http/public/http_cache.h"
 #include "net/instaweb/http/public/http_value.h"
 #include "net/instaweb/http/public/http_value_writer.h"
@@ -190,41 +191,116 @@ class CachePutFetch : public SharedAsyncFetch {
   DISALLOW_COPY_AND_ASSIGN(CachePutFetch);
 };
 
-class CacheFindCallback : public HTTPCache::Callback {
+// Wraps base_fetch so that the origin's response is written to the cache and,
+// when cached_value holds a previous response, so that the origin is asked to
+// revalidate it rather than resend it.
+AsyncFetch* WrapCachePutFetchAndConditionalFetch(
+    const GoogleString& url, const GoogleString& fragment,
+    AsyncFetch* base_fetch, HTTPValue* cached_value,
+    ResponseHeaders::VaryOption respect_vary, bool default_cache_html,
+    HTTPCache* cache, Histogram* backend_first_byte_latency,
+    Variable* num_conditional_refreshes, MessageHandler* handler) {
+  CachePutFetch* put_fetch = new CachePutFetch(
+      url, fragment, base_fetch, respect_vary, default_cache_html, cache,
+      backend_first_byte_latency, handler);
+
+  // Remove any Etags added by us before sending the request out. This is the
+  // etags generated by server and upstream original code would not
+  // understand them.
+  RequestHeaders* request_headers = put_fetch->request_headers();
+  const char* etag = request_headers->Lookup1(HttpAttributes::kIfNoneMatch);
+  if (etag != nullptr && StringCaseStartsWith(etag, HTTPCache::kEtagPrefix)) {
+    request_headers->RemoveAll(HttpAttributes::kIfNoneMatch);
+  }
+
+  ConditionalSharedAsyncFetch* conditional_fetch =
+      new ConditionalSharedAsyncFetch(put_fetch, cached_value, handler);
+  conditional_fetch->set_num_conditional_refreshes(num_conditional_refreshes);
+  return conditional_fetch;
+}
+
+// Refreshes a cached response off the request path.  The CacheFindCallback
+// that creates it is deleted as soon as the request has been answered, while
+// the refresh may only start once its sequence or its lock gets to it, so it
+// owns everything it needs: its request headers, a reference to the stale
+// value it revalidates, and the cache settings of the CacheUrlAsyncFetcher.
+//
+// Concurrent refreshes of a URL are collapsed by the AsyncFetchWithLock lock.
+// The lock is named from the URL just as CacheableResourceBase names the lock
+// for its fetches, so a refresh here also yields to a rewrite's freshen of the
+// same input (and vice versa); whichever wins writes the HTTP cache that the
+// other then reads.
+class BackgroundFreshenFetch : public AsyncFetchWithLock {
  public:
-  class BackgroundFreshenFetch : public AsyncFetchWithLock {
-   public:
-    explicit BackgroundFreshenFetch(
-        const Hasher* lock_hasher, const RequestContextPtr& request_context,
-        const GoogleString& url, NamedLockManager* lock_manager,
-        MessageHandler* message_handler, CacheFindCallback* callback,
-        CacheUrlAsyncFetcher::AsyncOpHooks* async_op_hooks)
-        : AsyncFetchWithLock(lock_hasher, request_context, url,
-                             url /* cache_key*/, lock_manager, message_handler),
-          callback_(callback),
-          async_op_hooks_(async_op_hooks) {
-      async_op_hooks_->StartAsyncOp();
+  BackgroundFreshenFetch(
+      const Hasher* lock_hasher, const RequestContextPtr& request_context,
+      const GoogleString& url, const GoogleString& fragment,
+      HTTPValue* stale_value, NamedLockManager* lock_manager,
+      HTTPCache* cache, ResponseHeaders::VaryOption respect_vary,
+      bool default_cache_html, Histogram* backend_first_byte_latency,
+      Variable* num_conditional_refreshes, MessageHandler* message_handler,
+      CacheUrlAsyncFetcher::AsyncOpHooks* async_op_hooks)
+      : AsyncFetchWithLock(lock_hasher, request_context, url,
+                           url /* cache_key*/, lock_manager, message_handler),
+        fragment_(fragment),
+        cache_(cache),
+        respect_vary_(respect_vary),
+        default_cache_html_(default_cache_html),
+        backend_first_byte_latency_(backend_first_byte_latency),
+        num_conditional_refreshes_(num_conditional_refreshes),
+        async_op_hooks_(async_op_hooks) {
+    if (stale_value != nullptr) {
+      stale_value_.Link(stale_value);
     }
+    async_op_hooks_->StartAsyncOp();
+  }
 
-    ~BackgroundFreshenFetch() override { async_op_hooks_->FinishAsyncOp(); }
+  ~BackgroundFreshenFetch() override { async_op_hooks_->FinishAsyncOp(); }
 
-    void StartFetch(UrlAsyncFetcher* fetcher,
-                    MessageHandler* handler) override {
-      AsyncFetch* fetch = callback_->WrapCachePutFetchAndConditionalFetch(this);
-      fetcher->Fetch(url(), handler, fetch);
+  // Starts the refresh on sequence, or right away if sequence is NULL.
+  void StartOn(Sequence* sequence, UrlAsyncFetcher* fetcher) {
+    if (sequence == nullptr) {
+      Start(fetcher);
+    } else {
+      sequence->Add(MakeFunction(this, &BackgroundFreshenFetch::StartQueued,
+                                 &BackgroundFreshenFetch::CancelQueued,
+                                 fetcher));
     }
+  }
+
+  void StartFetch(UrlAsyncFetcher* fetcher, MessageHandler* handler) override {
+    AsyncFetch* fetch = WrapCachePutFetchAndConditionalFetch(
+        url(), fragment_, this, &stale_value_, respect_vary_,
+        default_cache_html_, cache_, backend_first_byte_latency_,
+        num_conditional_refreshes_, handler);
+    fetcher->Fetch(url(), handler, fetch);
+  }
+
+  bool ShouldYieldToRedundantFetchInProgress() override { return true; }
 
-    bool ShouldYieldToRedundantFetchInProgress() override { return true; }
+  bool IsBackgroundFetch() const override { return true; }
 
-    bool IsBackgroundFetch() const override { return true; }
+ private:
+  void StartQueued(UrlAsyncFetcher* fetcher) { Start(fetcher); }
 
-   private:
-    CacheFindCallback* callback_;
-    CacheUrlAsyncFetcher::AsyncOpHooks* async_op_hooks_;
+  // The stale value has already been served, so a refresh the sequence
+  // sheds is simply dropped; the next request past expiry will try again.
+  void CancelQueued(UrlAsyncFetcher* fetcher) { delete this; }
+
+  GoogleString fragment_;
+  HTTPValue stale_value_;
+  HTTPCache* cache_;
+  ResponseHeaders::VaryOption respect_vary_;
+  bool default_cache_html_;
+  Histogram* backend_first_byte_latency_;
+  Variable* num_conditional_refreshes_;
+  CacheUrlAsyncFetcher::AsyncOpHooks* async_op_hooks_;
 
-    DISALLOW_COPY_AND_ASSIGN(BackgroundFreshenFetch);
-  };
+  DISALLOW_COPY_AND_ASSIGN(BackgroundFreshenFetch);
+};
 
+class CacheFindCallback : public HTTPCache::Callback {
+ public:
   CacheFindCallback(const Hasher* lock_hasher, NamedLockManager* lock_manager,
                     const GoogleString& url, const GoogleString& fragment,
                     AsyncFetch* base_fetch, CacheUrlAsyncFetcher* owner,
@@ -240,6 +316,8 @@ class CacheFindCallback : public HTTPCache::Callback {
         fragment_(fragment),
         async_op_hooks_(async_op_hooks),
         fetcher_(owner->fetcher()),
+        background_refresh_sequence_(owner->background_refresh_sequence()),
+        fetch_coalescer_(owner->fetch_coalescer()),
         backend_first_byte_latency_(
             owner->backend_first_byte_latency_histogram()),
         fallback_responses_served_(owner->fallback_responses_served()),
@@ -248,6 +326,7 @@ class CacheFindCallback : public HTTPCache::Callback {
         num_conditional_refreshes_(owner->num_conditional_refreshes()),
         num_proactively_freshen_user_facing_request_(
             owner->num_proactively_freshen_user_facing_request()),
+        num_coalesced_fetches_(owner->num_coalesced_fetches()),
         handler_(handler),
         http_options_(base_fetch->request_context()->options()),
         respect_vary_(ResponseHeaders::GetVaryOption(owner->respect_vary())),
@@ -367,19 +446,28 @@ class CacheFindCallback : public HTTPCache::Callback {
               // Serve stale content while revalidate in the background.
               break;
             }
+            if (JoinedInFlightFetch(&base_fetch)) {
+              // Another miss on this key is already fetching from the origin
+              // and will feed us its response.
+              break;
+            }
             if (serve_stale_if_fetch_error_) {
               // If fallback_http_value() is populated, use it in case the
               // fetch fails. Note that this is only populated if the
               // response in cache is stale.
               FallbackSharedAsyncFetch* fallback_fetch =
-                  new FallbackSharedAsyncFetch(base_fetch_,
+                  new FallbackSharedAsyncFetch(base_fetch,
                                                fallback_http_value(), handler_);
               fallback_fetch->set_fallback_responses_served(
                   fallback_responses_served_);
               base_fetch = fallback_fetch;
             }
 
-            base_fetch = WrapCachePutFetchAndConditionalFetch(base_fetch);
+            base_fetch = WrapCachePutFetchAndConditionalFetch(
+                url_, fragment_, base_fetch, fallback_http_value(),
+                respect_vary_, default_cache_html_, cache_,
+                backend_first_byte_latency_, num_conditional_refreshes_,
+                handler_);
           }
 
           fetcher_->Fetch(url_, handler_, base_fetch);
@@ -406,9 +494,35 @@ class CacheFindCallback : public HTTPCache::Callback {
   }
 
  private:
+  // If a fetch coalescer is configured and this miss can share an origin
+  // fetch, either attaches base_fetch_ to the fetch already in flight for
+  // its key and returns true, or makes *base_fetch the leader of a new
+  // flight, which the caller must send to the origin, and returns false.
+  bool JoinedInFlightFetch(AsyncFetch** base_fetch) {
+    if (fetch_coalescer_ == nullptr) {
+      return false;
+    }
+    GoogleString key = FetchCoalescer::CoalescingKey(
+        cache_->CompositeKey(url_, fragment_), *request_headers());
+    if (key.empty()) {
+      return false;
+    }
+    AsyncFetch* leader =
+        fetch_coalescer_->Join(key, url_, fetcher_, base_fetch_, handler_);
+    if (leader != nullptr) {
+      *base_fetch = leader;
+      return false;
+    }
+    VLOG(1) << "Coalesced with in-flight fetch: " << url_ << " ("
+            << fragment_ << ")";
+    if (num_coalesced_fetches_ != nullptr) {
+      num_coalesced_fetches_->Add(1);
+    }
+    return true;
+  }
+
   bool ServedStaleContentWhileRevalidate(AsyncFetch* base_fetch) {
-    if (serve_stale_while_revalidate_threshold_sec_ == 0 ||
-        fallback_http_value() == nullptr || fallback_http_value()->Empty()) {
+    if (fallback_http_value() == nullptr || fallback_http_value()->Empty()) {
       return false;
     }
     ResponseHeaders* response_headers = base_fetch->response_headers();
@@ -420,12 +534,19 @@ class CacheFindCallback : public HTTPCache::Callback {
     response_headers->ComputeCaching();
     const int64 expiry_ms = response_headers->CacheExpirationTimeMs();
     const int64 now_ms = cache_->timer()->NowMs();
+    // The origin's own stale-while-revalidate can widen the configured
+    // window, and must-revalidate / proxy-revalidate close it entirely.
+    // Note that it opens a window even when none is configured, so such
+    // origins get stale serving by default.
     const int64 serve_stale_threshold_ms =
-        serve_stale_while_revalidate_threshold_sec_ * 1000;
-    if (now_ms > expiry_ms + serve_stale_threshold_ms ||
+        HTTPCache::StaleWhileRevalidateWindowMs(
+            *response_headers,
+            serve_stale_while_revalidate_threshold_sec_ * Timer::kSecondMs);
+    if (serve_stale_threshold_ms == 0 ||
+        now_ms > expiry_ms + serve_stale_threshold_ms ||
         response_headers->IsHtmlLike()) {
       // Serve non-html request with fallback http value if resource
-      // was expired within serve_stale_while_revalidate_threshold_ms_.
+      // was expired within the stale-while-revalidate window.
       response_headers->Clear();
       return false;
     }
@@ -453,9 +574,11 @@ class CacheFindCallback : public HTTPCache::Callback {
   }
 
   void TriggerBackgroundFreshenFetch() {
-    AsyncFetchWithLock* fetch = new BackgroundFreshenFetch(
-        lock_hasher_, base_fetch_->request_context(), url_, lock_manager_,
-        handler_, this, async_op_hooks_);
+    BackgroundFreshenFetch* fetch = new BackgroundFreshenFetch(
+        lock_hasher_, base_fetch_->request_context(), url_, fragment_,
+        fallback_http_value(), lock_manager_, cache_, respect_vary_,
+        default_cache_html_, backend_first_byte_latency_,
+        num_conditional_refreshes_, handler_, async_op_hooks_);
     RequestHeaders* request_headers = fetch->request_headers();
     request_headers->CopyFrom(*base_fetch_->request_headers());
     DCHECK(request_headers->method() == RequestHeaders::kGet ||
@@ -464,7 +587,7 @@ class CacheFindCallback : public HTTPCache::Callback {
     // If so, actually send the GET request, since we don't want to be
     // trying to cache a HEAD response.
     request_headers->set_method(RequestHeaders::kGet);
-    fetch->Start(fetcher_);
+    fetch->StartOn(background_refresh_sequence_, fetcher_);
   }
 
   bool ShouldReturn304() const {
@@ -504,28 +627,6 @@ class CacheFindCallback : public HTTPCache::Callback {
         cache_->timer()->NowMs(), headers.http_options());
   }
 
-  AsyncFetch* WrapCachePutFetchAndConditionalFetch(AsyncFetch* base_fetch) {
-    CachePutFetch* put_fetch = new CachePutFetch(
-        url_, fragment_, base_fetch, respect_vary_, default_cache_html_, cache_,
-        backend_first_byte_latency_, handler_);
-    DCHECK_EQ(response_headers(), base_fetch_->response_headers());
-
-    // Remove any Etags added by us before sending the request out. This is the
-    // etags generated by server and upstream original code would not
-    // understand them.
-    const char* etag = request_headers()->Lookup1(HttpAttributes::kIfNoneMatch);
-    if (etag != nullptr && StringCaseStartsWith(etag, HTTPCache::kEtagPrefix)) {
-      put_fetch->request_headers()->RemoveAll(HttpAttributes::kIfNoneMatch);
-    }
-
-    ConditionalSharedAsyncFetch* conditional_fetch =
-        new ConditionalSharedAsyncFetch(put_fetch, fallback_http_value(),
-                                        handler_);
-    conditional_fetch->set_num_conditional_refreshes(
-        num_conditional_refreshes_);
-    return conditional_fetch;
-  }
-
   const Hasher* lock_hasher_;
   NamedLockManager* lock_manager_;
   const GoogleString url_;
@@ -535,11 +636,14 @@ class CacheFindCallback : public HTTPCache::Callback {
   GoogleString fragment_;
   CacheUrlAsyncFetcher::AsyncOpHooks* async_op_hooks_;
   UrlAsyncFetcher* fetcher_;
+  Sequence* background_refresh_sequence_;
+  FetchCoalescer* fetch_coalescer_;
   Histogram* backend_first_byte_latency_;
   Variable* fallback_responses_served_;
   Variable* fallback_responses_served_while_revalidate_;
   Variable* num_conditional_refreshes_;
   Variable* num_proactively_freshen_user_facing_request_;
+  Variable* num_coalesced_fetches_;
   MessageHandler* handler_;
 
   const HttpOptions http_options_;
@@ -569,11 +673,13 @@ CacheUrlAsyncFetcher::CacheUrlAsyncFetcher(const Hasher* lock_hasher,
       fragment_(fragment),
       fetcher_(fetcher),
       async_op_hooks_(async_op_hooks),
+      fetch_coalescer_(nullptr),
       backend_first_byte_latency_(nullptr),
       fallback_responses_served_(nullptr),
       fallback_responses_served_while_revalidate_(nullptr),
       num_conditional_refreshes_(nullptr),
       num_proactively_freshen_user_facing_request_(nullptr),
+      num_coalesced_fetches_(nullptr),
       respect_vary_(false),
       ignore_recent_fetch_failed_(false),
       serve_stale_if_fetch_error_(false),
@@ -581,7 +687,8 @@ CacheUrlAsyncFetcher::CacheUrlAsyncFetcher(const Hasher* lock_hasher,
       proactively_freshen_user_facing_request_(false),
       own_fetcher_(false),
       serve_stale_while_revalidate_threshold_sec_(0),
-      response_sequence_(nullptr) {}
+      response_sequence_(nullptr),
+      background_refresh_sequence_(nullptr) {}
 
 CacheUrlAsyncFetcher::~CacheUrlAsyncFetcher() {
   if (own_fetcher_) {
@@ -0,0 +1,263 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "net/instaweb/http/public/fetch_coalescer.h"
+
+#include <vector>
+
+#include "base/logging.h"
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/url_async_fetcher.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+
+namespace net_instaweb {
+
+const int64 FetchCoalescer::kDefaultMaxReplayBytes = 8 * 1024 * 1024;
+
+// Sits directly above the leader's own fetch, so that followers see the
+// response exactly as the leader's client does, after the fallback and
+// conditional-refresh handling in CacheUrlAsyncFetcher.
+class FetchCoalescer::LeaderFetch : public SharedAsyncFetch {
+ public:
+  LeaderFetch(const GoogleString& key, const GoogleString& url,
+              UrlAsyncFetcher* fetcher, AsyncFetch* base_fetch,
+              FetchCoalescer* coalescer, MessageHandler* handler,
+              ThreadSystem* thread_system)
+      : SharedAsyncFetch(base_fetch),
+        key_(key),
+        url_(url),
+        fetcher_(fetcher),
+        coalescer_(coalescer),
+        handler_(handler),
+        mutex_(thread_system->NewMutex()),
+        closed_(false),
+        headers_complete_(false) {}
+
+  ~LeaderFetch() override {}
+
+  // Queues fetch to be caught up with the response at the next event the
+  // leader receives.  Returns false if the flight no longer takes followers.
+  bool AddFollower(AsyncFetch* fetch) {
+    ScopedMutex lock(mutex_.get());
+    if (closed_) {
+      return false;
+    }
+    pending_.push_back(fetch);
+    return true;
+  }
+
+ protected:
+  void HandleHeadersComplete() override {
+    if (!IsShareable(*response_headers())) {
+      // Nobody has been sent anything yet, so the followers can still be
+      // fetched on their own.
+      CatchUp(true);
+      for (AsyncFetch* follower : followers_) {
+        fetcher_->Fetch(url_, handler_, follower);
+      }
+      followers_.clear();
+      SharedAsyncFetch::HandleHeadersComplete();
+      return;
+    }
+    CatchUp(false);
+    // Snapshot the headers before passing them on: the leader's fetch may
+    // edit or even detach them once it has seen them.
+    headers_ = std::make_unique<ResponseHeaders>(*response_headers());
+    headers_complete_ = true;
+    for (AsyncFetch* follower : followers_) {
+      SendHeaders(follower);
+    }
+    SharedAsyncFetch::HandleHeadersComplete();
+  }
+
+  bool HandleWrite(const StringPiece& content,
+                   MessageHandler* handler) override {
+    bool close = (static_cast<int64>(body_.size() + content.size()) >
+                  coalescer_->max_replay_bytes());
+    CatchUp(close);
+    if (close) {
+      // Nobody else can join, so there is nothing left to replay.
+      GoogleString().swap(body_);
+    } else {
+      content.AppendToString(&body_);
+    }
+    for (AsyncFetch* follower : followers_) {
+      follower->Write(content, handler);
+    }
+    return SharedAsyncFetch::HandleWrite(content, handler);
+  }
+
+  bool HandleFlush(MessageHandler* handler) override {
+    CatchUp(false);
+    for (AsyncFetch* follower : followers_) {
+      follower->Flush(handler);
+    }
+    return SharedAsyncFetch::HandleFlush(handler);
+  }
+
+  void HandleDone(bool success) override {
+    coalescer_->Unregister(key_, this);
+    CatchUp(true);
+    // AsyncFetch::Done has completed the headers by now, so every follower
+    // has been sent them.
+    for (AsyncFetch* follower : followers_) {
+      follower->Done(success);
+    }
+    SharedAsyncFetch::HandleDone(success);
+    delete this;
+  }
+
+ private:
+  // Moves the followers that joined since the last event into followers_,
+  // replaying the response so far to them.  Only the thread delivering the
+  // response calls this, so followers_, headers_ and body_ are not shared.
+  void CatchUp(bool close) {
+    std::vector<AsyncFetch*> joined;
+    {
+      ScopedMutex lock(mutex_.get());
+      closed_ |= close;
+      joined.swap(pending_);
+    }
+    for (AsyncFetch* follower : joined) {
+      if (headers_complete_) {
+        SendHeaders(follower);
+        if (!body_.empty()) {
+          follower->Write(body_, handler_);
+        }
+      }
+      followers_.push_back(follower);
+    }
+  }
+
+  void SendHeaders(AsyncFetch* follower) {
+    follower->response_headers()->CopyFrom(*headers_);
+    if (content_length_known()) {
+      follower->set_content_length(content_length());
+    }
+    follower->HeadersComplete();
+  }
+
+  const GoogleString key_;
+  const GoogleString url_;
+  UrlAsyncFetcher* fetcher_;
+  FetchCoalescer* coalescer_;
+  MessageHandler* handler_;
+
+  std::unique_ptr<AbstractMutex> mutex_;
+  std::vector<AsyncFetch*> pending_ GUARDED_BY(mutex_);
+  bool closed_ GUARDED_BY(mutex_);
+
+  std::vector<AsyncFetch*> followers_;
+  std::unique_ptr<ResponseHeaders> headers_;
+  bool headers_complete_;
+  GoogleString body_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeaderFetch);
+};
+
+FetchCoalescer::FetchCoalescer(ThreadSystem* thread_system)
+    : thread_system_(thread_system),
+      mutex_(thread_system->NewMutex()),
+      max_replay_bytes_(kDefaultMaxReplayBytes) {}
+
+FetchCoalescer::~FetchCoalescer() {}
+
+GoogleString FetchCoalescer::CoalescingKey(
+    StringPiece cache_key, const RequestHeaders& request_headers) {
+  if (request_headers.method() != RequestHeaders::kGet ||
+      request_headers.Has(HttpAttributes::kIfModifiedSince) ||
+      request_headers.Has(HttpAttributes::kIfNoneMatch) ||
+      request_headers.Has(HttpAttributes::kRange) ||
+      request_headers.Has(HttpAttributes::kAuthorization) ||
+      request_headers.Has(HttpAttributes::kCookie) ||
+      request_headers.Has(HttpAttributes::kCookie2)) {
+    return GoogleString();
+  }
+  return StrCat(
+      cache_key, "\n",
+      request_headers.LookupJoined(HttpAttributes::kAcceptEncoding));
+}
+
+bool FetchCoalescer::IsShareable(const ResponseHeaders& response_headers) {
+  // A response meant for one client, such as one starting a session, must
+  // not reach the others.
+  if (response_headers.Has(HttpAttributes::kSetCookie) ||
+      response_headers.Has(HttpAttributes::kSetCookie2)) {
+    return false;
+  }
+  ConstStringStarVector values;
+  response_headers.Lookup(HttpAttributes::kCacheControl, &values);
+  for (const GoogleString* value : values) {
+    // Also covers the private="field" form.
+    if (StringCaseStartsWith(*value, HttpAttributes::kPrivate) ||
+        StringCaseEqual(*value, HttpAttributes::kNoStore)) {
+      return false;
+    }
+  }
+
+  values.clear();
+  response_headers.Lookup(HttpAttributes::kVary, &values);
+  for (const GoogleString* value : values) {
+    // CoalescingKey covers Accept-Encoding, and only lets through requests
+    // without cookies.
+    if (!value->empty() &&
+        !StringCaseEqual(*value, HttpAttributes::kAcceptEncoding) &&
+        !StringCaseEqual(*value, HttpAttributes::kCookie) &&
+        !StringCaseEqual(*value, HttpAttributes::kCookie2)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AsyncFetch* FetchCoalescer::Join(const GoogleString& key,
+                                 const GoogleString& url,
+                                 UrlAsyncFetcher* fetcher, AsyncFetch* fetch,
+                                 MessageHandler* handler) {
+  DCHECK(!key.empty());
+  ScopedMutex lock(mutex_.get());
+  LeaderFetch*& leader = flights_[key];
+  if (leader != nullptr && leader->AddFollower(fetch)) {
+    return nullptr;
+  }
+  // Either there is no flight for key, or it has stopped taking followers;
+  // in the latter case the new flight replaces it in the map.
+  leader = new LeaderFetch(key, url, fetcher, fetch, this, handler,
+                           thread_system_);
+  return leader;
+}
+
+void FetchCoalescer::Unregister(const GoogleString& key, LeaderFetch* leader) {
+  ScopedMutex lock(mutex_.get());
+  FlightMap::iterator p = flights_.find(key);
+  if (p != flights_.end() && p->second == leader) {
+    flights_.erase(p);
+  }
+}
+
+int FetchCoalescer::NumFlights() const {
+  ScopedMutex lock(mutex_.get());
+  return flights_.size();
+}
+
+}  // namespace net_instaweb
@@ -118,6 +118,14 @@ bool HTTPCache::IsExpired(const ResponseHeaders& headers) {
   return IsExpired(headers, timer_->NowMs());
 }
 
+int64 HTTPCache::StaleWhileRevalidateWindowMs(const ResponseHeaders& headers,
+                                              int64 default_window_ms) {
+  if (headers.RequiresProxyRevalidation()) {
+    return 0;
+  }
+  return std::max(default_window_ms, headers.stale_while_revalidate_ms());
+}
+
 class HTTPCacheCallback : public CacheInterface::Callback {
  public:
   HTTPCacheCallback(const GoogleString& key, const GoogleString& fragment,
@@ -399,6 +407,8 @@ void HTTPCache::PutInternal(bool preserve_response_headers,
                             HTTPValue* value, ResponseHeaders* response_headers,
                             MessageHandler* handler) {
   HTTPValue working_value;
+  // The headers held by value, if we still know them.
+  const ResponseHeaders* value_headers = response_headers;
 
   // Check to see if the HTTPValue is worth gzipping.
   // TODO(jcrowell): investigate switching to mod_gzip from mod_deflate so that
@@ -415,6 +425,8 @@ void HTTPCache::PutInternal(bool preserve_response_headers,
       if (preserve_response_headers) {
         headers_copy.CopyFrom(*response_headers);
         headers_to_gzip = &headers_copy;
+      } else {
+        value_headers = nullptr;  // Reordered below even if gzip fails.
       }
 
       // Canonicalize header order so x-original-content-length is always
@@ -435,6 +447,7 @@ void HTTPCache::PutInternal(bool preserve_response_headers,
         // compressed, so we'll compress it and stick the new compressed version
         // in the cache.
         value = &working_value;
+        value_headers = headers_to_gzip;
       }
     }
   } else if ((compression_level_ == 0) && response_headers->IsGzipped()) {
@@ -448,10 +461,14 @@ void HTTPCache::PutInternal(bool preserve_response_headers,
     if (InflatingFetch::UnGzipValueIfCompressed(*value, headers_to_unzip,
                                                 &working_value, handler)) {
       value = &working_value;
+      value_headers = headers_to_unzip;
     }
   }
   // TODO(jcrowell): prevent the unzip-rezip flow when sending compressed data
   // directly to a client through InflatingFetch.
+  if (value_headers != nullptr) {
+    value->ShareDecodedHeaders(*value_headers);
+  }
   cache_->Put(CompositeKey(key, fragment), value->share());
   if (cache_time_us_ != nullptr) {
     int64 delta_us = timer_->NowUs() - start_us;
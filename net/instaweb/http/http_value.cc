@@ -20,10 +20,13 @@
 #include "net/instaweb/http/public/http_value.h"
 
 #include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/http/http.pb.h"
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/http/response_headers_parser.h"
 
@@ -48,6 +51,44 @@ namespace net_instaweb {
 
 class MessageHandler;
 
+namespace {
+
+// The headers passed to ShareDecodedHeaders, kept as an annotation on the
+// storage so that ExtractHeaders on any HTTPValue linked to that storage --
+// notably a hit in an in-memory cache -- can copy them rather than parse them
+// again.
+class DecodedHeaders : public SharedString::Annotation {
+ public:
+  explicit DecodedHeaders(const ResponseHeaders& headers) {
+    headers.CopyToProto(&proto_);
+    // The wire size approximates the strings the proto holds; add the
+    // objects that hold them.
+    size_ = sizeof(*this) + proto_.ByteSizeLong() +
+            proto_.header_size() * sizeof(NameValue);
+  }
+
+  const HttpResponseHeaders& proto() const { return proto_; }
+  size_t size() const override { return size_; }
+
+ private:
+  ~DecodedHeaders() override {}
+
+  HttpResponseHeaders proto_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecodedHeaders);
+};
+
+// Returns the decoded headers annotating storage, or NULL if there are none.
+const DecodedHeaders* GetDecodedHeaders(const SharedString& storage) {
+  if (storage.trimmed()) {
+    return nullptr;  // The annotation describes a different string.
+  }
+  return dynamic_cast<const DecodedHeaders*>(storage.annotation());
+}
+
+}  // namespace
+
 void HTTPValue::CopyOnWrite() { storage_.DetachRetainingContent(); }
 
 void HTTPValue::Clear() {
@@ -74,7 +115,17 @@ void HTTPValue::SetHeaders(ResponseHeaders* headers) {
   storage_.Append(headers_string);
 }
 
+void HTTPValue::ShareDecodedHeaders(const ResponseHeaders& headers) {
+  // Setting the annotation must not race with readers of shared storage.
+  if (storage_.unique() && !storage_.trimmed()) {
+    storage_.set_annotation(new DecodedHeaders(headers));
+  }
+}
+
 bool HTTPValue::Write(const StringPiece& str, MessageHandler* handler) {
+  // Appending to the body drops the storage's annotation, but leaves the
+  // headers it describes alone, so restore it afterwards.
+  RefCountedPtr<SharedString::Annotation> annotation(storage_.annotation());
   CopyOnWrite();
   if (storage_.empty()) {
     // We have received data prior to receiving response headers.
@@ -89,6 +140,7 @@ bool HTTPValue::Write(const StringPiece& str, MessageHandler* handler) {
     CHECK(type_identifier() == kHeadersFirst);
   }
   storage_.Append(str.data(), str.size());
+  storage_.set_annotation(annotation.get());
   contents_size_ += str.size();
   return true;
 }
@@ -130,6 +182,11 @@ unsigned int HTTPValue::SizeOfFirstChunk() const {
 // invalid entry rather than aborting the server.
 bool HTTPValue::ExtractHeaders(ResponseHeaders* headers,
                                MessageHandler* handler) const {
+  const DecodedHeaders* decoded_headers = GetDecodedHeaders(storage_);
+  if (decoded_headers != nullptr) {
+    headers->ReadFromProto(decoded_headers->proto());
+    return true;
+  }
   bool ret = false;
   headers->Clear();
   if (storage_.size() >= kStorageOverhead) {
@@ -175,6 +232,17 @@ bool HTTPValue::ExtractContents(StringPiece* val) const {
   return ret;
 }
 
+bool HTTPValue::ExtractContents(SharedString* contents) const {
+  StringPiece str;
+  if (!ExtractContents(&str)) {
+    return false;
+  }
+  *contents = storage_;
+  contents->RemovePrefix(str.data() - storage_.data());
+  contents->RemoveSuffix(contents->size() - str.size());
+  return true;
+}
+
 int64 HTTPValue::ComputeContentsSize() const {
   // Return size as 0 if the cache is corrupted.
   int64 size = 0;
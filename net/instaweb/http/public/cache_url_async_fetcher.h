@@ -28,6 +28,7 @@
 namespace net_instaweb {
 
 class AsyncFetch;
+class FetchCoalescer;
 class Hasher;
 class Histogram;
 class HTTPCache;
@@ -57,6 +58,9 @@ class Variable;
 // otherwise, fetcher object accessed by BackgroundFreshenFetch may be deleted
 // by the time origin fetch finishes.
 //
+// If a FetchCoalescer is set, concurrent cache misses for the same URL and
+// fragment share a single origin fetch; see fetch_coalescer.h.
+//
 // TODO(sligocki): In order to use this for fetching resources for rewriting
 // we'd need to integrate resource locking in this class. Do we want that?
 class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
@@ -133,6 +137,15 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
     return num_proactively_freshen_user_facing_request_;
   }
 
+  void set_num_coalesced_fetches(Variable* x) { num_coalesced_fetches_ = x; }
+
+  Variable* num_coalesced_fetches() const { return num_coalesced_fetches_; }
+
+  // Not owned; shared by all the CacheUrlAsyncFetchers fetching through the
+  // same HTTPCache.  NULL (the default) sends every miss to the fetcher.
+  void set_fetch_coalescer(FetchCoalescer* x) { fetch_coalescer_ = x; }
+  FetchCoalescer* fetch_coalescer() const { return fetch_coalescer_; }
+
   void set_respect_vary(bool x) { respect_vary_ = x; }
   bool respect_vary() const { return respect_vary_; }
 
@@ -151,6 +164,11 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
     return serve_stale_if_fetch_error_;
   }
 
+  // Expired non-HTML responses are served from cache, while a background
+  // fetch refreshes them, for up to this long past expiry.  A response's own
+  // Cache-Control: stale-while-revalidate can lengthen the window, and does
+  // so even when this is 0, so origins that send the directive get stale
+  // serving without any configuration.
   void set_serve_stale_while_revalidate_threshold_sec(int64 x) {
     serve_stale_while_revalidate_threshold_sec_ = x;
   }
@@ -188,6 +206,19 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
     response_sequence_ = x;
   }
 
+  // Background refreshes (of stale-while-revalidate hits and of imminently
+  // expiring entries) are started on this sequence, if set, rather than on
+  // the thread that answered the request.  The sequence must outlive any
+  // refresh started on it; each refresh holds an AsyncOpHooks op until it
+  // finishes, so a sequence owned by whatever implements the hooks works.
+  // A refresh whose start is cancelled, e.g. by load-shedding, is dropped.
+  void set_background_refresh_sequence(Sequence* x) {
+    background_refresh_sequence_ = x;
+  }
+  Sequence* background_refresh_sequence() const {
+    return background_refresh_sequence_;
+  }
+
  private:
   // Not owned by CacheUrlAsyncFetcher.
   const Hasher* lock_hasher_;
@@ -196,12 +227,14 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
   GoogleString fragment_;
   UrlAsyncFetcher* fetcher_;  // may be NULL.
   AsyncOpHooks* async_op_hooks_;
+  FetchCoalescer* fetch_coalescer_;  // may be NULL.
 
   Histogram* backend_first_byte_latency_;                  // may be NULL.
   Variable* fallback_responses_served_;                    // may be NULL.
   Variable* fallback_responses_served_while_revalidate_;   // may be NULL.
   Variable* num_conditional_refreshes_;                    // may be NULL.
   Variable* num_proactively_freshen_user_facing_request_;  // may be NULL.
+  Variable* num_coalesced_fetches_;                        // may be NULL.
 
   bool respect_vary_;
   bool ignore_recent_fetch_failed_;
@@ -211,6 +244,7 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
   bool own_fetcher_;  // set true to transfer ownership of fetcher to this.
   int64 serve_stale_while_revalidate_threshold_sec_;
   Sequence* response_sequence_;
+  Sequence* background_refresh_sequence_;  // may be NULL.
 
   DISALLOW_COPY_AND_ASSIGN(CacheUrlAsyncFetcher);
 };
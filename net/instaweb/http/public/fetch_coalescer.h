@@ -0,0 +1,121 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef NET_INSTAWEB_HTTP_PUBLIC_FETCH_COALESCER_H_
+#define NET_INSTAWEB_HTTP_PUBLIC_FETCH_COALESCER_H_
+
+#include <map>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+
+namespace net_instaweb {
+
+class AbstractMutex;
+class AsyncFetch;
+class MessageHandler;
+class RequestHeaders;
+class ResponseHeaders;
+class ThreadSystem;
+class UrlAsyncFetcher;
+
+// Collapses concurrent origin fetches for the same cache key into one
+// ("single flight").  When a popular resource expires, every request for it
+// misses in the HTTPCache at once; rather than sending each of them to the
+// origin, the first miss becomes the leader of a flight and the rest join
+// it as followers.  Followers are fed the leader's response as it streams
+// in, and a follower that joins after the response has started is first
+// replayed the headers and whatever body the leader has received so far.
+//
+// Callbacks on followers are issued from the thread delivering the
+// leader's response, never from the thread calling Join.  A follower that
+// joins after the leader's last write is caught up when the leader
+// completes.
+//
+// The key can only cover request headers known to matter before the
+// response arrives.  If the response turns out to vary on any others, it
+// isn't shared: the flight stops taking followers, and those it has are
+// fetched from the origin one by one, with their own request headers.
+//
+// One FetchCoalescer is shared by all the CacheUrlAsyncFetchers of a
+// server, as those are typically created per request.
+class FetchCoalescer {
+ public:
+  // Once the leader has received more than this much body, its flight
+  // stops accepting followers so that it can stop buffering.
+  static const int64 kDefaultMaxReplayBytes;
+
+  explicit FetchCoalescer(ThreadSystem* thread_system);
+
+  // Flights must all have completed before the coalescer is destroyed.
+  ~FetchCoalescer();
+
+  // Returns the key that a fetch of cache_key with request_headers is
+  // coalesced on, or the empty string if it must go to the origin on its
+  // own: only unconditional GETs without credentials are coalesced, and
+  // only with others that accept the same content encodings.
+  static GoogleString CoalescingKey(StringPiece cache_key,
+                                    const RequestHeaders& request_headers);
+
+  // If a flight for key is in progress, adds fetch to it as a follower and
+  // returns NULL; fetch will be completed with the leader's response.
+  // Otherwise starts a new flight and returns a fetch wrapping fetch, which
+  // the caller must send (possibly wrapped further) to the origin; the
+  // response it receives is passed on to fetch and to every follower.
+  //
+  // If the response can't be shared, the flight's followers are sent to
+  // fetcher for url instead, as given by the fetch that started the flight.
+  AsyncFetch* Join(const GoogleString& key, const GoogleString& url,
+                   UrlAsyncFetcher* fetcher, AsyncFetch* fetch,
+                   MessageHandler* handler);
+
+  // Whether a response to a fetch coalesced by CoalescingKey can be shared
+  // among all the fetches with that key.  It can't if it varies on more than
+  // the key covers, sets cookies, or is private or no-store.
+  static bool IsShareable(const ResponseHeaders& response_headers);
+
+  void set_max_replay_bytes(int64 x) { max_replay_bytes_ = x; }
+  int64 max_replay_bytes() const { return max_replay_bytes_; }
+
+  // Number of flights in progress.
+  int NumFlights() const;
+
+ private:
+  class LeaderFetch;
+  friend class LeaderFetch;
+
+  typedef std::map<GoogleString, LeaderFetch*> FlightMap;
+
+  // Called by a leader once its response is complete.
+  void Unregister(const GoogleString& key, LeaderFetch* leader);
+
+  ThreadSystem* thread_system_;
+  std::unique_ptr<AbstractMutex> mutex_;
+  FlightMap flights_ GUARDED_BY(mutex_);
+  int64 max_replay_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(FetchCoalescer);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_HTTP_PUBLIC_FETCH_COALESCER_H_
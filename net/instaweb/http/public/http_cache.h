@@ -316,6 +316,13 @@ class HTTPCache {
   bool IsExpired(const ResponseHeaders& headers);
   bool IsExpired(const ResponseHeaders& headers, int64 now_ms);
 
+  // Returns how long past its expiry a response may still be served while a
+  // background fetch revalidates it: the longer of its own Cache-Control
+  // stale-while-revalidate and default_window_ms.  Returns 0 if the response
+  // must be revalidated before reuse.  headers must have ComputeCaching done.
+  static int64 StaleWhileRevalidateWindowMs(const ResponseHeaders& headers,
+                                            int64 default_window_ms);
+
   // Stats for the HTTP cache.
   Variable* cache_time_us() { return cache_time_us_; }
   Variable* cache_hits() { return cache_hits_; }
@@ -64,6 +64,15 @@ class HTTPValue : public Writer {
   bool Write(const StringPiece& str, MessageHandler* handler) override;
   bool Flush(MessageHandler* handler) override;
 
+  // Keeps a decoded copy of headers with the storage, so ExtractHeaders on
+  // this value and on values linked to it -- including hits in an in-memory
+  // cache -- copies them instead of parsing.  headers must be the ones this
+  // value holds.  The copy is charged to in-memory caches, so HTTPCache does
+  // this only for what it puts rather than every SetHeaders paying for it.
+  // Does nothing if the storage is shared, since that could race with
+  // readers of it.
+  void ShareDecodedHeaders(const ResponseHeaders& headers);
+
   // Retrieves the headers, returning false if empty.
   bool ExtractHeaders(ResponseHeaders* headers, MessageHandler* handler) const;
 
@@ -72,6 +81,10 @@ class HTTPValue : public Writer {
   // object is in scope.
   bool ExtractContents(StringPiece* str) const;
 
+  // Retrieves the contents as a view sharing this value's storage, so they
+  // can outlive the HTTPValue without being copied.  Returns false if empty.
+  bool ExtractContents(SharedString* contents) const;
+
   // Tests whether this reference is the only active one to the string object.
   bool unique() const { return storage_.unique(); }
 
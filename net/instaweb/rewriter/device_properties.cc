@@ -38,9 +38,11 @@ DeviceProperties::DeviceProperties(UserAgentMatcher* matcher)
       supports_lazyload_images_(kNotSet),
       requests_save_data_(kNotSet),
       accepts_webp_(kNotSet),
+      accepts_avif_(kNotSet),
       supports_webp_rewritten_urls_(kNotSet),
       supports_webp_lossless_alpha_(kNotSet),
       supports_webp_animated_(kNotSet),
+      supports_avif_(kNotSet),
       is_bot_(kNotSet),
       is_mobile_user_agent_(kNotSet),
       supports_split_html_(kNotSet),
@@ -62,6 +64,7 @@ void DeviceProperties::SetUserAgent(const StringPiece& user_agent_string) {
   supports_webp_rewritten_urls_ = kNotSet;
   supports_webp_lossless_alpha_ = kNotSet;
   supports_webp_animated_ = kNotSet;
+  supports_avif_ = kNotSet;
   is_bot_ = kNotSet;
   is_mobile_user_agent_ = kNotSet;
   supports_split_html_ = kNotSet;
@@ -75,6 +78,10 @@ void DeviceProperties::ParseRequestHeaders(
                                            kContentTypeWebp.mime_type())
                       ? kTrue
                       : kFalse;
+  accepts_avif_ = request_headers.HasValue(HttpAttributes::kAccept,
+                                           kContentTypeAvif.mime_type())
+                      ? kTrue
+                      : kFalse;
   accepts_gzip_ = request_headers.HasValue(HttpAttributes::kAcceptEncoding,
                                            HttpAttributes::kGzip)
                       ? kTrue
@@ -197,6 +204,17 @@ bool DeviceProperties::SupportsWebpAnimated() const {
   return (supports_webp_animated_ == kTrue);
 }
 
+bool DeviceProperties::SupportsAvif() const {
+  if (supports_avif_ == kNotSet) {
+    if ((accepts_avif_ == kTrue) && ua_matcher_->SupportsAvif(user_agent_)) {
+      supports_avif_ = kTrue;
+    } else {
+      supports_avif_ = kFalse;
+    }
+  }
+  return (supports_avif_ == kTrue);
+}
+
 bool DeviceProperties::IsBot() const {
   if (is_bot_ == kNotSet) {
     is_bot_ = BotChecker::Lookup(user_agent_) ? kTrue : kFalse;
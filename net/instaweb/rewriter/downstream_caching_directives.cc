@@ -37,6 +37,7 @@ DownstreamCachingDirectives::DownstreamCachingDirectives()
       supports_webp_(kNotSet),
       supports_webp_lossless_alpha_(kNotSet),
       supports_webp_animated_(kNotSet),
+      supports_avif_(kNotSet),
       capabilities_to_be_supported_(kNoCapabilitiesSpecified) {}
 
 DownstreamCachingDirectives::~DownstreamCachingDirectives() {}
@@ -54,6 +55,7 @@ void DownstreamCachingDirectives::ParseCapabilityListFromRequestHeaders(
   supports_webp_ = kNotSet;
   supports_webp_lossless_alpha_ = kNotSet;
   supports_webp_animated_ = kNotSet;
+  supports_avif_ = kNotSet;
 }
 
 bool DownstreamCachingDirectives::IsPropertySupported(
@@ -129,4 +131,10 @@ bool DownstreamCachingDirectives::SupportsWebpAnimated() const {
       capabilities_to_be_supported_);
 }
 
+bool DownstreamCachingDirectives::SupportsAvif() const {
+  return IsPropertySupported(
+      &supports_avif_, RewriteOptions::FilterId(RewriteOptions::kConvertToAvif),
+      capabilities_to_be_supported_);
+}
+
 }  // namespace net_instaweb
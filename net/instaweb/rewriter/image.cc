@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <memory>
+#include <vector>
 
 extern "C" {
 #ifdef USE_SYSTEM_ZLIB
@@ -38,12 +39,14 @@ extern "C" {
 #include "net/instaweb/rewriter/public/webp_optimizer.h"
 #include "pagespeed/kernel/base/annotated_message_handler.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/countdown_timer.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/http/content_type.h"
+#include "pagespeed/kernel/image/avif_optimizer.h"
 #include "pagespeed/kernel/image/gif_reader.h"
 #include "pagespeed/kernel/image/image_analysis.h"
 #include "pagespeed/kernel/image/image_converter.h"
@@ -73,6 +76,8 @@ extern "C" {
 }
 
 using pagespeed::image_compression::AnalyzeImage;
+using pagespeed::image_compression::AvifConfiguration;
+using pagespeed::image_compression::ComputeDownscaledLuma;
 using pagespeed::image_compression::ConversionTimeoutHandler;
 using pagespeed::image_compression::CreateScanlineReader;
 using pagespeed::image_compression::CreateScanlineWriter;
@@ -92,12 +97,14 @@ using pagespeed::image_compression::PngReader;
 using pagespeed::image_compression::PngReaderInterface;
 using pagespeed::image_compression::PngScanlineWriter;
 using pagespeed::image_compression::PreferredLibwebpLevel;
+using pagespeed::image_compression::ReadsScanlinesInBands;
 using pagespeed::image_compression::RETAIN;
 using pagespeed::image_compression::RGB_888;
 using pagespeed::image_compression::RGBA_8888;
 using pagespeed::image_compression::ScanlineReaderInterface;
 using pagespeed::image_compression::ScanlineResizer;
 using pagespeed::image_compression::ScanlineWriterInterface;
+using pagespeed::image_compression::Ssim;
 using pagespeed::image_compression::WEBP_ANIMATED;
 using pagespeed::image_compression::WEBP_LOSSLESS;
 using pagespeed::image_compression::WEBP_LOSSY;
@@ -137,23 +144,74 @@ const char kGifString[] = "gif";
 const char kPngString[] = "png";
 const uint8 kAlphaOpaque = 255;
 
+// The quality search for target_ssim never goes below this quality.
+const int kMinSearchQuality = 40;
+
+// Encodes the image held by user_data at the given quality into output.
+typedef bool (*QualityEncoder)(int quality, void* user_data,
+                               GoogleString* output);
+
+// QualityEncoder data for recompressing a JPEG.
+struct JpegEncoderData {
+  const GoogleString* jpeg;
+  JpegCompressionOptions options;
+  MessageHandler* handler;
+};
+
+bool EncodeJpeg(int quality, void* user_data, GoogleString* output) {
+  JpegEncoderData* data = static_cast<JpegEncoderData*>(user_data);
+  data->options.lossy_options.quality = quality;
+  return OptimizeJpegWithOptions(*data->jpeg, output, data->options,
+                                 data->handler);
+}
+
+// QualityEncoder data for converting a JPEG to WebP.
+struct JpegToWebpEncoderData {
+  const GoogleString* jpeg;
+  int thread_level;
+  ConversionTimeoutHandler* timeout_handler;
+  MessageHandler* handler;
+};
+
+bool EncodeJpegAsWebp(int quality, void* user_data, GoogleString* output) {
+  JpegToWebpEncoderData* data = static_cast<JpegToWebpEncoderData*>(user_data);
+  return OptimizeWebp(*data->jpeg, quality, data->thread_level,
+                      ConversionTimeoutHandler::Continue, data->timeout_handler,
+                      output, data->handler);
+}
+
+bool EncodeWebp(int quality, void* user_data, GoogleString* output) {
+  const GoogleString* webp = static_cast<const GoogleString*>(user_data);
+  return ReduceWebpImageQuality(*webp, quality, output);
+}
+
+void UpdateConversionStats(bool ok, bool was_timed_out, int64 time_elapsed_ms,
+                           bool multithreaded,
+                           Image::ConversionBySourceVariable* the_var) {
+  if (the_var != nullptr) {
+    if (multithreaded && the_var->multithreaded_count != nullptr) {
+      the_var->multithreaded_count->Add(1);
+    }
+    if (was_timed_out) {
+      the_var->timeout_count->Add(1);
+      DCHECK(!ok);
+    } else {
+      if (ok) {
+        the_var->success_ms->Add(time_elapsed_ms);
+      } else {
+        the_var->failure_ms->Add(time_elapsed_ms);
+      }
+    }
+  }
+}
+
 void UpdateWebpStats(bool ok, bool was_timed_out, int64 time_elapsed_ms,
+                     bool multithreaded,
                      Image::ConversionVariables::VariableType var_type,
                      Image::ConversionVariables* conversion_vars) {
   if (conversion_vars != nullptr) {
-    Image::ConversionBySourceVariable* the_var = conversion_vars->Get(var_type);
-    if (the_var != nullptr) {
-      if (was_timed_out) {
-        the_var->timeout_count->Add(1);
-        DCHECK(!ok);
-      } else {
-        if (ok) {
-          the_var->success_ms->Add(time_elapsed_ms);
-        } else {
-          the_var->failure_ms->Add(time_elapsed_ms);
-        }
-      }
-    }
+    UpdateConversionStats(ok, was_timed_out, time_elapsed_ms, multithreaded,
+                          conversion_vars->Get(var_type));
   }
 }
 
@@ -178,6 +236,9 @@ ImageFormat ImageTypeToImageFormat(ImageType type) {
     case IMAGE_WEBP_ANIMATED:
       format = pagespeed::image_compression::IMAGE_WEBP;
       break;
+    case IMAGE_AVIF:
+      format = pagespeed::image_compression::IMAGE_AVIF;
+      break;
   }
   return format;
 }
@@ -215,6 +276,7 @@ class ImageImpl : public Image {
 
   void Dimensions(ImageDim* natural_dim) override;
   bool ResizeTo(const ImageDim& new_dim) override;
+  bool CanResizeInBands() override;
   bool DrawImage(Image* image, int x, int y) override;
   bool EnsureLoaded(bool output_useful) override;
   bool ShouldConvertToProgressive(int64 quality) const override;
@@ -290,6 +352,36 @@ class ImageImpl : public Image {
 
   static bool ContinueWebpConversion(int percent, void* user_data);
 
+  // Converts image_data, of type input_type, to a still AVIF in
+  // output_contents_ using the settings in options_. Alpha is kept
+  // losslessly.
+  bool ConvertToAvif(const GoogleString& image_data, ImageType input_type);
+
+  // Encodes source, an image of source_type, as output_type into output by
+  // calling encoder.  The quality is max_quality unless options_->target_ssim
+  // is set, in which case it is the lowest quality from kMinSearchQuality up
+  // whose output, compared with source, reaches target_ssim, found by binary
+  // search.  The search is skipped if options_ carries a quality found for
+  // output_type before, and stops early, keeping the best quality found so
+  // far, once options_->quality_search_timeout_ms has passed.  Records the
+  // quality used in options_.
+  bool EncodeWithQualitySearch(const GoogleString& source,
+                               ImageType source_type, ImageType output_type,
+                               int max_quality, QualityEncoder encoder,
+                               void* encoder_data, GoogleString* output);
+
+  // Whether encoded, of type image_type, has an SSIM of at least
+  // options_->target_ssim against the luma in reference.
+  bool MeetsTargetSsim(const GoogleString& encoded, ImageType image_type,
+                       const std::vector<float>& reference, int width,
+                       int height);
+
+  // The libwebp thread_level to encode with: multithreaded only if this
+  // conversion was granted helper threads.
+  int WebpThreadLevel() const {
+    return (options_->encode_helper_threads > 0) ? 1 : 0;
+  }
+
   // Determines whether we can attempt a libpagespeed conversion
   // without exceeding kMaxConversionAttempts. If so, increments the
   // number of attempts.
@@ -339,6 +431,10 @@ void ImageImpl::SetTransformToLowRes() {
   if (options_->preferred_webp != WEBP_NONE) {
     options_->preferred_webp = WEBP_LOSSY;
   }
+  // Low-res previews are inlined into HTML that is not keyed on Accept,
+  // so they never use AVIF.
+  options_->allow_avif = false;
+  options_->target_ssim = -1;
   options_->webp_quality = 10;
   options_->webp_animated_quality = 10;
   options_->jpeg_quality = 10;
@@ -546,6 +642,8 @@ void ImageImpl::ComputeImageType() {
     case IMAGE_WEBP_ANIMATED:
       FindWebpSize();
       break;
+    case IMAGE_AVIF:
+      // We only write AVIF, so its dimensions are never needed.
     case IMAGE_UNKNOWN:
       break;
   }
@@ -570,6 +668,9 @@ const ContentType* Image::TypeToContentType(ImageType image_type) {
     case IMAGE_WEBP_ANIMATED:
       res = &kContentTypeWebp;
       break;
+    case IMAGE_AVIF:
+      res = &kContentTypeAvif;
+      break;
   }
   return res;
 }
@@ -746,6 +847,18 @@ bool ImageImpl::ResizeTo(const ImageDim& new_dim) {
   return true;
 }
 
+bool ImageImpl::CanResizeInBands() {
+  const ImageFormat format = ImageTypeToImageFormat(image_type());
+  // ResizeTo() does not handle WebP.
+  if (format == pagespeed::image_compression::IMAGE_WEBP) {
+    return false;
+  }
+  std::unique_ptr<ScanlineReaderInterface> reader(
+      CreateScanlineReader(format, original_contents_.data(),
+                           original_contents_.length(), handler_.get()));
+  return (reader != nullptr && ReadsScanlinesInBands(format, reader.get()));
+}
+
 void ImageImpl::UndoChange() {
   if (changed_) {
     output_valid_ = false;
@@ -819,8 +932,10 @@ bool ImageImpl::ComputeOutputContents() {
       case IMAGE_WEBP_LOSSLESS_OR_ALPHA:
         if (resized || options_->recompress_webp) {
           ok = MayConvert() &&
-               ReduceWebpImageQuality(string_for_image, options_->webp_quality,
-                                      &output_contents_);
+               EncodeWithQualitySearch(
+                   string_for_image, image_type(), IMAGE_WEBP,
+                   options_->webp_quality, EncodeWebp, &string_for_image,
+                   &output_contents_);
         }
         // TODO(pulkitg): Convert a webp image to jpeg image if
         // web_preferred_ is false.
@@ -829,7 +944,20 @@ bool ImageImpl::ComputeOutputContents() {
         // TODO(huibao): Recompress animated WebP.
         ok = false;
         break;
+      case IMAGE_AVIF:
+        // We have no AVIF decoder, so AVIF input is left alone.
+        ok = false;
+        break;
       case IMAGE_JPEG:
+        if (options_->allow_avif && options_->avif_quality > 0 &&
+            MayConvert()) {
+          ok = ConvertToAvif(string_for_image, IMAGE_JPEG);
+          VLOG(1) << "Image conversion: " << ok << " jpeg->avif for " << url_;
+          if (ok) {
+            image_type_ = IMAGE_AVIF;
+            break;
+          }
+        }
         if (MayConvert() && options_->convert_jpeg_to_webp &&
             (options_->preferred_webp != WEBP_NONE)) {
           ok = ConvertJpegToWebp(string_for_image, options_->webp_quality,
@@ -843,10 +971,19 @@ bool ImageImpl::ComputeOutputContents() {
         if (ok) {
           image_type_ = IMAGE_WEBP;
         } else if (MayConvert() && (resized || options_->recompress_jpeg)) {
-          JpegCompressionOptions jpeg_options;
-          ConvertToJpegOptions(*options_.get(), &jpeg_options);
-          ok = OptimizeJpegWithOptions(string_for_image, &output_contents_,
-                                       jpeg_options, handler_.get());
+          JpegEncoderData encoder_data;
+          encoder_data.jpeg = &string_for_image;
+          encoder_data.handler = handler_.get();
+          ConvertToJpegOptions(*options_.get(), &encoder_data.options);
+          if (encoder_data.options.lossy) {
+            ok = EncodeWithQualitySearch(
+                string_for_image, IMAGE_JPEG, IMAGE_JPEG,
+                encoder_data.options.lossy_options.quality, EncodeJpeg,
+                &encoder_data, &output_contents_);
+          } else {
+            ok = OptimizeJpegWithOptions(string_for_image, &output_contents_,
+                                         encoder_data.options, handler_.get());
+          }
           VLOG(1) << "Image conversion: " << ok << " jpeg->jpeg for " << url_;
         }
         break;
@@ -886,25 +1023,118 @@ inline bool ImageImpl::ConvertJpegToWebp(const GoogleString& original_jpeg,
                                          GoogleString* compressed_webp) {
   ConversionTimeoutHandler timeout_handler(options_->webp_conversion_timeout_ms,
                                            timer_, handler_.get());
+  int thread_level = WebpThreadLevel();
   timeout_handler.Start(compressed_webp);
-  bool ok = OptimizeWebp(original_jpeg, configured_quality,
-                         ConversionTimeoutHandler::Continue, &timeout_handler,
-                         compressed_webp, handler_.get());
+  JpegToWebpEncoderData encoder_data;
+  encoder_data.jpeg = &original_jpeg;
+  encoder_data.thread_level = thread_level;
+  encoder_data.timeout_handler = &timeout_handler;
+  encoder_data.handler = handler_.get();
+  bool ok = EncodeWithQualitySearch(original_jpeg, IMAGE_JPEG, IMAGE_WEBP,
+                                    configured_quality, EncodeJpegAsWebp,
+                                    &encoder_data, compressed_webp);
   timeout_handler.Stop();
 
-  bool was_timed_out = timeout_handler.was_timed_out();
+  bool multithreaded = (thread_level != 0);
+  // A quality search that runs out of time still succeeds if an earlier
+  // step found a good enough encoding.
+  bool was_timed_out = timeout_handler.was_timed_out() && !ok;
   int64 time_elapsed_ms = timeout_handler.time_elapsed_ms();
 
-  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms,
+  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms, multithreaded,
                   Image::ConversionVariables::FROM_JPEG,
                   options_->webp_conversion_variables);
 
-  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms,
+  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms, multithreaded,
                   Image::ConversionVariables::OPAQUE,
                   options_->webp_conversion_variables);
   return ok;
 }
 
+bool ImageImpl::EncodeWithQualitySearch(const GoogleString& source,
+                                        ImageType source_type,
+                                        ImageType output_type, int max_quality,
+                                        QualityEncoder encoder,
+                                        void* encoder_data,
+                                        GoogleString* output) {
+  if (options_->target_ssim <= 0 || max_quality <= 0) {
+    return encoder(max_quality, encoder_data, output);
+  }
+
+  int quality = max_quality;
+  if (options_->cached_search_quality > 0 &&
+      options_->cached_search_image_type == output_type) {
+    quality = std::min(options_->cached_search_quality, max_quality);
+  } else {
+    std::vector<float> reference;
+    int width = 0;
+    int height = 0;
+    if (!ComputeDownscaledLuma(ImageTypeToImageFormat(source_type),
+                               source.data(), source.size(), &reference,
+                               &width, &height, handler_.get())) {
+      return encoder(max_quality, encoder_data, output);
+    }
+
+    // Quality max_quality is the fallback, so it is never tried in the
+    // search itself.
+    GoogleString best;
+    GoogleString trial;
+    CountdownTimer deadline(timer_, nullptr,
+                            options_->quality_search_timeout_ms);
+    int low = std::min(kMinSearchQuality, max_quality);
+    int high = max_quality - 1;
+    while (low <= high && deadline.HaveTimeLeft()) {
+      const int trial_quality = low + (high - low) / 2;
+      trial.clear();
+      if (!encoder(trial_quality, encoder_data, &trial)) {
+        // Most likely the conversion timed out; settle for what we have.
+        if (best.empty()) {
+          return false;
+        }
+        break;
+      }
+      if (MeetsTargetSsim(trial, output_type, reference, width, height)) {
+        best.swap(trial);
+        quality = trial_quality;
+        high = trial_quality - 1;
+      } else {
+        low = trial_quality + 1;
+      }
+    }
+    if (!best.empty()) {
+      output->swap(best);
+      options_->searched_quality = quality;
+      options_->searched_image_type = output_type;
+      return true;
+    }
+  }
+
+  output->clear();
+  if (!encoder(quality, encoder_data, output)) {
+    return false;
+  }
+  options_->searched_quality = quality;
+  options_->searched_image_type = output_type;
+  return true;
+}
+
+bool ImageImpl::MeetsTargetSsim(const GoogleString& encoded,
+                                ImageType image_type,
+                                const std::vector<float>& reference, int width,
+                                int height) {
+  std::vector<float> luma;
+  int encoded_width = 0;
+  int encoded_height = 0;
+  if (!ComputeDownscaledLuma(ImageTypeToImageFormat(image_type), encoded.data(),
+                             encoded.size(), &luma, &encoded_width,
+                             &encoded_height, handler_.get()) ||
+      encoded_width != width || encoded_height != height) {
+    return false;
+  }
+  return Ssim(reference.data(), luma.data(), width, height) >=
+         options_->target_ssim;
+}
+
 bool ImageImpl::ConvertAnimatedGifToWebp(bool has_transparency) {
   ConversionTimeoutHandler timeout_handler(options_->webp_conversion_timeout_ms,
                                            timer_, handler_.get());
@@ -917,6 +1147,7 @@ bool ImageImpl::ConvertAnimatedGifToWebp(bool has_transparency) {
   webp_config.user_data = &timeout_handler;
   // TODO(huibao): Evaluate the following parameters.
   webp_config.method = 3;
+  webp_config.thread_level = WebpThreadLevel();
   webp_config.kmin = 3;
   webp_config.kmax = 5;
   webp_config.lossless = false;
@@ -962,15 +1193,16 @@ bool ImageImpl::ConvertAnimatedGifToWebp(bool has_transparency) {
   writer->FinalizeWrite(&status);
 
   timeout_handler.Stop();
+  bool multithreaded = (webp_config.thread_level != 0);
   bool was_timed_out = timeout_handler.was_timed_out();
   int64 time_elapsed_ms = timeout_handler.time_elapsed_ms();
   bool ok = status.Success();
 
-  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms,
+  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms, multithreaded,
                   Image::ConversionVariables::FROM_GIF_ANIMATED,
                   options_->webp_conversion_variables);
 
-  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms,
+  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms, multithreaded,
                   (has_transparency ? Image::ConversionVariables::NONOPAQUE
                                     : Image::ConversionVariables::OPAQUE),
                   options_->webp_conversion_variables);
@@ -978,6 +1210,57 @@ bool ImageImpl::ConvertAnimatedGifToWebp(bool has_transparency) {
   return ok;
 }
 
+bool ImageImpl::ConvertToAvif(const GoogleString& image_data,
+                              ImageType input_type) {
+  ConversionTimeoutHandler timeout_handler(options_->avif_conversion_timeout_ms,
+                                           timer_, handler_.get());
+  AvifConfiguration avif_config;
+  avif_config.quality = options_->avif_quality;
+  avif_config.alpha_quality = 100;
+  avif_config.max_threads = 1 + options_->encode_helper_threads;
+  avif_config.progress_hook = ConversionTimeoutHandler::Continue;
+  avif_config.user_data = &timeout_handler;
+
+  GoogleString avif;
+  timeout_handler.Start(&avif);
+  pagespeed::image_compression::ScanlineStatus status;
+  std::unique_ptr<ScanlineReaderInterface> reader(CreateScanlineReader(
+      ImageTypeToImageFormat(input_type), image_data.data(),
+      image_data.length(), handler_.get(), &status));
+  std::unique_ptr<ScanlineWriterInterface> writer;
+  if (status.Success()) {
+    writer.reset(CreateScanlineWriter(
+        pagespeed::image_compression::IMAGE_AVIF, reader->GetPixelFormat(),
+        reader->GetImageWidth(), reader->GetImageHeight(), &avif_config, &avif,
+        handler_.get(), &status));
+  }
+  if (status.Success()) {
+    void* scanline = nullptr;
+    while (status.Success() && reader->HasMoreScanLines()) {
+      status = reader->ReadNextScanlineWithStatus(&scanline);
+      if (status.Success()) {
+        status = writer->WriteNextScanlineWithStatus(scanline);
+      }
+    }
+    if (status.Success()) {
+      status = writer->FinalizeWriteWithStatus();
+    }
+  }
+  timeout_handler.Stop();
+
+  bool ok = status.Success();
+  if (ok) {
+    output_contents_.swap(avif);
+  }
+  bool multithreaded = (avif_config.max_threads > 1);
+  bool was_timed_out = timeout_handler.was_timed_out();
+  int64 time_elapsed_ms = timeout_handler.time_elapsed_ms();
+
+  UpdateConversionStats(ok, was_timed_out, time_elapsed_ms, multithreaded,
+                        options_->avif_conversion_variables);
+  return ok;
+}
+
 inline bool ImageImpl::ComputeOutputContentsFromGifOrPng(
     const GoogleString& string_for_image, const PngReaderInterface* png_reader,
     bool fall_back_to_png, const char* dbg_input_format, ImageType input_type,
@@ -1018,8 +1301,13 @@ inline bool ImageImpl::ComputeOutputContentsFromGifOrPng(
   } else if (is_photo && options_->convert_png_to_jpeg &&
              (input_type == IMAGE_PNG ||
               (input_type == IMAGE_GIF && options_->convert_gif_to_png))) {
-    // Can be converted to lossy format.
-    if (!has_transparency) {
+    // Can be converted to lossy format. AVIF keeps any alpha channel, so
+    // it is tried first either way.
+    if (options_->allow_avif && options_->avif_quality > 0 && MayConvert() &&
+        ConvertToAvif(string_for_image, input_type)) {
+      ok = true;
+      output_type = IMAGE_AVIF;
+    } else if (!has_transparency) {
       // No alpha; can be converted to WebP lossy or JPEG.
       if (options_->preferred_webp != WEBP_NONE &&
           options_->convert_jpeg_to_webp && options_->webp_quality > 0) {
@@ -1044,7 +1332,9 @@ inline bool ImageImpl::ComputeOutputContentsFromGifOrPng(
     }
   }
 
-  if (output_type == IMAGE_WEBP_ANIMATED) {
+  if (output_type == IMAGE_AVIF) {
+    // Already converted above.
+  } else if (output_type == IMAGE_WEBP_ANIMATED) {
     ok = ConvertAnimatedGifToWebp(has_transparency);
   } else {
     if (output_type == IMAGE_WEBP ||
@@ -1108,6 +1398,7 @@ bool ImageImpl::ConvertPngToWebp(const PngReaderInterface& png_reader,
   // whether this is the optimal value, and consider making it
   // tunable.
   webp_config.method = 3;
+  webp_config.thread_level = WebpThreadLevel();
   webp_config.quality = options_->webp_quality;
   webp_config.progress_hook = ConversionTimeoutHandler::Continue;
   webp_config.user_data = &timeout_handler;
@@ -1145,13 +1436,14 @@ bool ImageImpl::ConvertPngToWebp(const PngReaderInterface& png_reader,
   }
   timeout_handler.Stop();
 
+  bool multithreaded = (webp_config.thread_level != 0);
   bool was_timed_out = timeout_handler.was_timed_out();
   int64 time_elapsed_ms = timeout_handler.time_elapsed_ms();
 
-  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms, var_type,
+  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms, multithreaded, var_type,
                   options_->webp_conversion_variables);
 
-  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms,
+  UpdateWebpStats(ok, was_timed_out, time_elapsed_ms, multithreaded,
                   (has_transparency ? Image::ConversionVariables::NONOPAQUE
                                     : Image::ConversionVariables::OPAQUE),
                   options_->webp_conversion_variables);
@@ -1175,9 +1467,14 @@ bool ImageImpl::OptimizePngOrConvertToJpeg(const PngReaderInterface& png_reader,
   bool is_png;
   JpegCompressionOptions jpeg_options;
   ConvertToJpegOptions(*options_.get(), &jpeg_options);
+  // Only spend a helper thread on the JPEG trial if we were granted one.
+  ThreadSystem* thread_system = (options_->encode_helper_threads > 0)
+                                    ? options_->thread_system
+                                    : nullptr;
   bool ok = MayConvert() && ImageConverter::OptimizePngOrConvertToJpeg(
                                 png_reader, image_data, jpeg_options,
-                                &output_contents_, &is_png, handler_.get());
+                                thread_system, &output_contents_, &is_png,
+                                handler_.get());
   if (ok) {
     if (is_png) {
       image_type_ = IMAGE_PNG;
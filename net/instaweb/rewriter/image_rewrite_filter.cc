@@ -176,6 +176,8 @@ bool ShouldInlinePreview(const int64 low_res_size, const int64 full_res_size,
 }
 
 const char* const kRelatedOptions[] = {
+    RewriteOptions::kImageAvifRecompressionQuality,
+    RewriteOptions::kImageAvifTimeoutMs,
     RewriteOptions::kImageJpegNumProgressiveScans,
     RewriteOptions::kImageJpegNumProgressiveScansForSmallScreens,
     RewriteOptions::kImageJpegRecompressionQuality,
@@ -185,8 +187,10 @@ const char* const kRelatedOptions[] = {
     RewriteOptions::kImageLimitResizeAreaPercent,
     RewriteOptions::kImageMaxRewritesAtOnce,
     RewriteOptions::kImagePreserveURLs,
+    RewriteOptions::kImageQualitySearchTimeoutMs,
     RewriteOptions::kImageRecompressionQuality,
     RewriteOptions::kImageResolutionLimitBytes,
+    RewriteOptions::kImageTargetSsim,
     RewriteOptions::kImageWebpRecompressionQuality,
     RewriteOptions::kImageWebpRecompressionQualityForSmallScreens,
     RewriteOptions::kImageWebpAnimatedRecompressionQuality,
@@ -202,6 +206,7 @@ const RewriteOptions::Filter ImageRewriteFilter::kRelatedFilters[] = {
     RewriteOptions::kConvertJpegToProgressive,
     RewriteOptions::kConvertJpegToWebp,
     RewriteOptions::kConvertPngToJpeg,
+    RewriteOptions::kConvertToAvif,
     RewriteOptions::kConvertToWebpAnimated,
     RewriteOptions::kConvertToWebpLossless,
     RewriteOptions::kJpegSubsampling,
@@ -220,6 +225,8 @@ StringPieceVector* ImageRewriteFilter::related_options_ = nullptr;
 const char ImageRewriteFilter::kImageRewrites[] = "image_rewrites";
 const char ImageRewriteFilter::kImageNoRewritesHighResolution[] =
     "image_norewrites_high_resolution";
+const char ImageRewriteFilter::kImageResizedInBandsHighResolution[] =
+    "image_resized_in_bands_high_resolution";
 const char kImageRewritesDroppedIntentionally[] =
     "image_rewrites_dropped_intentionally";
 const char ImageRewriteFilter::kImageRewritesDroppedDecodeFailure[] =
@@ -246,6 +253,11 @@ const char ImageRewriteFilter::kImageOngoingRewrites[] =
 const char ImageRewriteFilter::kImageResizedUsingRenderedDimensions[] =
     "image_resized_using_rendered_dimensions";
 const char ImageRewriteFilter::kImageWebpRewrites[] = "image_webp_rewrites";
+const char ImageRewriteFilter::kImageAvifRewrites[] = "image_avif_rewrites";
+const char ImageRewriteFilter::kImageQualitySearches[] =
+    "image_quality_searches";
+const char ImageRewriteFilter::kImageQualitySearchesReused[] =
+    "image_quality_searches_reused";
 const char ImageRewriteFilter::kInlinableImageUrlsPropertyName[] =
     "ImageRewriter-inlinable-urls";
 const char ImageRewriteFilter::kImageRewriteLatencyOkMs[] =
@@ -288,6 +300,8 @@ const char ImageRewriteFilter::kImageWebpWithAlphaSuccessMs[] =
     "image_webp_alpha_success_ms";
 const char ImageRewriteFilter::kImageWebpWithAlphaFailureMs[] =
     "image_webp_alpha_failure_ms";
+const char ImageRewriteFilter::kImageWebpWithAlphaMultithreaded[] =
+    "image_webp_alpha_multithreaded";
 
 const char ImageRewriteFilter::kImageWebpOpaqueTimeouts[] =
     "image_webp_opaque_timeouts";
@@ -295,9 +309,23 @@ const char ImageRewriteFilter::kImageWebpOpaqueSuccessMs[] =
     "image_webp_opaque_success_ms";
 const char ImageRewriteFilter::kImageWebpOpaqueFailureMs[] =
     "image_webp_opaque_failure_ms";
+const char ImageRewriteFilter::kImageWebpOpaqueMultithreaded[] =
+    "image_webp_opaque_multithreaded";
+
+const char ImageRewriteFilter::kImageAvifTimeouts[] = "image_avif_timeouts";
+const char ImageRewriteFilter::kImageAvifSuccessMs[] = "image_avif_success_ms";
+const char ImageRewriteFilter::kImageAvifFailureMs[] = "image_avif_failure_ms";
 
 const int kNotCriticalIndex = INT_MAX;
 
+// Both libwebp's multithreaded encode and the side-by-side PNG and JPEG
+// trials use one helper thread; a second would sit idle.
+const int kMaxEncodeHelperThreads = 1;
+
+// Helper threads cost a thread start and a controller slot, so they are
+// only worth it for images that take a while to encode.
+const size_t kMinBytesForEncodeHelperThreads = 100 * 1024;
+
 // This is the resized placeholder image width for mobile.
 const int kDelayImageWidthForMobile = 320;
 
@@ -456,7 +484,7 @@ class ImageRewriteFilter::Context::InvokeRewriteFunction
  protected:
   void RunImpl(std::unique_ptr<ExpensiveOperationContext>* context) override {
     RewriteResult result = filter_->RewriteLoadedResourceImpl(
-        context_, input_resource_, output_resource_);
+        context_, input_resource_, output_resource_, context->get());
     (*context)->Done();
     context_->RewriteDone(result, 0);
   }
@@ -647,6 +675,8 @@ ImageRewriteFilter::ImageRewriteFilter(RewriteDriver* driver)
       stats->GetVariable(kImageResizedUsingRenderedDimensions);
   image_norewrites_high_resolution_ =
       stats->GetVariable(kImageNoRewritesHighResolution);
+  image_resized_in_bands_high_resolution_ =
+      stats->GetVariable(kImageResizedInBandsHighResolution);
   image_rewrites_dropped_intentionally_ =
       stats->GetVariable(kImageRewritesDroppedIntentionally);
   image_rewrites_dropped_decode_failure_ =
@@ -670,6 +700,10 @@ ImageRewriteFilter::ImageRewriteFilter(RewriteDriver* driver)
   image_rewrite_uses_ = stats->GetVariable(kImageRewriteUses);
   image_inline_count_ = stats->GetVariable(kImageInline);
   image_webp_rewrites_ = stats->GetVariable(kImageWebpRewrites);
+  image_avif_rewrites_ = stats->GetVariable(kImageAvifRewrites);
+  image_quality_searches_ = stats->GetVariable(kImageQualitySearches);
+  image_quality_searches_reused_ =
+      stats->GetVariable(kImageQualitySearchesReused);
   image_rewrite_latency_total_ms_ =
       stats->GetVariable(kImageRewriteLatencyTotalMs);
 
@@ -706,6 +740,9 @@ ImageRewriteFilter::ImageRewriteFilter(RewriteDriver* driver)
       ->success_ms = stats->GetHistogram(kImageWebpWithAlphaSuccessMs);
   webp_conversion_variables_.Get(Image::ConversionVariables::NONOPAQUE)
       ->failure_ms = stats->GetHistogram(kImageWebpWithAlphaFailureMs);
+  webp_conversion_variables_.Get(Image::ConversionVariables::NONOPAQUE)
+      ->multithreaded_count = stats->GetVariable(
+      kImageWebpWithAlphaMultithreaded);
 
   webp_conversion_variables_.Get(Image::ConversionVariables::OPAQUE)
       ->timeout_count = stats->GetVariable(kImageWebpOpaqueTimeouts);
@@ -713,6 +750,15 @@ ImageRewriteFilter::ImageRewriteFilter(RewriteDriver* driver)
       ->success_ms = stats->GetHistogram(kImageWebpOpaqueSuccessMs);
   webp_conversion_variables_.Get(Image::ConversionVariables::OPAQUE)
       ->failure_ms = stats->GetHistogram(kImageWebpOpaqueFailureMs);
+  webp_conversion_variables_.Get(Image::ConversionVariables::OPAQUE)
+      ->multithreaded_count = stats->GetVariable(kImageWebpOpaqueMultithreaded);
+
+  avif_conversion_variables_.timeout_count =
+      stats->GetVariable(kImageAvifTimeouts);
+  avif_conversion_variables_.success_ms =
+      stats->GetHistogram(kImageAvifSuccessMs);
+  avif_conversion_variables_.failure_ms =
+      stats->GetHistogram(kImageAvifFailureMs);
 
   image_rewrite_latency_ok_ms_ = stats->GetHistogram(kImageRewriteLatencyOkMs);
   image_rewrite_latency_failed_ms_ =
@@ -734,6 +780,7 @@ void ImageRewriteFilter::InitStats(Statistics* statistics) {
   statistics->AddVariable(kImageRewrites);
   statistics->AddVariable(kImageResizedUsingRenderedDimensions);
   statistics->AddVariable(kImageNoRewritesHighResolution);
+  statistics->AddVariable(kImageResizedInBandsHighResolution);
   statistics->AddVariable(kImageRewritesDroppedIntentionally);
   statistics->AddVariable(kImageRewritesDroppedDecodeFailure);
   statistics->AddVariable(kImageRewritesDroppedMIMETypeUnknown);
@@ -749,6 +796,9 @@ void ImageRewriteFilter::InitStats(Statistics* statistics) {
   statistics->AddVariable(kImageRewriteUses);
   statistics->AddVariable(kImageInline);
   statistics->AddVariable(kImageWebpRewrites);
+  statistics->AddVariable(kImageAvifRewrites);
+  statistics->AddVariable(kImageQualitySearches);
+  statistics->AddVariable(kImageQualitySearchesReused);
   statistics->AddVariable(kImageRewriteLatencyTotalMs);
   statistics->AddUpDownCounter(kImageOngoingRewrites);
   statistics->AddHistogram(kImageRewriteLatencyOkMs);
@@ -772,10 +822,16 @@ void ImageRewriteFilter::InitStats(Statistics* statistics) {
   statistics->AddVariable(kImageWebpWithAlphaTimeouts);
   statistics->AddHistogram(kImageWebpWithAlphaSuccessMs);
   statistics->AddHistogram(kImageWebpWithAlphaFailureMs);
+  statistics->AddVariable(kImageWebpWithAlphaMultithreaded);
 
   statistics->AddVariable(kImageWebpOpaqueTimeouts);
   statistics->AddHistogram(kImageWebpOpaqueSuccessMs);
   statistics->AddHistogram(kImageWebpOpaqueFailureMs);
+  statistics->AddVariable(kImageWebpOpaqueMultithreaded);
+
+  statistics->AddVariable(kImageAvifTimeouts);
+  statistics->AddHistogram(kImageAvifSuccessMs);
+  statistics->AddHistogram(kImageAvifFailureMs);
 }
 
 void ImageRewriteFilter::Initialize() {
@@ -882,6 +938,14 @@ Image::CompressionOptions* ImageRewriteFilter::ImageOptionsForLoadedResource(
   image_options->retain_color_sampling =
       !options->Enabled(RewriteOptions::kJpegSubsampling);
   image_options->webp_conversion_timeout_ms = options->image_webp_timeout_ms();
+  image_options->allow_avif = resource_context.may_use_avif() &&
+                              options->Enabled(RewriteOptions::kConvertToAvif);
+  image_options->avif_quality = options->ImageAvifQuality();
+  image_options->avif_conversion_timeout_ms = options->image_avif_timeout_ms();
+  image_options->avif_conversion_variables = &avif_conversion_variables_;
+  image_options->target_ssim = options->image_target_ssim();
+  image_options->quality_search_timeout_ms =
+      options->image_quality_search_timeout_ms();
 
   return image_options;
 }
@@ -1022,7 +1086,8 @@ void ImageRewriteFilter::InfoAndTrace(Context* rewrite_context,
 
 RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
     Context* rewrite_context, const ResourcePtr& input_resource,
-    const OutputResourcePtr& result) {
+    const OutputResourcePtr& result,
+    ExpensiveOperationContext* expensive_operation) {
   rewrite_context->TracePrintf("Image rewrite: %s",
                                input_resource->url().c_str());
   MessageHandler* message_handler = driver()->message_handler();
@@ -1041,6 +1106,33 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
 
   Image::CompressionOptions* image_options =
       ImageOptionsForLoadedResource(resource_context, input_resource);
+  // A large image may borrow slots that other image rewrites aren't using
+  // for helper threads.  Done() hands them back along with our own slot.
+  int max_helpers = std::min(options->image_max_encode_threads() - 1,
+                             kMaxEncodeHelperThreads);
+  if (max_helpers > 0 && expensive_operation != nullptr &&
+      (input_resource->UncompressedContentsSize() >=
+       kMinBytesForEncodeHelperThreads)) {
+    image_options->encode_helper_threads =
+        expensive_operation->TryToClaimHelpers(max_helpers);
+    image_options->thread_system = server_context()->thread_system();
+  }
+  // If this rewrite recreates an output that has dropped out of the HTTP
+  // cache, the metadata of the earlier rewrite is still at hand; reuse the
+  // quality it found rather than searching again.
+  GoogleString input_hash;
+  if (image_options->target_ssim > 0) {
+    input_hash = input_resource->ContentsHash();
+    const CachedResult* previous =
+        rewrite_context->previous_output_partition(0);
+    if (previous != nullptr && previous->has_image_quality_search() &&
+        previous->image_quality_search().input_hash() == input_hash) {
+      const ImageQualitySearch& search = previous->image_quality_search();
+      image_options->cached_search_quality = search.quality();
+      image_options->cached_search_image_type =
+          static_cast<ImageType>(search.image_type());
+    }
+  }
   std::unique_ptr<Image> image(
       NewImage(input_resource->ExtractUncompressedContents(),
                input_resource->url(), server_context()->filename_prefix(),
@@ -1072,11 +1164,23 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
   ImageDim image_dim;
   image->Dimensions(&image_dim);
   int64 image_width = image_dim.width(), image_height = image_dim.height();
+  // An image over the resolution limit may still be shrunk to fit it, as long
+  // as it can be decoded a band of scanlines at a time; then only the resized
+  // image is ever held whole, and everything after the resize works on that.
+  bool must_resize = false;
   if ((image_width * image_height * 4) >
       options->image_resolution_limit_bytes()) {
-    image_rewrites_dropped_intentionally_->Add(1);
-    image_norewrites_high_resolution_->Add(1);
-    return kRewriteFailed;
+    ImageDim desired_dim;
+    if (!ShouldResize(resource_context, input_resource->url(), image.get(),
+                      &desired_dim) ||
+        (static_cast<int64>(desired_dim.width()) * desired_dim.height() * 4 >
+         options->image_resolution_limit_bytes()) ||
+        !image->CanResizeInBands()) {
+      image_rewrites_dropped_intentionally_->Add(1);
+      image_norewrites_high_resolution_->Add(1);
+      return kRewriteFailed;
+    }
+    must_resize = true;
   }
 
   image_ongoing_rewrites_->Add(1);
@@ -1087,6 +1191,15 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
   CachedResult* cached = result->EnsureCachedResultCreated();
   is_resized = ResizeImageIfNecessary(rewrite_context, input_resource->url(),
                                       &resource_context, image.get(), cached);
+  if (must_resize) {
+    if (!is_resized) {
+      image_rewrites_dropped_intentionally_->Add(1);
+      image_norewrites_high_resolution_->Add(1);
+      image_ongoing_rewrites_->Add(-1);
+      return kRewriteFailed;
+    }
+    image_resized_in_bands_high_resolution_->Add(1);
+  }
 
   // When the "resize_images" filter has been turned on and the IMG tag has
   // width and/or height specified, we assume that the image will be resized so
@@ -1120,6 +1233,19 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
     optimized_image_type = image->image_type();
     is_recompressed = true;
 
+    if (image_options->searched_quality > 0) {
+      if (image_options->searched_image_type ==
+          image_options->cached_search_image_type) {
+        image_quality_searches_reused_->Add(1);
+      } else {
+        image_quality_searches_->Add(1);
+      }
+      ImageQualitySearch* search = cached->mutable_image_quality_search();
+      search->set_quality(image_options->searched_quality);
+      search->set_image_type(image_options->searched_image_type);
+      search->set_input_hash(input_hash);
+    }
+
     // The image has been recompressed (and potentially resized). However,
     // the recompressed image may not be used unless the file size is reduced.
     if (image->output_size() * 100 <
@@ -1155,6 +1281,8 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
         image_rewrite_total_original_bytes_->Add(image->input_size());
         if (result->type()->type() == ContentType::kWebp) {
           image_webp_rewrites_->Add(1);
+        } else if (result->type()->type() == ContentType::kAvif) {
+          image_avif_rewrites_->Add(1);
         }
 
         rewrite_result = kRewriteOk;
@@ -1204,7 +1332,9 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
   }
 
   int64 image_size = static_cast<int64>(image->output_size());
-  if (options->Enabled(RewriteOptions::kDelayImages) &&
+  // A blank preview would have the original dimensions, which don't fit in
+  // the resolution limit if must_resize is set.
+  if (options->Enabled(RewriteOptions::kDelayImages) && !must_resize &&
       !rewrite_context->in_noscript_element_ &&
       !cached->has_low_resolution_inlined_data() &&
       image_size >= options->min_image_size_low_resolution_bytes() &&
@@ -29,6 +29,7 @@
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/http/google_url.h"
+#include "pagespeed/kernel/image/avif_optimizer.h"
 #include "pagespeed/kernel/util/url_escaper.h"
 
 namespace net_instaweb {
@@ -48,6 +49,7 @@ const char kWebpAnimatedUserAgentKey[] = "a";
 // This used to not have a separate key, but we mixed up animated and it
 // at one point, so this is now here to force a flush.
 const char kWebpNoneUserAgentKey[] = ".";
+const char kAvifUserAgentKey[] = "f";
 const char kMobileUserAgentKey[] = "m";
 const char kSaveDataKey[] = "d";
 const char kSmallScreenKey[] = "ss";
@@ -251,13 +253,16 @@ void ImageUrlEncoder::SetLibWebpLevel(
   resource_context->set_libwebp_level(libwebp_level);
 }
 
-bool ImageUrlEncoder::IsWebpRewrittenUrl(const GoogleUrl& gurl) {
+namespace {
+
+bool IsImageRewrittenUrlOfType(const GoogleUrl& gurl,
+                               const ContentType& content_type) {
   ResourceNamer namer;
   if (!namer.DecodeIgnoreHashAndSignature(gurl.LeafSansQuery())) {
     return false;
   }
 
-  // We only convert images to WebP whose URLs were created by
+  // We only convert images to WebP or AVIF whose URLs were created by
   // ImageRewriteFilter, whose ID is "ic".  Note that this code will
   // not ordinarily be awakened for other filters (notabley .ce.) but
   // is left in for paranoia in case this code is live for some path
@@ -266,8 +271,18 @@ bool ImageUrlEncoder::IsWebpRewrittenUrl(const GoogleUrl& gurl) {
     return false;
   }
 
-  StringPiece webp_extension_with_dot = kContentTypeWebp.file_extension();
-  return namer.ext() == webp_extension_with_dot.substr(1);
+  StringPiece extension_with_dot = content_type.file_extension();
+  return namer.ext() == extension_with_dot.substr(1);
+}
+
+}  // namespace
+
+bool ImageUrlEncoder::IsWebpRewrittenUrl(const GoogleUrl& gurl) {
+  return IsImageRewrittenUrlOfType(gurl, kContentTypeWebp);
+}
+
+bool ImageUrlEncoder::IsAvifRewrittenUrl(const GoogleUrl& gurl) {
+  return IsImageRewrittenUrlOfType(gurl, kContentTypeAvif);
 }
 
 void ImageUrlEncoder::SetWebpAndMobileUserAgent(const RewriteDriver& driver,
@@ -289,6 +304,18 @@ void ImageUrlEncoder::SetWebpAndMobileUserAgent(const RewriteDriver& driver,
     SetLibWebpLevel(*options, *driver.request_properties(), context);
   }
 
+  // Without libavif built in there is nothing to convert with, so images
+  // aren't keyed on AVIF support either.
+  if (options->Enabled(RewriteOptions::kConvertToAvif) &&
+      pagespeed::image_compression::AvifFrameWriter::IsAvailable()) {
+    // A rewritten .avif URL only reaches browsers that were sent it
+    // because they accept AVIF, so reconstructing it always uses AVIF.
+    context->set_may_use_avif(
+        (!driver.fetch_url().empty() &&
+         IsAvifRewrittenUrl(driver.decoded_base_url())) ||
+        driver.request_properties()->SupportsAvif());
+  }
+
   if (options->Enabled(RewriteOptions::kDelayImages) &&
       options->Enabled(RewriteOptions::kResizeMobileImages) &&
       driver.request_properties()->IsMobile()) {
@@ -308,7 +335,8 @@ void ImageUrlEncoder::SetSmallScreen(const RewriteDriver& driver,
 // Each image in lossless format may have up to 2 optimized versions
 // (2 formats: Webp and GIF/PNG), while each image in lossy format may have up
 // to 6 optimized versions (2 formats: WebP and JPEG; 3 qualities: Save-Data
-// quality, mobile quality, and regular quality).
+// quality, mobile quality, and regular quality).  may_use_avif adds AVIF
+// as one more candidate format for either, so it doubles the versions.
 //
 // mobile_user_agent, if applies, doubles the optimized versions. However,
 // this flag is usually not effective.
@@ -329,6 +357,9 @@ GoogleString ImageUrlEncoder::CacheKeyFromResourceContext(
       StrAppend(&user_agent_cache_key, kWebpAnimatedUserAgentKey);
       break;
   }
+  if (resource_context.may_use_avif()) {
+    StrAppend(&user_agent_cache_key, kAvifUserAgentKey);
+  }
   if (resource_context.mobile_user_agent()) {
     StrAppend(&user_agent_cache_key, kMobileUserAgentKey);
   }
@@ -669,7 +669,8 @@ void InPlaceRewriteContext::StartFetchReconstructionParent() {
 
 bool InPlaceRewriteContext::InPlaceOptimizeForBrowserEnabled() const {
   return Options()->Enabled(RewriteOptions::kInPlaceOptimizeForBrowser) &&
-         Options()->Enabled(RewriteOptions::kConvertJpegToWebp);
+         (Options()->Enabled(RewriteOptions::kConvertJpegToWebp) ||
+          Options()->Enabled(RewriteOptions::kConvertToAvif));
 }
 
 // TODO(jmaessen): Sharpen this up.  Mark CSS vary:User-Agent because it doesn't
@@ -700,6 +701,7 @@ void InPlaceRewriteContext::AddVaryIfRequired(const CachedResult& cached_result,
         (Options()->Enabled(RewriteOptions::kConvertJpegToWebp) ||
          Options()->Enabled(RewriteOptions::kConvertToWebpLossless) ||
          Options()->Enabled(RewriteOptions::kConvertToWebpAnimated) ||
+         Options()->Enabled(RewriteOptions::kConvertToAvif) ||
          Options()->HasValidSmallScreenQualities())) {
       // If we are allowed to vary on user-agent and the image has been
       // successfully optimized, we need to add "vary: user-agent", since
@@ -708,12 +710,14 @@ void InPlaceRewriteContext::AddVaryIfRequired(const CachedResult& cached_result,
       new_vary = HttpAttributes::kUserAgent;
     } else if (ImageUrlEncoder::AllowVaryOnAccept(*Options(),
                                                   request_properties) &&
-               (image_type == IMAGE_JPEG || image_type == IMAGE_WEBP) &&
-               Options()->Enabled(RewriteOptions::kConvertJpegToWebp)) {
+               (((image_type == IMAGE_JPEG || image_type == IMAGE_WEBP) &&
+                 Options()->Enabled(RewriteOptions::kConvertJpegToWebp)) ||
+                ((image_type != IMAGE_UNKNOWN) &&
+                 Options()->Enabled(RewriteOptions::kConvertToAvif)))) {
       // If we are allowed to vary on Accept header and the image has been
       // successfully optimized to lossy format, we need to add "vary: accept",
       // since we might have used the Accept header for determining image
-      // quality and whether WebP lossy could be used.
+      // quality and whether WebP lossy or AVIF could be used.
       new_vary = HttpAttributes::kAccept;
     }
 
@@ -834,7 +838,8 @@ void InPlaceRewriteContext::EncodeUserAgentIntoResourceContext(
 
   // In IPRO, if we are not allowed to vary on user agent:
   //   - if we are still allowed to vary on accept, we can use lossy format
-  //   - if we are not allowed to vary on accept, we cannot use any WebP format.
+  //   - if we are not allowed to vary on accept, we cannot use any WebP format
+  //     or AVIF.
   if (!vary_on_user_agent) {
     if (ImageUrlEncoder::AllowVaryOnAccept(*Driver()->options(),
                                            *Driver()->request_properties())) {
@@ -843,6 +848,7 @@ void InPlaceRewriteContext::EncodeUserAgentIntoResourceContext(
       }
     } else {
       context->set_libwebp_level(ResourceContext::LIBWEBP_NONE);
+      context->set_may_use_avif(false);
     }
   }
 }
@@ -21,6 +21,8 @@
 
 #include "net/instaweb/rewriter/public/input_info_utils.h"
 
+#include <algorithm>
+
 #include "base/logging.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/server_context.h"
@@ -141,11 +143,14 @@ bool IsInputValid(ServerContext* server_context, const RewriteOptions* options,
         return false;
       }
       int64 ttl_ms = input_info.expiration_time_ms() - now_ms;
+      // The input's own stale-while-revalidate may extend the configured
+      // staleness threshold.
+      int64 staleness_threshold_ms =
+          std::max(options->metadata_cache_staleness_threshold_ms(),
+                   input_info.stale_while_revalidate_ms());
       if (ttl_ms > 0) {
         return true;
-      } else if (!nested_rewrite &&
-                 ttl_ms + options->metadata_cache_staleness_threshold_ms() >
-                     0) {
+      } else if (!nested_rewrite && ttl_ms + staleness_threshold_ms > 0) {
         *stale_rewrite = true;
         return true;
       }
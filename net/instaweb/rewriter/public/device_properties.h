@@ -61,6 +61,9 @@ class DeviceProperties {
   bool SupportsWebpRewrittenUrls() const;
   bool SupportsWebpLosslessAlpha() const;
   bool SupportsWebpAnimated() const;
+  // SupportsAvif indicates we saw an Accept: image/avif header from a user
+  // agent not known to misreport it.
+  bool SupportsAvif() const;
   bool IsBot() const;
   bool AcceptsGzip() const;
   UserAgentMatcher::DeviceType GetDeviceType() const;
@@ -98,10 +101,12 @@ class DeviceProperties {
   mutable LazyBool supports_lazyload_images_;
   mutable LazyBool requests_save_data_;
   mutable LazyBool accepts_webp_;
+  mutable LazyBool accepts_avif_;
   mutable LazyBool accepts_gzip_;
   mutable LazyBool supports_webp_rewritten_urls_;
   mutable LazyBool supports_webp_lossless_alpha_;
   mutable LazyBool supports_webp_animated_;
+  mutable LazyBool supports_avif_;
   mutable LazyBool is_bot_;
   mutable LazyBool is_mobile_user_agent_;
   mutable LazyBool supports_split_html_;
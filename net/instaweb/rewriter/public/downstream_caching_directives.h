@@ -57,6 +57,7 @@ class DownstreamCachingDirectives {
   bool SupportsWebp() const;
   bool SupportsWebpLosslessAlpha() const;
   bool SupportsWebpAnimated() const;
+  bool SupportsAvif() const;
 
  private:
   // Helper method for figuring out support for a given capability based on
@@ -83,6 +84,7 @@ class DownstreamCachingDirectives {
   mutable LazyBool supports_webp_;
   mutable LazyBool supports_webp_lossless_alpha_;
   mutable LazyBool supports_webp_animated_;
+  mutable LazyBool supports_avif_;
 
   GoogleString capabilities_to_be_supported_;
 
@@ -33,6 +33,7 @@
 namespace net_instaweb {
 class Histogram;
 class MessageHandler;
+class ThreadSystem;
 class Timer;
 class Variable;
 struct ContentType;
@@ -53,11 +54,16 @@ class Image {
 
   struct ConversionBySourceVariable {
     ConversionBySourceVariable()
-        : timeout_count(NULL), success_ms(NULL), failure_ms(NULL) {}
+        : timeout_count(NULL),
+          success_ms(NULL),
+          failure_ms(NULL),
+          multithreaded_count(NULL) {}
 
     Variable* timeout_count;  // # of timed-out conversions.
     Histogram* success_ms;    // Successful conversion duration.
     Histogram* failure_ms;    // Failed (and non-timed-out) conversion duration.
+    Variable* multithreaded_count;  // # of conversions, of any outcome, that
+                                    // had helper threads.
   };
 
   struct ConversionVariables {
@@ -86,8 +92,10 @@ class Image {
         : preferred_webp(pagespeed::image_compression::WEBP_NONE),
           allow_webp_alpha(false),
           allow_webp_animated(false),
+          allow_avif(false),
           webp_quality(RewriteOptions::kDefaultImageRecompressQuality),
           webp_animated_quality(RewriteOptions::kDefaultImageRecompressQuality),
+          avif_quality(RewriteOptions::kDefaultImageRecompressQuality),
           jpeg_quality(RewriteOptions::kDefaultImageRecompressQuality),
           progressive_jpeg_min_bytes(
               RewriteOptions::kDefaultProgressiveJpegMinBytes),
@@ -105,17 +113,30 @@ class Image {
           jpeg_num_progressive_scans(
               RewriteOptions::kDefaultImageJpegNumProgressiveScans),
           webp_conversion_timeout_ms(-1),
+          avif_conversion_timeout_ms(-1),
+          encode_helper_threads(0),
+          thread_system(NULL),
+          target_ssim(-1),
+          cached_search_quality(-1),
+          cached_search_image_type(IMAGE_UNKNOWN),
+          quality_search_timeout_ms(-1),
           conversions_attempted(0),
           preserve_lossless(false),
-          webp_conversion_variables(NULL) {}
+          searched_quality(-1),
+          searched_image_type(IMAGE_UNKNOWN),
+          webp_conversion_variables(NULL),
+          avif_conversion_variables(NULL) {}
 
     // These options are set by the client to specify what type of
     // conversion to perform:
     pagespeed::image_compression::PreferredLibwebpLevel preferred_webp;
     bool allow_webp_alpha;
     bool allow_webp_animated;
+    // Lossy conversions try AVIF before WebP or JPEG.
+    bool allow_avif;
     int64 webp_quality;
     int64 webp_animated_quality;
+    int64 avif_quality;
     int64 jpeg_quality;
     int64 progressive_jpeg_min_bytes;
     bool progressive_jpeg;
@@ -131,13 +152,34 @@ class Image {
     bool use_transparent_for_blank_image;
     int64 jpeg_num_progressive_scans;
     int64 webp_conversion_timeout_ms;
+    int64 avif_conversion_timeout_ms;
+    // How many threads, besides the calling one, a conversion may keep busy.
+    // With any, libwebp encodes multithreaded and, given thread_system,
+    // the PNG and JPEG trials of a PNG run side by side.
+    int encode_helper_threads;
+    ThreadSystem* thread_system;
+    // When positive, lossy JPEG and WebP encodes use the lowest quality, up
+    // to jpeg_quality or webp_quality, whose result has at least this SSIM
+    // against the original.  A quality found by an earlier search of the
+    // same image, for the same output type, can be passed in to skip it.
+    double target_ssim;
+    int cached_search_quality;
+    ImageType cached_search_image_type;
+    // Once this many ms have passed the search stops and keeps the lowest
+    // passing quality found so far; negative means no limit.
+    int64 quality_search_timeout_ms;
 
     // These fields are set by the conversion routines to report
     // characteristics of the conversion process.
     int conversions_attempted;
     bool preserve_lossless;
+    // The quality chosen for target_ssim, and the type it applies to, or -1
+    // if no search was made.
+    int searched_quality;
+    ImageType searched_image_type;
 
     ConversionVariables* webp_conversion_variables;
+    ConversionBySourceVariable* avif_conversion_variables;
   };
 
   virtual ~Image();
@@ -181,6 +223,10 @@ class Image {
   // fails.  Otherwise the image contents and type can change.
   virtual bool ResizeTo(const ImageDim& new_dim) = 0;
 
+  // Returns true if ResizeTo() can decode this image a band of scanlines at a
+  // time, holding only the resized image in memory whole.
+  virtual bool CanResizeInBands() = 0;
+
   // Enable the transformation to low res image. If low res image is enabled,
   // all jpeg images are transformed to low quality jpeg images and all webp
   // images to low quality webp images, if possible.
@@ -45,6 +45,8 @@
 
 namespace net_instaweb {
 
+class ExpensiveOperationContext;
+
 // See MessageForInlineResult for enum meanings.
 enum InlineResult {
   INLINE_SUCCESS,
@@ -70,6 +72,7 @@ class ImageRewriteFilter : public RewriteFilter {
 
   // Statistic names:
   static const char kImageNoRewritesHighResolution[];
+  static const char kImageResizedInBandsHighResolution[];
   static const char kImageOngoingRewrites[];
   static const char kImageResizedUsingRenderedDimensions[];
   static const char kImageRewriteLatencyFailedMs[];
@@ -84,6 +87,12 @@ class ImageRewriteFilter : public RewriteFilter {
   static const char kImageRewritesSquashingForMobileScreen[];
   static const char kImageRewrites[];
   static const char kImageWebpRewrites[];
+  static const char kImageAvifRewrites[];
+  static const char kImageQualitySearches[];
+  static const char kImageQualitySearchesReused[];
+  static const char kImageAvifFailureMs[];
+  static const char kImageAvifSuccessMs[];
+  static const char kImageAvifTimeouts[];
   static const char kImageWebpFromGifFailureMs[];
   static const char kImageWebpFromGifSuccessMs[];
   static const char kImageWebpFromGifTimeouts[];
@@ -94,9 +103,11 @@ class ImageRewriteFilter : public RewriteFilter {
   static const char kImageWebpFromPngSuccessMs[];
   static const char kImageWebpFromPngTimeouts[];
   static const char kImageWebpOpaqueFailureMs[];
+  static const char kImageWebpOpaqueMultithreaded[];
   static const char kImageWebpOpaqueSuccessMs[];
   static const char kImageWebpOpaqueTimeouts[];
   static const char kImageWebpWithAlphaFailureMs[];
+  static const char kImageWebpWithAlphaMultithreaded[];
   static const char kImageWebpWithAlphaSuccessMs[];
   static const char kImageWebpWithAlphaTimeouts[];
   static const char kImageWebpFromGifAnimatedFailureMs[];
@@ -235,9 +246,12 @@ class ImageRewriteFilter : public RewriteFilter {
 
   void ComputePreserveUrls(const RewriteOptions* options, ResourceSlot* slot);
 
-  RewriteResult RewriteLoadedResourceImpl(Context* context,
-                                          const ResourcePtr& input_resource,
-                                          const OutputResourcePtr& result);
+  // expensive_operation is the controller slot the rewrite runs in; large
+  // images may claim helper threads through it.
+  RewriteResult RewriteLoadedResourceImpl(
+      Context* context, const ResourcePtr& input_resource,
+      const OutputResourcePtr& result,
+      ExpensiveOperationContext* expensive_operation);
 
   // Returns true if it rewrote (ie inlined) the URL.
   bool FinishRewriteCssImageUrl(int64 css_image_inline_max_bytes,
@@ -297,6 +311,9 @@ class ImageRewriteFilter : public RewriteFilter {
   Variable* image_resized_using_rendered_dimensions_;
   // # of images that we decided not to rewrite because of size constraint.
   Variable* image_norewrites_high_resolution_;
+  // # of images over the size constraint that were rewritten anyway, because
+  // they could be shrunk to fit it a band of scanlines at a time.
+  Variable* image_resized_in_bands_high_resolution_;
   // # of images that we decided not to serve rewritten. This could be because
   // the rewrite failed, recompression wasn't effective enough, the image
   // couldn't be resized because it had an alpha-channel, etc.
@@ -336,6 +353,12 @@ class ImageRewriteFilter : public RewriteFilter {
   Variable* image_inline_count_;
   // # of images rewritten into WebP format.
   Variable* image_webp_rewrites_;
+  // # of images rewritten into AVIF format.
+  Variable* image_avif_rewrites_;
+  // # of rewrites that searched for the quality to meet ImageTargetSsim,
+  // and # that used the quality found by an earlier rewrite instead.
+  Variable* image_quality_searches_;
+  Variable* image_quality_searches_reused_;
   // # of images being rewritten right now.
   UpDownCounter* image_ongoing_rewrites_;
 
@@ -360,6 +383,9 @@ class ImageRewriteFilter : public RewriteFilter {
   // Sets of variables and histograms for various conversions to WebP.
   Image::ConversionVariables webp_conversion_variables_;
 
+  // Timeouts and latency of conversions to AVIF.
+  Image::ConversionBySourceVariable avif_conversion_variables_;
+
   // The options related to this filter.
   static StringPieceVector* related_options_;
 
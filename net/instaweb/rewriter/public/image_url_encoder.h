@@ -80,7 +80,7 @@ class ImageUrlEncoder : public UrlSegmentEncoder {
                               const RequestProperties& request_properties,
                               ResourceContext* resource_context);
 
-  // Sets webp and mobile capability in resource context.
+  // Sets webp, AVIF and mobile capability in resource context.
   //
   // The parameters to this method are urls, rewrite options & resource context.
   // Since rewrite options are not changed, we have passed const reference and
@@ -91,6 +91,9 @@ class ImageUrlEncoder : public UrlSegmentEncoder {
   // Determines whether the given URL is a pagespeed-rewritten webp URL.
   static bool IsWebpRewrittenUrl(const GoogleUrl& gurl);
 
+  // Determines whether the given URL is a pagespeed-rewritten AVIF URL.
+  static bool IsAvifRewrittenUrl(const GoogleUrl& gurl);
+
   // Flag whether this device has a small screen, which determines what
   // Jpeg/WebP quality to use.
   static void SetSmallScreen(const RewriteDriver& driver,
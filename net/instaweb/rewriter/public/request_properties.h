@@ -63,6 +63,7 @@ class RequestProperties {
   bool SupportsWebpRewrittenUrls() const;
   bool SupportsWebpLosslessAlpha() const;
   bool SupportsWebpAnimated() const;
+  bool SupportsAvif() const;
   bool IsBot() const;
   UserAgentMatcher::DeviceType GetDeviceType() const;
   bool IsMobile() const;
@@ -88,6 +89,7 @@ class RequestProperties {
   mutable LazyBool supports_webp_rewritten_urls_;
   mutable LazyBool supports_webp_lossless_alpha_;
   mutable LazyBool supports_webp_animated_;
+  mutable LazyBool supports_avif_;
 
   DISALLOW_COPY_AND_ASSIGN(RequestProperties);
 };
@@ -211,6 +211,13 @@ class RewriteContext {
   const CachedResult* output_partition(int i) const;
   CachedResult* mutable_output_partition(int i);
 
+  // When the metadata cache held an entry that could not be used as is (its
+  // inputs changed or expired), and the rewrite is redone, returns partition
+  // i of that entry, or NULL if there is none.  Filters may use it to carry
+  // results of costly analysis over to the new rewrite, as long as they
+  // check that the input is the same.
+  const CachedResult* previous_output_partition(int i) const;
+
   // Returns true if this context is chained to some predecessors, and
   // must therefore be started by a predecessor and not RewriteDriver.
   bool chained() const { return chained_; }
@@ -676,6 +683,9 @@ class RewriteContext {
   void OutputCacheHit(bool write_partitions);
   void OutputCacheRevalidate(const InputInfoStarVector& to_revalidate);
   void OutputCacheMiss();
+  // Moves any partitions read from the metadata cache to
+  // previous_partitions_, before they are cleared for a new rewrite.
+  void KeepPreviousPartitions();
   void ResourceFetchDone(bool success, ResourcePtr resource, int slot_index);
   void ResourceRevalidateDone(InputInfo* input_info, bool success);
   void LogMetadataCacheInfo(bool cache_ok, bool can_revalidate);
@@ -908,6 +918,8 @@ class RewriteContext {
   AtomicBool frozen_;
 
   std::unique_ptr<OutputPartitions> partitions_;
+  // The unusable metadata cache entry partitions_ was cleared of, if any.
+  std::unique_ptr<OutputPartitions> previous_partitions_;
   OutputResourceVector outputs_;
   int outstanding_fetches_;
   int outstanding_rewrites_;
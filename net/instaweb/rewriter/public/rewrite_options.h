@@ -126,6 +126,7 @@ class RewriteOptions {
     kConvertJpegToWebp,
     kConvertMetaTags,
     kConvertPngToJpeg,
+    kConvertToAvif,
     kConvertToWebpAnimated,
     kConvertToWebpLossless,
     kDebug,
@@ -300,6 +301,7 @@ class RewriteOptions {
   static const char kFollowFlushes[];
   static const char kGoogleFontCssInlineMaxBytes[];
   static const char kForbidAllDisabledFilters[];
+  static const char kFuseStreamingFilters[];
   static const char kHideRefererUsingMeta[];
   static const char kHttpCacheCompressionLevel[];
   static const char kHonorCsp[];
@@ -314,11 +316,16 @@ class RewriteOptions {
   static const char kImageJpegRecompressionQualityForSmallScreens[];
   static const char kImageLimitOptimizedPercent[];
   static const char kImageLimitRenderedAreaPercent[];
+  static const char kImageAvifRecompressionQuality[];
+  static const char kImageAvifTimeoutMs[];
   static const char kImageLimitResizeAreaPercent[];
+  static const char kImageMaxEncodeThreads[];
   static const char kImageMaxRewritesAtOnce[];
   static const char kImagePreserveURLs[];
+  static const char kImageQualitySearchTimeoutMs[];
   static const char kImageRecompressionQuality[];
   static const char kImageResolutionLimitBytes[];
+  static const char kImageTargetSsim[];
   static const char kImageWebpQualityForSaveData[];
   static const char kImageWebpRecompressionQuality[];
   static const char kImageWebpRecompressionQualityForSmallScreens[];
@@ -436,15 +443,21 @@ class RewriteOptions {
   static const char kCacheFlushFilename[];
   static const char kCacheFlushPollIntervalSec[];
   static const char kCompressMetadataCache[];
+  static const char kCompressMetadataCacheDictionaryKb[];
   static const char kFetcherProxy[];
   static const char kFetchHttps[];
   static const char kFileCacheCleanInodeLimit[];
   static const char kFileCacheCleanIntervalMs[];
   static const char kFileCacheCleanSizeKb[];
+  static const char kFileCacheCleanSliceMs[];
+  static const char kFileCacheIoUring[];
+  static const char kFileCacheMode[];
   static const char kFileCachePath[];
   static const char kLogDir[];
+  static const char kLruCacheAdmissionPolicy[];
   static const char kLruCacheByteLimit[];
   static const char kLruCacheKbPerProcess[];
+  static const char kLruCacheShards[];
   static const char kMemcachedServers[];
   static const char kMemcachedThreads[];
   static const char kMemcachedTimeoutUs[];
@@ -572,6 +585,7 @@ class RewriteOptions {
   int64 ImageWebpQualityForSmallScreen() const;
   int64 ImageWebpQualityForSaveData() const;
   int64 ImageWebpAnimatedQuality() const;
+  int64 ImageAvifQuality() const;
   int64 ImageJpegNumProgressiveScansForSmallScreen() const;
   // Returns true if any quality for small screen is valid and different from
   // the base quality.
@@ -838,6 +852,9 @@ class RewriteOptions {
   static const int64 kDefaultImageWebpAnimatedRecompressQuality;
   static const int64 kDefaultImageWebpRecompressQualityForSmallScreens;
   static const int64 kDefaultImageWebpTimeoutMs;
+  static const int64 kDefaultImageAvifRecompressQuality;
+  static const int64 kDefaultImageAvifTimeoutMs;
+  static const int64 kDefaultImageQualitySearchTimeoutMs;
   static const int kDefaultDomainShardCount;
   static const int64 kDefaultOptionCookiesDurationMs;
   static const int64 kDefaultLoadFromFileCacheTtlMs;
@@ -848,6 +865,7 @@ class RewriteOptions {
   static const int kDefaultMaxUrlSize;
 
   static const int kDefaultImageMaxRewritesAtOnce;
+  static const int kDefaultImageMaxEncodeThreads;
 
   // See http://github.com/apache/incubator-pagespeed-mod/issues/9
   // Apache evidently limits each URL path segment (between /) to
@@ -1116,7 +1134,8 @@ class RewriteOptions {
 
   // Checks if either of the optimizing rewrite options are ON and it includes
   // kRecompressJPeg, kRecompressPng, kRecompressWebp, kConvertGifToPng,
-  // kConvertJpegToWebp, kConvertPngToJpeg, and kConvertToWebpLossless.
+  // kConvertJpegToWebp, kConvertPngToJpeg, kConvertToAvif, and
+  // kConvertToWebpLossless.
   bool ImageOptimizationEnabled() const;
 
   explicit RewriteOptions(ThreadSystem* thread_system);
@@ -1766,6 +1785,13 @@ class RewriteOptions {
     set_option(x, &image_max_rewrites_at_once_);
   }
 
+  int image_max_encode_threads() const {
+    return image_max_encode_threads_.value();
+  }
+  void set_image_max_encode_threads(int x) {
+    set_option(x, &image_max_encode_threads_);
+  }
+
   // The maximum size of the entire URL.  If '0', this is left unlimited.
   int max_url_size() const { return max_url_size_.value(); }
   void set_max_url_size(int x) { set_option(x, &max_url_size_); }
@@ -2270,6 +2296,25 @@ class RewriteOptions {
     set_option(x, &image_webp_timeout_ms_);
   }
 
+  void set_image_avif_recompress_quality(int64 x) {
+    set_option(x, &image_avif_recompress_quality_);
+  }
+
+  int64 image_avif_timeout_ms() const { return image_avif_timeout_ms_.value(); }
+  void set_image_avif_timeout_ms(int64 x) {
+    set_option(x, &image_avif_timeout_ms_);
+  }
+
+  double image_target_ssim() const { return image_target_ssim_.value(); }
+  void set_image_target_ssim(double x) { set_option(x, &image_target_ssim_); }
+
+  int64 image_quality_search_timeout_ms() const {
+    return image_quality_search_timeout_ms_.value();
+  }
+  void set_image_quality_search_timeout_ms(int64 x) {
+    set_option(x, &image_quality_search_timeout_ms_);
+  }
+
   bool domain_rewrite_hyperlinks() const {
     return CheckMobilizeFiltersOption(domain_rewrite_hyperlinks_);
   }
@@ -2292,6 +2337,13 @@ class RewriteOptions {
   void set_follow_flushes(bool x) { set_option(x, &follow_flushes_); }
   bool follow_flushes() const { return follow_flushes_.value(); }
 
+  void set_fuse_streaming_filters(bool x) {
+    set_option(x, &fuse_streaming_filters_);
+  }
+  bool fuse_streaming_filters() const {
+    return fuse_streaming_filters_.value();
+  }
+
   void set_enable_defer_js_experimental(bool x) {
     set_option(x, &enable_defer_js_experimental_);
   }
@@ -3421,6 +3473,9 @@ class RewriteOptions {
   static GoogleString OptionSignature(int64 x, const Hasher* hasher) {
     return Integer64ToString(x);
   }
+  static GoogleString OptionSignature(double x, const Hasher* hasher) {
+    return ToString(x);
+  }
   static GoogleString OptionSignature(const GoogleString& x,
                                       const Hasher* hasher);
   static GoogleString OptionSignature(RewriteLevel x, const Hasher* hasher);
@@ -3442,6 +3497,7 @@ class RewriteOptions {
   static GoogleString ToString(bool x) { return x ? "True" : "False"; }
   static GoogleString ToString(int x) { return IntegerToString(x); }
   static GoogleString ToString(int64 x) { return Integer64ToString(x); }
+  static GoogleString ToString(double x);
   static GoogleString ToString(const GoogleString& x) { return x; }
   static GoogleString ToString(RewriteLevel x);
   static GoogleString ToString(const ResourceCategorySet& x);
@@ -3597,7 +3653,21 @@ class RewriteOptions {
   Option<int64> image_webp_quality_for_save_data_;
   Option<int64> image_webp_timeout_ms_;
 
+  // Options related to AVIF compression.
+  Option<int64> image_avif_recompress_quality_;
+  Option<int64> image_avif_timeout_ms_;
+
+  // SSIM that lossy JPEG and WebP encodes search for the lowest quality to
+  // reach; not positive means the configured quality is used as is.
+  Option<double> image_target_ssim_;
+  // Time allowed for that search, after which the best quality found so far
+  // is kept; negative means no limit.
+  Option<int64> image_quality_search_timeout_ms_;
+
   Option<int> image_max_rewrites_at_once_;
+  // Threads one large image rewrite may use, counting its own; the extra
+  // ones are borrowed from the image_max_rewrites_at_once_ budget.
+  Option<int> image_max_encode_threads_;
   Option<int> max_url_segment_size_;  // For http://a/b/c.d, use strlen("c.d").
   Option<int> max_url_size_;          // This is strlen("http://a/b/c.d").
   // The interval to wait for async rewrites to complete before flushing
@@ -3661,6 +3731,7 @@ class RewriteOptions {
   // If set to true, ProxyFetch will request a flush on its RewriteDriver when
   // Flush() is called on it.
   Option<bool> follow_flushes_;
+  Option<bool> fuse_streaming_filters_;
   // Should we serve stale responses if the fetch results in a server side
   // error.
   Option<bool> serve_stale_if_fetch_error_;
@@ -70,6 +70,9 @@ class RewriteStats {
     return num_cache_control_not_rewritable_resources_;
   }
   Variable* num_flushes() { return num_flushes_; }
+  // Traversals of the event queue by HTML filters; a fused run of
+  // streaming-safe filters counts as one.
+  Variable* html_filter_passes() { return html_filter_passes_; }
   Variable* resource_404_count() { return resource_404_count_; }
   Variable* resource_url_domain_acceptances() {
     return resource_url_domain_acceptances_;
@@ -97,6 +100,9 @@ class RewriteStats {
 
   Variable* num_conditional_refreshes() { return num_conditional_refreshes_; }
 
+  // Cache misses served by another request's origin fetch.
+  Variable* num_coalesced_fetches() { return num_coalesced_fetches_; }
+
   Variable* ipro_served() { return ipro_served_; }
   Variable* ipro_not_in_cache() { return ipro_not_in_cache_; }
   Variable* ipro_not_rewritable() { return ipro_not_rewritable_; }
@@ -116,6 +122,10 @@ class RewriteStats {
   // HTML rewrite latency in ms.
   Histogram* rewrite_latency_histogram() { return rewrite_latency_histogram_; }
   Histogram* backend_latency_histogram() { return backend_latency_histogram_; }
+  // Number of HTML filter passes per flush window.
+  Histogram* html_filter_passes_histogram() {
+    return html_filter_passes_histogram_;
+  }
 
   // Number of .pagespeed. resources fetched.
   TimedVariable* total_fetch_count() { return total_fetch_count_; }
@@ -140,6 +150,7 @@ class RewriteStats {
   Variable* num_cache_control_rewritable_resources_;
   Variable* num_cache_control_not_rewritable_resources_;
   Variable* num_flushes_;
+  Variable* html_filter_passes_;
   Variable* page_load_count_;
   Variable* resource_404_count_;
   Variable* resource_url_domain_acceptances_;
@@ -151,6 +162,7 @@ class RewriteStats {
   Variable* num_proactively_freshen_user_facing_request_;
   Variable* fallback_responses_served_while_revalidate_;
   Variable* num_conditional_refreshes_;
+  Variable* num_coalesced_fetches_;
   Variable* ipro_served_;
   Variable* ipro_not_in_cache_;
   Variable* ipro_not_rewritable_;
@@ -161,6 +173,7 @@ class RewriteStats {
   Histogram* fetch_latency_histogram_;
   Histogram* rewrite_latency_histogram_;
   Histogram* backend_latency_histogram_;
+  Histogram* html_filter_passes_histogram_;
 
   TimedVariable* total_fetch_count_;
   TimedVariable* total_rewrite_count_;
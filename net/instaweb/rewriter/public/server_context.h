@@ -68,6 +68,7 @@ class CriticalImagesFinder;
 class CriticalSelectorFinder;
 class RequestProperties;
 class ExperimentMatcher;
+class FetchCoalescer;
 class FileSystem;
 class GoogleUrl;
 class MessageHandler;
@@ -220,6 +221,10 @@ class ServerContext {
   HTTPCache* http_cache() const { return http_cache_.get(); }
   void set_http_cache(HTTPCache* x) { http_cache_.reset(x); }
 
+  // Shared by the cache fetchers made in CreateCustomCacheFetcher, so that
+  // concurrent misses on http_cache() share one origin fetch.
+  FetchCoalescer* fetch_coalescer() { return fetch_coalescer_.get(); }
+
   // Creates PagePropertyCache object with the provided PropertyStore object.
   void MakePagePropertyCache(PropertyStore* property_store);
 
@@ -692,6 +697,7 @@ class ServerContext {
 
   Timer* timer_;
   std::unique_ptr<HTTPCache> http_cache_;
+  std::unique_ptr<FetchCoalescer> fetch_coalescer_;
   std::unique_ptr<PropertyCache> page_property_cache_;
   CacheInterface* filesystem_metadata_cache_;
   CacheInterface* metadata_cache_;
@@ -35,10 +35,12 @@ const int kNoQualityGiven = -1;
 
 // Optimizer in the style of pagespeed/kernel/image/jpeg_optimizer.h that
 // creates a webp-formatted image in compressed_webp from the jpeg image in
-// original_jpeg.  Indicates failure by returning false, in which case
-// compressed_webp may be filled with junk.
+// original_jpeg.  A non-zero thread_level lets libwebp use helper threads.
+// Indicates failure by returning false, in which case compressed_webp may be
+// filled with junk.
 bool OptimizeWebp(const GoogleString& original_jpeg, int configured_quality,
-                  WebpProgressHook progress_hook, void* progress_hook_data,
+                  int thread_level, WebpProgressHook progress_hook,
+                  void* progress_hook_data,
                   GoogleString* compressed_webp,
                   MessageHandler* message_handler);
 
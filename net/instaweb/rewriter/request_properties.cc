@@ -37,7 +37,8 @@ RequestProperties::RequestProperties(UserAgentMatcher* matcher)
       supports_webp_in_place_(kNotSet),
       supports_webp_rewritten_urls_(kNotSet),
       supports_webp_lossless_alpha_(kNotSet),
-      supports_webp_animated_(kNotSet) {}
+      supports_webp_animated_(kNotSet),
+      supports_avif_(kNotSet) {}
 
 RequestProperties::~RequestProperties() {}
 
@@ -152,6 +153,16 @@ bool RequestProperties::SupportsWebpAnimated() const {
   return (supports_webp_animated_ == kTrue);
 }
 
+bool RequestProperties::SupportsAvif() const {
+  if (supports_avif_ == kNotSet) {
+    supports_avif_ = (downstream_caching_directives_->SupportsAvif() &&
+                      device_properties_->SupportsAvif())
+                         ? kTrue
+                         : kFalse;
+  }
+  return (supports_avif_ == kTrue);
+}
+
 bool RequestProperties::IsBot() const { return device_properties_->IsBot(); }
 
 bool RequestProperties::IsMobile() const {
@@ -213,6 +213,9 @@ void Resource::FillInPartitionInputInfoFromResponseHeaders(
   }
   input->set_expiration_time_ms(headers.CacheExpirationTimeMs());
   input->set_date_ms(headers.date_ms());
+  if (headers.stale_while_revalidate_ms() > 0) {
+    input->set_stale_while_revalidate_ms(headers.stale_while_revalidate_ms());
+  }
 }
 
 int64 Resource::CacheExpirationTimeMs() const {
@@ -1042,6 +1042,14 @@ const CachedResult* RewriteContext::output_partition(int i) const {
   return &partitions_->partition(i);
 }
 
+const CachedResult* RewriteContext::previous_output_partition(int i) const {
+  if (previous_partitions_ == nullptr ||
+      i >= previous_partitions_->partition_size()) {
+    return nullptr;
+  }
+  return &previous_partitions_->partition(i);
+}
+
 CachedResult* RewriteContext::mutable_output_partition(int i) {
   CheckNotFrozen();
   return partitions_->mutable_partition(i);
@@ -1381,6 +1389,7 @@ void RewriteContext::OutputCacheMiss() {
   is_metadata_cache_miss_ = true;
   outputs_.clear();
   CheckNotFrozen();
+  KeepPreviousPartitions();
   partitions_->Clear();
   ServerContext* server_context = FindServerContext();
   if (server_context->shutting_down()) {
@@ -2709,10 +2718,18 @@ void RewriteContext::StartFetchReconstruction() {
   // Note that in case of fetches we continue even if we didn't manage to
   // take the lock.
   CheckNotFrozen();
+  KeepPreviousPartitions();
   partitions_->Clear();
   FetchInputs();
 }
 
+void RewriteContext::KeepPreviousPartitions() {
+  if (partitions_->partition_size() > 0) {
+    previous_partitions_ = std::make_unique<OutputPartitions>();
+    previous_partitions_->Swap(partitions_.get());
+  }
+}
+
 void RewriteContext::DetachFetch() {
   CHECK(IsFetchRewrite());
   fetch_->set_detached(true);
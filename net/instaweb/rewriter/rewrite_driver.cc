@@ -297,6 +297,7 @@ void RewriteDriver::PopulateRequestContext() {
   if ((request_context_.get() != nullptr && (request_headers_ != nullptr))) {
     request_context_->SetAcceptsWebp(
         request_properties_->SupportsWebpRewrittenUrls());
+    request_context_->SetAcceptsAvif(request_properties_->SupportsAvif());
     request_context_->SetAcceptsGzip(request_properties_->AcceptsGzip());
     request_context_->Freeze();
   }
@@ -655,20 +656,8 @@ void RewriteDriver::FlushAsync(Function* callback) {
   // can modify urls.
   DetermineFiltersBehavior();
 
-  for (FilterList::iterator it = early_pre_render_filters_.begin();
-       it != early_pre_render_filters_.end(); ++it) {
-    HtmlFilter* filter = *it;
-    if (filter->is_enabled()) {
-      ApplyFilter(filter);
-    }
-  }
-  for (FilterList::iterator it = pre_render_filters_.begin();
-       it != pre_render_filters_.end(); ++it) {
-    HtmlFilter* filter = *it;
-    if (filter->is_enabled()) {
-      ApplyFilter(filter);
-    }
-  }
+  ApplyFilters(early_pre_render_filters_);
+  ApplyFilters(pre_render_filters_);
 
   int num_rewrites = rewrites_.size();
 
@@ -840,6 +829,12 @@ void RewriteDriver::FlushAsyncDone(int num_rewrites, Function* callback) {
   // Run all the post-render filters, and clear the event queue.
   HtmlParse::Flush();
   flush_occurred_ = true;
+  int filter_passes = filter_passes_in_last_flush();
+  if (filter_passes > 0) {
+    RewriteStats* stats = server_context_->rewrite_stats();
+    stats->html_filter_passes()->Add(filter_passes);
+    stats->html_filter_passes_histogram()->Add(filter_passes);
+  }
   callback->CallRun();
 }
 
@@ -1434,9 +1429,13 @@ void RewriteDriver::SetSessionFetcher(UrlAsyncFetcher* f) {
 
 CacheUrlAsyncFetcher* RewriteDriver::CreateCustomCacheFetcher(
     UrlAsyncFetcher* base_fetcher) {
-  return server_context()->CreateCustomCacheFetcher(
+  CacheUrlAsyncFetcher* fetcher = server_context()->CreateCustomCacheFetcher(
       options(), CacheFragment(), cache_url_async_fetcher_async_op_hooks_.get(),
       base_fetcher);
+  // Background refreshes hold an async event on this driver until they are
+  // done, which keeps the sequence alive for as long as they need it.
+  fetcher->set_background_refresh_sequence(low_priority_rewrite_worker_);
+  return fetcher;
 }
 
 CacheUrlAsyncFetcher* RewriteDriver::CreateCacheFetcher() {
@@ -2134,6 +2133,7 @@ bool RewriteDriver::StartParseId(const StringPiece& url, const StringPiece& id,
   }
   start_time_ms_ = server_context_->timer()->NowMs();
   set_log_rewrite_timing(options()->log_rewrite_timing());
+  set_fuse_streaming_filters(options()->fuse_streaming_filters());
 
   if (debug_filter_ != nullptr) {
     debug_filter_->InitParse();
@@ -2933,6 +2933,11 @@ bool OptionsAwareHTTPCacheCallback::IsCacheValid(
       headers.HasValue(HttpAttributes::kVary, HttpAttributes::kAccept)) {
     return false;
   }
+  if ((headers.DetermineContentType() == &kContentTypeAvif) &&
+      !request_ctx->accepts_avif() &&
+      headers.HasValue(HttpAttributes::kVary, HttpAttributes::kAccept)) {
+    return false;
+  }
 
   return (headers.has_date_ms() &&
           rewrite_options.IsUrlCacheValid(url, headers.date_ms(),
@@ -79,6 +79,8 @@ const char RewriteOptions::kCacheSmallImagesUnrewritten[] =
 const char RewriteOptions::kClientDomainRewrite[] = "ClientDomainRewrite";
 const char RewriteOptions::kCombineAcrossPaths[] = "CombineAcrossPaths";
 const char RewriteOptions::kCompressMetadataCache[] = "CompressMetadataCache";
+const char RewriteOptions::kCompressMetadataCacheDictionaryKb[] =
+    "CompressMetadataCacheDictionaryKb";
 const char RewriteOptions::kContentExperimentID[] = "ContentExperimentID";
 const char RewriteOptions::kContentExperimentVariantID[] =
     "ContentExperimentVariantID";
@@ -128,6 +130,7 @@ const char RewriteOptions::kFinderPropertiesCacheRefreshTimeMs[] =
 const char RewriteOptions::kFlushBufferLimitBytes[] = "FlushBufferLimitBytes";
 const char RewriteOptions::kFlushHtml[] = "FlushHtml";
 const char RewriteOptions::kFollowFlushes[] = "FollowFlushes";
+const char RewriteOptions::kFuseStreamingFilters[] = "FuseStreamingFilters";
 const char RewriteOptions::kForbidAllDisabledFilters[] =
     "ForbidAllDisabledFilters";
 const char RewriteOptions::kGoogleFontCssInlineMaxBytes[] =
@@ -154,12 +157,19 @@ const char RewriteOptions::kImageLimitRenderedAreaPercent[] =
     "ImageLimitRenderedAreaPercent";
 const char RewriteOptions::kImageLimitResizeAreaPercent[] =
     "ImageLimitResizeAreaPercent";
+const char RewriteOptions::kImageAvifRecompressionQuality[] =
+    "AvifRecompressionQuality";
+const char RewriteOptions::kImageAvifTimeoutMs[] = "AvifTimeoutMs";
+const char RewriteOptions::kImageMaxEncodeThreads[] = "ImageMaxEncodeThreads";
 const char RewriteOptions::kImageMaxRewritesAtOnce[] = "ImageMaxRewritesAtOnce";
 const char RewriteOptions::kImagePreserveURLs[] = "ImagePreserveURLs";
+const char RewriteOptions::kImageQualitySearchTimeoutMs[] =
+    "ImageQualitySearchTimeoutMs";
 const char RewriteOptions::kImageRecompressionQuality[] =
     "ImageRecompressionQuality";
 const char RewriteOptions::kImageResolutionLimitBytes[] =
     "ImageResolutionLimitBytes";
+const char RewriteOptions::kImageTargetSsim[] = "ImageTargetSsim";
 const char RewriteOptions::kImageWebpRecompressionQuality[] =
     "WebpRecompressionQuality";
 const char RewriteOptions::kImageWebpRecompressionQualityForSmallScreens[] =
@@ -319,10 +329,16 @@ const char RewriteOptions::kFileCacheCleanInodeLimit[] = "FileCacheInodeLimit";
 const char RewriteOptions::kFileCacheCleanIntervalMs[] =
     "FileCacheCleanIntervalMs";
 const char RewriteOptions::kFileCacheCleanSizeKb[] = "FileCacheSizeKb";
+const char RewriteOptions::kFileCacheCleanSliceMs[] = "FileCacheCleanSliceMs";
+const char RewriteOptions::kFileCacheIoUring[] = "FileCacheIoUring";
+const char RewriteOptions::kFileCacheMode[] = "FileCacheMode";
 const char RewriteOptions::kFileCachePath[] = "FileCachePath";
 const char RewriteOptions::kLogDir[] = "LogDir";
+const char RewriteOptions::kLruCacheAdmissionPolicy[] =
+    "LRUCacheAdmissionPolicy";
 const char RewriteOptions::kLruCacheByteLimit[] = "LRUCacheByteLimit";
 const char RewriteOptions::kLruCacheKbPerProcess[] = "LRUCacheKbPerProcess";
+const char RewriteOptions::kLruCacheShards[] = "LRUCacheShards";
 const char RewriteOptions::kMemcachedServers[] = "MemcachedServers";
 const char RewriteOptions::kMemcachedThreads[] = "MemcachedThreads";
 const char RewriteOptions::kMemcachedTimeoutUs[] = "MemcachedTimeoutUs";
@@ -428,6 +444,9 @@ const int64 RewriteOptions::kDefaultPrioritizeVisibleContentCacheTimeMs =
 // TODO(jmaessen): Determine a sane default for this value.
 const int RewriteOptions::kDefaultImageMaxRewritesAtOnce = 8;
 
+// By default each image is optimized on a single thread.
+const int RewriteOptions::kDefaultImageMaxEncodeThreads = 1;
+
 // IE limits URL size overall to about 2k characters.  See
 // http://support.microsoft.com/kb/208427/EN-US
 const int RewriteOptions::kDefaultMaxUrlSize = 2083;
@@ -475,6 +494,20 @@ const int64 RewriteOptions::kDefaultImageWebpQualityForSaveData = 50;
 // image. If negative, does not time out.
 const int64 RewriteOptions::kDefaultImageWebpTimeoutMs = -1;
 
+// AV1 holds up better than WebP at low quality, so AVIF defaults lower.
+const int64 RewriteOptions::kDefaultImageAvifRecompressQuality = 60;
+
+// Timeout, in ms, for each AVIF conversion attempt. libavif can not stop
+// an encode early, so a late result is discarded rather than cut short; the
+// encoder's pixel limit is what keeps the encode itself short.
+const int64 RewriteOptions::kDefaultImageAvifTimeoutMs = 10 * Timer::kSecondMs;
+
+// Timeout, in ms, for the ImageTargetSsim quality search of one image.  Each
+// step of the search is a full encode and decode, so a large image can take
+// several seconds.
+const int64 RewriteOptions::kDefaultImageQualitySearchTimeoutMs =
+    5 * Timer::kSecondMs;
+
 const int64 RewriteOptions::kDefaultMaxCacheableResponseContentLength =
     16777216;  // 16 MB in bytes
 
@@ -752,6 +785,8 @@ const RewriteOptions::FilterEnumToIdAndNameEntry
         {RewriteOptions::kConvertJpegToWebp, "jw", "Convert Jpeg To Webp"},
         {RewriteOptions::kConvertMetaTags, "mc", "Convert Meta Tags"},
         {RewriteOptions::kConvertPngToJpeg, "pj", "Convert Png to Jpeg"},
+        {RewriteOptions::kConvertToAvif, "av",
+         "Convert images to AVIF for browsers that accept it"},
         {RewriteOptions::kConvertToWebpAnimated, "wa",
          "Convert animated images to WebP"},
         {RewriteOptions::kConvertToWebpLossless, "ws",
@@ -1098,6 +1133,7 @@ bool RewriteOptions::ImageOptimizationEnabled() const {
           this->Enabled(RewriteOptions::kConvertJpegToProgressive) ||
           this->Enabled(RewriteOptions::kConvertPngToJpeg) ||
           this->Enabled(RewriteOptions::kConvertJpegToWebp) ||
+          this->Enabled(RewriteOptions::kConvertToAvif) ||
           this->Enabled(RewriteOptions::kConvertToWebpAnimated) ||
           this->Enabled(RewriteOptions::kConvertToWebpLossless));
 }
@@ -1302,6 +1338,13 @@ void RewriteOptions::AddProperties() {
                   "Set bound on number of images being rewritten at one time "
                   "(0 = unbounded).",
                   true);
+  AddBaseProperty(kDefaultImageMaxEncodeThreads,
+                  &RewriteOptions::image_max_encode_threads_, "imet",
+                  kImageMaxEncodeThreads, kDirectoryScope,
+                  "Number of threads a large image rewrite may use, including "
+                  "its own. Extra threads are only taken while fewer than "
+                  "ImageMaxRewritesAtOnce rewrites are running.",
+                  true);
   AddBaseProperty(kDefaultMaxUrlSegmentSize,
                   &RewriteOptions::max_url_segment_size_, "uss",
                   kMaxUrlSegmentSize, kDirectoryScope,
@@ -1309,6 +1352,32 @@ void RewriteOptions::AddProperties() {
   AddBaseProperty(kDefaultMaxUrlSize, &RewriteOptions::max_url_size_, "us",
                   kMaxUrlSize, kDirectoryScope, nullptr,
                   true);  // TODO(jmarantz): write help & doc for mod_pagespeed.
+  AddBaseProperty(
+      kDefaultImageAvifRecompressQuality,
+      &RewriteOptions::image_avif_recompress_quality_, "iav",
+      kImageAvifRecompressionQuality, kQueryScope,
+      "Quality for images converted to AVIF [-1,100], 100 refers to best "
+      "quality, -1 uses ImageRecompressionQuality.",
+      true);
+  AddBaseProperty(kDefaultImageAvifTimeoutMs,
+                  &RewriteOptions::image_avif_timeout_ms_, "avt",
+                  kImageAvifTimeoutMs, kLegacyProcessScope,
+                  "Time allowed for converting one image to AVIF, in ms. "
+                  "Negative means no limit.",
+                  true);
+  AddBaseProperty(-1.0, &RewriteOptions::image_target_ssim_, "its",
+                  kImageTargetSsim, kQueryScope,
+                  "SSIM, below 1, that lossy JPEG and WebP images are "
+                  "recompressed to with the lowest quality that reaches it. "
+                  "Not positive means the configured quality is always used.",
+                  true);
+  AddBaseProperty(kDefaultImageQualitySearchTimeoutMs,
+                  &RewriteOptions::image_quality_search_timeout_ms_, "iqst",
+                  kImageQualitySearchTimeoutMs, kLegacyProcessScope,
+                  "Time allowed for the ImageTargetSsim quality search of one "
+                  "image, in ms, after which the best quality found so far is "
+                  "used. Negative means no limit.",
+                  true);
   AddBaseProperty(false, &RewriteOptions::forbid_all_disabled_filters_, "fadf",
                   kForbidAllDisabledFilters, kDirectoryScope,
                   "Prevents the use of disabled filters", true);
@@ -1472,7 +1541,8 @@ void RewriteOptions::AddProperties() {
       0, &RewriteOptions::serve_stale_while_revalidate_threshold_sec_, "sswrt",
       kServeStaleWhileRevalidateThresholdSec, kDirectoryScope,
       "Threshold for serving serving stale responses while revalidating in "
-      "background. 0 means don't serve stale content."
+      "background. 0 means don't serve stale content unless the response's "
+      "own Cache-Control: stale-while-revalidate allows it. "
       "Note: Stale response will be served only for non-html requests.",
       true);
   AddBaseProperty(
@@ -1481,6 +1551,12 @@ void RewriteOptions::AddProperties() {
       "Attempt to mirror incoming flushes for html streams in the output "
       "when ProxyFetch is used.",
       true);
+  AddBaseProperty(
+      false, &RewriteOptions::fuse_streaming_filters_, "fsf",
+      kFuseStreamingFilters, kDirectoryScope,
+      "Run adjacent streaming-safe HTML filters in a single pass over each "
+      "flush window, rather than one pass per filter.",
+      true);
   AddBaseProperty(false, &RewriteOptions::enable_defer_js_experimental_, "edje",
                   kEnableDeferJsExperimental, kDirectoryScope,
                   "Enable experimental options in defer javascript.", true);
@@ -3882,6 +3958,11 @@ GoogleString RewriteOptions::ToString(const ResourceCategorySet& x) {
   return result;
 }
 
+GoogleString RewriteOptions::ToString(double x) {
+  // Enough digits to tell apart SSIM targets such as 0.9995 and 0.9999.
+  return absl::StrFormat("%.6g", x);
+}
+
 GoogleString RewriteOptions::ToString(RewriteLevel level) {
   switch (level) {
     case kPassThrough:
@@ -5078,6 +5159,14 @@ int64 RewriteOptions::ImageWebpAnimatedQuality() const {
   return quality;
 }
 
+int64 RewriteOptions::ImageAvifQuality() const {
+  int64 quality = image_avif_recompress_quality_.value();
+  if (quality < 0) {
+    quality = image_recompress_quality_.value();
+  }
+  return quality;
+}
+
 int64 RewriteOptions::ImageJpegNumProgressiveScansForSmallScreen() const {
   int64 num = image_jpeg_num_progressive_scans_for_small_screens_.value();
   if (num < 0) {
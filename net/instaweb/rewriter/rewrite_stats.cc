@@ -40,12 +40,14 @@ const char kResourceFetchConstructSuccesses[] =
 const char kResourceFetchConstructFailures[] =
     "resource_fetch_construct_failures";
 const char kNumFlushes[] = "num_flushes";
+const char kHtmlFilterPasses[] = "html_filter_passes";
 const char kFallbackResponsesServed[] = "num_fallback_responses_served";
 const char kProactivelyFreshenUserFacingRequest[] =
     "num_proactively_freshen_user_facing_request";
 const char kFallbackResponsesServedWhileRevalidate[] =
     "num_fallback_responses_served_while_revalidate";
 const char kNumConditionalRefreshes[] = "num_conditional_refreshes";
+const char kNumCoalescedFetches[] = "num_coalesced_fetches";
 
 const char kIproServed[] = "ipro_served";
 const char kIproNotInCache[] = "ipro_not_in_cache";
@@ -72,6 +74,8 @@ const char kFetchLatencyHistogram[] = "Pagespeed Resource Latency Histogram";
 const char kRewriteLatencyHistogram[] = "Rewrite Latency Histogram";
 const char kBackendLatencyHistogram[] =
     "Backend Fetch First Byte Latency Histogram";
+const char kHtmlFilterPassesHistogram[] = "HTML Filter Passes Per Flush";
+const int kHtmlFilterPassesHistogramMaxValue = 100;
 
 // TimedVariable names.
 const char kTotalFetchCount[] = "total_fetch_count";
@@ -123,14 +127,17 @@ void RewriteStats::InitStats(Statistics* statistics) {
   statistics->AddVariable(kNumCacheControlRewritableResources);
   statistics->AddVariable(kNumCacheControlNotRewritableResources);
   statistics->AddVariable(kNumFlushes);
+  statistics->AddVariable(kHtmlFilterPasses);
   statistics->AddHistogram(kBeaconTimingsMsHistogram);
   statistics->AddHistogram(kFetchLatencyHistogram);
   statistics->AddHistogram(kRewriteLatencyHistogram);
   statistics->AddHistogram(kBackendLatencyHistogram);
+  statistics->AddHistogram(kHtmlFilterPassesHistogram);
   statistics->AddVariable(kFallbackResponsesServed);
   statistics->AddVariable(kProactivelyFreshenUserFacingRequest);
   statistics->AddVariable(kFallbackResponsesServedWhileRevalidate);
   statistics->AddVariable(kNumConditionalRefreshes);
+  statistics->AddVariable(kNumCoalescedFetches);
   statistics->AddVariable(kIproServed);
   statistics->AddVariable(kIproNotInCache);
   statistics->AddVariable(kIproNotRewritable);
@@ -167,6 +174,7 @@ RewriteStats::RewriteStats(bool has_waveforms, Statistics* stats,
       num_cache_control_not_rewritable_resources_(
           stats->GetVariable(kNumCacheControlNotRewritableResources)),
       num_flushes_(stats->GetVariable(kNumFlushes)),
+      html_filter_passes_(stats->GetVariable(kHtmlFilterPasses)),
       page_load_count_(stats->GetVariable(kPageLoadCount)),
       resource_404_count_(stats->GetVariable(kInstawebResource404Count)),
       resource_url_domain_acceptances_(
@@ -183,6 +191,7 @@ RewriteStats::RewriteStats(bool has_waveforms, Statistics* stats,
       fallback_responses_served_while_revalidate_(
           stats->GetVariable(kFallbackResponsesServedWhileRevalidate)),
       num_conditional_refreshes_(stats->GetVariable(kNumConditionalRefreshes)),
+      num_coalesced_fetches_(stats->GetVariable(kNumCoalescedFetches)),
       ipro_served_(stats->GetVariable(kIproServed)),
       ipro_not_in_cache_(stats->GetVariable(kIproNotInCache)),
       ipro_not_rewritable_(stats->GetVariable(kIproNotRewritable)),
@@ -195,6 +204,8 @@ RewriteStats::RewriteStats(bool has_waveforms, Statistics* stats,
       fetch_latency_histogram_(stats->GetHistogram(kFetchLatencyHistogram)),
       rewrite_latency_histogram_(stats->GetHistogram(kRewriteLatencyHistogram)),
       backend_latency_histogram_(stats->GetHistogram(kBackendLatencyHistogram)),
+      html_filter_passes_histogram_(
+          stats->GetHistogram(kHtmlFilterPassesHistogram)),
       total_fetch_count_(stats->GetTimedVariable(kTotalFetchCount)),
       total_rewrite_count_(stats->GetTimedVariable(kTotalRewriteCount)),
       num_rewrites_executed_(stats->GetTimedVariable(kRewritesExecuted)),
@@ -208,6 +219,8 @@ RewriteStats::RewriteStats(bool has_waveforms, Statistics* stats,
   fetch_latency_histogram_->EnableNegativeBuckets();
   rewrite_latency_histogram_->EnableNegativeBuckets();
   backend_latency_histogram_->EnableNegativeBuckets();
+  html_filter_passes_histogram_->SetMaxValue(
+      kHtmlFilterPassesHistogramMaxValue);
 
   for (int i = 0; i < RewriteDriverFactory::kNumWorkerPools; ++i) {
     if (has_waveforms) {
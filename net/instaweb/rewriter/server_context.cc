@@ -25,6 +25,7 @@
 
 #include "base/logging.h"  // for operator<<, etc
 #include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/fetch_coalescer.h"
 #include "net/instaweb/http/public/http_cache.h"
 #include "net/instaweb/http/public/sync_fetcher_adapter_callback.h"
 #include "net/instaweb/http/public/url_async_fetcher.h"
@@ -243,6 +244,7 @@ ServerContext::ServerContext(RewriteDriverFactory* factory)
       contents_hasher_(21),
       statistics_(nullptr),
       timer_(nullptr),
+      fetch_coalescer_(new FetchCoalescer(thread_system_)),
       filesystem_metadata_cache_(nullptr),
       metadata_cache_(nullptr),
       store_outputs_in_file_system_(false),
@@ -1348,6 +1350,8 @@ CacheUrlAsyncFetcher* ServerContext::CreateCustomCacheFetcher(
       stats->fallback_responses_served_while_revalidate());
   cache_fetcher->set_num_conditional_refreshes(
       stats->num_conditional_refreshes());
+  cache_fetcher->set_fetch_coalescer(fetch_coalescer_.get());
+  cache_fetcher->set_num_coalesced_fetches(stats->num_coalesced_fetches());
   cache_fetcher->set_serve_stale_if_fetch_error(
       options->serve_stale_if_fetch_error());
   cache_fetcher->set_proactively_freshen_user_facing_request(
@@ -95,7 +95,7 @@ class WebpOptimizer {
   // Take the given input file and transcode it to webp.
   // Return true on success.
   bool CreateOptimizedWebp(const GoogleString& original_jpeg,
-                           int configured_quality,
+                           int configured_quality, int thread_level,
                            WebpProgressHook progress_hook,
                            void* progress_hook_data,
                            GoogleString* compressed_webp);
@@ -326,6 +326,7 @@ int WebpOptimizer::ProgressHook(int percent, const WebPPicture* picture) {
 // Main body of transcode.
 bool WebpOptimizer::CreateOptimizedWebp(const GoogleString& original_jpeg,
                                         int configured_quality,
+                                        int thread_level,
                                         WebpProgressHook progress_hook,
                                         void* progress_hook_data,
                                         GoogleString* compressed_webp) {
@@ -369,6 +370,7 @@ bool WebpOptimizer::CreateOptimizedWebp(const GoogleString& original_jpeg,
     // no increase in file size. Method 2 incurs a prohibitive 10% increase in
     // file size, which is not worth the compression time savings.
     config.method = 3;
+    config.thread_level = thread_level;
     if (!WebPValidateConfig(&config)) {
       return false;
     }
@@ -422,13 +424,13 @@ bool WebpOptimizer::CreateOptimizedWebp(const GoogleString& original_jpeg,
 }  // namespace
 
 bool OptimizeWebp(const GoogleString& original_jpeg, int configured_quality,
-                  WebpProgressHook progress_hook, void* progress_hook_data,
-                  GoogleString* compressed_webp,
+                  int thread_level, WebpProgressHook progress_hook,
+                  void* progress_hook_data, GoogleString* compressed_webp,
                   MessageHandler* message_handler) {
   WebpOptimizer optimizer(message_handler);
   return optimizer.CreateOptimizedWebp(original_jpeg, configured_quality,
-                                       progress_hook, progress_hook_data,
-                                       compressed_webp);
+                                       thread_level, progress_hook,
+                                       progress_hook_data, compressed_webp);
 }
 
 // Helper function to initialize picture object from WebP decode buffer.
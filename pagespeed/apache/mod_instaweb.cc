@@ -174,6 +174,8 @@ const char kModPagespeedTrackOriginalContentLength[] =
 const char kModPagespeedUrlValuedAttribute[] = "ModPagespeedUrlValuedAttribute";
 const char kModPagespeedUsePerVHostStatistics[] =
     "ModPagespeedUsePerVHostStatistics";
+const char kModPagespeedWorkStealingWorkerPools[] =
+    "ModPagespeedWorkStealingWorkerPools";
 
 // The following are deprecated due to spelling
 const char kModPagespeedImgInlineMaxBytes[] = "ModPagespeedImgInlineMaxBytes";
@@ -1771,6 +1773,9 @@ static const command_rec mod_pagespeed_filter_cmds[] = {
         kModPagespeedNumExpensiveRewriteThreads,
         "Number of threads to use for computation-intensive portions of "
         "resource-rewriting. <= 0 to auto-detect"),
+    APACHE_CONFIG_OPTION(
+        kModPagespeedWorkStealingWorkerPools,
+        "Schedule rewrite threads with per-thread queues and work stealing"),
     APACHE_CONFIG_OPTION(
         kModPagespeedStaticAssetPrefix,
         "Where to serve static support files for pagespeed filters from."),
@@ -1232,6 +1232,7 @@ bool UrlMightHavePropertyCacheEntry(const GoogleUrl& url) {
     case ContentType::kJpeg:
     case ContentType::kSwf:
     case ContentType::kWebp:
+    case ContentType::kAvif:
     case ContentType::kIco:
     case ContentType::kPdf:
     case ContentType::kOther:
@@ -25,6 +25,10 @@ ExpensiveOperationContext::ExpensiveOperationContext() {}
 
 ExpensiveOperationContext::~ExpensiveOperationContext() {}
 
+int ExpensiveOperationContext::TryToClaimHelpers(int max_helpers) {
+  return 0;
+}
+
 ExpensiveOperationCallback::ExpensiveOperationCallback(Sequence* sequence)
     : CentralControllerCallback<ExpensiveOperationContext>(sequence) {}
 
@@ -38,6 +38,12 @@ class ExpensiveOperationContext {
   // destruction if not explicitly called.
   virtual void Done() = 0;
 
+  // Tries to claim up to max_helpers more slots from the controller, for
+  // helper threads working on this same operation.  Never waits.  Returns
+  // the number of slots claimed; Done() releases them along with the
+  // operation's own.  Returns 0 where the controller can't lend slots.
+  virtual int TryToClaimHelpers(int max_helpers);
+
  protected:
   ExpensiveOperationContext();
 
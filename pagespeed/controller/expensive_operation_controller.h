@@ -41,6 +41,13 @@ class ExpensiveOperationController {
   // Should only be called if Run() was invoked on callback above.
   virtual void NotifyExpensiveOperationComplete() = 0;
 
+  // Claims one more slot on behalf of an operation that is already running,
+  // so that it can spread its work over a helper thread.  Unlike
+  // ScheduleExpensiveOperation this never waits: it returns false unless a
+  // slot is free right now.  Each successful claim must be released with
+  // NotifyExpensiveOperationComplete().  By default no slots are granted.
+  virtual bool TryToClaimExpensiveOperation() { return false; }
+
  protected:
   ExpensiveOperationController() {}
 
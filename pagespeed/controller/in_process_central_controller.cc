@@ -36,7 +36,7 @@ class ExpensiveOperationContextImpl : public ExpensiveOperationContext {
  public:
   ExpensiveOperationContextImpl(ExpensiveOperationController* controller,
                                 ExpensiveOperationCallback* callback)
-      : controller_(controller), callback_(callback) {
+      : controller_(controller), callback_(callback), num_helpers_(0) {
     // SetTransactionContext steals ownership, which means we will never outlive
     // the callback.
     callback_->SetTransactionContext(this);
@@ -49,11 +49,26 @@ class ExpensiveOperationContextImpl : public ExpensiveOperationContext {
 
   void Done() override {
     if (controller_ != nullptr) {
+      for (; num_helpers_ > 0; --num_helpers_) {
+        controller_->NotifyExpensiveOperationComplete();
+      }
       controller_->NotifyExpensiveOperationComplete();
       controller_ = nullptr;
     }
   }
 
+  int TryToClaimHelpers(int max_helpers) override {
+    int claimed = 0;
+    if (controller_ != nullptr) {
+      while (claimed < max_helpers &&
+             controller_->TryToClaimExpensiveOperation()) {
+        ++claimed;
+      }
+      num_helpers_ += claimed;
+    }
+    return claimed;
+  }
+
  private:
   void CallRun() { callback_->CallRun(); }
 
@@ -64,6 +79,7 @@ class ExpensiveOperationContextImpl : public ExpensiveOperationContext {
 
   ExpensiveOperationController* controller_;
   ExpensiveOperationCallback* callback_;
+  int num_helpers_;  // Extra slots claimed by TryToClaimHelpers().
 };
 
 class ScheduleRewriteContextImpl : public ScheduleRewriteContext {
@@ -108,6 +108,17 @@ void QueuedExpensiveOperationController::NotifyExpensiveOperationComplete() {
   }
 }
 
+bool QueuedExpensiveOperationController::TryToClaimExpensiveOperation() {
+  ScopedMutex lock(mutex_.get());
+  // Never let a helper jump ahead of an operation that is waiting for a slot.
+  if (max_in_progress_ == 0 || !queue_.empty() ||
+      (max_in_progress_ > 0 && num_in_progress_ >= max_in_progress_)) {
+    return false;
+  }
+  IncrementInProgress();
+  return true;
+}
+
 void QueuedExpensiveOperationController::Enqueue(Function* callback) {
   queue_.push(callback);
   queued_operations_counter_->Set(queue_.size());
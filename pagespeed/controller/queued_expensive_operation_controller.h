@@ -54,6 +54,7 @@ class QueuedExpensiveOperationController : public ExpensiveOperationController {
   // ExpensiveOperationController interface.
   void ScheduleExpensiveOperation(Function* callback) override;
   void NotifyExpensiveOperationComplete() override;
+  bool TryToClaimExpensiveOperation() override;
 
   static void InitStats(Statistics* stats);
 
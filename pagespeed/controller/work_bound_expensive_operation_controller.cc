@@ -64,6 +64,10 @@ void WorkBoundExpensiveOperationController::ScheduleExpensiveOperation(
   }
 }
 
+bool WorkBoundExpensiveOperationController::TryToClaimExpensiveOperation() {
+  return TryToWork();
+}
+
 void WorkBoundExpensiveOperationController::NotifyExpensiveOperationComplete() {
   if (counter_ != nullptr) {
     counter_->Add(-1);
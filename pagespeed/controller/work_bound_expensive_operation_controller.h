@@ -46,6 +46,7 @@ class WorkBoundExpensiveOperationController
   // ExpensiveOperationController interface.
   void ScheduleExpensiveOperation(Function* callback) override;
   void NotifyExpensiveOperationComplete() override;
+  bool TryToClaimExpensiveOperation() override;
 
   static void InitStats(Statistics* stats);
 
@@ -50,6 +50,7 @@ const char* const server_only_options[] = {
     "FetcherTimeoutMs", "FetchProxy", "ForceCaching", "GeneratedFilePrefix",
     "ImgMaxRewritesAtOnce", "InheritVHostConfig", "InstallCrashHandler",
     "MessageBufferSize", "NumRewriteThreads", "NumExpensiveRewriteThreads",
+    "WorkStealingWorkerPools",
     "StaticAssetPrefix", "TrackOriginalContentLength",
     "UsePerVHostStatistics",  // TODO(anupama): What to do about "No longer
                               // used"
@@ -35,11 +35,13 @@
 
 namespace net_instaweb {
 
+SharedString::Annotation::~Annotation() {}
+
 SharedString::SharedString() : skip_(0), size_(0) {}
 
 SharedString::SharedString(const StringPiece& str)
     : skip_(0), size_(str.size()) {
-  GoogleString* storage = ref_string_.get();
+  GoogleString* storage = mutable_storage();
   str.CopyToString(storage);
 }
 
@@ -47,24 +49,26 @@ SharedString::SharedString(const StringPiece& str)
 // ctor above causes an extra copy compared with string implementations that
 // use copy-on-write.  So we make an explicit GoogleString constructor.
 SharedString::SharedString(const GoogleString& str)
-    : ref_string_(str), skip_(0), size_(str.size()) {}
+    : skip_(0), size_(str.size()) {
+  *mutable_storage() = str;
+}
 
 // Given the two constructors above, it is ambiguous which one gets
 // called when passed a string-literal, so making an explicit const char*
 // constructor eliminates the ambiguity.  This is likely beneficial mostly
 // for tests.
 SharedString::SharedString(const char* str) : skip_(0) {
-  GoogleString* storage = ref_string_.get();
+  GoogleString* storage = mutable_storage();
   *storage = str;
   size_ = storage->size();
 }
 
 SharedString::SharedString(const SharedString& src)
-    : ref_string_(src.ref_string_), skip_(src.skip_), size_(src.size_) {}
+    : storage_(src.storage_), skip_(src.skip_), size_(src.size_) {}
 
 SharedString& SharedString::operator=(const SharedString& src) {
   if (&src != this) {
-    ref_string_ = src.ref_string_;
+    storage_ = src.storage_;
     skip_ = src.skip_;
     size_ = src.size_;
   }
@@ -72,7 +76,7 @@ SharedString& SharedString::operator=(const SharedString& src) {
 }
 
 StringPiece SharedString::Value() const {
-  const GoogleString* storage = ref_string_.get();
+  const GoogleString* storage = &storage_->value;
   DCHECK_LE(size_ + skip_, static_cast<int>(storage->size()));
   return StringPiece(storage->data() + skip_, size_);
 }
@@ -82,15 +86,15 @@ void SharedString::Assign(const char* data, int size) {
   // avoid bugs by copying to a temp and swapping.
   GoogleString temp(data, size);
   ClearIfShared();
-  GoogleString* storage = ref_string_.get();
+  GoogleString* storage = mutable_storage();
   temp.swap(*storage);
   size_ = storage->size();
 }
 
 void SharedString::UniquifyIfTruncated() {
-  if (size_ != (static_cast<int>(ref_string_->size()) - skip_)) {
+  if (size_ != (static_cast<int>(storage_->value.size()) - skip_)) {
     if (unique()) {
-      ref_string_->resize(size_ + skip_);
+      mutable_storage()->resize(size_ + skip_);
     } else {
       *this = SharedString(Value());
       DCHECK(unique());
@@ -102,7 +106,7 @@ void SharedString::Append(const char* new_data, size_t new_size) {
   DCHECK((new_data + new_size) <= data() || (data() + size() < new_data))
       << "Append must be given non-overlapping strings";
   UniquifyIfTruncated();
-  ref_string_->append(new_data, new_size);
+  mutable_storage()->append(new_data, new_size);
   size_ += new_size;
 }
 
@@ -110,7 +114,7 @@ void SharedString::Extend(int new_size) {
   if (size_ < new_size) {
     UniquifyIfTruncated();
     size_ = new_size;
-    ref_string_.get()->resize(size_ + skip_);
+    mutable_storage()->resize(size_ + skip_);
   }
 }
 
@@ -125,7 +129,7 @@ void SharedString::WriteAt(int dest_offset, const char* source, int count) {
 
 void SharedString::SwapWithString(GoogleString* str) {
   ClearIfShared();
-  GoogleString* storage = ref_string_.get();
+  GoogleString* storage = mutable_storage();
   storage->swap(*str);
   skip_ = 0;
   size_ = storage->size();
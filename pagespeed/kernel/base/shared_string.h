@@ -30,6 +30,7 @@
 #include <cstddef>  // for size_t
 
 #include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/ref_counted_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -41,6 +42,29 @@ namespace net_instaweb {
 // SharedString instance's view of it via RemoveSuffix() and RemovePrefix().
 class SharedString {
  public:
+  // An object derived from the string's bytes, such as a decoded form of
+  // them, that travels with the storage: every SharedString linked to the
+  // storage sees the same annotation, so an expensive decode can be done
+  // once and shared by everyone holding a copy, e.g. via an in-memory cache.
+  // Any mutation of the storage drops the annotation.  An annotation
+  // describes the whole storage, so it should be ignored by trimmed
+  // SharedStrings.
+  class Annotation : public RefCounted<Annotation> {
+   public:
+    Annotation() {}
+
+    // Returns roughly how many bytes the annotation holds, so that caches
+    // keeping the string can charge for it too.
+    virtual size_t size() const = 0;
+
+   protected:
+    REFCOUNT_FRIEND_DECLARATION(Annotation);
+    virtual ~Annotation();
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Annotation);
+  };
+
   SharedString();
 
   explicit SharedString(const StringPiece& str);
@@ -126,7 +150,7 @@ class SharedString {
   // Computes the size, taking into account any removed prefix or suffix.
   int size() const { return size_; }
   bool empty() const { return size_ == 0; }
-  const char* data() const { return ref_string_->data() + skip_; }
+  const char* data() const { return storage_->value.data() + skip_; }
 
   // WriteAt allows mutation of the underlying string data.  The
   // string must already be sized as needed via previous Append() or
@@ -145,13 +169,30 @@ class SharedString {
 
   // Determines whether this SharedString shares storage from other
   // SharedStrings.
-  bool unique() const { return ref_string_.unique(); }
+  bool unique() const { return storage_.unique(); }
+
+  // Attaches an annotation to the storage, replacing any previous one, or
+  // removes it if annotation is NULL.  Like Append, this is a mutation of
+  // storage that may be shared, so it must not race with other accesses to
+  // that storage; attach annotations before publishing the string to other
+  // threads.
+  void set_annotation(Annotation* annotation) {
+    storage_->annotation.reset(annotation);
+  }
+  Annotation* annotation() const { return storage_->annotation.get(); }
+
+  // Returns size() plus that of any annotation on the storage, which is what
+  // an in-memory cache holding this string should charge for it.
+  size_t SizeIncludingAnnotation() const {
+    const Annotation* annotation = storage_->annotation.get();
+    return size_ + ((annotation == nullptr) ? 0 : annotation->size());
+  }
 
   // Determines whether RemovePrefix or RemoveSuffix has every been called
   // on this SharedString.  Note that other SharedStrings sharing the
   // same storage as this may be trimmed differently.
   bool trimmed() const {
-    return size_ != static_cast<int>(ref_string_->size());
+    return size_ != static_cast<int>(storage_->value.size());
   }
 
   // Returns back a GoogleString* representation for the contained value.
@@ -165,23 +206,33 @@ class SharedString {
   //
   // This routine is, however, useful to call from tests to determine
   // storage uniqueness.
-  const GoogleString* StringValue() const { return ref_string_.get(); }
+  const GoogleString* StringValue() const { return &storage_->value; }
 
   // Determines whether this and that share the same storage.
   bool SharesStorage(const SharedString& that) const {
-    return ref_string_.get() == that.ref_string_.get();
+    return storage_.get() == that.storage_.get();
   }
 
  private:
   void UniquifyIfTruncated();
-  char* mutable_data() { return &(*ref_string_.get())[0] + skip_; }
+  struct Storage {
+    GoogleString value;
+    RefCountedPtr<Annotation> annotation;
+  };
+
+  // Returns the string storage for mutation, dropping any annotation.
+  GoogleString* mutable_storage() {
+    storage_->annotation.clear();
+    return &storage_->value;
+  }
+  char* mutable_data() { return &(*mutable_storage())[0] + skip_; }
   void ClearIfShared() {
     if (!unique()) {
       DetachAndClear();
     }
   }
 
-  RefCountedObj<GoogleString> ref_string_;
+  RefCountedObj<Storage> storage_;
 
   int skip_;  // Number of bytes to skip at the beginning of the string.
   int size_;  // Number of bytes visible in the current view.
@@ -50,7 +50,9 @@ class Variable {
   // implementation has some sensible way of doing so.
   virtual StringPiece GetName() const = 0;
 
-  // Adds 'delta' to the variable's value, returning the result.
+  // Adds 'delta' to the variable's value, returning the result.  Some
+  // implementations can't do that cheaply and don't: SimpleStats returns
+  // just delta, and NullStatistics 0.  Call Get() when the total matters.
   int64 Add(int64 non_negative_delta) {
     DCHECK_LE(0, non_negative_delta);
     return AddHelper(non_negative_delta);
@@ -92,6 +94,7 @@ class UpDownCounter {
 
   virtual void Set(int64 value) = 0;
   void Clear() { Set(0); }
+  // Like Variable::Add, the result need not be the new value.
   int64 Add(int64 delta) { return AddHelper(delta); }
 
  protected:
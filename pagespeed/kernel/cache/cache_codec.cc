@@ -0,0 +1,207 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/cache/cache_codec.h"
+
+#include <cstring>
+
+#include "base/logging.h"
+#ifdef USE_SYSTEM_ZLIB
+#include "zlib.h"  // NOLINT
+#else
+#include "external/envoy/bazel/foreign_cc/zlib/include/zlib.h"
+#endif
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/stack_buffer.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/util/brotli_inflater.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
+#include "pagespeed/kernel/util/lz_block_compressor.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Brotli's quality 11 default costs ~50x the encode time of quality 5 for
+// a few percent of ratio, which is the wrong trade for a cache that is
+// written on the request path.
+const int kBrotliQuality = 5;
+
+// Without a dictionary deflate goes through GzipInflater, so payloads are
+// byte-for-byte what CompressedCache has always written.  zlib only
+// exposes preset dictionaries through its stream interface, so with one we
+// drive zlib directly, in raw deflate format as before.
+class DeflateCodec : public CacheCodec {
+ public:
+  explicit DeflateCodec(StringPiece dictionary)
+      : CacheCodec(kDeflate, !dictionary.empty()) {
+    dictionary.CopyToString(&dictionary_);
+  }
+
+  bool Compress(StringPiece in, GoogleString* out) const override {
+    if (dictionary_.empty()) {
+      StringWriter writer(out);
+      return GzipInflater::Deflate(in, GzipInflater::kDeflate, &writer);
+    }
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return false;
+    }
+    bool ok = (deflateSetDictionary(
+                   &stream, reinterpret_cast<const Bytef*>(dictionary_.data()),
+                   dictionary_.size()) == Z_OK);
+    if (ok) {
+      size_t start = out->size();
+      out->resize(start + deflateBound(&stream, in.size()));
+      stream.next_in =
+          reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+      stream.avail_in = in.size();
+      stream.next_out = reinterpret_cast<Bytef*>(&(*out)[start]);
+      stream.avail_out = out->size() - start;
+      ok = (deflate(&stream, Z_FINISH) == Z_STREAM_END);
+      out->resize(start + stream.total_out);
+    }
+    deflateEnd(&stream);
+    return ok;
+  }
+
+  bool Decompress(StringPiece in, GoogleString* out) const override {
+    if (dictionary_.empty()) {
+      StringWriter writer(out);
+      return GzipInflater::Inflate(in, GzipInflater::kDeflate, &writer);
+    }
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+      return false;
+    }
+    bool ok = (inflateSetDictionary(
+                   &stream, reinterpret_cast<const Bytef*>(dictionary_.data()),
+                   dictionary_.size()) == Z_OK);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    stream.avail_in = in.size();
+    int result = Z_OK;
+    while (ok && (result != Z_STREAM_END)) {
+      char buf[kStackBufferSize];
+      stream.next_out = reinterpret_cast<Bytef*>(buf);
+      stream.avail_out = sizeof(buf);
+      result = inflate(&stream, Z_NO_FLUSH);
+      ok = (result == Z_OK) || (result == Z_STREAM_END);
+      out->append(buf, sizeof(buf) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    // Bytes left over after the end of the stream mean corruption.
+    return ok && (stream.avail_in == 0);
+  }
+
+ private:
+  GoogleString dictionary_;
+};
+
+class BrotliCodec : public CacheCodec {
+ public:
+  BrotliCodec() : CacheCodec(kBrotli, false) {}
+
+  bool Compress(StringPiece in, GoogleString* out) const override {
+    NullMessageHandler handler;
+    StringWriter writer(out);
+    return BrotliInflater::Compress(in, kBrotliQuality, &handler, &writer);
+  }
+
+  bool Decompress(StringPiece in, GoogleString* out) const override {
+    NullMessageHandler handler;
+    StringWriter writer(out);
+    return BrotliInflater::Decompress(in, &handler, &writer);
+  }
+};
+
+class LzCodec : public CacheCodec {
+ public:
+  explicit LzCodec(StringPiece dictionary)
+      : CacheCodec(kLz, !dictionary.empty()), compressor_(dictionary) {}
+
+  bool Compress(StringPiece in, GoogleString* out) const override {
+    compressor_.Compress(in, out);
+    return true;
+  }
+
+  bool Decompress(StringPiece in, GoogleString* out) const override {
+    return compressor_.Decompress(in, out);
+  }
+
+ private:
+  LzBlockCompressor compressor_;
+};
+
+}  // namespace
+
+CacheCodec::~CacheCodec() {}
+
+CacheCodec* CacheCodec::Create(Type type, StringPiece dictionary) {
+  switch (type) {
+    case kDeflate:
+      return new DeflateCodec(dictionary);
+    case kBrotli:
+      return new BrotliCodec;
+    case kLz:
+      return new LzCodec(dictionary);
+  }
+  LOG(DFATAL) << "Unknown codec type " << type;
+  return nullptr;
+}
+
+uint32 CacheCodec::DictionaryId(StringPiece dictionary) {
+  return crc32(crc32(0, nullptr, 0),
+               reinterpret_cast<const Bytef*>(dictionary.data()),
+               dictionary.size());
+}
+
+char CacheCodec::Tag(Type type) {
+  switch (type) {
+    case kDeflate:
+      return 'd';
+    case kBrotli:
+      return 'b';
+    case kLz:
+      return 'l';
+  }
+  LOG(DFATAL) << "Unknown codec type " << type;
+  return '\0';
+}
+
+bool CacheCodec::TypeForTag(char tag, Type* type) {
+  switch (tag) {
+    case 'd':
+      *type = kDeflate;
+      return true;
+    case 'b':
+      *type = kBrotli;
+      return true;
+    case 'l':
+      *type = kLz;
+      return true;
+  }
+  return false;
+}
+
+}  // namespace net_instaweb
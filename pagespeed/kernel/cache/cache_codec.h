@@ -0,0 +1,90 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_CACHE_CODEC_H_
+#define PAGESPEED_KERNEL_CACHE_CACHE_CODEC_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Compresses and decompresses cache values for CompressedCache.  Each codec
+// is a stateless wrapper around a compressor, bound at construction to an
+// optional dictionary; instances are immutable and may be shared across
+// threads.
+class CacheCodec {
+ public:
+  // Values are tagged with their type when stored, so the numbering is
+  // free to change but the tags returned by Tag() are not.
+  enum Type {
+    // zlib deflate at the default level.  A good ratio at moderate cost;
+    // what CompressedCache has always used.
+    kDeflate,
+    // Brotli at a middling quality.  Better ratio than deflate for similar
+    // decode cost but slower encodes; suited to tiers that are bounded by
+    // disk or network rather than CPU.
+    kBrotli,
+    // LzBlockCompressor.  Several times faster than deflate in both
+    // directions at a lower ratio; suited to in-memory tiers.
+    kLz,
+  };
+
+  virtual ~CacheCodec();
+
+  // Returns a new codec of the given type, which the caller owns.  If
+  // dictionary is non-empty and the type supports dictionaries, values are
+  // compressed against it and can only be decompressed by a codec of the
+  // same type built with the same dictionary.
+  static CacheCodec* Create(Type type, StringPiece dictionary);
+
+  static bool SupportsDictionary(Type type) { return type != kBrotli; }
+
+  // Checksum identifying a dictionary in stored payloads.
+  static uint32 DictionaryId(StringPiece dictionary);
+
+  // Single character identifying type in a stored payload, and its inverse.
+  static char Tag(Type type);
+  static bool TypeForTag(char tag, Type* type);
+
+  Type type() const { return type_; }
+  bool has_dictionary() const { return has_dictionary_; }
+
+  // Append the compressed or decompressed form of in to *out, returning
+  // false on failure.  Decompress fails if in is corrupt, as far as the
+  // codec can tell: deflate and brotli carry no checksum, so some damage
+  // decodes to the wrong bytes rather than failing.
+  virtual bool Compress(StringPiece in, GoogleString* out) const = 0;
+  virtual bool Decompress(StringPiece in, GoogleString* out) const = 0;
+
+ protected:
+  CacheCodec(Type type, bool has_dictionary)
+      : type_(type), has_dictionary_(has_dictionary) {}
+
+ private:
+  const Type type_;
+  const bool has_dictionary_;
+
+  DISALLOW_COPY_AND_ASSIGN(CacheCodec);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_CACHE_CODEC_H_
@@ -19,14 +19,23 @@
 
 #include "pagespeed/kernel/cache/compressed_cache.h"
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+
 #include "base/logging.h"
 ////#include "strings/stringpiece_utils.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/null_mutex.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string_util.h"
-#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
-#include "pagespeed/kernel/util/gzip_inflater.h"
+#include "pagespeed/kernel/util/dictionary_trainer.h"
 
 namespace net_instaweb {
 
@@ -34,7 +43,24 @@ namespace {
 
 // A few bytes to put at the end of the physical payload we can track
 // corruption.  Note that CompressedCacheTest.CrapAtEnd fails without this.
+// Values compressed with anything but dictionary-less deflate put the
+// codec's tag, and the dictionary id in hex if there is one, between the
+// brackets.
 const char kTrailer[] = "[[]]";
+const char kTrailerOpen[] = "[[";
+const char kTrailerClose[] = "]]";
+const size_t kDictionaryIdDigits = 8;
+const size_t kMaxTrailerSize = STATIC_STRLEN(kTrailerOpen) + 1 +
+                               kDictionaryIdDigits +
+                               STATIC_STRLEN(kTrailerClose);
+
+// Only the head of each training sample is kept, bounding both the memory
+// held while sampling and the time spent training.
+const size_t kMaxSampleSize = 4096;
+
+// Dictionaries published to the underlying cache can be evicted like any
+// other value, so re-publish the current one every so many Puts.
+const int64 kRepublishInterval = 4096;
 
 // TODO(jmarantz): Evaluate the impact of histogramming the size reduction of
 // each entry.  The compressed_cache_speed_test.cc side-steps this because
@@ -50,14 +76,254 @@ const char kCompressedCacheCompressedSize[] =
     "compressed_cache_compressed_size";
 const char kCompressedCacheCorruptPayloads[] =
     "compressed_cache_corrupt_payloads";
+const char kCompressedCacheDictionaryMisses[] =
+    "compressed_cache_dictionary_misses";
+
+void AppendDictionaryId(uint32 id, GoogleString* out) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  for (int shift = 28; shift >= 0; shift -= 4) {
+    out->push_back(kHexDigits[(id >> shift) & 0xf]);
+  }
+}
+
+bool ParseDictionaryId(StringPiece hex, uint32* id) {
+  if (hex.size() != kDictionaryIdDigits) {
+    return false;
+  }
+  *id = 0;
+  for (char c : hex) {
+    int digit;
+    if ((c >= '0') && (c <= '9')) {
+      digit = c - '0';
+    } else if ((c >= 'a') && (c <= 'f')) {
+      digit = c - 'a' + 10;
+    } else {
+      return false;
+    }
+    *id = (*id << 4) | digit;
+  }
+  return true;
+}
+
+GoogleString DictionaryKey(uint32 id) {
+  GoogleString key(CompressedCache::kDictionaryKeyPrefix);
+  AppendDictionaryId(id, &key);
+  return key;
+}
+
+}  // namespace
+
+const char CompressedCache::kDictionaryKeyPrefix[] =
+    "CompressedCacheDictionary/";
+
+// Codecs by type, the dictionaries this process knows about, and the
+// state of dictionary training.  Shared between the cache and its
+// in-flight lookups.
+class CompressedCache::DictionaryStore
+    : public std::enable_shared_from_this<DictionaryStore> {
+ public:
+  // A dictionary and the codecs bound to it.  Immutable, and never deleted
+  // before the store, so it can be used without holding the lock.
+  class Dictionary {
+   public:
+    explicit Dictionary(StringPiece data)
+        : id_(CacheCodec::DictionaryId(data)) {
+      data.CopyToString(&data_);
+      for (CacheCodec::Type type :
+           {CacheCodec::kDeflate, CacheCodec::kBrotli, CacheCodec::kLz}) {
+        if (CacheCodec::SupportsDictionary(type)) {
+          codecs_[type].reset(CacheCodec::Create(type, data));
+        }
+      }
+    }
+
+    uint32 id() const { return id_; }
+    StringPiece data() const { return data_; }
+    const CacheCodec* codec(CacheCodec::Type type) const {
+      return codecs_[type].get();
+    }
+
+   private:
+    const uint32 id_;
+    GoogleString data_;
+    std::unique_ptr<CacheCodec> codecs_[CacheCodec::kLz + 1];
+
+    DISALLOW_COPY_AND_ASSIGN(Dictionary);
+  };
+
+  DictionaryStore(CacheInterface* cache, CacheCodec::Type type,
+                  AbstractMutex* mutex)
+      : cache_(cache),
+        type_(type),
+        mutex_(mutex),
+        current_(nullptr),
+        puts_since_publish_(0),
+        num_samples_(0),
+        dictionary_size_(0) {
+    for (CacheCodec::Type t :
+         {CacheCodec::kDeflate, CacheCodec::kBrotli, CacheCodec::kLz}) {
+      codecs_[t].reset(CacheCodec::Create(t, StringPiece()));
+    }
+  }
+
+  // Returns the codec to decompress a value of the given type, compressed
+  // against dictionary id if has_dictionary.  Returns nullptr if the
+  // dictionary is unknown, setting *fetch if no fetch for it is in flight
+  // yet; the caller must then call FetchDictionary.
+  const CacheCodec* DecompressionCodec(CacheCodec::Type type,
+                                       bool has_dictionary, uint32 id,
+                                       bool* fetch) LOCKS_EXCLUDED(mutex_) {
+    *fetch = false;
+    if (!has_dictionary) {
+      return codecs_[type].get();
+    }
+    ScopedMutex lock(mutex_.get());
+    DictionaryMap::const_iterator iter = dictionaries_.find(id);
+    if (iter != dictionaries_.end()) {
+      return iter->second->codec(type);
+    }
+    *fetch = fetches_.insert(id).second;
+    return nullptr;
+  }
+
+  // Looks up a dictionary published by another CompressedCache.
+  void FetchDictionary(uint32 id);
+
+  // Returns the codec for compressing a Put, and the dictionary it uses
+  // (nullptr if none).  Sets *publish when the dictionary is due to be
+  // re-published.
+  const CacheCodec* CompressionCodec(const Dictionary** dictionary,
+                                     bool* publish) LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    *dictionary = current_;
+    *publish = false;
+    if (current_ == nullptr) {
+      return codecs_[type_].get();
+    }
+    if (++puts_since_publish_ >= kRepublishInterval) {
+      puts_since_publish_ = 0;
+      *publish = true;
+    }
+    return current_->codec(type_);
+  }
+
+  // Registers a dictionary, making it current if make_current is set or
+  // if we are waiting on training for one.  Returns the dictionary.
+  const Dictionary* Add(StringPiece data, bool make_current)
+      LOCKS_EXCLUDED(mutex_) {
+    uint32 id = CacheCodec::DictionaryId(data);
+    ScopedMutex lock(mutex_.get());
+    std::unique_ptr<Dictionary>& dictionary = dictionaries_[id];
+    if (dictionary == nullptr) {
+      dictionary.reset(new Dictionary(data));
+    }
+    fetches_.erase(id);
+    if (make_current || (current_ == nullptr && num_samples_ > 0)) {
+      current_ = dictionary.get();
+      puts_since_publish_ = 0;
+      num_samples_ = 0;
+      samples_.clear();
+    }
+    return dictionary.get();
+  }
+
+  void FetchFailed(uint32 id) LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    fetches_.erase(id);
+  }
+
+  void EnableTraining(int num_samples, int dictionary_size)
+      LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    if (current_ == nullptr) {
+      num_samples_ = num_samples;
+      dictionary_size_ = dictionary_size;
+    }
+  }
+
+  // Adds value to the training sample.  Returns true, moving the samples
+  // to *samples, when that completes the sample.
+  bool AddSample(StringPiece value, StringVector* samples, int* size)
+      LOCKS_EXCLUDED(mutex_) {
+    ScopedMutex lock(mutex_.get());
+    if (num_samples_ == 0) {
+      return false;
+    }
+    value.substr(0, kMaxSampleSize).CopyToString(StringVectorAdd(&samples_));
+    if (static_cast<int>(samples_.size()) < num_samples_) {
+      return false;
+    }
+    samples->swap(samples_);
+    samples_.clear();
+    *size = dictionary_size_;
+    num_samples_ = 0;
+    return true;
+  }
 
-class CompressedCallback : public CacheInterface::Callback {
+ private:
+  typedef std::map<uint32, std::unique_ptr<Dictionary>> DictionaryMap;
+
+  CacheInterface* cache_;
+  const CacheCodec::Type type_;
+  std::unique_ptr<CacheCodec> codecs_[CacheCodec::kLz + 1];
+  std::unique_ptr<AbstractMutex> mutex_;
+  DictionaryMap dictionaries_ GUARDED_BY(mutex_);
+  const Dictionary* current_ GUARDED_BY(mutex_);
+  int64 puts_since_publish_ GUARDED_BY(mutex_);
+  std::set<uint32> fetches_ GUARDED_BY(mutex_);  // in flight
+  int num_samples_ GUARDED_BY(mutex_);  // 0 unless training
+  int dictionary_size_ GUARDED_BY(mutex_);
+  StringVector samples_ GUARDED_BY(mutex_);
+
+  DISALLOW_COPY_AND_ASSIGN(DictionaryStore);
+};
+
+// Receives a dictionary published by another CompressedCache.
+class CompressedCache::DictionaryCallback : public CacheInterface::Callback {
+ public:
+  DictionaryCallback(const std::shared_ptr<DictionaryStore>& store, uint32 id)
+      : store_(store), id_(id) {}
+  ~DictionaryCallback() override {}
+
+  bool ValidateCandidate(const GoogleString& key,
+                         CacheInterface::KeyState state) override {
+    return (state == CacheInterface::kAvailable) &&
+           (CacheCodec::DictionaryId(value().Value()) == id_);
+  }
+
+  void Done(CacheInterface::KeyState state) override {
+    if (state == CacheInterface::kAvailable) {
+      store_->Add(value().Value(), false /* make_current */);
+    } else {
+      store_->FetchFailed(id_);
+    }
+    delete this;
+  }
+
+ private:
+  std::shared_ptr<DictionaryStore> store_;
+  const uint32 id_;
+
+  DISALLOW_COPY_AND_ASSIGN(DictionaryCallback);
+};
+
+void CompressedCache::DictionaryStore::FetchDictionary(uint32 id) {
+  cache_->Get(DictionaryKey(id),
+              new DictionaryCallback(shared_from_this(), id));
+}
+
+class CompressedCache::CompressedCallback : public CacheInterface::Callback {
  public:
   CompressedCallback(CacheInterface::Callback* callback,
-                     Variable* corrupt_payloads)
+                     const std::shared_ptr<DictionaryStore>& dictionaries,
+                     Variable* corrupt_payloads, Variable* dictionary_misses)
       : callback_(callback),
+        dictionaries_(dictionaries),
         corrupt_payloads_(corrupt_payloads),
-        validate_candidate_called_(false) {}
+        dictionary_misses_(dictionary_misses),
+        validate_candidate_called_(false),
+        fetch_dictionary_(false),
+        dictionary_id_(0) {}
 
   ~CompressedCallback() override {}
 
@@ -67,13 +333,27 @@ class CompressedCallback : public CacheInterface::Callback {
     bool ret = false;
     if (state == CacheInterface::kAvailable) {
       GoogleString uncompressed;
-      StringWriter writer(&uncompressed);
       StringPiece compressed = value().Value();
-      if (strings::EndsWith(compressed,
-                            StringPiece(kTrailer, STATIC_STRLEN(kTrailer))) &&
-          GzipInflater::Inflate(
-              compressed.substr(0, compressed.size() - STATIC_STRLEN(kTrailer)),
-              GzipInflater::kDeflate, &writer)) {
+      StringPiece body;
+      CacheCodec::Type type;
+      bool has_dictionary;
+      uint32 dictionary_id;
+      const CacheCodec* codec = nullptr;
+      bool parsed = ParseTrailer(compressed, &body, &type, &has_dictionary,
+                                 &dictionary_id);
+      if (parsed) {
+        bool fetch;
+        codec = dictionaries_->DecompressionCodec(type, has_dictionary,
+                                                  dictionary_id, &fetch);
+        if (fetch) {
+          fetch_dictionary_ = true;
+          dictionary_id_ = dictionary_id;
+        }
+      }
+      if (parsed && (codec == nullptr)) {
+        state = CacheInterface::kNotFound;
+        dictionary_misses_->Add(1);
+      } else if (parsed && codec->Decompress(body, &uncompressed)) {
         SharedString uncompressed_shared;
         uncompressed_shared.SwapWithString(&uncompressed);
         callback_->set_value(uncompressed_shared);
@@ -89,25 +369,80 @@ class CompressedCallback : public CacheInterface::Callback {
 
   void Done(CacheInterface::KeyState state) override {
     DCHECK(validate_candidate_called_);
+    // Not from ValidateCandidate, which the underlying cache may call with
+    // a lock held.
+    if (fetch_dictionary_) {
+      dictionaries_->FetchDictionary(dictionary_id_);
+    }
     callback_->DelegatedDone(state);
     delete this;
   }
 
+ private:
+  // Splits a physical payload into the compressed body and the fields of
+  // its trailer, returning false if it has no well-formed trailer.
+  static bool ParseTrailer(StringPiece payload, StringPiece* body,
+                           CacheCodec::Type* type, bool* has_dictionary,
+                           uint32* dictionary_id) {
+    if (!strings::EndsWith(payload, kTrailerClose)) {
+      return false;
+    }
+    size_t search_from = payload.size() - std::min(payload.size(),
+                                                   kMaxTrailerSize);
+    size_t open = payload.substr(search_from).rfind(kTrailerOpen);
+    if (open == StringPiece::npos) {
+      return false;
+    }
+    open += search_from;
+    *body = payload.substr(0, open);
+    StringPiece fields = payload.substr(
+        open + STATIC_STRLEN(kTrailerOpen),
+        payload.size() - open - STATIC_STRLEN(kTrailerOpen) -
+            STATIC_STRLEN(kTrailerClose));
+    if (fields.empty()) {
+      *type = CacheCodec::kDeflate;
+      *has_dictionary = false;
+      return true;
+    }
+    if (!CacheCodec::TypeForTag(fields[0], type)) {
+      return false;
+    }
+    fields.remove_prefix(1);
+    *has_dictionary = !fields.empty();
+    return !*has_dictionary || ParseDictionaryId(fields, dictionary_id);
+  }
+
   Callback* callback_;
+  std::shared_ptr<DictionaryStore> dictionaries_;
   Variable* corrupt_payloads_;
+  Variable* dictionary_misses_;
   bool validate_candidate_called_;
-};
+  bool fetch_dictionary_;
+  uint32 dictionary_id_;
 
-}  // namespace
+  DISALLOW_COPY_AND_ASSIGN(CompressedCallback);
+};
 
 CompressedCache::CompressedCache(CacheInterface* cache, Statistics* stats)
-    : cache_(cache) {
+    : CompressedCache(cache, CacheCodec::kDeflate, nullptr, stats) {}
+
+CompressedCache::CompressedCache(CacheInterface* cache, CacheCodec::Type codec,
+                                 ThreadSystem* thread_system,
+                                 Statistics* stats)
+    : cache_(cache),
+      codec_type_(codec),
+      dictionaries_(new DictionaryStore(
+          cache, codec,
+          (thread_system == nullptr)
+              ? static_cast<AbstractMutex*>(new NullMutex)
+              : thread_system->NewMutex())) {
 #if INCLUDE_HISTOGRAMS
   compressed_cache_savings_ = stats->GetHistogram(kCompressedCacheSavings);
 #endif
   corrupt_payloads_ = stats->GetVariable(kCompressedCacheCorruptPayloads);
   original_size_ = stats->GetVariable(kCompressedCacheOriginalSize);
   compressed_size_ = stats->GetVariable(kCompressedCacheCompressedSize);
+  dictionary_misses_ = stats->GetVariable(kCompressedCacheDictionaryMisses);
 }
 
 CompressedCache::~CompressedCache() {}
@@ -123,21 +458,50 @@ void CompressedCache::InitStats(Statistics* statistics) {
   statistics->AddVariable(kCompressedCacheCorruptPayloads);
   statistics->AddVariable(kCompressedCacheOriginalSize);
   statistics->AddVariable(kCompressedCacheCompressedSize);
+  statistics->AddVariable(kCompressedCacheDictionaryMisses);
 }
 
 void CompressedCache::Get(const GoogleString& key, Callback* callback) {
-  CompressedCallback* cb = new CompressedCallback(callback, corrupt_payloads_);
+  CompressedCallback* cb = new CompressedCallback(
+      callback, dictionaries_, corrupt_payloads_, dictionary_misses_);
   cache_->Get(key, cb);
 }
 
 void CompressedCache::Put(const GoogleString& key, const SharedString& value) {
+  StringVector samples;
+  int dictionary_size;
+  if (dictionaries_->AddSample(value.Value(), &samples, &dictionary_size)) {
+    GoogleString dictionary =
+        DictionaryTrainer::Train(samples, dictionary_size);
+    if (!dictionary.empty()) {
+      SetDictionary(dictionary);
+    }
+  }
+
+  const DictionaryStore::Dictionary* dictionary;
+  bool publish;
+  const CacheCodec* codec =
+      dictionaries_->CompressionCodec(&dictionary, &publish);
+  if (publish) {
+    cache_->Put(DictionaryKey(dictionary->id()),
+                SharedString(dictionary->data()));
+  }
+
   int64 old_size = value.size();
   GoogleString buf;
-  buf.reserve(old_size + STATIC_STRLEN(kTrailer));
-  StringWriter writer(&buf);
+  buf.reserve(old_size + kMaxTrailerSize);
   original_size_->Add(old_size);
-  if (GzipInflater::Deflate(value.Value(), GzipInflater::kDeflate, &writer)) {
-    buf.append(kTrailer, STATIC_STRLEN(kTrailer));
+  if (codec->Compress(value.Value(), &buf)) {
+    if ((codec_type_ == CacheCodec::kDeflate) && (dictionary == nullptr)) {
+      buf.append(kTrailer, STATIC_STRLEN(kTrailer));
+    } else {
+      buf.append(kTrailerOpen, STATIC_STRLEN(kTrailerOpen));
+      buf.push_back(CacheCodec::Tag(codec_type_));
+      if (dictionary != nullptr) {
+        AppendDictionaryId(dictionary->id(), &buf);
+      }
+      buf.append(kTrailerClose, STATIC_STRLEN(kTrailerClose));
+    }
 #if INCLUDE_HISTOGRAMS
     compressed_cache_savings_->Add(old_size - static_cast<int64>(buf.size()));
 #endif
@@ -152,6 +516,22 @@ bool CompressedCache::IsHealthy() const { return cache_->IsHealthy(); }
 
 void CompressedCache::ShutDown() { return cache_->ShutDown(); }
 
+void CompressedCache::EnableDictionaryTraining(int num_samples,
+                                               int dictionary_size) {
+  if (CacheCodec::SupportsDictionary(codec_type_) && (num_samples > 0) &&
+      (dictionary_size > 0)) {
+    dictionaries_->EnableTraining(num_samples, dictionary_size);
+  }
+}
+
+void CompressedCache::SetDictionary(StringPiece dictionary) {
+  if (CacheCodec::SupportsDictionary(codec_type_)) {
+    const DictionaryStore::Dictionary* added =
+        dictionaries_->Add(dictionary, true /* make_current */);
+    cache_->Put(DictionaryKey(added->id()), SharedString(added->data()));
+  }
+}
+
 int64 CompressedCache::CorruptPayloads() const {
   return corrupt_payloads_->Get();
 }
@@ -162,4 +542,8 @@ int64 CompressedCache::CompressedSize() const {
   return compressed_size_->Get();
 }
 
+int64 CompressedCache::DictionaryMisses() const {
+  return dictionary_misses_->Get();
+}
+
 }  // namespace net_instaweb
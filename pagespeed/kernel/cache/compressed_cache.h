@@ -20,23 +20,45 @@
 #ifndef PAGESPEED_KERNEL_CACHE_COMPRESSED_CACHE_H_
 #define PAGESPEED_KERNEL_CACHE_COMPRESSED_CACHE_H_
 
+#include <memory>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 
 namespace net_instaweb {
 
 class Histogram;
 class Statistics;
+class ThreadSystem;
 class Variable;
 
 // Compressed cache adapter.
+//
+// Each stored value is tagged with the codec that compressed it, and with
+// the dictionary if there was one, so a cache can change codecs without
+// invalidating what is already stored: every instance reads every codec.
+// Values written with deflate and no dictionary are stored exactly as they
+// were before codecs were pluggable.
+//
+// Dictionaries are trained from the first values Put (see
+// EnableDictionaryTraining), then published into the underlying cache
+// under a reserved key so that other processes sharing that cache can
+// read values compressed against them.  A value whose dictionary is not
+// yet known reports a miss while the dictionary is fetched; a process
+// that is still sampling adopts the first dictionary it fetches rather
+// than training its own, so processes converge on one dictionary.
 class CompressedCache : public CacheInterface {
  public:
-  // Does not takes ownership of cache or stats.
+  // Does not takes ownership of cache or stats.  Compresses with deflate.
   CompressedCache(CacheInterface* cache, Statistics* stats);
+  // As above, compressing with the given codec.  thread_system is used to
+  // guard the dictionary state.
+  CompressedCache(CacheInterface* cache, CacheCodec::Type codec,
+                  ThreadSystem* thread_system, Statistics* stats);
   ~CompressedCache() override;
 
   static void InitStats(Statistics* stats);
@@ -63,12 +85,40 @@ class CompressedCache : public CacheInterface {
   // started.
   int64 CompressedSize() const;
 
+  // Total number of lookups that missed because the value was compressed
+  // against a dictionary this process did not have.
+  int64 DictionaryMisses() const;
+
+  // Builds a dictionary of up to dictionary_size bytes from the first
+  // num_samples values Put, then compresses subsequent values against it.
+  // Has no effect if the codec does not support dictionaries.  Training
+  // runs once, synchronously, in the Put that completes the sample.
+  void EnableDictionaryTraining(int num_samples, int dictionary_size);
+
+  // Compresses subsequent values against dictionary, publishing it to the
+  // underlying cache.  Has no effect if the codec does not support
+  // dictionaries.
+  void SetDictionary(StringPiece dictionary);
+
+  CacheCodec::Type codec() const { return codec_type_; }
+
+  // Prefix of the keys that dictionaries are published under.
+  static const char kDictionaryKeyPrefix[];
+
  private:
+  class CompressedCallback;
+  class DictionaryCallback;
+  class DictionaryStore;
+
   CacheInterface* cache_;
+  const CacheCodec::Type codec_type_;
+  // Shared with in-flight dictionary fetches, which may outlive us.
+  std::shared_ptr<DictionaryStore> dictionaries_;
   Histogram* compressed_cache_savings_;
   Variable* corrupt_payloads_;
   Variable* original_size_;
   Variable* compressed_size_;
+  Variable* dictionary_misses_;
 
   DISALLOW_COPY_AND_ASSIGN(CompressedCache);
 };
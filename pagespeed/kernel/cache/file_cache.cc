@@ -19,7 +19,12 @@
 
 #include "pagespeed/kernel/cache/file_cache.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <functional>
 #include <vector>
 
 #include "base/logging.h"
@@ -38,6 +43,7 @@
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
+#include "pagespeed/kernel/util/io_uring.h"
 #include "pagespeed/kernel/util/url_to_filename_encoder.h"
 
 namespace net_instaweb {
@@ -53,6 +59,31 @@ struct CompareByAtime {
   }
 };
 
+// Submission-queue size of the io_uring rings.  A read takes two entries
+// per key, so this lets a ring look up 128 keys at a time.
+const unsigned kIoUringEntries = 256;
+
+// Read size for files whose size we could not stat first.
+const size_t kIoUringDefaultReadSize = 16 * 1024;
+
+// Operations are identified in completions by the index of the file they
+// act on, shifted left to make room for the operation.
+enum IoUringOp { kOpenOp, kStatOp, kReadOp, kWriteOp, kRenameOp };
+const int kIoUringOpBits = 3;
+
+uint64 IoUringUserData(size_t index, IoUringOp op) {
+  return (static_cast<uint64>(index) << kIoUringOpBits) | op;
+}
+
+// Closes the descriptors in fds that are valid.
+void CloseFiles(const std::vector<int>& fds) {
+  for (int fd : fds) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
 }  // namespace
 
 class FileCache::CacheCleanFunction : public Function {
@@ -76,12 +107,22 @@ const char FileCache::kEvictions[] = "file_cache_evictions";
 const char FileCache::kSkippedCleanups[] = "file_cache_skipped_cleanups";
 const char FileCache::kStartedCleanups[] = "file_cache_started_cleanups";
 const char FileCache::kWriteErrors[] = "file_cache_write_errors";
+const char FileCache::kIoUringBatches[] = "file_cache_io_uring_batches";
+const char FileCache::kCleanerSlices[] = "file_cache_cleaner_slices";
+const char FileCache::kCleanerSliceLatencyUs[] =
+    "file_cache_cleaner_slice_latency_us";
+const char FileCache::kCleanerFilesSampled[] =
+    "file_cache_cleaner_files_sampled";
+const char FileCache::kLedgerBytes[] = "file_cache_ledger_bytes";
+const char FileCache::kLedgerInodes[] = "file_cache_ledger_inodes";
 
 // Filenames for the next scheduled clean time and the lockfile.  In
 // order to prevent these from colliding with actual cachefiles, they
 // contain characters that our filename encoder would escape.
 const char FileCache::kCleanTimeName[] = "!clean!time!";
 const char FileCache::kCleanLockName[] = "!clean!lock!";
+const char FileCache::kLedgerName[] = "!clean!ledger!";
+const char FileCache::kUncleanedDirName[] = "!uncleaned!";
 
 // Be willing to wait for a cache cleaner that hasn't bumped it's lock file in
 // the last 5min.  A successful cache cleaner should be hitting it far more
@@ -94,6 +135,13 @@ namespace {
 // Bump the lock once out of this many calls to Notify().
 const int kLockBumpIntervalCycles = 1000;
 
+// Incremental cleaning gathers at least this many files per sample, taking
+// up to kMaxSampleWalks random paths down the directory tree to find them,
+// and evicts the least recently used quarter of them.
+const size_t kCleanSampleSize = 32;
+const int kMaxSampleWalks = 8;
+const size_t kCleanSampleEvictionDivisor = 4;
+
 class LockBumpingProgressNotifier : public FileSystem::ProgressNotifier {
  public:
   // Takes ownership of nothing.
@@ -142,14 +190,30 @@ FileCache::FileCache(const GoogleString& path, FileSystem* file_system,
       path_length_limit_(file_system_->MaxPathLength(path)),
       clean_time_path_(path),
       clean_lock_path_(path),
+      ledger_path_(path),
+      uncleaned_path_(path),
+      ledger_known_(false),
+      ledger_bytes_(0),
+      ledger_inodes_(0),
+      pending_bytes_(0),
+      pending_inodes_(0),
+      random_(std::hash<GoogleString>()(path) ^ getpid()),
       notifier_for_tests_(nullptr),
+      thread_system_(thread_system),
+      io_uring_temp_file_count_(0),
       disk_checks_(stats->GetVariable(kDiskChecks)),
       cleanups_(stats->GetVariable(kCleanups)),
       evictions_(stats->GetVariable(kEvictions)),
       bytes_freed_in_cleanup_(stats->GetVariable(kBytesFreedInCleanup)),
       skipped_cleanups_(stats->GetVariable(kSkippedCleanups)),
       started_cleanups_(stats->GetVariable(kStartedCleanups)),
-      write_errors_(stats->GetVariable(kWriteErrors)) {
+      write_errors_(stats->GetVariable(kWriteErrors)),
+      io_uring_batches_(stats->GetVariable(kIoUringBatches)),
+      cleaner_slices_(stats->GetVariable(kCleanerSlices)),
+      cleaner_slice_latency_us_(stats->GetHistogram(kCleanerSliceLatencyUs)),
+      cleaner_files_sampled_(stats->GetVariable(kCleanerFilesSampled)),
+      ledger_bytes_counter_(stats->GetUpDownCounter(kLedgerBytes)),
+      ledger_inodes_counter_(stats->GetUpDownCounter(kLedgerInodes)) {
   if (policy->cleaning_enabled()) {
     next_clean_ms_ = policy->timer->NowMs() + policy->clean_interval_ms / 2;
   }
@@ -157,6 +221,10 @@ FileCache::FileCache(const GoogleString& path, FileSystem* file_system,
   StrAppend(&clean_time_path_, kCleanTimeName);
   EnsureEndsInSlash(&clean_lock_path_);
   StrAppend(&clean_lock_path_, kCleanLockName);
+  EnsureEndsInSlash(&ledger_path_);
+  StrAppend(&ledger_path_, kLedgerName);
+  EnsureEndsInSlash(&uncleaned_path_);
+  StrAppend(&uncleaned_path_, kUncleanedDirName);
 }
 
 FileCache::~FileCache() {}
@@ -169,12 +237,34 @@ void FileCache::InitStats(Statistics* statistics) {
   statistics->AddVariable(kSkippedCleanups);
   statistics->AddVariable(kStartedCleanups);
   statistics->AddVariable(kWriteErrors);
+  statistics->AddVariable(kIoUringBatches);
+  statistics->AddVariable(kCleanerSlices);
+  statistics->AddHistogram(kCleanerSliceLatencyUs);
+  statistics->AddVariable(kCleanerFilesSampled);
+  statistics->AddUpDownCounter(kLedgerBytes);
+  statistics->AddUpDownCounter(kLedgerInodes);
+}
+
+void FileCache::EnableIoUring() {
+  io_uring_pool_ =
+      std::make_unique<IoUringPool>(kIoUringEntries, thread_system_);
 }
 
 void FileCache::Get(const GoogleString& key, Callback* callback) {
   GoogleString filename;
   bool ret = EncodeFilename(key, &filename);
-  if (ret) {
+  StringVector filenames(1, filename);
+  std::vector<GoogleString> values;
+  std::vector<bool> found;
+  if (ret && io_uring_pool_ != nullptr &&
+      ReadFilesWithIoUring(&filenames, &values, &found)) {
+    ret = found[0];
+    if (ret) {
+      SharedString value;
+      value.SwapWithString(&values[0]);
+      callback->set_value(value);
+    }
+  } else if (ret) {
     // Suppress read errors.  Note that we want to show Write errors,
     // as they likely indicate a permissions or disk-space problem
     // which is best not eaten.  It's cheap enough to construct
@@ -187,23 +277,250 @@ void FileCache::Get(const GoogleString& key, Callback* callback) {
   ValidateAndReportResult(key, ret ? kAvailable : kNotFound, callback);
 }
 
+void FileCache::MultiGet(MultiGetRequest* request) {
+  if (io_uring_pool_ == nullptr) {
+    CacheInterface::MultiGet(request);
+    return;
+  }
+  int n = request->size();
+  StringVector filenames(n);
+  for (int i = 0; i < n; ++i) {
+    EncodeFilename((*request)[i].key, &filenames[i]);
+  }
+  std::vector<GoogleString> values;
+  std::vector<bool> found;
+  if (!ReadFilesWithIoUring(&filenames, &values, &found)) {
+    CacheInterface::MultiGet(request);
+    return;
+  }
+  for (int i = 0; i < n; ++i) {
+    KeyCallback* key_callback = &(*request)[i];
+    if (found[i]) {
+      SharedString value;
+      value.SwapWithString(&values[i]);
+      key_callback->callback->set_value(value);
+    }
+    ValidateAndReportResult(key_callback->key,
+                            found[i] ? kAvailable : kNotFound,
+                            key_callback->callback);
+  }
+  delete request;
+}
+
 void FileCache::Put(const GoogleString& key, const SharedString& value) {
   GoogleString filename;
-  if (EncodeFilename(key, &filename) &&
-      !file_system_->WriteFileAtomic(filename, value.Value(),
-                                     message_handler_)) {
-    write_errors_->Add(1);
+  if (EncodeFilename(key, &filename)) {
+    // For the ledger, find out how big any value we are replacing was.
+    NullMessageHandler null_handler;
+    int64 old_size = 0;
+    bool replacing = cache_policy_->incremental_cleaning() &&
+                     file_system_->Size(filename, &old_size, &null_handler);
+    if (WriteFileWithIoUring(filename, value) ||
+        file_system_->WriteFileAtomic(filename, value.Value(),
+                                      message_handler_)) {
+      if (cache_policy_->incremental_cleaning()) {
+        RecordUsage(value.size() - old_size, replacing ? 0 : 1);
+      }
+    } else {
+      write_errors_->Add(1);
+    }
   }
   CleanIfNeeded();
 }
 
+bool FileCache::ReadFilesWithIoUring(StringVector* filenames,
+                                     std::vector<GoogleString>* values,
+                                     std::vector<bool>* found) {
+  IoUring* ring =
+      (io_uring_pool_ == nullptr) ? nullptr : io_uring_pool_->Acquire();
+  if (ring == nullptr) {
+    return false;
+  }
+  size_t n = filenames->size();
+  values->assign(n, GoogleString());
+  found->assign(n, false);
+  // Files that turn out to have a different size than statx reported,
+  // typically because they were replaced in between, are read again
+  // through file_system.
+  std::vector<bool> reread(n, false);
+
+  // Each chunk takes two round trips: open and stat every file, then read
+  // every file that opened.  Using the size from statx means we read each
+  // file in one go.  Descriptors are closed directly rather than through the
+  // ring, so that none can leak, or be closed twice, whatever the ring does.
+  size_t chunk_size = ring->capacity() / 2;
+  std::vector<int> fds;
+  std::vector<struct statx> stats;
+  std::vector<bool> stat_ok;
+  std::vector<IoUring::Completion> completions;
+  bool usable = true;
+  for (size_t begin = 0; usable && begin < n; begin += chunk_size) {
+    size_t count = std::min(n - begin, chunk_size);
+    fds.assign(count, -1);
+    stats.resize(count);
+    stat_ok.assign(count, false);
+    for (size_t i = 0; i < count; ++i) {
+      const char* filename = (*filenames)[begin + i].c_str();
+      ring->QueueOpenAt(filename, O_RDONLY | O_CLOEXEC, 0,
+                        IoUringUserData(i, kOpenOp));
+      ring->QueueStatx(filename, STATX_SIZE, &stats[i],
+                       IoUringUserData(i, kStatOp));
+    }
+    completions.clear();
+    usable = ring->SubmitAndWait(&completions);
+    for (const IoUring::Completion& completion : completions) {
+      size_t i = completion.user_data >> kIoUringOpBits;
+      switch (completion.user_data & ((1 << kIoUringOpBits) - 1)) {
+        case kOpenOp:
+          fds[i] = completion.result;
+          break;
+        case kStatOp:
+          stat_ok[i] = (completion.result == 0);
+          break;
+      }
+    }
+    if (!usable) {
+      CloseFiles(fds);
+      break;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      if (fds[i] < 0) {
+        continue;
+      }
+      // Ask for one byte more than the file should hold, so a file that
+      // grew shows up as a full read.
+      GoogleString* value = &(*values)[begin + i];
+      value->resize(stat_ok[i] ? stats[i].stx_size + 1
+                               : kIoUringDefaultReadSize);
+      ring->QueueRead(fds[i], &(*value)[0], value->size(),
+                      IoUringUserData(i, kReadOp), false /* hardlink_next */);
+    }
+    completions.clear();
+    usable = ring->SubmitAndWait(&completions);
+    // A read still in flight if the ring failed holds its own reference to
+    // the file, so closing the descriptors is safe either way.  Its buffer
+    // is another matter; see below.
+    CloseFiles(fds);
+    if (!usable) {
+      break;
+    }
+    for (const IoUring::Completion& completion : completions) {
+      size_t i = completion.user_data >> kIoUringOpBits;
+      if ((completion.user_data & ((1 << kIoUringOpBits) - 1)) != kReadOp ||
+          completion.result < 0) {
+        continue;
+      }
+      size_t bytes = completion.result;
+      GoogleString* value = &(*values)[begin + i];
+      if (stat_ok[i] ? (bytes == stats[i].stx_size) : (bytes < value->size())) {
+        value->resize(bytes);
+        (*found)[begin + i] = true;
+      } else {
+        reread[begin + i] = true;
+      }
+    }
+    io_uring_batches_->Add(1);
+  }
+  if (!usable && ring->in_flight() > 0) {
+    // The kernel may still write into stats and the strings in values, and
+    // older kernels read statx paths only when they get to them, so all of
+    // that storage is leaked along with the ring rather than handed back.
+    // Swapping the vectors moves that storage without touching it.
+    LOG(ERROR) << "Leaking an io_uring ring with operations in flight";
+    (new StringVector)->swap(*filenames);
+    (new std::vector<struct statx>)->swap(stats);
+    (new std::vector<GoogleString>)->swap(*values);
+  }
+  io_uring_pool_->Release(ring, usable);
+  if (!usable) {
+    // Let the caller read everything through file_system instead.
+    return false;
+  }
+
+  NullMessageHandler null_handler;
+  for (size_t i = 0; i < n; ++i) {
+    if (!(*found)[i]) {
+      (*values)[i].clear();
+      if (reread[i]) {
+        (*found)[i] = file_system_->ReadFile((*filenames)[i].c_str(),
+                                             &(*values)[i], &null_handler);
+      }
+    }
+  }
+  return true;
+}
+
+bool FileCache::WriteFileWithIoUring(const GoogleString& filename,
+                                     const SharedString& value) {
+  IoUring* ring =
+      (io_uring_pool_ == nullptr) ? nullptr : io_uring_pool_->Acquire();
+  if (ring == nullptr) {
+    return false;
+  }
+  // Like FileSystem::WriteFileAtomic, write a temporary file next to the
+  // destination and rename it into place, so readers never see part of a
+  // value.  The rename is only queued once the write is known to be
+  // complete.
+  GoogleString temp_filename = StrCat(
+      filename, ".temp", IntegerToString(getpid()), "-",
+      Integer64ToString(io_uring_temp_file_count_.fetch_add(1)));
+  std::vector<IoUring::Completion> completions;
+  ring->QueueOpenAt(temp_filename.c_str(),
+                    O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600,
+                    IoUringUserData(0, kOpenOp));
+  bool usable = ring->SubmitAndWait(&completions);
+  // The open may have completed even if the ring then failed.
+  int fd = completions.empty() ? -1 : completions[0].result;
+  bool ok = false;
+  if (fd >= 0) {
+    if (usable) {
+      ring->QueueWrite(fd, value.data(), value.size(),
+                       IoUringUserData(0, kWriteOp), false /* hardlink_next */);
+      completions.clear();
+      usable = ring->SubmitAndWait(&completions);
+      ok = usable && !completions.empty() &&
+           (completions[0].result == static_cast<int>(value.size()));
+      if (ring->in_flight() > 0) {
+        // The kernel may still read from value's storage, so hold a
+        // reference to it forever, as the ring is leaked too.
+        LOG(ERROR) << "Leaking an io_uring ring with a write in flight";
+        static_cast<void>(new SharedString(value));
+      }
+    }
+    // As in ReadFilesWithIoUring, close directly so the descriptor can't
+    // leak if the ring failed.
+    ok = (close(fd) == 0) && ok;
+    if (ok) {
+      ring->QueueRenameAt(temp_filename.c_str(), filename.c_str(),
+                          IoUringUserData(0, kRenameOp));
+      completions.clear();
+      usable = ring->SubmitAndWait(&completions);
+      ok = usable && !completions.empty() && (completions[0].result == 0);
+    }
+    if (!ok) {
+      unlink(temp_filename.c_str());
+    }
+  }
+  io_uring_pool_->Release(ring, usable);
+  return ok;
+}
+
 void FileCache::Delete(const GoogleString& key) {
   GoogleString filename;
   if (!EncodeFilename(key, &filename)) {
     return;
   }
   NullMessageHandler null_handler;  // Do not emit messages on delete failures.
-  file_system_->RemoveFile(filename.c_str(), &null_handler);
+  int64 size = 0;
+  if (cache_policy_->incremental_cleaning() &&
+      file_system_->Size(filename, &size, &null_handler)) {
+    if (file_system_->RemoveFile(filename.c_str(), &null_handler)) {
+      RecordUsage(-size, -1);
+    }
+  } else {
+    file_system_->RemoveFile(filename.c_str(), &null_handler);
+  }
 }
 
 bool FileCache::EncodeFilename(const GoogleString& key,
@@ -233,7 +550,8 @@ const int64 kEmptyDirCleanAgeSec = 60;
 
 }  // namespace
 
-bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
+bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count,
+                      int64* cache_size_out, int64* cache_inode_count_out) {
   started_cleanups_->Add(1);
 
   DCHECK(cache_policy_->cleaning_enabled());
@@ -258,6 +576,7 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
   FileSystem::DirInfo dir_info;
   file_system_->GetDirInfoWithProgress(path_, &dir_info, notifier,
                                        message_handler_);
+  ExcludeUncleanedFiles(&dir_info);
 
   // Check to see if cache size or inode count exceeds our limits.
   // target_inode_count of 0 indicates no inode limit.
@@ -270,6 +589,10 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
                               "no cleanup needed.",
                               Integer64ToString(cache_size).c_str(),
                               Integer64ToString(cache_inode_count).c_str());
+    if (cache_size_out != nullptr) {
+      *cache_size_out = cache_size;
+      *cache_inode_count_out = cache_inode_count;
+    }
     return true;
   }
 
@@ -325,8 +648,7 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
     // newest files (and very small) so they would normally not be deleted
     // anyway. But on some systems (e.g. mounted noatime?) they were getting
     // deleted.
-    if (clean_time_path_.compare(file.name) == 0 ||
-        clean_lock_path_.compare(file.name) == 0) {
+    if (IsCleaningStateFile(file.name)) {
       continue;
     }
     cache_size -= file.size_bytes;
@@ -343,9 +665,240 @@ bool FileCache::Clean(int64 target_size_bytes, int64 target_inode_count) {
                             "File cache cleanup complete; freed %s bytes",
                             Integer64ToString(bytes_freed).c_str());
   bytes_freed_in_cleanup_->Add(bytes_freed);
+  if (cache_size_out != nullptr) {
+    *cache_size_out = cache_size;
+    *cache_inode_count_out = cache_inode_count;
+  }
   return everything_ok;
 }
 
+bool FileCache::CleanIncrementally(int64 target_size_bytes,
+                                   int64 target_inode_count) {
+  const Timer* timer = cache_policy_->timer;
+  const int64 start_us = timer->NowUs();
+  cleaner_slices_->Add(1);
+  bool everything_ok = true;
+
+  int64 cache_size;
+  int64 cache_inode_count;
+  {
+    // The usage recorded from here on is folded in by the next slice.
+    ScopedMutex lock(mutex_.get());
+    cache_size = pending_bytes_;
+    cache_inode_count = pending_inodes_;
+    pending_bytes_ = 0;
+    pending_inodes_ = 0;
+  }
+  int64 ledger_size;
+  int64 ledger_inode_count;
+  if (ReadLedger(&ledger_size, &ledger_inode_count)) {
+    cache_size += ledger_size;
+    cache_inode_count += ledger_inode_count;
+  } else {
+    // Without a ledger we don't know how big the cache is, so take a census
+    // the slow way.  It already counts the usage we just took.
+    everything_ok = Clean(target_size_bytes, target_inode_count, &cache_size,
+                          &cache_inode_count);
+    WriteLedger(cache_size, cache_inode_count);
+    cleaner_slice_latency_us_->Add(timer->NowUs() - start_us);
+    return everything_ok;
+  }
+
+  if (cache_size >= target_size_bytes ||
+      (target_inode_count != 0 && cache_inode_count >= target_inode_count)) {
+    disk_checks_->Add(1);
+    cleanups_->Add(1);
+    const int64 orig_cache_size = cache_size;
+    const int64 deadline_us = start_us + cache_policy_->clean_slice_ms * 1000;
+    // Like Clean, clean down to 75% of the targets, so we don't need to clean
+    // again straight away.
+    target_size_bytes = (target_size_bytes * 3) / 4;
+    target_inode_count = (target_inode_count * 3) / 4;
+    std::vector<FileSystem::FileInfo> sample;
+    while ((cache_size > target_size_bytes ||
+            (target_inode_count != 0 &&
+             cache_inode_count > target_inode_count)) &&
+           timer->NowUs() < deadline_us) {
+      sample.clear();
+      SampleFiles(&sample, &cache_inode_count);
+      if (sample.empty()) {
+        // The cache looks empty, so the ledger must have drifted from what
+        // is on disk.  Have the next slice count the cache afresh.
+        message_handler_->Message(
+            kWarning, "File cache ledger claims %s bytes but no files were "
+                      "found; recounting",
+            Integer64ToString(cache_size).c_str());
+        file_system_->RemoveFile(ledger_path_.c_str(), message_handler_);
+        bytes_freed_in_cleanup_->Add(orig_cache_size - cache_size);
+        cleaner_slice_latency_us_->Add(timer->NowUs() - start_us);
+        return false;
+      }
+      cleaner_files_sampled_->Add(sample.size());
+      std::sort(sample.begin(), sample.end(), CompareByAtime());
+      size_t evictions = std::max<size_t>(
+          1, sample.size() / kCleanSampleEvictionDivisor);
+      for (size_t i = 0;
+           i < evictions &&
+           (cache_size > target_size_bytes ||
+            (target_inode_count != 0 &&
+             cache_inode_count > target_inode_count));
+           ++i) {
+        const FileSystem::FileInfo& file = sample[i];
+        cache_size -= file.size_bytes;
+        --cache_inode_count;
+        everything_ok &=
+            file_system_->RemoveFile(file.name.c_str(), message_handler_);
+        evictions_->Add(1);
+      }
+    }
+    bytes_freed_in_cleanup_->Add(orig_cache_size - cache_size);
+  }
+  WriteLedger(cache_size, cache_inode_count);
+  cleaner_slice_latency_us_->Add(timer->NowUs() - start_us);
+  return everything_ok;
+}
+
+void FileCache::SampleFiles(std::vector<FileSystem::FileInfo>* sample,
+                            int64* cache_inode_count) {
+  NullMessageHandler null_handler;
+  const int64 now_sec = cache_policy_->timer->NowMs() / Timer::kSecondMs;
+  StringVector contents;
+  StringVector subdirs;
+  for (int walk = 0;
+       walk < kMaxSampleWalks && sample->size() < kCleanSampleSize; ++walk) {
+    GoogleString dir = path_;
+    while (true) {
+      contents.clear();
+      subdirs.clear();
+      file_system_->ListContents(dir, &contents, &null_handler);
+      for (const GoogleString& name : contents) {
+        if (IsCleaningStateFile(name)) {
+          continue;
+        }
+        if (file_system_->IsDir(name.c_str(), &null_handler).is_true()) {
+          subdirs.push_back(name);
+        } else {
+          FileSystem::FileInfo info(0, 0, name);
+          if (file_system_->Size(name, &info.size_bytes, &null_handler) &&
+              file_system_->Atime(name, &info.atime_sec, &null_handler)) {
+            sample->push_back(info);
+          }
+        }
+      }
+      if (contents.empty() && dir != path_) {
+        // As in Clean, leave young empty directories alone, as they may be
+        // locks.
+        int64 mtime_sec;
+        if (file_system_->Mtime(dir, &mtime_sec, &null_handler) &&
+            now_sec - mtime_sec > kEmptyDirCleanAgeSec &&
+            file_system_->RemoveDir(dir.c_str(), &null_handler)) {
+          --*cache_inode_count;
+        }
+      }
+      if (subdirs.empty()) {
+        break;
+      }
+      dir = subdirs[random_() % subdirs.size()];
+    }
+  }
+  // A walk may visit the same directory twice.
+  std::sort(sample->begin(), sample->end(),
+            [](const FileSystem::FileInfo& a, const FileSystem::FileInfo& b) {
+              return a.name < b.name;
+            });
+  sample->erase(std::unique(sample->begin(), sample->end(),
+                            [](const FileSystem::FileInfo& a,
+                               const FileSystem::FileInfo& b) {
+                              return a.name == b.name;
+                            }),
+                sample->end());
+}
+
+bool FileCache::ReadLedger(int64* cache_size, int64* cache_inode_count) {
+  NullMessageHandler null_handler;
+  GoogleString contents;
+  StringPieceVector fields;
+  if (!file_system_->ReadFile(ledger_path_.c_str(), &contents,
+                              &null_handler)) {
+    return false;
+  }
+  SplitStringPieceToVector(contents, " ", &fields, true);
+  return fields.size() == 2 && StringToInt64(fields[0], cache_size) &&
+         StringToInt64(fields[1], cache_inode_count);
+}
+
+void FileCache::WriteLedger(int64 cache_size, int64 cache_inode_count) {
+  // Recorded usage can't drive the totals negative, but a ledger that was
+  // out of date can.
+  cache_size = std::max<int64>(0, cache_size);
+  cache_inode_count = std::max<int64>(0, cache_inode_count);
+  if (!file_system_->WriteFileAtomic(
+          ledger_path_,
+          StrCat(Integer64ToString(cache_size), " ",
+                 Integer64ToString(cache_inode_count)),
+          message_handler_)) {
+    write_errors_->Add(1);
+  }
+  {
+    ScopedMutex lock(mutex_.get());
+    ledger_known_ = true;
+    ledger_bytes_ = cache_size;
+    ledger_inodes_ = cache_inode_count;
+  }
+  ledger_bytes_counter_->Set(cache_size);
+  ledger_inodes_counter_->Set(cache_inode_count);
+}
+
+void FileCache::RecordUsage(int64 bytes, int64 inodes) {
+  ScopedMutex lock(mutex_.get());
+  pending_bytes_ += bytes;
+  pending_inodes_ += inodes;
+}
+
+bool FileCache::IsCleaningStateFile(StringPiece path) const {
+  // ListContents may or may not give directories, such as the lock, a
+  // trailing slash.
+  if (path.ends_with("/")) {
+    path.remove_suffix(1);
+  }
+  return path == clean_time_path_ || path == clean_lock_path_ ||
+         path == ledger_path_ || IsUncleaned(path);
+}
+
+bool FileCache::IsUncleaned(StringPiece path) const {
+  return path.starts_with(uncleaned_path_) &&
+         (path.size() == uncleaned_path_.size() ||
+          path[uncleaned_path_.size()] == '/');
+}
+
+void FileCache::ExcludeUncleanedFiles(FileSystem::DirInfo* dir_info) {
+  NullMessageHandler null_handler;  // It usually doesn't exist.
+  FileSystem::DirInfo uncleaned_info;
+  file_system_->GetDirInfo(uncleaned_path_, &uncleaned_info, &null_handler);
+  dir_info->size_bytes -= uncleaned_info.size_bytes;
+  dir_info->inode_count -= uncleaned_info.inode_count;
+  // As well as the directory itself, if it's there.
+  int64 dir_size;
+  if (file_system_->Size(uncleaned_path_, &dir_size, &null_handler) ||
+      file_system_->Size(StrCat(uncleaned_path_, "/"), &dir_size,
+                         &null_handler)) {
+    dir_info->size_bytes -= dir_size;
+    --dir_info->inode_count;
+  }
+  dir_info->files.erase(
+      std::remove_if(dir_info->files.begin(), dir_info->files.end(),
+                     [this](const FileSystem::FileInfo& file) {
+                       return IsUncleaned(file.name);
+                     }),
+      dir_info->files.end());
+  dir_info->empty_dirs.erase(
+      std::remove_if(dir_info->empty_dirs.begin(), dir_info->empty_dirs.end(),
+                     [this](const GoogleString& dir) {
+                       return IsUncleaned(dir);
+                     }),
+      dir_info->empty_dirs.end());
+}
+
 void FileCache::CleanWithLocking(int64 next_clean_time_ms) {
   if (file_system_
           ->TryLockWithTimeout(clean_lock_path_, kLockTimeoutMs,
@@ -363,7 +916,13 @@ void FileCache::CleanWithLocking(int64 next_clean_time_ms) {
     }
 
     // Now actually clean.
-    Clean(cache_policy_->target_size_bytes, cache_policy_->target_inode_count);
+    if (cache_policy_->incremental_cleaning()) {
+      CleanIncrementally(cache_policy_->target_size_bytes,
+                         cache_policy_->target_inode_count);
+    } else {
+      Clean(cache_policy_->target_size_bytes,
+            cache_policy_->target_inode_count);
+    }
     file_system_->Unlock(clean_lock_path_, message_handler_);
   } else {
     // The previous cache cleaning run is still active, so skip this round.
@@ -384,6 +943,15 @@ bool FileCache::ShouldClean(int64* suggested_next_clean_time_ms) {
     ScopedMutex lock(mutex_.get());
     if (now_ms < next_clean_ms_) {
       *suggested_next_clean_time_ms = next_clean_ms_;  // No change yet.
+      // With incremental cleaning, clean as soon as we know we've grown too
+      // big, rather than waiting for the next scheduled clean.
+      if (cache_policy_->incremental_cleaning() && ledger_known_) {
+        int64 target_inode_count = cache_policy_->target_inode_count;
+        return (ledger_bytes_ + pending_bytes_ >
+                    cache_policy_->target_size_bytes ||
+                (target_inode_count != 0 &&
+                 ledger_inodes_ + pending_inodes_ > target_inode_count));
+      }
       return false;
     }
   }
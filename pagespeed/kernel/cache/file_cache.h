@@ -20,6 +20,11 @@
 #ifndef PAGESPEED_KERNEL_CACHE_FILE_CACHE_H_
 #define PAGESPEED_KERNEL_CACHE_FILE_CACHE_H_
 
+#include <atomic>
+#include <memory>
+#include <random>
+#include <vector>
+
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/cache_interface.h"
@@ -33,10 +38,13 @@
 namespace net_instaweb {
 
 class Hasher;
+class Histogram;
+class IoUringPool;
 class MessageHandler;
 class SlowWorker;
 class Statistics;
 class Timer;
+class UpDownCounter;
 class Variable;
 
 // Simple C++ implementation of file cache.
@@ -49,13 +57,20 @@ class FileCache : public CacheInterface {
           hasher(hasher),
           clean_interval_ms(clean_interval_ms),
           target_size_bytes(target_size_bytes),
-          target_inode_count(target_inode_count) {}
+          target_inode_count(target_inode_count),
+          clean_slice_ms(0) {}
     const Timer* timer;
     const Hasher* hasher;
     int64 clean_interval_ms;
     int64 target_size_bytes;
     int64 target_inode_count;
+    // If positive, the cache keeps a running total of its size and cleans
+    // incrementally whenever that exceeds the targets, evicting from random
+    // samples of the cache for at most this long at a time.  Otherwise each
+    // cleaning walks and sorts the whole cache.
+    int64 clean_slice_ms;
     bool cleaning_enabled() { return clean_interval_ms != kDisableCleaning; }
+    bool incremental_cleaning() const { return clean_slice_ms > 0; }
 
    private:
     DISALLOW_COPY_AND_ASSIGN(CachePolicy);
@@ -69,9 +84,18 @@ class FileCache : public CacheInterface {
   static void InitStats(Statistics* statistics);
 
   void Get(const GoogleString& key, Callback* callback) override;
+  void MultiGet(MultiGetRequest* request) override;
   void Put(const GoogleString& key, const SharedString& value) override;
   void Delete(const GoogleString& key) override;
   void set_worker(SlowWorker* worker) { worker_ = worker; }
+
+  // Reads and writes cache files through io_uring where the kernel supports
+  // it.  All the lookups of a MultiGet are then submitted together, so a
+  // batch costs two system calls however many keys it has.  The I/O
+  // bypasses file_system, so only enable this when that is the local disk.
+  // If io_uring turns out to be unavailable, file_system is used as before.
+  void EnableIoUring();
+  bool io_uring_enabled() const { return io_uring_pool_ != nullptr; }
   SlowWorker* worker() { return worker_; }
 
   static GoogleString FormatName() { return "FileCache"; }
@@ -84,6 +108,12 @@ class FileCache : public CacheInterface {
   const CachePolicy* cache_policy() const { return cache_policy_.get(); }
   CachePolicy* mutable_cache_policy() { return cache_policy_.get(); }
   const GoogleString& path() const { return path_; }
+  // A directory under path() for files that aren't cache entries, such as
+  // shared memory cache checkpoints.  Cleaning neither counts nor removes
+  // anything in it, so whoever keeps files there must bound their size.
+  const GoogleString& uncleaned_path() const { return uncleaned_path_; }
+  FileSystem* file_system() const { return file_system_; }
+  ThreadSystem* thread_system() const { return thread_system_; }
 
   // Variable names.
   static const char kBytesFreedInCleanup[];
@@ -99,6 +129,16 @@ class FileCache : public CacheInterface {
   // Number of times we scanned the cache to see if it needed cleaning.
   static const char kStartedCleanups[];
   static const char kWriteErrors[];
+  // Number of batches of reads submitted through io_uring.
+  static const char kIoUringBatches[];
+  // Number of incremental cleaning slices run, and how long each took.
+  static const char kCleanerSlices[];
+  static const char kCleanerSliceLatencyUs[];
+  // Files examined as eviction candidates by incremental cleaning.
+  static const char kCleanerFilesSampled[];
+  // The cache size and inode count last recorded in the ledger.
+  static const char kLedgerBytes[];
+  static const char kLedgerInodes[];
 
   // What to set clean_interval_ms to in order to disable cleaning.  This needs
   // to be -1, because that's what we have in our public documentation.
@@ -114,7 +154,46 @@ class FileCache : public CacheInterface {
   // while. It's OK for others to write and read from the cache while this is
   // going on, but try to avoid Cleaning from two threads at the same time. A
   // target_inode_count of 0 means no inode limit is applied.
-  bool Clean(int64 target_size_bytes, int64 target_inode_count);
+  bool Clean(int64 target_size_bytes, int64 target_inode_count) {
+    return Clean(target_size_bytes, target_inode_count, nullptr, nullptr);
+  }
+  // As above, also reporting the size and inode count left in the cache if
+  // cache_size and cache_inode_count are non-null.
+  bool Clean(int64 target_size_bytes, int64 target_inode_count,
+             int64* cache_size, int64* cache_inode_count);
+
+  // Runs one slice of incremental cleaning: folds the usage recorded since
+  // the last slice into the ledger, then evicts the least recently used
+  // files of random samples until the cache is under its targets or
+  // clean_slice_ms has passed.  If there is no ledger yet, this does a full
+  // Clean instead to establish one.  Like Clean, this expects the caller to
+  // hold the clean lock.
+  bool CleanIncrementally(int64 target_size_bytes, int64 target_inode_count)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Adds the files in a random path down the cache directory tree to
+  // sample, removing any old empty directories found on the way and
+  // decrementing *cache_inode_count for each.
+  void SampleFiles(std::vector<FileSystem::FileInfo>* sample,
+                   int64* cache_inode_count);
+
+  // Reads and writes the ledger file, which holds the cache size and inode
+  // count as of the last cleaning.
+  bool ReadLedger(int64* cache_size, int64* cache_inode_count);
+  void WriteLedger(int64 cache_size, int64 cache_inode_count)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Records a change to the cache's size and inode count for the ledger.
+  void RecordUsage(int64 bytes, int64 inodes) LOCKS_EXCLUDED(mutex_);
+
+  // True for the files the cache keeps its own state in, and for anything in
+  // uncleaned_path_.
+  bool IsCleaningStateFile(StringPiece path) const;
+  // True for uncleaned_path_ and anything in it.
+  bool IsUncleaned(StringPiece path) const;
+
+  // Removes the contents of uncleaned_path_ from dir_info, a census of path_.
+  void ExcludeUncleanedFiles(FileSystem::DirInfo* dir_info);
 
   // Clean the cache, taking care of interprocess locking, as well as timestamp
   // update.
@@ -132,6 +211,21 @@ class FileCache : public CacheInterface {
 
   bool EncodeFilename(const GoogleString& key, GoogleString* filename);
 
+  // Reads each of *filenames through io_uring, setting (*found)[i] if
+  // (*filenames)[i] was read into (*values)[i].  Returns false if no ring is
+  // available or the ring failed, in which case the outputs are meaningless
+  // and *filenames may have been emptied.
+  bool ReadFilesWithIoUring(StringVector* filenames,
+                            std::vector<GoogleString>* values,
+                            std::vector<bool>* found);
+
+  // Writes value to a temporary file and renames it over filename, all
+  // through io_uring.  Returns false if that did not work, including when
+  // the directory does not exist yet, leaving the caller to retry through
+  // file_system.
+  bool WriteFileWithIoUring(const GoogleString& filename,
+                            const SharedString& value);
+
   const GoogleString path_;
   FileSystem* file_system_;
   SlowWorker* worker_;
@@ -140,12 +234,29 @@ class FileCache : public CacheInterface {
   std::unique_ptr<AbstractMutex> mutex_;
   int64 next_clean_ms_ GUARDED_BY(mutex_);
   int path_length_limit_;  // Maximum total length of path file_system_ supports
-  // The full paths to our cleanup timestamp and lock files.
+  // The full paths to our cleanup timestamp, lock and ledger files.
   GoogleString clean_time_path_;
   GoogleString clean_lock_path_;
+  GoogleString ledger_path_;
+  GoogleString uncleaned_path_;
+  // With incremental cleaning, the totals read from or written to the ledger
+  // file by this process, and the usage it has recorded since.  The pending
+  // usage is added to the ledger file by the next slice to get the clean
+  // lock.
+  bool ledger_known_ GUARDED_BY(mutex_);
+  int64 ledger_bytes_ GUARDED_BY(mutex_);
+  int64 ledger_inodes_ GUARDED_BY(mutex_);
+  int64 pending_bytes_ GUARDED_BY(mutex_);
+  int64 pending_inodes_ GUARDED_BY(mutex_);
+  // Picks the directories sampled for eviction.  Only used on worker_.
+  std::minstd_rand random_;
   // If set, we use this instead of the default LockBumpingProgressNotifier.  We
   // do not take ownership.
   FileSystem::ProgressNotifier* notifier_for_tests_;
+  ThreadSystem* thread_system_;
+  std::unique_ptr<IoUringPool> io_uring_pool_;
+  // Makes the names of temporary files written through io_uring unique.
+  std::atomic<uint64> io_uring_temp_file_count_;
 
   Variable* disk_checks_;
   Variable* cleanups_;
@@ -154,11 +265,22 @@ class FileCache : public CacheInterface {
   Variable* skipped_cleanups_;
   Variable* started_cleanups_;
   Variable* write_errors_;
+  Variable* io_uring_batches_;
+  Variable* cleaner_slices_;
+  Histogram* cleaner_slice_latency_us_;
+  Variable* cleaner_files_sampled_;
+  UpDownCounter* ledger_bytes_counter_;
+  UpDownCounter* ledger_inodes_counter_;
 
   // The filename where we keep the next scheduled cleanup time in seconds.
   static const char kCleanTimeName[];
   // The name of the global mutex protecting reads and writes to that file.
   static const char kCleanLockName[];
+  // The filename where incremental cleaning keeps the cache size and inode
+  // count.
+  static const char kLedgerName[];
+  // The directory under path_ that cleaning leaves alone.
+  static const char kUncleanedDirName[];
 
   // How long a cache cleaner has to go without bumping it's lock before it
   // might be usurped.
@@ -0,0 +1,137 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Multipliers for the four rows.  Any distinct odd 64-bit constants will do.
+const uint64 kSeeds[] = {
+    0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+    0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL,
+};
+
+const uint64 kResetMask = 0x7777777777777777ULL;
+const size_t kMinCapacity = 16;
+
+// Scrambles the caller-supplied hash so that keys whose hashes differ
+// only in a few bits still land on unrelated counters.
+uint64 Spread(uint64 x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+size_t RoundUpToPowerOfTwo(size_t x) {
+  size_t result = kMinCapacity;
+  while (result < x) {
+    result <<= 1;
+  }
+  return result;
+}
+
+}  // namespace
+
+const int FrequencySketch::kMaxFrequency;
+
+FrequencySketch::FrequencySketch(size_t capacity)
+    : table_mask_(0), sample_size_(0), sample_count_(0) {
+  EnsureCapacity(capacity);
+}
+
+FrequencySketch::~FrequencySketch() {}
+
+void FrequencySketch::EnsureCapacity(size_t capacity) {
+  size_t size = RoundUpToPowerOfTwo(capacity);
+  if (size <= table_.size()) {
+    return;
+  }
+  table_.assign(size, 0);
+  table_mask_ = size - 1;
+  sample_size_ = 10 * size;
+  sample_count_ = 0;
+}
+
+uint64 FrequencySketch::HashKey(StringPiece key) {
+  return HashString<CasePreserve, uint64>(key.data(), key.size());
+}
+
+size_t FrequencySketch::IndexOf(uint64 hash, int i) const {
+  uint64 h = (hash + kSeeds[i]) * kSeeds[i];
+  h += h >> 32;
+  return static_cast<size_t>(h & table_mask_);
+}
+
+bool FrequencySketch::IncrementAt(size_t index, int offset) {
+  int shift = offset << 2;
+  uint64 mask = 0xfULL << shift;
+  if ((table_[index] & mask) != mask) {
+    table_[index] += 1ULL << shift;
+    return true;
+  }
+  return false;
+}
+
+void FrequencySketch::Increment(uint64 hash) {
+  uint64 spread = Spread(hash);
+  // Each row uses a different one of the 16 counters in its word, chosen
+  // from the low bits of the hash, so the four rows do not share counters.
+  int start = static_cast<int>(spread & 3) << 2;
+  bool added = false;
+  for (int i = 0; i < 4; ++i) {
+    added |= IncrementAt(IndexOf(spread, i), start + i);
+  }
+  if (added && (++sample_count_ >= sample_size_)) {
+    Age();
+  }
+}
+
+int FrequencySketch::Frequency(uint64 hash) const {
+  uint64 spread = Spread(hash);
+  int start = static_cast<int>(spread & 3) << 2;
+  int frequency = kMaxFrequency;
+  for (int i = 0; i < 4; ++i) {
+    int shift = (start + i) << 2;
+    int count = static_cast<int>((table_[IndexOf(spread, i)] >> shift) & 0xf);
+    frequency = std::min(frequency, count);
+  }
+  return frequency;
+}
+
+void FrequencySketch::Age() {
+  for (uint64& word : table_) {
+    word = (word >> 1) & kResetMask;
+  }
+  sample_count_ /= 2;
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,95 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
+#define PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Approximate, aging popularity counter for cache keys, used to implement
+// the TinyLFU admission policy: when a cache is full, a newly inserted key
+// is only allowed to displace an existing one if it has been seen more
+// often recently.
+//
+// This is a count-min sketch with four 4-bit counters per key, packed
+// sixteen to a 64-bit word.  Estimates saturate at 15, which is plenty to
+// tell a one-hit wonder from a popular key.  After 10 * capacity
+// increments every counter is halved, so popularity decays over time and
+// a formerly hot key does not keep its place forever.
+//
+// The sketch itself uses a fixed amount of memory regardless of how many
+// distinct keys are seen, about 8 bytes per unit of capacity.  It is not
+// thread-safe.
+class FrequencySketch {
+ public:
+  static const int kMaxFrequency = 15;
+
+  // capacity is the expected number of distinct keys resident in the
+  // cache; it is rounded up to a power of two.
+  explicit FrequencySketch(size_t capacity);
+  ~FrequencySketch();
+
+  // Grows the sketch to cover at least capacity keys.  Growing discards
+  // the accumulated counts.  Shrinking is not supported and is a no-op.
+  void EnsureCapacity(size_t capacity);
+
+  // Records an access to the key with the given hash.
+  void Increment(uint64 hash);
+
+  // Returns the estimated number of recent accesses to the key with the
+  // given hash, in the range [0, kMaxFrequency].
+  int Frequency(uint64 hash) const;
+
+  // Convenience hash for string keys.
+  static uint64 HashKey(StringPiece key);
+
+  size_t capacity() const { return table_.size(); }
+
+  // Number of increments since the counters were last halved.
+  size_t sample_count() const { return sample_count_; }
+  size_t sample_size() const { return sample_size_; }
+
+ private:
+  // Returns the index of the word holding the counter for hash in row i.
+  size_t IndexOf(uint64 hash, int i) const;
+
+  // Adds one to the 4-bit counter at (index, offset) unless saturated.
+  // Returns whether the counter changed.
+  bool IncrementAt(size_t index, int offset);
+
+  // Halves every counter.
+  void Age();
+
+  std::vector<uint64> table_;
+  uint64 table_mask_;
+  size_t sample_size_;
+  size_t sample_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrequencySketch);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_FREQUENCY_SKETCH_H_
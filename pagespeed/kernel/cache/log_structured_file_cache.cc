@@ -0,0 +1,741 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/cache/log_structured_file_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+#ifdef USE_SYSTEM_ZLIB
+#include "zlib.h"
+#else
+#include "external/envoy/bazel/foreign_cc/zlib/include/zlib.h"
+#endif
+
+namespace net_instaweb {
+
+const char LogStructuredFileCache::kCorruptRecords[] =
+    "log_file_cache_corrupt_records";
+const char LogStructuredFileCache::kSegmentEvictions[] =
+    "log_file_cache_segment_evictions";
+const char LogStructuredFileCache::kSkippedPuts[] =
+    "log_file_cache_skipped_puts";
+const char LogStructuredFileCache::kWriteErrors[] =
+    "log_file_cache_write_errors";
+
+namespace {
+
+const uint32 kRecordMagic = 0x4c534331;  // "LSC1"
+const uint32 kIndexMagic = 0x4c534931;   // "LSI1"
+const uint32 kTombstone = 0xffffffff;
+const size_t kAlignment = 8;
+const int64 kMinSegmentSize = 1 << 20;
+const int64 kMaxSegmentSize = 256 << 20;
+const char kSegmentSuffix[] = ".seg";
+const char kIndexSuffix[] = ".idx";
+const size_t kIdDigits = 16;
+
+// Every record starts on a kAlignment boundary with this header, followed
+// by the key, the value (absent for a tombstone) and zero padding.
+struct RecordHeader {
+  uint32 magic;
+  uint32 key_size;
+  uint32 value_size;  // kTombstone for a Delete.
+  uint32 checksum;    // crc32 of key_size, value_size, key and value.
+};
+
+struct IndexHeader {
+  uint32 magic;
+  uint32 checksum;       // crc32 of the entries.
+  uint64 segment_bytes;  // Length of the segment prefix that was indexed.
+  uint64 num_entries;
+};
+
+// Index entries are sorted by hash.
+struct IndexEntry {
+  uint64 hash;
+  uint32 offset;
+  uint32 value_size;
+};
+
+size_t RecordSize(size_t key_size, uint32 value_size) {
+  size_t size = sizeof(RecordHeader) + key_size;
+  if (value_size != kTombstone) {
+    size += value_size;
+  }
+  return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+uint32 Crc(uint32 crc, const void* data, size_t size) {
+  return crc32(crc, static_cast<const Bytef*>(data), static_cast<uInt>(size));
+}
+
+// key must be followed by the value in memory for non-tombstones, as it is
+// in a mapped segment.
+uint32 RecordChecksum(const RecordHeader& header, const char* key) {
+  uint32 crc = Crc(crc32(0L, Z_NULL, 0), &header.key_size,
+                   sizeof(header.key_size) + sizeof(header.value_size));
+  size_t payload = header.key_size;
+  if (header.value_size != kTombstone) {
+    payload += header.value_size;
+  }
+  return Crc(crc, key, payload);
+}
+
+// FNV-1a.  This must be stable across processes and releases, as it is
+// persisted in index files.
+uint64 HashKey(const char* key, size_t size) {
+  uint64 hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<uint8>(key[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+bool CompareEntryHash(const IndexEntry& entry, uint64 hash) {
+  return entry.hash < hash;
+}
+
+GoogleString IdPath(const GoogleString& dir, uint64 id, const char* suffix) {
+  char name[kIdDigits + 1];
+  snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(id));
+  return StrCat(dir, "/", name, suffix);
+}
+
+// Parses "<16 hex digits><suffix>", returning false for anything else.
+bool ParseIdName(const char* name, const char* suffix, uint64* id) {
+  size_t length = strlen(name);
+  if (length != kIdDigits + strlen(suffix) ||
+      strcmp(name + kIdDigits, suffix) != 0) {
+    return false;
+  }
+  char* end = nullptr;
+  *id = strtoull(name, &end, 16);
+  return end == name + kIdDigits;
+}
+
+// Lists the ids of the segment and index files in dir, in ascending order.
+bool ListIds(const GoogleString& dir, std::vector<uint64>* segments,
+             std::vector<uint64>* indexes, MessageHandler* handler) {
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) {
+    handler->Message(kError, "Failed to list cache directory %s: %s",
+                     dir.c_str(), strerror(errno));
+    return false;
+  }
+  uint64 id;
+  for (struct dirent* entry; (entry = readdir(d)) != nullptr;) {
+    if (ParseIdName(entry->d_name, kSegmentSuffix, &id)) {
+      segments->push_back(id);
+    } else if (indexes != nullptr &&
+               ParseIdName(entry->d_name, kIndexSuffix, &id)) {
+      indexes->push_back(id);
+    }
+  }
+  closedir(d);
+  std::sort(segments->begin(), segments->end());
+  return true;
+}
+
+bool MakeDirs(const GoogleString& path, MessageHandler* handler) {
+  for (size_t pos = 1; pos <= path.size(); ++pos) {
+    if (pos == path.size() || path[pos] == '/') {
+      GoogleString prefix = path.substr(0, pos);
+      if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+        handler->Message(kError, "Failed to make directory %s: %s",
+                         prefix.c_str(), strerror(errno));
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+// One segment file, mapped read-only at twice the nominal segment size so
+// that appends racing with a roll still land inside the mapping.  Sealed
+// segments are looked up through their mapped index file; the others
+// through recent_, which Scan() fills in from the records on disk.
+//
+// Everything but Read() and Append() must be called with the cache mutex
+// held.  Those two only touch the immutable fd_ and mapping.
+class LogStructuredFileCache::Segment
+    : public RefCounted<LogStructuredFileCache::Segment> {
+ public:
+  struct Location {
+    uint32 offset;
+    uint32 value_size;
+  };
+
+  // Returns nullptr, logging unless the file is simply absent and create
+  // is false, if the segment cannot be opened and mapped.
+  static Segment* Open(const GoogleString& path, size_t mapped_size,
+                       bool create, MessageHandler* handler) {
+    int flags = O_RDWR | O_APPEND | (create ? O_CREAT : 0);
+    int fd = open(path.c_str(), flags, 0644);
+    if (fd < 0) {
+      if (create || errno != ENOENT) {
+        handler->Message(kError, "Failed to open cache segment %s: %s",
+                         path.c_str(), strerror(errno));
+      }
+      return nullptr;
+    }
+    void* data = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      handler->Message(kError, "Failed to map cache segment %s: %s",
+                       path.c_str(), strerror(errno));
+      close(fd);
+      return nullptr;
+    }
+    return new Segment(fd, static_cast<const char*>(data), mapped_size);
+  }
+
+  ~Segment() {
+    if (index_map_ != nullptr) {
+      munmap(index_map_, index_map_size_);
+    }
+    munmap(const_cast<char*>(data_), mapped_size_);
+    close(fd_);
+  }
+
+  // Re-reads the size of the file, returning it.
+  int64 UpdateFileSize() {
+    struct stat st;
+    if (fstat(fd_, &st) == 0) {
+      file_size_ = st.st_size;
+    }
+    return file_size_;
+  }
+  int64 file_size() const { return file_size_; }
+
+  // Bytes of the segment whose records have been indexed.  Locations
+  // returned by Lookup lie within this prefix.
+  size_t scanned() const { return scanned_; }
+  bool sealed() const { return sealed_; }
+
+  // Indexes the complete records between scanned() and file_size() and
+  // returns the number of damaged stretches skipped.  A record that runs
+  // past the end of the file is left for the next scan, as its writer may
+  // still be appending it.
+  int Scan() {
+    DCHECK(!sealed_);
+    size_t limit = std::min(static_cast<size_t>(file_size_), mapped_size_);
+    int corrupt = 0;
+    bool in_damage = false;
+    while (scanned_ + sizeof(RecordHeader) <= limit) {
+      const RecordHeader* header =
+          reinterpret_cast<const RecordHeader*>(data_ + scanned_);
+      const char* key = data_ + scanned_ + sizeof(RecordHeader);
+      size_t record_size = 0;
+      if (header->magic == kRecordMagic && header->key_size < mapped_size_ &&
+          (header->value_size == kTombstone ||
+           header->value_size < mapped_size_)) {
+        record_size = RecordSize(header->key_size, header->value_size);
+        if (scanned_ + record_size > limit) {
+          if (scanned_ + record_size <= mapped_size_) {
+            break;
+          }
+          record_size = 0;  // Can never be completed.
+        }
+      }
+      if (record_size != 0 && RecordChecksum(*header, key) == header->checksum) {
+        Location location = {static_cast<uint32>(scanned_),
+                             header->value_size};
+        recent_[HashKey(key, header->key_size)] = location;
+        scanned_ += record_size;
+        in_damage = false;
+      } else {
+        // Resynchronize on the next aligned record header.
+        if (!in_damage) {
+          ++corrupt;
+          in_damage = true;
+        }
+        scanned_ += kAlignment;
+      }
+    }
+    return corrupt;
+  }
+
+  bool Lookup(uint64 hash, Location* location) const {
+    auto it = recent_.find(hash);
+    if (it != recent_.end()) {
+      *location = it->second;
+      return true;
+    }
+    const IndexEntry* end = index_ + num_index_entries_;
+    const IndexEntry* entry =
+        std::lower_bound(index_, end, hash, CompareEntryHash);
+    if (entry != end && entry->hash == hash) {
+      location->offset = entry->offset;
+      location->value_size = entry->value_size;
+      return true;
+    }
+    return false;
+  }
+
+  // Stops scanning this segment and moves its index to index_path, loading
+  // an existing index file if there is a valid one.  If the index file
+  // cannot be written the in-memory index is kept.  Returns the number of
+  // damaged stretches found if the segment had to be scanned.
+  int Seal(const GoogleString& index_path, MessageHandler* handler) {
+    DCHECK(!sealed_);
+    UpdateFileSize();
+    int corrupt = 0;
+    if (!LoadIndex(index_path)) {
+      corrupt = Scan();
+      if (!WriteIndex(index_path, handler) || !LoadIndex(index_path)) {
+        sealed_ = true;
+        return corrupt;
+      }
+    }
+    recent_.clear();
+    sealed_ = true;
+    return corrupt;
+  }
+
+  // Copies the value at location into *value after checking that the
+  // record lies within the first limit bytes, is for key, and is intact.
+  bool Read(const Location& location, size_t limit, const GoogleString& key,
+            SharedString* value) const {
+    size_t offset = location.offset;
+    if (offset % kAlignment != 0 || offset + sizeof(RecordHeader) > limit) {
+      return false;
+    }
+    const RecordHeader* header =
+        reinterpret_cast<const RecordHeader*>(data_ + offset);
+    const char* record_key = data_ + offset + sizeof(RecordHeader);
+    if (header->magic != kRecordMagic || header->key_size != key.size() ||
+        header->value_size != location.value_size ||
+        location.value_size == kTombstone ||
+        offset + RecordSize(header->key_size, header->value_size) > limit ||
+        memcmp(record_key, key.data(), key.size()) != 0 ||
+        RecordChecksum(*header, record_key) != header->checksum) {
+      return false;
+    }
+    value->Assign(record_key + key.size(), header->value_size);
+    return true;
+  }
+
+  bool Append(const struct iovec* iov, int iovcnt, size_t size) {
+    ssize_t written = writev(fd_, iov, iovcnt);
+    return written == static_cast<ssize_t>(size);
+  }
+
+ private:
+  Segment(int fd, const char* data, size_t mapped_size)
+      : fd_(fd),
+        data_(data),
+        mapped_size_(mapped_size),
+        file_size_(0),
+        scanned_(0),
+        sealed_(false),
+        index_map_(nullptr),
+        index_map_size_(0),
+        index_(nullptr),
+        num_index_entries_(0) {}
+
+  // Maps index_path if it is intact and describes no more data than the
+  // segment holds.
+  bool LoadIndex(const GoogleString& index_path) {
+    int fd = open(index_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 &&
+        static_cast<size_t>(st.st_size) >= sizeof(IndexHeader)) {
+      size = st.st_size;
+      map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+      return false;
+    }
+    const IndexHeader* header = static_cast<const IndexHeader*>(map);
+    const IndexEntry* entries = reinterpret_cast<const IndexEntry*>(header + 1);
+    size_t entries_size = size - sizeof(IndexHeader);
+    if (header->magic != kIndexMagic ||
+        header->num_entries != entries_size / sizeof(IndexEntry) ||
+        entries_size % sizeof(IndexEntry) != 0 ||
+        header->segment_bytes > static_cast<uint64>(file_size_) ||
+        header->segment_bytes > mapped_size_ ||
+        Crc(crc32(0L, Z_NULL, 0), entries, entries_size) !=
+            header->checksum) {
+      munmap(map, size);
+      return false;
+    }
+    index_map_ = map;
+    index_map_size_ = size;
+    index_ = entries;
+    num_index_entries_ = header->num_entries;
+    scanned_ = header->segment_bytes;
+    return true;
+  }
+
+  // Writes recent_ to index_path via a temporary file, so readers only
+  // ever see a complete index.
+  bool WriteIndex(const GoogleString& index_path, MessageHandler* handler) {
+    std::vector<IndexEntry> entries;
+    entries.reserve(recent_.size());
+    for (const auto& hash_location : recent_) {
+      IndexEntry entry = {hash_location.first, hash_location.second.offset,
+                          hash_location.second.value_size};
+      entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const IndexEntry& a, const IndexEntry& b) {
+                return a.hash < b.hash;
+              });
+    size_t entries_size = entries.size() * sizeof(IndexEntry);
+    IndexHeader header = {kIndexMagic,
+                          Crc(crc32(0L, Z_NULL, 0), entries.data(),
+                              entries_size),
+                          scanned_, entries.size()};
+
+    GoogleString temp_path =
+        StrCat(index_path, ".", IntegerToString(getpid()), ".tmp");
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      handler->Message(kError, "Failed to create cache index %s: %s",
+                       temp_path.c_str(), strerror(errno));
+      return false;
+    }
+    struct iovec iov[2] = {
+        {&header, sizeof(header)},
+        {entries.data(), entries_size},
+    };
+    bool ok = (writev(fd, iov, 2) ==
+               static_cast<ssize_t>(sizeof(header) + entries_size));
+    ok = (close(fd) == 0) && ok;
+    if (ok) {
+      ok = (rename(temp_path.c_str(), index_path.c_str()) == 0);
+    }
+    if (!ok) {
+      handler->Message(kError, "Failed to write cache index %s: %s",
+                       index_path.c_str(), strerror(errno));
+      unlink(temp_path.c_str());
+    }
+    return ok;
+  }
+
+  const int fd_;
+  const char* const data_;
+  const size_t mapped_size_;
+  int64 file_size_;
+  size_t scanned_;
+  bool sealed_;
+  std::unordered_map<uint64, Location> recent_;
+  void* index_map_;
+  size_t index_map_size_;
+  const IndexEntry* index_;
+  size_t num_index_entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(Segment);
+};
+
+LogStructuredFileCache::LogStructuredFileCache(
+    const GoogleString& path, int64 target_size_bytes,
+    int64 segment_size_bytes, ThreadSystem* thread_system, Statistics* stats,
+    MessageHandler* handler)
+    : path_(path),
+      segment_size_(std::min(segment_size_bytes > 0
+                                 ? segment_size_bytes
+                                 : DefaultSegmentSize(target_size_bytes),
+                             kMaxSegmentSize)),
+      max_segments_(static_cast<int>(
+          std::max<int64>(2, target_size_bytes / segment_size_))),
+      message_handler_(handler),
+      mutex_(thread_system->NewMutex()),
+      initialized_(false),
+      usable_(false),
+      listed_at_size_(-1),
+      corrupt_records_(stats->GetVariable(kCorruptRecords)),
+      segment_evictions_(stats->GetVariable(kSegmentEvictions)),
+      skipped_puts_(stats->GetVariable(kSkippedPuts)),
+      write_errors_(stats->GetVariable(kWriteErrors)) {}
+
+LogStructuredFileCache::~LogStructuredFileCache() {}
+
+void LogStructuredFileCache::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kCorruptRecords);
+  statistics->AddVariable(kSegmentEvictions);
+  statistics->AddVariable(kSkippedPuts);
+  statistics->AddVariable(kWriteErrors);
+}
+
+int64 LogStructuredFileCache::DefaultSegmentSize(int64 target_size_bytes) {
+  return std::max(kMinSegmentSize,
+                  std::min(kMaxSegmentSize, target_size_bytes / 16));
+}
+
+GoogleString LogStructuredFileCache::SegmentPath(uint64 id) const {
+  return IdPath(path_, id, kSegmentSuffix);
+}
+
+GoogleString LogStructuredFileCache::IndexPath(uint64 id) const {
+  return IdPath(path_, id, kIndexSuffix);
+}
+
+void LogStructuredFileCache::Get(const GoogleString& key, Callback* callback) {
+  uint64 hash = HashKey(key.data(), key.size());
+  RefCountedPtr<Segment> segment;
+  Segment::Location location = {0, kTombstone};
+  size_t limit = 0;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (RefreshLockHeld()) {
+      for (auto it = segments_.rbegin(); it != segments_.rend(); ++it) {
+        if (it->second->Lookup(hash, &location)) {
+          segment = it->second;
+          limit = segment->scanned();
+          break;
+        }
+      }
+    }
+  }
+
+  // The copy out of the mapping happens without the lock; our reference
+  // keeps the segment mapped even if it is evicted meanwhile.
+  KeyState key_state = kNotFound;
+  if (segment.get() != nullptr && location.value_size != kTombstone) {
+    SharedString value;
+    if (segment->Read(location, limit, key, &value)) {
+      callback->set_value(value);
+      key_state = kAvailable;
+    }
+  }
+  ValidateAndReportResult(key, key_state, callback);
+}
+
+void LogStructuredFileCache::Put(const GoogleString& key,
+                                 const SharedString& value) {
+  if (RecordSize(key.size(), value.size()) >
+      static_cast<size_t>(segment_size_ / 2)) {
+    skipped_puts_->Add(1);
+    return;
+  }
+  Append(key, &value);
+}
+
+void LogStructuredFileCache::Delete(const GoogleString& key) {
+  Append(key, nullptr);
+}
+
+void LogStructuredFileCache::Append(const GoogleString& key,
+                                    const SharedString* value) {
+  RefCountedPtr<Segment> segment;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (!RefreshLockHeld()) {
+      return;
+    }
+    if ((segments_.empty() ||
+         segments_.rbegin()->second->file_size() >= segment_size_) &&
+        !RollLockHeld()) {
+      return;
+    }
+    segment = segments_.rbegin()->second;
+  }
+
+  RecordHeader header;
+  header.magic = kRecordMagic;
+  header.key_size = key.size();
+  header.value_size = (value == nullptr) ? kTombstone : value->size();
+  uint32 crc = Crc(crc32(0L, Z_NULL, 0), &header.key_size,
+                   sizeof(header.key_size) + sizeof(header.value_size));
+  crc = Crc(crc, key.data(), key.size());
+  if (value != nullptr) {
+    crc = Crc(crc, value->data(), value->size());
+  }
+  header.checksum = crc;
+
+  static const char kPadding[kAlignment] = {0};
+  size_t record_size = RecordSize(header.key_size, header.value_size);
+  struct iovec iov[4];
+  int iovcnt = 0;
+  iov[iovcnt++] = {&header, sizeof(header)};
+  iov[iovcnt++] = {const_cast<char*>(key.data()), key.size()};
+  size_t unpadded = sizeof(header) + key.size();
+  if (value != nullptr) {
+    iov[iovcnt++] = {const_cast<char*>(value->data()), value->size()};
+    unpadded += value->size();
+  }
+  if (record_size > unpadded) {
+    iov[iovcnt++] = {const_cast<char*>(kPadding), record_size - unpadded};
+  }
+  if (!segment->Append(iov, iovcnt, record_size)) {
+    message_handler_->Message(kError, "Failed to append to cache in %s: %s",
+                              path_.c_str(), strerror(errno));
+    write_errors_->Add(1);
+  }
+}
+
+bool LogStructuredFileCache::InitializeLockHeld() {
+  if (!MakeDirs(path_, message_handler_)) {
+    return false;
+  }
+  std::vector<uint64> segment_ids, index_ids;
+  if (!ListIds(path_, &segment_ids, &index_ids, message_handler_)) {
+    return false;
+  }
+
+  // Segments that should already have been evicted, and indexes without a
+  // segment, are debris from a crash or a smaller configuration.
+  uint64 newest = segment_ids.empty() ? 0 : segment_ids.back();
+  for (uint64 id : segment_ids) {
+    if (id + max_segments_ <= newest) {
+      unlink(SegmentPath(id).c_str());
+    } else {
+      OpenSegmentLockHeld(id, false);
+    }
+  }
+  for (uint64 id : index_ids) {
+    if (segments_.find(id) == segments_.end()) {
+      unlink(IndexPath(id).c_str());
+    }
+  }
+  return true;
+}
+
+bool LogStructuredFileCache::RefreshLockHeld() {
+  if (!initialized_) {
+    initialized_ = true;
+    usable_ = InitializeLockHeld();
+  }
+  if (!usable_ || segments_.empty()) {
+    return usable_;
+  }
+
+  // Once the newest segment is full someone will start the next one; look
+  // for it whenever the full segment has grown since we last looked.
+  int64 newest_size = segments_.rbegin()->second->UpdateFileSize();
+  if (newest_size >= segment_size_ && newest_size != listed_at_size_) {
+    listed_at_size_ = newest_size;
+    OpenNewerSegmentsLockHeld();
+  }
+  RetireOldSegmentsLockHeld(false);
+
+  // Pick up records appended to the unsealed segments, which are the two
+  // newest ones.
+  for (auto it = segments_.rbegin(); it != segments_.rend(); ++it) {
+    Segment* segment = it->second.get();
+    if (segment->sealed()) {
+      break;
+    }
+    segment->UpdateFileSize();
+    int corrupt = segment->Scan();
+    if (corrupt != 0) {
+      corrupt_records_->Add(corrupt);
+    }
+  }
+  return true;
+}
+
+void LogStructuredFileCache::OpenNewerSegmentsLockHeld() {
+  std::vector<uint64> ids;
+  if (!ListIds(path_, &ids, nullptr, message_handler_) || ids.empty()) {
+    return;
+  }
+  uint64 newest = segments_.empty() ? 0 : segments_.rbegin()->first;
+  for (uint64 id : ids) {
+    if (id > newest && id + max_segments_ > ids.back()) {
+      OpenSegmentLockHeld(id, false);
+    }
+  }
+}
+
+bool LogStructuredFileCache::RollLockHeld() {
+  // Another process may have started a segment we haven't seen yet.
+  OpenNewerSegmentsLockHeld();
+  if (!segments_.empty()) {
+    Segment* newest = segments_.rbegin()->second.get();
+    if (newest->UpdateFileSize() < segment_size_) {
+      RetireOldSegmentsLockHeld(false);
+      return true;
+    }
+  }
+  uint64 id = segments_.empty() ? 1 : segments_.rbegin()->first + 1;
+  if (OpenSegmentLockHeld(id, true) == nullptr) {
+    return false;
+  }
+  listed_at_size_ = -1;
+  RetireOldSegmentsLockHeld(true);
+  return true;
+}
+
+void LogStructuredFileCache::RetireOldSegmentsLockHeld(bool unlink_files) {
+  if (segments_.empty()) {
+    return;
+  }
+  uint64 newest = segments_.rbegin()->first;
+  for (auto it = segments_.begin(); it != segments_.end();) {
+    uint64 id = it->first;
+    if (id + max_segments_ <= newest) {
+      if (unlink_files) {
+        unlink(SegmentPath(id).c_str());
+        unlink(IndexPath(id).c_str());
+        segment_evictions_->Add(1);
+      }
+      it = segments_.erase(it);
+    } else {
+      if (id + 2 <= newest && !it->second->sealed()) {
+        int corrupt = it->second->Seal(IndexPath(id), message_handler_);
+        if (corrupt != 0) {
+          corrupt_records_->Add(corrupt);
+        }
+      }
+      ++it;
+    }
+  }
+}
+
+LogStructuredFileCache::Segment* LogStructuredFileCache::OpenSegmentLockHeld(
+    uint64 id, bool create) {
+  Segment* segment = Segment::Open(SegmentPath(id), 2 * segment_size_, create,
+                                   message_handler_);
+  if (segment != nullptr) {
+    segment->UpdateFileSize();
+    segments_[id].reset(segment);
+  }
+  return segment;
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,170 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_LOG_STRUCTURED_FILE_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_LOG_STRUCTURED_FILE_CACHE_H_
+
+#include <map>
+#include <memory>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+class Statistics;
+class ThreadSystem;
+class Variable;
+
+// Disk cache that appends values to a small number of large segment files
+// instead of writing one file per key as FileCache does.  Segments are
+// memory-mapped for reading, so a hit costs a hash lookup and a copy out of
+// the page cache rather than an open/read/close, and eviction unlinks a
+// whole segment instead of walking the directory tree and stat'ing every
+// file.
+//
+// Layout: the cache directory holds segments named by a hexadecimal
+// sequence number ("0000000000000007.seg").  Each segment is a sequence of
+// checksummed records {header, key, value}, appended with a single
+// O_APPEND write so that any number of processes can share one cache.  A
+// Delete appends a tombstone record.  Once a segment is no longer one of
+// the two newest it is sealed: its key-hash index is written next to it
+// ("0000000000000007.idx") and memory-mapped, so every process shares one
+// copy of the index for sealed data.  The two newest segments are indexed
+// in memory by each process as it scans the records others appended.
+//
+// Eviction is FIFO by segment: when the newest segment fills up a new one
+// is started, and segments older than target_size_bytes / segment_size are
+// unlinked.  Every process applies the same rule, so mappings of evicted
+// segments are dropped everywhere without further coordination.
+//
+// Recovery: nothing is trusted without a checksum.  On startup an index
+// file is used only if its checksum matches and it does not claim more
+// data than its segment holds; otherwise the segment is rescanned.  A
+// scan skips over damaged records, so a crash during an append loses at
+// most the record being written.
+//
+// The disk is not touched until the first cache operation, so the cache
+// can be constructed in a parent process and used from its children.
+class LogStructuredFileCache : public CacheInterface {
+ public:
+  // segment_size_bytes of 0 selects DefaultSegmentSize(target_size_bytes).
+  // Mutexes are allocated from thread_system, which is not retained.
+  LogStructuredFileCache(const GoogleString& path, int64 target_size_bytes,
+                         int64 segment_size_bytes, ThreadSystem* thread_system,
+                         Statistics* stats, MessageHandler* handler);
+  ~LogStructuredFileCache() override;
+
+  static void InitStats(Statistics* statistics);
+
+  // Segment size used for a cache of target_size_bytes: a sixteenth of the
+  // target, kept within [1MB, 256MB].
+  static int64 DefaultSegmentSize(int64 target_size_bytes);
+
+  void Get(const GoogleString& key, Callback* callback) override;
+  void Put(const GoogleString& key, const SharedString& value) override;
+  void Delete(const GoogleString& key) override;
+
+  static GoogleString FormatName() { return "LogStructuredFileCache"; }
+  GoogleString Name() const override { return FormatName(); }
+
+  bool IsBlocking() const override { return true; }
+  bool IsHealthy() const override { return true; }
+  void ShutDown() override {}
+
+  const GoogleString& path() const { return path_; }
+  int64 segment_size() const { return segment_size_; }
+  // Number of segments retained on disk, including the one being written.
+  int max_segments() const { return max_segments_; }
+
+  // Variable names.
+  // Records skipped because their checksum or framing was bad.
+  static const char kCorruptRecords[];
+  // Segments unlinked to make room for new ones.
+  static const char kSegmentEvictions[];
+  // Values not stored because they did not fit in half a segment.
+  static const char kSkippedPuts[];
+  static const char kWriteErrors[];
+
+ private:
+  class Segment;
+  typedef std::map<uint64, RefCountedPtr<Segment> > SegmentMap;
+
+  // Opens the cache directory and maps the existing segments.  Returns
+  // false (and logs) if the directory cannot be used.
+  bool InitializeLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Brings the mappings up to date with what other processes have
+  // written: scans new records in the unsealed segments, picks up
+  // segments other processes started, and seals or drops old ones.
+  // Returns false if the cache is unusable.
+  bool RefreshLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Maps any segments on disk newer than the newest one we know about.
+  void OpenNewerSegmentsLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Starts a new segment after the newest one and evicts old ones.
+  bool RollLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Seals all but the two newest segments and drops the mappings of (and,
+  // if unlink is true, deletes) those past max_segments_.
+  void RetireOldSegmentsLockHeld(bool unlink) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Maps segment id, creating it if create is true.  Returns nullptr on
+  // failure.
+  Segment* OpenSegmentLockHeld(uint64 id, bool create)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Appends a record for key to the newest segment; value is nullptr for
+  // a tombstone.
+  void Append(const GoogleString& key, const SharedString* value);
+
+  GoogleString SegmentPath(uint64 id) const;
+  GoogleString IndexPath(uint64 id) const;
+
+  const GoogleString path_;
+  const int64 segment_size_;
+  const int max_segments_;
+  MessageHandler* message_handler_;
+  std::unique_ptr<AbstractMutex> mutex_;
+  bool initialized_ GUARDED_BY(mutex_);
+  bool usable_ GUARDED_BY(mutex_);
+  // Segments currently mapped by this process, oldest first.
+  SegmentMap segments_ GUARDED_BY(mutex_);
+  // Size of the newest segment when we last listed the directory looking
+  // for newer ones, so a full segment doesn't cause a listing per lookup.
+  int64 listed_at_size_ GUARDED_BY(mutex_);
+
+  Variable* corrupt_records_;
+  Variable* segment_evictions_;
+  Variable* skipped_puts_;
+  Variable* write_errors_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogStructuredFileCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_LOG_STRUCTURED_FILE_CACHE_H_
@@ -80,6 +80,13 @@ class LRUCache : public CacheInterface {
     return base_.num_identical_reinserts();
   }
   size_t num_deletes() const { return base_.num_deletes(); }
+  size_t num_admission_rejections() const {
+    return base_.num_admission_rejections();
+  }
+
+  // Makes the cache scan-resistant by switching replacement to W-TinyLFU;
+  // see LRUCacheBase.  Call this before populating the cache.
+  void EnableAdmissionPolicy() { base_.EnableAdmissionPolicy(); }
 
   // Sanity check the cache data structures.
   void SanityCheck() { base_.SanityCheck(); }
@@ -101,7 +108,9 @@ class LRUCache : public CacheInterface {
 
  private:
   struct SharedStringHelper {
-    size_t size(const SharedString& ss) const { return ss.size(); }
+    size_t size(const SharedString& ss) const {
+      return ss.SizeIncludingAnnotation();
+    }
     bool Equal(const SharedString& a, const SharedString& b) const {
       return a.Value() == b.Value();
     }
@@ -22,6 +22,7 @@
 
 #include <cstddef>
 #include <list>
+#include <memory>
 #include <utility>  // for pair
 
 #include "absl/container/flat_hash_map.h"
@@ -30,6 +31,7 @@
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_hash.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 
 namespace net_instaweb {
 
@@ -42,6 +44,8 @@ namespace net_instaweb {
 // which must define:
 //
 //   // Computes the size of a value.  Used to track resource consumption.
+//   // It is called once, when the value is inserted, and the entry is
+//   // charged that much until it leaves the cache.
 //   size_t size(const ValueType&) const;
 //
 //   // Determines whether two values are equal.
@@ -56,36 +60,101 @@ namespace net_instaweb {
 //                      const ValueType& new_value) const;
 //
 // ValueType must support copy-construction and assign-by-value.
+//
+// Pure LRU replacement lets a sweep over many keys that are each touched
+// once (a crawler, a purge storm) flush out everything that is actually
+// popular.  Calling EnableAdmissionPolicy switches to W-TinyLFU, which
+// splits the byte budget into three LRU segments:
+//
+//   window:     ~1% of the bytes.  Every new entry starts here.
+//   probation:  entries that have been pushed out of the window.
+//   protected:  up to 80% of the non-window bytes; entries that were hit
+//               again while on probation.
+//
+// When an entry leaves the window and the other two segments are full, a
+// FrequencySketch of recent accesses decides whether it displaces the
+// least-recently-used probation entry or is evicted itself.  Either way
+// the loser is reported through EvictNotify.
 template <class ValueType, class ValueHelper>
 class LRUCacheBase {
-  typedef std::pair<GoogleString, ValueType> KeyValuePair;
+  // Without the admission policy every entry lives in kWindow, which then
+  // is simply the LRU list for the whole cache.
+  enum Segment { kWindow, kProbation, kProtected, kNumSegments };
+
+  struct KeyValuePair {
+    KeyValuePair(const GoogleString& k, const ValueType& v, Segment s,
+                 size_t bytes)
+        : key(k), value(v), segment(s), bytes(bytes) {}
+
+    GoogleString key;
+    ValueType value;
+    Segment segment;
+    size_t bytes;  // Charged against the cache while the entry is in it.
+  };
   typedef std::list<KeyValuePair*> EntryList;
-  // STL guarantees lifetime of list iterators as long as the node is in list.
+  // STL guarantees lifetime of list iterators as long as the node is in list,
+  // including across splices between lists.
   typedef typename EntryList::iterator ListNode;
 
   typedef absl::flat_hash_map<GoogleString, ListNode, CasePreserveStringHash>
       Map;
 
+  static const int kWindowPercent = 1;
+  static const int kProtectedPercent = 80;
+  static const size_t kInitialSketchCapacity = 256;
+
  public:
+  // Walks the entries in eviction order: probation, then protected, then
+  // the window, each from oldest to youngest.  Without the admission policy
+  // that is simply oldest to youngest.
   class Iterator {
    public:
-    explicit Iterator(const typename EntryList::const_reverse_iterator& iter)
-        : iter_(iter) {}
-
-    void operator++() { ++iter_; }
-    bool operator==(const Iterator& src) const { return iter_ == src.iter_; }
-    bool operator!=(const Iterator& src) const { return iter_ != src.iter_; }
+    void operator++() {
+      ++iter_;
+      SkipExhaustedSegments();
+    }
+    bool operator==(const Iterator& src) const {
+      return ((position_ == src.position_) &&
+              ((position_ == kNumSegments) || (iter_ == src.iter_)));
+    }
+    bool operator!=(const Iterator& src) const { return !(*this == src); }
 
     const GoogleString& Key() const {
       const KeyValuePair* key_value_pair = *iter_;
-      return key_value_pair->first;
+      return key_value_pair->key;
     }
     const ValueType& Value() const {
       const KeyValuePair* key_value_pair = *iter_;
-      return key_value_pair->second;
+      return key_value_pair->value;
     }
 
    private:
+    friend class LRUCacheBase;
+
+    Iterator(const EntryList* lists, int position)
+        : lists_(lists), position_(position) {
+      if (position_ < kNumSegments) {
+        iter_ = list().rbegin();
+        SkipExhaustedSegments();
+      }
+    }
+
+    const EntryList& list() const {
+      static const Segment kOrder[] = {kProbation, kProtected, kWindow};
+      return lists_[kOrder[position_]];
+    }
+
+    void SkipExhaustedSegments() {
+      while (iter_ == list().rend()) {
+        if (++position_ == kNumSegments) {
+          break;
+        }
+        iter_ = list().rbegin();
+      }
+    }
+
+    const EntryList* lists_;
+    int position_;
     typename EntryList::const_reverse_iterator iter_;
 
     // Implicit copy and assign are OK.
@@ -95,6 +164,9 @@ class LRUCacheBase {
       : max_bytes_in_cache_(max_size),
         current_bytes_in_cache_(0),
         value_helper_(value_helper) {
+    for (int i = 0; i < kNumSegments; ++i) {
+      segment_bytes_[i] = 0;
+    }
     ClearStats();
   }
   ~LRUCacheBase() { Clear(); }
@@ -106,21 +178,31 @@ class LRUCacheBase {
     max_bytes_in_cache_ = max_size;
   }
 
+  // Switches replacement to W-TinyLFU, as described above.  This should be
+  // called before the cache is populated.
+  void EnableAdmissionPolicy() {
+    if (sketch_ == nullptr) {
+      sketch_.reset(new FrequencySketch(kInitialSketchCapacity));
+    }
+  }
+  bool admission_policy_enabled() const { return sketch_ != nullptr; }
+
   // Returns a pointer to the stored value, or NULL if not found, freshening
   // the entry in the lru-list.  Note: this pointer is safe to use until the
   // next call to Put or Delete in the cache.
   ValueType* GetFreshen(const GoogleString& key) {
     ValueType* value = NULL;
+    RecordAccess(key);
     typename Map::iterator p = map_.find(key);
     if (p != map_.end()) {
       ListNode cell = p->second;
       KeyValuePair* key_value = *cell;
-      p->second = Freshen(cell);
+      Freshen(cell);
       // Note: it's safe to assume the list iterator will remain valid so that
       // the caller can do what's necessary with the pointer.
       // http://stackoverflow.com/questions/759274/
       // what-is-the-lifetime-and-validity-of-c-iterators
-      value = &key_value->second;
+      value = &key_value->value;
       ++num_hits_;
     } else {
       ++num_misses_;
@@ -128,6 +210,9 @@ class LRUCacheBase {
     return value;
   }
 
+  // Like GetFreshen, but leaves the entry's position alone.  The access is
+  // not counted by the admission policy either, so apart from the hit and
+  // miss counters this does not modify the cache.
   ValueType* GetNoFreshen(const GoogleString& key) const {
     ValueType* value = NULL;
     typename Map::const_iterator p = map_.find(key);
@@ -135,7 +220,7 @@ class LRUCacheBase {
       ListNode cell = p->second;
       KeyValuePair* key_value = *cell;
       // See the above comment about stl::list::iterator lifetime.
-      value = &key_value->second;
+      value = &key_value->value;
       ++num_hits_;
     } else {
       ++num_misses_;
@@ -158,6 +243,7 @@ class LRUCacheBase {
     bool found = !iter_found.second;
     typename Map::iterator map_iter = iter_found.first;
     bool need_to_insert = true;
+    Segment segment = kWindow;
     if (found) {
       cell = map_iter->second;
       KeyValuePair* key_value = *cell;
@@ -165,21 +251,24 @@ class LRUCacheBase {
       // Protect the element that we are rewriting by erasing
       // it from the entry_list prior to calling EvictIfNecessary,
       // which can't find it if it isn't in the list.
-      if (!value_helper_->ShouldReplace(key_value->second, new_value)) {
+      if (!value_helper_->ShouldReplace(key_value->value, new_value)) {
         need_to_insert = false;
       } else {
-        if (value_helper_->Equal(new_value, key_value->second)) {
-          map_iter->second = Freshen(cell);
+        if (value_helper_->Equal(new_value, key_value->value)) {
+          Freshen(cell);
           need_to_insert = false;
           ++num_identical_reinserts_;
         } else {
           ++num_deletes_;
-          CHECK_GE(current_bytes_in_cache_, EntrySize(key_value));
-          current_bytes_in_cache_ -= EntrySize(key_value);
+          // A new value for a key keeps the key's standing in the
+          // admission policy's segments.
+          segment = key_value->segment;
+          Unlink(cell);
           delete key_value;
-          lru_ordered_list_.erase(cell);
         }
       }
+    } else {
+      RecordAccess(key);
     }
 
     if (need_to_insert) {
@@ -187,13 +276,21 @@ class LRUCacheBase {
       // is removed from the list, so we can treat replacements and new
       // insertions the same way.  In both cases, the new key is in the map
       // as a result of the call to map_.insert above.
-
-      if (EvictIfNecessary(key.size() + value_helper_->size(new_value))) {
+      size_t bytes_needed = key.size() + value_helper_->size(new_value);
+      bool fits = (sketch_ == nullptr) ? EvictIfNecessary(bytes_needed)
+                                       : (bytes_needed < max_bytes_in_cache_);
+      if (fits) {
         // The new value fits.  Put it in the LRU-list.
-        KeyValuePair* kvp = new KeyValuePair(map_iter->first, new_value);
-        lru_ordered_list_.push_front(kvp);
-        map_iter->second = lru_ordered_list_.begin();
+        KeyValuePair* kvp = new KeyValuePair(map_iter->first, new_value,
+                                             segment, bytes_needed);
+        map_iter->second = Link(kvp);
         ++num_inserts_;
+        if (sketch_ != nullptr) {
+          if (map_.size() > sketch_->capacity()) {
+            sketch_->EnsureCapacity(2 * map_.size());
+          }
+          EnforceBudgets();
+        }
       } else {
         // The new value was too big to fit.  Remove it from the map.
         // it's already removed from the list.  We have failed.  We
@@ -237,6 +334,7 @@ class LRUCacheBase {
     num_inserts_ += src.num_inserts_;
     num_identical_reinserts_ += src.num_identical_reinserts_;
     num_deletes_ += src.num_deletes_;
+    num_admission_rejections_ += src.num_admission_rejections_;
   }
 
   // Total size in bytes of keys and values stored.
@@ -255,47 +353,75 @@ class LRUCacheBase {
   size_t num_identical_reinserts() const { return num_identical_reinserts_; }
   size_t num_deletes() const { return num_deletes_; }
 
+  // Number of entries leaving the window that lost the admission contest
+  // and were evicted in favor of a more popular probation entry.  These are
+  // also counted in num_evictions.
+  size_t num_admission_rejections() const { return num_admission_rejections_; }
+
   // Sanity check the cache data structures.
   void SanityCheck() {
-    CHECK_EQ(static_cast<size_t>(map_.size()), lru_ordered_list_.size());
+    size_t list_size = 0;
+    for (int s = 0; s < kNumSegments; ++s) {
+      list_size += lists_[s].size();
+    }
+    CHECK_EQ(static_cast<size_t>(map_.size()), list_size);
     size_t count = 0;
     size_t bytes_used = 0;
 
-    // Walk forward through the list, making sure the map and list elements
+    // Walk forward through the lists, making sure the map and list elements
     // point to each other correctly.
-    for (ListNode cell = lru_ordered_list_.begin(), e = lru_ordered_list_.end();
-         cell != e; ++cell, ++count) {
-      KeyValuePair* key_value = *cell;
-      typename Map::iterator map_iter = map_.find(key_value->first);
-      CHECK(map_iter != map_.end());
-      CHECK(map_iter->first == key_value->first);
-      CHECK(map_iter->second == cell);
-      bytes_used += EntrySize(key_value);
+    for (int s = 0; s < kNumSegments; ++s) {
+      size_t segment_bytes = 0;
+      for (ListNode cell = lists_[s].begin(), e = lists_[s].end(); cell != e;
+           ++cell, ++count) {
+        KeyValuePair* key_value = *cell;
+        CHECK_EQ(s, key_value->segment);
+        typename Map::iterator map_iter = map_.find(key_value->key);
+        CHECK(map_iter != map_.end());
+        CHECK(map_iter->first == key_value->key);
+        CHECK(map_iter->second == cell);
+        segment_bytes += EntrySize(key_value);
+      }
+      CHECK_EQ(segment_bytes_[s], segment_bytes);
+      bytes_used += segment_bytes;
     }
     CHECK_EQ(count, static_cast<size_t>(map_.size()));
     CHECK_EQ(current_bytes_in_cache_, bytes_used);
     CHECK_LE(current_bytes_in_cache_, max_bytes_in_cache_);
+    if (sketch_ == nullptr) {
+      CHECK(lists_[kProbation].empty());
+      CHECK(lists_[kProtected].empty());
+    } else {
+      CHECK_LE(segment_bytes_[kWindow], WindowBudget());
+      CHECK_LE(MainBytes(), MainBudget());
+      CHECK_LE(segment_bytes_[kProtected], ProtectedBudget());
+    }
 
-    // Walk backward through the list, making sure it's coherent as well.
+    // Walk backward through the lists, making sure they're coherent as well.
     count = 0;
-    for (typename EntryList::reverse_iterator cell = lru_ordered_list_.rbegin(),
-                                              e = lru_ordered_list_.rend();
-         cell != e; ++cell, ++count) {
+    for (int s = 0; s < kNumSegments; ++s) {
+      for (typename EntryList::reverse_iterator cell = lists_[s].rbegin(),
+                                                e = lists_[s].rend();
+           cell != e; ++cell, ++count) {
+      }
     }
     CHECK_EQ(count, static_cast<size_t>(map_.size()));
   }
 
   // Clear the entire cache.  Used primarily for testing.  Note that this
   // will not clear the stats, however it will update current_bytes_in_cache_.
+  // The admission policy's access history is kept.
   void Clear() {
     current_bytes_in_cache_ = 0;
 
-    for (ListNode p = lru_ordered_list_.begin(), e = lru_ordered_list_.end();
-         p != e; ++p) {
-      KeyValuePair* key_value = *p;
-      delete key_value;
+    for (int s = 0; s < kNumSegments; ++s) {
+      for (ListNode p = lists_[s].begin(), e = lists_[s].end(); p != e; ++p) {
+        KeyValuePair* key_value = *p;
+        delete key_value;
+      }
+      lists_[s].clear();
+      segment_bytes_[s] = 0;
     }
-    lru_ordered_list_.clear();
     map_.clear();
   }
 
@@ -307,58 +433,163 @@ class LRUCacheBase {
     num_inserts_ = 0;
     num_identical_reinserts_ = 0;
     num_deletes_ = 0;
+    num_admission_rejections_ = 0;
   }
 
-  // Iterators for walking cache entries from oldest to youngest.
-  Iterator Begin() const { return Iterator(lru_ordered_list_.rbegin()); }
-  Iterator End() const { return Iterator(lru_ordered_list_.rend()); }
+  // Iterators for walking cache entries; see Iterator for the order.
+  Iterator Begin() const { return Iterator(lists_, 0); }
+  Iterator End() const { return Iterator(lists_, kNumSegments); }
 
  private:
   // TODO(jmarantz): consider accounting for overhead for list cells, map
   // cells.
-  size_t EntrySize(KeyValuePair* kvp) const {
-    return kvp->first.size() + value_helper_->size(kvp->second);
+  size_t EntrySize(KeyValuePair* kvp) const { return kvp->bytes; }
+
+  size_t WindowBudget() const {
+    return max_bytes_in_cache_ * kWindowPercent / 100;
+  }
+  size_t MainBudget() const { return max_bytes_in_cache_ - WindowBudget(); }
+  size_t ProtectedBudget() const {
+    return MainBudget() * kProtectedPercent / 100;
+  }
+  size_t MainBytes() const {
+    return segment_bytes_[kProbation] + segment_bytes_[kProtected];
   }
 
-  ListNode Freshen(ListNode cell) {
-    if (cell != lru_ordered_list_.begin()) {
-      lru_ordered_list_.splice(lru_ordered_list_.begin(), lru_ordered_list_,
-                               cell);
+  void RecordAccess(const GoogleString& key) {
+    if (sketch_ != nullptr) {
+      sketch_->Increment(FrequencySketch::HashKey(key));
     }
+  }
 
-    return lru_ordered_list_.begin();
+  // Adds kvp to the front of its segment and accounts for its size.
+  ListNode Link(KeyValuePair* kvp) {
+    size_t size = EntrySize(kvp);
+    current_bytes_in_cache_ += size;
+    segment_bytes_[kvp->segment] += size;
+    lists_[kvp->segment].push_front(kvp);
+    return lists_[kvp->segment].begin();
   }
 
-  void DeleteAt(typename Map::iterator p) {
-    ListNode cell = p->second;
+  // Removes the entry at cell from its segment, without touching the map.
+  void Unlink(ListNode cell) {
     KeyValuePair* key_value = *cell;
-    lru_ordered_list_.erase(cell);
-    CHECK_GE(current_bytes_in_cache_, EntrySize(key_value));
-    current_bytes_in_cache_ -= EntrySize(key_value);
+    size_t size = EntrySize(key_value);
+    CHECK_GE(current_bytes_in_cache_, size);
+    current_bytes_in_cache_ -= size;
+    segment_bytes_[key_value->segment] -= size;
+    lists_[key_value->segment].erase(cell);
+  }
+
+  // Moves the entry at cell to the front of segment 'to'.  Iterators to the
+  // entry stay valid.
+  void MoveTo(ListNode cell, Segment to) {
+    KeyValuePair* key_value = *cell;
+    size_t size = EntrySize(key_value);
+    segment_bytes_[key_value->segment] -= size;
+    segment_bytes_[to] += size;
+    lists_[to].splice(lists_[to].begin(), lists_[key_value->segment], cell);
+    key_value->segment = to;
+  }
+
+  // Records a hit on the entry at cell.  A hit on probation earns a place in
+  // the protected segment; otherwise the entry moves to the front of its
+  // own segment.
+  void Freshen(ListNode cell) {
+    KeyValuePair* key_value = *cell;
+    if (key_value->segment == kProbation) {
+      MoveTo(cell, kProtected);
+      DemoteProtectedOverflow();
+    } else {
+      EntryList* list = &lists_[key_value->segment];
+      if (cell != list->begin()) {
+        list->splice(list->begin(), *list, cell);
+      }
+    }
+  }
+
+  void DeleteAt(typename Map::iterator p) {
+    KeyValuePair* key_value = *p->second;
+    Unlink(p->second);
     map_.erase(p);
     delete key_value;
     ++num_deletes_;
   }
 
+  void Evict(KeyValuePair* key_value) {
+    typename Map::iterator p = map_.find(key_value->key);
+    DCHECK(p != map_.end());
+    Unlink(p->second);
+    value_helper_->EvictNotify(key_value->value);
+    map_.erase(p);
+    delete key_value;
+    ++num_evictions_;
+  }
+
+  // Makes room for bytes_needed under plain LRU replacement.  Returns false
+  // if the entry could never fit.
   bool EvictIfNecessary(size_t bytes_needed) {
     bool ret = false;
     if (bytes_needed < max_bytes_in_cache_) {
       while (bytes_needed + current_bytes_in_cache_ > max_bytes_in_cache_) {
-        KeyValuePair* key_value = lru_ordered_list_.back();
-        lru_ordered_list_.pop_back();
-        CHECK_GE(current_bytes_in_cache_, EntrySize(key_value));
-        current_bytes_in_cache_ -= EntrySize(key_value);
-        value_helper_->EvictNotify(key_value->second);
-        map_.erase(key_value->first);
-        delete key_value;
-        ++num_evictions_;
+        Evict(lists_[kWindow].back());
       }
-      current_bytes_in_cache_ += bytes_needed;
       ret = true;
     }
     return ret;
   }
 
+  void DemoteProtectedOverflow() {
+    while (segment_bytes_[kProtected] > ProtectedBudget()) {
+      MoveTo(--lists_[kProtected].end(), kProbation);
+    }
+  }
+
+  // Restores the segment budgets after an insertion under the admission
+  // policy.
+  void EnforceBudgets() {
+    DemoteProtectedOverflow();
+    while (segment_bytes_[kWindow] > WindowBudget()) {
+      KeyValuePair* candidate = lists_[kWindow].back();
+      MoveTo(--lists_[kWindow].end(), kProbation);
+      AdmitOrEvict(candidate);
+    }
+    // Replacing a value in place can overfill the main segments without
+    // anything leaving the window.
+    while (MainBytes() > MainBudget()) {
+      Segment victim_segment =
+          lists_[kProbation].empty() ? kProtected : kProbation;
+      Evict(lists_[victim_segment].back());
+    }
+  }
+
+  // candidate has just moved from the window to the front of probation.
+  // While that leaves the main segments over budget, it competes with the
+  // least-recently-used main entry, and the less popular one is evicted.
+  void AdmitOrEvict(KeyValuePair* candidate) {
+    uint64 candidate_hash = FrequencySketch::HashKey(candidate->key);
+    while (MainBytes() > MainBudget()) {
+      KeyValuePair* victim = nullptr;
+      if (lists_[kProbation].back() != candidate) {
+        victim = lists_[kProbation].back();
+      } else if (!lists_[kProtected].empty()) {
+        victim = lists_[kProtected].back();
+      }
+      if (victim == nullptr) {
+        // The candidate alone is bigger than the main segments.
+        Evict(candidate);
+        return;
+      }
+      if (sketch_->Frequency(candidate_hash) <=
+          sketch_->Frequency(FrequencySketch::HashKey(victim->key))) {
+        ++num_admission_rejections_;
+        Evict(candidate);
+        return;
+      }
+      Evict(victim);
+    }
+  }
+
   // TODO(jmarantz): convert most of these to 'int'.
   size_t max_bytes_in_cache_;
   size_t current_bytes_in_cache_;
@@ -368,9 +599,13 @@ class LRUCacheBase {
   size_t num_inserts_;
   size_t num_identical_reinserts_;
   size_t num_deletes_;
-  EntryList lru_ordered_list_;
+  size_t num_admission_rejections_;
+  EntryList lists_[kNumSegments];
+  size_t segment_bytes_[kNumSegments];
   Map map_;
   ValueHelper* value_helper_;
+  // Only allocated when the admission policy is enabled.
+  std::unique_ptr<FrequencySketch> sketch_;
 
   DISALLOW_COPY_AND_ASSIGN(LRUCacheBase);
 };
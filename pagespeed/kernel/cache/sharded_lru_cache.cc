@@ -0,0 +1,185 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
+
+#include <cstddef>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+
+namespace net_instaweb {
+
+ShardedLRUCache::ShardedLRUCache(size_t max_size, int num_shards,
+                                 ThreadSystem* thread_system) {
+  CHECK_LT(0, num_shards);
+  // Rounding down keeps the sum of the shard budgets within max_size.
+  size_t shard_size = max_size / num_shards;
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(
+        new Shard(shard_size, &value_helper_, thread_system->NewMutex()));
+  }
+  is_healthy_.set_value(true);
+}
+
+ShardedLRUCache::~ShardedLRUCache() { Clear(); }
+
+GoogleString ShardedLRUCache::FormatName(int num_shards) {
+  return StrCat("ShardedLRUCache(", IntegerToString(num_shards), ")");
+}
+
+ShardedLRUCache::Shard* ShardedLRUCache::ShardFor(
+    const GoogleString& key) const {
+  // The same hash drives the bucket selection inside each shard's map, so
+  // fold the high bits in to keep shard choice and bucket choice from
+  // being correlated.
+  size_t hash = HashString<CasePreserve, size_t>(key.data(), key.size());
+  hash ^= hash >> 16;
+  return shards_[hash % shards_.size()].get();
+}
+
+void ShardedLRUCache::Get(const GoogleString& key, Callback* callback) {
+  KeyState key_state = kNotFound;
+  if (is_healthy_.value()) {
+    Shard* shard = ShardFor(key);
+    ScopedMutex lock(shard->mutex.get());
+    SharedString* value = shard->base.GetFreshen(key);
+    if (value != nullptr) {
+      key_state = kAvailable;
+      callback->set_value(*value);
+    }
+  }
+  ValidateAndReportResult(key, key_state, callback);
+}
+
+void ShardedLRUCache::Put(const GoogleString& key,
+                          const SharedString& new_value) {
+  if (!is_healthy_.value()) {
+    return;
+  }
+  Shard* shard = ShardFor(key);
+  ScopedMutex lock(shard->mutex.get());
+  shard->base.Put(key, new_value);
+}
+
+void ShardedLRUCache::Delete(const GoogleString& key) {
+  if (!is_healthy_.value()) {
+    return;
+  }
+  Shard* shard = ShardFor(key);
+  ScopedMutex lock(shard->mutex.get());
+  shard->base.Delete(key);
+}
+
+void ShardedLRUCache::DeleteWithPrefixForTesting(StringPiece prefix) {
+  if (!is_healthy_.value()) {
+    return;
+  }
+  for (const auto& shard : shards_) {
+    ScopedMutex lock(shard->mutex.get());
+    shard->base.DeleteWithPrefixForTesting(prefix);
+  }
+}
+
+size_t ShardedLRUCache::SumOverShards(
+    size_t (Base::*accessor)() const) const {
+  size_t sum = 0;
+  for (const auto& shard : shards_) {
+    ScopedMutex lock(shard->mutex.get());
+    sum += (shard->base.*accessor)();
+  }
+  return sum;
+}
+
+size_t ShardedLRUCache::size_bytes() const {
+  return SumOverShards(&Base::size_bytes);
+}
+
+size_t ShardedLRUCache::max_bytes_in_cache() const {
+  return SumOverShards(&Base::max_bytes_in_cache);
+}
+
+size_t ShardedLRUCache::num_elements() const {
+  return SumOverShards(&Base::num_elements);
+}
+
+size_t ShardedLRUCache::num_evictions() const {
+  return SumOverShards(&Base::num_evictions);
+}
+
+size_t ShardedLRUCache::num_hits() const {
+  return SumOverShards(&Base::num_hits);
+}
+
+size_t ShardedLRUCache::num_misses() const {
+  return SumOverShards(&Base::num_misses);
+}
+
+size_t ShardedLRUCache::num_inserts() const {
+  return SumOverShards(&Base::num_inserts);
+}
+
+size_t ShardedLRUCache::num_identical_reinserts() const {
+  return SumOverShards(&Base::num_identical_reinserts);
+}
+
+size_t ShardedLRUCache::num_deletes() const {
+  return SumOverShards(&Base::num_deletes);
+}
+
+size_t ShardedLRUCache::num_admission_rejections() const {
+  return SumOverShards(&Base::num_admission_rejections);
+}
+
+void ShardedLRUCache::EnableAdmissionPolicy() {
+  for (const auto& shard : shards_) {
+    ScopedMutex lock(shard->mutex.get());
+    shard->base.EnableAdmissionPolicy();
+  }
+}
+
+void ShardedLRUCache::SanityCheck() {
+  for (const auto& shard : shards_) {
+    ScopedMutex lock(shard->mutex.get());
+    shard->base.SanityCheck();
+  }
+}
+
+void ShardedLRUCache::Clear() {
+  for (const auto& shard : shards_) {
+    ScopedMutex lock(shard->mutex.get());
+    shard->base.Clear();
+  }
+}
+
+void ShardedLRUCache::ClearStats() {
+  for (const auto& shard : shards_) {
+    ScopedMutex lock(shard->mutex.get());
+    shard->base.ClearStats();
+  }
+}
+
+}  // namespace net_instaweb
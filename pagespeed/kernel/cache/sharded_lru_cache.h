@@ -0,0 +1,146 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/atomic_bool.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/cache/lru_cache_base.h"
+
+namespace net_instaweb {
+
+// Thread-safe in-memory LRU cache that spreads its keys over a number of
+// independently locked shards.  It is a drop-in replacement for
+// ThreadsafeCache(LRUCache), which serializes every lookup behind a single
+// mutex and becomes a contention point on machines with many cores.
+//
+// Each shard is an LRUCacheBase with a budget of max_size / num_shards
+// bytes, so LRU order is only maintained within a shard.  With a
+// reasonable number of keys per shard this approximates a global LRU
+// closely.
+//
+// Unlike ThreadsafeCache, no lock is held while the callback's validator
+// runs: the value is copied out under the shard lock (which just bumps
+// the SharedString reference count) and the lock is released before
+// ValidateAndReportResult is called.
+class ShardedLRUCache : public CacheInterface {
+ public:
+  // num_shards must be at least 1.  Mutexes are allocated from
+  // thread_system, which is not retained.
+  ShardedLRUCache(size_t max_size, int num_shards, ThreadSystem* thread_system);
+  ~ShardedLRUCache() override;
+
+  void Get(const GoogleString& key, Callback* callback) override;
+  void Put(const GoogleString& key, const SharedString& new_value) override;
+  void Delete(const GoogleString& key) override;
+
+  // Deletes all objects whose key starts with prefix, from every shard.
+  // Not part of cache interface. Exported for testing only.
+  void DeleteWithPrefixForTesting(StringPiece prefix);
+
+  int num_shards() const { return static_cast<int>(shards_.size()); }
+
+  // Aggregated statistics, summed over all shards.  Each shard is locked
+  // in turn, so the totals are not an atomic snapshot while other threads
+  // are using the cache.
+  size_t size_bytes() const;
+  size_t max_bytes_in_cache() const;
+  size_t num_elements() const;
+  size_t num_evictions() const;
+  size_t num_hits() const;
+  size_t num_misses() const;
+  size_t num_inserts() const;
+  size_t num_identical_reinserts() const;
+  size_t num_deletes() const;
+  size_t num_admission_rejections() const;
+
+  // Switches every shard to W-TinyLFU replacement; see LRUCacheBase.  Call
+  // this before populating the cache.
+  void EnableAdmissionPolicy();
+
+  // Sanity check the data structures of every shard.
+  void SanityCheck();
+
+  // Clear the entire cache.  Used primarily for testing.  Note that this
+  // will not clear the stats.
+  void Clear();
+
+  // Clear the stats -- note that this will not clear the content.
+  void ClearStats();
+
+  static GoogleString FormatName(int num_shards);
+  GoogleString Name() const override { return FormatName(num_shards()); }
+  bool IsBlocking() const override { return true; }
+  bool IsHealthy() const override { return is_healthy_.value(); }
+  void ShutDown() override { set_is_healthy(false); }
+
+  void set_is_healthy(bool x) { is_healthy_.set_value(x); }
+
+ private:
+  struct SharedStringHelper {
+    size_t size(const SharedString& ss) const {
+      return ss.SizeIncludingAnnotation();
+    }
+    bool Equal(const SharedString& a, const SharedString& b) const {
+      return a.Value() == b.Value();
+    }
+    void EvictNotify(const SharedString& a) {}
+    bool ShouldReplace(const SharedString& old_value,
+                       const SharedString& new_value) const {
+      return true;
+    }
+  };
+  typedef LRUCacheBase<SharedString, SharedStringHelper> Base;
+
+  struct Shard {
+    Shard(size_t max_size, SharedStringHelper* helper, AbstractMutex* mutex)
+        : mutex(mutex), base(max_size, helper) {}
+
+    std::unique_ptr<AbstractMutex> mutex;
+    Base base;  // GUARDED_BY(mutex)
+  };
+
+  Shard* ShardFor(const GoogleString& key) const;
+
+  // Sums accessor over all shards, taking each shard's lock in turn.
+  size_t SumOverShards(size_t (Base::*accessor)() const) const;
+
+  SharedStringHelper value_helper_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  // Checked on every operation, so it is atomic rather than guarded by
+  // yet another mutex shared by all shards.
+  AtomicBool is_healthy_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShardedLRUCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_SHARDED_LRU_CACHE_H_
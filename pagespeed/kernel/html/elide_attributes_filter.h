@@ -38,6 +38,7 @@ class ElideAttributesFilter : public EmptyHtmlFilter {
   ~ElideAttributesFilter() override;
 
   void StartElement(HtmlElement* element) override;
+  bool IsStreamingSafe() const override { return true; }
   const char* Name() const override { return "ElideAttributes"; }
 
  private:
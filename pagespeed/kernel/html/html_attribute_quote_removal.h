@@ -50,6 +50,7 @@ class HtmlAttributeQuoteRemoval : public EmptyHtmlFilter {
   // # of quote pairs removed from attributes in *all* documents processed.
   int total_quotes_removed() const { return total_quotes_removed_; }
 
+  bool IsStreamingSafe() const override { return true; }
   const char* Name() const override { return "HtmlAttributeQuoteRemoval"; }
 
  private:
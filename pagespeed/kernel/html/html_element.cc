@@ -33,19 +33,22 @@ namespace net_instaweb {
 
 HtmlElement::HtmlElement(HtmlElement* parent, const HtmlName& name,
                          const HtmlEventListIterator& begin,
-                         const HtmlEventListIterator& end)
-    : HtmlNode(parent), data_(new Data(name, begin, end)) {}
+                         const HtmlEventListIterator& end,
+                         HtmlObjectPool* pool)
+    : HtmlNode(parent), data_(new Data(name, begin, end, pool)) {}
 
 HtmlElement::~HtmlElement() {}
 
 HtmlElement::Data::Data(const HtmlName& name,
                         const HtmlEventListIterator& begin,
-                        const HtmlEventListIterator& end)
+                        const HtmlEventListIterator& end,
+                        HtmlObjectPool* pool)
     : begin_line_number_(0),
       live_(1),
       end_line_number_(0),
       style_(AUTO_CLOSE),
       name_(name),
+      pool_(pool),
       begin_(begin),
       end_(end) {}
 
@@ -62,9 +65,12 @@ void HtmlElement::MarkAsDead(const HtmlEventListIterator& end) {
 void HtmlElement::SynthesizeEvents(const HtmlEventListIterator& iter,
                                    HtmlEventList* queue) {
   // We use -1 as a bogus line number, since these events are synthetic.
-  HtmlEvent* start_tag = new HtmlStartElementEvent(this, Data::kMaxLineNumber);
+  HtmlObjectPool* pool = queue->get_allocator().pool();
+  HtmlEvent* start_tag =
+      new (pool) HtmlStartElementEvent(this, Data::kMaxLineNumber);
   set_begin(queue->insert(iter, start_tag));
-  HtmlEvent* end_tag = new HtmlEndElementEvent(this, Data::kMaxLineNumber);
+  HtmlEvent* end_tag =
+      new (pool) HtmlEndElementEvent(this, Data::kMaxLineNumber);
   set_end(queue->insert(iter, end_tag));
 }
 
@@ -174,12 +180,13 @@ GoogleString HtmlElement::ToString() const {
 void HtmlElement::DebugPrint() const { puts(ToString().c_str()); }
 
 void HtmlElement::AddAttribute(const Attribute& src_attr) {
-  Attribute* attr = new Attribute(src_attr.name(), src_attr.escaped_value(),
-                                  src_attr.quote_style());
+  Attribute* attr = new (data_->pool_)
+      Attribute(src_attr.name(), src_attr.escaped_value(),
+                src_attr.quote_style(), data_->pool_);
   if (src_attr.decoded_value_computed_) {
     attr->decoded_value_computed_ = true;
     attr->decoding_error_ = src_attr.decoding_error_;
-    Attribute::CopyValue(src_attr.decoded_value_.get(), &attr->decoded_value_);
+    attr->CopyValue(src_attr.decoded_value_.get(), &attr->decoded_value_);
   }
   data_->attributes_.Append(attr);
 }
@@ -188,29 +195,32 @@ void HtmlElement::AddAttribute(const HtmlName& name,
                                const StringPiece& decoded_value,
                                QuoteStyle quote_style) {
   GoogleString buf;
-  Attribute* attr = new Attribute(
-      name, HtmlKeywords::Escape(decoded_value, &buf), quote_style);
+  Attribute* attr = new (data_->pool_)
+      Attribute(name, HtmlKeywords::Escape(decoded_value, &buf), quote_style,
+                data_->pool_);
   attr->decoded_value_computed_ = true;
   attr->decoding_error_ = false;
-  Attribute::CopyValue(decoded_value, &attr->decoded_value_);
+  attr->CopyValue(decoded_value, &attr->decoded_value_);
   data_->attributes_.Append(attr);
 }
 
 void HtmlElement::AddEscapedAttribute(const HtmlName& name,
                                       const StringPiece& escaped_value,
                                       QuoteStyle quote_style) {
-  Attribute* attr = new Attribute(name, escaped_value, quote_style);
+  Attribute* attr = new (data_->pool_)
+      Attribute(name, escaped_value, quote_style, data_->pool_);
   data_->attributes_.Append(attr);
 }
 
 void HtmlElement::Attribute::CopyValue(const StringPiece& src,
-                                       scoped_array<char>* dst) {
+                                       Value* dst) const {
   if (src.data() == nullptr) {
     // This case indicates attribute without value <tag attr>, as opposed
     // to data()=="", which implies an empty value <tag attr=>.
     dst->reset();
   } else {
-    char* buf = new char[src.size() + 1];
+    char* buf =
+        static_cast<char*>(HtmlObjectPool::Allocate(pool_, src.size() + 1));
     memcpy(buf, src.data(), src.size());
     buf[src.size()] = '\0';
     dst->reset(buf);
@@ -219,8 +229,10 @@ void HtmlElement::Attribute::CopyValue(const StringPiece& src,
 
 HtmlElement::Attribute::Attribute(const HtmlName& name,
                                   const StringPiece& escaped_value,
-                                  QuoteStyle quote_style)
-    : name_(name),
+                                  QuoteStyle quote_style,
+                                  HtmlObjectPool* pool)
+    : pool_(pool),
+      name_(name),
       quote_style_(quote_style),
       decoding_error_(false),
       decoded_value_computed_(false) {
@@ -20,6 +20,9 @@
 #ifndef PAGESPEED_KERNEL_HTML_HTML_ELEMENT_H_
 #define PAGESPEED_KERNEL_HTML_HTML_ELEMENT_H_
 
+#include <cstddef>
+#include <memory>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/inline_slist.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -27,6 +30,7 @@
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/html/html_node.h"
+#include "pagespeed/kernel/html/html_object_pool.h"
 
 namespace net_instaweb {
 
@@ -165,16 +169,30 @@ class HtmlElement : public HtmlNode {
 
     friend class HtmlElement;
 
+    // Attributes, and their values, are allocated from the object pool of
+    // the HtmlParse that owns the element.
+    void operator delete(void* ptr) { HtmlObjectPool::Free(ptr); }
+
    private:
+    // Values are NUL-terminated strings in pool memory.
+    typedef std::unique_ptr<char[], HtmlObjectPool::Deleter> Value;
+
+    void* operator new(size_t size, HtmlObjectPool* pool) {
+      return HtmlObjectPool::Allocate(pool, size);
+    }
+    void operator delete(void* ptr, HtmlObjectPool* pool) {
+      HtmlObjectPool::Free(ptr);
+    }
+
     void ComputeDecodedValue() const;
 
     // This should only be called from AddAttribute
     Attribute(const HtmlName& name, const StringPiece& escaped_value,
-              QuoteStyle quote_style);
+              QuoteStyle quote_style, HtmlObjectPool* pool);
 
-    static inline void CopyValue(const StringPiece& src,
-                                 scoped_array<char>* dst);
+    inline void CopyValue(const StringPiece& src, Value* dst) const;
 
+    HtmlObjectPool* pool_;
     HtmlName name_;
     QuoteStyle quote_style_ : 8;
     mutable bool decoding_error_;
@@ -188,7 +206,7 @@ class HtmlElement : public HtmlNode {
     // Note that it is acceptable to have 8-bit characters in escape
     // sequences (typically iso8859).  However we will not be able to
     // decode such attributes.
-    scoped_array<char> escaped_value_;
+    Value escaped_value_;
 
     // An 8-bit representation of the escaped_value.  Escape sequences
     // that contain character-codes >= 256 are not decoded, and will
@@ -206,7 +224,7 @@ class HtmlElement : public HtmlNode {
     // Note that we do not decode non-ASCII characters but we can
     // represent them in escaped_value_.  We can get 8-bit characters
     // into decoded_value_ via &#129; etc.
-    mutable scoped_array<char> decoded_value_;
+    mutable Value decoded_value_;
 
     DISALLOW_COPY_AND_ASSIGN(Attribute);
   };
@@ -353,7 +371,7 @@ class HtmlElement : public HtmlNode {
   // class, so we can delete it on Flush after a CloseElement event.
   struct Data {
     Data(const HtmlName& name, const HtmlEventListIterator& begin,
-         const HtmlEventListIterator& end);
+         const HtmlEventListIterator& end, HtmlObjectPool* pool);
     ~Data();
 
     // Max value for the line numbers below.  Since they are 24-bits,
@@ -377,6 +395,7 @@ class HtmlElement : public HtmlNode {
     Style style_ : 8;
 
     HtmlName name_;
+    HtmlObjectPool* pool_;  // Allocates attributes; NULL means the heap.
     AttributeList attributes_;
     HtmlEventListIterator begin_;
     HtmlEventListIterator end_;
@@ -394,7 +413,7 @@ class HtmlElement : public HtmlNode {
   // construct via HtmlParse::NewElement
   HtmlElement(HtmlElement* parent, const HtmlName& name,
               const HtmlEventListIterator& begin,
-              const HtmlEventListIterator& end);
+              const HtmlEventListIterator& end, HtmlObjectPool* pool);
 
   // HtmlElement data is held in HtmlElement::Data*, which is freed
   // when a CloseElement is Flushed.  The pointers themselves are
@@ -20,12 +20,15 @@
 #ifndef PAGESPEED_KERNEL_HTML_HTML_EVENT_H_
 #define PAGESPEED_KERNEL_HTML_HTML_EVENT_H_
 
+#include <cstddef>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_filter.h"
 #include "pagespeed/kernel/html/html_node.h"
+#include "pagespeed/kernel/html/html_object_pool.h"
 
 namespace net_instaweb {
 
@@ -51,6 +54,20 @@ class HtmlEvent {
 
   int line_number() const { return line_number_; }
 
+  // Events are normally allocated from the HtmlParse's object pool with
+  // new (pool) HtmlXxxEvent(...), but may also be allocated from the heap.
+  // Either way they are released with delete.
+  void* operator new(size_t size, HtmlObjectPool* pool) {
+    return HtmlObjectPool::Allocate(pool, size);
+  }
+  void* operator new(size_t size) {
+    return HtmlObjectPool::Allocate(NULL, size);
+  }
+  void operator delete(void* ptr, HtmlObjectPool* pool) {
+    HtmlObjectPool::Free(ptr);
+  }
+  void operator delete(void* ptr) { HtmlObjectPool::Free(ptr); }
+
  private:
   int line_number_;
 
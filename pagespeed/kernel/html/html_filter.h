@@ -143,6 +143,21 @@ class HtmlFilter {
   // that is not page-critical.
   virtual ScriptUsage GetScriptUsage() const = 0;
 
+  // Returns true if this filter can share a single pass over the flush
+  // window with adjacent streaming-safe filters; see
+  // HtmlParse::set_fuse_streaming_filters.  In that mode, the filter sees
+  // each event before the filters after it do, but also before the filters
+  // ahead of it have seen later events.  So a streaming-safe filter must:
+  //   - not look ahead in the event stream, or depend on the state of
+  //     nodes that come later in the flush window;
+  //   - not insert, delete, move, replace or defer nodes;
+  //   - only modify the node of the event it is handling, and not modify
+  //     an element in EndElement in a way that matters to StartElement
+  //     (e.g. its attributes), since later filters have already seen it;
+  //   - not modify nodes from its Flush method.
+  // The default is false.
+  virtual bool IsStreamingSafe() const { return false; }
+
   // The name of this filter -- used for logging and debugging.
   virtual const char* Name() const = 0;
 
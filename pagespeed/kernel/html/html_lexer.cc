@@ -32,6 +32,7 @@
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_event.h"
 #include "pagespeed/kernel/html/html_keywords.h"
+#include "pagespeed/kernel/html/html_lexer_scan.h"
 #include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/html/html_node.h"
 #include "pagespeed/kernel/html/html_parse.h"
@@ -146,7 +147,8 @@ HtmlLexer::HtmlLexer(HtmlParse* html_parse)
       discard_until_start_state_for_error_recovery_(false),
       size_limit_exceeded_(false),
       skip_parsing_(false),
-      size_limit_(-1) {
+      size_limit_(-1),
+      fast_scan_enabled_(true) {
 #ifndef NDEBUG
   CHECK_KEYWORD_SET_ORDERING(kImplicitlyClosedHtmlTags);
   CHECK_KEYWORD_SET_ORDERING(kNonBriefTerminatedTags);
@@ -617,8 +619,9 @@ void HtmlLexer::EvalScriptTag(char c) {
 // Emits raw uninterpreted characters.
 void HtmlLexer::EmitLiteral() {
   if (!literal_.empty()) {
-    html_parse_->AddEvent(new HtmlCharactersEvent(
-        html_parse_->NewCharactersNode(Parent(), literal_), tag_start_line_));
+    html_parse_->AddEvent(new (html_parse_->object_pool())
+        HtmlCharactersEvent(html_parse_->NewCharactersNode(Parent(), literal_),
+                            tag_start_line_));
     literal_.clear();
   }
   state_ = START;
@@ -634,10 +637,12 @@ void HtmlLexer::EmitComment() {
       (token_.find("[endif]") != GoogleString::npos)) {
     HtmlIEDirectiveNode* node =
         html_parse_->NewIEDirectiveNode(Parent(), token_);
-    html_parse_->AddEvent(new HtmlIEDirectiveEvent(node, tag_start_line_));
+    html_parse_->AddEvent(new (html_parse_->object_pool())
+        HtmlIEDirectiveEvent(node, tag_start_line_));
   } else {
     HtmlCommentNode* node = html_parse_->NewCommentNode(Parent(), token_);
-    html_parse_->AddEvent(new HtmlCommentEvent(node, tag_start_line_));
+    html_parse_->AddEvent(new (html_parse_->object_pool())
+        HtmlCommentEvent(node, tag_start_line_));
   }
   token_.clear();
   state_ = START;
@@ -645,7 +650,7 @@ void HtmlLexer::EmitComment() {
 
 void HtmlLexer::EmitCdata() {
   literal_.clear();
-  html_parse_->AddEvent(new HtmlCdataEvent(
+  html_parse_->AddEvent(new (html_parse_->object_pool()) HtmlCdataEvent(
       html_parse_->NewCdataNode(Parent(), token_), tag_start_line_));
   token_.clear();
   state_ = START;
@@ -993,7 +998,7 @@ void HtmlLexer::EmitTagClose(HtmlElement::Style style) {
 
 void HtmlLexer::EmitDirective() {
   literal_.clear();
-  html_parse_->AddEvent(new HtmlDirectiveEvent(
+  html_parse_->AddEvent(new (html_parse_->object_pool()) HtmlDirectiveEvent(
       html_parse_->NewDirectiveNode(Parent(), token_), line_));
   // Update the doctype; note that if this is not a doctype directive, Parse()
   // will return false and not alter doctype_.
@@ -1015,6 +1020,12 @@ void HtmlLexer::Parse(const char* text, int size) {
       // Return without doing anything if skip_parsing_ is true.
       return;
     }
+    if (fast_scan_enabled_) {
+      i += ConsumeInertRun(text + i, size - i);
+      if (i == size) {
+        break;
+      }
+    }
     char c = text[i];
     if (c == '\n') {
       ++line_;
@@ -1128,6 +1139,84 @@ void HtmlLexer::Parse(const char* text, int size) {
   }
 }
 
+int HtmlLexer::ConsumeInertRun(const char* text, int size) {
+  // Each of these states dispatches on just a few bytes; all others are
+  // appended to literal_ and, for some states, to a second buffer.  No
+  // events are emitted along the way, so line_ can be advanced for the
+  // whole run at once.
+  GoogleString* buffer = nullptr;
+  size_t run;
+  switch (state_) {
+    case START:
+      run = HtmlLexerScan::FindFirstOf(text, size, "<", 1);
+      break;
+    case COMMENT_BODY:
+      run = HtmlLexerScan::FindFirstOf(text, size, "-", 1);
+      buffer = &token_;
+      break;
+    case CDATA_BODY:
+      run = HtmlLexerScan::FindFirstOf(text, size, "]", 1);
+      buffer = &token_;
+      break;
+    case DIRECTIVE:
+      run = HtmlLexerScan::FindFirstOf(text, size, ">", 1);
+      buffer = &token_;
+      break;
+    case TAG_ATTR_VALDQ:
+      run = HtmlLexerScan::FindFirstOf(text, size, "\"", 1);
+      buffer = &attr_value_;
+      break;
+    case TAG_ATTR_VALSQ:
+      run = HtmlLexerScan::FindFirstOf(text, size, "'", 1);
+      buffer = &attr_value_;
+      break;
+    case LITERAL_TAG:
+    case BOGUS_COMMENT:
+      run = HtmlLexerScan::FindFirstOf(text, size, ">", 1);
+      break;
+    case SCRIPT_TAG:
+      run = FindScriptInertRun(text, size);
+      break;
+    default:
+      return 0;
+  }
+  if (run != 0) {
+    line_ += HtmlLexerScan::CountChar(text, run, '\n');
+    literal_.append(text, run);
+    if (buffer != nullptr) {
+      buffer->append(text, run);
+    }
+  }
+  return run;
+}
+
+size_t HtmlLexer::FindScriptInertRun(const char* text, size_t size) const {
+  // EvalScriptTag only reacts to '-' (completing "<!--"), and to CanEndTag
+  // bytes that complete "</script", "<script" or "-->".  In every case the
+  // byte immediately preceding it must be 't', 'T' or '-', so a candidate
+  // byte following anything else can be skipped as well.
+  static const char kStops[] = "->/ \t\n\r\f";
+  size_t run = 0;
+  while (run < size) {
+    run += HtmlLexerScan::FindFirstOf(text + run, size - run, kStops,
+                                      STATIC_STRLEN(kStops));
+    if (run == size) {
+      break;
+    }
+    char prev = '\0';
+    if (run > 0) {
+      prev = text[run - 1];
+    } else if (!literal_.empty()) {
+      prev = literal_[literal_.size() - 1];
+    }
+    if ((prev == 't') || (prev == 'T') || (prev == '-')) {
+      break;
+    }
+    ++run;
+  }
+  return run;
+}
+
 // The HTML-input sloppiness in these three methods is applied independent
 // of whether we think the document is XHTML, either via doctype or
 // mime-type.  The internet is full of lies.  See Issue 252:
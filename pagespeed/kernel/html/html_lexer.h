@@ -96,6 +96,14 @@ class HtmlLexer {
   // that we should parse.
   bool size_limit_exceeded() const { return size_limit_exceeded_; }
 
+  // When enabled (the default), runs of bytes that cannot change the lexer
+  // state -- e.g. text up to the next '<', or a quoted attribute value up to
+  // its closing quote -- are located with vectorized scans and appended in
+  // bulk rather than dispatched a byte at a time.  The resulting event stream
+  // is identical either way; disabling is useful for tests and benchmarks.
+  void set_fast_scan_enabled(bool x) { fast_scan_enabled_ = x; }
+  bool fast_scan_enabled() const { return fast_scan_enabled_; }
+
  private:
   // Most of these routines expect c to be the last character of literal_
   inline void EvalStart(char c);
@@ -130,6 +138,16 @@ class HtmlLexer {
   inline void EvalDirective(char c);
   inline void EvalBogusComment(char c);
 
+  // If the current state is one that ignores most bytes, consumes the
+  // longest prefix of text that would leave the state unchanged, appending
+  // it to the buffers the per-byte Eval* methods would have.  Returns the
+  // number of bytes consumed, which may be 0.
+  int ConsumeInertRun(const char* text, int size);
+
+  // Like ConsumeInertRun, but for SCRIPT_TAG, where the potentially
+  // significant bytes only matter in certain contexts.
+  size_t FindScriptInertRun(const char* text, size_t size) const;
+
   // Makes an element based on token_, which will be parsed as the tag
   // name.
   void MakeElement();
@@ -250,6 +268,7 @@ class HtmlLexer {
   bool skip_parsing_;
   int64 num_bytes_parsed_;
   int64 size_limit_;
+  bool fast_scan_enabled_;
 
   DISALLOW_COPY_AND_ASSIGN(HtmlLexer);
 };
@@ -0,0 +1,207 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/html/html_lexer_scan.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+// SSE2 is part of the x86-64 baseline.  AVX2 code is compiled with a
+// function-level target attribute so the rest of the binary need not be
+// built with -mavx2; it is only called after checking the CPU at runtime.
+#define PAGESPEED_HTML_LEXER_SCAN_X86 1
+#define PAGESPEED_AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+namespace net_instaweb {
+
+namespace {
+
+size_t FindFirstOfPortable(const char* text, size_t size, const char* stops,
+                           int num_stops) {
+  if (num_stops == 1) {
+    // memchr is already vectorized by most C libraries.
+    const void* found = memchr(text, stops[0], size);
+    return (found == nullptr)
+               ? size
+               : static_cast<const char*>(found) - text;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    char c = text[i];
+    for (int k = 0; k < num_stops; ++k) {
+      if (c == stops[k]) {
+        return i;
+      }
+    }
+  }
+  return size;
+}
+
+size_t CountCharPortable(const char* text, size_t size, char c) {
+  return std::count(text, text + size, c);
+}
+
+#ifdef PAGESPEED_HTML_LEXER_SCAN_X86
+
+size_t FindFirstOfSse2(const char* text, size_t size, const char* stops,
+                       int num_stops) {
+  __m128i needles[HtmlLexerScan::kMaxStops];
+  for (int k = 0; k < num_stops; ++k) {
+    needles[k] = _mm_set1_epi8(stops[k]);
+  }
+  size_t i = 0;
+  for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i)) {
+    __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+    __m128i hits = _mm_cmpeq_epi8(chunk, needles[0]);
+    for (int k = 1; k < num_stops; ++k) {
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[k]));
+    }
+    int mask = _mm_movemask_epi8(hits);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + FindFirstOfPortable(text + i, size - i, stops, num_stops);
+}
+
+size_t CountCharSse2(const char* text, size_t size, char c) {
+  __m128i needle = _mm_set1_epi8(c);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i)) {
+    __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    count += __builtin_popcount(mask);
+  }
+  return count + CountCharPortable(text + i, size - i, c);
+}
+
+PAGESPEED_AVX2_FUNCTION
+size_t FindFirstOfAvx2(const char* text, size_t size, const char* stops,
+                       int num_stops) {
+  __m256i needles[HtmlLexerScan::kMaxStops];
+  for (int k = 0; k < num_stops; ++k) {
+    needles[k] = _mm256_set1_epi8(stops[k]);
+  }
+  size_t i = 0;
+  for (; i + sizeof(__m256i) <= size; i += sizeof(__m256i)) {
+    __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+    __m256i hits = _mm256_cmpeq_epi8(chunk, needles[0]);
+    for (int k = 1; k < num_stops; ++k) {
+      hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, needles[k]));
+    }
+    unsigned mask = _mm256_movemask_epi8(hits);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + FindFirstOfSse2(text + i, size - i, stops, num_stops);
+}
+
+PAGESPEED_AVX2_FUNCTION
+size_t CountCharAvx2(const char* text, size_t size, char c) {
+  __m256i needle = _mm256_set1_epi8(c);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + sizeof(__m256i) <= size; i += sizeof(__m256i)) {
+    __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+    count += __builtin_popcount(mask);
+  }
+  return count + CountCharSse2(text + i, size - i, c);
+}
+
+HtmlLexerScan::Implementation DetectImplementation() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return HtmlLexerScan::kAvx2;
+  }
+  return HtmlLexerScan::kSse2;
+}
+
+#else
+
+HtmlLexerScan::Implementation DetectImplementation() {
+  return HtmlLexerScan::kPortable;
+}
+
+#endif  // PAGESPEED_HTML_LEXER_SCAN_X86
+
+}  // namespace
+
+HtmlLexerScan::Implementation HtmlLexerScan::best_implementation() {
+  // Function-local statics are initialized thread-safely.
+  static const Implementation best = DetectImplementation();
+  return best;
+}
+
+bool HtmlLexerScan::IsSupported(Implementation impl) {
+  switch (impl) {
+    case kPortable:
+      return true;
+    case kSse2:
+      return best_implementation() != kPortable;
+    case kAvx2:
+      return best_implementation() == kAvx2;
+  }
+  return false;
+}
+
+size_t HtmlLexerScan::FindFirstOfUsing(Implementation impl, const char* text,
+                                       size_t size, const char* stops,
+                                       int num_stops) {
+  DCHECK_LE(1, num_stops);
+  DCHECK_GE(kMaxStops, num_stops);
+  DCHECK(IsSupported(impl));
+  switch (impl) {
+#ifdef PAGESPEED_HTML_LEXER_SCAN_X86
+    case kAvx2:
+      return FindFirstOfAvx2(text, size, stops, num_stops);
+    case kSse2:
+      return FindFirstOfSse2(text, size, stops, num_stops);
+#endif
+    default:
+      return FindFirstOfPortable(text, size, stops, num_stops);
+  }
+}
+
+size_t HtmlLexerScan::CountCharUsing(Implementation impl, const char* text,
+                                     size_t size, char c) {
+  DCHECK(IsSupported(impl));
+  switch (impl) {
+#ifdef PAGESPEED_HTML_LEXER_SCAN_X86
+    case kAvx2:
+      return CountCharAvx2(text, size, c);
+    case kSse2:
+      return CountCharSse2(text, size, c);
+#endif
+    default:
+      return CountCharPortable(text, size, c);
+  }
+}
+
+}  // namespace net_instaweb
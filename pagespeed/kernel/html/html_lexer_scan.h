@@ -0,0 +1,81 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_HTML_HTML_LEXER_SCAN_H_
+#define PAGESPEED_KERNEL_HTML_HTML_LEXER_SCAN_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// Byte-scanning primitives used by HtmlLexer to hop over runs of input that
+// cannot change the lexer state, e.g. text up to the next '<', or a quoted
+// attribute value up to its closing quote.  On x86-64 these compare 16 bytes
+// (SSE2) or 32 bytes (AVX2, selected at runtime if the CPU supports it) at a
+// time; elsewhere they fall back to portable scalar loops.  All
+// implementations return identical results.
+class HtmlLexerScan {
+ public:
+  // The maximum number of distinct stop bytes FindFirstOf accepts.
+  static const int kMaxStops = 8;
+
+  enum Implementation {
+    kPortable,
+    kSse2,
+    kAvx2,
+  };
+
+  // Returns the offset of the first byte in [text, text + size) that is
+  // equal to one of the num_stops bytes in stops, or size if there is none.
+  // num_stops must be between 1 and kMaxStops.
+  static size_t FindFirstOf(const char* text, size_t size, const char* stops,
+                            int num_stops) {
+    return FindFirstOfUsing(best_implementation(), text, size, stops,
+                            num_stops);
+  }
+
+  // Returns the number of bytes in [text, text + size) equal to c.
+  static size_t CountChar(const char* text, size_t size, char c) {
+    return CountCharUsing(best_implementation(), text, size, c);
+  }
+
+  // As above, but with an explicit implementation, which must be
+  // supported on this CPU.  Exposed for tests and benchmarks.
+  static size_t FindFirstOfUsing(Implementation impl, const char* text,
+                                 size_t size, const char* stops,
+                                 int num_stops);
+  static size_t CountCharUsing(Implementation impl, const char* text,
+                               size_t size, char c);
+
+  // Returns whether impl can run on this CPU.
+  static bool IsSupported(Implementation impl);
+
+  // The fastest implementation supported on this CPU.
+  static Implementation best_implementation();
+
+ private:
+  HtmlLexerScan();
+  DISALLOW_COPY_AND_ASSIGN(HtmlLexerScan);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_HTML_HTML_LEXER_SCAN_H_
@@ -50,7 +50,8 @@ HtmlCdataNode::~HtmlCdataNode() {}
 void HtmlCdataNode::SynthesizeEvents(const HtmlEventListIterator& iter,
                                      HtmlEventList* queue) {
   // We use -1 as a bogus line number, since the event is synthetic.
-  HtmlCdataEvent* event = new HtmlCdataEvent(this, -1);
+  HtmlCdataEvent* event =
+      new (queue->get_allocator().pool()) HtmlCdataEvent(this, -1);
   set_iter(queue->insert(iter, event));
 }
 
@@ -59,7 +60,8 @@ HtmlCharactersNode::~HtmlCharactersNode() {}
 void HtmlCharactersNode::SynthesizeEvents(const HtmlEventListIterator& iter,
                                           HtmlEventList* queue) {
   // We use -1 as a bogus line number, since the event is synthetic.
-  HtmlCharactersEvent* event = new HtmlCharactersEvent(this, -1);
+  HtmlCharactersEvent* event =
+      new (queue->get_allocator().pool()) HtmlCharactersEvent(this, -1);
   set_iter(queue->insert(iter, event));
 }
 
@@ -68,7 +70,8 @@ HtmlCommentNode::~HtmlCommentNode() {}
 void HtmlCommentNode::SynthesizeEvents(const HtmlEventListIterator& iter,
                                        HtmlEventList* queue) {
   // We use -1 as a bogus line number, since the event is synthetic.
-  HtmlCommentEvent* event = new HtmlCommentEvent(this, -1);
+  HtmlCommentEvent* event =
+      new (queue->get_allocator().pool()) HtmlCommentEvent(this, -1);
   set_iter(queue->insert(iter, event));
 }
 
@@ -77,7 +80,8 @@ HtmlIEDirectiveNode::~HtmlIEDirectiveNode() {}
 void HtmlIEDirectiveNode::SynthesizeEvents(const HtmlEventListIterator& iter,
                                            HtmlEventList* queue) {
   // We use -1 as a bogus line number, since the event is synthetic.
-  HtmlIEDirectiveEvent* event = new HtmlIEDirectiveEvent(this, -1);
+  HtmlIEDirectiveEvent* event =
+      new (queue->get_allocator().pool()) HtmlIEDirectiveEvent(this, -1);
   set_iter(queue->insert(iter, event));
 }
 
@@ -86,7 +90,8 @@ HtmlDirectiveNode::~HtmlDirectiveNode() {}
 void HtmlDirectiveNode::SynthesizeEvents(const HtmlEventListIterator& iter,
                                          HtmlEventList* queue) {
   // We use -1 as a bogus line number, since the event is synthetic.
-  HtmlDirectiveEvent* event = new HtmlDirectiveEvent(this, -1);
+  HtmlDirectiveEvent* event =
+      new (queue->get_allocator().pool()) HtmlDirectiveEvent(this, -1);
   set_iter(queue->insert(iter, event));
 }
 
@@ -29,13 +29,18 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/html_object_pool.h"
 
 namespace net_instaweb {
 
 class HtmlElement;
 class HtmlEvent;
 
-typedef std::list<HtmlEvent*> HtmlEventList;
+// The list nodes are drawn from the HtmlParse's object pool.  Lists created
+// with a default-constructed allocator use the heap, and may still be
+// spliced with pooled lists.
+typedef std::list<HtmlEvent*, HtmlObjectPool::Allocator<HtmlEvent*> >
+    HtmlEventList;
 typedef HtmlEventList::iterator HtmlEventListIterator;
 
 // Base class for HtmlElement and HtmlLeafNode.  Generally represents all
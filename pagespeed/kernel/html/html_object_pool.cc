@@ -0,0 +1,157 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/html/html_object_pool.h"
+
+#include <cstdlib>
+
+#include "base/logging.h"
+
+namespace net_instaweb {
+
+const size_t HtmlObjectPool::kAlign;
+const size_t HtmlObjectPool::kChunkSize;
+const size_t HtmlObjectPool::kDefaultRetainedBytes;
+const size_t HtmlObjectPool::kMaxPooledSize =
+    HtmlObjectPool::SlotSize(HtmlObjectPool::kNumSizeClasses - 1) -
+    HtmlObjectPool::kAlign;
+
+HtmlObjectPool::HtmlObjectPool()
+    : num_live_blocks_(0), num_chunks_(0), enabled_(true) {}
+
+HtmlObjectPool::~HtmlObjectPool() {
+  DCHECK_EQ(0, num_live_blocks_);
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    std::vector<char*>& chunks = classes_[i].chunks;
+    for (int j = 0, n = chunks.size(); j < n; ++j) {
+      delete[] chunks[j];
+    }
+  }
+}
+
+int HtmlObjectPool::SizeClassIndex(size_t size) {
+  size += kAlign;
+  int index = 0;
+  while (SlotSize(index) < size) {
+    ++index;
+  }
+  DCHECK_LT(index, kNumSizeClasses);
+  return index;
+}
+
+void* HtmlObjectPool::AllocateFromHeap(size_t size) {
+  char* block = static_cast<char*>(malloc(size + kAlign));
+  CHECK(block != NULL);
+  *reinterpret_cast<uintptr_t*>(block) = kHeapTag;
+  return block + kAlign;
+}
+
+void* HtmlObjectPool::Allocate(size_t size) {
+  if (!enabled_ || (size > kMaxPooledSize)) {
+    return AllocateFromHeap(size);
+  }
+  int index = SizeClassIndex(size);
+  char* slot = static_cast<char*>(AllocateSlot(index));
+  *reinterpret_cast<uintptr_t*>(slot) =
+      reinterpret_cast<uintptr_t>(this) | static_cast<uintptr_t>(index);
+  ++num_live_blocks_;
+  return slot + kAlign;
+}
+
+void* HtmlObjectPool::AllocateSlot(int index) {
+  SizeClass* size_class = &classes_[index];
+  char* slot = size_class->free_list;
+  if (slot != NULL) {
+    size_class->free_list = *reinterpret_cast<char**>(slot);
+    return slot;
+  }
+  size_t slot_size = SlotSize(index);
+  if ((size_class->next_alloc == NULL) ||
+      (size_class->next_alloc + slot_size > size_class->chunk_end)) {
+    char* chunk;
+    if (size_class->next_chunk < size_class->chunks.size()) {
+      chunk = size_class->chunks[size_class->next_chunk];
+    } else {
+      chunk = new char[kChunkSize];
+      size_class->chunks.push_back(chunk);
+      ++num_chunks_;
+    }
+    ++size_class->next_chunk;
+    size_class->next_alloc = chunk;
+    size_class->chunk_end = chunk + kChunkSize;
+  }
+  slot = size_class->next_alloc;
+  size_class->next_alloc += slot_size;
+  return slot;
+}
+
+void HtmlObjectPool::FreeSlot(char* slot, int index) {
+  SizeClass* size_class = &classes_[index];
+  *reinterpret_cast<char**>(slot) = size_class->free_list;
+  size_class->free_list = slot;
+  --num_live_blocks_;
+  DCHECK_LE(0, num_live_blocks_);
+}
+
+void HtmlObjectPool::Free(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  char* block = static_cast<char*>(ptr) - kAlign;
+  uintptr_t header = *reinterpret_cast<uintptr_t*>(block);
+  uintptr_t tag = header & (kAlign - 1);
+  if (tag == kHeapTag) {
+    free(block);
+  } else {
+    HtmlObjectPool* pool = reinterpret_cast<HtmlObjectPool*>(header - tag);
+    pool->FreeSlot(block, static_cast<int>(tag));
+  }
+}
+
+void HtmlObjectPool::Trim(size_t max_retained_bytes) {
+  if (num_live_blocks_ != 0) {
+    return;
+  }
+
+  // With nothing live, every chunk is entirely free, so we can forget the
+  // free-lists and carve from the start of the retained chunks again.
+  // This also restores allocation-order locality for the next document.
+  size_t retained_bytes = 0;
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    SizeClass* size_class = &classes_[i];
+    size_class->free_list = NULL;
+    size_class->next_alloc = NULL;
+    size_class->chunk_end = NULL;
+    size_class->next_chunk = 0;
+    std::vector<char*>& chunks = size_class->chunks;
+    size_t keep = 0;
+    while ((keep < chunks.size()) &&
+           (retained_bytes + kChunkSize <= max_retained_bytes)) {
+      retained_bytes += kChunkSize;
+      ++keep;
+    }
+    for (size_t j = keep; j < chunks.size(); ++j) {
+      delete[] chunks[j];
+      --num_chunks_;
+    }
+    chunks.resize(keep);
+  }
+}
+
+}  // namespace net_instaweb
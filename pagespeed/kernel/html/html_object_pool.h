@@ -0,0 +1,173 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_HTML_HTML_OBJECT_POOL_H_
+#define PAGESPEED_KERNEL_HTML_HTML_OBJECT_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// Recycling allocator for the small objects HtmlParse creates and destroys
+// in every flush window: HtmlEvents, the list nodes of HtmlEventList, and
+// HtmlElement::Attribute objects along with their value strings.
+//
+// Memory is carved out of fixed-size chunks, segregated into a few size
+// classes, and freed blocks go on a per-class free-list.  Because a flush
+// window frees nearly everything the previous one allocated, steady-state
+// parsing runs entirely out of recycled blocks and never calls malloc.  The
+// chunks stay with the owning HtmlParse (and thus with a pooled
+// RewriteDriver) across documents, subject to Trim().
+//
+// Every block is preceded by a one-word header naming the pool and size
+// class it came from, so that Free() is static: objects can be released
+// without knowing where they were allocated, and blocks taken from the heap
+// (because they are too large, or were allocated with a NULL pool) are
+// released correctly too.  This keeps 'delete event' working everywhere.
+//
+// This class is not thread-safe; like the rest of HtmlParse it is used
+// from one thread at a time.
+class HtmlObjectPool {
+ public:
+  // Alignment of all returned blocks, and size of the per-block header.
+  static const size_t kAlign = 8;
+
+  // Size of the chunks from which pooled blocks are carved.
+  static const size_t kChunkSize = 8192;
+
+  // Largest request served from the pool, rather than from the heap.
+  static const size_t kMaxPooledSize;
+
+  // Default for Trim(): retain up to this many bytes of chunks between
+  // documents.
+  static const size_t kDefaultRetainedBytes = 16 * kChunkSize;
+
+  HtmlObjectPool();
+
+  // All blocks allocated from the pool must have been freed.
+  ~HtmlObjectPool();
+
+  // Returns a kAlign-aligned block of at least size bytes.
+  void* Allocate(size_t size);
+
+  // As Allocate, but takes the block from the heap if pool is NULL.
+  static void* Allocate(HtmlObjectPool* pool, size_t size) {
+    return (pool == NULL) ? AllocateFromHeap(size) : pool->Allocate(size);
+  }
+
+  // Releases a block returned by either flavor of Allocate.  NULL is ignored.
+  static void Free(void* ptr);
+
+  // When disabled, Allocate() passes every request through to the heap.
+  // Blocks already handed out are unaffected.
+  void set_enabled(bool x) { enabled_ = x; }
+  bool enabled() const { return enabled_; }
+
+  // Returns chunks to the system so that no more than max_retained_bytes
+  // remain reserved.  This only has an effect when no pooled blocks are
+  // live, which is the case between documents.
+  void Trim(size_t max_retained_bytes);
+
+  // Number of pooled blocks currently handed out.
+  int64 num_live_blocks() const { return num_live_blocks_; }
+
+  // Bytes currently reserved in chunks.
+  size_t bytes_reserved() const { return num_chunks_ * kChunkSize; }
+
+  // Deleter for std::unique_ptr holding blocks from this pool.
+  struct Deleter {
+    void operator()(void* ptr) const { Free(ptr); }
+  };
+
+  // STL allocator that draws from a pool, or from the heap if constructed
+  // without one.  All instances compare equal, as any of them can free
+  // memory allocated by another; that lets lists drawing from different
+  // pools (or from none) be spliced together.
+  template <typename T>
+  class Allocator {
+   public:
+    typedef T value_type;
+    typedef std::true_type is_always_equal;
+
+    Allocator() : pool_(NULL) {}
+    explicit Allocator(HtmlObjectPool* pool) : pool_(pool) {}
+    template <typename U>
+    Allocator(const Allocator<U>& src) : pool_(src.pool()) {}  // NOLINT
+
+    T* allocate(size_t n) {
+      static_assert(alignof(T) <= kAlign, "type is overaligned for the pool");
+      return static_cast<T*>(HtmlObjectPool::Allocate(pool_, n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t n) { HtmlObjectPool::Free(ptr); }
+
+    HtmlObjectPool* pool() const { return pool_; }
+
+    template <typename U>
+    bool operator==(const Allocator<U>& other) const { return true; }
+    template <typename U>
+    bool operator!=(const Allocator<U>& other) const { return false; }
+
+   private:
+    HtmlObjectPool* pool_;
+  };
+
+ private:
+  // Per-size-class state.  Blocks are carved off the current chunk until
+  // it runs out, then off the next retained chunk, and only then is a
+  // new chunk allocated.
+  struct SizeClass {
+    SizeClass() : free_list(NULL), next_alloc(NULL), chunk_end(NULL),
+                  next_chunk(0) {}
+    char* free_list;
+    char* next_alloc;
+    char* chunk_end;
+    size_t next_chunk;
+    std::vector<char*> chunks;
+  };
+
+  static const int kNumSizeClasses = 4;
+
+  // Header tag for heap blocks; the low bits of a pool header hold the
+  // size class, which is always smaller.
+  static const uintptr_t kHeapTag = kAlign - 1;
+
+  static void* AllocateFromHeap(size_t size);
+  static int SizeClassIndex(size_t size);
+  static size_t SlotSize(int index) { return static_cast<size_t>(32) << index; }
+
+  void* AllocateSlot(int index);
+  void FreeSlot(char* slot, int index);
+
+  SizeClass classes_[kNumSizeClasses];
+  int64 num_live_blocks_;
+  size_t num_chunks_;
+  bool enabled_;
+
+  DISALLOW_COPY_AND_ASSIGN(HtmlObjectPool);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_HTML_HTML_OBJECT_POOL_H_
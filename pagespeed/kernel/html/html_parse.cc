@@ -49,6 +49,7 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
     : lexer_(nullptr),  // Can't initialize here, since "this" should not be
                         // used in the initializer list (it generates an error
                         // in Visual Studio builds).
+      queue_(HtmlEventList::allocator_type(&object_pool_)),
       current_(queue_.end()),
       message_handler_(message_handler),
       line_number_(1),
@@ -62,6 +63,9 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
       log_rewrite_timing_(false),
       running_filters_(false),
       buffer_events_(false),
+      fuse_streaming_filters_(false),
+      num_filter_passes_(0),
+      filter_passes_in_last_flush_(0),
       parse_start_time_us_(0),
       timer_(nullptr),
       current_filter_(nullptr),
@@ -222,7 +226,8 @@ HtmlElement* HtmlParse::NewElement(HtmlElement* parent, const HtmlName& name) {
   }
 #endif
   HtmlElement* element =
-      new (&nodes_) HtmlElement(parent, name, queue_.end(), queue_.end());
+      new (&nodes_) HtmlElement(parent, name, queue_.end(), queue_.end(),
+                                &object_pool_);
   if (IsOptionallyClosedTag(name.keyword())) {
     // When we programmatically insert HTML nodes we should default to
     // including an explicit close-tag if they are optionally closed
@@ -234,7 +239,7 @@ HtmlElement* HtmlParse::NewElement(HtmlElement* parent, const HtmlName& name) {
 
 void HtmlParse::AddElement(HtmlElement* element, int line_number) {
   HtmlStartElementEvent* event =
-      new HtmlStartElementEvent(element, line_number);
+      new (&object_pool_) HtmlStartElementEvent(element, line_number);
   AddEvent(event);
   element->set_begin(Last());
   element->set_begin_line_number(line_number);
@@ -278,7 +283,7 @@ bool HtmlParse::StartParseId(const StringPiece& url, const StringPiece& id,
       parse_start_time_us_ = timer_->NowUs();
       InfoHere("HtmlParse::StartParse");
     }
-    AddEvent(new HtmlStartDocumentEvent(line_number_));
+    AddEvent(new (&object_pool_) HtmlStartDocumentEvent(line_number_));
     lexer_->StartParse(id, content_type);
   }
   return url_valid_;
@@ -309,7 +314,7 @@ void HtmlParse::BeginFinishParse() {
     lexer_->FinishParse();
     DCHECK(delayed_start_literal_.get() == nullptr);
     delayed_start_literal_.reset();
-    AddEvent(new HtmlEndDocumentEvent(line_number_));
+    AddEvent(new (&object_pool_) HtmlEndDocumentEvent(line_number_));
   }
 }
 
@@ -402,6 +407,7 @@ void HtmlParse::ApplyFilter(HtmlFilter* filter) {
   }
 
   ShowProgress(StrCat("ApplyFilter:", filter->Name()).c_str());
+  ++num_filter_passes_;
   for (current_ = queue_.begin(); current_ != queue_.end(); NextEvent()) {
     HtmlEvent* event = *current_;
     line_number_ = event->line_number();
@@ -416,6 +422,89 @@ void HtmlParse::ApplyFilter(HtmlFilter* filter) {
   current_filter_ = nullptr;
 }
 
+void HtmlParse::ApplyFilters(const FilterList& filters) {
+  DCHECK(fused_filters_.empty());
+  for (FilterList::const_iterator i = filters.begin(); i != filters.end();
+       ++i) {
+    HtmlFilter* filter = *i;
+    if (!filter->is_enabled()) {
+      continue;
+    }
+    if (fuse_streaming_filters_ && filter->IsStreamingSafe()) {
+      fused_filters_.push_back(filter);
+    } else {
+      ApplyFusedFilters();
+      ApplyFilter(filter);
+    }
+  }
+  ApplyFusedFilters();
+}
+
+void HtmlParse::ApplyFusedFilters() {
+  if (fused_filters_.size() <= 1) {
+    if (!fused_filters_.empty()) {
+      ApplyFilter(fused_filters_[0]);
+      fused_filters_.clear();
+    }
+    return;
+  }
+
+  // Streaming-safe filters never defer nodes, so there are no deferred
+  // events to collect for them as ApplyFilter does.
+  if (coalesce_characters_ && need_coalesce_characters_) {
+    CoalesceAdjacentCharactersNodes();
+    DelayLiteralTag();
+    need_coalesce_characters_ = false;
+  }
+
+  // Check the queue now, rather than after the first filter as ApplyFilter
+  // would, so that need_sanity_check_ flags any queue mutation made by the
+  // fused filters.
+  if (need_sanity_check_) {
+    SanityCheck();
+    need_sanity_check_ = false;
+  }
+
+  if (log_rewrite_timing_) {
+    GoogleString names;
+    for (int i = 0, n = fused_filters_.size(); i < n; ++i) {
+      StrAppend(&names, (i == 0) ? "" : ",", fused_filters_[i]->Name());
+    }
+    ShowProgress(StrCat("ApplyFusedFilters:", names).c_str());
+  }
+  ++num_filter_passes_;
+  int num_filters = fused_filters_.size();
+  for (current_ = queue_.begin(); current_ != queue_.end(); NextEvent()) {
+    HtmlEvent* event = *current_;
+    line_number_ = event->line_number();
+    for (int i = 0; i < num_filters; ++i) {
+      HtmlFilter* filter = fused_filters_[i];
+      DCHECK(open_deferred_nodes_.find(filter) == open_deferred_nodes_.end());
+      current_filter_ = filter;
+      event->Run(filter);
+      if (need_sanity_check_) {
+        LOG(DFATAL) << filter->Name() << " is declared streaming-safe but "
+                    << "mutated the event queue";
+        if (skip_increment_) {
+          // The event was removed, so the remaining filters can't see it.
+          break;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < num_filters; ++i) {
+    current_filter_ = fused_filters_[i];
+    current_filter_->Flush();
+  }
+
+  if (need_sanity_check_) {
+    SanityCheck();
+    need_sanity_check_ = false;
+  }
+  current_filter_ = nullptr;
+  fused_filters_.clear();
+}
+
 void HtmlParse::NextEvent() {
   if (skip_increment_) {
     skip_increment_ = false;
@@ -561,13 +650,12 @@ void HtmlParse::Flush() {
   if (url_valid_ && !buffer_events_) {
     ShowProgress("Flush");
 
-    for (FilterList::iterator i = filters_.begin(); i != filters_.end(); ++i) {
-      HtmlFilter* filter = *i;
-      if (filter->is_enabled()) {
-        ApplyFilter(filter);
-      }
-    }
+    ApplyFilters(filters_);
     ClearEvents();
+    filter_passes_in_last_flush_ = num_filter_passes_;
+    num_filter_passes_ = 0;
+  } else {
+    filter_passes_in_last_flush_ = 0;
   }
 }
 
@@ -1022,6 +1110,7 @@ bool HtmlParse::IsInEventWindow(const HtmlEventListIterator& iter) const {
 void HtmlParse::ClearElements() {
   ClearDeferredNodes();
   nodes_.DestroyObjects();
+  object_pool_.Trim(HtmlObjectPool::kDefaultRetainedBytes);
   DCHECK(!running_filters_);
 }
 
@@ -1187,7 +1276,7 @@ void HtmlParse::CloseElement(HtmlElement* element, HtmlElement::Style style,
   }
 
   HtmlEndElementEvent* end_event =
-      new HtmlEndElementEvent(element, line_number);
+      new (&object_pool_) HtmlEndElementEvent(element, line_number);
   if (element->style() != HtmlElement::INVISIBLE) {
     element->set_style(style);
   }
@@ -1222,6 +1311,10 @@ void HtmlParse::add_event_listener(HtmlFilter* listener) {
 
 void HtmlParse::set_size_limit(int64 x) { lexer_->set_size_limit(x); }
 
+void HtmlParse::set_lexer_fast_scan_enabled(bool x) {
+  lexer_->set_fast_scan_enabled(x);
+}
+
 bool HtmlParse::size_limit_exceeded() const {
   return lexer_->size_limit_exceeded();
 }
@@ -1277,8 +1370,8 @@ bool HtmlParse::InsertComment(StringPiece unescaped) {
     if (parent != nullptr && IsLiteralTag(parent->keyword())) {
       return false;
     }
-    AddEvent(
-        new HtmlCommentEvent(NewCommentNode(lexer_->Parent(), escaped), 0));
+    AddEvent(new (&object_pool_) HtmlCommentEvent(
+        NewCommentNode(lexer_->Parent(), escaped), 0));
   }
   return true;
 }
@@ -1304,7 +1397,7 @@ void HtmlParse::DeferCurrentNode() {
   //      StartElement event is not in the flush window.  We avoid this
   //      case by requiring that callers run DeferCurentNode from the
   //      StartElement event.
-  HtmlEventList* node_events = new HtmlEventList;
+  HtmlEventList* node_events = new HtmlEventList(queue_.get_allocator());
   deferred_nodes_[node] = node_events;
   HtmlEventListIterator node_last = node->end();
   if (node_last != queue_.end()) {
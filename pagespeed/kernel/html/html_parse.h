@@ -38,6 +38,7 @@
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_name.h"
 #include "pagespeed/kernel/html/html_node.h"
+#include "pagespeed/kernel/html/html_object_pool.h"
 #include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/http/google_url.h"
 
@@ -438,6 +439,18 @@ class HtmlParse {
   // Run a filter on the current queue of parse nodes.
   void ApplyFilter(HtmlFilter* filter);
 
+  // Controls whether ApplyFilters fuses streaming-safe filters.  Off by
+  // default.
+  void set_fuse_streaming_filters(bool x) { fuse_streaming_filters_ = x; }
+  bool fuse_streaming_filters() const { return fuse_streaming_filters_; }
+
+  // Returns the number of traversals of the event queue made by filters in
+  // the most recent flush window, counting a fused run of filters as one.
+  // This is 0 if the most recent Flush did not release its events.
+  int filter_passes_in_last_flush() const {
+    return filter_passes_in_last_flush_;
+  }
+
   // Provide timer to helping to report timing of each filter.  You must also
   // set_log_rewrite_timing(true) to turn on this reporting.
   void set_timer(Timer* timer) { timer_ = timer; }
@@ -464,6 +477,19 @@ class HtmlParse {
   // Returns whether we have exceeded the size limit.
   bool size_limit_exceeded() const;
 
+  // Controls whether the lexer uses vectorized scans to skip over text that
+  // cannot change its state.  This is on by default and does not affect the
+  // parse results; turning it off is intended for tests and benchmarks.
+  void set_lexer_fast_scan_enabled(bool x);
+
+  // Events, event-list nodes and attributes are allocated from a pool that
+  // recycles memory from one flush window to the next, and is retained
+  // when the parser is reused for another document.  Disabling the pool
+  // sends those allocations to the heap; this is intended for tests and
+  // benchmarks.
+  void set_object_pool_enabled(bool x) { object_pool_.set_enabled(x); }
+  HtmlObjectPool* object_pool() { return &object_pool_; }
+
   // For debugging purposes. If this vector is supplied, DetermineEnabledFilters
   // will populate it with the list of Filters that were disabled, plus the
   // associated reason, if supplied by the Filter. Caller retains ownership
@@ -523,6 +549,13 @@ class HtmlParse {
   void BeginFinishParse();
   void EndFinishParse();
 
+  // Runs each enabled filter in the list on the current queue of parse
+  // nodes, in order.  If set_fuse_streaming_filters(true) has been called,
+  // runs of adjacent filters that are IsStreamingSafe() share a single
+  // traversal of the queue: each event is delivered to every filter in the
+  // run before the traversal moves on to the next event.
+  void ApplyFilters(const FilterList& filters);
+
   // Clears any cached state we have while this object is laying
   // around for recycling.
   void Clear();
@@ -607,6 +640,7 @@ class HtmlParse {
                   HtmlElement* new_parent);
   void CoalesceAdjacentCharactersNodes();
   void ClearEvents();
+  void ApplyFusedFilters();
   void EmitQueue(MessageHandler* handler);
   inline void NextEvent();
   void ClearDeferredNodes();
@@ -630,6 +664,8 @@ class HtmlParse {
   // right before calling the Filters.
   void DelayLiteralTag();
 
+  // Declared first so that it outlives every member holding pooled memory.
+  HtmlObjectPool object_pool_;
   FilterVector event_listeners_;
   SymbolTableSensitive string_table_;
   FilterList filters_;
@@ -654,11 +690,18 @@ class HtmlParse {
   bool log_rewrite_timing_;  // Should we time the speed of parsing?
   bool running_filters_;
   bool buffer_events_;
+  bool fuse_streaming_filters_;
+  int num_filter_passes_;
+  int filter_passes_in_last_flush_;
   int64 parse_start_time_us_;
   std::unique_ptr<HtmlEvent> delayed_start_literal_;
   Timer* timer_;
   HtmlFilter* current_filter_;  // Filter currently running in ApplyFilter
 
+  // Streaming-safe filters collected by ApplyFilters, waiting to be run
+  // together by ApplyFusedFilters.
+  FilterVector fused_filters_;
+
   // When deferring a node that spans a flush window, we present upstream
   // filters with a view of the event-stream that is not impacted by the
   // deferral.  To implement this, at the beginning of each flush window,
@@ -59,6 +59,7 @@ class HtmlWriterFilter : public HtmlFilter {
   void set_max_column(int max_column) { max_column_ = max_column; }
   void set_case_fold(bool case_fold) { case_fold_ = case_fold; }
 
+  bool IsStreamingSafe() const override { return true; }
   const char* Name() const override { return "HtmlWriter"; }
 
  protected:
@@ -63,6 +63,7 @@ const ContentType kTypes[] = {
     // be very careful not to just lump them in with images for all purposes, to
     // avoid creating security vulnerabilities.
     {"image/svg+xml", ".svg", ContentType::kXml},
+    {"image/avif", ".avif", ContentType::kAvif},
 
     // Synonyms; Note that the canonical types above are referenced by index
     // in the named references declared below.  The synonyms below are not
@@ -124,6 +125,7 @@ const ContentType& kContentTypeJpeg = kTypes[9];
 const ContentType& kContentTypeSwf = kTypes[10];
 const ContentType& kContentTypeWebp = kTypes[11];
 const ContentType& kContentTypeIco = kTypes[12];
+const ContentType& kContentTypeAvif = kTypes[18];
 
 const ContentType& kContentTypeJson = kTypes[13];
 const ContentType& kContentTypeSourceMap = kTypes[14];
@@ -133,7 +135,7 @@ const ContentType& kContentTypePdf = kTypes[15];
 const ContentType& kContentTypeBinaryOctetStream = kTypes[16];
 
 int ContentType::MaxProducedExtensionLength() {
-  return 4;  // .jpeg or .webp
+  return 4;  // .jpeg, .webp or .avif
 }
 
 bool ContentType::IsCss() const { return type_ == kCss; }
@@ -184,6 +186,7 @@ bool ContentType::IsImage() const {
     case kGif:
     case kJpeg:
     case kWebp:
+    case kAvif:
       return true;
     default:
       return false;
@@ -319,6 +322,7 @@ bool ContentType::IsLikelyStaticResource() const {
     case kVideo:
     case kAudio:
     case kWebp:
+    case kAvif:
       return true;
   };
   LOG(DFATAL) << "Unexpected content type: " << type_;
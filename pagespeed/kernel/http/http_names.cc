@@ -74,6 +74,7 @@ const char HttpAttributes::kProxyAuthenticate[] = "Proxy-Authenticate";
 const char HttpAttributes::kProxyAuthorization[] = "Proxy-Authorization";
 const char HttpAttributes::kPublic[] = "public";
 const char HttpAttributes::kPurpose[] = "Purpose";
+const char HttpAttributes::kRange[] = "Range";
 const char HttpAttributes::kReferer[] = "Referer";  // sic
 const char HttpAttributes::kRefresh[] = "Refresh";
 const char HttpAttributes::kSaveData[] = "Save-Data";
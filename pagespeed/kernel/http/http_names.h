@@ -78,6 +78,7 @@ struct HttpAttributes {
   static const char kProxyAuthorization[];
   static const char kPublic[];
   static const char kPurpose[];
+  static const char kRange[];
   static const char kReferer[];  // sic
   static const char kRefresh[];
   static const char kSaveData[];
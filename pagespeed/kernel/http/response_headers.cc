@@ -216,6 +216,7 @@ void ResponseHeaders::Clear() {
   proto->clear_reason_phrase();
   proto->clear_header();
   proto->clear_is_implicitly_cacheable();
+  proto->clear_stale_while_revalidate_ms();
   cache_fields_dirty_ = false;
   force_cache_ttl_ms_ = -1;
   force_cached_ = false;
@@ -369,6 +370,11 @@ bool ResponseHeaders::ReadFromBinary(const StringPiece& buf,
   return Headers<HttpResponseHeaders>::ReadFromBinary(buf, message_handler);
 }
 
+void ResponseHeaders::ReadFromProto(const HttpResponseHeaders& proto) {
+  Clear();
+  Headers<HttpResponseHeaders>::CopyProto(proto);
+}
+
 // Serialize meta-data to a binary stream.
 bool ResponseHeaders::WriteAsHttp(Writer* writer,
                                   MessageHandler* handler) const {
@@ -458,6 +464,12 @@ bool ResponseHeaders::IsProxyCacheable(
   return true;
 }
 
+int64 ResponseHeaders::stale_while_revalidate_ms() const {
+  DCHECK(!cache_fields_dirty_)
+      << "Call ComputeCaching() before stale_while_revalidate_ms()";
+  return proto()->stale_while_revalidate_ms();
+}
+
 // Returns the ms-since-1970 absolute time when this resource
 // should be expired out of caches.
 int64 ResponseHeaders::CacheExpirationTimeMs() const {
@@ -796,9 +808,35 @@ void ResponseHeaders::ComputeCaching() {
     proto->set_expiration_time_ms(0);
     proto->set_proxy_cacheable(false);
   }
+  int64 stale_while_revalidate_sec = 0;
+  if (!proto->proxy_cacheable() || proto->requires_proxy_revalidation() ||
+      !ParseStaleWhileRevalidate(&stale_while_revalidate_sec)) {
+    stale_while_revalidate_sec = 0;
+  }
+  // Only serialize the window when there is one, so that responses without
+  // the directive keep their existing encoding.
+  if (stale_while_revalidate_sec > 0) {
+    proto->set_stale_while_revalidate_ms(stale_while_revalidate_sec *
+                                         Timer::kSecondMs);
+  } else {
+    proto->clear_stale_while_revalidate_ms();
+  }
   cache_fields_dirty_ = false;
 }
 
+bool ResponseHeaders::ParseStaleWhileRevalidate(int64* seconds) const {
+  ConstStringStarVector cc_values;
+  Lookup(HttpAttributes::kCacheControl, &cc_values);
+  for (auto value : cc_values) {
+    StringPiece name, arg;
+    if (ExtractNameAndValue(*value, &name, &arg) &&
+        StringCaseEqual(name, "stale-while-revalidate")) {
+      return StringToInt64(arg, seconds) && (*seconds > 0);
+    }
+  }
+  return false;
+}
+
 GoogleString ResponseHeaders::CacheControlValuesToPreserve() {
   GoogleString to_preserve;
   if (HasValue(HttpAttributes::kCacheControl, "no-transform")) {
@@ -811,7 +849,8 @@ GoogleString ResponseHeaders::CacheControlValuesToPreserve() {
   ConstStringStarVector cc_values;
   Lookup(HttpAttributes::kCacheControl, &cc_values);
   for (auto value : cc_values) {
-    if (StringCaseStartsWith(*value, "s-maxage=")) {
+    if (StringCaseStartsWith(*value, "s-maxage=") ||
+        StringCaseStartsWith(*value, "stale-while-revalidate=")) {
       to_preserve += ", " + *value;
     }
   }
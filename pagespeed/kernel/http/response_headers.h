@@ -100,6 +100,11 @@ class ResponseHeaders : public Headers<HttpResponseHeaders> {
   // ResponseHeadersParser.
   bool ReadFromBinary(const StringPiece& buf, MessageHandler* handler) override;
 
+  // Equivalent to ReadFromBinary of proto's serialization, where proto was
+  // captured (e.g. with CopyToProto) from headers just written with
+  // WriteAsBinary, but skips the parse.
+  void ReadFromProto(const HttpResponseHeaders& proto);
+
   // Serialize HTTP response header in HTTP format so it can be re-parsed.
   bool WriteAsHttp(Writer* writer, MessageHandler* handler) const override;
 
@@ -155,6 +160,13 @@ class ResponseHeaders : public Headers<HttpResponseHeaders> {
   // it's OK to serve stale content while freshening in the background.
   bool RequiresProxyRevalidation() const;
 
+  // How long after CacheExpirationTimeMs() a proxy may keep serving the
+  // response while it revalidates it in the background, from the
+  // Cache-Control stale-while-revalidate directive (RFC 5861).  Returns 0 if
+  // there is no such directive, or if the response is not proxy-cacheable
+  // or requires proxy revalidation.
+  int64 stale_while_revalidate_ms() const;
+
   // Note(sligocki): I think CacheExpirationTimeMs will return 0 if !IsCacheable
   // TODO(sligocki): Look through callsites and make sure this is being
   // interpreted correctly.
@@ -406,6 +418,9 @@ class ResponseHeaders : public Headers<HttpResponseHeaders> {
   // Returns true if the headers were changed.
   bool CombineContentTypes(const StringPiece& orig, const StringPiece& fresh);
 
+  // Finds a positive stale-while-revalidate=<seconds> in Cache-Control.
+  bool ParseStaleWhileRevalidate(int64* seconds) const;
+
   friend class ResponseHeadersTest;
   bool cache_fields_dirty_;
 
@@ -173,6 +173,13 @@ const char* kWebpAnimatedBlockedlist[] = {
     "*Firefox/64.*",
 };
 
+// Chromium-based Edge inherited Chromium's "accept: image/avif" long before
+// it could decode AVIF, which it only learned in Edge 121.
+const char* kAvifBlockedlist[] = {
+    "*Edg/7?.*",  "*Edg/8?.*",  "*Edg/9?.*",
+    "*Edg/10?.*", "*Edg/11?.*", "*Edg/120.*",
+};
+
 const char* kInsertDnsPrefetchAllowlist[] = {
     "*Chrome/*",
     "*Firefox/*",
@@ -340,6 +347,9 @@ UserAgentMatcher::UserAgentMatcher()
   for (int i = 0, n = arraysize(kWebpAnimatedBlockedlist); i < n; ++i) {
     supports_webp_animated_.Disallow(kWebpAnimatedBlockedlist[i]);
   }
+  for (int i = 0, n = arraysize(kAvifBlockedlist); i < n; ++i) {
+    supports_avif_.Disallow(kAvifBlockedlist[i]);
+  }
   for (int i = 0, n = arraysize(kInsertDnsPrefetchAllowlist); i < n; ++i) {
     supports_dns_prefetch_.Allow(kInsertDnsPrefetchAllowlist[i]);
   }
@@ -435,6 +445,10 @@ bool UserAgentMatcher::SupportsWebpAnimated(
   return supports_webp_animated_.Match(user_agent, false);
 }
 
+bool UserAgentMatcher::SupportsAvif(const StringPiece& user_agent) const {
+  return supports_avif_.Match(user_agent, true);
+}
+
 UserAgentMatcher::DeviceType UserAgentMatcher::GetDeviceTypeForUAAndHeaders(
     const StringPiece& user_agent,
     const RequestHeaders* request_headers) const {
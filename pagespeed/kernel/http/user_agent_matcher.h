@@ -107,6 +107,11 @@ class UserAgentMatcher {
   // out an "accept: webp" header.
   bool SupportsWebpAnimated(const StringPiece& user_agent) const;
 
+  // Returns false for user agents known to send "accept: image/avif"
+  // without being able to decode AVIF. Browsers that do support AVIF must
+  // still send that header.
+  bool SupportsAvif(const StringPiece& user_agent) const;
+
   // IE9 does not implement <link rel=dns-prefetch ...>. Instead it does DNS
   // preresolution when it sees <link rel=prefetch ...>. This method returns
   // true if the browser support DNS prefetch using rel=prefetch.
@@ -146,6 +151,7 @@ class UserAgentMatcher {
   FastWildcardGroup legacy_webp_;
   FastWildcardGroup supports_webp_lossless_alpha_;
   FastWildcardGroup supports_webp_animated_;
+  FastWildcardGroup supports_avif_;
   FastWildcardGroup supports_dns_prefetch_;
   FastWildcardGroup mobile_user_agents_;
   FastWildcardGroup tablet_user_agents_;
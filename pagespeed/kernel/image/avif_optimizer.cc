@@ -0,0 +1,334 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#include "pagespeed/kernel/image/avif_optimizer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/message_handler.h"
+
+#ifdef PAGESPEED_AVIF
+extern "C" {
+#include "avif/avif.h"
+}
+#endif
+
+namespace pagespeed {
+
+namespace image_compression {
+
+namespace {
+
+// libavif accepts larger images, but the RGB canvas and the AV1 encoder
+// both hold the whole image in memory, so keep to WebP's limit.
+const size_px kAvifMaxDimension = 16383;
+
+#ifdef PAGESPEED_AVIF
+// Maps a 0-100 quality to an AV1 quantizer, where 0 is lossless and 63 is
+// the coarsest.
+int QualityToQuantizer(int quality) {
+  quality = std::max(0, std::min(100, quality));
+  return ((100 - quality) * AVIF_QUANTIZER_WORST_QUALITY + 50) / 100;
+}
+#endif
+
+}  // namespace
+
+const int64 AvifConfiguration::kDefaultMaxPixels;
+
+AvifConfiguration::~AvifConfiguration() {}
+
+AvifFrameWriter::AvifFrameWriter(MessageHandler* handler)
+    : MultipleFrameWriter(handler),
+      image_spec_(nullptr),
+      frame_prepared_(false),
+      next_scanline_(0),
+      canvas_bytes_per_pixel_(0),
+      is_gray_(false),
+      quality_(0),
+      alpha_quality_(0),
+      speed_(0),
+      max_threads_(1),
+      max_pixels_(AvifConfiguration::kDefaultMaxPixels),
+      progress_hook_(nullptr),
+      progress_hook_data_(nullptr),
+      output_image_(nullptr) {}
+
+AvifFrameWriter::~AvifFrameWriter() {}
+
+bool AvifFrameWriter::IsAvailable() {
+#ifdef PAGESPEED_AVIF
+  return true;
+#else
+  return false;
+#endif
+}
+
+ScanlineStatus AvifFrameWriter::Initialize(const void* config,
+                                           GoogleString* out) {
+  if (config == nullptr) {
+    return PS_LOGGED_STATUS(PS_LOG_DFATAL, message_handler(),
+                            SCANLINE_STATUS_INVOCATION_ERROR, FRAME_AVIFWRITER,
+                            "missing AvifConfiguration*");
+  }
+#ifndef PAGESPEED_AVIF
+  return PS_LOGGED_STATUS(PS_LOG_INFO, message_handler(),
+                          SCANLINE_STATUS_UNSUPPORTED_FEATURE,
+                          FRAME_AVIFWRITER, "built without libavif");
+#else
+
+  const AvifConfiguration* avif_config =
+      static_cast<const AvifConfiguration*>(config);
+  quality_ = avif_config->quality;
+  alpha_quality_ = avif_config->alpha_quality;
+  speed_ = std::max(static_cast<int>(AVIF_SPEED_SLOWEST),
+                    std::min(static_cast<int>(AVIF_SPEED_FASTEST),
+                             avif_config->speed));
+  max_threads_ = std::max(1, avif_config->max_threads);
+  max_pixels_ = avif_config->max_pixels;
+  progress_hook_ = avif_config->progress_hook;
+  progress_hook_data_ = avif_config->user_data;
+
+  output_image_ = out;
+
+  return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+#endif
+}
+
+ScanlineStatus AvifFrameWriter::PrepareImage(const ImageSpec* image_spec) {
+  DVLOG(1) << image_spec->ToString();
+  if (image_spec_ != nullptr) {
+    return PS_LOGGED_STATUS(PS_LOG_DFATAL, message_handler(),
+                            SCANLINE_STATUS_INVOCATION_ERROR, FRAME_AVIFWRITER,
+                            "image already prepared");
+  }
+
+  if (image_spec->num_frames > 1) {
+    return PS_LOGGED_STATUS(
+        PS_LOG_INFO, message_handler(), SCANLINE_STATUS_UNSUPPORTED_FEATURE,
+        FRAME_AVIFWRITER, "animated AVIF is not supported");
+  }
+
+  if ((image_spec->height > kAvifMaxDimension) ||
+      (image_spec->width > kAvifMaxDimension)) {
+    return PS_LOGGED_STATUS(
+        PS_LOG_ERROR, message_handler(), SCANLINE_STATUS_UNSUPPORTED_FEATURE,
+        FRAME_AVIFWRITER, "each image dimension must be at most %d",
+        kAvifMaxDimension);
+  }
+
+  if ((image_spec->height < 1) || (image_spec->width < 1)) {
+    return PS_LOGGED_STATUS(
+        PS_LOG_ERROR, message_handler(), SCANLINE_STATUS_UNSUPPORTED_FEATURE,
+        FRAME_AVIFWRITER, "each image dimension must be at least 1");
+  }
+
+  if (static_cast<int64>(image_spec->width) * image_spec->height >
+      max_pixels_) {
+    return PS_LOGGED_STATUS(
+        PS_LOG_INFO, message_handler(), SCANLINE_STATUS_UNSUPPORTED_FEATURE,
+        FRAME_AVIFWRITER, "image has more than %lld pixels",
+        static_cast<long long>(max_pixels_));
+  }
+
+  image_spec_ = image_spec;
+  return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+}
+
+ScanlineStatus AvifFrameWriter::PrepareNextFrame(const FrameSpec* frame_spec) {
+  if (image_spec_ == nullptr) {
+    return PS_LOGGED_STATUS(PS_LOG_DFATAL, message_handler(),
+                            SCANLINE_STATUS_INVOCATION_ERROR, FRAME_AVIFWRITER,
+                            "PrepareNextFrame: image not prepared");
+  }
+
+  if (frame_prepared_) {
+    return PS_LOGGED_STATUS(PS_LOG_DFATAL, message_handler(),
+                            SCANLINE_STATUS_INVOCATION_ERROR, FRAME_AVIFWRITER,
+                            "PrepareNextFrame: no next frame");
+  }
+
+  if (!image_spec_->CanContainFrame(*frame_spec)) {
+    return PS_LOGGED_STATUS(PS_LOG_ERROR, message_handler(),
+                            SCANLINE_STATUS_INVOCATION_ERROR, FRAME_AVIFWRITER,
+                            "PrepareNextFrame: frame does not fit in image:\n"
+                            "%s\n%s",
+                            image_spec_->ToString().c_str(),
+                            frame_spec->ToString().c_str());
+  }
+
+  frame_spec_ = *frame_spec;
+  const bool covers_image = (frame_spec_.width == image_spec_->width) &&
+                            (frame_spec_.height == image_spec_->height);
+  switch (frame_spec_.pixel_format) {
+    case RGB_888:
+      is_gray_ = false;
+      break;
+    case RGBA_8888:
+      is_gray_ = false;
+      break;
+    case GRAY_8:
+      // AVIF can encode gray natively (YUV 4:0:0), but libavif only
+      // converts from RGB, so the luminance is replicated here.
+      is_gray_ = covers_image;
+      break;
+    default:
+      return PS_LOGGED_STATUS(PS_LOG_ERROR, message_handler(),
+                              SCANLINE_STATUS_INTERNAL_ERROR, FRAME_AVIFWRITER,
+                              "unknown pixel format: %d",
+                              frame_spec_.pixel_format);
+  }
+
+  // A frame smaller than the image leaves the rest of the canvas
+  // transparent, which needs an alpha channel.
+  canvas_bytes_per_pixel_ =
+      (frame_spec_.pixel_format == RGBA_8888 || !covers_image) ? 4 : 3;
+  canvas_.assign(static_cast<size_t>(image_spec_->width) *
+                     image_spec_->height * canvas_bytes_per_pixel_,
+                 0);
+
+  frame_prepared_ = true;
+  next_scanline_ = 0;
+  return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+}
+
+ScanlineStatus AvifFrameWriter::WriteNextScanline(const void* scanline_bytes) {
+  if (!frame_prepared_ || next_scanline_ >= frame_spec_.height) {
+    return PS_LOGGED_STATUS(PS_LOG_DFATAL, message_handler(),
+                            SCANLINE_STATUS_INVOCATION_ERROR, FRAME_AVIFWRITER,
+                            "WriteNextScanline: too many scanlines");
+  }
+
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(scanline_bytes);
+  const size_t row = frame_spec_.top + next_scanline_;
+  uint8_t* out =
+      &canvas_[(row * image_spec_->width + frame_spec_.left) *
+               canvas_bytes_per_pixel_];
+  const size_t in_bytes_per_pixel = GetBytesPerPixel(frame_spec_.pixel_format);
+  if (in_bytes_per_pixel == canvas_bytes_per_pixel_) {
+    memcpy(out, in, frame_spec_.width * in_bytes_per_pixel);
+  } else {
+    for (size_px col = 0; col < frame_spec_.width; ++col) {
+      if (frame_spec_.pixel_format == GRAY_8) {
+        out[0] = out[1] = out[2] = in[0];
+      } else {
+        memcpy(out, in, 3);
+      }
+      if (canvas_bytes_per_pixel_ == 4) {
+        out[3] = 0xff;
+      }
+      in += in_bytes_per_pixel;
+      out += canvas_bytes_per_pixel_;
+    }
+  }
+
+  ++next_scanline_;
+  return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+}
+
+ScanlineStatus AvifFrameWriter::FinalizeWrite() {
+  if (!frame_prepared_ || next_scanline_ < frame_spec_.height) {
+    return PS_LOGGED_STATUS(PS_LOG_DFATAL, message_handler(),
+                            SCANLINE_STATUS_INVOCATION_ERROR, FRAME_AVIFWRITER,
+                            "FinalizeWrite: not all scanlines written");
+  }
+
+  if (progress_hook_ != nullptr &&
+      !progress_hook_(0, progress_hook_data_)) {
+    return PS_LOGGED_STATUS(PS_LOG_INFO, message_handler(),
+                            SCANLINE_STATUS_TIMEOUT_ERROR, FRAME_AVIFWRITER,
+                            "timed out before encoding");
+  }
+
+#ifndef PAGESPEED_AVIF
+  // Initialize() has already failed.
+  return ScanlineStatus(SCANLINE_STATUS_UNSUPPORTED_FEATURE);
+#else
+  avifImage* image = avifImageCreate(
+      image_spec_->width, image_spec_->height, 8,
+      is_gray_ ? AVIF_PIXEL_FORMAT_YUV400 : AVIF_PIXEL_FORMAT_YUV420);
+  if (image == nullptr) {
+    return PS_LOGGED_STATUS(PS_LOG_ERROR, message_handler(),
+                            SCANLINE_STATUS_MEMORY_ERROR, FRAME_AVIFWRITER,
+                            "avifImageCreate()");
+  }
+
+  avifRGBImage rgb;
+  avifRGBImageSetDefaults(&rgb, image);
+  rgb.format = (canvas_bytes_per_pixel_ == 4) ? AVIF_RGB_FORMAT_RGBA
+                                              : AVIF_RGB_FORMAT_RGB;
+  rgb.pixels = canvas_.data();
+  rgb.rowBytes = image_spec_->width * canvas_bytes_per_pixel_;
+  avifResult result = avifImageRGBToYUV(image, &rgb);
+  if (result != AVIF_RESULT_OK) {
+    avifImageDestroy(image);
+    return PS_LOGGED_STATUS(PS_LOG_ERROR, message_handler(),
+                            SCANLINE_STATUS_INTERNAL_ERROR, FRAME_AVIFWRITER,
+                            "avifImageRGBToYUV(): %s",
+                            avifResultToString(result));
+  }
+
+  avifEncoder* encoder = avifEncoderCreate();
+  if (encoder == nullptr) {
+    avifImageDestroy(image);
+    return PS_LOGGED_STATUS(PS_LOG_ERROR, message_handler(),
+                            SCANLINE_STATUS_MEMORY_ERROR, FRAME_AVIFWRITER,
+                            "avifEncoderCreate()");
+  }
+  encoder->maxThreads = max_threads_;
+  encoder->speed = speed_;
+  encoder->minQuantizer = encoder->maxQuantizer = QualityToQuantizer(quality_);
+  encoder->minQuantizerAlpha = encoder->maxQuantizerAlpha =
+      QualityToQuantizer(alpha_quality_);
+
+  avifRWData encoded = AVIF_DATA_EMPTY;
+  result = avifEncoderWrite(encoder, image, &encoded);
+  avifEncoderDestroy(encoder);
+  avifImageDestroy(image);
+  if (result != AVIF_RESULT_OK) {
+    avifRWDataFree(&encoded);
+    return PS_LOGGED_STATUS(PS_LOG_ERROR, message_handler(),
+                            SCANLINE_STATUS_INTERNAL_ERROR, FRAME_AVIFWRITER,
+                            "avifEncoderWrite(): %s",
+                            avifResultToString(result));
+  }
+
+  // The encode can not be interrupted, so an image that finished past the
+  // deadline is dropped here instead.
+  if (progress_hook_ != nullptr &&
+      !progress_hook_(100, progress_hook_data_)) {
+    avifRWDataFree(&encoded);
+    return PS_LOGGED_STATUS(PS_LOG_INFO, message_handler(),
+                            SCANLINE_STATUS_TIMEOUT_ERROR, FRAME_AVIFWRITER,
+                            "encoding exceeded the deadline");
+  }
+
+  output_image_->append(reinterpret_cast<const char*>(encoded.data),
+                        encoded.size);
+  avifRWDataFree(&encoded);
+  return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+#endif
+}
+
+}  // namespace image_compression
+
+}  // namespace pagespeed
@@ -0,0 +1,149 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef PAGESPEED_KERNEL_IMAGE_AVIF_OPTIMIZER_H_
+#define PAGESPEED_KERNEL_IMAGE_AVIF_OPTIMIZER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/image/image_frame_interface.h"
+#include "pagespeed/kernel/image/image_util.h"
+#include "pagespeed/kernel/image/scanline_interface.h"
+#include "pagespeed/kernel/image/scanline_status.h"
+
+namespace net_instaweb {
+class MessageHandler;
+}
+
+namespace pagespeed {
+
+namespace image_compression {
+
+using net_instaweb::MessageHandler;
+
+struct AvifConfiguration : public ScanlineWriterConfig {
+  // This contains the subset of the avifEncoder settings we expose.
+
+  typedef bool (*AvifProgressHook)(int percent, void* user_data);
+
+  // 2048x2048. AV1 encode time grows with the pixel count and libavif can
+  // not interrupt an encode, so this is what bounds its cost up front.
+  static const int64 kDefaultMaxPixels = 4 * 1024 * 1024;
+
+  AvifConfiguration()
+      : quality(60),
+        alpha_quality(100),
+        speed(8),
+        max_threads(1),
+        max_pixels(kDefaultMaxPixels),
+        progress_hook(NULL),
+        user_data(NULL) {}
+
+  ~AvifConfiguration() override;
+
+  int quality;        // between 0 (smallest file) and 100 (best quality)
+  int alpha_quality;  // Between 0 (smallest size) and 100 (lossless).
+                      // Default is 100.
+  int speed;          // speed/size trade-off (0=slowest-smallest,
+                      // 10=fastest). Default is 8.
+  int max_threads;    // Number of threads libavif may use for the AV1
+                      // encode, including the calling one.
+  int64 max_pixels;   // Images with more pixels than this (width times
+                      // height) are rejected before anything is encoded.
+
+  // If non-NULL, called with 0 before the encode and with 100 once the
+  // encoded bytes are ready. libavif can not interrupt an encode in
+  // progress, so returning false from the second call is what discards
+  // an encode that ran past its deadline.
+  AvifProgressHook progress_hook;
+
+  void* user_data;  // Can be used by progress_hook. This
+                    // pointer remains owned by the client and
+                    // must remain valid until
+                    // AvifFrameWriter::FinalizeWrite() completes.
+};
+
+// AvifFrameWriter buffers a single frame and encodes it as a still AVIF
+// image in FinalizeWrite(). Animated images are rejected with
+// SCANLINE_STATUS_UNSUPPORTED_FEATURE.
+class AvifFrameWriter : public MultipleFrameWriter {
+ public:
+  explicit AvifFrameWriter(MessageHandler* handler);
+  ~AvifFrameWriter() override;
+
+  // Whether libavif is linked in, which takes building with
+  // --define avif=enabled. Without it Initialize() fails with
+  // SCANLINE_STATUS_UNSUPPORTED_FEATURE.
+  static bool IsAvailable();
+
+  // Sets the AVIF configuration to be 'config', which should be an
+  // AvifConfiguration* and should not be NULL.
+  ScanlineStatus Initialize(const void* config, GoogleString* out) override;
+
+  // image_spec must remain valid for the lifetime of AvifFrameWriter.
+  ScanlineStatus PrepareImage(const ImageSpec* image_spec) override;
+
+  // frame_spec must remain valid while the frame is being written.
+  ScanlineStatus PrepareNextFrame(const FrameSpec* frame_spec) override;
+
+  ScanlineStatus WriteNextScanline(const void* scanline_bytes) override;
+
+  ScanlineStatus FinalizeWrite() override;
+
+ private:
+  // This class does NOT own image_spec_.
+  const ImageSpec* image_spec_;
+  FrameSpec frame_spec_;
+
+  // Whether PrepareNextFrame() has been called for the single frame.
+  bool frame_prepared_;
+
+  // Zero-based index of the next scanline to be written.
+  size_px next_scanline_;
+
+  // Packed RGB or RGBA pixels for the whole image. Gray frames are
+  // replicated to RGB and encoded as monochrome.
+  std::vector<uint8_t> canvas_;
+  size_t canvas_bytes_per_pixel_;
+  bool is_gray_;
+
+  // Settings copied from the AvifConfiguration.
+  int quality_;
+  int alpha_quality_;
+  int speed_;
+  int max_threads_;
+  int64 max_pixels_;
+  AvifConfiguration::AvifProgressHook progress_hook_;
+  void* progress_hook_data_;
+
+  // Pointer to the AVIF output.
+  GoogleString* output_image_;
+
+  DISALLOW_COPY_AND_ASSIGN(AvifFrameWriter);
+};
+
+}  // namespace image_compression
+
+}  // namespace pagespeed
+
+#endif  // PAGESPEED_KERNEL_IMAGE_AVIF_OPTIMIZER_H_
@@ -29,6 +29,7 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/image/image_frame_interface.h"
+#include "pagespeed/kernel/image/image_resizer.h"
 #include "pagespeed/kernel/image/jpeg_utils.h"
 #include "pagespeed/kernel/image/pixel_format_optimizer.h"
 #include "pagespeed/kernel/image/read_image.h"
@@ -37,6 +38,12 @@
 #include "pagespeed/kernel/image/scanline_status.h"
 #include "pagespeed/kernel/image/scanline_utils.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <emmintrin.h>
+// SSE2 is part of the x86-64 baseline, so it needs no runtime check.
+#define PAGESPEED_IMAGE_ANALYSIS_SSE2 1
+#endif
+
 namespace pagespeed {
 
 namespace {
@@ -57,6 +64,134 @@ inline T AbsDif(T v1, T v2) {
   return (v1 >= v2 ? v1 - v2 : v2 - v1);
 }
 
+// Size of the square windows SSIM is computed over, and the distance between
+// neighboring windows.
+const int kSsimWindow = 8;
+const int kSsimStep = 4;
+
+// Stabilizing constants from the SSIM paper for 8-bit samples,
+// (0.01 * 255)^2 and (0.03 * 255)^2.
+const double kSsimC1 = 6.5025;
+const double kSsimC2 = 58.5225;
+
+// Length of the short side of the image, in pixels, that one pixel of the
+// downsampled image stands for.
+const int kSsimScaleDimension = 256;
+
+// Sums over a window of two images: of the pixels of each, of their squares,
+// and of their products.
+struct WindowSums {
+  float sum1;
+  float sum2;
+  float sum11;
+  float sum22;
+  float sum12;
+};
+
+double SsimFromSums(const WindowSums& sums, int num_pixels) {
+  const double n = num_pixels;
+  const double mean1 = sums.sum1 / n;
+  const double mean2 = sums.sum2 / n;
+  const double var1 = sums.sum11 / n - mean1 * mean1;
+  const double var2 = sums.sum22 / n - mean2 * mean2;
+  const double covar = sums.sum12 / n - mean1 * mean2;
+  return ((2 * mean1 * mean2 + kSsimC1) * (2 * covar + kSsimC2)) /
+         ((mean1 * mean1 + mean2 * mean2 + kSsimC1) *
+          (var1 + var2 + kSsimC2));
+}
+
+// Sums a window of any size, one pixel at a time. Only used for images
+// smaller than a kSsimWindow x kSsimWindow window.
+void SumWindow(const float* luma1, const float* luma2, int stride, int width,
+               int height, WindowSums* sums) {
+  WindowSums result = {0, 0, 0, 0, 0};
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const float p1 = luma1[y * stride + x];
+      const float p2 = luma2[y * stride + x];
+      result.sum1 += p1;
+      result.sum2 += p2;
+      result.sum11 += p1 * p1;
+      result.sum22 += p2 * p2;
+      result.sum12 += p1 * p2;
+    }
+  }
+  *sums = result;
+}
+
+#if defined(PAGESPEED_IMAGE_ANALYSIS_SSE2)
+
+// Adds up the lanes of v as (v0 + v2) + (v1 + v3).
+inline float FoldLanes(__m128 v) {
+  __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  return _mm_cvtss_f32(
+      _mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+// Sums a kSsimWindow x kSsimWindow window, four pixels at a time.
+void SumWindow8x8(const float* luma1, const float* luma2, int stride,
+                  WindowSums* sums) {
+  __m128 sum1 = _mm_setzero_ps();
+  __m128 sum2 = _mm_setzero_ps();
+  __m128 sum11 = _mm_setzero_ps();
+  __m128 sum22 = _mm_setzero_ps();
+  __m128 sum12 = _mm_setzero_ps();
+  for (int y = 0; y < kSsimWindow; ++y) {
+    const float* row1 = luma1 + y * stride;
+    const float* row2 = luma2 + y * stride;
+    for (int x = 0; x < kSsimWindow; x += 4) {
+      const __m128 p1 = _mm_loadu_ps(row1 + x);
+      const __m128 p2 = _mm_loadu_ps(row2 + x);
+      sum1 = _mm_add_ps(sum1, p1);
+      sum2 = _mm_add_ps(sum2, p2);
+      sum11 = _mm_add_ps(sum11, _mm_mul_ps(p1, p1));
+      sum22 = _mm_add_ps(sum22, _mm_mul_ps(p2, p2));
+      sum12 = _mm_add_ps(sum12, _mm_mul_ps(p1, p2));
+    }
+  }
+  sums->sum1 = FoldLanes(sum1);
+  sums->sum2 = FoldLanes(sum2);
+  sums->sum11 = FoldLanes(sum11);
+  sums->sum22 = FoldLanes(sum22);
+  sums->sum12 = FoldLanes(sum12);
+}
+
+#else
+
+// Sums a kSsimWindow x kSsimWindow window. Pixels are accumulated in four
+// lanes and the lanes folded in the order the SSE2 version uses, so that
+// both round the same way.
+void SumWindow8x8(const float* luma1, const float* luma2, int stride,
+                  WindowSums* sums) {
+  float lanes[5][4] = {{0}};
+  for (int y = 0; y < kSsimWindow; ++y) {
+    const float* row1 = luma1 + y * stride;
+    const float* row2 = luma2 + y * stride;
+    for (int x = 0; x < kSsimWindow; x += 4) {
+      for (int lane = 0; lane < 4; ++lane) {
+        const float p1 = row1[x + lane];
+        const float p2 = row2[x + lane];
+        lanes[0][lane] += p1;
+        lanes[1][lane] += p2;
+        lanes[2][lane] += p1 * p1;
+        lanes[3][lane] += p2 * p2;
+        lanes[4][lane] += p1 * p2;
+      }
+    }
+  }
+  float folded[5];
+  for (int i = 0; i < 5; ++i) {
+    folded[i] = (lanes[i][0] + lanes[i][2]) + (lanes[i][1] + lanes[i][3]);
+  }
+  sums->sum1 = folded[0];
+  sums->sum2 = folded[1];
+  sums->sum11 = folded[2];
+  sums->sum22 = folded[3];
+  sums->sum12 = folded[4];
+}
+
+#endif  // PAGESPEED_IMAGE_ANALYSIS_SSE2
+
 }  // namespace
 
 namespace image_compression {
@@ -397,6 +532,91 @@ bool AnalyzeImage(ImageFormat image_type, const void* image_buffer,
   return true;
 }
 
+bool ComputeDownscaledLuma(ImageFormat image_type, const void* image_buffer,
+                           size_t buffer_length, std::vector<float>* luma,
+                           int* width, int* height, MessageHandler* handler) {
+  std::unique_ptr<ScanlineReaderInterface> reader(CreateScanlineReader(
+      image_type, image_buffer, buffer_length, handler));
+  if (reader == nullptr) {
+    return false;
+  }
+
+  const int image_width = reader->GetImageWidth();
+  const int image_height = reader->GetImageHeight();
+  const int factor =
+      std::max(1, (std::min(image_width, image_height) +
+                   kSsimScaleDimension / 2) / kSsimScaleDimension);
+  ScanlineReaderInterface* source = reader.get();
+  std::unique_ptr<ScanlineResizer> resizer;
+  if (factor > 1) {
+    resizer = std::make_unique<ScanlineResizer>(handler);
+    if (!resizer->Initialize(reader.get(), image_width / factor,
+                             image_height / factor)) {
+      return false;
+    }
+    source = resizer.get();
+  }
+
+  const PixelFormat pixel_format = source->GetPixelFormat();
+  const int bytes_per_pixel = GetBytesPerPixel(pixel_format);
+  if (bytes_per_pixel == 0) {
+    PS_LOG_INFO(handler, "Unsupported pixel format for computing luma.");
+    return false;
+  }
+  const int out_width = source->GetImageWidth();
+  const int out_height = source->GetImageHeight();
+  luma->resize(static_cast<size_t>(out_width) * out_height);
+
+  float* out = luma->data();
+  int row = 0;
+  for (; row < out_height && source->HasMoreScanLines(); ++row) {
+    void* scanline = nullptr;
+    if (!source->ReadNextScanline(&scanline)) {
+      return false;
+    }
+    const uint8_t* in = static_cast<const uint8_t*>(scanline);
+    if (pixel_format == GRAY_8) {
+      for (int x = 0; x < out_width; ++x) {
+        out[x] = in[x];
+      }
+    } else {
+      for (int x = 0; x < out_width; ++x, in += bytes_per_pixel) {
+        out[x] = 0.299f * in[0] + 0.587f * in[1] + 0.114f * in[2];
+      }
+    }
+    out += out_width;
+  }
+  if (row != out_height) {
+    return false;
+  }
+
+  *width = out_width;
+  *height = out_height;
+  return true;
+}
+
+double Ssim(const float* luma1, const float* luma2, int width, int height) {
+  DCHECK_GT(width, 0);
+  DCHECK_GT(height, 0);
+  WindowSums sums;
+  if (width < kSsimWindow || height < kSsimWindow) {
+    SumWindow(luma1, luma2, width, width, height, &sums);
+    return SsimFromSums(sums, width * height);
+  }
+
+  double total = 0;
+  int num_windows = 0;
+  for (int y = 0; y + kSsimWindow <= height; y += kSsimStep) {
+    for (int x = 0; x + kSsimWindow <= width; x += kSsimStep) {
+      const int offset = y * width + x;
+      SumWindow8x8(luma1 + offset, luma2 + offset, width, &sums);
+      total += SsimFromSums(sums, kSsimWindow * kSsimWindow);
+      ++num_windows;
+    }
+  }
+  return total / num_windows;
+}
+
 }  // namespace image_compression
 
 }  // namespace pagespeed
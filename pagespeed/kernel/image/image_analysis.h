@@ -21,6 +21,7 @@
 #define PAGESPEED_KERNEL_IMAGE_IMAGE_ANALYSIS_H_
 
 #include <cstddef>
+#include <vector>
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/image/image_util.h"
@@ -94,6 +95,23 @@ bool AnalyzeImage(ImageFormat image_type, const void* image_buffer,
                   bool* has_transparency, bool* is_photo, int* quality,
                   ScanlineReaderInterface** reader, MessageHandler* handler);
 
+// Decodes the image and returns its luminance, 0.299 R + 0.587 G + 0.114 B
+// with alpha ignored, in "luma" as width x height floats. The image is first
+// shrunk by an integer factor of round(min(width, height) / 256), the
+// downsampling the authors of SSIM recommend for approximating what a viewer
+// sees; images under 384 pixels on their short side are used as they are.
+// Only the first frame of an animated image is read.
+bool ComputeDownscaledLuma(ImageFormat image_type, const void* image_buffer,
+                           size_t buffer_length, std::vector<float>* luma,
+                           int* width, int* height, MessageHandler* handler);
+
+// Returns the mean structural similarity (SSIM) of two luma planes of the
+// same size: 1 for identical images, lower as they differ more. The index is
+// computed over 8x8 windows placed every 4 pixels; a plane smaller than a
+// window is compared as a single window. On x86-64 the window sums use SSE2,
+// and give the same result as the portable code.
+double Ssim(const float* luma1, const float* luma2, int width, int height);
+
 }  // namespace image_compression
 
 }  // namespace pagespeed
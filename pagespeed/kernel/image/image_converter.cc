@@ -42,6 +42,8 @@ extern "C" {
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/image/image_frame_interface.h"
 #include "pagespeed/kernel/image/image_util.h"
 #include "pagespeed/kernel/image/jpeg_optimizer.h"
@@ -52,6 +54,45 @@ extern "C" {
 #include "pagespeed/kernel/image/scanline_utils.h"
 
 namespace {
+
+// Runs ImageConverter::ConvertPngToJpeg on its own thread.  All of the
+// inputs, and 'out', must outlive Join().
+class PngToJpegThread : public net_instaweb::ThreadSystem::Thread {
+ public:
+  PngToJpegThread(
+      net_instaweb::ThreadSystem* thread_system,
+      const pagespeed::image_compression::PngReaderInterface& png_reader,
+      const GoogleString& in,
+      const pagespeed::image_compression::JpegCompressionOptions& options,
+      GoogleString* out, MessageHandler* handler)
+      : Thread(thread_system, "png_to_jpeg",
+               net_instaweb::ThreadSystem::kJoinable),
+        png_reader_(png_reader),
+        in_(in),
+        options_(options),
+        out_(out),
+        handler_(handler),
+        success_(false) {}
+
+  void Run() override {
+    success_ = pagespeed::image_compression::ImageConverter::ConvertPngToJpeg(
+        png_reader_, in_, options_, out_, handler_);
+  }
+
+  // Only meaningful after Join().
+  bool success() const { return success_; }
+
+ private:
+  const pagespeed::image_compression::PngReaderInterface& png_reader_;
+  const GoogleString& in_;
+  const pagespeed::image_compression::JpegCompressionOptions& options_;
+  GoogleString* out_;
+  MessageHandler* handler_;
+  bool success_;
+
+  DISALLOW_COPY_AND_ASSIGN(PngToJpegThread);
+};
+
 // In some cases, converting a PNG to JPEG results in a smaller
 // file. This is at the cost of switching from lossless to lossy, so
 // we require that the savings are substantial before in order to do
@@ -264,8 +305,31 @@ bool ImageConverter::OptimizePngOrConvertToJpeg(
     const PngReaderInterface& png_struct_reader, const GoogleString& in,
     const JpegCompressionOptions& options, GoogleString* out, bool* is_out_png,
     MessageHandler* handler) {
-  bool jpeg_success =
-      ConvertPngToJpeg(png_struct_reader, in, options, out, handler);
+  return OptimizePngOrConvertToJpeg(png_struct_reader, in, options,
+                                    nullptr /* thread_system */, out,
+                                    is_out_png, handler);
+}
+
+bool ImageConverter::OptimizePngOrConvertToJpeg(
+    const PngReaderInterface& png_struct_reader, const GoogleString& in,
+    const JpegCompressionOptions& options, ThreadSystem* thread_system,
+    GoogleString* out, bool* is_out_png, MessageHandler* handler) {
+  // The two trials share nothing but their read-only inputs, so the JPEG
+  // one can run on a helper thread.  If the thread can't be started we fall
+  // back to running it here.
+  std::unique_ptr<PngToJpegThread> jpeg_thread;
+  if (thread_system != nullptr) {
+    jpeg_thread = std::make_unique<PngToJpegThread>(
+        thread_system, png_struct_reader, in, options, out, handler);
+    if (!jpeg_thread->Start()) {
+      jpeg_thread.reset();
+    }
+  }
+  bool jpeg_success = false;
+  if (jpeg_thread == nullptr) {
+    jpeg_success =
+        ConvertPngToJpeg(png_struct_reader, in, options, out, handler);
+  }
 
   // Try Optimizing the PNG.
   // TODO(satyanarayana): Try reusing the PNG structs for png->jpeg and optimize
@@ -274,6 +338,11 @@ bool ImageConverter::OptimizePngOrConvertToJpeg(
   bool png_success = PngOptimizer::OptimizePngBestCompression(
       png_struct_reader, in, &optimized_png_out, handler);
 
+  if (jpeg_thread != nullptr) {
+    jpeg_thread->Join();
+    jpeg_success = jpeg_thread->success();
+  }
+
   // Consider using jpeg's only if it gives substantial amount of byte savings.
   if (png_success &&
       (!jpeg_success ||
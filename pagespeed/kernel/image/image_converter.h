@@ -33,6 +33,7 @@
 
 namespace net_instaweb {
 class MessageHandler;
+class ThreadSystem;
 }
 
 namespace pagespeed {
@@ -40,6 +41,7 @@ namespace pagespeed {
 namespace image_compression {
 
 using net_instaweb::MessageHandler;
+using net_instaweb::ThreadSystem;
 
 class PngReaderInterface;
 
@@ -104,6 +106,15 @@ class ImageConverter {
       const JpegCompressionOptions& options, GoogleString* out,
       bool* is_out_png, MessageHandler* handler);
 
+  // As above, but if 'thread_system' is non-NULL the JPEG trial runs on a
+  // helper thread while the calling thread optimizes the PNG, which roughly
+  // halves the wall time.  'png_struct_reader' must be safe to use from two
+  // threads at once, which is true of PngReader and GifReader.
+  static bool OptimizePngOrConvertToJpeg(
+      const PngReaderInterface& png_struct_reader, const GoogleString& in,
+      const JpegCompressionOptions& options, ThreadSystem* thread_system,
+      GoogleString* out, bool* is_out_png, MessageHandler* handler);
+
   // Populates 'out' with a version of the input image 'in' resulting
   // in the smallest size, and returns the corresponding
   // ImageType. The image formats that are candidates for the output
@@ -210,6 +210,9 @@ ImageFormat ImageOptimizer::ImageTypeToImageFormat(
     case net_instaweb::IMAGE_WEBP_ANIMATED:
       image_format = IMAGE_WEBP;
       break;
+    case net_instaweb::IMAGE_AVIF:
+      image_format = IMAGE_AVIF;
+      break;
   }
   return image_format;
 }
@@ -225,6 +228,8 @@ bool ImageOptimizer::ConfigureWriter() {
   switch (optimized_format_) {
     case IMAGE_UNKNOWN:
     case IMAGE_GIF:
+    // AVIF output is produced by Image, not ImageOptimizer.
+    case IMAGE_AVIF:
       break;
     case IMAGE_PNG:
       png_config = std::make_unique<PngCompressParams>(
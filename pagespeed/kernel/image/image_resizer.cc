@@ -21,12 +21,23 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <memory>
+#include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/image/scanline_utils.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+// SSE2 is part of the x86-64 baseline. AVX2 code is compiled with a
+// function-level target attribute so the rest of the binary need not be
+// built with -mavx2; it is only called after checking the CPU at runtime.
+#define PAGESPEED_IMAGE_RESIZER_X86 1
+#define PAGESPEED_AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
 namespace pagespeed {
 
 namespace {
@@ -299,6 +310,424 @@ void ResizeRowAreaRGBA(const ResizeTableEntry* table, int pixels_per_row,
   }
 }
 
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+
+// Converts the 4 or 8 elements at in to floats.
+inline __m128 Load4Sse2(const float* in) { return _mm_loadu_ps(in); }
+
+inline __m128 Load4Sse2(const uint8_t* in) {
+  int32_t bytes;
+  memcpy(&bytes, in, sizeof(bytes));
+  const __m128i zero = _mm_setzero_si128();
+  __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+PAGESPEED_AVX2_FUNCTION
+inline __m256 Load8Avx2(const float* in) { return _mm256_loadu_ps(in); }
+
+PAGESPEED_AVX2_FUNCTION
+inline __m256 Load8Avx2(const uint8_t* in) {
+  __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in));
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+}
+
+// SSE2 versions of ResizeRowAreaRGB and ResizeRowAreaRGBA, which keep the
+// channels of a pixel in the lanes of one register. Each lane sees the same
+// sequence of float operations as the scalar code. The RGB version loads 4
+// bytes per pixel, so it only handles the first num_pixels outputs, which the
+// caller has checked do not read past the end of the row.
+void ResizeRowAreaRGBSse2(const ResizeTableEntry* table, int num_pixels,
+                          const uint8_t* in_data, float* out_data) {
+  for (int x = 0; x < num_pixels; ++x) {
+    const ResizeTableEntry& table_entry = table[x];
+    int in_idx = table_entry.first_index;
+    __m128 acc = _mm_mul_ps(Load4Sse2(in_data + in_idx),
+                            _mm_set1_ps(table_entry.first_weight));
+    for (in_idx += 3; in_idx < table_entry.last_index; in_idx += 3) {
+      acc = _mm_add_ps(acc, Load4Sse2(in_data + in_idx));
+    }
+    acc = _mm_add_ps(acc,
+                     _mm_mul_ps(Load4Sse2(in_data + table_entry.last_index),
+                                _mm_set1_ps(table_entry.last_weight)));
+    // The fourth lane is overwritten by the next pixel.
+    _mm_storeu_ps(out_data + 3 * x, acc);
+  }
+}
+
+void ResizeRowAreaRGBASse2(const ResizeTableEntry* table, int pixels_per_row,
+                           const uint8_t* in_data, float* out_data) {
+  for (int x = 0; x < pixels_per_row; ++x) {
+    const ResizeTableEntry& table_entry = table[x];
+    int in_idx = table_entry.first_index;
+    __m128 acc = _mm_mul_ps(Load4Sse2(in_data + in_idx),
+                            _mm_set1_ps(table_entry.first_weight));
+    for (in_idx += 4; in_idx < table_entry.last_index; in_idx += 4) {
+      acc = _mm_add_ps(acc, Load4Sse2(in_data + in_idx));
+    }
+    acc = _mm_add_ps(acc,
+                     _mm_mul_ps(Load4Sse2(in_data + table_entry.last_index),
+                                _mm_set1_ps(table_entry.last_weight)));
+    _mm_storeu_ps(out_data + 4 * x, acc);
+  }
+}
+
+#endif  // PAGESPEED_IMAGE_RESIZER_X86
+
+// Table of weights for a separable convolution filter. Output element i is
+// the sum, for k < entries[i].num_taps, of
+// weights[entries[i].weight_offset + k] times input element
+// entries[i].first_index + k. The weights of each entry sum to 1.
+struct FilterTable {
+  struct Entry {
+    int first_index;
+    int num_taps;
+    int weight_offset;
+  };
+  std::vector<Entry> entries;
+  std::vector<float> weights;
+};
+
+// The Lanczos kernel with 3 lobes, sinc(x) * sinc(x / 3) for |x| < 3.
+double Lanczos3(double x) {
+  const double kLobes = 3.0;
+  if (x == 0.0) {
+    return 1.0;
+  }
+  if (x <= -kLobes || x >= kLobes) {
+    return 0.0;
+  }
+  const double pi_x = M_PI * x;
+  return kLobes * sin(pi_x) * sin(pi_x / kLobes) / (pi_x * pi_x);
+}
+
+// Computes Lanczos3 weights for shrinking in_size elements to out_size by
+// ratio (>= 1). The kernel is stretched by ratio so that it also filters out
+// the frequencies the output cannot represent. Taps that would fall outside
+// of the input are dropped and the rest renormalized.
+bool CreateTableForLanczos3(int in_size, int out_size, double ratio,
+                            FilterTable* table, MessageHandler* handler) {
+  if (in_size <= 0 || out_size <= 0 || ratio <= 0) {
+    PS_LOG_DFATAL(handler, "The inputs must be positive values.");
+    return false;
+  }
+  // Weights this small do not change any output pixel.
+  const double kNegligibleWeight = 1.0E-6;
+  const double scale = std::max(ratio, 1.0);
+  const double support = 3.0 * scale;
+  table->entries.resize(out_size);
+  table->weights.clear();
+  std::vector<double> taps;
+  for (int i = 0; i < out_size; ++i) {
+    const double center = (i + 0.5) * ratio - 0.5;
+    int first = std::max(0, static_cast<int>(ceil(center - support)));
+    int last = std::min(in_size - 1, static_cast<int>(floor(center + support)));
+    first = std::min(first, in_size - 1);
+    last = std::max(last, first);
+    taps.clear();
+    double sum = 0;
+    for (int j = first; j <= last; ++j) {
+      taps.push_back(Lanczos3((j - center) / scale));
+      sum += taps.back();
+    }
+    if (sum <= 0) {
+      PS_LOG_DFATAL(handler, "Degenerate Lanczos weights.");
+      return false;
+    }
+    int begin = 0;
+    int end = static_cast<int>(taps.size());
+    while (end - begin > 1 && fabs(taps[begin] / sum) < kNegligibleWeight) {
+      ++begin;
+    }
+    while (end - begin > 1 && fabs(taps[end - 1] / sum) < kNegligibleWeight) {
+      --end;
+    }
+    FilterTable::Entry& entry = table->entries[i];
+    entry.first_index = first + begin;
+    entry.num_taps = end - begin;
+    entry.weight_offset = static_cast<int>(table->weights.size());
+    for (int k = begin; k < end; ++k) {
+      table->weights.push_back(static_cast<float>(taps[k] / sum));
+    }
+  }
+  return true;
+}
+
+// Convolves a row of pixels with kNumChannels channels by the table, whose
+// indices are in pixels. Shared by all pixel formats; the compiler unrolls
+// the channel loops.
+template <int kNumChannels>
+void ResizeRowFilter(const FilterTable& table, int first_pixel, int end_pixel,
+                     const uint8_t* in_data, float* out_data) {
+  for (int x = first_pixel; x < end_pixel; ++x) {
+    const FilterTable::Entry& entry = table.entries[x];
+    const float* weights = &table.weights[entry.weight_offset];
+    const uint8_t* in = in_data + kNumChannels * entry.first_index;
+    float acc[kNumChannels];
+    for (int c = 0; c < kNumChannels; ++c) {
+      acc[c] = in[c] * weights[0];
+    }
+    for (int k = 1; k < entry.num_taps; ++k) {
+      in += kNumChannels;
+      for (int c = 0; c < kNumChannels; ++c) {
+        acc[c] += in[c] * weights[k];
+      }
+    }
+    for (int c = 0; c < kNumChannels; ++c) {
+      out_data[kNumChannels * x + c] = acc[c];
+    }
+  }
+}
+
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+
+// SSE2 version of ResizeRowFilter for 3 or 4 channels, one pixel per
+// register. For 3 channels it reads a byte past each pixel and writes a float
+// past each output, so the caller must leave room for both.
+template <int kNumChannels>
+void ResizeRowFilterSse2(const FilterTable& table, int end_pixel,
+                         const uint8_t* in_data, float* out_data) {
+  for (int x = 0; x < end_pixel; ++x) {
+    const FilterTable::Entry& entry = table.entries[x];
+    const float* weights = &table.weights[entry.weight_offset];
+    const uint8_t* in = in_data + kNumChannels * entry.first_index;
+    __m128 acc = _mm_mul_ps(Load4Sse2(in), _mm_set1_ps(weights[0]));
+    for (int k = 1; k < entry.num_taps; ++k) {
+      in += kNumChannels;
+      acc = _mm_add_ps(acc, _mm_mul_ps(Load4Sse2(in), _mm_set1_ps(weights[k])));
+    }
+    _mm_storeu_ps(out_data + kNumChannels * x, acc);
+  }
+}
+
+#endif  // PAGESPEED_IMAGE_RESIZER_X86
+
+// Column kernels. For 0 <= i < size:
+//   ScaleRow:        out[i] = weight * in[i]
+//   AddRow:          out[i] += in[i]
+//   AddScaledRow:    out[i] += weight * in[i]
+//   QuantizeRow:     out[i] = clamp((in[i] + offset) * scale, 0, 255),
+//                    truncated to an integer
+// Every implementation performs the same float operations on each element,
+// so all of them produce identical results.
+template <class BufferType>
+void ScaleRowPortable(const BufferType* in, float weight, int size,
+                      float* out) {
+  for (int i = 0; i < size; ++i) {
+    out[i] = weight * in[i];
+  }
+}
+
+template <class BufferType>
+void AddRowPortable(const BufferType* in, int size, float* out) {
+  for (int i = 0; i < size; ++i) {
+    out[i] += in[i];
+  }
+}
+
+template <class BufferType>
+void AddScaledRowPortable(const BufferType* in, float weight, int size,
+                          float* out) {
+  for (int i = 0; i < size; ++i) {
+    out[i] += weight * in[i];
+  }
+}
+
+void QuantizeRowPortable(const float* in, float offset, float scale, int size,
+                         uint8_t* out) {
+  for (int i = 0; i < size; ++i) {
+    float value = (in[i] + offset) * scale;
+    value = std::min(std::max(value, 0.0f), 255.0f);
+    out[i] = static_cast<uint8_t>(value);
+  }
+}
+
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+
+template <class BufferType>
+void ScaleRowSse2(const BufferType* in, float weight, int size, float* out) {
+  const __m128 w = _mm_set1_ps(weight);
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(out + i, _mm_mul_ps(w, Load4Sse2(in + i)));
+  }
+  ScaleRowPortable(in + i, weight, size - i, out + i);
+}
+
+template <class BufferType>
+void AddRowSse2(const BufferType* in, int size, float* out) {
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(out + i,
+                  _mm_add_ps(_mm_loadu_ps(out + i), Load4Sse2(in + i)));
+  }
+  AddRowPortable(in + i, size - i, out + i);
+}
+
+template <class BufferType>
+void AddScaledRowSse2(const BufferType* in, float weight, int size,
+                      float* out) {
+  const __m128 w = _mm_set1_ps(weight);
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i),
+                                      _mm_mul_ps(w, Load4Sse2(in + i))));
+  }
+  AddScaledRowPortable(in + i, weight, size - i, out + i);
+}
+
+void QuantizeRowSse2(const float* in, float offset, float scale, int size,
+                     uint8_t* out) {
+  const __m128 off = _mm_set1_ps(offset);
+  const __m128 mul = _mm_set1_ps(scale);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 max_value = _mm_set1_ps(255.0f);
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    __m128 value = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(in + i), off), mul);
+    value = _mm_min_ps(_mm_max_ps(value, zero), max_value);
+    __m128i words = _mm_cvttps_epi32(value);
+    words = _mm_packs_epi32(words, words);
+    int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+    memcpy(out + i, &bytes, sizeof(bytes));
+  }
+  QuantizeRowPortable(in + i, offset, scale, size - i, out + i);
+}
+
+template <class BufferType>
+PAGESPEED_AVX2_FUNCTION void ScaleRowAvx2(const BufferType* in, float weight,
+                                          int size, float* out) {
+  const __m256 w = _mm256_set1_ps(weight);
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(w, Load8Avx2(in + i)));
+  }
+  ScaleRowSse2(in + i, weight, size - i, out + i);
+}
+
+template <class BufferType>
+PAGESPEED_AVX2_FUNCTION void AddRowAvx2(const BufferType* in, int size,
+                                        float* out) {
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    _mm256_storeu_ps(
+        out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), Load8Avx2(in + i)));
+  }
+  AddRowSse2(in + i, size - i, out + i);
+}
+
+template <class BufferType>
+PAGESPEED_AVX2_FUNCTION void AddScaledRowAvx2(const BufferType* in,
+                                              float weight, int size,
+                                              float* out) {
+  const __m256 w = _mm256_set1_ps(weight);
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    _mm256_storeu_ps(out + i,
+                     _mm256_add_ps(_mm256_loadu_ps(out + i),
+                                   _mm256_mul_ps(w, Load8Avx2(in + i))));
+  }
+  AddScaledRowSse2(in + i, weight, size - i, out + i);
+}
+
+PAGESPEED_AVX2_FUNCTION
+void QuantizeRowAvx2(const float* in, float offset, float scale, int size,
+                     uint8_t* out) {
+  const __m256 off = _mm256_set1_ps(offset);
+  const __m256 mul = _mm256_set1_ps(scale);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 max_value = _mm256_set1_ps(255.0f);
+  int i = 0;
+  for (; i + 8 <= size; i += 8) {
+    __m256 value =
+        _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(in + i), off), mul);
+    value = _mm256_min_ps(_mm256_max_ps(value, zero), max_value);
+    __m256i dwords = _mm256_cvttps_epi32(value);
+    __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(dwords),
+                                    _mm256_extracti128_si256(dwords, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packus_epi16(words, words));
+  }
+  QuantizeRowSse2(in + i, offset, scale, size - i, out + i);
+}
+
+image_compression::ScanlineResizer::Implementation DetectImplementation() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return image_compression::ScanlineResizer::kAvx2;
+  }
+  return image_compression::ScanlineResizer::kSse2;
+}
+
+#else
+
+image_compression::ScanlineResizer::Implementation DetectImplementation() {
+  return image_compression::ScanlineResizer::kPortable;
+}
+
+#endif  // PAGESPEED_IMAGE_RESIZER_X86
+
+// Dispatchers for the column kernels.
+template <class BufferType>
+void ScaleRow(image_compression::ScanlineResizer::Implementation impl,
+              const BufferType* in, float weight, int size, float* out) {
+  switch (impl) {
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+    case image_compression::ScanlineResizer::kAvx2:
+      return ScaleRowAvx2(in, weight, size, out);
+    case image_compression::ScanlineResizer::kSse2:
+      return ScaleRowSse2(in, weight, size, out);
+#endif
+    default:
+      return ScaleRowPortable(in, weight, size, out);
+  }
+}
+
+template <class BufferType>
+void AddRow(image_compression::ScanlineResizer::Implementation impl,
+            const BufferType* in, int size, float* out) {
+  switch (impl) {
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+    case image_compression::ScanlineResizer::kAvx2:
+      return AddRowAvx2(in, size, out);
+    case image_compression::ScanlineResizer::kSse2:
+      return AddRowSse2(in, size, out);
+#endif
+    default:
+      return AddRowPortable(in, size, out);
+  }
+}
+
+template <class BufferType>
+void AddScaledRow(image_compression::ScanlineResizer::Implementation impl,
+                  const BufferType* in, float weight, int size, float* out) {
+  switch (impl) {
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+    case image_compression::ScanlineResizer::kAvx2:
+      return AddScaledRowAvx2(in, weight, size, out);
+    case image_compression::ScanlineResizer::kSse2:
+      return AddScaledRowSse2(in, weight, size, out);
+#endif
+    default:
+      return AddScaledRowPortable(in, weight, size, out);
+  }
+}
+
+void QuantizeRow(image_compression::ScanlineResizer::Implementation impl,
+                 const float* in, float offset, float scale, int size,
+                 uint8_t* out) {
+  switch (impl) {
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+    case image_compression::ScanlineResizer::kAvx2:
+      return QuantizeRowAvx2(in, offset, scale, size, out);
+    case image_compression::ScanlineResizer::kSse2:
+      return QuantizeRowSse2(in, offset, scale, size, out);
+#endif
+    default:
+      return QuantizeRowPortable(in, offset, scale, size, out);
+  }
+}
+
 }  // namespace
 
 namespace image_compression {
@@ -355,13 +784,24 @@ class ResizeCol {
   virtual void InitializeResize() {}
   virtual bool NeedMoreScanlines() const = 0;
   virtual int out_row() const = 0;
+
+  // Computes the next output row entirely from input rows already passed to
+  // Resize(). Only called if NeedMoreScanlines() is false right after
+  // InitializeResize(), which happens for filters wide enough that several
+  // output rows depend on the same last input row.
+  virtual const uint8_t* ResizeBuffered() {
+    LOG(DFATAL) << "No buffered rows to resize.";
+    return nullptr;
+  }
 };
 
 // Base class for the horizontal resizer using the "area" method.
 class ResizeRowArea : public ResizeRow {
  public:
-  explicit ResizeRowArea(int num_channels)
-      : num_channels_(num_channels), output_buffer_(nullptr) {}
+  ResizeRowArea(int num_channels, ScanlineResizer::Implementation impl)
+      : num_channels_(num_channels),
+        implementation_(impl),
+        output_buffer_(nullptr) {}
 
   bool Initialize(int in_size, int out_size, double ratio, float* output_buffer,
                   MessageHandler* handler) override;
@@ -369,7 +809,11 @@ class ResizeRowArea : public ResizeRow {
 
  protected:
   const int num_channels_;
+  const ScanlineResizer::Implementation implementation_;
   int pixels_per_row_;
+  // Number of leading output pixels for which the SSE2 RGB kernel, which
+  // loads 4 bytes per pixel, stays within the input row.
+  int pixels_within_row_;
   float* output_buffer_;  // Not owned
   net_instaweb::scoped_array<ResizeTableEntry> table_;
 };
@@ -384,10 +828,18 @@ bool ResizeRowArea::Initialize(int in_size, int out_size, double ratio,
     return false;
   }
 
-  // Modify the indices so they are based on bytes instead of pixels.
+  // Modify the indices so they are based on bytes instead of pixels. The SSE2
+  // RGB path loads 4 bytes at last_index and stores 4 floats for each
+  // 3-channel output pixel, so neither may run past the end of its row; the
+  // store rules out the last output pixel regardless of the input.
+  const int bytes_per_row = in_size * num_channels_;
+  pixels_within_row_ = out_size - 1;
   for (int i = 0; i < out_size; ++i) {
     table_[i].first_index *= num_channels_;
     table_[i].last_index *= num_channels_;
+    if (table_[i].last_index + 4 > bytes_per_row) {
+      pixels_within_row_ = std::min(pixels_within_row_, i);
+    }
   }
   pixels_per_row_ = out_size;
   output_buffer_ = output_buffer;
@@ -404,9 +856,26 @@ const void* ResizeRowArea::Resize(const uint8_t* in_data) {
       ResizeRowAreaGray(table_.get(), pixels_per_row_, in_data, output_buffer_);
       break;
     case 3:  // RGB_888
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+      if (implementation_ != ScanlineResizer::kPortable) {
+        // Finish the pixels near the end of the row with the scalar code.
+        const int done = pixels_within_row_;
+        ResizeRowAreaRGBSse2(table_.get(), done, in_data, output_buffer_);
+        ResizeRowAreaRGB(table_.get() + done, pixels_per_row_ - done, in_data,
+                         output_buffer_ + 3 * done);
+        break;
+      }
+#endif
       ResizeRowAreaRGB(table_.get(), pixels_per_row_, in_data, output_buffer_);
       break;
     case 4:  // RGBA_8888
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+      if (implementation_ != ScanlineResizer::kPortable) {
+        ResizeRowAreaRGBASse2(table_.get(), pixels_per_row_, in_data,
+                              output_buffer_);
+        break;
+      }
+#endif
       ResizeRowAreaRGBA(table_.get(), pixels_per_row_, in_data, output_buffer_);
       break;
   }
@@ -418,7 +887,8 @@ const void* ResizeRowArea::Resize(const uint8_t* in_data) {
 template <class BufferType>
 class ResizeColArea : public ResizeCol {
  public:
-  ResizeColArea() : output_buffer_(nullptr) {}
+  explicit ResizeColArea(ScanlineResizer::Implementation impl)
+      : implementation_(impl), output_buffer_(nullptr) {}
 
   bool Initialize(int in_size, int out_size, double ratio_x, double ratio_y,
                   int elements_per_output_row, uint8_t* output_buffer,
@@ -438,13 +908,11 @@ class ResizeColArea : public ResizeCol {
   void AppendLastRow(const BufferType* in_data, float weight);
   void ComputeOutput(const float* in_data, uint8_t* out_data);
 
+  const ScanlineResizer::Implementation implementation_;
   net_instaweb::scoped_array<ResizeTableEntry> table_;
   net_instaweb::scoped_array<float> buffer_;
   uint8_t* output_buffer_;  // Not owned
   int elements_per_row_;
-  // elements_per_row_4_ is the largest multiple of 4 which is smaller than
-  // elements_per_row_.
-  int elements_per_row_4_;
   int in_row_;
   int out_row_;
   int num_out_rows_;
@@ -482,79 +950,32 @@ bool ResizeColArea<BufferType>::Initialize(int in_size, int out_size,
   num_out_rows_ = out_size;
   need_more_scanlines_ = true;
   elements_per_row_ = elements_per_output_row;
-  // elements_per_row_4_ is the largest multiplier of 4 which is smaller than
-  // elements_per_row_.
-  elements_per_row_4_ = (elements_per_output_row & ~3);
   return true;
 }
 
-// To speed up computation, loop unrolling is used in AppendFirstRow()
-// AppendMiddleRow(), AppendLastRow(), and ComputeOutput().
 template <class BufferType>
 void ResizeColArea<BufferType>::AppendFirstRow(const BufferType* in_data,
                                                float weight) {
-  int index = 0;
-  for (; index < elements_per_row_4_; index += 4) {
-    buffer_[index] = weight * in_data[index];
-    buffer_[index + 1] = weight * in_data[index + 1];
-    buffer_[index + 2] = weight * in_data[index + 2];
-    buffer_[index + 3] = weight * in_data[index + 3];
-  }
-  for (; index < elements_per_row_; ++index) {
-    buffer_[index] = weight * in_data[index];
-  }
+  ScaleRow(implementation_, in_data, weight, elements_per_row_, buffer_.get());
 }
 
 template <class BufferType>
 void ResizeColArea<BufferType>::AppendMiddleRow(const BufferType* in_data) {
-  int index = 0;
-  for (; index < elements_per_row_4_; index += 4) {
-    buffer_[index] += in_data[index];
-    buffer_[index + 1] += in_data[index + 1];
-    buffer_[index + 2] += in_data[index + 2];
-    buffer_[index + 3] += in_data[index + 3];
-  }
-  for (; index < elements_per_row_; ++index) {
-    buffer_[index] += in_data[index];
-  }
+  AddRow(implementation_, in_data, elements_per_row_, buffer_.get());
 }
 
 template <class BufferType>
 void ResizeColArea<BufferType>::AppendLastRow(const BufferType* in_data,
                                               float weight) {
-  int index = 0;
-  for (; index < elements_per_row_4_; index += 4) {
-    buffer_[index] += weight * in_data[index];
-    buffer_[index + 1] += weight * in_data[index + 1];
-    buffer_[index + 2] += weight * in_data[index + 2];
-    buffer_[index + 3] += weight * in_data[index + 3];
-  }
-  for (; index < elements_per_row_; ++index) {
-    buffer_[index] += weight * in_data[index];
-  }
+  AddScaledRow(implementation_, in_data, weight, elements_per_row_,
+               buffer_.get());
 }
 
 template <class BufferType>
 void ResizeColArea<BufferType>::ComputeOutput(const float* in_data,
                                               uint8_t* out_data) {
-  int index = 0;
-  // Make local copies of the data in order to speed up computation.
-  const float half_grid_area = half_grid_area_;
-  const float inv_grid_area = inv_grid_area_;
-  for (; index < elements_per_row_4_; index += 4) {
-    out_data[index] =
-        static_cast<uint8_t>((in_data[index] + half_grid_area) * inv_grid_area);
-    out_data[index + 1] = static_cast<uint8_t>(
-        (in_data[index + 1] + half_grid_area) * inv_grid_area);
-    out_data[index + 2] = static_cast<uint8_t>(
-        (in_data[index + 2] + half_grid_area) * inv_grid_area);
-    out_data[index + 3] = static_cast<uint8_t>(
-        (in_data[index + 3] + half_grid_area) * inv_grid_area);
-  }
-  for (; index < elements_per_row_; ++index) {
-    out_data[index] =
-        static_cast<uint8_t>((in_data[index] + half_grid_area) * inv_grid_area);
-  }
+  QuantizeRow(implementation_, in_data, half_grid_area_, inv_grid_area_,
+              elements_per_row_, out_data);
 }
 
 // Resize the image vertically and output a row.
@@ -608,16 +1029,207 @@ const uint8_t* ResizeColArea<BufferType>::Resize(const void* in_data_ptr) {
   return output_buffer_;
 }
 
+// Horizontal resizer for all pixel formats using the Lanczos3 filter.
+class ResizeRowLanczos : public ResizeRow {
+ public:
+  ResizeRowLanczos(int num_channels, ScanlineResizer::Implementation impl)
+      : num_channels_(num_channels),
+        implementation_(impl),
+        output_buffer_(nullptr) {}
+
+  bool Initialize(int in_size, int out_size, double ratio, float* output_buffer,
+                  MessageHandler* handler) override;
+  const void* Resize(const uint8_t* in_data) override;
+
+ private:
+  const int num_channels_;
+  const ScanlineResizer::Implementation implementation_;
+  FilterTable table_;
+  int pixels_per_row_;
+  // Number of leading output pixels for which the SSE2 RGB kernel, which
+  // reads and writes one element past each pixel, stays within the rows.
+  int pixels_within_row_;
+  float* output_buffer_;  // Not owned
+};
+
+bool ResizeRowLanczos::Initialize(int in_size, int out_size, double ratio,
+                                  float* output_buffer,
+                                  MessageHandler* handler) {
+  if ((num_channels_ != 1 && num_channels_ != 3 && num_channels_ != 4) ||
+      output_buffer == nullptr ||
+      !CreateTableForLanczos3(in_size, out_size, ratio, &table_, handler)) {
+    return false;
+  }
+  pixels_within_row_ = out_size - 1;
+  for (int i = 0; i < out_size - 1; ++i) {
+    const FilterTable::Entry& entry = table_.entries[i];
+    if (entry.first_index + entry.num_taps >= in_size) {
+      pixels_within_row_ = i;
+      break;
+    }
+  }
+  pixels_per_row_ = out_size;
+  output_buffer_ = output_buffer;
+  return true;
+}
+
+const void* ResizeRowLanczos::Resize(const uint8_t* in_data) {
+  switch (num_channels_) {
+    case 1:  // GRAY_8
+      ResizeRowFilter<1>(table_, 0, pixels_per_row_, in_data, output_buffer_);
+      break;
+    case 3:  // RGB_888
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+      if (implementation_ != ScanlineResizer::kPortable) {
+        ResizeRowFilterSse2<3>(table_, pixels_within_row_, in_data,
+                               output_buffer_);
+        ResizeRowFilter<3>(table_, pixels_within_row_, pixels_per_row_,
+                           in_data, output_buffer_);
+        break;
+      }
+#endif
+      ResizeRowFilter<3>(table_, 0, pixels_per_row_, in_data, output_buffer_);
+      break;
+    case 4:  // RGBA_8888
+#ifdef PAGESPEED_IMAGE_RESIZER_X86
+      if (implementation_ != ScanlineResizer::kPortable) {
+        ResizeRowFilterSse2<4>(table_, pixels_per_row_, in_data,
+                               output_buffer_);
+        break;
+      }
+#endif
+      ResizeRowFilter<4>(table_, 0, pixels_per_row_, in_data, output_buffer_);
+      break;
+  }
+  return output_buffer_;
+}
+
+// Vertical resizer for all pixel formats using the Lanczos3 filter. It keeps
+// the most recent horizontally resized rows in a ring, as many as any output
+// row needs, so the image is still streamed a scanline at a time.
+class ResizeColLanczos : public ResizeCol {
+ public:
+  explicit ResizeColLanczos(ScanlineResizer::Implementation impl)
+      : implementation_(impl), output_buffer_(nullptr) {}
+
+  bool Initialize(int in_size, int out_size, double ratio_x, double ratio_y,
+                  int elements_per_output_row, uint8_t* output_buffer,
+                  MessageHandler* handler) override;
+  const uint8_t* Resize(const void* in_data_ptr) override;
+  const uint8_t* ResizeBuffered() override;
+  void InitializeResize() override { UpdateNeedMoreScanlines(); }
+  bool NeedMoreScanlines() const override { return need_more_scanlines_; }
+  int out_row() const override { return out_row_; }
+
+ private:
+  void UpdateNeedMoreScanlines();
+  void ComputeOutput();
+  float* RingRow(int row) {
+    return ring_.get() + (row % num_ring_rows_) * elements_per_row_;
+  }
+
+  const ScanlineResizer::Implementation implementation_;
+  FilterTable table_;
+  net_instaweb::scoped_array<float> ring_;
+  net_instaweb::scoped_array<float> accumulator_;
+  uint8_t* output_buffer_;  // Not owned
+  int num_ring_rows_;
+  int elements_per_row_;
+  int in_row_;
+  int out_row_;
+  int num_out_rows_;
+  bool need_more_scanlines_;
+};
+
+bool ResizeColLanczos::Initialize(int in_size, int out_size,
+                                  double /* ratio_x */, double ratio_y,
+                                  int elements_per_output_row,
+                                  uint8_t* output_buffer,
+                                  MessageHandler* handler) {
+  if (output_buffer == nullptr ||
+      !CreateTableForLanczos3(in_size, out_size, ratio_y, &table_, handler)) {
+    return false;
+  }
+  // Row out_row is computed once the last row it or any earlier output row
+  // depends on has been read, so the ring must reach back from there to its
+  // own first row.
+  num_ring_rows_ = 1;
+  int last_row_read = 0;
+  for (const FilterTable::Entry& entry : table_.entries) {
+    last_row_read =
+        std::max(last_row_read, entry.first_index + entry.num_taps - 1);
+    num_ring_rows_ =
+        std::max(num_ring_rows_, last_row_read - entry.first_index + 1);
+  }
+  elements_per_row_ = elements_per_output_row;
+  ring_.reset(new float[num_ring_rows_ * elements_per_row_]);
+  accumulator_.reset(new float[elements_per_row_]);
+  output_buffer_ = output_buffer;
+  in_row_ = 0;
+  out_row_ = 0;
+  num_out_rows_ = out_size;
+  need_more_scanlines_ = true;
+  return true;
+}
+
+void ResizeColLanczos::UpdateNeedMoreScanlines() {
+  if (out_row_ >= num_out_rows_) {
+    need_more_scanlines_ = false;
+    return;
+  }
+  const FilterTable::Entry& entry = table_.entries[out_row_];
+  need_more_scanlines_ = (entry.first_index + entry.num_taps > in_row_);
+}
+
+void ResizeColLanczos::ComputeOutput() {
+  const FilterTable::Entry& entry = table_.entries[out_row_];
+  const float* weights = &table_.weights[entry.weight_offset];
+  float* acc = accumulator_.get();
+  ScaleRow(implementation_, RingRow(entry.first_index), weights[0],
+           elements_per_row_, acc);
+  for (int k = 1; k < entry.num_taps; ++k) {
+    AddScaledRow(implementation_, RingRow(entry.first_index + k), weights[k],
+                 elements_per_row_, acc);
+  }
+  // Round to the nearest integer; the negative lobes can overshoot.
+  QuantizeRow(implementation_, acc, 0.5f, 1.0f, elements_per_row_,
+              output_buffer_);
+  ++out_row_;
+}
+
+const uint8_t* ResizeColLanczos::Resize(const void* in_data_ptr) {
+  memcpy(RingRow(in_row_), in_data_ptr, elements_per_row_ * sizeof(float));
+  ++in_row_;
+  UpdateNeedMoreScanlines();
+  if (!need_more_scanlines_) {
+    ComputeOutput();
+  }
+  return output_buffer_;
+}
+
+const uint8_t* ResizeColLanczos::ResizeBuffered() {
+  DCHECK(!need_more_scanlines_);
+  ComputeOutput();
+  return output_buffer_;
+}
+
 // Instantiate the resizers. It is based on the pixel format as well as the
 // resizing ratios.
 template <class BufferType>
 bool InstantiateResizers(pagespeed::image_compression::PixelFormat pixel_format,
+                         ScanlineResizer::Filter filter,
+                         ScanlineResizer::Implementation impl,
                          std::unique_ptr<ResizeRow>* resizer_x,
                          std::unique_ptr<ResizeCol>* resizer_y,
                          MessageHandler* handler) {
   const int num_channels = GetNumChannelsFromPixelFormat(pixel_format, handler);
-  *resizer_x = std::make_unique<ResizeRowArea>(num_channels);
-  resizer_y->reset(new ResizeColArea<BufferType>());
+  if (filter == ScanlineResizer::kLanczos3) {
+    *resizer_x = std::make_unique<ResizeRowLanczos>(num_channels, impl);
+    *resizer_y = std::make_unique<ResizeColLanczos>(impl);
+  } else {
+    *resizer_x = std::make_unique<ResizeRowArea>(num_channels, impl);
+    resizer_y->reset(new ResizeColArea<BufferType>(impl));
+  }
   return (resizer_x->get() != nullptr && resizer_y->get() != nullptr);
 }
 
@@ -627,8 +1239,28 @@ ScanlineResizer::ScanlineResizer(MessageHandler* handler)
       height_(0),
       elements_per_row_(0),
       bytes_per_buffer_row_(0),
+      filter_(kArea),
+      implementation_(best_implementation()),
       message_handler_(handler) {}
 
+ScanlineResizer::Implementation ScanlineResizer::best_implementation() {
+  // Function-local statics are initialized thread-safely.
+  static const Implementation best = DetectImplementation();
+  return best;
+}
+
+bool ScanlineResizer::IsSupported(Implementation impl) {
+  switch (impl) {
+    case kPortable:
+      return true;
+    case kSse2:
+      return best_implementation() != kPortable;
+    case kAvx2:
+      return best_implementation() == kAvx2;
+  }
+  return false;
+}
+
 ScanlineResizer::~ScanlineResizer() {}
 
 // Reset the scanline reader to its initial state.
@@ -662,8 +1294,11 @@ ScanlineStatus ScanlineResizer::ReadNextScanlineWithStatus(
   }
 
   // Fetch scanlines from the reader until we have enough input rows for
-  // computing an output row.
+  // computing an output row. Wide filters may already have them all.
   resizer_y_->InitializeResize();
+  if (!resizer_y_->NeedMoreScanlines()) {
+    *out_scanline_bytes = const_cast<uint8_t*>(resizer_y_->ResizeBuffered());
+  }
   while (resizer_y_->NeedMoreScanlines()) {
     if (!reader_->HasMoreScanLines()) {
       return PS_LOGGED_STATUS(PS_LOG_INFO, message_handler_,
@@ -693,6 +1328,7 @@ ScanlineStatus ScanlineResizer::ReadNextScanlineWithStatus(
 // - If ratio_x is an integer but ratio_y is not, use integer for the
 //   horizontal resizer and floating point for the vertical resizer;
 // - Otherwise, use floating point for all computation.
+// The Lanczos filter always resizes in both directions through float buffers.
 bool ScanlineResizer::Initialize(ScanlineReaderInterface* reader,
                                  size_t request_width, size_t request_height) {
   if (reader == nullptr || reader->GetImageWidth() == 0 ||
@@ -752,13 +1388,15 @@ bool ScanlineResizer::Initialize(ScanlineReaderInterface* reader,
   // x == 1 && y != 1 | Shortcut  | NULL   | uint8   | Resize & Scale | Valid
   // x == 1 && y == 1 | Shortcut  | NULL   | uint8   | Shortcut       | NULL
 
-  const bool need_resize_x = (ratio_x != 1.0);
-  const bool need_resize_y = (ratio_y != 1.0);
+  DCHECK(IsSupported(implementation_));
+  const bool use_lanczos = (filter_ == kLanczos3);
+  const bool need_resize_x = (ratio_x != 1.0 || use_lanczos);
+  const bool need_resize_y = (ratio_y != 1.0 || use_lanczos);
   float* resizer_x_buffer = nullptr;
   uint8_t* resizer_y_buffer = nullptr;
   if (need_resize_x) {
-    InstantiateResizers<float>(pixel_format, &resizer_x_, &resizer_y_,
-                               message_handler_);
+    InstantiateResizers<float>(pixel_format, filter_, implementation_,
+                               &resizer_x_, &resizer_y_, message_handler_);
     buffer_.reset(new float[elements_per_row_]);
     resizer_x_buffer = buffer_.get();
     output_.reset(new uint8_t[elements_per_row_]);
@@ -767,8 +1405,8 @@ bool ScanlineResizer::Initialize(ScanlineReaderInterface* reader,
       return false;
     }
   } else {
-    InstantiateResizers<uint8_t>(pixel_format, &resizer_x_, &resizer_y_,
-                                 message_handler_);
+    InstantiateResizers<uint8_t>(pixel_format, filter_, implementation_,
+                                 &resizer_x_, &resizer_y_, message_handler_);
     if (need_resize_y) {
       output_.reset(new uint8_t[elements_per_row_]);
       resizer_y_buffer = output_.get();
@@ -49,11 +49,45 @@ class ResizeCol;
 //
 // Currently, ScanlineResizer only supports shrinking. It works best when the
 // image shrinks significantly, e.g, by more than 2x times.
+//
+// The row and column kernels process 4 (SSE2) or 8 (AVX2, selected at runtime
+// if the CPU supports it) floats at a time on x86-64, and fall back to
+// portable scalar loops elsewhere. All implementations produce identical
+// pixels.
 class ScanlineResizer : public ScanlineReaderInterface {
  public:
+  // How output pixels are computed from the input.
+  enum Filter {
+    // Averages the input area covered by each output pixel. Fast, and the
+    // best choice for large integer ratios.
+    kArea,
+    // Three-lobed windowed sinc. Keeps edges sharper than kArea, especially
+    // for small or fractional ratios, at a few times the cost.
+    kLanczos3,
+  };
+
+  enum Implementation {
+    kPortable,
+    kSse2,
+    kAvx2,
+  };
+
   explicit ScanlineResizer(MessageHandler* handler);
   ~ScanlineResizer() override;
 
+  // Both take effect at the next Initialize(). The defaults are kArea and
+  // best_implementation(); the implementation must be supported on this CPU.
+  void set_filter(Filter filter) { filter_ = filter; }
+  void set_implementation(Implementation implementation) {
+    implementation_ = implementation;
+  }
+
+  // Returns whether impl can run on this CPU.
+  static bool IsSupported(Implementation impl);
+
+  // The fastest implementation supported on this CPU.
+  static Implementation best_implementation();
+
   // Initializes the resizer with a reader and the desired output size.
   bool Initialize(ScanlineReaderInterface* reader, size_t output_width,
                   size_t output_height);
@@ -109,6 +143,8 @@ class ScanlineResizer : public ScanlineReaderInterface {
   // Buffer for storing the intermediate results.
   net_instaweb::scoped_array<float> buffer_;
   int bytes_per_buffer_row_;
+  Filter filter_;
+  Implementation implementation_;
   MessageHandler* message_handler_;
 
   DISALLOW_COPY_AND_ASSIGN(ScanlineResizer);
@@ -19,6 +19,8 @@
 
 #include "pagespeed/kernel/image/image_util.h"
 
+#include <algorithm>
+
 #include "external/libwebp/src/webp/decode.h"
 #include "pagespeed/kernel/base/countdown_timer.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -36,6 +38,12 @@ const char kPngHeader[] = "\x89PNG\r\n\x1a\n";
 const size_t kPngHeaderLength = arraysize(kPngHeader) - 1;
 const char kGifHeader[] = "GIF8";
 const size_t kGifHeaderLength = arraysize(kGifHeader) - 1;
+// An AVIF file is an ISO-BMFF file whose leading 'ftyp' box names "avif"
+// (still) or "avis" (sequence) as its major or one of its compatible brands.
+const char kIsoBmffFtyp[] = "ftyp";
+const char kAvifBrand[] = "avif";
+const char kAvifSequenceBrand[] = "avis";
+const size_t kIsoBmffTagLength = 4;
 
 // char to int *without sign extension*.
 inline int CharToInt(char c) {
@@ -43,6 +51,32 @@ inline int CharToInt(char c) {
   return static_cast<int>(uc);
 }
 
+// Returns true if buf starts with an ISO-BMFF 'ftyp' box listing an AVIF
+// brand.  The box is laid out as a 32-bit big-endian size, "ftyp", the major
+// brand, a 32-bit minor version, and then the compatible brands.
+bool IsAvif(const StringPiece& buf) {
+  if (buf.size() < 4 * kIsoBmffTagLength ||
+      buf.substr(kIsoBmffTagLength, kIsoBmffTagLength) != kIsoBmffFtyp) {
+    return false;
+  }
+  uint32 box_size = 0;
+  for (size_t i = 0; i < kIsoBmffTagLength; ++i) {
+    box_size = (box_size << 8) | CharToInt(buf[i]);
+  }
+  size_t box_end = std::min(static_cast<size_t>(box_size), buf.size());
+  for (size_t pos = 2 * kIsoBmffTagLength; pos + kIsoBmffTagLength <= box_end;
+       pos += kIsoBmffTagLength) {
+    if (pos == 3 * kIsoBmffTagLength) {
+      continue;  // The minor version, not a brand.
+    }
+    StringPiece brand = buf.substr(pos, kIsoBmffTagLength);
+    if (brand == kAvifBrand || brand == kAvifSequenceBrand) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 namespace image_compression {
@@ -59,6 +93,8 @@ const char* ImageFormatToMimeTypeString(ImageFormat image_type) {
       return "image/gif";
     case IMAGE_WEBP:
       return "image/webp";
+    case IMAGE_AVIF:
+      return "image/avif";
       // No default so compiler will complain if any enum is not processed.
   }
   return kInvalidImageFormat;
@@ -76,6 +112,8 @@ const char* ImageFormatToString(ImageFormat image_type) {
       return "IMAGE_GIF";
     case IMAGE_WEBP:
       return "IMAGE_WEBP";
+    case IMAGE_AVIF:
+      return "IMAGE_AVIF";
       // No default so compiler will complain if any enum is not processed.
   }
   return kInvalidImageFormat;
@@ -160,6 +198,12 @@ net_instaweb::ImageType ComputeImageType(const StringPiece& buf) {
           }
         }
         break;
+      case 0x00:
+        // Possible AVIF; the 'ftyp' box is far smaller than 16MB.
+        if (IsAvif(buf)) {
+          image_type = net_instaweb::IMAGE_AVIF;
+        }
+        break;
       default:
         break;
     }
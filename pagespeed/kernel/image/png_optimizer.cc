@@ -1071,6 +1071,7 @@ PngScanlineWriter::PngScanlineWriter(MessageHandler* handler)
       row_(0),
       pixel_format_(UNSUPPORTED),
       was_initialized_(false),
+      is_interlaced_(false),
       message_handler_(handler) {}
 
 PngScanlineWriter::~PngScanlineWriter() {}
@@ -1224,7 +1225,12 @@ ScanlineStatus PngScanlineWriter::InitializeWriteWithStatus(
 
   png_write_info(png_ptr, info_ptr);
   try_best_compression_ = png_params->try_best_compression;
-  pixel_buffer_.reset(new unsigned char[height_ * bytes_per_row_]);
+  is_interlaced_ = png_params->is_progressive;
+  if (is_interlaced_) {
+    pixel_buffer_.reset(new unsigned char[height_ * bytes_per_row_]);
+  } else {
+    pixel_buffer_.reset();
+  }
   was_initialized_ = true;
   return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
 }
@@ -1233,9 +1239,22 @@ ScanlineStatus PngScanlineWriter::InitializeWriteWithStatus(
 ScanlineStatus PngScanlineWriter::WriteNextScanlineWithStatus(
     const void* const scanline_bytes) {
   if (was_initialized_ && row_ < height_) {
-    // Buffer the scanlines.
-    memcpy(pixel_buffer_.get() + row_ * bytes_per_row_, scanline_bytes,
-           bytes_per_row_);
+    if (is_interlaced_) {
+      // Buffer the scanlines.
+      memcpy(pixel_buffer_.get() + row_ * bytes_per_row_, scanline_bytes,
+             bytes_per_row_);
+    } else {
+      png_structp png_ptr = png_struct_->png_ptr();
+      if (setjmp(png_jmpbuf(png_ptr)) != 0) {
+        // Jump to here if any error happens.
+        Reset();
+        return PS_LOGGED_STATUS(PS_LOG_INFO, message_handler_,
+                                SCANLINE_STATUS_INTERNAL_ERROR,
+                                SCANLINE_PNGWRITER,
+                                "libpng failed to compress the image.");
+      }
+      png_write_row(png_ptr, static_cast<png_const_bytep>(scanline_bytes));
+    }
     ++row_;
     return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
   }
@@ -1253,15 +1272,28 @@ ScanlineStatus PngScanlineWriter::FinalizeWriteWithStatus() {
         SCANLINE_PNGWRITER, "not initialized or not all rows written");
   }
 
-  net_instaweb::scoped_array<unsigned char*> row_pointers(
-      new unsigned char*[height_]);
-  for (size_t row = 0; row < height_; ++row) {
-    row_pointers[row] = pixel_buffer_.get() + row * bytes_per_row_;
+  png_structp png_ptr = png_struct_->png_ptr();
+  png_infop info_ptr = png_struct_->info_ptr();
+  if (setjmp(png_jmpbuf(png_ptr)) != 0) {
+    // Jump to here if any error happens.
+    Reset();
+    return PS_LOGGED_STATUS(PS_LOG_INFO, message_handler_,
+                            SCANLINE_STATUS_INTERNAL_ERROR, SCANLINE_PNGWRITER,
+                            "libpng failed to compress the image.");
+  }
+
+  if (is_interlaced_) {
+    net_instaweb::scoped_array<unsigned char*> row_pointers(
+        new unsigned char*[height_]);
+    for (size_t row = 0; row < height_; ++row) {
+      row_pointers[row] = pixel_buffer_.get() + row * bytes_per_row_;
+    }
+    png_set_rows(png_ptr, info_ptr, row_pointers.get());
+    png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, nullptr);
+  } else {
+    // The rows have all been written already.
+    png_write_end(png_ptr, info_ptr);
   }
-  png_set_rows(png_struct_->png_ptr(), png_struct_->info_ptr(),
-               row_pointers.get());
-  png_write_png(png_struct_->png_ptr(), png_struct_->info_ptr(),
-                PNG_TRANSFORM_IDENTITY, nullptr);
 
   if (try_best_compression_) {
     if (!DoBestCompression()) {
@@ -388,6 +388,10 @@ class PngScanlineWriter : public ScanlineWriterInterface {
   std::unique_ptr<ScopedPngStruct> png_struct_;
   bool was_initialized_;
   bool try_best_compression_;
+  // Interlaced output needs every row for each of its passes, so the rows are
+  // kept in pixel_buffer_ until FinalizeWrite().  Otherwise each row goes to
+  // libpng as it is written and memory use doesn't grow with the height.
+  bool is_interlaced_;
   net_instaweb::scoped_array<unsigned char> pixel_buffer_;
   MessageHandler* message_handler_;
 
@@ -25,6 +25,7 @@
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/image/avif_optimizer.h"
 #include "pagespeed/kernel/image/frame_interface_optimizer.h"
 #include "pagespeed/kernel/image/gif_reader.h"
 #include "pagespeed/kernel/image/image_frame_interface.h"
@@ -85,6 +86,9 @@ ScanlineReaderInterface* InstantiateScanlineReader(ImageFormat image_type,
       break;
     }
 
+    case IMAGE_AVIF:
+      // This library does not implement an AVIF reader; intentional
+      // fall-through.
     case IMAGE_UNKNOWN:
       break;
 
@@ -165,6 +169,12 @@ ScanlineWriterInterface* InstantiateScanlineWriter(ImageFormat image_type,
           InstantiateImageFrameWriter(image_type, handler, status));
       break;
 
+    case pagespeed::image_compression::IMAGE_AVIF:
+      which = "FrameToScanlineWriterAdapter(AvifFrameWriter)";
+      writer = new FrameToScanlineWriterAdapter(
+          InstantiateImageFrameWriter(image_type, handler, status));
+      break;
+
     case IMAGE_GIF:
       // This library does not implement a GIF writer; intentional
       // fall-through.
@@ -267,6 +277,13 @@ MultipleFrameWriter* InstantiateImageFrameWriter(ImageFormat image_type,
           PS_LOGGED_STATUS(PS_LOG_ERROR, handler, SCANLINE_STATUS_MEMORY_ERROR,
                            SCANLINE_UTIL, "failed to allocate WebpFrameReader");
     }
+  } else if (image_type == IMAGE_AVIF) {
+    allocated_writer = new AvifFrameWriter(handler);
+    if (allocated_writer == nullptr) {
+      *status =
+          PS_LOGGED_STATUS(PS_LOG_ERROR, handler, SCANLINE_STATUS_MEMORY_ERROR,
+                           SCANLINE_UTIL, "failed to allocate AvifFrameWriter");
+    }
   } else {
     // Image formats for which we do not have an ImageFrame
     // implementation result in a wrapper around the corresponding
@@ -357,6 +374,22 @@ bool ReadImage(ImageFormat image_type, const void* image_buffer,
   return true;
 }
 
+bool ReadsScanlinesInBands(ImageFormat image_type,
+                           ScanlineReaderInterface* reader) {
+  switch (image_type) {
+    case IMAGE_PNG:
+    case IMAGE_JPEG:
+      return !reader->IsProgressive();
+    case IMAGE_GIF:
+    case IMAGE_WEBP:
+    case IMAGE_AVIF:
+    case IMAGE_UNKNOWN:
+      break;
+      // No default so compiler will complain if any enum is not processed.
+  }
+  return false;
+}
+
 }  // namespace image_compression
 
 }  // namespace pagespeed
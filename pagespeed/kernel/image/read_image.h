@@ -149,6 +149,15 @@ bool ReadImage(ImageFormat image_type, const void* image_buffer,
                size_t* width, size_t* height, size_t* stride,
                MessageHandler* handler);
 
+// Returns true if 'reader', initialized with an image of 'image_type',
+// decodes it a few scanlines at a time, so that the memory it uses grows
+// with the width of the image but not its height. This is the case for
+// sequential JPEGs and non-interlaced PNGs. Progressive JPEGs and interlaced
+// PNGs, like GIFs and WebPs, are decoded whole before the first scanline is
+// returned.
+bool ReadsScanlinesInBands(ImageFormat image_type,
+                           ScanlineReaderInterface* reader);
+
 }  // namespace image_compression
 
 }  // namespace pagespeed
@@ -61,6 +61,7 @@ namespace image_compression {
       _X(SCANLINE_TO_FRAME_READER_ADAPTER),                                   \
       _X(SCANLINE_TO_FRAME_WRITER_ADAPTER), _X(FRAME_GIFREADER),              \
       _X(FRAME_WEBPWRITER), _X(FRAME_PADDING_READER),                         \
+      _X(FRAME_AVIFWRITER),                                                   \
                                                                               \
       _X(NUM_SCANLINE_SOURCE)
 
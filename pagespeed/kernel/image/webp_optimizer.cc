@@ -197,6 +197,7 @@ void WebpConfiguration::CopyTo(WebPConfig* webp_config) const {
   webp_config->lossless = lossless;
   webp_config->quality = quality;
   webp_config->method = method;
+  webp_config->thread_level = thread_level;
   webp_config->target_size = target_size;
   webp_config->alpha_compression = alpha_compression;
   webp_config->alpha_filtering = alpha_filtering;
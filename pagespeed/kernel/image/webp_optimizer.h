@@ -52,6 +52,7 @@ struct WebpConfiguration : public ScanlineWriterConfig {
       : lossless(true),
         quality(75),
         method(3),
+        thread_level(0),
         target_size(0),
         alpha_compression(1),
         alpha_filtering(1),
@@ -68,6 +69,8 @@ struct WebpConfiguration : public ScanlineWriterConfig {
   int lossless;   // Lossless encoding (0=lossy(default), 1=lossless).
   float quality;  // between 0 (smallest file) and 100 (biggest)
   int method;     // quality/speed trade-off (0=fast, 6=slower-better)
+  int thread_level;  // If non-zero, libwebp may spread the encode over
+                     // helper threads.  Output is the same either way.
 
   // Parameters related to lossy compression only:
   int target_size;        // if non-zero, set the desired target size in bytes.
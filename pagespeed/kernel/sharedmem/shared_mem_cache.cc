@@ -32,8 +32,9 @@
 //
 // When we access an entry, we first select a sector number based off its key,
 // and then within the sector we choose kAssociativity (4) possible
-// directory entries storing it, and the appropriate directory entry then
-// points to some number of blocks containing the object's payload.
+// directory entries storing it (or, with the kTaggedBuckets directory layout,
+// a bucket of 16), and the appropriate directory entry then points to some
+// number of blocks containing the object's payload.
 //
 // In each sector we store:
 //
@@ -63,6 +64,10 @@
 //    (But note that the size of the hash portion is dependent on the Hasher;
 //     and the struct is padded to be 8-aligned).
 //
+// With the kTaggedBuckets directory layout only, padding to align to 64 and:
+//
+// 6a) Key tags, one byte per directory entry.
+//
 // Padding to align to block size.
 //
 // 7) The data blocks. These contain the actual payload.
@@ -77,6 +82,19 @@
 // timestamps to determine replacement candidates. (Experiments have shown that
 // 2-way produced way too many extra conflicts).
 //
+// With the kTaggedBuckets layout, the directory is instead split into buckets
+// of 16 consecutive entries, and a key may live in any entry of the single
+// bucket its hash selects. Each entry also has a one-byte tag taken from
+// another part of the hash (0 meaning free), and as the tags of a bucket are
+// contiguous, one SSE2 compare finds the few entries whose full keys are worth
+// comparing. Replacement picks the oldest writeable entry of the bucket.
+//
+// If EnableAdmissionPolicy() was called, the least-recently-used candidate
+// is only replaced by a new key if it is not more popular than the new key
+// according to a TinyLFU frequency sketch. The sketches live in each
+// process's private memory, one per sector, and are protected by the sector
+// lock; each process thus judges popularity by the traffic it sees itself.
+//
 // ----------------------------------------------------------------------------
 // Cache entry format
 // ----------------------------------------------------------------------------
@@ -85,7 +103,8 @@
 // length may vary with the hasher in use.
 //
 // last_use_timestamp_ms denotes when the entry was last touched, for
-// associativity replacement.
+// associativity replacement.  last_write_timestamp_ms is when its value was
+// last written, for checkpointing.
 //
 // byte_size is the size of the actual payload in bytes (not counting
 // internal fragmentation or our bookkeeping overhead).
@@ -118,9 +137,68 @@
 // TODO(morlovich): Evaluate using chaining and one more layer of indirection
 // instead, as it should hopefully produce much better utilization and avoid
 // conflict misses entirely.
+//
+// ----------------------------------------------------------------------------
+// Resizing
+// ----------------------------------------------------------------------------
+//
+// Shared memory segments can only be created before the children fork, so a
+// cache that may be resized reserves a segment with two slots, each big enough
+// for the largest geometry allowed, preceded by a ResizeState control block
+// and its mutex. The sectors in use live in one slot; a resize formats the
+// other one with the new geometry and bumps ResizeState::generation, which
+// every operation checks (with one atomic load) to notice it should switch.
+//
+// While entries migrate, the old slot stays readable: Put and Delete first
+// remove the key from the old slot and then act on the new one, and Get falls
+// back to the old slot on a miss. Each old sector is migrated under its lock
+// and then flagged, after which nothing touches it, so the only values that
+// move are ones no newer write has superseded.
+//
+// Every operation pins the slots it uses by counting itself in
+// ResizeState::users, and a resize waits for the retired slot's count to drop
+// to zero before reformatting it.
+//
+// ----------------------------------------------------------------------------
+// Checkpointing
+// ----------------------------------------------------------------------------
+//
+// If a file cache is registered, every sector is checkpointed into its own
+// append-only file in the file cache's directory, on the file cache's worker
+// thread, once a put finds checkpoint_interval_sec has passed since the
+// sector's last_checkpoint_ms. A checkpoint only appends the entries written
+// since the previous one. Those were also used since, so they're found by
+// walking the LRU list from the front until an older use; entries that were
+// only read are skipped, as their value is already in the file, and the
+// timestamp it has there is good enough for replacement after a restart.
+// The walk just collects keys; values are then copied out
+// a batch at a time, with the sector lock dropped between batches, so neither
+// the lock hold time nor the memory used grows with the sector.
+//
+// Appending means the file also holds superseded, evicted and deleted
+// entries, so it's rewritten (into a temporary file renamed over it) instead
+// on the first checkpoint after Initialize, when it's missing, when it has
+// grown to kCheckpointRewriteRatio times the size of the sector, after a
+// Delete, and after a failed write.
+//
+// Each record is checksummed, and Initialize replays the files oldest record
+// first, several sectors in parallel, stopping at the first damaged record of
+// a file (as a crash while appending leaves one at its end).
+//
+// Which sector a key lands in depends on the geometry, so each file is named
+// for the geometry that wrote it as well as the sector, and only one
+// geometry's files are ever replayed together.  Replay goes through
+// PutRawHash, so it doesn't matter which geometry wrote them: Initialize
+// restores whichever was checkpointed most recently.  When that isn't the
+// current geometry -- the cache was resized, online or in the configuration
+// -- the new layout is checkpointed in full, and then the other geometries'
+// files are removed, so the files don't outgrow the cache.  A finished online
+// resize does the same.
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>  // for size_t
 #include <cstring>
 #include <map>
@@ -133,16 +211,21 @@
 #include "pagespeed/kernel/base/base64_util.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/hasher.h"
 #include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
 #include "pagespeed/kernel/base/proto_util.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/shared_string.h"
-#include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_cache_checkpoint.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_snapshot.pb.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
@@ -156,6 +239,9 @@ using SharedMemCacheData::EntryNum;
 using SharedMemCacheData::kHashSize;
 using SharedMemCacheData::kInvalidBlock;
 using SharedMemCacheData::kInvalidEntry;
+using SharedMemCacheData::KeyTag;
+using SharedMemCacheData::kNoTag;
+using SharedMemCacheData::kTagBucketWays;
 using SharedMemCacheData::Sector;
 using SharedMemCacheData::SectorStats;
 
@@ -165,6 +251,40 @@ namespace {
 // format.
 const int kSnapshotVersion = 1;
 
+// Likewise for the checkpoint file format.
+const int kCheckpointVersion = 1;
+
+// A checkpoint file is rewritten once it is this many times the size of its
+// sector.
+const int kCheckpointRewriteRatio = 2;
+
+// Most threads Initialize uses to restore checkpoints.
+const int kMaxRestoreThreads = 8;
+
+// Sectors are picked by one byte of the hash, so there is no use for more
+// than this many.  Bounds the per-sector overhead of resizable caches.
+const int kMaxSectors = 256;
+
+// An operation can find that the layout it picked was retired by a resize
+// while it was getting started, in which case it starts over with the new
+// one.  Resizes are rare and slow, so a few attempts are plenty.
+const int kMaxAttempts = 3;
+
+// How long StartResize waits for operations still using the spare half of
+// the segment to finish.  They take microseconds, so running out means one
+// is stuck, or its process died with the half pinned.
+const int64 kResizeDrainTimeoutMs = 1000;
+
+// Tag of a key in a tagged directory.  The bucket comes from hash bytes 4..7
+// and the sector from byte 12, so byte 13 is independent of both.
+KeyTag KeyTagForRawHash(const GoogleString& raw_hash) {
+  KeyTag tag = static_cast<unsigned char>(raw_hash[13]);
+  return (tag == kNoTag) ? 1 : tag;
+}
+
+static_assert(std::atomic<int64>::is_always_lock_free,
+              "Resizable SharedMemCache needs lock-free int64 atomics");
+
 bool IsAllNil(const StringPiece& raw_hash) {
   bool all_nil = true;
   for (size_t c = 0; c < raw_hash.length(); ++c) {
@@ -180,10 +300,57 @@ GoogleString FormatSize(size_t size) {
   return Integer64ToString(static_cast<int64>(size));
 }
 
+// Assumes align is power-of-2
+inline size_t AlignTo(size_t alignment, size_t in) {
+  return (in + (alignment - 1)) & ~(alignment - 1);
+}
+
 }  // namespace
 
-// If you add any new parameters also include them in SnapshotCacheKey() or else
-// people will restore invalid snapshots and have a corrupt cache.
+// Lives at the start of the segment of a resizable cache.  Everything but
+// the atomics is protected by the mutex that follows it.
+template <size_t kBlockSize>
+struct SharedMemCache<kBlockSize>::ResizeState {
+  // Incremented whenever anything below changes.
+  std::atomic<int64> generation;
+
+  // Number of operations, across all processes, using each slot.
+  std::atomic<int32> users[2];
+
+  // Which slot holds the current layout, and the geometry of each slot.
+  int32 active_slot;
+  int32 sectors[2];
+  int32 entries_per_sector[2];
+  int32 blocks_per_sector[2];
+  int64 format_generation[2];
+
+  // Whether entries are still moving out of the other slot, and how far
+  // along that is.
+  int32 migrating;
+  int32 next_migration_sector;
+  int32 migrated_sectors;
+};
+
+// Pins the current view for the duration of an operation.
+template <size_t kBlockSize>
+class SharedMemCache<kBlockSize>::ScopedView {
+ public:
+  explicit ScopedView(SharedMemCache<kBlockSize>* cache)
+      : cache_(cache), view_(cache->PinView()) {}
+  ~ScopedView() { cache_->UnpinView(view_); }
+
+  const View* operator->() const { return view_; }
+
+ private:
+  SharedMemCache<kBlockSize>* cache_;
+  View* view_;
+  DISALLOW_COPY_AND_ASSIGN(ScopedView);
+};
+
+// If you add any new parameters that change what a checkpointed entry means,
+// also include them in CheckpointDir() or else people will restore invalid
+// checkpoints and have a corrupt cache.  Those that only change where entries
+// go, like the geometry, are taken care of by replaying through PutRawHash.
 template <size_t kBlockSize>
 SharedMemCache<kBlockSize>::SharedMemCache(AbstractSharedMem* shm_runtime,
                                            const GoogleString& filename,
@@ -201,7 +368,14 @@ SharedMemCache<kBlockSize>::SharedMemCache(AbstractSharedMem* shm_runtime,
       checkpoint_interval_sec_(-1),
       handler_(handler),
       snapshot_path_(""),
-      file_cache_(nullptr) {}
+      file_cache_(nullptr),
+      max_size_kb_(0),
+      control_bytes_(0),
+      slot_bytes_(0),
+      resize_state_(nullptr),
+      view_(nullptr),
+      admission_policy_enabled_(false),
+      directory_layout_(kSkewAssociative) {}
 
 template <size_t kBlockSize>
 GoogleString SharedMemCache<kBlockSize>::FormatName() {
@@ -209,15 +383,35 @@ GoogleString SharedMemCache<kBlockSize>::FormatName() {
 }
 
 template <size_t kBlockSize>
-SharedMemCache<kBlockSize>::~SharedMemCache() {
-  STLDeleteElements(&sectors_);
-}
+SharedMemCache<kBlockSize>::~SharedMemCache() {}
 
 template <size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::InitCache(bool parent) {
-  size_t sector_size = Sector<kBlockSize>::RequiredSize(
-      shm_runtime_, entries_per_sector_, blocks_per_sector_);
-  size_t size = num_sectors_ * sector_size;
+  view_ = nullptr;
+  views_.clear();
+  layouts_.clear();
+  resize_mutex_.reset();
+  resize_state_ = nullptr;
+
+  size_t size = num_sectors_ * SectorSize(entries_per_sector_,
+                                          blocks_per_sector_);
+  size_t mutex_offset = AlignTo(8, sizeof(ResizeState));
+  if (max_size_kb_ > 0) {
+    // Each slot needs room for the configured geometry, and for whatever
+    // ComputeDimensions picks for max_size_kb_, which is that much payload
+    // plus rounding of each sector's metadata to a block, and of its entries
+    // to a bucket, plus any key tags.
+    size_t max_size =
+        max_size_kb_ * 1024 +
+        kMaxSectors * (SectorSize(kTagBucketWays, 0) + kBlockSize + 8);
+    if (directory_layout_ == kTaggedBuckets) {
+      max_size += max_size_kb_ * 1024 / sizeof(CacheEntry);
+    }
+    slot_bytes_ = AlignTo(kBlockSize, std::max(size, max_size));
+    control_bytes_ =
+        AlignTo(kBlockSize, mutex_offset + shm_runtime_->SharedMutexSize());
+    size = control_bytes_ + 2 * slot_bytes_;
+  }
 
   if (parent) {
     segment_.reset(shm_runtime_->CreateSegment(filename_, size, handler_));
@@ -232,28 +426,45 @@ bool SharedMemCache<kBlockSize>::InitCache(bool parent) {
     return false;
   }
 
-  STLDeleteElements(&sectors_);
-  sectors_.clear();
-  for (int s = 0; s < num_sectors_; ++s) {
-    std::unique_ptr<Sector<kBlockSize> > sec(
-        new Sector<kBlockSize>(segment_.get(), s * sector_size,
-                               entries_per_sector_, blocks_per_sector_));
-    bool ok;
-    if (parent) {
-      ok = sec->Initialize(handler_);
-    } else {
-      ok = sec->Attach(handler_);
-    }
-
-    if (!ok) {
+  if (max_size_kb_ > 0) {
+    if (parent && !segment_->InitializeSharedMutex(mutex_offset, handler_)) {
       handler_->Message(kError,
-                        "SharedMemCache: can't %s sector %d of cache %s",
-                        parent ? "create" : "attach", s, filename_.c_str());
+                        "SharedMemCache: can't create resize lock of cache %s",
+                        filename_.c_str());
       return false;
     }
-    sectors_.push_back(sec.release());
+    resize_mutex_.reset(segment_->AttachToSharedMutex(mutex_offset));
+    resize_state_ =
+        reinterpret_cast<ResizeState*>(const_cast<char*>(segment_->Base()));
   }
 
+  if (!parent && resize_state_ != nullptr) {
+    // The cache may have been resized since it was created.
+    return (RefreshView() != nullptr);
+  }
+
+  Layout* layout = NewLayout(0, num_sectors_, entries_per_sector_,
+                             blocks_per_sector_, parent);
+  if (layout == nullptr) {
+    return false;
+  }
+  std::unique_ptr<View> view(new View);
+  view->generation = 0;
+  view->current = layout;
+  view->previous = nullptr;
+  if (resize_state_ != nullptr) {
+    resize_state_->active_slot = 0;
+    resize_state_->sectors[0] = num_sectors_;
+    resize_state_->entries_per_sector[0] = entries_per_sector_;
+    resize_state_->blocks_per_sector[0] = blocks_per_sector_;
+    resize_state_->format_generation[0] = 1;
+    resize_state_->generation = 1;
+    view->generation = 1;
+    layout->format_generation = 1;
+  }
+  view_ = view.get();
+  views_.push_back(std::move(view));
+
   if (parent) {
     handler_->Message(kInfo,
                       "SharedMemCache: %s, sectors = %d, entries/sector = %d, "
@@ -265,11 +476,183 @@ bool SharedMemCache<kBlockSize>::InitCache(bool parent) {
   return true;
 }
 
+template <size_t kBlockSize>
+size_t SharedMemCache<kBlockSize>::SlotOffset(int slot) const {
+  return control_bytes_ + slot * slot_bytes_;
+}
+
+template <size_t kBlockSize>
+typename SharedMemCache<kBlockSize>::Layout*
+SharedMemCache<kBlockSize>::NewLayout(int slot, int sectors,
+                                      int entries_per_sector,
+                                      int blocks_per_sector, bool initialize) {
+  std::unique_ptr<Layout> layout(new Layout);
+  layout->slot = slot;
+  layout->format_generation = 0;
+  layout->num_sectors = sectors;
+  layout->entries_per_sector = entries_per_sector;
+  layout->blocks_per_sector = blocks_per_sector;
+
+  size_t sector_size = SectorSize(entries_per_sector, blocks_per_sector);
+  size_t slot_offset = SlotOffset(slot);
+  for (int s = 0; s < sectors; ++s) {
+    std::unique_ptr<Sector<kBlockSize>> sec(new Sector<kBlockSize>(
+        segment_.get(), slot_offset + s * sector_size, entries_per_sector,
+        blocks_per_sector, directory_layout_ == kTaggedBuckets));
+    bool ok;
+    if (initialize) {
+      ok = sec->Initialize(handler_);
+    } else {
+      ok = sec->Attach(handler_);
+    }
+
+    if (!ok) {
+      handler_->Message(kError,
+                        "SharedMemCache: can't %s sector %d of cache %s",
+                        initialize ? "create" : "attach", s, filename_.c_str());
+      return nullptr;
+    }
+    layout->sectors.push_back(std::move(sec));
+  }
+  AllocateSketches(layout.get());
+
+  layouts_.push_back(std::move(layout));
+  return layouts_.back().get();
+}
+
+template <size_t kBlockSize>
+typename SharedMemCache<kBlockSize>::Layout*
+SharedMemCache<kBlockSize>::AttachLayout(int slot) {
+  const ResizeState* state = resize_state_;
+  for (int i = layouts_.size() - 1; i >= 0; --i) {
+    Layout* layout = layouts_[i].get();
+    if (layout->slot == slot &&
+        layout->format_generation == state->format_generation[slot]) {
+      return layout;
+    }
+  }
+  Layout* layout =
+      NewLayout(slot, state->sectors[slot], state->entries_per_sector[slot],
+                state->blocks_per_sector[slot], false /* attach */);
+  if (layout != nullptr) {
+    layout->format_generation = state->format_generation[slot];
+  }
+  return layout;
+}
+
+template <size_t kBlockSize>
+typename SharedMemCache<kBlockSize>::View*
+SharedMemCache<kBlockSize>::RefreshView() {
+  ScopedMutex lock(resize_mutex_.get());
+  View* view = view_;
+  int64 generation = resize_state_->generation;
+  if (view != nullptr && view->generation == generation) {
+    return view;  // Another thread got here first.
+  }
+
+  int slot = resize_state_->active_slot;
+  std::unique_ptr<View> new_view(new View);
+  new_view->generation = generation;
+  new_view->current = AttachLayout(slot);
+  new_view->previous = nullptr;
+  if (new_view->current == nullptr) {
+    return nullptr;
+  }
+  if (resize_state_->migrating) {
+    new_view->previous = AttachLayout(1 - slot);
+    if (new_view->previous == nullptr) {
+      return nullptr;
+    }
+  }
+  view = new_view.get();
+  views_.push_back(std::move(new_view));
+  view_ = view;
+  return view;
+}
+
+template <size_t kBlockSize>
+typename SharedMemCache<kBlockSize>::View*
+SharedMemCache<kBlockSize>::PinView() {
+  View* view = view_;
+  if (resize_state_ == nullptr) {
+    return view;
+  }
+  for (;;) {
+    if (view->generation != resize_state_->generation) {
+      view = RefreshView();
+      CHECK(view != nullptr) << "SharedMemCache: lost track of " << filename_;
+    }
+    ++resize_state_->users[view->current->slot];
+    if (view->previous != nullptr) {
+      ++resize_state_->users[view->previous->slot];
+    }
+    // A resize that started before we were counted may be reformatting one
+    // of these slots; if so the generation has moved on.
+    if (view->generation == resize_state_->generation) {
+      return view;
+    }
+    UnpinView(view);
+  }
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::UnpinView(View* view) {
+  if (resize_state_ != nullptr) {
+    --resize_state_->users[view->current->slot];
+    if (view->previous != nullptr) {
+      --resize_state_->users[view->previous->slot];
+    }
+  }
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::EnableAdmissionPolicy() {
+  admission_policy_enabled_ = true;
+  for (const std::unique_ptr<Layout>& layout : layouts_) {
+    AllocateSketches(layout.get());
+  }
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::AllocateSketches(Layout* layout) {
+  layout->sketches.clear();
+  if (admission_policy_enabled_) {
+    for (int s = 0; s < layout->num_sectors; ++s) {
+      layout->sketches.emplace_back(
+          new FrequencySketch(layout->entries_per_sector));
+    }
+  }
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::RecordAccess(Layout* layout, int sector_num,
+                                              const GoogleString& raw_hash) {
+  if (!layout->sketches.empty()) {
+    layout->sketches[sector_num]->Increment(FrequencySketch::HashKey(raw_hash));
+  }
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::Admit(Layout* layout, int sector_num,
+                                       const GoogleString& raw_hash,
+                                       const CacheEntry* victim) {
+  if (layout->sketches.empty()) {
+    return true;
+  }
+  const FrequencySketch* sketch = layout->sketches[sector_num].get();
+  int victim_frequency = sketch->Frequency(
+      FrequencySketch::HashKey(StringPiece(victim->hash_bytes, kHashSize)));
+  // Ties go to the new key, so that without any popularity signal the
+  // replacement is plain LRU.
+  return sketch->Frequency(FrequencySketch::HashKey(raw_hash)) >=
+         victim_frequency;
+}
+
 template <size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::Initialize() {
   bool ok = InitCache(true);
   if (ok) {
-    RestoreFromDisk();
+    RestoreFromDisk(view_.load()->current);
   }
   return ok;
 }
@@ -279,6 +662,199 @@ bool SharedMemCache<kBlockSize>::Attach() {
   return InitCache(false);
 }
 
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::set_directory_layout(DirectoryLayout layout) {
+  DCHECK(segment_.get() == nullptr);
+  directory_layout_ = layout;
+  entries_per_sector_ = DirectoryEntries(entries_per_sector_);
+}
+
+template <size_t kBlockSize>
+int SharedMemCache<kBlockSize>::DirectoryEntries(
+    int entries_per_sector) const {
+  if (directory_layout_ != kTaggedBuckets) {
+    return entries_per_sector;
+  }
+  return AlignTo(kTagBucketWays, entries_per_sector);
+}
+
+template <size_t kBlockSize>
+size_t SharedMemCache<kBlockSize>::SectorSize(int entries_per_sector,
+                                              int blocks_per_sector) const {
+  return Sector<kBlockSize>::RequiredSize(shm_runtime_, entries_per_sector,
+                                          blocks_per_sector,
+                                          directory_layout_ == kTaggedBuckets);
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::EnableResizing(int64 max_size_kb) {
+  DCHECK(segment_.get() == nullptr);
+  max_size_kb_ = max_size_kb;
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::StartResize(int sectors,
+                                             int entries_per_sector,
+                                             int blocks_per_sector) {
+  if (resize_state_ == nullptr) {
+    handler_->Message(kWarning, "SharedMemCache: resizing %s is not enabled",
+                      filename_.c_str());
+    return false;
+  }
+  entries_per_sector = DirectoryEntries(entries_per_sector);
+  if (sectors <= 0 || entries_per_sector <= 0 || blocks_per_sector <= 0 ||
+      sectors * SectorSize(entries_per_sector, blocks_per_sector) >
+          slot_bytes_) {
+    handler_->Message(kWarning,
+                      "SharedMemCache: can't resize %s to sectors = %d, "
+                      "entries/sector = %d, blocks/sector = %d, which "
+                      "doesn't fit in the %s bytes reserved",
+                      filename_.c_str(), sectors, entries_per_sector,
+                      blocks_per_sector, FormatSize(slot_bytes_).c_str());
+    return false;
+  }
+
+  ScopedMutex lock(resize_mutex_.get());
+  ResizeState* state = resize_state_;
+  if (state->migrating) {
+    handler_->Message(kWarning, "SharedMemCache: %s is already being resized",
+                      filename_.c_str());
+    return false;
+  }
+
+  // Operations that started before the previous resize finished may still
+  // be using the slot we're about to reformat.  New ones won't pick it, and
+  // none of them need the resize lock to finish.  Nothing has changed yet,
+  // so if they don't drain in time we can just give up.
+  int slot = 1 - state->active_slot;
+  int64 deadline_ms = timer_->NowMs() + kResizeDrainTimeoutMs;
+  while (state->users[slot] != 0) {
+    if (timer_->NowMs() >= deadline_ms) {
+      handler_->Message(kWarning,
+                        "SharedMemCache: can't resize %s: %d operation(s) "
+                        "still hold the spare sectors after %d ms",
+                        filename_.c_str(), state->users[slot].load(),
+                        static_cast<int>(kResizeDrainTimeoutMs));
+      return false;
+    }
+    timer_->SleepUs(50);
+  }
+
+  size_t size = sectors * SectorSize(entries_per_sector, blocks_per_sector);
+  std::memset(const_cast<char*>(segment_->Base()) + SlotOffset(slot), 0, size);
+  Layout* layout = NewLayout(slot, sectors, entries_per_sector,
+                             blocks_per_sector, true /* initialize */);
+  if (layout == nullptr) {
+    return false;
+  }
+  int64 generation = state->generation + 1;
+  layout->format_generation = generation;
+  state->sectors[slot] = sectors;
+  state->entries_per_sector[slot] = entries_per_sector;
+  state->blocks_per_sector[slot] = blocks_per_sector;
+  state->format_generation[slot] = generation;
+  state->active_slot = slot;
+  state->migrating = 1;
+  state->next_migration_sector = 0;
+  state->migrated_sectors = 0;
+  state->generation = generation;
+
+  handler_->Message(kInfo,
+                    "SharedMemCache: resizing %s to sectors = %d, "
+                    "entries/sector = %d,  %d-byte blocks/sector = %d",
+                    filename_.c_str(), sectors, entries_per_sector,
+                    static_cast<int>(kBlockSize), blocks_per_sector);
+  return true;
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::MigrateNextSector() {
+  if (resize_state_ == nullptr) {
+    return false;
+  }
+  for (;;) {
+    ScopedView view(this);
+    int sector_num;
+    {
+      ScopedMutex lock(resize_mutex_.get());
+      ResizeState* state = resize_state_;
+      if (!state->migrating) {
+        return false;
+      }
+      if (view->generation != state->generation) {
+        continue;  // Pinned a view from before the resize started.
+      }
+      if (state->next_migration_sector == view->previous->num_sectors) {
+        return false;  // Others are moving the last sectors.
+      }
+      sector_num = state->next_migration_sector++;
+    }
+
+    MigrateSector(view->previous, sector_num, view->current);
+
+    bool finished = false;
+    {
+      ScopedMutex lock(resize_mutex_.get());
+      ResizeState* state = resize_state_;
+      if (++state->migrated_sectors == view->previous->num_sectors) {
+        state->migrating = 0;
+        ++state->generation;
+        finished = true;
+        handler_->Message(kInfo, "SharedMemCache: finished resizing %s",
+                          filename_.c_str());
+      }
+    }
+    if (finished && file_cache_ != nullptr && checkpoint_interval_sec_ > 0) {
+      // The previous geometry's checkpoints are superseded once this one's
+      // are complete.
+      CheckpointAllAndRemoveOthers(view->current);
+    }
+    return true;
+  }
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::Resize(int sectors, int entries_per_sector,
+                                        int blocks_per_sector) {
+  if (!StartResize(sectors, entries_per_sector, blocks_per_sector)) {
+    return false;
+  }
+  while (MigrateNextSector()) {
+  }
+  return true;
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::MigrateSector(Layout* from, int sector_num,
+                                               Layout* to) {
+  Sector<kBlockSize>* sector = from->sectors[sector_num].get();
+  SharedMemCacheDump dump;
+  ScopedMutex lock(sector->mutex());
+  DumpSector(sector, &dump);
+
+  // Restoring with the old sector still locked means a Put or Delete of one
+  // of these keys, which first drops it from the old sector, either finishes
+  // before the dump or waits and then overrides the restored value.  Nothing
+  // takes an old sector's lock while holding a new one, so this can't
+  // deadlock.
+  RestoreSnapshotInto(to, dump);
+  sector->set_migrated();
+}
+
+template <size_t kBlockSize>
+size_t SharedMemCache<kBlockSize>::MaxValueSize() const {
+  const View* view = view_;
+  int blocks_per_sector =
+      (view == nullptr) ? blocks_per_sector_ : view->current->blocks_per_sector;
+  return (blocks_per_sector * kBlockSize) / 8;
+}
+
+template <size_t kBlockSize>
+int SharedMemCache<kBlockSize>::num_sectors() const {
+  const View* view = view_;
+  return (view == nullptr) ? num_sectors_ : view->current->num_sectors;
+}
+
 template <size_t kBlockSize>
 void SharedMemCache<kBlockSize>::GlobalCleanup(
     AbstractSharedMem* shm_runtime, const GoogleString& filename,
@@ -318,24 +894,35 @@ void SharedMemCache<kBlockSize>::ComputeDimensions(int64 size_kb,
 
 template <size_t kBlockSize>
 GoogleString SharedMemCache<kBlockSize>::DumpStats() {
+  ScopedView view(this);
+  const Layout* layout = view->current;
   SectorStats aggregate;
-  for (size_t c = 0; c < sectors_.size(); ++c) {
-    ScopedMutex lock(sectors_[c]->mutex());
-    aggregate.Add(*sectors_[c]->sector_stats());
+  for (int s = 0; s < layout->num_sectors; ++s) {
+    Sector<kBlockSize>* sector = layout->sectors[s].get();
+    ScopedMutex lock(sector->mutex());
+    aggregate.Add(*sector->sector_stats());
   }
 
-  return aggregate.Dump(entries_per_sector_ * num_sectors_,
-                        blocks_per_sector_ * num_sectors_);
+  return aggregate.Dump(layout->entries_per_sector * layout->num_sectors,
+                        layout->blocks_per_sector * layout->num_sectors);
 }
 
 template <size_t kBlockSize>
 bool SharedMemCache<kBlockSize>::AddSectorToSnapshot(int sector_num,
                                                      int64 last_checkpoint_ms,
                                                      SharedMemCacheDump* dest) {
+  ScopedView view(this);
+  return SnapshotSector(view->current, sector_num, last_checkpoint_ms, dest);
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::SnapshotSector(Layout* layout, int sector_num,
+                                                int64 last_checkpoint_ms,
+                                                SharedMemCacheDump* dest) {
   CHECK_LE(0, sector_num);
-  CHECK_LT(sector_num, num_sectors_);
+  CHECK_LT(sector_num, layout->num_sectors);
 
-  Sector<kBlockSize>* sector = sectors_[sector_num];
+  Sector<kBlockSize>* sector = layout->sectors[sector_num].get();
   SectorStats* stats = sector->sector_stats();
   ScopedMutex lock(sector->mutex());
   DCHECK(!(last_checkpoint_ms > stats->last_checkpoint_ms));
@@ -344,6 +931,14 @@ bool SharedMemCache<kBlockSize>::AddSectorToSnapshot(int sector_num,
     return false;
   }
 
+  DumpSector(sector, dest);
+  stats->last_checkpoint_ms = timer_->NowMs();
+  return true;
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::DumpSector(Sector<kBlockSize>* sector,
+                                            SharedMemCacheDump* dest) {
   EntryNum cur = sector->OldestEntryNum();
   while (cur != kInvalidEntry) {
     CacheEntry* cur_entry = sector->EntryAt(cur);
@@ -357,28 +952,36 @@ bool SharedMemCache<kBlockSize>::AddSectorToSnapshot(int sector_num,
       dump_entry->set_raw_key(cur_entry->hash_bytes, kHashSize);
       dump_entry->set_last_use_timestamp_ms(cur_entry->last_use_timestamp_ms);
 
-      // Gather value.
-      BlockVector blocks;
-      sector->BlockListForEntry(cur_entry, &blocks);
-
-      size_t total_blocks = blocks.size();
-      for (size_t b = 0; b < total_blocks; ++b) {
-        int bytes =
-            sector->BytesInPortion(cur_entry->byte_size, b, total_blocks);
-        dump_entry->mutable_value()->append(sector->BlockBytes(blocks[b]),
-                                            bytes);
-      }
+      ReadEntryValue(sector, cur_entry, dump_entry->mutable_value());
     }
     cur = cur_entry->lru_prev;
   }
+}
 
-  stats->last_checkpoint_ms = timer_->NowMs();
-  return true;
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::ReadEntryValue(Sector<kBlockSize>* sector,
+                                                CacheEntry* entry,
+                                                GoogleString* value) {
+  BlockVector blocks;
+  sector->BlockListForEntry(entry, &blocks);
+
+  size_t total_blocks = blocks.size();
+  for (size_t b = 0; b < total_blocks; ++b) {
+    int bytes = sector->BytesInPortion(entry->byte_size, b, total_blocks);
+    value->append(sector->BlockBytes(blocks[b]), bytes);
+  }
 }
 
 template <size_t kBlockSize>
 void SharedMemCache<kBlockSize>::RestoreSnapshot(
     const SharedMemCacheDump& dump) {
+  ScopedView view(this);
+  RestoreSnapshotInto(view->current, dump);
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::RestoreSnapshotInto(
+    Layout* layout, const SharedMemCacheDump& dump) {
   for (int i = 0; i < dump.entry_size(); ++i) {
     const SharedMemCacheDumpEntry& entry = dump.entry(i);
 
@@ -389,7 +992,7 @@ void SharedMemCache<kBlockSize>::RestoreSnapshot(
     }
 
     SharedString value(entry.value());
-    PutRawHash(entry.raw_key(), entry.last_use_timestamp_ms(), value,
+    PutRawHash(layout, entry.raw_key(), entry.last_use_timestamp_ms(), value,
                false /* don't trigger checkpointing */);
   }
 }
@@ -414,70 +1017,85 @@ void SharedMemCache<kBlockSize>::Put(const GoogleString& key,
                                      const SharedString& value) {
   int64 now_ms = timer_->NowMs();
   GoogleString raw_hash = ToRawHash(key);
-  PutRawHash(raw_hash, now_ms, value, true /* may trigger checkpointing */);
+  for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+    ScopedView view(this);
+    if (view->previous != nullptr) {
+      // Drop any old copy first, so that migration can't bring it back.
+      DeleteFromLayout(view->previous, raw_hash);
+    }
+    if (PutRawHash(view->current, raw_hash, now_ms, value,
+                   true /* may trigger checkpointing */)) {
+      return;
+    }
+  }
 }
 
 template <size_t kBlockSize>
 void SharedMemCache<kBlockSize>::ScheduleSnapshotIfNecessary(
-    bool checkpoint_ok, int64 last_use_timestamp_ms, int64 last_checkpoint_ms,
-    int sector_num) {
+    Layout* layout, bool checkpoint_ok, int64 last_use_timestamp_ms,
+    int64 last_checkpoint_ms, int sector_num) {
   if (checkpoint_ok /* not restoring, ok to checkpoint */ &&
       checkpoint_interval_sec_ > 0 /* checkpointing enabled */) {
     int64 now_ms = last_use_timestamp_ms;
 
     if (now_ms - last_checkpoint_ms >
         (checkpoint_interval_sec_ * Timer::kSecondMs)) {
-      ScheduleSnapshot(sector_num, last_checkpoint_ms);
+      ScheduleSnapshot(layout, sector_num, last_checkpoint_ms);
     }
   }
 }
 
 template <size_t kBlockSize>
-void SharedMemCache<kBlockSize>::PutRawHash(const GoogleString& raw_hash,
+bool SharedMemCache<kBlockSize>::PutRawHash(Layout* layout,
+                                            const GoogleString& raw_hash,
                                             int64 last_use_timestamp_ms,
                                             const SharedString& value,
                                             bool checkpoint_ok) {
   // See also ::ComputeDimensions
-  const size_t kMaxSize = MaxValueSize();
+  const size_t kMaxSize = (layout->blocks_per_sector * kBlockSize) / 8;
 
   size_t value_size = static_cast<size_t>(value.size());
   if (value_size > kMaxSize) {
     handler_->Message(
         kInfo, "Unable to insert object of size: %s, cache limit is: %s",
         FormatSize(value.size()).c_str(), FormatSize(kMaxSize).c_str());
-    return;
+    return true;
   }
 
   Position pos;
-  ExtractPosition(raw_hash, &pos);
+  ExtractPosition(layout, raw_hash, &pos);
 
-  Sector<kBlockSize>* sector = sectors_[pos.sector];
+  Sector<kBlockSize>* sector = layout->sectors[pos.sector].get();
   SectorStats* stats = sector->sector_stats();
 
   ScopedMutex lock(sector->mutex());
+  if (sector->migrated()) {
+    return false;
+  }
   ++stats->num_put;
   int64 last_checkpoint_ms = stats->last_checkpoint_ms;
+  if (checkpoint_ok) {
+    RecordAccess(layout, pos.sector, raw_hash);
+  }
 
   // See if our key already exists. Note that if it does, we will attempt to
   // write even if there are readers (we will wait for them to finish);
   // but not if there is another writer, in which case we just give up.
   // It is important, however, that we always exit if the key matches,
   // so we don't end up creating a second copy!
-  for (int p = 0; p < kAssociativity; ++p) {
-    EntryNum cand_key = pos.keys[p];
-    CacheEntry* cand = sector->EntryAt(cand_key);
-    if (KeyMatch(cand, raw_hash)) {
-      if (!cand->creating) {
-        ++stats->num_put_update;
-        EnsureReadyForWriting(sector, cand);
-        PutIntoEntry(sector, cand_key, last_use_timestamp_ms, value);
-        ScheduleSnapshotIfNecessary(checkpoint_ok, last_use_timestamp_ms,
-                                    last_checkpoint_ms, pos.sector);
-      } else {
-        ++stats->num_put_concurrent_create;
-      }
-      return;
+  EntryNum match_key = FindEntry(sector, pos, raw_hash);
+  if (match_key != kInvalidEntry) {
+    CacheEntry* match = sector->EntryAt(match_key);
+    if (!match->creating) {
+      ++stats->num_put_update;
+      EnsureReadyForWriting(sector, match);
+      PutIntoEntry(sector, match_key, last_use_timestamp_ms, value);
+      ScheduleSnapshotIfNecessary(layout, checkpoint_ok, last_use_timestamp_ms,
+                                  last_checkpoint_ms, pos.sector);
+    } else {
+      ++stats->num_put_concurrent_create;
     }
+    return true;
   }
 
   // We don't have a current entry with our key, but see if we can overwrite
@@ -485,7 +1103,7 @@ void SharedMemCache<kBlockSize>::PutRawHash(const GoogleString& raw_hash,
   // readers, as it's unclear that they are any less important than us.
   EntryNum best_key = kInvalidEntry;
   CacheEntry* best = nullptr;
-  for (int p = 0; p < kAssociativity; ++p) {
+  for (int p = 0; p < pos.num_keys; ++p) {
     EntryNum cand_key = pos.keys[p];
     CacheEntry* cand = sector->EntryAt(cand_key);
     if (Writeable(cand)) {
@@ -500,45 +1118,56 @@ void SharedMemCache<kBlockSize>::PutRawHash(const GoogleString& raw_hash,
   if (best_key == kInvalidEntry) {
     // All slots busy. Giving up.
     ++stats->num_put_concurrent_full_set;
-    return;
+    return true;
   }
 
   if (best->byte_size != 0 ||
       !IsAllNil(StringPiece(best->hash_bytes, kHashSize))) {
+    // Restoring a snapshot replays old entries, so they are not subject to
+    // the admission policy.
+    if (checkpoint_ok && !Admit(layout, pos.sector, raw_hash, best)) {
+      ++stats->num_put_admission_rejected;
+      return true;
+    }
     ++stats->num_put_replace;
   }
 
   // Wait for readers before touching the key.
   EnsureReadyForWriting(sector, best);
-  std::memcpy(best->hash_bytes, raw_hash.data(), kHashSize);
+  SetEntryKey(sector, pos, best_key, raw_hash);
   PutIntoEntry(sector, best_key, last_use_timestamp_ms, value);
 
-  ScheduleSnapshotIfNecessary(checkpoint_ok, last_use_timestamp_ms,
+  ScheduleSnapshotIfNecessary(layout, checkpoint_ok, last_use_timestamp_ms,
                               last_checkpoint_ms, pos.sector);
+  return true;
 }
 
 template <size_t kBlockSize>
 class SharedMemCache<kBlockSize>::WriteOutSnapshotFunction : public Function {
  public:
-  WriteOutSnapshotFunction(SharedMemCache<kBlockSize>* cache, int sector_num,
-                           int64 last_checkpoint_ms)
+  WriteOutSnapshotFunction(SharedMemCache<kBlockSize>* cache, Layout* layout,
+                           int sector_num, int64 last_checkpoint_ms)
       : cache_(cache),
+        layout_(layout),
         sector_num_(sector_num),
         last_checkpoint_ms_(last_checkpoint_ms) {}
   ~WriteOutSnapshotFunction() override {}
   void Run() override {
-    cache_->WriteOutSnapshotFromWorkerThread(sector_num_, last_checkpoint_ms_);
+    cache_->WriteOutSnapshotFromWorkerThread(layout_, sector_num_,
+                                             last_checkpoint_ms_);
   }
 
  private:
   SharedMemCache<kBlockSize>* cache_;
+  Layout* layout_;
   int sector_num_;
   int64 last_checkpoint_ms_;
   DISALLOW_COPY_AND_ASSIGN(WriteOutSnapshotFunction);
 };
 
 template <size_t kBlockSize>
-void SharedMemCache<kBlockSize>::ScheduleSnapshot(int sector_num,
+void SharedMemCache<kBlockSize>::ScheduleSnapshot(Layout* layout,
+                                                  int sector_num,
                                                   int64 last_checkpoint_ms) {
   // We're being called from whatever thread called Put() but snapshotting can
   // take a while so we need to move to the slow worker thread.  We use whatever
@@ -547,45 +1176,317 @@ void SharedMemCache<kBlockSize>::ScheduleSnapshot(int sector_num,
   SlowWorker* worker = file_cache_->worker();
   CHECK(worker != nullptr);
   worker->Start();
-  worker->RunIfNotBusy(
-      new WriteOutSnapshotFunction(this, sector_num, last_checkpoint_ms));
+  worker->RunIfNotBusy(new WriteOutSnapshotFunction(this, layout, sector_num,
+                                                    last_checkpoint_ms));
   // If the worker chose not to run the snapshotter, because it was busy, we'll
   // try again after the next Put() for this sector.
 }
 
+template <size_t kBlockSize>
+GoogleString SharedMemCache<kBlockSize>::CheckpointDir() const {
+  // filename_ is usually a path itself, so it's hashed to get a directory
+  // name.
+  GoogleString cache_id = hasher_->Hash(
+      StrCat(filename_, "/", IntegerToString(kCheckpointVersion)));
+  return StrCat(file_cache_->uncleaned_path(), "/shm_metadata_cache/",
+                cache_id);
+}
+
+template <size_t kBlockSize>
+GoogleString SharedMemCache<kBlockSize>::CheckpointGeometry(
+    const Layout* layout) const {
+  return StrCat(IntegerToString(kBlockSize), "-",
+                IntegerToString(layout->blocks_per_sector), "-",
+                IntegerToString(layout->num_sectors));
+}
+
+template <size_t kBlockSize>
+GoogleString SharedMemCache<kBlockSize>::CheckpointPath(const Layout* layout,
+                                                       int sector_num) const {
+  return StrCat(CheckpointDir(), "/", CheckpointGeometry(layout), ".",
+                IntegerToString(sector_num));
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::ListCheckpointFiles(
+    StringVector* paths, StringVector* geometries) {
+  StringVector files;
+  NullMessageHandler null_handler;  // There may well be no checkpoints.
+  file_cache_->file_system()->ListContents(CheckpointDir(), &files,
+                                           &null_handler);
+  for (const GoogleString& file : files) {
+    StringPiece name(file);
+    name.remove_prefix(name.rfind('/') + 1);
+    size_t dot = name.find('.');
+    // Skip rewrites that never got renamed into place.
+    if (dot != StringPiece::npos &&
+        name.find(".temp") == StringPiece::npos) {
+      paths->push_back(file);
+      geometries->push_back(name.substr(0, dot).as_string());
+    }
+  }
+}
+
+template <size_t kBlockSize>
+GoogleString SharedMemCache<kBlockSize>::NewestCheckpointGeometry(
+    const Layout* layout) {
+  StringVector paths, geometries;
+  ListCheckpointFiles(&paths, &geometries);
+  GoogleString current = CheckpointGeometry(layout);
+  GoogleString newest;
+  int64 newest_mtime_sec = -1;
+  NullMessageHandler null_handler;
+  for (int i = 0, n = paths.size(); i < n; ++i) {
+    int64 mtime_sec;
+    if (!file_cache_->file_system()->Mtime(paths[i], &mtime_sec,
+                                           &null_handler)) {
+      continue;
+    }
+    // Ties go to the current geometry, which needs no full checkpoint.
+    if (mtime_sec > newest_mtime_sec ||
+        (mtime_sec == newest_mtime_sec && geometries[i] == current)) {
+      newest = geometries[i];
+      newest_mtime_sec = mtime_sec;
+    }
+  }
+  return newest;
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::CheckpointAllAndRemoveOthers(
+    Layout* layout) {
+  for (int sector_num = 0; sector_num < layout->num_sectors; ++sector_num) {
+    Sector<kBlockSize>* sector = layout->sectors[sector_num].get();
+    // A worker thread checkpointing the sector at the same time makes this
+    // fail, and so does a failed write; either way, try again.
+    bool written = false;
+    for (int attempt = 0; attempt < kMaxAttempts && !written; ++attempt) {
+      int64 last_checkpoint_ms;
+      {
+        ScopedMutex lock(sector->mutex());
+        // Entries restored or migrated into the sector weren't necessarily
+        // used since its last checkpoint, so appending would miss them.
+        sector->set_checkpoint_needs_rewrite(true);
+        last_checkpoint_ms = sector->sector_stats()->last_checkpoint_ms;
+      }
+      written = WriteOutSnapshotFromWorkerThread(layout, sector_num,
+                                                 last_checkpoint_ms);
+    }
+    if (!written) {
+      // Until the sector is checkpointed, the other geometries' files are
+      // all there is of its entries, so keep them.
+      return;
+    }
+  }
+
+  RemoveOtherCheckpointGeometries(layout);
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::RemoveOtherCheckpointGeometries(
+    const Layout* layout) {
+  StringVector paths, geometries;
+  ListCheckpointFiles(&paths, &geometries);
+  GoogleString keep = CheckpointGeometry(layout);
+  for (int i = 0, n = paths.size(); i < n; ++i) {
+    if (geometries[i] != keep) {
+      file_cache_->file_system()->RemoveFile(paths[i].c_str(), handler_);
+    }
+  }
+}
+
 template <size_t kBlockSize>
 GoogleString SharedMemCache<kBlockSize>::SnapshotCacheKey(
-    int sector_num) const {
+    const Layout* layout, int sector_num) const {
   // Important: everything that determines whether it is legitimate to restore a
   // shared memory cache needs to be included in the key here.
   return StrCat(
       "shm_metadata_cache/snapshot/", filename_, "/",
       IntegerToString(kSnapshotVersion), "/",
       StrCat(IntegerToString(kBlockSize), "/",
-             IntegerToString(blocks_per_sector_), "/",
-             IntegerToString(num_sectors_), "/", IntegerToString(sector_num)));
+             IntegerToString(layout->blocks_per_sector), "/",
+             IntegerToString(layout->num_sectors), "/",
+             IntegerToString(sector_num)));
 }
 
 template <size_t kBlockSize>
-void SharedMemCache<kBlockSize>::WriteOutSnapshotFromWorkerThread(
-    int sector_num, int64 last_checkpoint_ms) {
-  SharedMemCacheDump snapshot;
-  bool updated = AddSectorToSnapshot(sector_num, last_checkpoint_ms, &snapshot);
-  if (!updated) {
-    return;  // Another thread updated it first.  Nothing needs doing.
+bool SharedMemCache<kBlockSize>::WriteOutSnapshotFromWorkerThread(
+    Layout* layout, int sector_num, int64 last_checkpoint_ms) {
+  // The view pins the layout's sectors while entries are copied out.
+  ScopedView view(this);
+  if (view->current != layout) {
+    return false;  // Resized since this was scheduled.
   }
-  GoogleString snapshot_s;
-  MarshalSnapshot(snapshot, &snapshot_s);
-  SharedString snapshot_s_shared(snapshot_s);
 
   CHECK(file_cache_ != nullptr);
-  // It's safe for us to use the file cache from an arbitrary thread because
-  // the file cache is thread-agnostic, having no writable member variables.
-  file_cache_->Put(SnapshotCacheKey(sector_num), snapshot_s_shared);
+  // It's safe for us to use the file cache's FileSystem from an arbitrary
+  // thread, as the file cache itself does so from its worker.
+  FileSystem* file_system = file_cache_->file_system();
+  GoogleString path = CheckpointPath(layout, sector_num);
+  NullMessageHandler null_handler;  // The file may well not exist.
+  int64 file_size = 0;
+  bool rewrite =
+      (last_checkpoint_ms == 0) ||
+      !file_system->Size(path, &file_size, &null_handler) ||
+      (file_size == 0) ||
+      (file_size >
+       kCheckpointRewriteRatio * static_cast<int64>(SectorSize(
+                                     layout->entries_per_sector,
+                                     layout->blocks_per_sector)));
+
+  StringVector raw_hashes;
+  if (!CollectCheckpointKeys(layout, sector_num, last_checkpoint_ms, &rewrite,
+                             &raw_hashes)) {
+    return false;  // Another thread updated it first, or it was migrated.
+  }
+
+  SharedMemCacheCheckpointWriter writer(file_system, path, rewrite, handler_);
+  if (!writer.Open() ||
+      !WriteCheckpointEntries(layout, sector_num, raw_hashes, &writer) ||
+      !writer.Finish()) {
+    handler_->Message(kWarning, "SharedMemCache: failed to checkpoint %s",
+                      path.c_str());
+    // Entries checkpointed from now on can't be appended to whatever the
+    // file holds.
+    Sector<kBlockSize>* sector = layout->sectors[sector_num].get();
+    ScopedMutex lock(sector->mutex());
+    sector->set_checkpoint_needs_rewrite(true);
+    return false;
+  }
+  return true;
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::CollectCheckpointKeys(
+    Layout* layout, int sector_num, int64 last_checkpoint_ms, bool* rewrite,
+    StringVector* raw_hashes) {
+  Sector<kBlockSize>* sector = layout->sectors[sector_num].get();
+  SectorStats* stats = sector->sector_stats();
+  ScopedMutex lock(sector->mutex());
+  if (sector->migrated()) {
+    return false;
+  }
+  DCHECK(!(last_checkpoint_ms > stats->last_checkpoint_ms));
+  if (last_checkpoint_ms < stats->last_checkpoint_ms) {
+    return false;
+  }
+
+  if (sector->checkpoint_needs_rewrite()) {
+    *rewrite = true;
+    sector->set_checkpoint_needs_rewrite(false);
+  }
+
+  // Entries are in LRU order, so the ones used, and therefore the ones
+  // written, since the last checkpoint are at the front.  Entries written in
+  // the same millisecond as the last checkpoint may or may not have made it
+  // in, so they're written again.
+  for (EntryNum cur = sector->NewestEntryNum(); cur != kInvalidEntry;) {
+    CacheEntry* cur_entry = sector->EntryAt(cur);
+    if (!*rewrite && cur_entry->last_use_timestamp_ms < last_checkpoint_ms) {
+      break;
+    }
+    // As in DumpSector, entries being written are skipped.
+    if (!cur_entry->creating &&
+        (*rewrite ||
+         cur_entry->last_write_timestamp_ms >= last_checkpoint_ms)) {
+      raw_hashes->push_back(GoogleString(cur_entry->hash_bytes, kHashSize));
+    }
+    cur = cur_entry->lru_next;
+  }
+  std::reverse(raw_hashes->begin(), raw_hashes->end());
+
+  stats->last_checkpoint_ms = timer_->NowMs();
+  return true;
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::WriteCheckpointEntries(
+    Layout* layout, int sector_num, const StringVector& raw_hashes,
+    SharedMemCacheCheckpointWriter* writer) {
+  Sector<kBlockSize>* sector = layout->sectors[sector_num].get();
+  GoogleString value;
+  size_t i = 0;
+  while (i < raw_hashes.size()) {
+    {
+      ScopedMutex lock(sector->mutex());
+      if (sector->migrated()) {
+        return false;
+      }
+      for (; i < raw_hashes.size() && !writer->ShouldFlush(); ++i) {
+        const GoogleString& raw_hash = raw_hashes[i];
+        Position pos;
+        ExtractPosition(layout, raw_hash, &pos);
+        DCHECK_EQ(sector_num, pos.sector);
+        // The entry may have been evicted, deleted or be in the middle of
+        // being rewritten since the keys were collected.
+        EntryNum entry_num = FindEntry(sector, pos, raw_hash);
+        if (entry_num == kInvalidEntry) {
+          continue;
+        }
+        CacheEntry* entry = sector->EntryAt(entry_num);
+        if (entry->creating) {
+          continue;
+        }
+        value.clear();
+        ReadEntryValue(sector, entry, &value);
+        writer->Add(raw_hash, entry->last_use_timestamp_ms, value);
+      }
+    }
+    if (!writer->Flush()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <size_t kBlockSize>
+GoogleString SharedMemCache<kBlockSize>::CheckpointPathForTesting(
+    int sector_num) {
+  ScopedView view(this);
+  return CheckpointPath(view->current, sector_num);
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::WriteOutSnapshotForTesting(
+    int sector_num, int64 last_checkpoint_ms) {
+  Layout* layout;
+  {
+    ScopedView view(this);
+    layout = view->current;
+  }
+  WriteOutSnapshotFromWorkerThread(layout, sector_num, last_checkpoint_ms);
 }
 
 template <size_t kBlockSize>
-void SharedMemCache<kBlockSize>::RestoreFromDisk() {
+class SharedMemCache<kBlockSize>::RestoreFilesThread
+    : public ThreadSystem::Thread {
+ public:
+  RestoreFilesThread(SharedMemCache<kBlockSize>* cache, Layout* layout,
+                     const StringVector* paths, bool legacy_snapshots,
+                     std::atomic<int>* next, ThreadSystem* thread_system)
+      : Thread(thread_system, "shm_restore", ThreadSystem::kJoinable),
+        cache_(cache),
+        layout_(layout),
+        paths_(paths),
+        legacy_snapshots_(legacy_snapshots),
+        next_(next) {}
+  ~RestoreFilesThread() override {}
+
+  void Run() override {
+    cache_->RestoreFilesFromDisk(layout_, *paths_, legacy_snapshots_, next_);
+  }
+
+ private:
+  SharedMemCache<kBlockSize>* cache_;
+  Layout* layout_;
+  const StringVector* paths_;
+  bool legacy_snapshots_;
+  std::atomic<int>* next_;
+  DISALLOW_COPY_AND_ASSIGN(RestoreFilesThread);
+};
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::RestoreFromDisk(Layout* layout) {
   if (file_cache_ == nullptr) {
     // RegisterSnapshotFileCache was never called, which should only happen in
     // test code.
@@ -596,21 +1497,120 @@ void SharedMemCache<kBlockSize>::RestoreFromDisk() {
     return;  // Don't try to restore.
   }
 
-  // We want to delay forking until these snapshots are all loaded, so we rely
-  // on the file cache being a synchronous cache.
-  CHECK(file_cache_->IsBlocking());
-  for (int sector_num = 0; sector_num < num_sectors_; ++sector_num) {
-    CacheInterface::SynchronousCallback callback;
-    file_cache_->Get(SnapshotCacheKey(sector_num), &callback);
-    CHECK(callback.called());
-    if (callback.state() == CacheInterface::kAvailable) {
-      SharedMemCacheDump snapshot;
-      DemarshalSnapshot(callback.value().Value(), &snapshot);
-      RestoreSnapshot(snapshot);
+  // The current geometry's files are named by sector, and a sector without
+  // one may still have a snapshot from an earlier version.  Another
+  // geometry's are replayed whatever they're named.
+  GoogleString restore_geometry = NewestCheckpointGeometry(layout);
+  bool current_geometry = restore_geometry.empty() ||
+                          (restore_geometry == CheckpointGeometry(layout));
+  StringVector paths;
+  if (current_geometry) {
+    for (int sector_num = 0; sector_num < layout->num_sectors; ++sector_num) {
+      paths.push_back(CheckpointPath(layout, sector_num));
+    }
+  } else {
+    StringVector all_paths, geometries;
+    ListCheckpointFiles(&all_paths, &geometries);
+    for (int i = 0, n = all_paths.size(); i < n; ++i) {
+      if (geometries[i] == restore_geometry) {
+        paths.push_back(all_paths[i]);
+      }
     }
+    handler_->Message(kInfo,
+                      "SharedMemCache: restoring %s from checkpoints of "
+                      "geometry %s",
+                      filename_.c_str(), restore_geometry.c_str());
+  }
+
+  // We want to delay forking until these checkpoints are all loaded, so we
+  // restore synchronously, though with the files spread over a few threads.
+  // The calling thread restores files too, and does all of them if no
+  // threads can be started.
+  std::atomic<int> next(0);
+  std::vector<std::unique_ptr<RestoreFilesThread>> threads;
+  ThreadSystem* thread_system = file_cache_->thread_system();
+  if (thread_system != nullptr) {
+    int num_threads =
+        std::min(static_cast<int>(paths.size()), kMaxRestoreThreads) - 1;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back(new RestoreFilesThread(
+          this, layout, &paths, current_geometry, &next, thread_system));
+      if (!threads.back()->Start()) {
+        threads.pop_back();
+        break;
+      }
+    }
+  }
+  RestoreFilesFromDisk(layout, paths, current_geometry, &next);
+  for (const auto& thread : threads) {
+    thread->Join();
   }
   // Some of these may have failed, or there may not have been any in the file
-  // cache at all.  This is fine; restoring the snapshots is best-effort.
+  // cache at all.  This is fine; restoring the checkpoints is best-effort.
+
+  if (checkpoint_interval_sec_ > 0 && !restore_geometry.empty()) {
+    if (current_geometry) {
+      // Any other geometries' files are older than these, so they're done
+      // with; there's nothing to checkpoint first.
+      RemoveOtherCheckpointGeometries(layout);
+    } else {
+      CheckpointAllAndRemoveOthers(layout);
+    }
+  }
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::RestoreFilesFromDisk(
+    Layout* layout, const StringVector& paths, bool legacy_snapshots,
+    std::atomic<int>* next) {
+  int size = paths.size();
+  for (int i = next->fetch_add(1); i < size; i = next->fetch_add(1)) {
+    if (!RestoreCheckpointFile(layout, paths[i]) && legacy_snapshots) {
+      RestoreLegacySnapshot(layout, i);
+    }
+  }
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::RestoreCheckpointFile(
+    Layout* layout, const GoogleString& path) {
+  SharedMemCacheCheckpointReader reader(file_cache_->file_system(), path,
+                                        handler_);
+  if (!reader.Open()) {
+    return false;
+  }
+  StringPiece raw_key, value;
+  int64 last_use_timestamp_ms;
+  while (reader.Next(&raw_key, &last_use_timestamp_ms, &value)) {
+    if (raw_key.size() == kHashSize) {
+      PutRawHash(layout, raw_key.as_string(), last_use_timestamp_ms,
+                 SharedString(value), false /* don't trigger checkpointing */);
+    }
+  }
+  if (reader.damaged()) {
+    handler_->Message(kWarning,
+                      "SharedMemCache: checkpoint %s is damaged after %d "
+                      "entries; restored those",
+                      path.c_str(), reader.records());
+  }
+  return true;
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::RestoreLegacySnapshot(Layout* layout,
+                                                       int sector_num) {
+  // Snapshots stored in the file cache by earlier versions are still
+  // restored, as long as the sector has no checkpoint file.  We rely on the
+  // file cache being a synchronous cache.
+  CHECK(file_cache_->IsBlocking());
+  CacheInterface::SynchronousCallback callback;
+  file_cache_->Get(SnapshotCacheKey(layout, sector_num), &callback);
+  CHECK(callback.called());
+  if (callback.state() == CacheInterface::kAvailable) {
+    SharedMemCacheDump snapshot;
+    DemarshalSnapshot(callback.value().Value(), &snapshot);
+    RestoreSnapshotInto(layout, snapshot);
+  }
 }
 
 // Expects sector->mutex() held on entry, leaves it held on exit.
@@ -655,6 +1655,7 @@ void SharedMemCache<kBlockSize>::PutIntoEntry(Sector<kBlockSize>* sector,
   }
 
   entry->byte_size = value.size();
+  entry->last_write_timestamp_ms = last_use_timestamp_ms;
   TouchEntry(sector, last_use_timestamp_ms, entry_num);
 
   // Write out successor list for the blocks we use, and point the entry to it.
@@ -684,29 +1685,45 @@ template <size_t kBlockSize>
 void SharedMemCache<kBlockSize>::Get(const GoogleString& key,
                                      Callback* callback) {
   GoogleString raw_hash = ToRawHash(key);
-  Position pos;
-  ExtractPosition(raw_hash, &pos);
   CacheInterface::KeyState key_state = kNotFound;
-  Sector<kBlockSize>* sector = sectors_[pos.sector];
-  {
-    ScopedMutex lock(sector->mutex());
-    SectorStats* stats = sector->sector_stats();
-    ++stats->num_get;
-
-    for (int p = 0; p < kAssociativity; ++p) {
-      EntryNum cand_key = pos.keys[p];
-      CacheEntry* cand = sector->EntryAt(cand_key);
-      if (KeyMatch(cand, raw_hash)) {
-        ++stats->num_get_hit;
-        key_state = GetFromEntry(key, sector, cand_key, callback);
-        break;
-      }
+  for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+    ScopedView view(this);
+    if (!GetFromLayout(view->current, key, raw_hash, callback, &key_state)) {
+      continue;
+    }
+    if (key_state == kNotFound && view->previous != nullptr) {
+      // The entry may not have been migrated yet.
+      GetFromLayout(view->previous, key, raw_hash, callback, &key_state);
     }
+    break;
   }
 
   ValidateAndReportResult(key, key_state, callback);
 }
 
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::GetFromLayout(
+    Layout* layout, const GoogleString& key, const GoogleString& raw_hash,
+    Callback* callback, CacheInterface::KeyState* key_state) {
+  Position pos;
+  ExtractPosition(layout, raw_hash, &pos);
+  Sector<kBlockSize>* sector = layout->sectors[pos.sector].get();
+  ScopedMutex lock(sector->mutex());
+  if (sector->migrated()) {
+    return false;
+  }
+  SectorStats* stats = sector->sector_stats();
+  ++stats->num_get;
+  RecordAccess(layout, pos.sector, raw_hash);
+
+  EntryNum entry_num = FindEntry(sector, pos, raw_hash);
+  if (entry_num != kInvalidEntry) {
+    ++stats->num_get_hit;
+    *key_state = GetFromEntry(key, sector, entry_num, callback);
+  }
+  return true;
+}
+
 // Expects sector->mutex() held on entry, leaves it held on exit.
 template <size_t kBlockSize>
 CacheInterface::KeyState SharedMemCache<kBlockSize>::GetFromEntry(
@@ -751,19 +1768,36 @@ CacheInterface::KeyState SharedMemCache<kBlockSize>::GetFromEntry(
 template <size_t kBlockSize>
 void SharedMemCache<kBlockSize>::Delete(const GoogleString& key) {
   GoogleString raw_hash = ToRawHash(key);
+  for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+    ScopedView view(this);
+    if (view->previous != nullptr) {
+      DeleteFromLayout(view->previous, raw_hash);
+    }
+    if (DeleteFromLayout(view->current, raw_hash)) {
+      return;
+    }
+  }
+}
+
+template <size_t kBlockSize>
+bool SharedMemCache<kBlockSize>::DeleteFromLayout(
+    Layout* layout, const GoogleString& raw_hash) {
   Position pos;
-  ExtractPosition(raw_hash, &pos);
+  ExtractPosition(layout, raw_hash, &pos);
 
-  Sector<kBlockSize>* sector = sectors_[pos.sector];
+  Sector<kBlockSize>* sector = layout->sectors[pos.sector].get();
   ScopedMutex lock(sector->mutex());
+  if (sector->migrated()) {
+    return false;
+  }
 
-  for (int p = 0; p < kAssociativity; ++p) {
-    EntryNum cand_key = pos.keys[p];
-    if (KeyMatch(sector->EntryAt(cand_key), raw_hash)) {
-      DeleteEntry(sector, cand_key);
-      return;
-    }
+  EntryNum entry_num = FindEntry(sector, pos, raw_hash);
+  if (entry_num != kInvalidEntry) {
+    DeleteEntry(sector, entry_num);
+    // Appending can't take the entry out of the checkpoint.
+    sector->set_checkpoint_needs_rewrite(true);
   }
+  return true;
 }
 
 // Called with lock held.
@@ -787,15 +1821,17 @@ void SharedMemCache<kBlockSize>::DeleteEntry(Sector<kBlockSize>* sector,
 
 template <size_t kBlockSize>
 void SharedMemCache<kBlockSize>::SanityCheck() {
-  for (int i = 0; i < num_sectors_; ++i) {
-    Sector<kBlockSize>* sector = sectors_[i];
+  ScopedView view(this);
+  const Layout* layout = view->current;
+  for (int i = 0; i < layout->num_sectors; ++i) {
+    Sector<kBlockSize>* sector = layout->sectors[i].get();
     ScopedMutex lock(sector->mutex());
 
     // Make sure that all blocks are accounted for exactly once.
 
     // First collect all blocks referred to from entries
     std::map<BlockNum, int> block_occur;
-    for (EntryNum e = 0; e < entries_per_sector_; ++e) {
+    for (EntryNum e = 0; e < layout->entries_per_sector; ++e) {
       CacheEntry* entry = sector->EntryAt(e);
       BlockVector blocks;
       sector->BlockListForEntry(entry, &blocks);
@@ -806,17 +1842,27 @@ void SharedMemCache<kBlockSize>::SanityCheck() {
 
     // Now from freelist. We re-use the API for convenience.
     BlockVector freelist_blocks;
-    sector->AllocBlocksFromFreeList(blocks_per_sector_, &freelist_blocks);
+    sector->AllocBlocksFromFreeList(layout->blocks_per_sector, &freelist_blocks);
     for (size_t i = 0; i < freelist_blocks.size(); ++i) {
       ++block_occur[freelist_blocks[i]];
     }
     sector->ReturnBlocksToFreeList(freelist_blocks);
 
-    CHECK(block_occur.size() == static_cast<size_t>(blocks_per_sector_));
+    CHECK(block_occur.size() ==
+          static_cast<size_t>(layout->blocks_per_sector));
     for (std::map<BlockNum, int>::iterator i = block_occur.begin();
          i != block_occur.end(); ++i) {
       CHECK_EQ(1, i->second);
     }
+
+    // Key tags must agree with the keys.
+    if (sector->has_key_tags()) {
+      for (EntryNum e = 0; e < layout->entries_per_sector; ++e) {
+        GoogleString raw_hash(sector->EntryAt(e)->hash_bytes, kHashSize);
+        CHECK_EQ(IsAllNil(raw_hash) ? kNoTag : KeyTagForRawHash(raw_hash),
+                 sector->GetKeyTag(e));
+      }
+    }
   }
 }
 
@@ -876,7 +1922,11 @@ void SharedMemCache<kBlockSize>::MarkEntryFree(Sector<kBlockSize>* sector,
   CacheEntry* entry = sector->EntryAt(entry_num);
   CHECK(Writeable(entry));
   std::memset(entry->hash_bytes, 0, kHashSize);
+  if (sector->has_key_tags()) {
+    sector->SetKeyTag(entry_num, kNoTag);
+  }
   entry->last_use_timestamp_ms = 0;
+  entry->last_write_timestamp_ms = 0;
   entry->byte_size = 0;
   entry->first_block = kInvalidBlock;
 }
@@ -920,7 +1970,7 @@ GoogleString SharedMemCache<kBlockSize>::ToRawHash(const GoogleString& key) {
 
 template <size_t kBlockSize>
 void SharedMemCache<kBlockSize>::ExtractPosition(
-    const GoogleString& raw_hash,
+    const Layout* layout, const GoogleString& raw_hash,
     SharedMemCache<kBlockSize>::Position* out_pos) {
   // We need at least 13 bytes of hash in code below, as we split it as follows:
   // keys[0] from hash[0..3]
@@ -939,17 +1989,70 @@ void SharedMemCache<kBlockSize>::ExtractPosition(
   // Get the sector # from the [12]th byte, being careful not to sign-extend;
   // we have to watch out for negatives for %
   int raw_sector = static_cast<int>(static_cast<unsigned char>(raw_hash[12]));
-  out_pos->sector = (raw_sector % sectors_.size());
+  out_pos->sector = (raw_sector % layout->num_sectors);
 
   const uint32* keys = reinterpret_cast<const uint32*>(raw_hash.data());
-  out_pos->keys[0] = static_cast<EntryNum>(keys[0] % entries_per_sector_);
-  out_pos->keys[1] = static_cast<EntryNum>(keys[1] % entries_per_sector_);
-  out_pos->keys[2] = static_cast<EntryNum>(keys[2] % entries_per_sector_);
+  if (directory_layout_ == kTaggedBuckets) {
+    int num_buckets = layout->entries_per_sector / kTagBucketWays;
+    EntryNum first_entry =
+        static_cast<EntryNum>(keys[1] % num_buckets) * kTagBucketWays;
+    out_pos->num_keys = kTagBucketWays;
+    for (int p = 0; p < kTagBucketWays; ++p) {
+      out_pos->keys[p] = first_entry + p;
+    }
+    out_pos->tag = KeyTagForRawHash(raw_hash);
+    return;
+  }
+
+  out_pos->num_keys = kAssociativity;
+  out_pos->tag = kNoTag;
+  out_pos->keys[0] = static_cast<EntryNum>(keys[0] % layout->entries_per_sector);
+  out_pos->keys[1] = static_cast<EntryNum>(keys[1] % layout->entries_per_sector);
+  out_pos->keys[2] = static_cast<EntryNum>(keys[2] % layout->entries_per_sector);
 
   // For entry 3, we potentially already used lower bits of key[3] word for
   // sector, so instead use higher-bits from keys[0] as lower ones.
   uint32 key3 = (keys[0] >> 16) | (keys[1] << 16);
-  out_pos->keys[3] = static_cast<EntryNum>(key3 % entries_per_sector_);
+  out_pos->keys[3] = static_cast<EntryNum>(key3 % layout->entries_per_sector);
+}
+
+template <size_t kBlockSize>
+EntryNum SharedMemCache<kBlockSize>::FindEntry(Sector<kBlockSize>* sector,
+                                               const Position& pos,
+                                               const GoogleString& raw_hash) {
+  if (sector->has_key_tags()) {
+    // Only entries whose tag matches can hold the key; with 8-bit tags a
+    // full bucket has a false match about 6% of the time.
+    uint32 matches = sector->MatchKeyTags(pos.keys[0], pos.tag);
+    while (matches != 0) {
+      EntryNum entry_num = pos.keys[0] + __builtin_ctz(matches);
+      if (KeyMatch(sector->EntryAt(entry_num), raw_hash)) {
+        return entry_num;
+      }
+      matches &= matches - 1;
+    }
+    return kInvalidEntry;
+  }
+
+  for (int p = 0; p < pos.num_keys; ++p) {
+    EntryNum cand_key = pos.keys[p];
+    if (KeyMatch(sector->EntryAt(cand_key), raw_hash)) {
+      return cand_key;
+    }
+  }
+  return kInvalidEntry;
+}
+
+template <size_t kBlockSize>
+void SharedMemCache<kBlockSize>::SetEntryKey(Sector<kBlockSize>* sector,
+                                             const Position& pos,
+                                             EntryNum entry_num,
+                                             const GoogleString& raw_hash) {
+  std::memcpy(sector->EntryAt(entry_num)->hash_bytes, raw_hash.data(),
+              kHashSize);
+  if (sector->has_key_tags()) {
+    sector->SetKeyTag(entry_num, pos.tag);
+  }
 }
 
 template <size_t kBlockSize>
@@ -976,7 +2079,8 @@ void SharedMemCache<kBlockSize>::EnsureReadyForWriting(
 
 template <size_t kBlockSize>
 int64 SharedMemCache<kBlockSize>::GetLastWriteMsForTesting(int sector_num) {
-  Sector<kBlockSize>* sector = sectors_[sector_num];
+  ScopedView view(this);
+  Sector<kBlockSize>* sector = view->current->sectors[sector_num].get();
   SectorStats* stats = sector->sector_stats();
   sector->mutex()->Lock();
   int64 last_checkpoint_ms = stats->last_checkpoint_ms;
@@ -987,7 +2091,8 @@ int64 SharedMemCache<kBlockSize>::GetLastWriteMsForTesting(int sector_num) {
 template <size_t kBlockSize>
 void SharedMemCache<kBlockSize>::SetLastWriteMsForTesting(
     int sector_num, int64 last_checkpoint_ms) {
-  Sector<kBlockSize>* sector = sectors_[sector_num];
+  ScopedView view(this);
+  Sector<kBlockSize>* sector = view->current->sectors[sector_num].get();
   SectorStats* stats = sector->sector_stats();
   sector->mutex()->Lock();
   stats->last_checkpoint_ms = last_checkpoint_ms;
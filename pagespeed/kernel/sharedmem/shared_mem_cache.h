@@ -20,7 +20,9 @@
 #ifndef PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_CACHE_H_
 #define PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_CACHE_H_
 
+#include <atomic>
 #include <cstddef>
+#include <memory>
 #include <vector>
 
 #include "pagespeed/kernel/base/basictypes.h"
@@ -31,14 +33,17 @@
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/cache/file_cache.h"
+#include "pagespeed/kernel/cache/frequency_sketch.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 
 namespace net_instaweb {
 
+class AbstractMutex;
 class AbstractSharedMem;
 class AbstractSharedMemSegment;
 class Hasher;
 class MessageHandler;
+class SharedMemCacheCheckpointWriter;
 class SharedMemCacheDump;
 class Timer;
 
@@ -49,6 +54,19 @@ class SharedMemCache : public CacheInterface {
   static const int kAssociativity = 4;  // Note: changing this requires changing
                                         // code of ExtractPosition as well.
 
+  // How each sector's directory maps keys to the entries that may hold them.
+  enum DirectoryLayout {
+    // Each key may be in any of kAssociativity entries scattered through
+    // the directory, and lookups compare the full key of each.
+    kSkewAssociative,
+    // Entries are grouped into buckets of SharedMemCacheData::kTagBucketWays
+    // (16), with a one-byte tag of each entry's key stored apart from the
+    // entries so that a lookup can check the whole bucket with one vector
+    // compare, and only compares full keys on a tag match.  The higher
+    // associativity means fewer conflict misses when the cache is churning.
+    kTaggedBuckets,
+  };
+
   // Initializes the cache's settings, but does not actually touch the shared
   // memory --- you must call Initialize or Attach (and handle them potentially
   // returning false) to do so. The filename parameter will be used to identify
@@ -77,6 +95,56 @@ class SharedMemCache : public CacheInterface {
   // Returns whether successful.
   bool Attach();
 
+  // Makes replacement scan-resistant: a new key only takes the place of the
+  // least-recently-used entry in its associativity set if it has been
+  // accessed at least as often recently.  Popularity is tracked per process,
+  // so this should be called in every process using the cache, either
+  // before or after Initialize/Attach.
+  void EnableAdmissionPolicy();
+
+  // Selects the directory layout; the default is kSkewAssociative.  This
+  // changes the segment layout, so it must be called with the same value in
+  // every process, before Initialize or Attach (and before EnableResizing).
+  // With kTaggedBuckets entries_per_sector is rounded up to a whole number of
+  // buckets.
+  void set_directory_layout(DirectoryLayout layout);
+  DirectoryLayout directory_layout() const { return directory_layout_; }
+
+  // Reserves room in the shared memory segment for the cache to be resized
+  // while running, up to a geometry ComputeDimensions would pick for
+  // max_size_kb.  This changes the segment layout, so it must be called with
+  // the same value in every process, before Initialize or Attach.  Until it is
+  // called, StartResize and Resize fail.
+  //
+  // The reservation is twice the larger of the configured and maximum sizes,
+  // since during a resize the old and new sectors coexist; pages of the half
+  // that's not in use are only touched by the next resize.
+  void EnableResizing(int64 max_size_kb);
+
+  // Switches the running cache to a new geometry, which may be larger or
+  // smaller, without discarding its contents.  Can be called from any process
+  // attached to the cache.
+  //
+  // StartResize formats the new sectors in the unused half of the segment
+  // and switches all processes over to them; from then on writes go to the
+  // new sectors, and lookups that miss there fall back to the old ones.
+  // Entries then move over one old sector at a time, via the same dump and
+  // restore code as snapshots, with each call to MigrateNextSector.  Entries
+  // that don't fit the new geometry are lost, least recently used first.
+  // MigrateNextSector returns false once no sectors are left to migrate, and
+  // the old half of the segment is retired when the last one is done.
+  //
+  // StartResize returns false if resizing isn't enabled, the geometry doesn't
+  // fit in the reservation, another resize is still migrating, or operations
+  // begun before the previous resize finished still hold the sectors it
+  // retired after a second; it leaves the cache as it was in all these cases.
+  bool StartResize(int sectors, int entries_per_sector, int blocks_per_sector);
+  bool MigrateNextSector();
+
+  // StartResize followed by migrating every sector.  Blocks for as long as
+  // copying the whole cache takes, so call it off the request path.
+  bool Resize(int sectors, int entries_per_sector, int blocks_per_sector);
+
   // This should be called from the root process as it is about to exit, when
   // no further children are expected to start.
   static void GlobalCleanup(AbstractSharedMem* shm_runtime,
@@ -95,7 +163,11 @@ class SharedMemCache : public CacheInterface {
                                 int64* size_cap_out);
 
   // Returns the largest size of an object this cache can store.
-  size_t MaxValueSize() const { return (blocks_per_sector_ * kBlockSize) / 8; }
+  size_t MaxValueSize() const;
+
+  // The geometry currently in use, which differs from the configured one
+  // after a resize.
+  int num_sectors() const;
 
   // Returns some statistics as plaintext.
   // TODO(morlovich): Potentially periodically push these to the main
@@ -114,7 +186,8 @@ class SharedMemCache : public CacheInterface {
                            SharedMemCacheDump* dest);
 
   // Restores entries stored in the dump into this cache. The dump
-  // may contain multiple sectors.
+  // may contain multiple sectors, and needn't come from a cache with the
+  // same geometry.
   void RestoreSnapshot(const SharedMemCacheDump& dump);
 
   // Encode/Decode SharedMemCacheDump objects.
@@ -143,6 +216,12 @@ class SharedMemCache : public CacheInterface {
   // cache has the same path we were constructed with, use that.  Otherwise, to
   // handle the default shm cache case, use the cache with the path that comes
   // first alphabetically.
+  //
+  // Sectors are checkpointed into files in the file cache's directory,
+  // written through its FileSystem on its worker thread, at most every
+  // checkpoint_interval_sec; Initialize restores them, using the file cache's
+  // ThreadSystem to read several sectors in parallel, even if they were
+  // written with a different geometry.
   void RegisterSnapshotFileCache(FileCache* potential_file_cache,
                                  int checkpoint_interval_sec);
 
@@ -152,29 +231,130 @@ class SharedMemCache : public CacheInterface {
   int64 GetLastWriteMsForTesting(int sector_num);
   void SetLastWriteMsForTesting(int sector_num, int64 last_checkpoint_ms);
 
-  void WriteOutSnapshotForTesting(int sector_num, int64 last_checkpoint_ms) {
-    WriteOutSnapshotFromWorkerThread(sector_num, last_checkpoint_ms);
-  }
+  void WriteOutSnapshotForTesting(int sector_num, int64 last_checkpoint_ms);
+  GoogleString CheckpointPathForTesting(int sector_num);
 
  private:
+  class RestoreFilesThread;
+  class ScopedView;
   class WriteOutSnapshotFunction;
+  struct ResizeState;
+
+  // The sectors of one cache geometry, in one half ("slot") of the segment.
+  // Slot 0 is the whole segment unless resizing is enabled.  A Layout is not
+  // changed once other threads can see it, and is kept until destruction
+  // since an operation that started before a resize may still be using it.
+  struct Layout {
+    int slot;
+    // Resize generation at which the slot was formatted for this layout.
+    int64 format_generation;
+    int num_sectors;
+    int entries_per_sector;
+    int blocks_per_sector;
+    std::vector<std::unique_ptr<SharedMemCacheData::Sector<kBlockSize>>>
+        sectors;
+
+    // Process-local, one per sector, each guarded by its sector's mutex.
+    // Empty unless the admission policy is enabled.
+    std::vector<std::unique_ptr<FrequencySketch>> sketches;
+  };
+
+  // The layouts this process uses as of a given resize generation: the
+  // current one, and while a resize is migrating entries, the one they are
+  // migrating from.  Like Layouts, Views are kept until destruction.
+  struct View {
+    int64 generation;
+    Layout* current;
+    Layout* previous;
+  };
 
-  // Describes potential placements of a key
+  // Describes potential placements of a key.  With kTaggedBuckets, keys are
+  // the entries of the bucket starting at keys[0], and tag is the key's tag.
   struct Position {
     int sector;
-    SharedMemCacheData::EntryNum keys[kAssociativity];
+    int num_keys;
+    SharedMemCacheData::EntryNum keys[SharedMemCacheData::kTagBucketWays];
+    SharedMemCacheData::KeyTag tag;
   };
 
   bool InitCache(bool parent);
 
+  // entries_per_sector rounded up to what the directory layout can use.
+  int DirectoryEntries(int entries_per_sector) const;
+
+  // Bytes needed by one sector of the given geometry.
+  size_t SectorSize(int entries_per_sector, int blocks_per_sector) const;
+
+  // Byte offset of the given slot within the segment.
+  size_t SlotOffset(int slot) const;
+
+  // Creates a Layout over the given slot, and either formats its sectors
+  // (initialize=true) or attaches to sectors already formatted by another
+  // process.  Returns nullptr on failure.  The result is owned by layouts_.
+  Layout* NewLayout(int slot, int sectors, int entries_per_sector,
+                    int blocks_per_sector, bool initialize);
+
+  // Returns a layout for what the resize state says is in the slot, reusing
+  // one this process already has if the slot hasn't been reformatted since.
+  // Expects resize_mutex_ held.
+  Layout* AttachLayout(int slot);
+
+  // Makes view_ match the shared resize state, and returns it.
+  View* RefreshView();
+
+  // Returns the current view, pinning its slots so that no resize can
+  // reformat them until UnpinView.  Use ScopedView rather than calling these
+  // directly.
+  View* PinView();
+  void UnpinView(View* view);
+
+  // (Re)creates the per-sector frequency sketches of the layout if the
+  // admission policy is enabled.
+  void AllocateSketches(Layout* layout);
+
+  // Admission policy helpers; both expect the sector lock held.
+  void RecordAccess(Layout* layout, int sector_num,
+                    const GoogleString& raw_hash);
+  bool Admit(Layout* layout, int sector_num, const GoogleString& raw_hash,
+             const SharedMemCacheData::CacheEntry* victim);
+
+  // Per-layout implementations of the CacheInterface operations.  Each
+  // returns false without doing anything if the sector for the key has
+  // already been migrated into a newer layout.
+  bool GetFromLayout(Layout* layout, const GoogleString& key,
+                     const GoogleString& raw_hash, Callback* callback,
+                     CacheInterface::KeyState* key_state);
+  bool DeleteFromLayout(Layout* layout, const GoogleString& raw_hash);
+
+  // Appends all complete entries of the sector to *dest, oldest first.
+  void DumpSector(SharedMemCacheData::Sector<kBlockSize>* sector,
+                  SharedMemCacheDump* dest)
+      EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
+
+  // Appends the value of the entry to *value.
+  void ReadEntryValue(SharedMemCacheData::Sector<kBlockSize>* sector,
+                      SharedMemCacheData::CacheEntry* entry,
+                      GoogleString* value)
+      EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
+
+  // Layout-specific versions of AddSectorToSnapshot and RestoreSnapshot.
+  bool SnapshotSector(Layout* layout, int sector_num, int64 last_checkpoint_ms,
+                      SharedMemCacheDump* dest);
+  void RestoreSnapshotInto(Layout* layout, const SharedMemCacheDump& dump);
+
+  // Moves the entries of one sector of 'from' into 'to', and marks the
+  // sector as migrated so that nothing reads or writes it any more.
+  void MigrateSector(Layout* from, int sector_num, Layout* to);
+
   // PutRawHash can be used in either realtime mode or in restore mode.  In
   // realtime mode (checkpoint_ok=true) a put can trigger a checkpoint and
   // last_use_timestamp_ms should be the current time.  In restore mode, a put
   // shouldn't checkpointing because we're in the middle of restoring a
   // checkpoint and last_use_timestamp_ms should be the timestamp to restore for
-  // the entry.
-  void PutRawHash(const GoogleString& raw_hash, int64 last_use_timestamp_ms,
-                  const SharedString& value, bool checkpoint_ok);
+  // the entry.  Returns false if the key's sector has been migrated.
+  bool PutRawHash(Layout* layout, const GoogleString& raw_hash,
+                  int64 last_use_timestamp_ms, const SharedString& value,
+                  bool checkpoint_ok);
 
   // Finish a get, with the entry matching and sector lock held.  Releases lock
   // while performing the read, but takes it again before returning.
@@ -226,7 +406,19 @@ class SharedMemCache : public CacheInterface {
   GoogleString ToRawHash(const GoogleString& key);
 
   // Given a hash, tells what sector and what entries in it to check.
-  void ExtractPosition(const GoogleString& raw_hash, Position* out_pos);
+  void ExtractPosition(const Layout* layout, const GoogleString& raw_hash,
+                       Position* out_pos);
+
+  // Returns which of the entries at pos holds the key, or kInvalidEntry.
+  SharedMemCacheData::EntryNum FindEntry(
+      SharedMemCacheData::Sector<kBlockSize>* sector, const Position& pos,
+      const GoogleString& raw_hash) EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
+
+  // Stores the key of the entry, after its previous user has been evicted.
+  void SetEntryKey(SharedMemCacheData::Sector<kBlockSize>* sector,
+                   const Position& pos, SharedMemCacheData::EntryNum entry_num,
+                   const GoogleString& raw_hash)
+      EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
 
   // Makes sure we have exclusive write access to the entry, with no concurrent
   // readers. Must be called with sector lock held.
@@ -234,33 +426,96 @@ class SharedMemCache : public CacheInterface {
                              SharedMemCacheData::CacheEntry* entry)
       EXCLUSIVE_LOCKS_REQUIRED(sector->mutex());
 
-  // Restore snapshots from the file cache, if set.
-  void RestoreFromDisk();
+  // Restore checkpoints from the file cache's directory, if set: those of
+  // whichever geometry was checkpointed most recently.  If that isn't
+  // layout's, checkpoints layout in full afterwards; either way, removes the
+  // other geometries' checkpoints once they're superseded.
+  void RestoreFromDisk(Layout* layout);
+
+  // Restores the checkpoint files in paths, taking the next index to do from
+  // *next, until there are none left.  With legacy_snapshots, paths[i] is
+  // sector i's file, and a sector without one is restored from a snapshot an
+  // earlier version stored in the file cache instead.  One geometry's files
+  // hold disjoint sets of keys, so several threads can do this at once.
+  void RestoreFilesFromDisk(Layout* layout, const StringVector& paths,
+                            bool legacy_snapshots, std::atomic<int>* next);
+
+  // Replays a checkpoint file into layout, returning false if there's no
+  // such file.  Entries go to whichever sector their key maps to, so the file
+  // may have been written with another geometry.
+  bool RestoreCheckpointFile(Layout* layout, const GoogleString& path);
+  void RestoreLegacySnapshot(Layout* layout, int sector_num);
 
   // Helper for PutRawHash that decides whether to call ScheduleSnapshot and
   // then makes the call if appropriate.
-  void ScheduleSnapshotIfNecessary(bool checkpoint_ok,
+  void ScheduleSnapshotIfNecessary(Layout* layout, bool checkpoint_ok,
                                    int64 last_use_timestamp_ms,
                                    int64 last_checkpoint_ms, int sector_num);
 
   // Write out the specified sector to the file cache so it will survive process
   // restarts.  We pass along last_checkpoint_ms so that if another thread or
   // process succeeds at snapshotting before we do we can abort quickly.
-  void ScheduleSnapshot(int sector_num, int64 last_checkpoint_ms);
+  void ScheduleSnapshot(Layout* layout, int sector_num,
+                        int64 last_checkpoint_ms);
 
   // ScheduleSnapshot asks the FileCache's slow worker thread to call this.
-  void WriteOutSnapshotFromWorkerThread(int sector_num,
+  // Does nothing if the cache has been resized away from layout since.
+  // Returns whether it wrote the checkpoint.
+  bool WriteOutSnapshotFromWorkerThread(Layout* layout, int sector_num,
                                         int64 last_checkpoint_ms);
 
-  // Key to store the snapshot of this sector under.  If two SharedMemCaches
-  // have the same cache key it's safe to restore a snapshot dumped from one
-  // into the other.
-  GoogleString SnapshotCacheKey(int sector_num) const;
+  // Rewrites every sector's checkpoint from scratch, and once they're all
+  // written, calls RemoveOtherCheckpointGeometries.  Used after entries were
+  // moved into layout from another geometry.
+  void CheckpointAllAndRemoveOthers(Layout* layout);
+
+  // Removes the checkpoints of every geometry but layout's.
+  void RemoveOtherCheckpointGeometries(const Layout* layout);
+
+  // Checkpointing helpers for WriteOutSnapshotFromWorkerThread.
+  //
+  // CollectCheckpointKeys checks last_checkpoint_ms like SnapshotSector, and
+  // if this thread gets to checkpoint the sector, outputs the keys of the
+  // entries to write, oldest first: all of them if *rewrite, otherwise those
+  // used since the last checkpoint.  It sets *rewrite if the sector needs its
+  // file rewritten anyway.  Takes the sector lock for as long as the walk of
+  // the LRU list takes, without copying any values.
+  bool CollectCheckpointKeys(Layout* layout, int sector_num,
+                             int64 last_checkpoint_ms, bool* rewrite,
+                             StringVector* raw_hashes);
+
+  // Writes out those of the entries that are still in the sector, releasing
+  // the sector lock each time writer has a batch to flush.  Returns false if
+  // writing failed or the sector was migrated.
+  bool WriteCheckpointEntries(Layout* layout, int sector_num,
+                              const StringVector& raw_hashes,
+                              SharedMemCacheCheckpointWriter* writer);
+
+  // Directory of this cache's checkpoints, and the file in it the sector is
+  // checkpointed into, which is named for layout's geometry and the sector.
+  GoogleString CheckpointDir() const;
+  GoogleString CheckpointGeometry(const Layout* layout) const;
+  GoogleString CheckpointPath(const Layout* layout, int sector_num) const;
+
+  // Lists the checkpoint files in CheckpointDir(), and the geometry each was
+  // written with.
+  void ListCheckpointFiles(StringVector* paths, StringVector* geometries);
+
+  // The geometry of the most recently modified checkpoint file, preferring
+  // layout's on a tie, or empty if there are none.
+  GoogleString NewestCheckpointGeometry(const Layout* layout);
+
+  // Key an earlier version stored the snapshot of this sector under.  If two
+  // SharedMemCaches have the same cache key it's safe to restore a snapshot
+  // dumped from one into the other.
+  GoogleString SnapshotCacheKey(const Layout* layout, int sector_num) const;
 
   AbstractSharedMem* shm_runtime_;
   const Hasher* hasher_;
   Timer* timer_;
   GoogleString filename_;
+  // The configured geometry, used by Initialize and as the fallback for
+  // Attach when resizing is disabled.
   int num_sectors_;
   int entries_per_sector_;
   int blocks_per_sector_;
@@ -270,10 +525,30 @@ class SharedMemCache : public CacheInterface {
   FileCache* file_cache_;
 
   std::unique_ptr<AbstractSharedMemSegment> segment_;
-  std::vector<SharedMemCacheData::Sector<kBlockSize>*> sectors_;
+
+  // Resizing support; resize_state_ is nullptr unless EnableResizing was
+  // called.  It lives at the start of the segment, followed by the mutex
+  // serializing changes to it, and then the two slots of slot_bytes_ each.
+  int64 max_size_kb_;
+  size_t control_bytes_;
+  size_t slot_bytes_;
+  ResizeState* resize_state_;
+  std::unique_ptr<AbstractMutex> resize_mutex_;
+
+  // All layouts and views this process has used; only appended to, either
+  // during Initialize/Attach or with resize_mutex_ held.  view_ points to the
+  // newest view.
+  std::vector<std::unique_ptr<Layout>> layouts_;
+  std::vector<std::unique_ptr<View>> views_;
+  std::atomic<View*> view_;
 
   GoogleString name_;
 
+  bool admission_policy_enabled_;
+  DirectoryLayout directory_layout_;
+
+  friend class SharedMemCacheTestBase;
+
   DISALLOW_COPY_AND_ASSIGN(SharedMemCache);
 };
 
@@ -0,0 +1,229 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/sharedmem/shared_mem_cache_checkpoint.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+
+#ifdef USE_SYSTEM_ZLIB
+#include "zlib.h"
+#else
+#include "external/envoy/bazel/foreign_cc/zlib/include/zlib.h"
+#endif
+
+namespace net_instaweb {
+
+namespace {
+
+const uint32 kRecordMagic = 0x534d4331;  // "SMC1"
+const int kReadChunkBytes = 64 * 1024;
+
+// Bounds on the sizes a record header may claim, so that a damaged header
+// can't make the reader allocate without limit.
+const uint32 kMaxKeySize = 1024;
+const uint32 kMaxValueSize = 1 << 30;
+
+// Each record is this header, followed by the key and the value.
+struct RecordHeader {
+  uint32 magic;
+  uint32 key_size;
+  uint32 value_size;
+  uint32 checksum;  // crc32 of everything in the record after it.
+  int64 last_use_timestamp_ms;
+};
+
+uint32 Crc(uint32 crc, const void* data, size_t size) {
+  return crc32(crc, static_cast<const Bytef*>(data), static_cast<uInt>(size));
+}
+
+uint32 RecordChecksum(const RecordHeader& header, StringPiece key,
+                      StringPiece value) {
+  uint32 crc = Crc(crc32(0L, Z_NULL, 0), &header.key_size,
+                   sizeof(header.key_size) + sizeof(header.value_size));
+  crc = Crc(crc, &header.last_use_timestamp_ms,
+            sizeof(header.last_use_timestamp_ms));
+  crc = Crc(crc, key.data(), key.size());
+  return Crc(crc, value.data(), value.size());
+}
+
+}  // namespace
+
+SharedMemCacheCheckpointWriter::SharedMemCacheCheckpointWriter(
+    FileSystem* file_system, const GoogleString& path, bool rewrite,
+    MessageHandler* handler)
+    : file_system_(file_system),
+      path_(path),
+      rewrite_(rewrite),
+      handler_(handler),
+      file_(nullptr),
+      ok_(true) {}
+
+SharedMemCacheCheckpointWriter::~SharedMemCacheCheckpointWriter() {
+  if (file_ != nullptr) {
+    // Finish wasn't called, so whatever we wrote is incomplete.
+    GoogleString filename = file_->filename();
+    file_system_->Close(file_, handler_);
+    if (rewrite_) {
+      file_system_->RemoveFile(filename.c_str(), handler_);
+    }
+  }
+}
+
+bool SharedMemCacheCheckpointWriter::Open() {
+  DCHECK(file_ == nullptr);
+  if (rewrite_) {
+    file_ = file_system_->OpenTempFile(StrCat(path_, ".temp"), handler_);
+  } else {
+    file_ = file_system_->OpenOutputFileForAppend(path_.c_str(), handler_);
+  }
+  return file_ != nullptr;
+}
+
+bool SharedMemCacheCheckpointWriter::Add(StringPiece raw_key,
+                                         int64 last_use_timestamp_ms,
+                                         StringPiece value) {
+  RecordHeader header;
+  header.magic = kRecordMagic;
+  header.key_size = raw_key.size();
+  header.value_size = value.size();
+  header.last_use_timestamp_ms = last_use_timestamp_ms;
+  header.checksum = RecordChecksum(header, raw_key, value);
+  buffer_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  raw_key.AppendToString(&buffer_);
+  value.AppendToString(&buffer_);
+  return ok_;
+}
+
+bool SharedMemCacheCheckpointWriter::Flush() {
+  DCHECK(file_ != nullptr);
+  if (ok_ && !buffer_.empty()) {
+    ok_ = file_->Write(buffer_, handler_) && file_->Flush(handler_);
+  }
+  buffer_.clear();
+  return ok_;
+}
+
+bool SharedMemCacheCheckpointWriter::Finish() {
+  Flush();
+  GoogleString filename = file_->filename();
+  ok_ = file_system_->Close(file_, handler_) && ok_;
+  file_ = nullptr;
+  if (rewrite_) {
+    if (ok_) {
+      ok_ = file_system_->RenameFile(filename.c_str(), path_.c_str(),
+                                     handler_);
+    }
+    if (!ok_) {
+      file_system_->RemoveFile(filename.c_str(), handler_);
+    }
+  }
+  return ok_;
+}
+
+SharedMemCacheCheckpointReader::SharedMemCacheCheckpointReader(
+    FileSystem* file_system, const GoogleString& path,
+    MessageHandler* handler)
+    : file_system_(file_system),
+      path_(path),
+      handler_(handler),
+      file_(nullptr),
+      pos_(0),
+      eof_(false),
+      records_(0),
+      damaged_(false) {}
+
+SharedMemCacheCheckpointReader::~SharedMemCacheCheckpointReader() {
+  if (file_ != nullptr) {
+    file_system_->Close(file_, handler_);
+  }
+}
+
+bool SharedMemCacheCheckpointReader::Open() {
+  DCHECK(file_ == nullptr);
+  NullMessageHandler null_handler;  // A missing file is not an error.
+  if (!file_system_->Exists(path_.c_str(), &null_handler).is_true()) {
+    return false;
+  }
+  file_ = file_system_->OpenInputFile(path_.c_str(), handler_);
+  return file_ != nullptr;
+}
+
+bool SharedMemCacheCheckpointReader::Fill(size_t size) {
+  if (pos_ > 0) {
+    buffer_.erase(0, pos_);
+    pos_ = 0;
+  }
+  while (buffer_.size() < size && !eof_) {
+    size_t old_size = buffer_.size();
+    size_t chunk = std::max<size_t>(kReadChunkBytes, size - old_size);
+    buffer_.resize(old_size + chunk);
+    int bytes = file_->Read(&buffer_[old_size], chunk, handler_);
+    if (bytes <= 0) {
+      bytes = 0;
+      eof_ = true;
+    }
+    buffer_.resize(old_size + bytes);
+  }
+  return buffer_.size() >= size;
+}
+
+bool SharedMemCacheCheckpointReader::Next(StringPiece* raw_key,
+                                          int64* last_use_timestamp_ms,
+                                          StringPiece* value) {
+  if (file_ == nullptr || damaged_) {
+    return false;
+  }
+  RecordHeader header;
+  if (buffer_.size() - pos_ < sizeof(header) && !Fill(sizeof(header))) {
+    // A clean end of file, unless there's part of a header left over.
+    damaged_ = (buffer_.size() > pos_);
+    return false;
+  }
+  memcpy(&header, buffer_.data() + pos_, sizeof(header));
+  if (header.magic != kRecordMagic || header.key_size > kMaxKeySize ||
+      header.value_size > kMaxValueSize) {
+    damaged_ = true;
+    return false;
+  }
+  size_t record_size = sizeof(header) + header.key_size + header.value_size;
+  if (buffer_.size() - pos_ < record_size && !Fill(record_size)) {
+    damaged_ = true;
+    return false;
+  }
+  const char* key_start = buffer_.data() + pos_ + sizeof(header);
+  StringPiece key(key_start, header.key_size);
+  StringPiece val(key_start + header.key_size, header.value_size);
+  if (RecordChecksum(header, key, val) != header.checksum) {
+    damaged_ = true;
+    return false;
+  }
+  pos_ += record_size;
+  ++records_;
+  *raw_key = key;
+  *last_use_timestamp_ms = header.last_use_timestamp_ms;
+  *value = val;
+  return true;
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,123 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Append-only checkpoint files for SharedMemCache.  See "Checkpointing" at
+// the top of shared_mem_cache.cc.
+
+#ifndef PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_CACHE_CHECKPOINT_H_
+#define PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_CACHE_CHECKPOINT_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+
+// Writes entries to a checkpoint file, either appending to it, or (when
+// rewriting it from scratch) writing a temporary file that Finish() renames
+// over it, so that readers never see a half-written replacement.  Entries are
+// buffered and written out whenever more than kFlushBytes are pending, so the
+// memory used doesn't depend on how much is checkpointed.
+class SharedMemCacheCheckpointWriter {
+ public:
+  static const size_t kFlushBytes = 64 * 1024;
+
+  SharedMemCacheCheckpointWriter(FileSystem* file_system,
+                                 const GoogleString& path, bool rewrite,
+                                 MessageHandler* handler);
+  ~SharedMemCacheCheckpointWriter();
+
+  // Returns false if the file could not be opened, in which case nothing
+  // else should be called.
+  bool Open();
+
+  // Adds a record for one entry.  Returns false once a write has failed.
+  bool Add(StringPiece raw_key, int64 last_use_timestamp_ms,
+           StringPiece value);
+
+  // Whether Add has buffered enough that the caller should Flush.
+  bool ShouldFlush() const { return buffer_.size() >= kFlushBytes; }
+  bool Flush();
+
+  // Flushes and closes the file, and puts a rewritten file in place.
+  // Returns whether everything was written.
+  bool Finish();
+
+ private:
+  FileSystem* file_system_;
+  GoogleString path_;
+  bool rewrite_;
+  MessageHandler* handler_;
+  FileSystem::OutputFile* file_;
+  GoogleString buffer_;
+  bool ok_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedMemCacheCheckpointWriter);
+};
+
+// Reads back the records of a checkpoint file in the order they were
+// written, a chunk at a time.  Reading stops at the first record that is
+// truncated or fails its checksum, as a crash during an append leaves one
+// at the end of the file.
+class SharedMemCacheCheckpointReader {
+ public:
+  SharedMemCacheCheckpointReader(FileSystem* file_system,
+                                 const GoogleString& path,
+                                 MessageHandler* handler);
+  ~SharedMemCacheCheckpointReader();
+
+  // Returns false if there's no such file.
+  bool Open();
+
+  // Reads the next record, returning false when there are no more intact
+  // ones.  The outputs are only valid until the next call.
+  bool Next(StringPiece* raw_key, int64* last_use_timestamp_ms,
+            StringPiece* value);
+
+  // Number of intact records read, and whether reading stopped at a damaged
+  // one rather than at the end of the file.
+  int records() const { return records_; }
+  bool damaged() const { return damaged_; }
+
+ private:
+  // Makes at least size bytes available at buffer_[pos_], returning false if
+  // the file ends first.
+  bool Fill(size_t size);
+
+  FileSystem* file_system_;
+  GoogleString path_;
+  MessageHandler* handler_;
+  FileSystem::InputFile* file_;
+  GoogleString buffer_;
+  size_t pos_;
+  bool eof_;
+  int records_;
+  bool damaged_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedMemCacheCheckpointReader);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_CACHE_CHECKPOINT_H_
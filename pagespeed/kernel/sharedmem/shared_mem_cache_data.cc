@@ -22,12 +22,20 @@
 
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_data.h"
 
+#include <cstring>
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/string_util.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <emmintrin.h>
+// SSE2 is part of the x86-64 baseline, so needs no runtime check.
+#define PAGESPEED_SHM_CACHE_TAGS_SSE2 1
+#endif
+
 namespace net_instaweb {
 
 namespace SharedMemCacheData {
@@ -46,39 +54,56 @@ double percent(int64 portion, int64 total) {
 
 template <size_t kBlockSize>
 struct Sector<kBlockSize>::MemLayout {
-  MemLayout(size_t mutex_size, size_t cache_entries, size_t data_blocks) {
+  MemLayout(size_t mutex_size, size_t cache_entries, size_t data_blocks,
+            bool key_tags) {
     // Check out alignment assumptions -- everything must be of a size
     // that's multiple of 8. The exact sizes don't matter too much, but
     // we check it anyway to avoid surprises.
-    CHECK_EQ(104u, sizeof(SectorHeader));
-    CHECK_EQ(48u, sizeof(CacheEntry));
+    CHECK_EQ(120u, sizeof(SectorHeader));
+    CHECK_EQ(56u, sizeof(CacheEntry));
 
     header_bytes = AlignTo(8, sizeof(SectorHeader) + mutex_size);
     block_successor_list_bytes = AlignTo(8, sizeof(BlockNum) * data_blocks);
     size_t directory_size = sizeof(CacheEntry) * cache_entries;
-    metadata_bytes = AlignTo(
-        kBlockSize, header_bytes + directory_size + block_successor_list_bytes);
+    size_t directory_end =
+        header_bytes + block_successor_list_bytes + directory_size;
+    if (key_tags) {
+      // Aligned so that no bucket's tags straddle a cache line.
+      key_tags_offset = AlignTo(64, directory_end);
+      metadata_bytes = AlignTo(
+          kBlockSize, key_tags_offset + sizeof(KeyTag) * cache_entries);
+    } else {
+      key_tags_offset = 0;
+      metadata_bytes = AlignTo(kBlockSize, directory_end);
+    }
   }
 
   size_t header_bytes;  // also offset to the block successor list.
   size_t block_successor_list_bytes;
+  size_t key_tags_offset;  // 0 if there are no key tags.
   size_t metadata_bytes;  // e.g. offset to the blocks.
 };
 
 template <size_t kBlockSize>
 Sector<kBlockSize>::Sector(AbstractSharedMemSegment* segment,
                            size_t sector_offset, size_t cache_entries,
-                           size_t data_blocks)
+                           size_t data_blocks, bool key_tags)
     : cache_entries_(cache_entries),
       data_blocks_(data_blocks),
       segment_(segment),
+      key_tags_(nullptr),
       sector_offset_(sector_offset) {
-  MemLayout layout(segment->SharedMutexSize(), cache_entries, data_blocks);
+  DCHECK(!key_tags || (cache_entries % kTagBucketWays == 0));
+  MemLayout layout(segment->SharedMutexSize(), cache_entries, data_blocks,
+                   key_tags);
   char* base = const_cast<char*>(segment->Base()) + sector_offset;
   sector_header_ = reinterpret_cast<SectorHeader*>(base);
   block_successors_ = reinterpret_cast<BlockNum*>(base + layout.header_bytes);
   directory_base_ =
       base + layout.header_bytes + layout.block_successor_list_bytes;
+  if (key_tags) {
+    key_tags_ = reinterpret_cast<KeyTag*>(base + layout.key_tags_offset);
+  }
   blocks_base_ = base + layout.metadata_bytes;
 }
 
@@ -114,6 +139,9 @@ bool Sector<kBlockSize>::Initialize(MessageHandler* handler)
     entry->lru_next = kInvalidEntry;
     entry->first_block = kInvalidBlock;
   }
+  if (key_tags_ != nullptr) {
+    std::memset(key_tags_, kNoTag, sizeof(KeyTag) * cache_entries_);
+  }
 
   // Initialize the freelist and block successor list.
   sector_header_->free_list_front = kInvalidBlock;
@@ -130,9 +158,9 @@ bool Sector<kBlockSize>::Initialize(MessageHandler* handler)
 template <size_t kBlockSize>
 size_t Sector<kBlockSize>::RequiredSize(AbstractSharedMem* shmem_runtime,
                                         size_t cache_entries,
-                                        size_t data_blocks) {
+                                        size_t data_blocks, bool key_tags) {
   MemLayout layout(shmem_runtime->SharedMutexSize(), cache_entries,
-                   data_blocks);
+                   data_blocks, key_tags);
   return layout.metadata_bytes + data_blocks * kBlockSize;
 }
 
@@ -160,6 +188,28 @@ void Sector<kBlockSize>::ReturnBlocksToFreeList(const BlockVector& blocks) {
   sector_header_->stats.used_blocks -= blocks.size();
 }
 
+template <size_t kBlockSize>
+uint32 Sector<kBlockSize>::MatchKeyTags(EntryNum first_entry, KeyTag tag) {
+  DCHECK(has_key_tags());
+  DCHECK_EQ(0, first_entry % kTagBucketWays);
+  DCHECK_LE(static_cast<size_t>(first_entry + kTagBucketWays), cache_entries_);
+  const KeyTag* tags = key_tags_ + first_entry;
+#ifdef PAGESPEED_SHM_CACHE_TAGS_SSE2
+  static_assert(kTagBucketWays * sizeof(KeyTag) == sizeof(__m128i),
+                "a bucket's tags should fill one SSE2 vector");
+  __m128i bucket = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(bucket, _mm_set1_epi8(tag)));
+#else
+  uint32 mask = 0;
+  for (int i = 0; i < kTagBucketWays; ++i) {
+    if (tags[i] == tag) {
+      mask |= (1u << i);
+    }
+  }
+  return mask;
+#endif
+}
+
 template <size_t kBlockSize>
 void Sector<kBlockSize>::InsertEntryIntoLRU(EntryNum entry_num) {
   CacheEntry* entry = EntryAt(entry_num);
@@ -245,6 +295,7 @@ SectorStats::SectorStats()
       num_put_concurrent_create(0),
       num_put_concurrent_full_set(0),
       num_put_spins(0),
+      num_put_admission_rejected(0),
       num_get(0),
       num_get_hit(0),
       last_checkpoint_ms(0),
@@ -258,6 +309,7 @@ void SectorStats::Add(const SectorStats& other) {
   num_put_concurrent_create += other.num_put_concurrent_create;
   num_put_concurrent_full_set += other.num_put_concurrent_full_set;
   num_put_spins += other.num_put_spins;
+  num_put_admission_rejected += other.num_put_admission_rejected;
   num_get += other.num_get;
   num_get_hit += other.num_get_hit;
   used_entries += other.used_entries;
@@ -280,6 +332,8 @@ GoogleString SectorStats::Dump(size_t total_entries,
                         Integer64ToString(num_put_concurrent_full_set).c_str());
   absl::StrAppendFormat(&out, "  spinning sleeps performed by writers: %s\n",
                         Integer64ToString(num_put_spins).c_str());
+  absl::StrAppendFormat(&out, "  rejected by admission policy: %s\n",
+                        Integer64ToString(num_put_admission_rejected).c_str());
 
   absl::StrAppendFormat(&out, "Total get operations: %s\n",
                         Integer64ToString(num_get).c_str());
@@ -49,6 +49,13 @@ const BlockNum kInvalidBlock = -1;
 const EntryNum kInvalidEntry = -1;
 const size_t kHashSize = 16;
 
+// Tagged directories (see SharedMemCache::DirectoryLayout) group entries into
+// buckets of kTagBucketWays, and keep a one-byte tag of each entry's key in a
+// separate array, so that the tags of a bucket fill one 16-byte vector.
+const int kTagBucketWays = 16;
+typedef uint8 KeyTag;
+const KeyTag kNoTag = 0;  // tag of free entries
+
 struct SectorStats {
   SectorStats();
 
@@ -65,6 +72,7 @@ struct SectorStats {
   int64 num_put_concurrent_create;
   int64 num_put_concurrent_full_set;
   int64 num_put_spins;  // # of times writers had to sleep behind readers
+  int64 num_put_admission_rejected;  // new key less popular than victim
   int64 num_get;        // # of calls to get
   int64 num_get_hit;
   int64 last_checkpoint_ms;  // When this sector was last checkpointed to disk.
@@ -84,7 +92,11 @@ struct SectorHeader {
   BlockNum free_list_front;
   EntryNum lru_list_front;
   EntryNum lru_list_rear;
-  int32 padding;
+  // Non-zero once a resize has moved this sector's entries elsewhere.
+  int32 migrated;
+  // Non-zero if the sector's next checkpoint must rewrite its file rather
+  // than append to it, e.g. because an entry was deleted.
+  int32 checkpoint_needs_rewrite;
 
   SectorStats stats;
 
@@ -94,6 +106,7 @@ struct SectorHeader {
 struct CacheEntry {
   char hash_bytes[kHashSize];
   int64 last_use_timestamp_ms;
+  int64 last_write_timestamp_ms;
   int32 byte_size;
 
   // For LRU list, prev/next are kInvalidEntry to denote 'none', which
@@ -130,8 +143,11 @@ class Sector {
   // call Initialize() in the parent process, and Attach() in child processes,
   // and check their results as well. Also, segment is assumed to be owned
   // separately, with lifetime longer than ours.
+  //
+  // If key_tags is true the sector also has an array of key tags, one per
+  // entry; cache_entries should then be a multiple of kTagBucketWays.
   Sector(AbstractSharedMemSegment* segment, size_t sector_offset,
-         size_t cache_entries, size_t data_blocks);
+         size_t cache_entries, size_t data_blocks, bool key_tags = false);
   ~Sector();
 
   // This should be called from child processes to initialize client
@@ -150,7 +166,8 @@ class Sector {
   // Computes how much memory a sector will need for given number of entries.
   // Also makes sure it's padded to proper alignment.
   static size_t RequiredSize(AbstractSharedMem* shmem_runtime,
-                             size_t cache_entries, size_t data_blocks);
+                             size_t cache_entries, size_t data_blocks,
+                             bool key_tags = false);
 
   // Mutex ops.
 
@@ -223,6 +240,29 @@ class Sector {
   void UnlinkEntryFromLRU(EntryNum entry_num);
 
   EntryNum OldestEntryNum() { return sector_header_->lru_list_rear; }
+  EntryNum NewestEntryNum() { return sector_header_->lru_list_front; }
+
+  // Key tag ops, only for sectors created with key_tags.
+  // ------------------------------------------------------------
+
+  bool has_key_tags() const { return key_tags_ != nullptr; }
+
+  KeyTag GetKeyTag(EntryNum entry_num) EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
+    DCHECK(has_key_tags());
+    return key_tags_[entry_num];
+  }
+
+  void SetKeyTag(EntryNum entry_num, KeyTag tag)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
+    DCHECK(has_key_tags());
+    key_tags_[entry_num] = tag;
+  }
+
+  // Compares the tags of the kTagBucketWays entries starting at first_entry
+  // against tag, and returns a mask with bit i set if entry first_entry + i
+  // matches.  This is a single vector compare where SSE2 is available.
+  uint32 MatchKeyTags(EntryNum first_entry, KeyTag tag)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex());
 
   // Block ops.
   // ------------------------------------------------------------
@@ -255,6 +295,26 @@ class Sector {
 
   SectorStats* sector_stats() { return &sector_header_->stats; }
 
+  // Resize support
+  // ------------------------------------------------------------
+
+  bool migrated() const EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
+    return sector_header_->migrated != 0;
+  }
+  void set_migrated() EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
+    sector_header_->migrated = 1;
+  }
+
+  // Checkpoint support
+  // ------------------------------------------------------------
+
+  bool checkpoint_needs_rewrite() const EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
+    return sector_header_->checkpoint_needs_rewrite != 0;
+  }
+  void set_checkpoint_needs_rewrite(bool x) EXCLUSIVE_LOCKS_REQUIRED(mutex()) {
+    sector_header_->checkpoint_needs_rewrite = x ? 1 : 0;
+  }
+
   // Prints out all statistics in the header (some of which are maintained
   // by the higher-level)
   void DumpStats(MessageHandler* handler);
@@ -278,6 +338,7 @@ class Sector {
   SectorHeader* sector_header_;
   BlockNum* block_successors_ PT_GUARDED_BY(mutex());
   char* directory_base_;
+  KeyTag* key_tags_;  // nullptr unless created with key_tags
   char* blocks_base_;
   size_t sector_offset_;  // offset of the sector within the SHM segment
 
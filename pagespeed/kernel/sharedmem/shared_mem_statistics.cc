@@ -20,10 +20,12 @@
 #include "pagespeed/kernel/sharedmem/shared_mem_statistics.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstddef>
 #include <limits>
 #include <memory>
+#include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -56,11 +58,57 @@ const char kStatisticsObjName[] = "statistics";
 // statistics.
 const char kTimestampVariable[] = "timestamp_";
 
+// Everything in the segment that gets updated concurrently starts on a
+// boundary of this many bytes, so that unrelated updates from different
+// CPUs don't fight over the same cache line.
+const size_t kCacheLineSize = 64;
+
+static_assert(std::atomic<int64>::is_always_lock_free,
+              "Shared-memory statistics need lock-free int64 atomics");
+static_assert(std::atomic<double>::is_always_lock_free,
+              "Shared-memory statistics need lock-free double atomics");
+
+size_t RoundUpToCacheLine(size_t size) {
+  return (size + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+}
+
+// Follows the segment mutex at the start of the segment.
+struct SegmentHeader {
+  // Hands out histogram stripes to processes as they attach.
+  std::atomic<uint32> next_stripe;
+};
+
+void AtomicAdd(std::atomic<double>* target, double delta) {
+  double old_value = target->load(std::memory_order_relaxed);
+  while (!target->compare_exchange_weak(old_value, old_value + delta,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
+void AtomicMin(std::atomic<double>* target, double value) {
+  double old_value = target->load(std::memory_order_relaxed);
+  while ((value < old_value) &&
+         !target->compare_exchange_weak(old_value, value,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
+void AtomicMax(std::atomic<double>* target, double value) {
+  double old_value = target->load(std::memory_order_relaxed);
+  while ((value > old_value) &&
+         !target->compare_exchange_weak(old_value, value,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
 }  // namespace
 
-// Our shared memory storage format is an array of (mutex, int64).
+const int SharedMemHistogram::kStripes;
+
+// Our shared memory storage format is the segment mutex and header, then a
+// cache line holding an atomic int64 for each variable, then the histograms.
 SharedMemVariable::SharedMemVariable(StringPiece name, Statistics* stats)
-    : name_(name.as_string()), value_ptr_(nullptr) {}
+    : name_(name.as_string()), mutex_(nullptr), value_ptr_(nullptr) {}
 
 SharedMemStatistics::Var* SharedMemStatistics::NewVariable(StringPiece name) {
   if (frozen_) {
@@ -90,35 +138,60 @@ SharedMemStatistics::Hist* SharedMemStatistics::NewHistogram(StringPiece name) {
   return new Hist(name, this);
 }
 
-int64 SharedMemVariable::GetLockHeld() const { return *value_ptr_; }
+int64 SharedMemVariable::Get() const {
+  if (value_ptr_ == nullptr) {
+    return -1;
+  }
+  return value_ptr_->load(std::memory_order_relaxed);
+}
+
+void SharedMemVariable::Set(int64 value) {
+  if (value_ptr_ != nullptr) {
+    value_ptr_->store(value, std::memory_order_relaxed);
+  }
+}
 
-int64 SharedMemVariable::SetReturningPreviousValueLockHeld(int64 new_value) {
-  int64 previous_value = *value_ptr_;
-  *value_ptr_ = new_value;
-  return previous_value;
+int64 SharedMemVariable::SetReturningPreviousValue(int64 value) {
+  if (value_ptr_ == nullptr) {
+    return -1;
+  }
+  return value_ptr_->exchange(value, std::memory_order_relaxed);
 }
 
-void SharedMemVariable::AttachTo(AbstractSharedMemSegment* segment,
-                                 size_t offset,
-                                 MessageHandler* message_handler) {
-  mutex_.reset(segment->AttachToSharedMutex(offset));
-  if (mutex_.get() == nullptr) {
-    message_handler->Message(
-        kError, "Unable to attach to mutex for statistics variable %s",
-        name_.c_str());
+int64 SharedMemVariable::AddHelper(int64 delta) {
+  if (value_ptr_ == nullptr) {
+    return -1;
   }
+  return value_ptr_->fetch_add(delta, std::memory_order_relaxed) + delta;
+}
+
+int64 SharedMemVariable::GetLockHeld() const {
+  return value_ptr_->load(std::memory_order_relaxed);
+}
+
+int64 SharedMemVariable::SetReturningPreviousValueLockHeld(int64 new_value) {
+  return value_ptr_->exchange(new_value, std::memory_order_relaxed);
+}
 
-  value_ptr_ = reinterpret_cast<volatile int64*>(segment->Base() + offset +
-                                                 segment->SharedMutexSize());
+void SharedMemVariable::AttachTo(AbstractSharedMemSegment* segment,
+                                 size_t offset, AbstractMutex* mutex) {
+  mutex_ = mutex;
+  value_ptr_ = reinterpret_cast<std::atomic<int64>*>(
+      const_cast<char*>(segment->Base() + offset));
 }
 
-void SharedMemVariable::Reset() { mutex_.reset(); }
+void SharedMemVariable::Reset() {
+  mutex_ = nullptr;
+  value_ptr_ = nullptr;
+}
 
-AbstractMutex* SharedMemVariable::mutex() const { return mutex_.get(); }
+AbstractMutex* SharedMemVariable::mutex() const { return mutex_; }
 
 SharedMemHistogram::SharedMemHistogram(StringPiece name, Statistics* stats)
     : num_buckets_(kDefaultNumBuckets + kOutOfBoundsCatcherBuckets),
-      buffer_(nullptr) {}
+      buffer_(nullptr),
+      stripes_(nullptr),
+      stripe_(nullptr) {}
 
 SharedMemHistogram::~SharedMemHistogram() {}
 
@@ -138,8 +211,24 @@ void SharedMemHistogram::DCheckRanges() const {
   DCHECK_LT(buffer_->min_value_, buffer_->max_value_);
 }
 
+size_t SharedMemHistogram::AllocationSize(AbstractSharedMem* shm_runtime) {
+  // Shared memory space should include a mutex, HistogramBody and a Stripe
+  // with storage for the actual buckets for each stripe.
+  return RoundUpToCacheLine(shm_runtime->SharedMutexSize()) +
+         RoundUpToCacheLine(sizeof(HistogramBody)) + kStripes * StripeSize();
+}
+
+size_t SharedMemHistogram::StripeSize() const {
+  return RoundUpToCacheLine(sizeof(Stripe) +
+                            sizeof(std::atomic<int64>) * (num_buckets_ - 1));
+}
+
+SharedMemHistogram::Stripe* SharedMemHistogram::GetStripe(int index) const {
+  return reinterpret_cast<Stripe*>(stripes_ + index * StripeSize());
+}
+
 void SharedMemHistogram::AttachTo(AbstractSharedMemSegment* segment,
-                                  size_t offset,
+                                  size_t offset, int stripe,
                                   MessageHandler* message_handler) {
   mutex_.reset(segment->AttachToSharedMutex(offset));
   if (mutex_.get() == nullptr) {
@@ -148,13 +237,18 @@ void SharedMemHistogram::AttachTo(AbstractSharedMemSegment* segment,
     Reset();
     return;
   }
-  buffer_ = reinterpret_cast<HistogramBody*>(
-      const_cast<char*>(segment->Base() + offset + segment->SharedMutexSize()));
+  char* base = const_cast<char*>(segment->Base()) + offset +
+               RoundUpToCacheLine(segment->SharedMutexSize());
+  buffer_ = reinterpret_cast<HistogramBody*>(base);
+  stripes_ = base + RoundUpToCacheLine(sizeof(HistogramBody));
+  stripe_ = GetStripe(stripe);
 }
 
 void SharedMemHistogram::Reset() {
   mutex_ = std::make_unique<NullMutex>();
   buffer_ = nullptr;
+  stripes_ = nullptr;
+  stripe_ = nullptr;
 }
 
 int SharedMemHistogram::FindBucket(double value) {
@@ -182,7 +276,9 @@ void SharedMemHistogram::Add(double value) {
   if (buffer_ == nullptr) {
     return;
   }
-  ScopedMutex hold_lock(mutex_.get());
+  // The bucket layout only changes during setup, so this doesn't need the
+  // lock, and the stripe is updated atomically.
+  //
   // See if we should put the value in one of the out-of-bounds catcher buckets,
   // in which case we will change index from -1.
   int index = -1;
@@ -211,19 +307,13 @@ void SharedMemHistogram::Add(double value) {
     LOG(ERROR) << "Invalid bucket index found for" << value;
     return;
   }
-  buffer_->values_[index]++;
+  stripe_->values_[index].fetch_add(1, std::memory_order_relaxed);
   // Update actual min & max values;
-  if (buffer_->count_ == 0) {
-    buffer_->min_ = value;
-    buffer_->max_ = value;
-  } else if (value < buffer_->min_) {
-    buffer_->min_ = value;
-  } else if (value > buffer_->max_) {
-    buffer_->max_ = value;
-  }
-  buffer_->count_++;
-  buffer_->sum_ += value;
-  buffer_->sum_of_squares_ += value * value;
+  AtomicMin(&stripe_->min_, value);
+  AtomicMax(&stripe_->max_, value);
+  stripe_->count_.fetch_add(1, std::memory_order_relaxed);
+  AtomicAdd(&stripe_->sum_, value);
+  AtomicAdd(&stripe_->sum_of_squares_, value * value);
 }
 
 void SharedMemHistogram::Clear() {
@@ -236,15 +326,51 @@ void SharedMemHistogram::Clear() {
 }
 
 void SharedMemHistogram::ClearInternal() {
-  // Throw away data.
-  buffer_->min_ = 0;
-  buffer_->max_ = 0;
-  buffer_->count_ = 0;
-  buffer_->sum_ = 0;
-  buffer_->sum_of_squares_ = 0;
-  for (int i = 0; i < num_buckets_; ++i) {
-    buffer_->values_[i] = 0;
+  // Throw away data.  Values added concurrently may survive in part.
+  for (int s = 0; s < kStripes; ++s) {
+    Stripe* stripe = GetStripe(s);
+    stripe->min_.store(std::numeric_limits<double>::infinity(),
+                       std::memory_order_relaxed);
+    stripe->max_.store(-std::numeric_limits<double>::infinity(),
+                       std::memory_order_relaxed);
+    stripe->count_.store(0, std::memory_order_relaxed);
+    stripe->sum_.store(0, std::memory_order_relaxed);
+    stripe->sum_of_squares_.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < num_buckets_; ++i) {
+      stripe->values_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void SharedMemHistogram::MergeTotals(Totals* totals) const {
+  totals->count = 0;
+  totals->sum = 0;
+  totals->sum_of_squares = 0;
+  totals->min = std::numeric_limits<double>::infinity();
+  totals->max = -std::numeric_limits<double>::infinity();
+  for (int s = 0; s < kStripes; ++s) {
+    Stripe* stripe = GetStripe(s);
+    totals->count += stripe->count_.load(std::memory_order_relaxed);
+    totals->sum += stripe->sum_.load(std::memory_order_relaxed);
+    totals->sum_of_squares +=
+        stripe->sum_of_squares_.load(std::memory_order_relaxed);
+    totals->min =
+        std::min(totals->min, stripe->min_.load(std::memory_order_relaxed));
+    totals->max =
+        std::max(totals->max, stripe->max_.load(std::memory_order_relaxed));
+  }
+  if (totals->count == 0) {
+    totals->min = 0;
+    totals->max = 0;
+  }
+}
+
+double SharedMemHistogram::MergedBucketCount(int index) const {
+  double count = 0;
+  for (int s = 0; s < kStripes; ++s) {
+    count += GetStripe(s)->values_[index].load(std::memory_order_relaxed);
   }
+  return count;
 }
 
 int SharedMemHistogram::NumBuckets() { return num_buckets_; }
@@ -304,10 +430,12 @@ double SharedMemHistogram::AverageInternal() {
   if (buffer_ == nullptr) {
     return -1.0;
   }
-  if (buffer_->count_ == 0) {
+  Totals totals;
+  MergeTotals(&totals);
+  if (totals.count == 0) {
     return 0.0;
   }
-  return buffer_->sum_ / buffer_->count_;
+  return totals.sum / totals.count;
 }
 
 // Return estimated value that is larger than perc% of all data.
@@ -317,19 +445,29 @@ double SharedMemHistogram::PercentileInternal(const double perc) {
   if (buffer_ == nullptr) {
     return -1.0;
   }
-  if (buffer_->count_ == 0 || perc < 0) {
+  // Take a snapshot of the merged buckets, and count from that, so that
+  // values added meanwhile can't make the counts disagree.
+  std::vector<double> values(num_buckets_);
+  double total_count = 0;
+  for (int i = 0; i < num_buckets_; ++i) {
+    values[i] = MergedBucketCount(i);
+    total_count += values[i];
+  }
+  if (total_count == 0 || perc < 0) {
     return 0.0;
   }
+  Totals totals;
+  MergeTotals(&totals);
   // Floor of count_below is the number of values below the percentile.
   // We are indeed looking for the next value in histogram.
-  double count_below = floor(buffer_->count_ * perc / 100);
+  double count_below = floor(total_count * perc / 100);
   double count = 0;
   int i;
   // Find the bucket which is closest to the bucket that contains
   // the number we want.
   for (i = 0; i < num_buckets_; ++i) {
-    if (count + buffer_->values_[i] <= count_below) {
-      count += buffer_->values_[i];
+    if (count + values[i] <= count_below) {
+      count += values[i];
       if (count == count_below) {
         // The first number in (i+1)th bucket is the number we want. Its
         // estimated value is the lower-bound of (i+1)th bucket.
@@ -339,11 +477,15 @@ double SharedMemHistogram::PercentileInternal(const double perc) {
       break;
     }
   }
+  if (i == num_buckets_) {
+    // Only possible for perc >= 100.
+    return totals.max;
+  }
   // The (count_below + 1 - count)th number in bucket i is the number we want.
   // However, we do not know its exact value as we do not have a trace of all
   // values.
-  double fraction = (count_below + 1 - count) / BucketCount(i);
-  double bound = std::min(BucketWidth(), buffer_->max_ - BucketStart(i));
+  double fraction = (count_below + 1 - count) / values[i];
+  double bound = std::min(BucketWidth(), totals.max - BucketStart(i));
   double ret = BucketStart(i) + fraction * bound;
   return ret;
 }
@@ -352,13 +494,15 @@ double SharedMemHistogram::StandardDeviationInternal() {
   if (buffer_ == nullptr) {
     return -1.0;
   }
-  if (buffer_->count_ == 0) {
+  Totals totals;
+  MergeTotals(&totals);
+  if (totals.count == 0) {
     return 0.0;
   }
-  const double v = (buffer_->sum_of_squares_ * buffer_->count_ -
-                    buffer_->sum_ * buffer_->sum_) /
-                   (buffer_->count_ * buffer_->count_);
-  if (v < buffer_->sum_of_squares_ * std::numeric_limits<double>::epsilon()) {
+  const double v =
+      (totals.sum_of_squares * totals.count - totals.sum * totals.sum) /
+      (totals.count * totals.count);
+  if (v < totals.sum_of_squares * std::numeric_limits<double>::epsilon()) {
     return 0.0;
   }
   return std::sqrt(v);
@@ -368,21 +512,27 @@ double SharedMemHistogram::CountInternal() {
   if (buffer_ == nullptr) {
     return -1.0;
   }
-  return buffer_->count_;
+  Totals totals;
+  MergeTotals(&totals);
+  return totals.count;
 }
 
 double SharedMemHistogram::MaximumInternal() {
   if (buffer_ == nullptr) {
     return -1.0;
   }
-  return buffer_->max_;
+  Totals totals;
+  MergeTotals(&totals);
+  return totals.max;
 }
 
 double SharedMemHistogram::MinimumInternal() {
   if (buffer_ == nullptr) {
     return -1.0;
   }
-  return buffer_->min_;
+  Totals totals;
+  MergeTotals(&totals);
+  return totals.min;
 }
 
 double SharedMemHistogram::BucketStart(int index) {
@@ -421,7 +571,7 @@ double SharedMemHistogram::BucketCount(int index) {
   if (index < 0 || index >= num_buckets_) {
     return -1.0;
   }
-  return buffer_->values_[index];
+  return MergedBucketCount(index);
 }
 
 double SharedMemHistogram::BucketWidth() {
@@ -467,26 +617,25 @@ SharedMemStatistics::SharedMemStatistics(
 
 SharedMemStatistics::~SharedMemStatistics() {}
 
-bool SharedMemStatistics::InitMutexes(size_t per_var,
-                                      MessageHandler* message_handler) {
-  size_t pos = 0;
-  for (size_t i = 0; i < variables_size(); ++i, pos += per_var) {
-    Variable* var = variables(i);
-    if (!segment_->InitializeSharedMutex(pos, message_handler)) {
-      message_handler->Message(
-          kError, "Unable to create mutex for statistics variable %s",
-          var->GetName().as_string().c_str());
-      return false;
-    }
+size_t SharedMemStatistics::HeaderSize() const {
+  return RoundUpToCacheLine(shm_runtime_->SharedMutexSize()) +
+         RoundUpToCacheLine(sizeof(SegmentHeader));
+}
+
+bool SharedMemStatistics::InitSegment(MessageHandler* message_handler) {
+  if (!segment_->InitializeSharedMutex(0, message_handler)) {
+    message_handler->Message(kError, "Unable to create statistics mutex");
+    return false;
   }
-  for (size_t i = 0; i < up_down_size(); ++i, pos += per_var) {
-    UpDownCounter* var = up_downs(i);
-    if (!segment_->InitializeSharedMutex(pos, message_handler)) {
-      message_handler->Message(
-          kError, "Unable to create mutex for statistics variable %s",
-          var->GetName().as_string().c_str());
-      return false;
-    }
+  char* base = const_cast<char*>(segment_->Base());
+  SegmentHeader* header = reinterpret_cast<SegmentHeader*>(
+      base + RoundUpToCacheLine(shm_runtime_->SharedMutexSize()));
+  header->next_stripe.store(0, std::memory_order_relaxed);
+  size_t pos = HeaderSize();
+  for (size_t i = 0; i < variables_size() + up_down_size();
+       ++i, pos += kCacheLineSize) {
+    reinterpret_cast<std::atomic<int64>*>(base + pos)->store(
+        0, std::memory_order_relaxed);
   }
   for (size_t i = 0; i < histograms_size();) {
     if (!segment_->InitializeSharedMutex(pos, message_handler)) {
@@ -506,8 +655,8 @@ bool SharedMemStatistics::Init(bool parent, MessageHandler* message_handler) {
   frozen_ = true;
 
   // Compute size of shared memory
-  size_t per_var = shm_runtime_->SharedMutexSize() + sizeof(int64);
-  size_t total = (variables_size() + up_down_size()) * per_var;
+  size_t total = HeaderSize() + (variables_size() + up_down_size()) *
+                                    kCacheLineSize;
   for (size_t i = 0; i < histograms_size(); ++i) {
     SharedMemHistogram* hist = histograms(i);
     total += hist->AllocationSize(shm_runtime_);
@@ -521,13 +670,14 @@ bool SharedMemStatistics::Init(bool parent, MessageHandler* message_handler) {
 
     // Init the locks
     if (ok) {
-      if (!InitMutexes(per_var, message_handler)) {
+      if (!InitSegment(message_handler)) {
         // We had a segment but could not make some mutex. In this case,
         // we can't predict what would happen if the child process tried
         // to touch messed up mutexes. Accordingly, we blow away the
         // segment.
         segment_.reset(nullptr);
         shm_runtime_->DestroySegment(SegmentName(), message_handler);
+        ok = false;
       }
     }
   } else {
@@ -543,19 +693,35 @@ bool SharedMemStatistics::Init(bool parent, MessageHandler* message_handler) {
                              "statistics functionality unavailable.");
   }
 
+  int stripe = 0;
+  if (ok) {
+    segment_mutex_.reset(segment_->AttachToSharedMutex(0));
+    if (segment_mutex_.get() == nullptr) {
+      // The variables still work without it, but statistics logging won't.
+      message_handler->Message(kError,
+                               "Unable to attach to statistics mutex");
+    }
+    SegmentHeader* header = reinterpret_cast<SegmentHeader*>(
+        const_cast<char*>(segment_->Base()) +
+        RoundUpToCacheLine(shm_runtime_->SharedMutexSize()));
+    stripe = header->next_stripe.fetch_add(1, std::memory_order_relaxed) %
+             SharedMemHistogram::kStripes;
+  }
+
   // Now make the variable objects actually point to the right things.
-  size_t pos = 0;
-  for (size_t i = 0; i < variables_size(); ++i, pos += per_var) {
+  size_t pos = HeaderSize();
+  for (size_t i = 0; i < variables_size(); ++i, pos += kCacheLineSize) {
     if (ok) {
-      variables(i)->impl()->AttachTo(segment_.get(), pos, message_handler);
+      variables(i)->impl()->AttachTo(segment_.get(), pos,
+                                     segment_mutex_.get());
     } else {
       variables(i)->impl()->Reset();
     }
   }
   // Now make the up_down_counter objects actually point to the right things.
-  for (size_t i = 0; i < up_down_size(); ++i, pos += per_var) {
+  for (size_t i = 0; i < up_down_size(); ++i, pos += kCacheLineSize) {
     if (ok) {
-      up_downs(i)->impl()->AttachTo(segment_.get(), pos, message_handler);
+      up_downs(i)->impl()->AttachTo(segment_.get(), pos, segment_mutex_.get());
     } else {
       up_downs(i)->impl()->Reset();
     }
@@ -564,7 +730,7 @@ bool SharedMemStatistics::Init(bool parent, MessageHandler* message_handler) {
   for (size_t i = 0; i < histograms_size();) {
     SharedMemHistogram* hist = histograms(i);
     if (ok) {
-      hist->AttachTo(segment_.get(), pos, message_handler);
+      hist->AttachTo(segment_.get(), pos, stripe, message_handler);
       if (parent) {
         hist->Init();
       }
@@ -20,6 +20,7 @@
 #ifndef PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_STATISTICS_H_
 #define PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_STATISTICS_H_
 
+#include <atomic>
 #include <cstddef>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -40,10 +41,12 @@ class Timer;
 
 // An implementation of Statistics using our shared memory infrastructure.
 // These statistics will be shared amongst all processes and threads
-// spawned by our host.  Note that we will be obtaining a per-variable mutex for
-// every read and write to these variables.  Since this may be expensive,
-// we may need each thread to keep a local cache and infrequently write
-// through to this Statistics object.  TODO(abliss): actually do this.
+// spawned by our host.  Each variable is a lock-free std::atomic<int64> in a
+// cache line of its own, so updating a variable never takes a lock and
+// never contends with updates to its neighbors.  The mutex() that
+// MutexedScalar exposes, which StatisticsLogger uses to elect a single
+// process to write the log, is one cross-process mutex shared by the whole
+// segment.
 //
 // Because we must allocate shared memory segments and mutexes before any child
 // processes and threads are created, all AddVariable calls must be done in
@@ -62,6 +65,14 @@ class SharedMemVariable : public MutexedScalar {
   ~SharedMemVariable() override {}
   virtual StringPiece GetName() const { return name_; }
 
+  // These hide the locking versions in MutexedScalar.  VarTemplate and
+  // UpDownTemplate call them on the concrete type, so these are what
+  // the Variable and UpDownCounter interfaces end up using.
+  int64 Get() const;
+  void Set(int64 value);
+  int64 SetReturningPreviousValue(int64 value);
+  int64 AddHelper(int64 delta);
+
  protected:
   AbstractMutex* mutex() const override;
   int64 GetLockHeld() const override;
@@ -73,8 +84,9 @@ class SharedMemVariable : public MutexedScalar {
 
   explicit SharedMemVariable(const StringPiece& name);
 
+  // mutex is the segment-wide mutex, owned by SharedMemStatistics.
   void AttachTo(AbstractSharedMemSegment* segment_, size_t offset,
-                MessageHandler* message_handler);
+                AbstractMutex* mutex);
 
   // Called on initialization failure, to make sure it's clear if we
   // share some state with parent.
@@ -83,11 +95,11 @@ class SharedMemVariable : public MutexedScalar {
   // The name of this variable.
   const GoogleString name_;
 
-  // Lock protecting us. NULL if for some reason initialization failed.
-  std::unique_ptr<AbstractMutex> mutex_;
+  // NULL if for some reason initialization failed.
+  AbstractMutex* mutex_;
 
   // The data...
-  volatile int64* value_ptr_;
+  std::atomic<int64>* value_ptr_;
 
   DISALLOW_COPY_AND_ASSIGN(SharedMemVariable);
 };
@@ -119,12 +131,12 @@ class SharedMemHistogram : public Histogram {
 
   // Return the amount of shared memory this Histogram objects needs for its
   // use.
-  size_t AllocationSize(AbstractSharedMem* shm_runtime) {
-    // Shared memory space should include a mutex, HistogramBody and the storage
-    // for the actual buckets.
-    return shm_runtime->SharedMutexSize() + sizeof(HistogramBody) +
-           sizeof(double) * NumBuckets();
-  }
+  size_t AllocationSize(AbstractSharedMem* shm_runtime);
+
+  // Number of sets of buckets each histogram keeps.  Each process adds to
+  // one set, chosen round-robin as processes attach, and readers merge them
+  // all.
+  static const int kStripes = 8;
 
  protected:
   AbstractMutex* lock() override { return mutex_.get(); }
@@ -139,7 +151,42 @@ class SharedMemHistogram : public Histogram {
 
  private:
   friend class SharedMemStatistics;
-  void AttachTo(AbstractSharedMemSegment* segment, size_t offset,
+
+  // TODO(fangfei): implement a non-shared-mem histogram.
+  // Bucket layout, set up before any values are added.
+  struct HistogramBody {
+    // Enable negative values in histogram, false by default.
+    bool enable_negative_;
+    // Minimum value allowed in Histogram, 0 by default.
+    double min_value_;
+    // Maximum value allowed in Histogram,
+    // numeric_limits<double>::max() by default.
+    double max_value_;
+  };
+
+  // The data, one per stripe.  Add updates these without locking.
+  struct Stripe {
+    std::atomic<int64> count_;
+    std::atomic<double> sum_;
+    std::atomic<double> sum_of_squares_;
+    // Real minimum and maximum values, +/-infinity while empty.
+    std::atomic<double> min_;
+    std::atomic<double> max_;
+    // Histogram buckets data.
+    std::atomic<int64> values_[1];
+  };
+
+  // Summary statistics merged across stripes.
+  struct Totals {
+    double count;
+    double sum;
+    double sum_of_squares;
+    double min;
+    double max;
+  };
+
+  // stripe is the index of the stripe this process adds to.
+  void AttachTo(AbstractSharedMemSegment* segment, size_t offset, int stripe,
                 MessageHandler* message_handler);
 
   // Returns the width of normal buckets (as in not the two extreme outermost
@@ -153,30 +200,18 @@ class SharedMemHistogram : public Histogram {
   void DCheckRanges() const;
   void Reset();
   void ClearInternal();  // expects mutex_ held, buffer_ != NULL
+  size_t StripeSize() const;
+  Stripe* GetStripe(int index) const;
+  void MergeTotals(Totals* totals) const;
+  double MergedBucketCount(int index) const;
+
   const GoogleString name_;
   std::unique_ptr<AbstractMutex> mutex_;
-  // TODO(fangfei): implement a non-shared-mem histogram.
-  struct HistogramBody {
-    // Enable negative values in histogram, false by default.
-    bool enable_negative_;
-    // Minimum value allowed in Histogram, 0 by default.
-    double min_value_;
-    // Maximum value allowed in Histogram,
-    // numeric_limits<double>::max() by default.
-    double max_value_;
-    // Real minimum value.
-    double min_;
-    // Real maximum value.
-    double max_;
-    double count_;
-    double sum_;
-    double sum_of_squares_;
-    // Histogram buckets data.
-    double values_[1];
-  };
   // Number of buckets in this histogram.
   int num_buckets_;
   HistogramBody* buffer_;  // may be NULL if init failed.
+  char* stripes_;
+  Stripe* stripe_;  // The one this process adds to.
   DISALLOW_COPY_AND_ASSIGN(SharedMemHistogram);
 };
 
@@ -225,15 +260,19 @@ class SharedMemStatistics
   Hist* NewHistogram(StringPiece name) override;
 
  private:
-  // Create mutexes in the segment, with per_var bytes being used,
-  // counting the mutex, for each variable.
-  bool InitMutexes(size_t per_var, MessageHandler* message_handler);
+  // Create the mutexes and atomics in the segment.
+  bool InitSegment(MessageHandler* message_handler);
+
+  // Bytes at the start of the segment for its mutex and stripe counter.
+  size_t HeaderSize() const;
 
   friend class SharedMemStatisticsTestBase;
 
   AbstractSharedMem* shm_runtime_;
   GoogleString filename_prefix_;
   std::unique_ptr<AbstractSharedMemSegment> segment_;
+  // Handed out as every variable's mutex(); see SharedMemVariable.
+  std::unique_ptr<AbstractMutex> segment_mutex_;
   bool frozen_;
   // TODO(sligocki): Rename.
   std::unique_ptr<StatisticsLogger> console_logger_;
@@ -0,0 +1,190 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_THREAD_MPSC_QUEUE_H_
+#define PAGESPEED_KERNEL_THREAD_MPSC_QUEUE_H_
+
+#include <atomic>
+
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// Unbounded FIFO queue that any number of threads may Push onto without
+// locking, but only one thread at a time may Pop from.  This is Dmitry
+// Vyukov's node-based MPSC queue: a producer swaps its node into
+// push_end_ and then links it to its predecessor, so producers never
+// contend with the consumer and only briefly with each other.
+//
+// Between those two steps the queue is momentarily split, and Pop and
+// Empty report the queue as ending at the unlinked node.  Callers must
+// therefore only rely on an item being visible once the Push that added it
+// has returned.
+//
+// All atomic operations on the queue proper are sequentially consistent, so
+// that callers can build Dekker-style handshakes ("push, then check flag"
+// racing with "clear flag, then check Empty") on top of this queue.
+//
+// Nodes are recycled rather than freed, so that a queue in steady use does
+// not allocate.  Each thread keeps a small cache of spare nodes, which Push
+// takes from and Pop returns to.  When the popping thread's cache is full,
+// Pop pushes the node onto the queue's free stack instead, and a producer
+// whose cache is empty refills it by taking the whole free stack of the
+// queue it is pushing to.  Taking the whole stack with one exchange, rather
+// than popping single nodes, keeps concurrent producers free of the ABA
+// problem.
+//
+// T must be cheap to copy; it is intended for pointers.
+template <class T>
+class MpscQueue {
+ public:
+  MpscQueue() : pop_end_(new Node(T())), free_nodes_(nullptr), num_free_(0) {
+    push_end_.store(pop_end_);
+  }
+
+  // Any elements still in the queue are discarded, not deleted.
+  ~MpscQueue() {
+    DeleteNodes(pop_end_);
+    DeleteNodes(free_nodes_.load());
+  }
+
+  // May be called from any thread.
+  void Push(const T& value) {
+    Node* node = NewNode(value);
+    Node* prev = push_end_.exchange(node);
+    prev->next.store(node);
+  }
+
+  // Consumer only.  Removes the oldest element into *value and returns
+  // true, or returns false if the queue is empty.
+  bool Pop(T* value) {
+    Node* next = pop_end_->next.load();
+    if (next == nullptr) {
+      return false;
+    }
+    // 'next' becomes the new stub; its value has been consumed.
+    *value = next->value;
+    next->value = T();
+    FreeNode(pop_end_);
+    pop_end_ = next;
+    return true;
+  }
+
+  // Consumer only.
+  bool Empty() const { return pop_end_->next.load() == nullptr; }
+
+ private:
+  struct Node {
+    explicit Node(const T& v) : value(v), next(nullptr) {}
+    T value;
+    std::atomic<Node*> next;
+  };
+
+  // Nodes a thread has taken from free stacks but not used yet.  They are
+  // interchangeable between queues of the same T.
+  class ThreadCache {
+   public:
+    ThreadCache() : head(nullptr), size(0) {}
+    ~ThreadCache() { DeleteNodes(head); }
+
+    Node* head;
+    int size;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(ThreadCache);
+  };
+
+  // Pop only fills a thread's cache up to kThreadCacheNodes.  A refill from
+  // a free stack can take it over that, up to about kMaxFreeNodes more.
+  static const int kThreadCacheNodes = 64;
+  static const int kMaxFreeNodes = 256;
+
+  static ThreadCache* GetThreadCache() {
+    static thread_local ThreadCache cache;
+    return &cache;
+  }
+
+  static void DeleteNodes(Node* node) {
+    while (node != nullptr) {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      delete node;
+      node = next;
+    }
+  }
+
+  Node* NewNode(const T& value) {
+    ThreadCache* cache = GetThreadCache();
+    if ((cache->head == nullptr) &&
+        (free_nodes_.load(std::memory_order_relaxed) != nullptr)) {
+      // num_free_ can lag the stack, so a stack may briefly hold a few more
+      // than kMaxFreeNodes; it only needs to be bounded, not exact.
+      cache->head = free_nodes_.exchange(nullptr, std::memory_order_acquire);
+      cache->size = num_free_.exchange(0, std::memory_order_relaxed);
+    }
+    Node* node = cache->head;
+    if (node == nullptr) {
+      return new Node(value);
+    }
+    cache->head = node->next.load(std::memory_order_relaxed);
+    if (cache->size > 0) {
+      --cache->size;
+    }
+    node->value = value;
+    node->next.store(nullptr, std::memory_order_relaxed);
+    return node;
+  }
+
+  // Consumer only, which makes this the free stack's only pusher.
+  void FreeNode(Node* node) {
+    ThreadCache* cache = GetThreadCache();
+    if (cache->size < kThreadCacheNodes) {
+      node->next.store(cache->head, std::memory_order_relaxed);
+      cache->head = node;
+      ++cache->size;
+      return;
+    }
+    if (num_free_.load(std::memory_order_relaxed) >= kMaxFreeNodes) {
+      delete node;
+      return;
+    }
+    num_free_.fetch_add(1, std::memory_order_relaxed);
+    Node* head = free_nodes_.load(std::memory_order_relaxed);
+    do {
+      node->next.store(head, std::memory_order_relaxed);
+    } while (!free_nodes_.compare_exchange_weak(head, node,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+  }
+
+  // pop_end_ is a stub node whose value has already been consumed; the
+  // oldest element is in pop_end_->next.  Only the consumer touches it.
+  Node* pop_end_;
+  std::atomic<Node*> push_end_;
+
+  // Recycled nodes, linked through next.  Producers only ever take the whole
+  // stack.
+  std::atomic<Node*> free_nodes_;
+  std::atomic<int> num_free_;
+
+  DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_THREAD_MPSC_QUEUE_H_
@@ -21,17 +21,21 @@
 
 #include <deque>
 #include <set>
+#include <thread>
 #include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/condvar.h"
 #include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/thread.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/base/waveform.h"
+#include "pagespeed/kernel/thread/mpsc_queue.h"
 #include "pagespeed/kernel/thread/queued_worker.h"
+#include "pagespeed/kernel/thread/work_stealing_deque.h"
 
 namespace net_instaweb {
 
@@ -43,10 +47,158 @@ inline void UpdateWaveform(Waveform* queue_size, int delta) {
   }
 }
 
+// Cancels functions removed from a sequence's queue.  This is called with
+// no locks held, and takes the Waveform rather than the sequence because
+// the sequence may have been deleted by then.
+void CancelFunctions(const std::vector<Function*>& functions,
+                     Waveform* queue_size) {
+  UpdateWaveform(queue_size, -static_cast<int>(functions.size()));
+  for (int i = 0, n = functions.size(); i < n; ++i) {
+    functions[i]->CallCancel();
+  }
+}
+
 const size_t kUnboundedQueue = 0;
 
+// A worker that only looks at its own deque will starve sequences queued
+// from outside the pool, so every so often it looks there first.
+const int kInjectionCheckInterval = 61;
+
+// A worker that finds no work while some is advertised in
+// num_waiting_sequences_ lost a steal race, or got there before the owner
+// finished publishing it.  It yields and retries this many times, and then
+// naps for kStealBackoffMs at a time until the work turns up or it is woken.
+const int kFailedFindsBeforeBackoff = 16;
+const int64 kStealBackoffMs = 1;
+
 }  // namespace
 
+// A worker thread for a pool with work stealing enabled.  The deque holds
+// sequences made runnable by functions running on this thread.
+class QueuedWorkerPool::StealingWorker : public ThreadSystem::Thread {
+ public:
+  StealingWorker(QueuedWorkerPool* pool, StringPiece name,
+                 Sequence* first_sequence)
+      : Thread(pool->thread_system_, name, ThreadSystem::kJoinable),
+        pool_(pool),
+        first_sequence_(first_sequence),
+        num_finds_(0),
+        next_victim_(0) {}
+
+  void Run() override {
+    current_ = this;
+    pool_->RunStealingWorker(this, first_sequence_);
+    current_ = nullptr;
+  }
+
+  // Returns the worker whose thread we are running on, if it belongs to
+  // 'pool'.
+  static StealingWorker* Current(QueuedWorkerPool* pool) {
+    return ((current_ != nullptr) && (current_->pool_ == pool)) ? current_
+                                                                 : nullptr;
+  }
+
+  WorkStealingDeque<Sequence>* deque() { return &deque_; }
+
+  // Whether this search for work should start with the pool's queue.
+  bool CheckInjectedFirst() {
+    return (++num_finds_ % kInjectionCheckInterval) == 0;
+  }
+
+  // Rotates through the workers to steal from so that thieves don't all
+  // pile onto the same victim.
+  int NextVictim(int num_workers) {
+    next_victim_ = (next_victim_ + 1) % num_workers;
+    return next_victim_;
+  }
+
+ private:
+  static thread_local StealingWorker* current_;
+
+  QueuedWorkerPool* pool_;
+  Sequence* first_sequence_;
+  WorkStealingDeque<Sequence> deque_;
+  int num_finds_;
+  int next_victim_;
+
+  DISALLOW_COPY_AND_ASSIGN(StealingWorker);
+};
+
+thread_local QueuedWorkerPool::StealingWorker*
+    QueuedWorkerPool::StealingWorker::current_ = nullptr;
+
+// The Sequence used by pools with work stealing.  Functions go onto an MPSC
+// queue that only the worker running the sequence pops from, so adding to a
+// sequence that is already waiting or running doesn't lock.  The sequence
+// mutex is only taken when the sequence becomes runnable or idle, and for
+// cancellation and shutdown.  Sequence's own work_queue_ stays empty, and
+// its shutdown_ and active_ flags are replaced by atomics that can be read
+// without the lock.
+class QueuedWorkerPool::LockFreeSequence : public QueuedWorkerPool::Sequence {
+ public:
+  LockFreeSequence(ThreadSystem* thread_system, QueuedWorkerPool* pool);
+  ~LockFreeSequence() override;
+
+  void Add(Function* function) override;
+  void CancelPendingFunctions() override LOCKS_EXCLUDED(consumer_mutex_);
+
+ private:
+  void Reset() override;
+  void WaitForShutDown() override;
+  bool InitiateShutDown() override;
+
+  // Only called by the worker running the sequence.
+  Function* NextFunction() override;
+
+  // Handles the cases of NextFunction that need sequence_mutex_: the
+  // first function of a run, going idle, and shutdown.
+  Function* NextFunctionSlow();
+
+  bool IsBusy() override {
+    return scheduled_.load() || (queued_count_.load() > 0);
+  }
+
+  // Cancels all pending tasks (and updates stats appropriately).  Called
+  // when the pool sheds a waiting sequence, so it takes over the
+  // sequence's scheduled state.
+  void Cancel() override;
+
+  // Pops the oldest function from functions_, or returns NULL.
+  Function* PopFunction() LOCKS_EXCLUDED(consumer_mutex_);
+  Function* PopFunctionLocked() EXCLUSIVE_LOCKS_REQUIRED(consumer_mutex_);
+
+  // Moves every function in functions_ to the end of *functions.
+  void DrainWorkQueue(std::vector<Function*>* functions)
+      LOCKS_EXCLUDED(consumer_mutex_);
+
+  bool WorkQueueEmpty() LOCKS_EXCLUDED(consumer_mutex_);
+
+  // Marks the sequence as handed to the pool to run.  Whoever makes this
+  // transition is responsible for queueing the sequence.
+  void MarkScheduled() EXCLUSIVE_LOCKS_REQUIRED(sequence_mutex_);
+
+  // Producers push here without locking; functions are popped with
+  // consumer_mutex_ held, which is normally only contended when
+  // cancelling.
+  MpscQueue<Function*> functions_;
+  std::unique_ptr<AbstractMutex> consumer_mutex_;
+  // Number of functions pushed and not yet popped.
+  std::atomic<int> queued_count_;
+
+  // True from the moment the sequence is handed to the pool to run until
+  // the worker running it finds its queue empty.  A sequence is only ever
+  // queued in the pool once at a time.
+  std::atomic<bool> scheduled_;
+
+  // Stand in for Sequence's shutdown_ and active_, and are written with
+  // sequence_mutex_ held, but also read without it.  running_ is only set
+  // by the worker running the sequence.
+  std::atomic<bool> closed_;
+  std::atomic<bool> running_;
+
+  DISALLOW_COPY_AND_ASSIGN(LockFreeSequence);
+};
+
 QueuedWorkerPool::QueuedWorkerPool(int max_workers,
                                    StringPiece thread_name_base,
                                    ThreadSystem* thread_system)
@@ -55,7 +207,15 @@ QueuedWorkerPool::QueuedWorkerPool(int max_workers,
       max_workers_(max_workers),
       shutdown_(false),
       queue_size_(nullptr),
-      load_shedding_threshold_(kNoLoadShedding) {
+      load_shedding_threshold_(kNoLoadShedding),
+      work_stealing_(false),
+      num_stealing_workers_(0),
+      num_waiting_sequences_(0),
+      num_injected_sequences_(0),
+      num_sleeping_workers_(0),
+      stop_stealing_workers_(false),
+      sleep_mutex_(thread_system_->NewMutex()),
+      wake_condvar_(sleep_mutex_->NewCondvar()) {
   thread_name_base.CopyToString(&thread_name_base_);
 }
 
@@ -71,6 +231,14 @@ QueuedWorkerPool::~QueuedWorkerPool() {
   }
 }
 
+void QueuedWorkerPool::EnableWorkStealing() {
+  ScopedMutex lock(mutex_.get());
+  DCHECK(active_workers_.empty());
+  DCHECK(available_workers_.empty());
+  work_stealing_ = true;
+  stealing_workers_.resize(max_workers_);
+}
+
 void QueuedWorkerPool::ShutDown() {
   InitiateShutDown();
   WaitForShutDownComplete();
@@ -116,6 +284,11 @@ void QueuedWorkerPool::WaitForShutDownComplete() {
     // further tasks will be started in the thread.
   }
 
+  if (work_stealing_) {
+    ShutDownStealingWorkers();
+    return;
+  }
+
   // Wait for all workers to complete whatever they were doing.
   //
   // TODO(jmarantz): attempt to cancel in-progress functions via
@@ -146,6 +319,37 @@ void QueuedWorkerPool::WaitForShutDownComplete() {
   available_workers_.clear();
 }
 
+void QueuedWorkerPool::ShutDownStealingWorkers() {
+  // No workers can be started once shutdown_ is set, so reading the count
+  // under mutex_ gives us all of them.
+  int num_workers = 0;
+  {
+    ScopedMutex lock(mutex_.get());
+    num_workers = num_stealing_workers_.load();
+  }
+  {
+    ScopedMutex lock(sleep_mutex_.get());
+    stop_stealing_workers_.store(true);
+    wake_condvar_->Broadcast();
+  }
+  // Workers still running may try to steal from those already joined, so
+  // only delete them once they have all exited.
+  for (int i = 0; i < num_workers; ++i) {
+    stealing_workers_[i]->Join();
+  }
+  num_stealing_workers_.store(0);
+  for (int i = 0; i < num_workers; ++i) {
+    stealing_workers_[i].reset();
+  }
+
+  // Anything still waiting belongs to a shut-down sequence, whose functions
+  // were canceled above.
+  ScopedMutex lock(mutex_.get());
+  queued_sequences_.clear();
+  num_injected_sequences_.store(0);
+  num_waiting_sequences_.store(0);
+}
+
 // Runs computable tasks through a worker.  Note that a first
 // candidate sequence is passed into this method, but we can start
 // looking at a new sequence when the passed-in one is exhausted
@@ -184,6 +388,11 @@ QueuedWorkerPool::Sequence* QueuedWorkerPool::AssignWorkerToNextSequence(
 }
 
 void QueuedWorkerPool::QueueSequence(Sequence* sequence) {
+  if (work_stealing_) {
+    QueueSequenceForStealing(sequence);
+    return;
+  }
+
   QueuedWorker* worker = nullptr;
   Sequence* drop_sequence = nullptr;
   {
@@ -232,6 +441,152 @@ void QueuedWorkerPool::QueueSequence(Sequence* sequence) {
   }
 }
 
+void QueuedWorkerPool::QueueSequenceForStealing(Sequence* sequence) {
+  // As with the classic pool, threads are started on demand, and a new
+  // thread starts out with the sequence that needed it.
+  if ((num_sleeping_workers_.load() == 0) &&
+      (num_stealing_workers_.load() < static_cast<int>(max_workers_))) {
+    ScopedMutex lock(mutex_.get());
+    int index = num_stealing_workers_.load();
+    if (!shutdown_ && (index < static_cast<int>(max_workers_))) {
+      StealingWorker* worker = new StealingWorker(
+          this, StrCat(thread_name_base_, "-", IntegerToString(index)),
+          sequence);
+      stealing_workers_[index].reset(worker);
+      num_stealing_workers_.store(index + 1);
+      worker->Start();
+      return;
+    }
+  }
+
+  StealingWorker* self = StealingWorker::Current(this);
+  if (self != nullptr) {
+    self->deque()->Push(sequence);
+  } else {
+    ScopedMutex lock(mutex_.get());
+    queued_sequences_.push_back(sequence);
+    ++num_injected_sequences_;
+  }
+
+  // Sleeping workers increment num_sleeping_workers_ and then check
+  // num_waiting_sequences_, so either they will see this sequence or we
+  // will see them and wake one up.
+  int num_waiting = ++num_waiting_sequences_;
+  if ((load_shedding_threshold_ != kNoLoadShedding) &&
+      (num_waiting > load_shedding_threshold_)) {
+    Sequence* drop_sequence = TakeOldestQueuedSequence(self);
+    if (drop_sequence != nullptr) {
+      drop_sequence->Cancel();
+    }
+  }
+  if (num_sleeping_workers_.load() > 0) {
+    ScopedMutex lock(sleep_mutex_.get());
+    wake_condvar_->Signal();
+  }
+}
+
+void QueuedWorkerPool::RunStealingWorker(StealingWorker* worker,
+                                         Sequence* sequence) {
+  int failed_finds = 0;
+  while (!stop_stealing_workers_.load()) {
+    if (sequence == nullptr) {
+      sequence = FindStealableSequence(worker);
+    }
+    if (sequence == nullptr) {
+      if ((num_waiting_sequences_.load() > 0) &&
+          (++failed_finds < kFailedFindsBeforeBackoff)) {
+        std::this_thread::yield();
+        continue;
+      }
+      ScopedMutex lock(sleep_mutex_.get());
+      ++num_sleeping_workers_;
+      if (num_waiting_sequences_.load() > 0) {
+        // Still advertised, so whoever holds it will most likely run it
+        // before we could; don't burn a CPU competing for it.
+        if (!stop_stealing_workers_.load()) {
+          wake_condvar_->TimedWait(kStealBackoffMs);
+        }
+      } else {
+        failed_finds = 0;
+        while ((num_waiting_sequences_.load() <= 0) &&
+               !stop_stealing_workers_.load()) {
+          wake_condvar_->Wait();
+        }
+      }
+      --num_sleeping_workers_;
+      continue;
+    }
+    failed_finds = 0;
+
+    // As in Run(), stick with one sequence until it is exhausted.
+    while (Function* function = sequence->NextFunction()) {
+      function->CallRun();
+    }
+    sequence = nullptr;
+  }
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::PopInjectedSequence() {
+  Sequence* sequence = nullptr;
+  if (num_injected_sequences_.load() > 0) {
+    ScopedMutex lock(mutex_.get());
+    if (!queued_sequences_.empty()) {
+      sequence = queued_sequences_.front();
+      queued_sequences_.pop_front();
+      --num_injected_sequences_;
+    }
+  }
+  return sequence;
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::FindStealableSequence(
+    StealingWorker* worker) {
+  Sequence* sequence = nullptr;
+  bool injected_first = worker->CheckInjectedFirst();
+  if (injected_first) {
+    sequence = PopInjectedSequence();
+  }
+  if (sequence == nullptr) {
+    sequence = worker->deque()->Pop();
+  }
+  if ((sequence == nullptr) && !injected_first) {
+    sequence = PopInjectedSequence();
+  }
+  if (sequence == nullptr) {
+    int num_workers = num_stealing_workers_.load();
+    int start = worker->NextVictim(num_workers);
+    for (int i = 0; (i < num_workers) && (sequence == nullptr); ++i) {
+      StealingWorker* victim = stealing_workers_[(start + i) % num_workers].get();
+      if (victim != worker) {
+        sequence = victim->deque()->Steal();
+      }
+    }
+  }
+  if (sequence != nullptr) {
+    --num_waiting_sequences_;
+  }
+  return sequence;
+}
+
+QueuedWorkerPool::Sequence* QueuedWorkerPool::TakeOldestQueuedSequence(
+    StealingWorker* worker) {
+  // Sequences queued from outside the pool are usually new requests, and
+  // are shed first.  Otherwise take the oldest from our own deque, and
+  // failing that from anyone's.
+  Sequence* sequence = PopInjectedSequence();
+  if ((sequence == nullptr) && (worker != nullptr)) {
+    sequence = worker->deque()->Steal();
+  }
+  for (int i = 0, n = num_stealing_workers_.load();
+       (i < n) && (sequence == nullptr); ++i) {
+    sequence = stealing_workers_[i]->deque()->Steal();
+  }
+  if (sequence != nullptr) {
+    --num_waiting_sequences_;
+  }
+  return sequence;
+}
+
 bool QueuedWorkerPool::AreBusy(const SequenceSet& sequences)
     NO_THREAD_SAFETY_ANALYSIS {
   // This is the only operation that accesses multiple workers at once.
@@ -268,7 +623,11 @@ QueuedWorkerPool::Sequence* QueuedWorkerPool::NewSequence() {
   Sequence* sequence = nullptr;
   if (!shutdown_) {
     if (free_sequences_.empty()) {
-      sequence = new Sequence(thread_system_, this);
+      if (work_stealing_) {
+        sequence = new LockFreeSequence(thread_system_, this);
+      } else {
+        sequence = new Sequence(thread_system_, this);
+      }
       sequence->set_queue_size_stat(queue_size_);
       all_sequences_.push_back(sequence);
     } else {
@@ -475,4 +834,241 @@ bool QueuedWorkerPool::Sequence::IsBusy() {
   return active_ || !work_queue_.empty();
 }
 
+QueuedWorkerPool::LockFreeSequence::LockFreeSequence(
+    ThreadSystem* thread_system, QueuedWorkerPool* pool)
+    : Sequence(thread_system, pool),
+      consumer_mutex_(thread_system->NewMutex()),
+      queued_count_(0),
+      scheduled_(false),
+      closed_(false),
+      running_(false) {}
+
+QueuedWorkerPool::LockFreeSequence::~LockFreeSequence() {
+  DCHECK(closed_);
+  DCHECK_EQ(0, queued_count_.load());
+}
+
+void QueuedWorkerPool::LockFreeSequence::Reset() {
+  // scheduled_ is left alone: a sequence freed while waiting in the pool
+  // is still in the pool's queue, and will run from there.
+  Sequence::Reset();
+  ScopedMutex lock(sequence_mutex_.get());
+  closed_ = false;
+  running_ = false;
+  DCHECK_EQ(0, queued_count_.load());
+}
+
+bool QueuedWorkerPool::LockFreeSequence::InitiateShutDown() {
+  ScopedMutex lock(sequence_mutex_.get());
+  shutdown_ = true;
+  closed_ = true;
+  return !running_;
+}
+
+void QueuedWorkerPool::LockFreeSequence::WaitForShutDown() {
+  std::vector<Function*> canceled;
+  {
+    ScopedMutex lock(sequence_mutex_.get());
+    shutdown_ = true;
+    closed_ = true;
+    pool_ = nullptr;
+
+    while (running_) {
+      // We use a TimedWait rather than a Wait so that we don't deadlock if
+      // running_ turns false after the above check and before the call to
+      // TimedWait.
+      termination_condvar_->TimedWait(Timer::kSecondMs);
+    }
+    DrainWorkQueue(&canceled);
+  }
+
+  CancelFunctions(canceled, queue_size_);
+}
+
+Function* QueuedWorkerPool::LockFreeSequence::PopFunctionLocked() {
+  Function* function = nullptr;
+  if (functions_.Pop(&function)) {
+    --queued_count_;
+  }
+  return function;
+}
+
+Function* QueuedWorkerPool::LockFreeSequence::PopFunction() {
+  ScopedMutex lock(consumer_mutex_.get());
+  return PopFunctionLocked();
+}
+
+void QueuedWorkerPool::LockFreeSequence::DrainWorkQueue(
+    std::vector<Function*>* functions) {
+  ScopedMutex lock(consumer_mutex_.get());
+  while (Function* function = PopFunctionLocked()) {
+    functions->push_back(function);
+  }
+}
+
+bool QueuedWorkerPool::LockFreeSequence::WorkQueueEmpty() {
+  ScopedMutex lock(consumer_mutex_.get());
+  return functions_.Empty();
+}
+
+void QueuedWorkerPool::LockFreeSequence::MarkScheduled() {
+  scheduled_ = true;
+}
+
+void QueuedWorkerPool::LockFreeSequence::Cancel() {
+  std::vector<Function*> canceled;
+  DrainWorkQueue(&canceled);
+
+  // The pool dropped us from its queue, so we are no longer scheduled.
+  // Functions added since the drain saw scheduled_ set and left it to us
+  // to queue the sequence again.
+  QueuedWorkerPool* requeue_pool = nullptr;
+  {
+    ScopedMutex lock(sequence_mutex_.get());
+    scheduled_ = false;
+    if (!closed_ && !WorkQueueEmpty()) {
+      MarkScheduled();
+      requeue_pool = pool_;
+    }
+  }
+
+  CancelFunctions(canceled, queue_size_);
+  if (requeue_pool != nullptr) {
+    requeue_pool->QueueSequence(this);
+  }
+}
+
+void QueuedWorkerPool::LockFreeSequence::Add(Function* function) {
+  if (closed_.load()) {
+#ifndef NDEBUG
+    LOG(WARNING) << "Adding function to sequence " << this
+                 << " after shutdown";
+#endif
+    function->CallCancel();
+    return;
+  }
+
+  functions_.Push(function);
+  int queued = ++queued_count_;
+
+  Function* overflow = nullptr;
+  if ((max_queue_size_ != kUnboundedQueue) &&
+      (queued > static_cast<int>(max_queue_size_))) {
+    // As in Sequence::Add, overflowing a bounded queue cancels the oldest
+    // function.
+    ScopedMutex lock(consumer_mutex_.get());
+    if (queued_count_.load() > static_cast<int>(max_queue_size_)) {
+      overflow = PopFunctionLocked();
+    }
+  }
+
+  // If nobody is running or about to run this sequence, queue it.  The
+  // worker running it clears scheduled_ before a final check of the queue,
+  // so one of us will see the function we just pushed.
+  if (!scheduled_.load()) {
+    QueuedWorkerPool* pool = nullptr;
+    {
+      ScopedMutex lock(sequence_mutex_.get());
+      if (!closed_ && !scheduled_) {
+        MarkScheduled();
+        pool = pool_;
+      }
+    }
+    if (pool != nullptr) {
+      pool->QueueSequence(this);
+    }
+  }
+
+  // We checked closed_ without the lock, so the sequence may have shut
+  // down and drained its queue before our function got in.
+  if (closed_.load()) {
+    std::vector<Function*> canceled;
+    DrainWorkQueue(&canceled);
+    CancelFunctions(canceled, queue_size_);
+  }
+
+  if (overflow != nullptr) {
+    overflow->CallCancel();
+  }
+  UpdateWaveform(queue_size_, (overflow != nullptr) ? 0 : 1);
+}
+
+void QueuedWorkerPool::LockFreeSequence::CancelPendingFunctions() {
+  std::vector<Function*> canceled;
+  DrainWorkQueue(&canceled);
+  CancelFunctions(canceled, queue_size_);
+}
+
+Function* QueuedWorkerPool::LockFreeSequence::NextFunction() {
+  // While a worker is running this sequence only it pops functions, so
+  // the sequence mutex is not needed until the queue runs dry.
+  if (running_.load() && !closed_.load()) {
+    Function* function = PopFunction();
+    if (function != nullptr) {
+      UpdateWaveform(queue_size_, -1);
+      return function;
+    }
+  }
+  return NextFunctionSlow();
+}
+
+Function* QueuedWorkerPool::LockFreeSequence::NextFunctionSlow() {
+  // Copied so we can update it after the sequence may have been deleted.
+  Waveform* queue_size = queue_size_;
+  while (true) {
+    Function* function = nullptr;
+    QueuedWorkerPool* release_to_pool = nullptr;
+    std::vector<Function*> canceled;
+    bool went_idle = false;
+    {
+      ScopedMutex lock(sequence_mutex_.get());
+      if (closed_) {
+        scheduled_ = false;
+        if (running_) {
+          DrainWorkQueue(&canceled);
+          if (!canceled.empty()) {
+            LOG(WARNING) << "Canceling " << canceled.size()
+                         << " functions on sequence Shutdown";
+          }
+          running_ = false;
+
+          // As in Sequence::NextFunction, the sequence may be deleted once
+          // we Signal(), and pool_ is NULL if the whole pool is shutting
+          // down.
+          release_to_pool = pool_;
+          termination_condvar_->Signal();
+        }
+      } else {
+        function = PopFunction();
+        if (function != nullptr) {
+          running_ = true;
+        } else {
+          running_ = false;
+          scheduled_ = false;
+          went_idle = true;
+        }
+      }
+    }
+    if (release_to_pool != nullptr) {
+      release_to_pool->SequenceNoLongerActive(this);
+    }
+    CancelFunctions(canceled, queue_size);
+    if (function != nullptr) {
+      UpdateWaveform(queue_size, -1);
+      return function;
+    }
+
+    // A function added just before we cleared scheduled_ was left for us
+    // to run; see Add.  If we can reclaim the sequence, keep going.
+    if (!went_idle || WorkQueueEmpty()) {
+      return nullptr;
+    }
+    ScopedMutex lock(sequence_mutex_.get());
+    if (closed_ || scheduled_) {
+      return nullptr;
+    }
+    MarkScheduled();
+  }
+}
+
 }  // namespace net_instaweb
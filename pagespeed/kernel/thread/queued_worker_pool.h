@@ -23,10 +23,20 @@
 //
 // This differs from QueuedWorker, which always uses exactly one thread.
 // In this interface, any task can be assigned to any thread.
+//
+// By default runnable sequences wait in a single queue guarded by the
+// pool's mutex, and idle workers are handed sequences directly.  With
+// EnableWorkStealing(), each worker instead keeps its own lock-free deque
+// of runnable sequences: a sequence made runnable from a worker thread
+// goes onto that worker's deque, sequences made runnable from other
+// threads go onto the shared queue, and workers that run out of work steal
+// the oldest sequences from each other.  Idle workers sleep on a condvar.
+// The pool's sequences then also queue their functions without locking.
 
 #ifndef PAGESPEED_KERNEL_THREAD_QUEUED_WORKER_POOL_H_
 #define PAGESPEED_KERNEL_THREAD_QUEUED_WORKER_POOL_H_
 
+#include <atomic>
 #include <cstddef>  // for size_t
 #include <deque>
 #include <set>
@@ -110,7 +120,7 @@ class QueuedWorkerPool {
     void set_max_queue_size(size_t x) { max_queue_size_ = x; }
 
     // Calls Cancel on all pending functions in the queue.
-    void CancelPendingFunctions() LOCKS_EXCLUDED(sequence_mutex_);
+    virtual void CancelPendingFunctions() LOCKS_EXCLUDED(sequence_mutex_);
 
    private:
     // Construct using QueuedWorkerPool::NewSequence().
@@ -120,7 +130,7 @@ class QueuedWorkerPool {
     ~Sequence() override;
 
     // Resets a new or recycled Sequence to its original state.
-    void Reset();
+    virtual void Reset();
 
     // Waits for any currently active function to complete, deletes
     // any other outstanding functions.  During the shutdown process,
@@ -128,24 +138,24 @@ class QueuedWorkerPool {
     // added to it from another thread.
     //
     // This function blocks until shutdown is complete.
-    void WaitForShutDown() LOCKS_EXCLUDED(sequence_mutex_);
+    virtual void WaitForShutDown() LOCKS_EXCLUDED(sequence_mutex_);
 
     // Puts the Sequence in shutdown mode, but does not block until shutdown
     // is complete.  Return 'true' if the sequence is inactive and thus can
     // be immediately recycled.
-    bool InitiateShutDown() LOCKS_EXCLUDED(sequence_mutex_);
+    virtual bool InitiateShutDown() LOCKS_EXCLUDED(sequence_mutex_);
 
     // Gets the next function in the sequence, and transfers ownership
     // the the caller.
-    Function* NextFunction() LOCKS_EXCLUDED(sequence_mutex_);
+    virtual Function* NextFunction() LOCKS_EXCLUDED(sequence_mutex_);
 
-    bool IsBusy() EXCLUSIVE_LOCKS_REQUIRED(sequence_mutex_);
+    virtual bool IsBusy() EXCLUSIVE_LOCKS_REQUIRED(sequence_mutex_);
 
     // Returns number of tasks that were canceled.
     int CancelTasksOnWorkQueue() EXCLUSIVE_LOCKS_REQUIRED(sequence_mutex_);
 
     // Cancels all pending tasks (and updates stats appropriately).
-    void Cancel() LOCKS_EXCLUDED(sequence_mutex_);
+    virtual void Cancel() LOCKS_EXCLUDED(sequence_mutex_);
 
     friend class QueuedWorkerPool;
     std::deque<Function*> work_queue_ GUARDED_BY(sequence_mutex_);
@@ -221,13 +231,33 @@ class QueuedWorkerPool {
   // This must be called prior to creating sequences.
   void set_queue_size_stat(Waveform* x) { queue_size_ = x; }
 
+  // Switches to per-worker deques with work stealing, as described at the
+  // top of this file.  With work stealing, load shedding still cancels
+  // sequences once more than the threshold are waiting, but "oldest first"
+  // only holds among sequences queued from outside the pool and within
+  // each worker's deque.
+  //
+  // Should be called before starting any work.
+  void EnableWorkStealing();
+  bool work_stealing() const { return work_stealing_; }
+
  private:
+  class LockFreeSequence;
+  class StealingWorker;
   friend class Sequence;
   void Run(Sequence* sequence, QueuedWorker* worker);
   void QueueSequence(Sequence* sequence);
   Sequence* AssignWorkerToNextSequence(QueuedWorker* worker);
   void SequenceNoLongerActive(Sequence* sequence);
 
+  // Work-stealing counterparts of the above.
+  void QueueSequenceForStealing(Sequence* sequence);
+  void RunStealingWorker(StealingWorker* worker, Sequence* sequence);
+  Sequence* FindStealableSequence(StealingWorker* worker);
+  Sequence* PopInjectedSequence() LOCKS_EXCLUDED(mutex_);
+  Sequence* TakeOldestQueuedSequence(StealingWorker* worker);
+  void ShutDownStealingWorkers();
+
   ThreadSystem* thread_system_;
   std::unique_ptr<AbstractMutex> mutex_;
 
@@ -249,6 +279,21 @@ class QueuedWorkerPool {
   Waveform* queue_size_;
   int load_shedding_threshold_;
 
+  // Work-stealing state.  stealing_workers_ has max_workers_ slots, of
+  // which the first num_stealing_workers_ have been started; slots are
+  // only filled in with mutex_ held.  queued_sequences_ (under mutex_)
+  // doubles as the queue for sequences made runnable outside the pool.
+  bool work_stealing_;
+  std::vector<std::unique_ptr<StealingWorker>> stealing_workers_;
+  std::atomic<int> num_stealing_workers_;
+  // Sequences waiting in queued_sequences_ plus all workers' deques.
+  std::atomic<int> num_waiting_sequences_;
+  std::atomic<int> num_injected_sequences_;  // just queued_sequences_.
+  std::atomic<int> num_sleeping_workers_;
+  std::atomic<bool> stop_stealing_workers_;
+  std::unique_ptr<ThreadSystem::CondvarCapableMutex> sleep_mutex_;
+  std::unique_ptr<ThreadSystem::Condvar> wake_condvar_;
+
   DISALLOW_COPY_AND_ASSIGN(QueuedWorkerPool);
 };
 
@@ -46,7 +46,7 @@ const int kIndexNotSet = 0;
 // that Alarms hold the scheduler lock when they are invoked; the alarm drops
 // the lock before invoking its embedded callback and re-takes it afterwards if
 // that is necessary.
-class Scheduler::Alarm {
+class Scheduler::Alarm : public TimerWheel::Entry {
  public:
   virtual void RunAlarm() = 0;
   virtual void CancelAlarm() = 0;
@@ -57,14 +57,14 @@ class Scheduler::Alarm {
   int Compare(const Alarm* other) const {
     int cmp = 0;
     if (this != other) {
-      if (wakeup_time_us_ < other->wakeup_time_us_) {
+      if (wakeup_time_us() < other->wakeup_time_us()) {
         cmp = -1;
-      } else if (wakeup_time_us_ > other->wakeup_time_us_) {
+      } else if (wakeup_time_us() > other->wakeup_time_us()) {
         cmp = 1;
-      } else if (index_ < other->index_) {
+      } else if (index() < other->index()) {
         cmp = -1;
       } else {
-        DCHECK(index_ > other->index_);
+        DCHECK(index() > other->index());
         cmp = 1;
       }
     }
@@ -75,14 +75,11 @@ class Scheduler::Alarm {
   void set_in_wait_dispatch(bool w) { in_wait_dispatch_ = w; }
 
  protected:
-  Alarm()
-      : wakeup_time_us_(0), index_(kIndexNotSet), in_wait_dispatch_(false) {}
+  Alarm() : in_wait_dispatch_(false) {}
   virtual ~Alarm() {}
 
  private:
   friend class Scheduler;
-  int64 wakeup_time_us_;
-  uint32 index_;  // Set by scheduler to disambiguate equal wakeup times.
 
   // This is used to mark a wait alarm that's being considered by ::Signal
   // as owned by it for purposes of cleanup, so any concurrent timeout will
@@ -202,21 +199,26 @@ Scheduler::Scheduler(ThreadSystem* thread_system, Timer* timer)
       mutex_(thread_system->NewMutex()),
       condvar_(mutex_->NewCondvar()),
       index_(kIndexNotSet),
+      use_timer_wheel_(true),
       signal_count_(0),
       running_waiting_alarms_(false) {}
 
 Scheduler::~Scheduler() {
 #if SCHEDULER_CANCEL_OUTSTANDING_ALARMS_ON_DESTRUCTION
   ScopedMutex lock(mutex_.get());
-  while (!outstanding_alarms_.empty()) {
-    AlarmSet::iterator p = outstanding_alarms_.begin();
-    Alarm* alarm = *p;
-    outstanding_alarms_.erase(p);
+  while (HasOutstandingAlarms()) {
+    Alarm* alarm = EarliestOutstandingAlarm();
+    RemoveOutstandingAlarm(alarm);
     alarm->CancelAlarm();
   }
 #endif
 }
 
+void Scheduler::set_use_timer_wheel(bool x) {
+  DCHECK(!HasOutstandingAlarms());
+  use_timer_wheel_ = x;
+}
+
 void Scheduler::BlockingTimedWaitUs(int64 timeout_us) {
   mutex_->DCheckLocked();
   int64 now_us = timer_->NowUs();
@@ -302,19 +304,19 @@ void Scheduler::InsertAlarmAtUsMutexHeld(int64 wakeup_time_us,
                                          bool broadcast_on_wakeup_change,
                                          Alarm* alarm) {
   mutex_->DCheckLocked();
-  alarm->wakeup_time_us_ = wakeup_time_us;
-  alarm->index_ = ++index_;
+  alarm->set_wakeup_time_us(wakeup_time_us);
+  alarm->set_index(++index_);
 
   if (broadcast_on_wakeup_change) {
-    bool wakeup_time_changed =
-        outstanding_alarms_.empty() ||
-        (wakeup_time_us < (*outstanding_alarms_.begin())->wakeup_time_us_);
+    Alarm* first_alarm = EarliestOutstandingAlarm();
+    bool wakeup_time_changed = (first_alarm == nullptr) ||
+                               (wakeup_time_us < first_alarm->wakeup_time_us());
     if (wakeup_time_changed) {
       condvar_->Broadcast();
     }
   }
 
-  outstanding_alarms_.insert(alarm);
+  AddOutstandingAlarm(alarm);
 }
 
 Scheduler::Alarm* Scheduler::AddAlarmAtUs(int64 wakeup_time_us,
@@ -335,7 +337,7 @@ Scheduler::Alarm* Scheduler::AddAlarmAtUsMutexHeld(int64 wakeup_time_us,
 
 bool Scheduler::CancelAlarm(Alarm* alarm) {
   mutex_->DCheckLocked();
-  if (outstanding_alarms_.erase(alarm) != 0) {
+  if (RemoveOutstandingAlarm(alarm)) {
     // Note: the following call may drop and re-lock the scheduler mutex.
     alarm->CancelAlarm();
     return true;
@@ -345,20 +347,20 @@ bool Scheduler::CancelAlarm(Alarm* alarm) {
 }
 
 int64 Scheduler::RunAlarms(bool* ran_alarms) {
-  while (!outstanding_alarms_.empty()) {
+  while (HasOutstandingAlarms()) {
     mutex_->DCheckLocked();
-    // We don't use the iterator to go through the set, because we're dropping
-    // the lock in mid-loop thus permitting new insertions and cancellations.
-    AlarmSet::iterator first_alarm_iterator = outstanding_alarms_.begin();
-    Alarm* first_alarm = *first_alarm_iterator;
+    // We look up the first alarm afresh each time around, because we're
+    // dropping the lock in mid-loop thus permitting new insertions and
+    // cancellations.
     int64 now_us = timer_->NowUs();
-    if (now_us < first_alarm->wakeup_time_us_) {
+    Alarm* first_alarm = PopDueAlarm(now_us);
+    if (first_alarm == nullptr) {
       // The next deadline lies in the future.
-      return first_alarm->wakeup_time_us_;
+      return EarliestOutstandingAlarm()->wakeup_time_us();
     }
     // first_alarm should be run.  It can't have been cancelled as we've held
-    // the lock since we found it.
-    outstanding_alarms_.erase(first_alarm_iterator);  // Prevent cancellation.
+    // the lock since we found it, and it's now out of the queue which
+    // prevents cancellation.
     if (ran_alarms != nullptr) {
       *ran_alarms = true;
     }
@@ -368,6 +370,49 @@ int64 Scheduler::RunAlarms(bool* ran_alarms) {
   return 0;
 }
 
+void Scheduler::AddOutstandingAlarm(Alarm* alarm) {
+  if (use_timer_wheel_) {
+    alarm_wheel_.Insert(alarm);
+  } else {
+    outstanding_alarms_.insert(alarm);
+  }
+}
+
+bool Scheduler::RemoveOutstandingAlarm(Alarm* alarm) {
+  if (use_timer_wheel_) {
+    return alarm_wheel_.Erase(alarm);
+  }
+  return (outstanding_alarms_.erase(alarm) != 0);
+}
+
+Scheduler::Alarm* Scheduler::EarliestOutstandingAlarm() {
+  if (use_timer_wheel_) {
+    return static_cast<Alarm*>(alarm_wheel_.Earliest());
+  }
+  return outstanding_alarms_.empty() ? nullptr : *outstanding_alarms_.begin();
+}
+
+Scheduler::Alarm* Scheduler::PopDueAlarm(int64 now_us) {
+  if (use_timer_wheel_) {
+    return static_cast<Alarm*>(alarm_wheel_.PopExpired(now_us));
+  }
+  if (outstanding_alarms_.empty()) {
+    return nullptr;
+  }
+  AlarmSet::iterator first_alarm_iterator = outstanding_alarms_.begin();
+  Alarm* first_alarm = *first_alarm_iterator;
+  if (now_us < first_alarm->wakeup_time_us()) {
+    return nullptr;
+  }
+  outstanding_alarms_.erase(first_alarm_iterator);
+  return first_alarm;
+}
+
+bool Scheduler::HasOutstandingAlarms() const {
+  return use_timer_wheel_ ? !alarm_wheel_.empty()
+                          : !outstanding_alarms_.empty();
+}
+
 void Scheduler::AwaitWakeupUntilUs(int64 wakeup_time_us) {
   mutex_->DCheckLocked();
   int64 now_us = timer_->NowUs();
@@ -396,13 +441,13 @@ bool Scheduler::ProcessAlarmsOrWaitUs(int64 timeout_us) {
 
     next_wakeup_us = RunAlarms(nullptr);
   }
-  return !outstanding_alarms_.empty();
+  return HasOutstandingAlarms();
 }
 
 // For testing purposes, let a tester know when the scheduler has quiesced.
 bool Scheduler::NoPendingAlarms() {
   mutex_->DCheckLocked();
-  return (outstanding_alarms_.empty());
+  return !HasOutstandingAlarms();
 }
 
 SchedulerBlockingFunction::SchedulerBlockingFunction(Scheduler* scheduler)
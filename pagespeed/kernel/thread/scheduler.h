@@ -30,6 +30,7 @@
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/thread/timer_wheel.h"
 
 // TODO(jmarantz): The Scheduler should cancel all outstanding operations
 // on destruction.  Deploying this requires further analysis of shutdown
@@ -179,6 +180,13 @@ class Scheduler {
   // Creates a new sequence, controlled by the scheduler.
   Sequence* NewSequence();
 
+  // Pending alarms are kept in a hierarchical timing wheel by default, which
+  // adds and cancels them in constant time.  Passing false switches back to
+  // a balanced tree (O(log n), allocating); alarms run in the same order
+  // either way.  Only call this while no alarms are pending.
+  void set_use_timer_wheel(bool x);
+  bool use_timer_wheel() const { return use_timer_wheel_; }
+
  protected:
   // Internal method to await a wakeup event.  Block until wakeup_time_us (an
   // absolute time since the epoch), or until something interesting (such as a
@@ -203,6 +211,15 @@ class Scheduler {
   void CancelWaiting(Alarm* alarm);
   bool NoPendingAlarms();
 
+  // Operations on the queue of outstanding alarms, whichever structure
+  // holds it.  PopDueAlarm removes and returns the earliest alarm due at
+  // now_us, or returns nullptr if there is none.
+  void AddOutstandingAlarm(Alarm* alarm);
+  bool RemoveOutstandingAlarm(Alarm* alarm);
+  Alarm* EarliestOutstandingAlarm();
+  Alarm* PopDueAlarm(int64 now_us);
+  bool HasOutstandingAlarms() const;
+
   ThreadSystem* thread_system_;
   Timer* timer_;
   std::unique_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
@@ -210,9 +227,12 @@ class Scheduler {
   // signal_count_ increasing) events occur.
   std::unique_ptr<ThreadSystem::Condvar> condvar_;
   uint32 index_;  // Used to disambiguate alarms with equal deadlines
-  AlarmSet outstanding_alarms_;  // Priority queue of future alarms
-  // An alarm may be deleted iff it is successfully removed from
-  // outstanding_alarms_.
+  // Priority queue of future alarms: alarm_wheel_ if use_timer_wheel_,
+  // otherwise outstanding_alarms_.  An alarm may be deleted iff it is
+  // successfully removed from the queue.
+  bool use_timer_wheel_;
+  TimerWheel alarm_wheel_;
+  AlarmSet outstanding_alarms_;
   int64 signal_count_;           // Number of times Signal has been called
   AlarmSet waiting_alarms_;      // Alarms waiting for signal_count to change
   bool running_waiting_alarms_;  // True if we're in process of invoking
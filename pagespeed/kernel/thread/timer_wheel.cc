@@ -0,0 +1,248 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/thread/timer_wheel.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Index of the most significant base-64 digit in which a and b differ.
+// a and b must be distinct.
+int DifferingLevel(int64 a, int64 b) {
+  uint64 diff = static_cast<uint64>(a) ^ static_cast<uint64>(b);
+  return (63 - __builtin_clzll(diff)) / TimerWheel::kBitsPerLevel;
+}
+
+int Digit(int64 time_us, int level) {
+  return static_cast<int>((static_cast<uint64>(time_us) >>
+                           (level * TimerWheel::kBitsPerLevel)) &
+                          (TimerWheel::kSlotsPerLevel - 1));
+}
+
+}  // namespace
+
+const int TimerWheel::kBitsPerLevel;
+const int TimerWheel::kSlotsPerLevel;
+const int TimerWheel::kNumLevels;
+
+void TimerWheel::Slot::Link(Entry* entry) {
+  entry->slot_ = this;
+  if (head == nullptr) {
+    entry->prev_ = nullptr;
+    entry->next_ = nullptr;
+    head = tail = min = entry;
+    sorted = true;
+    return;
+  }
+  if (!Less(entry, tail)) {
+    entry->prev_ = tail;
+    entry->next_ = nullptr;
+    tail->next_ = entry;
+    tail = entry;
+  } else if (Less(entry, head)) {
+    entry->prev_ = nullptr;
+    entry->next_ = head;
+    head->prev_ = entry;
+    head = entry;
+  } else {
+    // Out of order; min stays put, but we can no longer rely on the list
+    // order to find the next one.
+    entry->prev_ = tail;
+    entry->next_ = nullptr;
+    tail->next_ = entry;
+    tail = entry;
+    sorted = false;
+  }
+  if ((min != nullptr) && Less(entry, min)) {
+    min = entry;
+  }
+}
+
+void TimerWheel::Slot::Unlink(Entry* entry) {
+  DCHECK_EQ(this, entry->slot_);
+  Entry* next = entry->next_;
+  if (entry->prev_ == nullptr) {
+    head = next;
+  } else {
+    entry->prev_->next_ = next;
+  }
+  if (next == nullptr) {
+    tail = entry->prev_;
+  } else {
+    next->prev_ = entry->prev_;
+  }
+  entry->prev_ = nullptr;
+  entry->next_ = nullptr;
+  entry->slot_ = nullptr;
+  if (head == nullptr) {
+    min = nullptr;
+    sorted = true;
+  } else if (entry == min) {
+    // If sorted, entry was the head and next is the new head.
+    min = sorted ? next : nullptr;
+  }
+}
+
+TimerWheel::Entry* TimerWheel::Slot::Min(std::vector<Entry*>* scratch) {
+  if ((min == nullptr) && (head != nullptr)) {
+    scratch->clear();
+    for (Entry* entry = head; entry != nullptr; entry = entry->next_) {
+      scratch->push_back(entry);
+    }
+    std::sort(scratch->begin(), scratch->end(), Less);
+    Entry* prev = nullptr;
+    for (Entry* entry : *scratch) {
+      entry->prev_ = prev;
+      if (prev != nullptr) {
+        prev->next_ = entry;
+      }
+      prev = entry;
+    }
+    prev->next_ = nullptr;
+    head = min = scratch->front();
+    tail = prev;
+    sorted = true;
+    scratch->clear();
+  }
+  return min;
+}
+
+TimerWheel::TimerWheel() : now_us_(0), size_(0) {
+  for (int level = 0; level < kNumLevels; ++level) {
+    occupied_[level] = 0;
+    for (int digit = 0; digit < kSlotsPerLevel; ++digit) {
+      slots_[level][digit].level = level;
+      slots_[level][digit].digit = digit;
+    }
+  }
+}
+
+TimerWheel::~TimerWheel() {}
+
+void TimerWheel::Insert(Entry* entry) {
+  DCHECK(!entry->in_wheel());
+  ++size_;
+  Place(entry);
+}
+
+bool TimerWheel::Erase(Entry* entry) {
+  if (!entry->in_wheel()) {
+    return false;
+  }
+  Remove(entry);
+  return true;
+}
+
+TimerWheel::Entry* TimerWheel::PopExpired(int64 now_us) {
+  AdvanceTo(now_us);
+  Entry* entry = expired_.Min(&scratch_);
+  if ((entry == nullptr) || (entry->wakeup_time_us_ > now_us)) {
+    // The latter only happens if the clock went backwards.
+    return nullptr;
+  }
+  Remove(entry);
+  return entry;
+}
+
+TimerWheel::Entry* TimerWheel::Earliest() {
+  if (!expired_.empty()) {
+    return expired_.Min(&scratch_);
+  }
+  for (int level = 0; level < kNumLevels; ++level) {
+    if (occupied_[level] != 0) {
+      int digit = __builtin_ctzll(occupied_[level]);
+      return slots_[level][digit].Min(&scratch_);
+    }
+  }
+  return nullptr;
+}
+
+void TimerWheel::AdvanceTo(int64 now_us) {
+  if (now_us <= now_us_) {
+    return;
+  }
+  int top = DifferingLevel(now_us, now_us_);
+  int new_digit = Digit(now_us, top);
+  now_us_ = now_us;
+
+  // Everything below the top changed digit is now in the past.
+  for (int level = 0; level < top; ++level) {
+    while (occupied_[level] != 0) {
+      Cascade(&slots_[level][__builtin_ctzll(occupied_[level])]);
+    }
+  }
+
+  // At the top level, slots before now's have expired, and now's own slot
+  // is split between the expired list and the lower levels.  Later slots
+  // stay where they are, as do all higher levels.
+  uint64 passed = (static_cast<uint64>(2) << new_digit) - 1;
+  while ((occupied_[top] & passed) != 0) {
+    Cascade(&slots_[top][__builtin_ctzll(occupied_[top] & passed)]);
+  }
+}
+
+void TimerWheel::Place(Entry* entry) {
+  Slot* slot;
+  if (entry->wakeup_time_us_ <= now_us_) {
+    slot = &expired_;
+  } else {
+    int level = DifferingLevel(entry->wakeup_time_us_, now_us_);
+    int digit = Digit(entry->wakeup_time_us_, level);
+    slot = &slots_[level][digit];
+    occupied_[level] |= static_cast<uint64>(1) << digit;
+  }
+  slot->Link(entry);
+}
+
+void TimerWheel::Remove(Entry* entry) {
+  Slot* slot = entry->slot_;
+  slot->Unlink(entry);
+  if (slot->empty() && (slot->level >= 0)) {
+    occupied_[slot->level] &= ~(static_cast<uint64>(1) << slot->digit);
+  }
+  --size_;
+}
+
+void TimerWheel::Cascade(Slot* slot) {
+  DCHECK_GE(slot->level, 0);
+  Entry* entry = slot->head;
+  slot->head = slot->tail = slot->min = nullptr;
+  slot->sorted = true;
+  occupied_[slot->level] &= ~(static_cast<uint64>(1) << slot->digit);
+  // Walking the list in order keeps a sorted slot's entries sorted in their
+  // new slots.
+  while (entry != nullptr) {
+    Entry* next = entry->next_;
+    entry->prev_ = nullptr;
+    entry->next_ = nullptr;
+    entry->slot_ = nullptr;
+    Place(entry);
+    entry = next;
+  }
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,159 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_THREAD_TIMER_WHEEL_H_
+#define PAGESPEED_KERNEL_THREAD_TIMER_WHEEL_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// Priority queue of timers keyed on (wakeup time, index), implemented as a
+// hierarchical timing wheel.  Entries are intrusive, so Insert and Erase are
+// O(1) and never allocate; each entry is moved down the hierarchy at most
+// once per level as time advances, and expired entries are handed out in
+// exact (wakeup time, index) order.  This is the queue behind
+// Scheduler's alarms.
+//
+// The wheel has kNumLevels levels of kSlotsPerLevel slots.  A slot at level
+// L covers 64^L microseconds.  An entry lives at the level of the most
+// significant base-64 digit in which its wakeup time differs from the
+// wheel's current time, so every entry at a lower level fires before every
+// entry at a higher one, and within a level the slots are in time order.
+// Entries at or before the current time are kept on a separate expired
+// list.
+//
+// Within a slot entries are unordered, but the slot remembers its earliest
+// entry and whether its list happens to be sorted, which it usually is
+// since timers tend to be added in deadline order.  Finding the earliest
+// entry only sorts a slot if that entry was erased while the slot was out
+// of order.
+//
+// This class is not thread-safe.
+class TimerWheel {
+ private:
+  struct Slot;
+
+ public:
+  // Base class for anything stored in a TimerWheel.  The wakeup time and
+  // index may only be changed while the entry is not in a wheel.
+  class Entry {
+   public:
+    Entry()
+        : wakeup_time_us_(0), index_(0), prev_(nullptr), next_(nullptr),
+          slot_(nullptr) {}
+
+    int64 wakeup_time_us() const { return wakeup_time_us_; }
+    uint32 index() const { return index_; }
+    void set_wakeup_time_us(int64 x) { wakeup_time_us_ = x; }
+    void set_index(uint32 x) { index_ = x; }
+
+    bool in_wheel() const { return slot_ != nullptr; }
+
+   private:
+    friend class TimerWheel;
+
+    int64 wakeup_time_us_;
+    uint32 index_;  // Disambiguates entries with equal wakeup times.
+    Entry* prev_;
+    Entry* next_;
+    Slot* slot_;  // The slot holding this entry, if any.
+
+    DISALLOW_COPY_AND_ASSIGN(Entry);
+  };
+
+  static const int kBitsPerLevel = 6;
+  static const int kSlotsPerLevel = 1 << kBitsPerLevel;
+  // Enough levels to cover any non-negative int64 time.
+  static const int kNumLevels = (63 + kBitsPerLevel - 1) / kBitsPerLevel;
+
+  TimerWheel();
+  ~TimerWheel();
+
+  // Adds entry, which must not already be in a wheel.
+  void Insert(Entry* entry);
+
+  // Removes entry if it is in this wheel, returning whether it was.
+  bool Erase(Entry* entry);
+
+  // Removes and returns the earliest entry with a wakeup time no later than
+  // now_us, or nullptr if there is none.
+  Entry* PopExpired(int64 now_us);
+
+  // Returns the earliest entry without removing it, or nullptr if the wheel
+  // is empty.  Not const because it may reorder a slot.
+  Entry* Earliest();
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  // Strict ordering on (wakeup time, index).
+  static bool Less(const Entry* a, const Entry* b) {
+    return ((a->wakeup_time_us_ < b->wakeup_time_us_) ||
+            ((a->wakeup_time_us_ == b->wakeup_time_us_) &&
+             (a->index_ < b->index_)));
+  }
+
+ private:
+  // A list of entries, along with enough bookkeeping to find the earliest
+  // one cheaply.
+  struct Slot {
+    Slot() : head(nullptr), tail(nullptr), min(nullptr), sorted(true),
+             level(-1), digit(0) {}
+
+    void Link(Entry* entry);
+    void Unlink(Entry* entry);
+    Entry* Min(std::vector<Entry*>* scratch);
+    bool empty() const { return head == nullptr; }
+
+    Entry* head;
+    Entry* tail;
+    // Earliest entry, or nullptr if not known.  Always head when sorted.
+    Entry* min;
+    bool sorted;
+    int level;  // -1 for the expired list.
+    int digit;
+  };
+
+  // Moves the current time forward to now_us, expiring and cascading
+  // entries as needed.
+  void AdvanceTo(int64 now_us);
+
+  // Links entry into the slot appropriate for the current time.
+  void Place(Entry* entry);
+  void Remove(Entry* entry);
+  // Moves every entry in slot to wherever it now belongs.
+  void Cascade(Slot* slot);
+
+  Slot slots_[kNumLevels][kSlotsPerLevel];
+  uint64 occupied_[kNumLevels];  // Bitmap of non-empty slots per level.
+  Slot expired_;  // Entries due no later than now_us_.
+  std::vector<Entry*> scratch_;  // Reused when sorting a slot.
+  int64 now_us_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_THREAD_TIMER_WHEEL_H_
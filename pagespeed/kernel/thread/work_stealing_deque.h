@@ -0,0 +1,158 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_THREAD_WORK_STEALING_DEQUE_H_
+#define PAGESPEED_KERNEL_THREAD_WORK_STEALING_DEQUE_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+
+namespace net_instaweb {
+
+// Lock-free double-ended queue of pointers for work-stealing schedulers.
+// The owning thread pushes and pops at the bottom (LIFO, so it keeps
+// working on what it queued most recently), while any other thread may
+// Steal from the top (FIFO, taking the oldest work).
+//
+// This is the Chase-Lev deque, using the memory orderings from Le, Pop,
+// Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak
+// Memory Models" (PPoPP 2013).  The buffer grows as needed; outgrown
+// buffers are kept until the deque is destroyed, because a thief may still
+// be reading from one.  Since the deque only ever doubles, that at most
+// doubles its footprint.
+template <class T>
+class WorkStealingDeque {
+ public:
+  explicit WorkStealingDeque(int64 initial_capacity = 64)
+      : top_(0), bottom_(0) {
+    int64 capacity = 1;
+    while (capacity < initial_capacity) {
+      capacity <<= 1;
+    }
+    arrays_.emplace_back(new Array(capacity));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+  }
+
+  // Owner only.
+  void Push(T* item) {
+    int64 b = bottom_.load(std::memory_order_relaxed);
+    int64 t = top_.load(std::memory_order_acquire);
+    Array* a = array_.load(std::memory_order_relaxed);
+    if (b - t > a->capacity() - 1) {
+      a = Grow(a, t, b);
+    }
+    a->Put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only.  Returns the most recently pushed item, or nullptr.
+  T* Pop() {
+    int64 b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64 t = top_.load(std::memory_order_relaxed);
+    T* item = nullptr;
+    if (t <= b) {
+      item = a->Get(b);
+      if (t == b) {
+        // Last item: race any thieves for it.
+        if (!top_.compare_exchange_strong(t, t + 1,
+                                          std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+          item = nullptr;
+        }
+        bottom_.store(b + 1, std::memory_order_relaxed);
+      }
+    } else {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread.  Returns the oldest item, or nullptr if the deque is empty
+  // or another thread won the race for it.
+  T* Steal() {
+    int64 t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64 b = bottom_.load(std::memory_order_acquire);
+    if (t < b) {
+      Array* a = array_.load(std::memory_order_acquire);
+      T* item = a->Get(t);
+      if (top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+        return item;
+      }
+    }
+    return nullptr;
+  }
+
+  // Any thread; only a hint, as the deque may change at any time.
+  bool Empty() const {
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  class Array {
+   public:
+    explicit Array(int64 capacity)
+        : mask_(capacity - 1), items_(new std::atomic<T*>[capacity]) {}
+
+    int64 capacity() const { return mask_ + 1; }
+    T* Get(int64 i) const {
+      return items_[i & mask_].load(std::memory_order_relaxed);
+    }
+    void Put(int64 i, T* item) {
+      items_[i & mask_].store(item, std::memory_order_relaxed);
+    }
+
+   private:
+    int64 mask_;
+    std::unique_ptr<std::atomic<T*>[]> items_;
+
+    DISALLOW_COPY_AND_ASSIGN(Array);
+  };
+
+  // Owner only.
+  Array* Grow(Array* old_array, int64 top, int64 bottom) {
+    Array* a = new Array(2 * old_array->capacity());
+    for (int64 i = top; i < bottom; ++i) {
+      a->Put(i, old_array->Get(i));
+    }
+    arrays_.emplace_back(a);
+    array_.store(a, std::memory_order_release);
+    return a;
+  }
+
+  std::atomic<int64> top_;
+  std::atomic<int64> bottom_;
+  std::atomic<Array*> array_;
+  std::vector<std::unique_ptr<Array>> arrays_;  // Owner only.
+
+  DISALLOW_COPY_AND_ASSIGN(WorkStealingDeque);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_THREAD_WORK_STEALING_DEQUE_H_
@@ -0,0 +1,141 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/dictionary_trainer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Substrings are compared as 8-byte words, which is also about the
+// shortest match that pays for itself in any of the codecs.
+const size_t kDmerSize = sizeof(uint64);
+const size_t kSegmentSize = 64;
+const size_t kSegmentStride = 16;
+
+typedef std::unordered_map<uint64, int> FrequencyMap;
+
+inline uint64 LoadDmer(const char* p) {
+  uint64 dmer;
+  memcpy(&dmer, p, sizeof(dmer));
+  return dmer;
+}
+
+struct Segment {
+  Segment(StringPiece d, int64 s) : data(d), score(s) {}
+  bool operator<(const Segment& that) const { return score < that.score; }
+
+  StringPiece data;
+  int64 score;
+};
+
+// Sums the frequency of the distinct dmers in segment, counting only those
+// seen in more than one sample: anything rarer can't help a future value.
+int64 ScoreSegment(StringPiece segment, const FrequencyMap& frequency) {
+  std::vector<uint64> dmers;
+  for (size_t i = 0; i + kDmerSize <= segment.size(); ++i) {
+    dmers.push_back(LoadDmer(segment.data() + i));
+  }
+  std::sort(dmers.begin(), dmers.end());
+  dmers.erase(std::unique(dmers.begin(), dmers.end()), dmers.end());
+  int64 score = 0;
+  for (uint64 dmer : dmers) {
+    FrequencyMap::const_iterator iter = frequency.find(dmer);
+    if ((iter != frequency.end()) && (iter->second > 1)) {
+      score += iter->second;
+    }
+  }
+  return score;
+}
+
+}  // namespace
+
+GoogleString DictionaryTrainer::Train(const StringVector& samples,
+                                      size_t max_size) {
+  // Count, for each dmer, the number of samples it appears in.
+  FrequencyMap frequency;
+  for (const GoogleString& sample : samples) {
+    std::unordered_set<uint64> seen;
+    for (size_t i = 0; i + kDmerSize <= sample.size(); ++i) {
+      uint64 dmer = LoadDmer(sample.data() + i);
+      if (seen.insert(dmer).second) {
+        ++frequency[dmer];
+      }
+    }
+  }
+
+  std::priority_queue<Segment> candidates;
+  for (const GoogleString& sample : samples) {
+    for (size_t pos = 0; pos + kDmerSize <= sample.size();
+         pos += kSegmentStride) {
+      StringPiece segment =
+          StringPiece(sample).substr(pos, std::min(kSegmentSize,
+                                                   sample.size() - pos));
+      int64 score = ScoreSegment(segment, frequency);
+      if (score > 0) {
+        candidates.push(Segment(segment, score));
+      }
+    }
+  }
+
+  // Choosing a segment only lowers the scores of the others, so a stale
+  // score is an upper bound: rescore the best candidate, and take it if it
+  // still beats the next one's (possibly stale) score.
+  std::vector<StringPiece> chosen;
+  size_t total_size = 0;
+  while (!candidates.empty() && (total_size < max_size)) {
+    Segment best = candidates.top();
+    candidates.pop();
+    best.score = ScoreSegment(best.data, frequency);
+    if (best.score == 0) {
+      continue;
+    }
+    if (!candidates.empty() && (best.score < candidates.top().score)) {
+      candidates.push(best);
+      continue;
+    }
+    StringPiece segment =
+        best.data.substr(0, std::min(best.data.size(), max_size - total_size));
+    for (size_t i = 0; i + kDmerSize <= best.data.size(); ++i) {
+      frequency.erase(LoadDmer(best.data.data() + i));
+    }
+    chosen.push_back(segment);
+    total_size += segment.size();
+  }
+
+  GoogleString dictionary;
+  dictionary.reserve(total_size);
+  for (std::vector<StringPiece>::reverse_iterator iter = chosen.rbegin();
+       iter != chosen.rend(); ++iter) {
+    iter->AppendToString(&dictionary);
+  }
+  return dictionary;
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,53 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_UTIL_DICTIONARY_TRAINER_H_
+#define PAGESPEED_KERNEL_UTIL_DICTIONARY_TRAINER_H_
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Builds a compression dictionary from a set of sample payloads, for
+// codecs that can prime their window with one (zlib's preset dictionary,
+// LzBlockCompressor).  Small payloads such as cached rewrite metadata
+// share a lot of structure -- field tags, URL prefixes, header names --
+// but are each too short for an LZ77 window to find it.  Seeding the
+// window with that structure recovers most of the lost ratio.
+//
+// Training is a greedy set cover in the spirit of zstd's COVER: the
+// samples are cut into overlapping segments, each scored by how many
+// distinct 8-byte substrings it contains that also appear in other
+// samples, and the best segments are taken until the dictionary is full.
+// Substrings already covered by a chosen segment stop contributing to
+// the score of the rest.  The highest-scoring segments are placed at the
+// end of the dictionary, where back-references to them are shortest.
+class DictionaryTrainer {
+ public:
+  // Returns a dictionary of at most max_size bytes built from samples.
+  // The result is empty if the samples have nothing in common.
+  static GoogleString Train(const StringVector& samples, size_t max_size);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_UTIL_DICTIONARY_TRAINER_H_
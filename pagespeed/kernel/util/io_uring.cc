@@ -0,0 +1,378 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/io_uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// The operations we use; a kernel lacking any of them gets no ring.
+const uint8 kRequiredOps[] = {
+    IORING_OP_OPENAT, IORING_OP_STATX,    IORING_OP_READ,
+    IORING_OP_WRITE,  IORING_OP_CLOSE,    IORING_OP_RENAMEAT,
+};
+
+// The kernel reads the submission tail and writes the completion tail
+// concurrently with us, so those accesses need acquire/release ordering.
+unsigned LoadAcquire(const unsigned* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void StoreRelease(unsigned* p, unsigned value) {
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+template <class T>
+T* Offset(void* base, uint32 offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+}  // namespace
+
+IoUring::IoUring()
+    : ring_fd_(-1),
+      sq_ring_(MAP_FAILED),
+      sq_ring_size_(0),
+      cq_ring_(MAP_FAILED),
+      cq_ring_size_(0),
+      sqes_(nullptr),
+      sqes_size_(0),
+      sq_entries_(0),
+      sq_head_(nullptr),
+      sq_tail_(nullptr),
+      sq_mask_(nullptr),
+      sq_array_(nullptr),
+      cq_head_(nullptr),
+      cq_tail_(nullptr),
+      cq_mask_(nullptr),
+      cqes_(nullptr),
+      queued_(0),
+      in_flight_(0),
+      fail_next_enter_(false) {}
+
+IoUring::~IoUring() {
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+IoUring* IoUring::Create(unsigned entries) {
+  std::unique_ptr<IoUring> ring(new IoUring);
+  if (!ring->Initialize(entries)) {
+    return nullptr;
+  }
+  return ring.release();
+}
+
+bool IoUring::Initialize(unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring_fd_ < 0) {
+    return false;
+  }
+
+  // Make sure every operation we issue is supported.
+  size_t probe_size =
+      sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe* probe =
+      static_cast<struct io_uring_probe*>(calloc(1, probe_size));
+  bool supported =
+      (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe,
+               256) == 0);
+  for (uint8 op : kRequiredOps) {
+    supported = supported && (op <= probe->last_op) &&
+                ((probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0);
+  }
+  free(probe);
+  if (!supported) {
+    return false;
+  }
+
+  sq_entries_ = params.sq_entries;
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  sq_head_ = Offset<unsigned>(sq_ring_, params.sq_off.head);
+  sq_tail_ = Offset<unsigned>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = Offset<unsigned>(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = Offset<unsigned>(sq_ring_, params.sq_off.array);
+  cq_head_ = Offset<unsigned>(cq_ring_, params.cq_off.head);
+  cq_tail_ = Offset<unsigned>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = Offset<unsigned>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = Offset<void>(cq_ring_, params.cq_off.cqes);
+  return true;
+}
+
+io_uring_sqe* IoUring::NextSqe(uint8 opcode, uint64 user_data) {
+  if (queued_ == sq_entries_) {
+    return nullptr;
+  }
+  // We only submit from this thread, and SubmitAndWait leaves the
+  // submission queue empty, so the tail is ours to read without ordering.
+  unsigned tail = *sq_tail_ + queued_;
+  unsigned index = tail & *sq_mask_;
+  io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->user_data = user_data;
+  sq_array_[index] = index;
+  ++queued_;
+  return sqe;
+}
+
+bool IoUring::QueueOpenAt(const char* path, int flags, mode_t mode,
+                          uint64 user_data) {
+  io_uring_sqe* sqe = NextSqe(IORING_OP_OPENAT, user_data);
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->fd = AT_FDCWD;
+  sqe->addr = reinterpret_cast<uintptr_t>(path);
+  sqe->len = mode;
+  sqe->open_flags = flags;
+  return true;
+}
+
+bool IoUring::QueueStatx(const char* path, unsigned mask,
+                         struct statx* buffer, uint64 user_data) {
+  io_uring_sqe* sqe = NextSqe(IORING_OP_STATX, user_data);
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->fd = AT_FDCWD;
+  sqe->addr = reinterpret_cast<uintptr_t>(path);
+  sqe->len = mask;
+  sqe->off = reinterpret_cast<uintptr_t>(buffer);
+  return true;
+}
+
+bool IoUring::QueueRead(int fd, char* buffer, size_t size, uint64 user_data,
+                        bool hardlink_next) {
+  io_uring_sqe* sqe = NextSqe(IORING_OP_READ, user_data);
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+  sqe->len = size;
+  sqe->off = 0;
+  sqe->flags = hardlink_next ? IOSQE_IO_HARDLINK : 0;
+  return true;
+}
+
+bool IoUring::QueueWrite(int fd, const char* buffer, size_t size,
+                         uint64 user_data, bool hardlink_next) {
+  io_uring_sqe* sqe = NextSqe(IORING_OP_WRITE, user_data);
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+  sqe->len = size;
+  sqe->off = 0;
+  sqe->flags = hardlink_next ? IOSQE_IO_HARDLINK : 0;
+  return true;
+}
+
+bool IoUring::QueueClose(int fd, uint64 user_data) {
+  io_uring_sqe* sqe = NextSqe(IORING_OP_CLOSE, user_data);
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->fd = fd;
+  return true;
+}
+
+bool IoUring::QueueRenameAt(const char* old_path, const char* new_path,
+                            uint64 user_data) {
+  io_uring_sqe* sqe = NextSqe(IORING_OP_RENAMEAT, user_data);
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->fd = AT_FDCWD;
+  sqe->addr = reinterpret_cast<uintptr_t>(old_path);
+  sqe->len = AT_FDCWD;
+  sqe->addr2 = reinterpret_cast<uintptr_t>(new_path);
+  return true;
+}
+
+bool IoUring::SubmitAndWait(std::vector<Completion>* completions) {
+  unsigned to_submit = queued_;
+  in_flight_ = queued_;
+  StoreRelease(sq_tail_, *sq_tail_ + queued_);
+  queued_ = 0;
+
+  bool ok = true;
+  const io_uring_cqe* cqes = static_cast<const io_uring_cqe*>(cqes_);
+  while (in_flight_ > 0) {
+    int ret;
+    if (fail_next_enter_) {
+      fail_next_enter_ = false;
+      syscall(__NR_io_uring_enter, ring_fd_, to_submit, 0, 0, nullptr, 0);
+      to_submit = 0;
+      errno = EIO;
+      ret = -1;
+    } else {
+      ret = syscall(__NR_io_uring_enter, ring_fd_, to_submit, in_flight_,
+                    IORING_ENTER_GETEVENTS, nullptr, 0);
+    }
+    if (ret >= 0) {
+      to_submit -= std::min<unsigned>(to_submit, ret);
+    } else if (errno != EINTR) {
+      if (ok) {
+        // The ring failed.  Withdraw what the kernel has not picked up, which
+        // it only reads during io_uring_enter, and keep waiting for the rest,
+        // which may still be using the callers' buffers.
+        ok = false;
+        unsigned head = LoadAcquire(sq_head_);
+        in_flight_ -= *sq_tail_ - head;
+        StoreRelease(sq_tail_, head);
+        to_submit = 0;
+      } else if (LoadAcquire(cq_tail_) == *cq_head_) {
+        // Waiting fails too, so leave the rest in_flight().
+        LOG(ERROR) << "io_uring_enter failed with " << in_flight_
+                   << " operations in flight: " << strerror(errno);
+        return false;
+      }
+    }
+
+    unsigned head = *cq_head_;
+    unsigned tail = LoadAcquire(cq_tail_);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = cqes[head & *cq_mask_];
+      Completion completion = {cqe.user_data, cqe.res};
+      completions->push_back(completion);
+      --in_flight_;
+    }
+    StoreRelease(cq_head_, head);
+  }
+  return ok;
+}
+
+IoUringPool::IoUringPool(unsigned entries, ThreadSystem* thread_system)
+    : entries_(entries),
+      mutex_(thread_system->NewMutex()),
+      available_(true),
+      pid_(getpid()) {}
+
+IoUringPool::~IoUringPool() {
+  for (IoUring* ring : free_rings_) {
+    delete ring;
+  }
+}
+
+IoUring* IoUringPool::Acquire() {
+  {
+    ScopedMutex lock(mutex_.get());
+    if (!available_) {
+      return nullptr;
+    }
+    pid_t pid = getpid();
+    if (pid != pid_) {
+      // We were forked.  Closing our copies of the parent's rings leaves
+      // the parent's alone.
+      for (IoUring* ring : free_rings_) {
+        delete ring;
+      }
+      free_rings_.clear();
+      pid_ = pid;
+    }
+    if (!free_rings_.empty()) {
+      IoUring* ring = free_rings_.back();
+      free_rings_.pop_back();
+      return ring;
+    }
+  }
+  IoUring* ring = IoUring::Create(entries_);
+  if (ring == nullptr) {
+    ScopedMutex lock(mutex_.get());
+    available_ = false;
+  }
+  return ring;
+}
+
+void IoUringPool::Release(IoUring* ring, bool usable) {
+  DCHECK_EQ(0U, ring->queued());
+  if (usable) {
+    ScopedMutex lock(mutex_.get());
+    free_rings_.push_back(ring);
+  } else if (ring->in_flight() == 0) {
+    delete ring;
+  }
+  // Otherwise the ring is leaked: closing it would not stop the kernel from
+  // finishing what is in flight.
+}
+
+bool IoUringPool::available() const {
+  ScopedMutex lock(mutex_.get());
+  return available_;
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,167 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_UTIL_IO_URING_H_
+#define PAGESPEED_KERNEL_UTIL_IO_URING_H_
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+
+struct io_uring_sqe;
+
+namespace net_instaweb {
+
+class ThreadSystem;
+
+// A Linux io_uring instance driven through the raw system calls, so there
+// is no dependency on liburing.  It supports the handful of file
+// operations the file cache needs, queued up and then submitted together
+// with a single io_uring_enter call that also waits for their completion.
+//
+// An IoUring must only be used by one thread at a time; see IoUringPool.
+class IoUring {
+ public:
+  struct Completion {
+    uint64 user_data;
+    int32 result;  // As returned by the system call, or -errno.
+  };
+
+  // Returns nullptr if io_uring is unavailable, which includes kernels
+  // older than 5.11 (for IORING_OP_RENAMEAT) and sandboxes that block it.
+  // entries is rounded up to a power of two by the kernel.
+  static IoUring* Create(unsigned entries);
+  ~IoUring();
+
+  // Maximum number of operations that can be queued before submitting.
+  unsigned capacity() const { return sq_entries_; }
+  // Number of operations queued since the last SubmitAndWait.
+  unsigned queued() const { return queued_; }
+
+  // Each Queue method returns false if the submission queue is full.
+  // When hardlink_next is true, the following operation starts only after
+  // this one completes, whether or not it succeeded.  Path strings and
+  // buffers must stay valid until SubmitAndWait returns.
+  bool QueueOpenAt(const char* path, int flags, mode_t mode, uint64 user_data);
+  // Fills in the fields of *buffer selected by mask (STATX_SIZE etc.).
+  bool QueueStatx(const char* path, unsigned mask, struct statx* buffer,
+                  uint64 user_data);
+  bool QueueRead(int fd, char* buffer, size_t size, uint64 user_data,
+                 bool hardlink_next);
+  bool QueueWrite(int fd, const char* buffer, size_t size, uint64 user_data,
+                  bool hardlink_next);
+  bool QueueClose(int fd, uint64 user_data);
+  bool QueueRenameAt(const char* old_path, const char* new_path,
+                     uint64 user_data);
+
+  // Submits the queued operations and waits for all of them to complete,
+  // appending their completions in completion order.  Returns false if the
+  // ring itself failed, in which case the ring should not be reused.  Even
+  // then, operations the kernel never picked up are withdrawn and the rest
+  // are waited for, so that their buffers are free to reuse, unless waiting
+  // fails as well; see in_flight().
+  bool SubmitAndWait(std::vector<Completion>* completions);
+
+  // Number of submitted operations that have not completed.  Only nonzero
+  // after a failed SubmitAndWait gave up waiting, in which case the kernel
+  // may still write to their buffers at any time, so those buffers must
+  // never be freed or reused, and neither may the ring.
+  unsigned in_flight() const { return in_flight_; }
+
+  // Makes the next io_uring_enter submit without waiting and then report
+  // failure, leaving the operations running.
+  void FailNextEnterForTesting() { fail_next_enter_ = true; }
+
+ private:
+  IoUring();
+  bool Initialize(unsigned entries);
+  io_uring_sqe* NextSqe(uint8 opcode, uint64 user_data);
+
+  int ring_fd_;
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned sq_entries_;
+
+  // Pointers into the shared rings.
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  void* cqes_;
+
+  unsigned queued_;
+  unsigned in_flight_;
+  bool fail_next_enter_;
+
+  DISALLOW_COPY_AND_ASSIGN(IoUring);
+};
+
+// Hands out IoUring instances to threads, creating them on demand, so that
+// concurrent callers never share a ring.  Rings are only created on first
+// use, so a pool may be set up in a parent process before forking; rings
+// the parent had pooled are dropped, not reused, by a forked child, which
+// would otherwise share them with the parent.  If the
+// kernel turns out not to support io_uring the pool stops trying and
+// Acquire returns nullptr from then on.
+class IoUringPool {
+ public:
+  // Rings are created with entries submission-queue slots.  Mutexes are
+  // allocated from thread_system, which is not retained.
+  IoUringPool(unsigned entries, ThreadSystem* thread_system);
+  ~IoUringPool();
+
+  // Returns a ring for the exclusive use of the caller, or nullptr if
+  // io_uring is unavailable.  Pass it back to Release when done.
+  IoUring* Acquire() LOCKS_EXCLUDED(mutex_);
+  // Returns a ring to the pool.  Pass usable = false if SubmitAndWait
+  // failed, and the ring will be destroyed, or leaked if operations are
+  // still in flight on it.
+  void Release(IoUring* ring, bool usable) LOCKS_EXCLUDED(mutex_);
+
+  // False once creating a ring has failed.
+  bool available() const LOCKS_EXCLUDED(mutex_);
+
+ private:
+  const unsigned entries_;
+  std::unique_ptr<AbstractMutex> mutex_;
+  bool available_ GUARDED_BY(mutex_);
+  // The process that created the rings in free_rings_.
+  pid_t pid_ GUARDED_BY(mutex_);
+  std::vector<IoUring*> free_rings_ GUARDED_BY(mutex_);
+
+  DISALLOW_COPY_AND_ASSIGN(IoUringPool);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_UTIL_IO_URING_H_
@@ -0,0 +1,316 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/lz_block_compressor.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#ifdef USE_SYSTEM_ZLIB
+#include "zlib.h"  // NOLINT
+#else
+#include "external/envoy/bazel/foreign_cc/zlib/include/zlib.h"
+#endif
+#include "pagespeed/kernel/base/string.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kHashBits = 12;
+const int kHashSize = 1 << kHashBits;
+const uint32 kEmptySlot = 0xffffffff;
+const size_t kMinMatch = 4;
+const size_t kMaxOffset = 0xffff;
+const size_t kLengthMask = 15;
+
+inline uint32 Load32(const char* p) {
+  uint32 value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline uint32 HashSequence(uint32 sequence) {
+  return (sequence * 2654435761U) >> (32 - kHashBits);
+}
+
+// Returns the length of the common prefix of a and b, which is at least
+// kMinMatch and at most limit, comparing a word at a time.
+inline size_t MatchLength(const char* a, const char* b, size_t limit) {
+  size_t length = kMinMatch;
+  while (length + sizeof(uint64) <= limit) {
+    uint64 x, y;
+    memcpy(&x, a + length, sizeof(x));
+    memcpy(&y, b + length, sizeof(y));
+    if (x != y) {
+#if defined(__GNUC__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+      return length + (__builtin_ctzll(x ^ y) >> 3);
+#else
+      break;
+#endif
+    }
+    length += sizeof(uint64);
+  }
+  while ((length < limit) && (a[length] == b[length])) {
+    ++length;
+  }
+  return length;
+}
+
+uint32 Checksum(StringPiece data) {
+  return adler32(adler32(0, nullptr, 0),
+                 reinterpret_cast<const Bytef*>(data.data()), data.size());
+}
+
+void AppendVarint(uint64 value, GoogleString* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+bool ReadVarint(const char** p, const char* end, uint64* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*p == end) {
+      return false;
+    }
+    uint8 byte = static_cast<uint8>(*(*p)++);
+    *value |= static_cast<uint64>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Lengths that do not fit in a token nibble continue as a run of bytes,
+// each adding its value, terminated by the first byte that is not 255.
+void AppendLength(size_t length, GoogleString* out) {
+  for (; length >= 255; length -= 255) {
+    out->push_back(static_cast<char>(255));
+  }
+  out->push_back(static_cast<char>(length));
+}
+
+bool ReadLength(const char** p, const char* end, size_t* length) {
+  uint8 byte;
+  do {
+    if (*p == end) {
+      return false;
+    }
+    byte = static_cast<uint8>(*(*p)++);
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// Appends a sequence of literals followed by a back-reference.  A zero
+// match_length marks the final, literals-only sequence.
+void AppendSequence(StringPiece literals, size_t offset, size_t match_length,
+                    GoogleString* out) {
+  size_t literal_length = literals.size();
+  size_t match_code = (match_length == 0) ? 0 : match_length - kMinMatch;
+  out->push_back(static_cast<char>(
+      (std::min(literal_length, kLengthMask) << 4) |
+      std::min(match_code, kLengthMask)));
+  if (literal_length >= kLengthMask) {
+    AppendLength(literal_length - kLengthMask, out);
+  }
+  out->append(literals.data(), literal_length);
+  if (match_length != 0) {
+    out->push_back(static_cast<char>(offset & 0xff));
+    out->push_back(static_cast<char>(offset >> 8));
+    if (match_code >= kLengthMask) {
+      AppendLength(match_code - kLengthMask, out);
+    }
+  }
+}
+
+}  // namespace
+
+LzBlockCompressor::LzBlockCompressor() {}
+
+LzBlockCompressor::LzBlockCompressor(StringPiece dictionary) {
+  // Only the tail of the dictionary is reachable by a 16-bit offset.
+  if (dictionary.size() > kMaxOffset) {
+    dictionary = dictionary.substr(dictionary.size() - kMaxOffset);
+  }
+  dictionary.CopyToString(&dictionary_);
+  if (dictionary_.size() >= kMinMatch) {
+    dictionary_table_.assign(kHashSize, kEmptySlot);
+    const char* data = dictionary_.data();
+    for (size_t pos = 0; pos + kMinMatch <= dictionary_.size(); ++pos) {
+      dictionary_table_[HashSequence(Load32(data + pos))] = pos;
+    }
+  }
+}
+
+LzBlockCompressor::~LzBlockCompressor() {}
+
+void LzBlockCompressor::Compress(StringPiece in, GoogleString* out) const {
+  const size_t size = in.size();
+  AppendVarint(size, out);
+  uint32 checksum = Checksum(in);
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(static_cast<char>((checksum >> (8 * i)) & 0xff));
+  }
+  out->reserve(out->size() + size + size / 255 + 16);
+
+  // Positions in the table are offsets into the virtual buffer formed by
+  // the dictionary followed by the input.
+  uint32 table[kHashSize];
+  if (dictionary_table_.empty()) {
+    std::fill(table, table + kHashSize, kEmptySlot);
+  } else {
+    std::copy(dictionary_table_.begin(), dictionary_table_.end(), table);
+  }
+  const char* src = in.data();
+  const char* dict = dictionary_.data();
+  const size_t dict_size = dictionary_.size();
+  size_t anchor = 0;
+  size_t pos = 0;
+  while (pos + kMinMatch <= size) {
+    uint32 sequence = Load32(src + pos);
+    uint32* slot = &table[HashSequence(sequence)];
+    uint32 candidate = *slot;
+    uint32 here = dict_size + pos;
+    *slot = here;
+    if ((candidate != kEmptySlot) && (here - candidate <= kMaxOffset)) {
+      // Matches do not run from the dictionary into the input; that keeps
+      // the comparison loop to a single pair of pointers.
+      const char* match;
+      size_t match_limit;
+      if (candidate < dict_size) {
+        match = dict + candidate;
+        match_limit = std::min(size - pos, dict_size - candidate);
+      } else {
+        match = src + (candidate - dict_size);
+        match_limit = size - pos;
+      }
+      if ((match_limit >= kMinMatch) && (Load32(match) == sequence)) {
+        size_t length = MatchLength(match, src + pos, match_limit);
+        AppendSequence(StringPiece(src + anchor, pos - anchor),
+                       here - candidate, length, out);
+        pos += length;
+        anchor = pos;
+        continue;
+      }
+    }
+    // Step faster through input that has not been matching, so that
+    // incompressible data costs little more than a copy.
+    pos += 1 + ((pos - anchor) >> 6);
+  }
+  AppendSequence(StringPiece(src + anchor, size - anchor), 0, 0, out);
+}
+
+bool LzBlockCompressor::Decompress(StringPiece in, GoogleString* out) const {
+  const char* p = in.data();
+  const char* end = p + in.size();
+  uint64 size;
+  if (!ReadVarint(&p, end, &size) || (end - p < 4)) {
+    return false;
+  }
+  uint32 checksum = 0;
+  for (int i = 0; i < 4; ++i) {
+    checksum |= static_cast<uint32>(static_cast<uint8>(*p++)) << (8 * i);
+  }
+  // Every input byte expands to at most 255 output bytes, so anything
+  // larger is a corrupt header; don't let it drive a huge reservation.
+  if (size > (static_cast<uint64>(in.size()) + 1) * 255) {
+    return false;
+  }
+
+  const size_t start = out->size();
+  const size_t dict_size = dictionary_.size();
+  out->resize(start + size);
+  char* dest = &(*out)[0] + start;
+  size_t produced = 0;
+  while (true) {
+    if (p == end) {
+      return false;
+    }
+    uint8 token = static_cast<uint8>(*p++);
+    size_t literal_length = token >> 4;
+    if ((literal_length == kLengthMask) &&
+        !ReadLength(&p, end, &literal_length)) {
+      return false;
+    }
+    if ((static_cast<size_t>(end - p) < literal_length) ||
+        (size - produced < literal_length)) {
+      return false;
+    }
+    memcpy(dest + produced, p, literal_length);
+    p += literal_length;
+    produced += literal_length;
+    if (p == end) {
+      break;
+    }
+
+    if (end - p < 2) {
+      return false;
+    }
+    size_t offset = static_cast<uint8>(p[0]) |
+                    (static_cast<size_t>(static_cast<uint8>(p[1])) << 8);
+    p += 2;
+    size_t length = token & kLengthMask;
+    if ((length == kLengthMask) && !ReadLength(&p, end, &length)) {
+      return false;
+    }
+    length += kMinMatch;
+    if ((offset == 0) || (offset > produced + dict_size) ||
+        (size - produced < length)) {
+      return false;
+    }
+    if (offset > produced) {
+      // The match starts in the dictionary.
+      size_t dict_pos = dict_size - (offset - produced);
+      size_t from_dict = std::min(length, dict_size - dict_pos);
+      memcpy(dest + produced, dictionary_.data() + dict_pos, from_dict);
+      produced += from_dict;
+      length -= from_dict;
+    }
+    if (length == 0) {
+      continue;
+    }
+    char* copy_from = dest + produced - offset;
+    char* copy_to = dest + produced;
+    produced += length;
+    if (offset >= length) {
+      memcpy(copy_to, copy_from, length);
+    } else {
+      // An overlapping copy replicates the last offset bytes written.  Each
+      // pass copies everything written since copy_from, so the distance
+      // doubles every pass.
+      while (length > 0) {
+        size_t chunk = std::min(length, static_cast<size_t>(copy_to -
+                                                            copy_from));
+        memcpy(copy_to, copy_from, chunk);
+        copy_to += chunk;
+        length -= chunk;
+      }
+    }
+  }
+  return (produced == size) &&
+         (Checksum(StringPiece(dest, produced)) == checksum);
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,78 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_UTIL_LZ_BLOCK_COMPRESSOR_H_
+#define PAGESPEED_KERNEL_UTIL_LZ_BLOCK_COMPRESSOR_H_
+
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// A fast, single-pass LZ77 block compressor in the style of LZ4.  It trades
+// ratio for speed: a greedy parse against a small hash table of 4-byte
+// sequences, no entropy coding, and a decoder that is little more than a
+// sequence of memcpys.  That makes it a good fit for values that are read
+// far more often than they are written, e.g. an in-memory cache tier.
+//
+// A block is the varint-encoded uncompressed size, the Adler-32 checksum of
+// the uncompressed bytes, and then a run of sequences.  Each sequence is a
+// token byte (literal length in the high nibble, match length - 4 in the low
+// nibble, 15 meaning "more length bytes follow"), the literals, and a 2-byte
+// little-endian back-reference offset.  The last sequence has literals only.
+// The checksum lets Decompress reject corrupted blocks, which LZ77 alone
+// cannot detect.
+//
+// An optional dictionary acts as a window that precedes the input: matches
+// may reach back into its last 64k bytes.  Blocks compressed with a
+// dictionary can only be decompressed with the identical dictionary.
+//
+// The object holds the prepared dictionary and is immutable after
+// construction, so one instance can be shared across threads.
+class LzBlockCompressor {
+ public:
+  LzBlockCompressor();
+  explicit LzBlockCompressor(StringPiece dictionary);
+  ~LzBlockCompressor();
+
+  // Appends the compressed form of in to *out.
+  void Compress(StringPiece in, GoogleString* out) const;
+
+  // Appends the decompressed form of in to *out, returning false if in is
+  // not a well-formed block or fails its checksum.  *out may hold a partial
+  // result on failure.
+  bool Decompress(StringPiece in, GoogleString* out) const;
+
+  StringPiece dictionary() const { return dictionary_; }
+
+ private:
+  GoogleString dictionary_;
+  // Hash table of the dictionary's 4-byte sequences, copied as the initial
+  // state of each Compress.  Empty when there is no dictionary.
+  std::vector<uint32> dictionary_table_;
+
+  DISALLOW_COPY_AND_ASSIGN(LzBlockCompressor);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_UTIL_LZ_BLOCK_COMPRESSOR_H_
@@ -19,12 +19,25 @@
 
 #include "pagespeed/kernel/util/simple_stats.h"
 
-#include "pagespeed/kernel/base/abstract_mutex.h"
+#include <algorithm>
+#include <atomic>
+
+#include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 
 namespace net_instaweb {
 
+namespace {
+
+// Number of threads that have been dealt a shard so far.  Shards at or past
+// this index have never been added to, so Get() can skip them.
+std::atomic<uint32> threads_with_shards(0);
+
+}  // namespace
+
+const int SimpleStatsVariable::kNumShards;
+
 SimpleStats::SimpleStats(ThreadSystem* thread_system)
     : thread_system_(thread_system) {}
 
@@ -34,29 +47,45 @@ CountHistogram* SimpleStats::NewHistogram(StringPiece /*name*/) {
   return new CountHistogram(thread_system_->NewMutex());
 }
 
-SimpleStats::Var* SimpleStats::NewVariable(StringPiece name) {
-  Var* var = new Var(name, this);
-  var->impl()->set_mutex(thread_system_->NewMutex());
-  return var;
+SimpleStatsVariable::SimpleStatsVariable(StringPiece name, Statistics* stats) {
+  for (Shard& shard : shards_) {
+    shard.value.store(0, std::memory_order_relaxed);
+  }
 }
 
-SimpleStats::UpDown* SimpleStats::NewUpDownCounter(StringPiece name) {
-  UpDown* up_down = new UpDown(name, this);
-  up_down->impl()->set_mutex(thread_system_->NewMutex());
-  return up_down;
-}
+SimpleStatsVariable::~SimpleStatsVariable() {}
 
-SimpleStatsVariable::SimpleStatsVariable(StringPiece name, Statistics* stats)
-    : value_(0) {}
+int SimpleStatsVariable::ThisThreadShard() {
+  // Threads are dealt shards round-robin, so up to kNumShards threads never
+  // share one.
+  static thread_local int shard =
+      threads_with_shards.fetch_add(1, std::memory_order_relaxed) % kNumShards;
+  return shard;
+}
 
-SimpleStatsVariable::~SimpleStatsVariable() {}
+int64 SimpleStatsVariable::Get() const {
+  // Shard 0 is always read, as Set() stores there.  A thread always sees its
+  // own fetch_add of threads_with_shards, so it never misses its own adds.
+  uint32 shards_in_use = threads_with_shards.load(std::memory_order_relaxed);
+  int num_shards = std::max(
+      1, static_cast<int>(std::min<uint32>(shards_in_use, kNumShards)));
+  int64 sum = 0;
+  for (int i = 0; i < num_shards; ++i) {
+    sum += shards_[i].value.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
 
-int64 SimpleStatsVariable::GetLockHeld() const { return value_; }
+void SimpleStatsVariable::Set(int64 value) {
+  shards_[0].value.store(value, std::memory_order_relaxed);
+  for (int i = 1; i < kNumShards; ++i) {
+    shards_[i].value.store(0, std::memory_order_relaxed);
+  }
+}
 
-int64 SimpleStatsVariable::SetReturningPreviousValueLockHeld(int64 value) {
-  int64 previous_value = value_;
-  value_ = value;
-  return previous_value;
+int64 SimpleStatsVariable::AddHelper(int64 delta) {
+  shards_[ThisThreadShard()].value.fetch_add(delta, std::memory_order_relaxed);
+  return delta;
 }
 
 }  // namespace net_instaweb
@@ -20,9 +20,9 @@
 #ifndef PAGESPEED_KERNEL_UTIL_SIMPLE_STATS_H_
 #define PAGESPEED_KERNEL_UTIL_SIMPLE_STATS_H_
 
-#include "pagespeed/kernel/base/abstract_mutex.h"
+#include <atomic>
+
 #include "pagespeed/kernel/base/basictypes.h"
-#include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/statistics_template.h"
 #include "pagespeed/kernel/base/string.h"
@@ -32,23 +32,38 @@ namespace net_instaweb {
 
 class ThreadSystem;
 
-// These variables are thread-safe.
-class SimpleStatsVariable : public MutexedScalar {
+// These variables are thread-safe without locking.  The value is split into
+// kNumShards cache-line-sized atomic shards, and each thread adds to the
+// shard it was assigned on first use, so hot counters bumped from many
+// worker threads don't bounce a shared lock or cache line between cores.
+// Get() sums the shards.
+//
+// Add returns just its delta: summing the shards there would pull every
+// other core's cache line into each add, which is the traffic the shards
+// are there to avoid.  Set is not atomic with respect to concurrent Adds:
+// each such Add is either kept or overwritten.
+class SimpleStatsVariable {
  public:
-  SimpleStatsVariable(StringPiece name, Statistics* stats);
-  ~SimpleStatsVariable() override;
-  virtual StringPiece GetName() const { return StringPiece(); }
+  static const int kNumShards = 16;
 
-  void set_mutex(AbstractMutex* mutex) { mutex_.reset(mutex); }
+  SimpleStatsVariable(StringPiece name, Statistics* stats);
+  ~SimpleStatsVariable();
 
- protected:
-  AbstractMutex* mutex() const override { return mutex_.get(); }
-  int64 GetLockHeld() const override;
-  int64 SetReturningPreviousValueLockHeld(int64 value) override;
+  int64 Get() const;
+  StringPiece GetName() const { return StringPiece(); }
+  void Set(int64 value);
+  int64 AddHelper(int64 delta);
 
  private:
-  int64 value_;
-  std::unique_ptr<AbstractMutex> mutex_;
+  struct alignas(64) Shard {
+    std::atomic<int64> value;
+  };
+
+  // Returns the shard the calling thread adds to.
+  static int ThisThreadShard();
+
+  Shard shards_[kNumShards];
+
   DISALLOW_COPY_AND_ASSIGN(SimpleStatsVariable);
 };
 
@@ -56,7 +71,7 @@ class SimpleStatsVariable : public MutexedScalar {
 class SimpleStats : public ScalarStatisticsTemplate<SimpleStatsVariable> {
  public:
   // SimpleStats will not take ownership of thread_system.  The thread system is
-  // used to instantiate mutexes to allow SimpleStatsVariable to be thread-safe.
+  // used to instantiate the mutexes that make histograms thread-safe.
   explicit SimpleStats(ThreadSystem* thread_system);
   ~SimpleStats() override;
 
@@ -64,8 +79,6 @@ class SimpleStats : public ScalarStatisticsTemplate<SimpleStatsVariable> {
   ThreadSystem* thread_system() const { return thread_system_; }
 
   CountHistogram* NewHistogram(StringPiece name) override;
-  Var* NewVariable(StringPiece name) override;
-  UpDown* NewUpDownCounter(StringPiece name) override;
 
  private:
   ThreadSystem* thread_system_;  // Not owned by this class.
@@ -65,6 +65,7 @@ RequestContext::RequestContext(const HttpOptions& options, AbstractMutex* mutex,
 void RequestContext::Init() {
   using_http2_ = false;
   accepts_webp_ = false;
+  accepts_avif_ = false;
   accepts_gzip_ = false;
   frozen_ = false;
 }
@@ -131,6 +132,13 @@ void RequestContext::SetAcceptsWebp(bool x) {
   }
 }
 
+void RequestContext::SetAcceptsAvif(bool x) {
+  if (x != accepts_avif_) {
+    DCHECK(!frozen_);
+    accepts_avif_ = x;
+  }
+}
+
 AbstractLogRecord* RequestContext::GetBackgroundRewriteLog(
     ThreadSystem* thread_system, bool log_urls, bool log_url_indices,
     int max_rewrite_info_log_size) {
@@ -152,6 +152,11 @@ class RequestContext : public RefCounted<RequestContext> {
   void SetAcceptsWebp(bool x);
   bool accepts_webp() const { return accepts_webp_; }
 
+  // Indicates whether the request-headers tell us that a browser can
+  // render AVIF images.
+  void SetAcceptsAvif(bool x);
+  bool accepts_avif() const { return accepts_avif_; }
+
   // Indicates whether the request-headers tell us that a browser can extract
   // gzip compressed data.
   void SetAcceptsGzip(bool x);
@@ -251,6 +256,7 @@ class RequestContext : public RefCounted<RequestContext> {
 
   bool using_http2_;
   bool accepts_webp_;
+  bool accepts_avif_;
   bool accepts_gzip_;
   bool frozen_;
   GoogleString minimal_private_suffix_;
@@ -522,6 +522,30 @@ void AdminSite::PrintCaches(
     response_headers->Add(HttpAttributes::kContentType, "text/html");
     fetch->Write(options->PurgeSetString(), message_handler_);
     fetch->Done(true);
+  } else if ((source == kPageSpeedAdmin) &&
+             query_params.Lookup1Unescaped("resize_shm_cache", &url)) {
+    // Here url is the name of a shared memory metadata cache, as given to
+    // CreateSharedMemoryMetadataCache, or empty for the default one.
+    if (url.empty()) {
+      url = SystemCaches::kDefaultSharedMemoryPath;
+    }
+    GoogleString size_kb_string, message;
+    int64 size_kb;
+    if (system_caches == nullptr) {
+      message = "Shared memory caches are not available.";
+    } else if (query_params.Lookup1Unescaped("size_kb", &size_kb_string) &&
+               StringToInt64(size_kb_string, &size_kb)) {
+      system_caches->ResizeShmMetadataCache(url, size_kb, &message);
+    } else {
+      message = "resize_shm_cache needs a numeric size_kb.";
+    }
+    ResponseHeaders* response_headers = fetch->response_headers();
+    response_headers->SetStatusAndReason(HttpStatus::kOK);
+    response_headers->Add(HttpAttributes::kContentType, "text/html");
+    GoogleString escaped_message;
+    HtmlKeywords::Escape(message, &escaped_message);
+    fetch->Write(escaped_message, message_handler_);
+    fetch->Done(true);
   } else if ((source == kPageSpeedAdmin) &&
              query_params.Lookup1Unescaped("purge", &url)) {
     ResponseHeaders* response_headers = fetch->response_headers();
@@ -23,8 +23,10 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <map>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "base/logging.h"
 #include "third_party/redis-crc/redis_crc.h"
@@ -161,10 +163,15 @@ void RedisCache::ShutDown() {
 }
 
 void RedisCache::Get(const GoogleString& key, Callback* callback) {
+  GetFrom(LookupConnection(key), false /* asking */, key, callback);
+}
+
+void RedisCache::GetFrom(Connection* connection, bool asking,
+                         const GoogleString& key, Callback* callback) {
   KeyState keyState = CacheInterface::kNotFound;
-  RedisReply reply = RedisCommand(LookupConnection(key), "GET %b",
-                                  {REDIS_REPLY_STRING, REDIS_REPLY_NIL},
-                                  key.data(), key.length());
+  RedisReply reply = RedisCommandAfterRedirection(
+      connection, asking, "GET %b", {REDIS_REPLY_STRING, REDIS_REPLY_NIL},
+      key.data(), key.length());
 
   if (reply) {
     if (reply->type == REDIS_REPLY_STRING) {
@@ -178,6 +185,132 @@ void RedisCache::Get(const GoogleString& key, Callback* callback) {
   ValidateAndReportResult(key, keyState, callback);
 }
 
+void RedisCache::MultiGet(MultiGetRequest* request) {
+  // Group the keys by the server we expect to hold them, and then by hash
+  // slot, as Redis Cluster only allows an MGET of keys that share a slot.
+  // The groups hold indices into request.
+  typedef std::map<int, std::vector<int>> SlotGroups;
+  std::map<Connection*, SlotGroups> servers;
+  const int num_keys = request->size();
+  for (int i = 0; i < num_keys; ++i) {
+    const GoogleString& key = (*request)[i].key;
+    servers[LookupConnection(key)][HashSlot(key)].push_back(i);
+  }
+
+  std::vector<KeyState> key_states(num_keys, CacheInterface::kNotFound);
+  std::vector<bool> redirected(num_keys, false);
+  // Where each redirected key was sent, and whether with an ASK.
+  std::vector<ExternalServerSpec> redirected_to(num_keys);
+  std::vector<bool> asking(num_keys, false);
+  Connection* moved_from = nullptr;
+  for (const auto& server : servers) {
+    Connection* conn = server.first;
+    if (conn == nullptr) {
+      continue;
+    }
+    std::vector<StringPieceVector> commands;
+    std::vector<const std::vector<int>*> command_keys;
+    for (const auto& slot : server.second) {
+      const std::vector<int>& indices = slot.second;
+      commands.emplace_back(1, indices.size() == 1 ? "GET" : "MGET");
+      for (int i : indices) {
+        commands.back().push_back((*request)[i].key);
+      }
+      command_keys.push_back(&indices);
+    }
+
+    std::vector<RedisReply> replies;
+    {
+      ScopedMutex lock(conn->GetOperationMutex());
+      if (!conn->RedisCommandBatch(commands,
+                                   {REDIS_REPLY_STRING, REDIS_REPLY_NIL,
+                                    REDIS_REPLY_ARRAY, REDIS_REPLY_ERROR},
+                                   "MGET", &replies)) {
+        continue;
+      }
+    }
+    for (size_t c = 0; c < replies.size(); ++c) {
+      const redisReply* reply = replies[c].get();
+      const std::vector<int>& indices = *command_keys[c];
+      if (reply == nullptr) {
+        continue;  // Already logged.
+      }
+      if (reply->type == REDIS_REPLY_ERROR) {
+        StringPiece error(reply->str, reply->len);
+        if (strings::StartsWith(error, "MOVED ") ||
+            strings::StartsWith(error, "ASK ")) {
+          // Look these keys up one at a time, carrying on from this
+          // redirection so that it is neither repeated nor counted twice.
+          redirections_->Add(1);
+          bool ask = strings::StartsWith(error, "ASK ");
+          if (!ask) {
+            moved_from = conn;
+          }
+          ExternalServerSpec spec = ParseRedirectionError(error);
+          for (int i : indices) {
+            redirected[i] = true;
+            redirected_to[i] = spec;
+            asking[i] = ask;
+          }
+        } else {
+          GoogleString error_string = error.as_string();
+          LOG(DFATAL) << "MGET: redis returned error: " << error_string;
+          message_handler_->Message(kError, "MGET: redis returned error: %s",
+                                    error_string.c_str());
+        }
+        continue;
+      }
+      // A GET gets a single value and an MGET an array of them, in the order
+      // the keys were given.
+      const redisReply* const* values = &reply;
+      size_t num_values = 1;
+      if (reply->type == REDIS_REPLY_ARRAY) {
+        values = reply->element;
+        num_values = reply->elements;
+      }
+      if (num_values != indices.size()) {
+        LOG(DFATAL) << "MGET: expected " << indices.size()
+                    << " values from redis, got " << num_values;
+        message_handler_->Message(kError,
+                                  "MGET: expected %d values from redis, got %d",
+                                  static_cast<int>(indices.size()),
+                                  static_cast<int>(num_values));
+        continue;
+      }
+      for (size_t j = 0; j < num_values; ++j) {
+        // As in Get(), anything but a string means 'key not found'.
+        if (values[j]->type == REDIS_REPLY_STRING) {
+          (*request)[indices[j]].callback->set_value(SharedString(
+              StringPiece(values[j]->str, values[j]->len)));
+          key_states[indices[j]] = CacheInterface::kAvailable;
+        }
+      }
+    }
+  }
+
+  if (moved_from != nullptr) {
+    // As in RedisCommand(), a MOVED means our slot mapping is out of date.
+    // Fetching it now sends the redirected keys straight to the right
+    // servers.
+    FetchClusterSlotMapping(moved_from);
+  }
+  for (int i = 0; i < num_keys; ++i) {
+    KeyCallback* key_callback = &(*request)[i];
+    if (redirected[i]) {
+      if (redirected_to[i].empty()) {
+        Get(key_callback->key, key_callback->callback);  // Already logged.
+      } else {
+        GetFrom(GetOrCreateConnection(redirected_to[i], kDefaultDatabaseIndex),
+                asking[i], key_callback->key, key_callback->callback);
+      }
+    } else {
+      ValidateAndReportResult(key_callback->key, key_states[i],
+                              key_callback->callback);
+    }
+  }
+  delete request;
+}
+
 void RedisCache::Put(const GoogleString& key, const SharedString& value) {
   RedisReply reply;
 
@@ -245,18 +378,37 @@ void RedisCache::GetStatus(GoogleString* buffer) {
 RedisCache::RedisReply RedisCache::RedisCommand(
     Connection* likely_connection, const char* format,
     std::initializer_list<int> valid_reply_types, ...) {
+  va_list args;
+  va_start(args, valid_reply_types);
+  RedisReply reply = RedisCommandV(likely_connection, false /* asking */,
+                                   format, valid_reply_types, args);
+  va_end(args);
+  return reply;
+}
+
+RedisCache::RedisReply RedisCache::RedisCommandAfterRedirection(
+    Connection* connection, bool asking, const char* format,
+    std::initializer_list<int> valid_reply_types, ...) {
+  va_list args;
+  va_start(args, valid_reply_types);
+  RedisReply reply =
+      RedisCommandV(connection, asking, format, valid_reply_types, args);
+  va_end(args);
+  return reply;
+}
+
+RedisCache::RedisReply RedisCache::RedisCommandV(
+    Connection* likely_connection, bool asking, const char* format,
+    std::initializer_list<int> valid_reply_types, va_list args) {
   if (likely_connection == nullptr) {
     return nullptr;
   }
   GoogleString command = format;
   command = command.substr(0, command.find_first_of(' '));
 
-  va_list args;
-  va_start(args, valid_reply_types);
-
   RedisReply reply;
   Connection* conn = likely_connection;
-  bool with_asking = false;
+  bool with_asking = asking;
   ExternalServerSpec redirected_to;
   Connection* last_redirecting_connection = nullptr;
   // This loop will break when no further redirections are needed.
@@ -310,8 +462,6 @@ RedisCache::RedisReply RedisCache::RedisCommand(
     }
   }
 
-  va_end(args);
-
   if (redirections > 0 && !with_asking) {
     // We were redirected with a MOVED, so query the server that told us to look
     // somewhere else what we should update our mappings to.
@@ -712,6 +862,61 @@ RedisCache::RedisReply RedisCache::Connection::RedisCommand(const char* format,
   return reply;
 }
 
+bool RedisCache::Connection::RedisCommandBatch(
+    const std::vector<StringPieceVector>& commands,
+    std::initializer_list<int> valid_types, const char* command_executed,
+    std::vector<RedisReply>* replies) {
+  replies->clear();
+  if (!EnsureConnectionAndDatabaseSelection()) {
+    return false;
+  }
+
+  std::vector<const char*> argv;
+  std::vector<size_t> argv_len;
+  bool ok = true;
+  for (const StringPieceVector& command : commands) {
+    argv.clear();
+    argv_len.clear();
+    for (StringPiece arg : command) {
+      argv.push_back(arg.data());
+      argv_len.push_back(arg.size());
+    }
+    if (redisAppendCommandArgv(redis_.get(), argv.size(), argv.data(),
+                               argv_len.data()) != REDIS_OK) {
+      ok = false;
+      break;
+    }
+  }
+  // The first redisGetReply() sends everything appended above.
+  for (size_t i = 0; ok && i < commands.size(); ++i) {
+    void* reply = nullptr;
+    if (redisGetReply(redis_.get(), &reply) == REDIS_OK) {
+      replies->emplace_back(static_cast<redisReply*>(reply));
+    } else {
+      ok = false;
+    }
+  }
+  redis_cache_->thread_synchronizer_->Signal("RedisCommand.After.Signal");
+  redis_cache_->thread_synchronizer_->Wait("RedisCommand.After.Wait");
+
+  if (!ok) {
+    LogRedisContextError(redis_.get(), command_executed);
+    replies->clear();
+    // Any replies left unread would be taken for those of later commands,
+    // so this connection can't be used again.
+    ScopedMutex lock(state_mutex_.get());
+    redis_.reset();
+    state_ = kDisconnected;
+    return false;
+  }
+  for (RedisReply& reply : *replies) {
+    if (!ValidateRedisReply(reply, valid_types, command_executed)) {
+      reply.reset();
+    }
+  }
+  return true;
+}
+
 void RedisCache::Connection::LogRedisContextError(redisContext* context,
                                                   const char* cause) {
   if (context == nullptr) {
@@ -70,6 +70,16 @@ namespace net_instaweb {
 //
 // http://redis.io/topics/cluster-spec explains this all.
 //
+// MultiGet batches its keys into one MGET per hash slot (or GET, for a slot
+// with a single key), as Redis Cluster only allows an MGET of keys that share
+// a slot, and sends each server all of its commands before reading the
+// replies.  So a batch takes one round trip per server rather than one per
+// key.  Keys whose command is redirected are then looked up one at a time,
+// starting from the server the redirection named.
+//
+// RedisCache is otherwise a blocking client: each connection serves one
+// caller at a time, and Get and Put take a round trip each.
+//
 // TODO(yeputons): consider extracting a common interface with AprMemCache.
 // TODO(yeputons): consider making Redis-reported errors treated as failures.
 // TODO(yeputons): add redis AUTH command support.
@@ -100,6 +110,7 @@ class RedisCache : public CacheInterface {
 
   // CacheInterface implementations.
   void Get(const GoogleString& key, Callback* callback) override;
+  void MultiGet(MultiGetRequest* request) override;
   void Put(const GoogleString& key, const SharedString& value) override;
   void Delete(const GoogleString& key) override;
 
@@ -166,6 +177,17 @@ class RedisCache : public CacheInterface {
                             const char* command_executed)
         EXCLUSIVE_LOCKS_REQUIRED(redis_mutex_) LOCKS_EXCLUDED(state_mutex_);
 
+    // Runs a batch of commands, each given as its arguments, sending them
+    // all before reading any of the replies, and validates the replies as
+    // ValidateRedisReply does.  Fills replies with one entry per command,
+    // null where a reply was invalid.  Returns false, leaving replies empty,
+    // if the commands could not be sent or the replies could not be read.
+    bool RedisCommandBatch(const std::vector<StringPieceVector>& commands,
+                           std::initializer_list<int> valid_types,
+                           const char* command_executed,
+                           std::vector<RedisReply>* replies)
+        EXCLUSIVE_LOCKS_REQUIRED(redis_mutex_) LOCKS_EXCLUDED(state_mutex_);
+
    private:
     enum State { kShutDown, kDisconnected, kConnecting, kConnected };
 
@@ -226,6 +248,23 @@ class RedisCache : public CacheInterface {
   RedisReply RedisCommand(Connection* connection, const char* format,
                           std::initializer_list<int> valid_reply_types, ...);
 
+  // Like RedisCommand, but carrying on from a redirection that has already
+  // been received and counted: connection is the server it named, and
+  // asking says whether it was an ASK, which requires sending ASKING first.
+  RedisReply RedisCommandAfterRedirection(
+      Connection* connection, bool asking, const char* format,
+      std::initializer_list<int> valid_reply_types, ...);
+
+  RedisReply RedisCommandV(Connection* connection, bool asking,
+                           const char* format,
+                           std::initializer_list<int> valid_reply_types,
+                           va_list args);
+
+  // Implements Get, starting from connection; see
+  // RedisCommandAfterRedirection for asking.
+  void GetFrom(Connection* connection, bool asking, const GoogleString& key,
+               Callback* callback);
+
   ThreadSynchronizer* GetThreadSynchronizerForTesting() const {
     return thread_synchronizer_.get();
   }
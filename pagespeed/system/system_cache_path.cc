@@ -33,9 +33,11 @@
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/cache_stats.h"
 #include "pagespeed/kernel/cache/file_cache.h"
+#include "pagespeed/kernel/cache/log_structured_file_cache.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/cache/purge_context.h"
 #include "pagespeed/kernel/cache/purge_set.h"
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
 #include "pagespeed/kernel/cache/threadsafe_cache.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_lock_manager.h"
 #include "pagespeed/kernel/util/file_system_lock_manager.h"
@@ -46,6 +48,9 @@ namespace net_instaweb {
 
 const char SystemCachePath::kFileCache[] = "file_cache";
 const char SystemCachePath::kLruCache[] = "lru_cache";
+const char SystemCachePath::kFileCacheModeFiles[] = "files";
+const char SystemCachePath::kFileCacheModeLog[] = "log";
+const char SystemCachePath::kLogStructuredDir[] = "log_structured";
 
 // The SystemCachePath encapsulates a cache-sharing model where a user specifies
 // a file-cache path per virtual-host.  With each file-cache object we keep
@@ -59,6 +64,8 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
       shm_runtime_(shm_runtime),
       lock_manager_(nullptr),
       file_cache_backend_(nullptr),
+      log_file_cache_backend_(nullptr),
+      file_cache_mode_(config->file_cache_mode()),
       lru_cache_(nullptr),
       file_cache_(nullptr),
       cache_flush_filename_(config->cache_flush_filename()),
@@ -69,6 +76,7 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
       clean_size_explicitly_set_(config->has_file_cache_clean_size_kb()),
       clean_inode_limit_explicitly_set_(
           config->has_file_cache_clean_inode_limit()),
+      clean_slice_explicitly_set_(config->has_file_cache_clean_slice_ms()),
       mutex_(factory->thread_system()->NewMutex()) {
   if (cache_flush_filename_.empty()) {
     if (enable_cache_purge_) {
@@ -109,23 +117,65 @@ SystemCachePath::SystemCachePath(const StringPiece& path,
     FallBackToFileBasedLocking();
   }
 
-  FileCache::CachePolicy* policy =
-      new FileCache::CachePolicy(factory->timer(), factory->hasher(),
-                                 config->file_cache_clean_interval_ms(),
-                                 config->file_cache_clean_size_kb() * 1024,
-                                 config->file_cache_clean_inode_limit());
-  file_cache_backend_ =
-      new FileCache(config->file_cache_path(), factory->file_system(),
-                    factory->thread_system(), nullptr, policy,
-                    factory->statistics(), factory->message_handler());
-  factory->TakeOwnership(file_cache_backend_);
-  file_cache_ = new CacheStats(kFileCache, file_cache_backend_,
+  CacheInterface* file_cache_backend;
+  if (file_cache_mode_ == kFileCacheModeLog) {
+    // The log-structured cache evicts whole segments to stay within the
+    // size limit, so it needs no cleaning interval or inode limit.
+    StringPiece path(config->file_cache_path());
+    log_file_cache_backend_ = new LogStructuredFileCache(
+        StrCat(path, strings::EndsWith(path, "/") ? "" : "/",
+               kLogStructuredDir),
+        config->file_cache_clean_size_kb() * 1024, 0 /* segment size */,
+        factory->thread_system(), factory->statistics(),
+        factory->message_handler());
+    file_cache_backend = log_file_cache_backend_;
+  } else {
+    if (file_cache_mode_ != kFileCacheModeFiles) {
+      factory->message_handler()->Message(
+          kWarning, "Unknown FileCacheMode %s for file-cache %s, using %s",
+          file_cache_mode_.c_str(), path_.c_str(), kFileCacheModeFiles);
+      file_cache_mode_ = kFileCacheModeFiles;
+    }
+    FileCache::CachePolicy* policy =
+        new FileCache::CachePolicy(factory->timer(), factory->hasher(),
+                                   config->file_cache_clean_interval_ms(),
+                                   config->file_cache_clean_size_kb() * 1024,
+                                   config->file_cache_clean_inode_limit());
+    policy->clean_slice_ms = config->file_cache_clean_slice_ms();
+    file_cache_backend_ =
+        new FileCache(config->file_cache_path(), factory->file_system(),
+                      factory->thread_system(), nullptr, policy,
+                      factory->statistics(), factory->message_handler());
+    if (config->file_cache_io_uring()) {
+      file_cache_backend_->EnableIoUring();
+    }
+    file_cache_backend = file_cache_backend_;
+  }
+  factory->TakeOwnership(file_cache_backend);
+  file_cache_ = new CacheStats(kFileCache, file_cache_backend,
                                factory->timer(), factory->statistics());
   factory->TakeOwnership(file_cache_);
 
-  if (config->lru_cache_kb_per_process() != 0) {
+  if (config->lru_cache_kb_per_process() != 0 &&
+      config->lru_cache_shards() > 0) {
+    // The sharded LRU does its own per-shard locking, so a lookup only
+    // contends with other lookups that hash to the same shard.
+    ShardedLRUCache* sharded_cache = new ShardedLRUCache(
+        config->lru_cache_kb_per_process() * 1024, config->lru_cache_shards(),
+        factory->thread_system());
+    if (config->lru_cache_admission_policy()) {
+      sharded_cache->EnableAdmissionPolicy();
+    }
+    factory->TakeOwnership(sharded_cache);
+    lru_cache_ = new CacheStats(kLruCache, sharded_cache, factory->timer(),
+                                factory->statistics());
+    factory->TakeOwnership(lru_cache_);
+  } else if (config->lru_cache_kb_per_process() != 0) {
     LRUCache* lru_cache =
         new LRUCache(config->lru_cache_kb_per_process() * 1024);
+    if (config->lru_cache_admission_policy()) {
+      lru_cache->EnableAdmissionPolicy();
+    }
     factory->TakeOwnership(lru_cache);
 
     // We only add the threadsafe-wrapper to the LRUCache.  The FileCache
@@ -153,6 +203,19 @@ GoogleString SystemCachePath::CachePath(SystemRewriteOptions* config) {
 }
 
 void SystemCachePath::MergeConfig(const SystemRewriteOptions* config) {
+  if (config->file_cache_mode() != file_cache_mode_) {
+    factory_->message_handler()->Message(
+        kWarning,
+        "Conflicting settings %s!=%s for FileCacheMode for file-cache %s, "
+        "keeping %s",
+        config->file_cache_mode().c_str(), file_cache_mode_.c_str(),
+        path_.c_str(), file_cache_mode_.c_str());
+  }
+  if (file_cache_backend_ == nullptr) {
+    // The log-structured cache's segments are sized when it is constructed,
+    // so later configurations cannot change its size.
+    return;
+  }
   FileCache::CachePolicy* policy = file_cache_backend_->mutable_cache_policy();
 
   // For the interval, we take the smaller of the specified intervals, so
@@ -172,6 +235,11 @@ void SystemCachePath::MergeConfig(const SystemRewriteOptions* config) {
   MergeEntries(config->file_cache_clean_inode_limit(),
                config->has_file_cache_clean_inode_limit(), true, "InodeLimit",
                &policy->target_inode_count, &clean_inode_limit_explicitly_set_);
+  // Any vhost asking for incremental cleaning gets it, with the longest
+  // slices asked for.
+  MergeEntries(config->file_cache_clean_slice_ms(),
+               config->has_file_cache_clean_slice_ms(), true, "SliceMs",
+               &policy->clean_slice_ms, &clean_slice_explicitly_set_);
 }
 
 void SystemCachePath::MergeEntries(int64 config_value, bool config_was_set,
@@ -36,6 +36,7 @@ class AbstractSharedMem;
 class CacheInterface;
 class FileCache;
 class FileSystemLockManager;
+class LogStructuredFileCache;
 class MessageHandler;
 class NamedLockManager;
 class PurgeContext;
@@ -55,6 +56,12 @@ class SystemCachePath {
   static const char kFileCache[];
   static const char kLruCache[];
 
+  // Values of the FileCacheMode option, and the subdirectory of the file
+  // cache path that holds the log-structured cache's segments.
+  static const char kFileCacheModeFiles[];
+  static const char kFileCacheModeLog[];
+  static const char kLogStructuredDir[];
+
   SystemCachePath(const StringPiece& path, const SystemRewriteOptions* config,
                   RewriteDriverFactory* factory,
                   AbstractSharedMem* shm_runtime);
@@ -71,8 +78,12 @@ class SystemCachePath {
   CacheInterface* file_cache() { return file_cache_; }
 
   // Access to backend for testing.  Do not use this directly in production
-  // as it lacks statistics wrappers, etc.
+  // as it lacks statistics wrappers, etc.  Exactly one of these is non-NULL,
+  // depending on the FileCacheMode.
   FileCache* file_cache_backend() { return file_cache_backend_; }
+  LogStructuredFileCache* log_file_cache_backend() {
+    return log_file_cache_backend_;
+  }
   NamedLockManager* lock_manager() { return lock_manager_; }
 
   // See comments in SystemCaches for calling conventions on these.
@@ -136,6 +147,8 @@ class SystemCachePath {
   std::unique_ptr<FileSystemLockManager> file_system_lock_manager_;
   NamedLockManager* lock_manager_;
   FileCache* file_cache_backend_;  // owned by file_cache_
+  LogStructuredFileCache* log_file_cache_backend_;  // owned by file_cache_
+  GoogleString file_cache_mode_;
   CacheInterface* lru_cache_;
   CacheInterface* file_cache_;
   GoogleString cache_flush_filename_;
@@ -144,6 +157,7 @@ class SystemCachePath {
   bool clean_interval_explicitly_set_;
   bool clean_size_explicitly_set_;
   bool clean_inode_limit_explicitly_set_;
+  bool clean_slice_explicitly_set_;
 
   std::unique_ptr<PurgeContext> purge_context_;
 
@@ -41,10 +41,12 @@
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/cache/async_cache.h"
 #include "pagespeed/kernel/cache/cache_batcher.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_stats.h"
 #include "pagespeed/kernel/cache/compressed_cache.h"
 #include "pagespeed/kernel/cache/fallback_cache.h"
 #include "pagespeed/kernel/cache/file_cache.h"
+#include "pagespeed/kernel/cache/log_structured_file_cache.h"
 #include "pagespeed/kernel/cache/purge_context.h"
 #include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
@@ -58,6 +60,24 @@
 
 namespace net_instaweb {
 
+namespace {
+
+// Number of metadata cache values sampled to train a compression
+// dictionary, when CompressMetadataCacheDictionaryKb is set.
+const int kDictionaryTrainingSamples = 1000;
+
+// Geometry of shared memory metadata caches, at whatever size they're
+// created or resized to.
+const int kShmCacheSectors = 128;
+const int kShmCacheBlockEntryRatio = 2;  // Based empirically off load tests.
+
+// Make sure the size cap is not unusably low. In particular, with 2K inlining
+// thresholds, something like 3K is needed. (As of time of writing, that
+// required about 4.3MiB).
+const int64 kShmCacheMinSizeCap = 3 * 1024;
+
+}  // namespace
+
 const char SystemCaches::kMemcachedAsync[] = "memcached_async";
 const char SystemCaches::kMemcachedBlocking[] = "memcached_blocking";
 const char SystemCaches::kRedisAsync[] = "redis_async";
@@ -345,15 +365,10 @@ bool SystemCaches::CreateShmMetadataCache(StringPiece name, int64 size_kb,
   if (result.second) {
     int entries, blocks;
     int64 size_cap;
-    const int kSectors = 128;
-    MetadataShmCache::ComputeDimensions(
-        size_kb, 2 /* block/entry ratio, based empirically off load tests */,
-        kSectors, &entries, &blocks, &size_cap);
-
-    // Make sure the size cap is not unusably low. In particular, with 2K
-    // inlining thresholds, something like 3K is needed. (As of time of writing,
-    // that required about 4.3MiB).
-    if (size_cap < 3 * 1024) {
+    MetadataShmCache::ComputeDimensions(size_kb, kShmCacheBlockEntryRatio,
+                                        kShmCacheSectors, &entries, &blocks,
+                                        &size_cap);
+    if (size_cap < kShmCacheMinSizeCap) {
       metadata_shm_caches_.erase(result.first);
       *error_msg = "Shared memory cache unusably small.";
       return false;
@@ -363,7 +378,8 @@ bool SystemCaches::CreateShmMetadataCache(StringPiece name, int64 size_kb,
       cache_info->segment = StrCat(name, "/metadata_cache");
       cache_info->cache_backend = new SharedMemCache<64>(
           shared_mem_runtime_, cache_info->segment, factory_->timer(),
-          factory_->hasher(), kSectors, entries, /* entries per sector */
+          factory_->hasher(), kShmCacheSectors,
+          entries, /* entries per sector */
           blocks /* blocks per sector*/, factory_->message_handler());
       factory_->TakeOwnership(cache_info->cache_backend);
       // We can't set cache_info->cache_to_use yet since statistics aren't ready
@@ -383,6 +399,34 @@ bool SystemCaches::CreateShmMetadataCache(StringPiece name, int64 size_kb,
   }
 }
 
+bool SystemCaches::ResizeShmMetadataCache(const GoogleString& name,
+                                          int64 size_kb,
+                                          GoogleString* message) {
+  MetadataShmCacheInfo* cache_info = LookupShmMetadataCache(name);
+  if (cache_info == nullptr || cache_info->cache_to_use == nullptr) {
+    *message = StrCat("No shared memory cache named ", name, ".");
+    return false;
+  }
+  int entries, blocks;
+  int64 size_cap;
+  MetadataShmCache::ComputeDimensions(size_kb, kShmCacheBlockEntryRatio,
+                                      kShmCacheSectors, &entries, &blocks,
+                                      &size_cap);
+  if (size_cap < kShmCacheMinSizeCap) {
+    *message = "Shared memory cache unusably small.";
+    return false;
+  }
+  if (!cache_info->cache_backend->Resize(kShmCacheSectors, entries, blocks)) {
+    // The cache logged why.
+    *message = StrCat("Unable to resize shared memory cache ", name,
+                      "; see the error log.");
+    return false;
+  }
+  *message = StrCat("Resized shared memory cache ", name, " to ",
+                    Integer64ToString(size_kb), "KB.");
+  return true;
+}
+
 NamedLockManager* SystemCaches::GetLockManager(SystemRewriteOptions* config) {
   return GetCache(config)->lock_manager();
 }
@@ -512,6 +556,7 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
   // metadata_l2, with metadata_l1 set to NULL.
   CacheInterface* metadata_l1 = nullptr;
   CacheInterface* metadata_l2 = nullptr;
+  bool metadata_l2_in_memory = false;
   size_t l1_size_limit = WriteThroughCache::kUnlimited;
   if (shm_metadata_cache != nullptr) {
     if (external_cache.async != nullptr) {
@@ -557,6 +602,7 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
       metadata_fallback->set_account_for_key_size(false);
       server_context->DeleteCacheOnDestruction(metadata_fallback);
       metadata_l2 = metadata_fallback;
+      metadata_l2_in_memory = true;
 
       // TODO(jmarantz): do we really want to use the shm-cache as a
       // pcache?  The potential for inconsistent data across a
@@ -588,9 +634,31 @@ void SystemCaches::SetupCaches(ServerContext* server_context,
     property_store_cache = metadata_l2;
   }
   if (config->compress_metadata_cache()) {
-    metadata_cache = new CompressedCache(metadata_cache, stats);
+    // Choose each codec by the tier that serves most of its lookups.  Values
+    // held in memory are read far more often than written and cost nothing
+    // to fetch, so compression speed dominates; disk and network tiers are
+    // bounded by I/O, so ratio does.  Either codec reads what the other, or
+    // an older deflate-only server, wrote.
+    CacheCodec::Type metadata_codec =
+        (metadata_l1 != nullptr || metadata_l2_in_memory) ? CacheCodec::kLz
+                                                          : CacheCodec::kBrotli;
+    CacheCodec::Type property_store_codec =
+        (property_store_cache == metadata_l2 && metadata_l2_in_memory)
+            ? CacheCodec::kLz
+            : CacheCodec::kBrotli;
+    CompressedCache* compressed_metadata_cache =
+        new CompressedCache(metadata_cache, metadata_codec,
+                            factory_->thread_system(), stats);
+    int64 dictionary_kb = config->compress_metadata_cache_dictionary_kb();
+    if (dictionary_kb > 0) {
+      compressed_metadata_cache->EnableDictionaryTraining(
+          kDictionaryTrainingSamples, dictionary_kb * 1024);
+    }
+    metadata_cache = compressed_metadata_cache;
     server_context->DeleteCacheOnDestruction(metadata_cache);
-    property_store_cache = new CompressedCache(property_store_cache, stats);
+    property_store_cache =
+        new CompressedCache(property_store_cache, property_store_codec,
+                            factory_->thread_system(), stats);
     server_context->DeleteCacheOnDestruction(property_store_cache);
   }
   DCHECK(property_store_cache->IsBlocking());
@@ -645,6 +713,10 @@ void SystemCaches::RootInit() {
                                 f = path_cache_map_.end();
          q != f; ++q) {
       FileCache* file_cache = q->second->file_cache_backend();
+      // Snapshots are only written to per-file caches.
+      if (file_cache == nullptr) {
+        continue;
+      }
       // It's fine to call RegisterSnapshotFileCache multiple times: it
       // considers all the inputs and picks the best one.
       cache_info->cache_backend->RegisterSnapshotFileCache(
@@ -652,6 +724,19 @@ void SystemCaches::RootInit() {
           global_options->shm_metadata_cache_checkpoint_interval_sec());
     }
 
+    // The popularity sketches are per process; children inherit the setting
+    // across fork and allocate their own in Attach().
+    if (global_options->shm_metadata_cache_admission_policy()) {
+      cache_info->cache_backend->EnableAdmissionPolicy();
+    }
+
+    // The room reserved for resizing is part of the segment layout, so it
+    // must be set up before Initialize; children inherit it across fork.
+    if (global_options->shm_metadata_cache_max_size_kb() > 0) {
+      cache_info->cache_backend->EnableResizing(
+          global_options->shm_metadata_cache_max_size_kb());
+    }
+
     if (cache_info->cache_backend->Initialize()) {
       cache_info->initialized = true;
       cache_info->cache_to_use =
@@ -743,6 +828,7 @@ void SystemCaches::StopCacheActivity() {
 void SystemCaches::InitStats(Statistics* statistics) {
   AprMemCache::InitStats(statistics);
   FileCache::InitStats(statistics);
+  LogStructuredFileCache::InitStats(statistics);
   CacheStats::InitStats(SystemCachePath::kFileCache, statistics);
   CacheStats::InitStats(SystemCachePath::kLruCache, statistics);
   CacheStats::InitStats(kShmCache, statistics);
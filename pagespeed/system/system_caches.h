@@ -116,6 +116,13 @@ class SystemCaches {
   bool CreateShmMetadataCache(StringPiece name, int64 size_kb,
                               GoogleString* error_msg);
 
+  // Resizes the named shared memory metadata cache to size_kb, keeping what
+  // fits of its contents, and sets *message to the outcome.  The cache must
+  // have been initialized with room to grow by ShmMetadataCacheMaxSizeKb.
+  // This blocks while the contents move to the new sectors.
+  bool ResizeShmMetadataCache(const GoogleString& name, int64 size_kb,
+                              GoogleString* message);
+
   // Returns, perhaps creating it, an appropriate named manager for this config
   // (potentially sharing with others as appropriate).
   NamedLockManager* GetLockManager(SystemRewriteOptions* config);
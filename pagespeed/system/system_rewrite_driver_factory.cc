@@ -87,6 +87,7 @@ const char kUsePerVHostStatistics[] = "UsePerVHostStatistics";
 const char kInstallCrashHandler[] = "InstallCrashHandler";
 const char kNumRewriteThreads[] = "NumRewriteThreads";
 const char kNumExpensiveRewriteThreads[] = "NumExpensiveRewriteThreads";
+const char kWorkStealingWorkerPools[] = "WorkStealingWorkerPools";
 const char kForceCaching[] = "ForceCaching";
 const char kListOutstandingUrlsOnError[] = "ListOutstandingUrlsOnError";
 const char kMessageBufferSize[] = "MessageBufferSize";
@@ -113,7 +114,8 @@ SystemRewriteDriverFactory::SystemRewriteDriverFactory(
       install_crash_handler_(false),
       thread_counts_finalized_(false),
       num_rewrite_threads_(-1),
-      num_expensive_rewrite_threads_(-1) {
+      num_expensive_rewrite_threads_(-1),
+      work_stealing_worker_pools_(false) {
   if (shared_mem_runtime == nullptr) {
 #ifdef PAGESPEED_SUPPORT_POSIX_SHARED_MEM
     shared_mem_runtime = new PthreadSharedMem();
@@ -238,15 +240,24 @@ QueuedWorkerPool* SystemRewriteDriverFactory::CreateWorkerPool(
       // In Apache this will effectively be 0, as it doesn't use HTML threads.
       return new QueuedWorkerPool(1, name, thread_system());
     case kRewriteWorkers:
-      return new QueuedWorkerPool(num_rewrite_threads_, name, thread_system());
+      return NewRewriteWorkerPool(num_rewrite_threads_, name);
     case kLowPriorityRewriteWorkers:
-      return new QueuedWorkerPool(num_expensive_rewrite_threads_, name,
-                                  thread_system());
+      return NewRewriteWorkerPool(num_expensive_rewrite_threads_, name);
     default:
       return RewriteDriverFactory::CreateWorkerPool(pool, name);
   }
 }
 
+QueuedWorkerPool* SystemRewriteDriverFactory::NewRewriteWorkerPool(
+    int num_threads, StringPiece name) {
+  QueuedWorkerPool* pool =
+      new QueuedWorkerPool(num_threads, name, thread_system());
+  if (work_stealing_worker_pools_) {
+    pool->EnableWorkStealing();
+  }
+  return pool;
+}
+
 void SystemRewriteDriverFactory::ParentOrChildInit() {
   SharedCircularBufferInit(is_root_process_);
 }
@@ -411,7 +422,8 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
       StringCaseEqual(option, kUsePerVHostStatistics) ||
       StringCaseEqual(option, kInstallCrashHandler) ||
       StringCaseEqual(option, kNumRewriteThreads) ||
-      StringCaseEqual(option, kNumExpensiveRewriteThreads)) {
+      StringCaseEqual(option, kNumExpensiveRewriteThreads) ||
+      StringCaseEqual(option, kWorkStealingWorkerPools)) {
     if (!process_scope) {
       *msg = StrCat("'", option, "' is global and can't be set at this scope.");
       return RewriteOptions::kOptionValueInvalid;
@@ -459,6 +471,9 @@ SystemRewriteDriverFactory::ParseAndSetOption1(StringPiece option,
   } else if (StringCaseEqual(option, kTrackOriginalContentLength)) {
     set_track_original_content_length(is_on);
     return parsed_as_bool;
+  } else if (StringCaseEqual(option, kWorkStealingWorkerPools)) {
+    set_work_stealing_worker_pools(is_on);
+    return parsed_as_bool;
   }
 
   // Others take an integer >= 0.
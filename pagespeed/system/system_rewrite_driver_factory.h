@@ -220,6 +220,14 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   void set_num_expensive_rewrite_threads(int x) {
     num_expensive_rewrite_threads_ = x;
   }
+  // Whether the rewrite worker pools schedule with per-thread deques and
+  // work stealing; see QueuedWorkerPool::EnableWorkStealing.
+  bool work_stealing_worker_pools() const {
+    return work_stealing_worker_pools_;
+  }
+  void set_work_stealing_worker_pools(bool x) {
+    work_stealing_worker_pools_ = x;
+  }
   bool use_per_vhost_statistics() const { return use_per_vhost_statistics_; }
   void set_use_per_vhost_statistics(bool x) { use_per_vhost_statistics_ = x; }
   bool install_crash_handler() const { return install_crash_handler_; }
@@ -331,6 +339,10 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
 
   UrlAsyncFetcher* DefaultAsyncUrlFetcher() override;
 
+  // Creates one of the rewrite worker pools, honoring
+  // work_stealing_worker_pools_.
+  QueuedWorkerPool* NewRewriteWorkerPool(int num_threads, StringPiece name);
+
   std::unique_ptr<SharedMemStatistics> shared_mem_statistics_;
   // While split statistics in the ServerContext cleans up the actual objects,
   // we do the segment cleanup for local stats here.
@@ -393,6 +405,8 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   int num_rewrite_threads_;
   int num_expensive_rewrite_threads_;
 
+  bool work_stealing_worker_pools_;
+
   std::shared_ptr<CentralControllerRpcClient> central_controller_;
 
   DISALLOW_COPY_AND_ASSIGN(SystemRewriteDriverFactory);
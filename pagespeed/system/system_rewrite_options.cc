@@ -94,6 +94,17 @@ void SystemRewriteOptions::AddProperties() {
   AddSystemProperty("", &SystemRewriteOptions::file_cache_path_, "afcp",
                     RewriteOptions::kFileCachePath,
                     "Set the path for file cache", false);
+  AddSystemProperty("files", &SystemRewriteOptions::file_cache_mode_, "afcm",
+                    RewriteOptions::kFileCacheMode,
+                    "How the file cache stores values: 'files' for one file "
+                    "per entry, or 'log' for a log-structured store of large "
+                    "memory-mapped segment files",
+                    false);
+  AddSystemProperty(false, &SystemRewriteOptions::file_cache_io_uring_,
+                    "afciu", RewriteOptions::kFileCacheIoUring,
+                    "Whether the per-file cache should read and write "
+                    "through io_uring, where the kernel supports it",
+                    true);
   AddSystemProperty("", &SystemRewriteOptions::log_dir_, "ald",
                     RewriteOptions::kLogDir, "Directory to store logs in.",
                     false);
@@ -183,6 +194,13 @@ void SystemRewriteOptions::AddProperties() {
                     &SystemRewriteOptions::file_cache_clean_size_kb_, "afc",
                     RewriteOptions::kFileCacheCleanSizeKb,
                     "Set the target size (in kilobytes) for file cache", true);
+  AddSystemProperty(0, &SystemRewriteOptions::file_cache_clean_slice_ms_,
+                    "afccs", RewriteOptions::kFileCacheCleanSliceMs,
+                    "If positive, track the file cache's size as it changes "
+                    "and clean it whenever it is too big, spending at most "
+                    "this many ms at a time; 0 means scanning the whole "
+                    "cache every clean interval",
+                    true);
   // Default to no inode limit so that existing installations are not affected.
   // pagespeed.conf.template contains suggested limit for new installations.
   // TODO(morlovich): Inject this as an argument, since we want a different
@@ -202,6 +220,17 @@ void SystemRewriteOptions::AddProperties() {
                     "Set the total size, in KB, of the per-process in-memory "
                     "LRU cache",
                     true);
+  AddSystemProperty(false, &SystemRewriteOptions::lru_cache_admission_policy_,
+                    "alca", RewriteOptions::kLruCacheAdmissionPolicy,
+                    "Whether the per-process in-memory LRU cache should use "
+                    "a scan-resistant W-TinyLFU admission policy",
+                    true);
+  AddSystemProperty(0, &SystemRewriteOptions::lru_cache_shards_, "alcs",
+                    RewriteOptions::kLruCacheShards,
+                    "Number of independently locked shards to split the "
+                    "per-process in-memory LRU cache into; 0 means a single "
+                    "mutex-protected LRU cache",
+                    true);
   AddSystemProperty("", &SystemRewriteOptions::cache_flush_filename_, "acff",
                     RewriteOptions::kCacheFlushFilename,
                     "Name of file to check for timestamp updates used to flush "
@@ -220,6 +249,12 @@ void SystemRewriteOptions::AddProperties() {
                     "Whether to compress cache entries before writing them to "
                     "memory or disk.",
                     true);
+  AddSystemProperty(
+      0, &SystemRewriteOptions::compress_metadata_cache_dictionary_kb_,
+      "cmcdk", RewriteOptions::kCompressMetadataCacheDictionaryKb,
+      "Size of the dictionary to train from the first metadata cache entries "
+      "written, for codecs that support one.  0 disables dictionaries.",
+      true);
   AddSystemProperty(
       "enable", &SystemRewriteOptions::https_options_, "fhs", kFetchHttps,
       "Controls direct fetching of HTTPS resources."
@@ -308,6 +343,19 @@ void SystemRewriteOptions::AddProperties() {
       "How often to checkpoint the shared memory metadata cache "
       "to disk.  Set to 0 to turn off checkpointing.",
       true);
+  AddSystemProperty(
+      false, &SystemRewriteOptions::shm_metadata_cache_admission_policy_,
+      "smca", "ShmMetadataCacheAdmissionPolicy", kProcessScopeStrict,
+      "Whether shared memory metadata caches should only replace an entry "
+      "with a key that has been used at least as often recently",
+      true);
+  AddSystemProperty(
+      0, &SystemRewriteOptions::shm_metadata_cache_max_size_kb_, "smcm",
+      "ShmMetadataCacheMaxSizeKb", kProcessScopeStrict,
+      "Largest size, in kilobytes, shared memory metadata caches may be "
+      "resized to from the admin pages while running.  Twice this much "
+      "address space is reserved.  Set to 0 to turn off resizing.",
+      true);
   AddSystemProperty("", &SystemRewriteOptions::purge_method_, "pm",
                     "PurgeMethod", kServerScope,
                     "HTTP method used for Cache Purge requests. Typically "
@@ -91,6 +91,15 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_file_cache_clean_size_kb(int64 x) {
     set_option(x, &file_cache_clean_size_kb_);
   }
+  int64 file_cache_clean_slice_ms() const {
+    return file_cache_clean_slice_ms_.value();
+  }
+  bool has_file_cache_clean_slice_ms() const {
+    return file_cache_clean_slice_ms_.was_set();
+  }
+  void set_file_cache_clean_slice_ms(int64 x) {
+    set_option(x, &file_cache_clean_slice_ms_);
+  }
   int64 file_cache_clean_inode_limit() const {
     return file_cache_clean_inode_limit_.value();
   }
@@ -110,6 +119,14 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_lru_cache_kb_per_process(int64 x) {
     set_option(x, &lru_cache_kb_per_process_);
   }
+  bool lru_cache_admission_policy() const {
+    return lru_cache_admission_policy_.value();
+  }
+  void set_lru_cache_admission_policy(bool x) {
+    set_option(x, &lru_cache_admission_policy_);
+  }
+  int lru_cache_shards() const { return lru_cache_shards_.value(); }
+  void set_lru_cache_shards(int x) { set_option(x, &lru_cache_shards_); }
   bool use_shared_mem_locking() const {
     return use_shared_mem_locking_.value();
   }
@@ -122,6 +139,12 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_compress_metadata_cache(bool x) {
     set_option(x, &compress_metadata_cache_);
   }
+  int64 compress_metadata_cache_dictionary_kb() const {
+    return compress_metadata_cache_dictionary_kb_.value();
+  }
+  void set_compress_metadata_cache_dictionary_kb(int64 x) {
+    set_option(x, &compress_metadata_cache_dictionary_kb_);
+  }
   bool statistics_enabled() const { return statistics_enabled_.value(); }
   void set_statistics_enabled(bool x) { set_option(x, &statistics_enabled_); }
   bool statistics_logging_enabled() const {
@@ -151,6 +174,16 @@ class SystemRewriteOptions : public RewriteOptions {
   void set_file_cache_path(const GoogleString& x) {
     set_option(x, &file_cache_path_);
   }
+  const GoogleString& file_cache_mode() const {
+    return file_cache_mode_.value();
+  }
+  void set_file_cache_mode(const GoogleString& x) {
+    set_option(x, &file_cache_mode_);
+  }
+  bool file_cache_io_uring() const { return file_cache_io_uring_.value(); }
+  void set_file_cache_io_uring(bool x) {
+    set_option(x, &file_cache_io_uring_);
+  }
   const GoogleString& log_dir() const { return log_dir_.value(); }
   void set_log_dir(const GoogleString& x) { set_option(x, &log_dir_); }
   const ExternalClusterSpec& memcached_servers() const {
@@ -258,6 +291,18 @@ class SystemRewriteOptions : public RewriteOptions {
   int shm_metadata_cache_checkpoint_interval_sec() const {
     return shm_metadata_cache_checkpoint_interval_sec_.value();
   }
+  bool shm_metadata_cache_admission_policy() const {
+    return shm_metadata_cache_admission_policy_.value();
+  }
+  void set_shm_metadata_cache_admission_policy(bool x) {
+    set_option(x, &shm_metadata_cache_admission_policy_);
+  }
+  int64 shm_metadata_cache_max_size_kb() const {
+    return shm_metadata_cache_max_size_kb_.value();
+  }
+  void set_shm_metadata_cache_max_size_kb(int64 x) {
+    set_option(x, &shm_metadata_cache_max_size_kb_);
+  }
   void set_purge_method(const GoogleString& x) {
     set_option(x, &purge_method_);
   }
@@ -423,6 +468,7 @@ class SystemRewriteOptions : public RewriteOptions {
 
   Option<GoogleString> fetcher_proxy_;
   Option<GoogleString> file_cache_path_;
+  Option<GoogleString> file_cache_mode_;
   Option<GoogleString> log_dir_;
 
   ExternalServersOption<ExternalClusterSpec, kMemcachedDefaultPort>
@@ -441,7 +487,10 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<bool> statistics_enabled_;
   Option<bool> statistics_logging_enabled_;
   Option<bool> use_shared_mem_locking_;
+  Option<bool> lru_cache_admission_policy_;
+  Option<bool> file_cache_io_uring_;
   Option<bool> compress_metadata_cache_;
+  Option<int64> compress_metadata_cache_dictionary_kb_;
 
   Option<bool> slurp_read_only_;
   Option<bool> test_proxy_;
@@ -471,8 +520,10 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<int64> file_cache_clean_inode_limit_;
   Option<int64> file_cache_clean_interval_ms_;
   Option<int64> file_cache_clean_size_kb_;
+  Option<int64> file_cache_clean_slice_ms_;
   Option<int64> lru_cache_byte_limit_;
   Option<int64> lru_cache_kb_per_process_;
+  Option<int> lru_cache_shards_;
   Option<int64> statistics_logging_interval_ms_;
   // If cache_flush_poll_interval_sec_<=0 then we turn off polling for
   // cache-flushes.
@@ -483,6 +534,8 @@ class SystemRewriteOptions : public RewriteOptions {
   Option<int64> ipro_max_concurrent_recordings_;
   Option<int64> default_shared_memory_cache_kb_;
   Option<int> shm_metadata_cache_checkpoint_interval_sec_;
+  Option<bool> shm_metadata_cache_admission_policy_;
+  Option<int64> shm_metadata_cache_max_size_kb_;
   Option<GoogleString> purge_method_;
 
   StaticAssetCDNOptions static_assets_to_cdn_;
@@ -156,7 +156,8 @@ void SystemServerContext::CheckLegacyGlobalCacheFlushFile() {
         if (flushed && (timestamp_ms !=
                         cache_flush_timestamp_ms_->SetReturningPreviousValue(
                             timestamp_ms))) {
-          int count = cache_flush_count_->Add(1);
+          cache_flush_count_->Add(1);
+          int count = cache_flush_count_->Get();
           message_handler()->Message(kWarning, "Cache Flush %d", count);
         }
       }
@@ -21,14 +21,17 @@
 
 #include <cstddef>
 #include <memory>
+#include <vector>
 
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/counting_url_async_fetcher.h"
+#include "net/instaweb/http/public/fetch_coalescer.h"
 #include "net/instaweb/http/public/http_cache.h"
 #include "net/instaweb/http/public/http_cache_failure.h"
 #include "net/instaweb/http/public/http_value.h"
 #include "net/instaweb/http/public/logging_proto_impl.h"
 #include "net/instaweb/http/public/request_context.h"
+#include "net/instaweb/http/public/wait_url_async_fetcher.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"  // for ScopedMutex
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -46,6 +49,7 @@
 #include "pagespeed/kernel/http/request_headers.h"
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/thread/sequence.h"
 #include "pagespeed/kernel/thread/thread_synchronizer.h"
 #include "pagespeed/kernel/util/file_system_lock_manager.h"
 #include "pagespeed/kernel/util/platform.h"
@@ -126,6 +130,38 @@ class MockFetch : public AsyncFetch {
   DISALLOW_COPY_AND_ASSIGN(MockFetch);
 };
 
+// Holds the functions added to it until the test runs or cancels them.
+class DeferredSequence : public Sequence {
+ public:
+  DeferredSequence() {}
+  ~DeferredSequence() override { EXPECT_TRUE(functions_.empty()); }
+
+  void Add(Function* function) override { functions_.push_back(function); }
+
+  int size() const { return functions_.size(); }
+
+  void RunAll() {
+    std::vector<Function*> functions;
+    functions.swap(functions_);
+    for (Function* function : functions) {
+      function->CallRun();
+    }
+  }
+
+  void CancelAll() {
+    std::vector<Function*> functions;
+    functions.swap(functions_);
+    for (Function* function : functions) {
+      function->CallCancel();
+    }
+  }
+
+ private:
+  std::vector<Function*> functions_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeferredSequence);
+};
+
 class MockCacheUrlAsyncFetcherAsyncOpHooks
     : public CacheUrlAsyncFetcher::AsyncOpHooks {
  public:
@@ -828,6 +864,111 @@ TEST_F(CacheUrlAsyncFetcherTest, ServeStaleContentWhileRevalidate) {
       0, cache_fetcher_->fallback_responses_served_while_revalidate()->Get());
 }
 
+TEST_F(CacheUrlAsyncFetcherTest, ServeStaleWithinOriginStaleWhileRevalidate) {
+  // No threshold is configured; the origin's own stale-while-revalidate
+  // opens the window.
+  const char url[] = "http://www.example.com/swr.css";
+  ResponseHeaders response_headers;
+  SetDefaultHeaders(kContentTypeCss, &response_headers);
+  response_headers.SetDate(timer_.NowMs());
+  response_headers.Replace(HttpAttributes::kCacheControl,
+                           "max-age=300, stale-while-revalidate=3600");
+  response_headers.ComputeCaching();
+  mock_fetcher_.SetResponse(url, response_headers, cache_body_);
+  ExpectCache(url, cache_body_);
+
+  timer_.AdvanceMs(5 * Timer::kMinuteMs + 30 * Timer::kMinuteMs);
+  ClearStats();
+  FetchAndValidate(url, empty_request_headers_, true, HttpStatus::kOK,
+                   cache_body_, kServeStaleContentWhileRevalidate, true);
+  EXPECT_EQ(1, http_cache_->cache_expirations()->Get());
+  // The background fetch refreshed the cache.
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(1, http_cache_->cache_inserts()->Get());
+  EXPECT_EQ(
+      1, cache_fetcher_->fallback_responses_served_while_revalidate()->Get());
+
+  // Past the end of the window the fetch waits for the origin.
+  timer_.AdvanceMs(5 * Timer::kMinuteMs + 2 * Timer::kHourMs);
+  ClearStats();
+  FetchAndValidate(url, empty_request_headers_, true, HttpStatus::kOK,
+                   cache_body_, kBackendFetch, true);
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(
+      0, cache_fetcher_->fallback_responses_served_while_revalidate()->Get());
+}
+
+TEST_F(CacheUrlAsyncFetcherTest, StaleWhileRevalidateRefreshesOnSequence) {
+  DeferredSequence sequence;
+  cache_fetcher_->set_background_refresh_sequence(&sequence);
+  cache_fetcher_->set_serve_stale_while_revalidate_threshold_sec(
+      Timer::kDayMs / Timer::kSecondMs);
+  ExpectCache(cache_css_url_, cache_body_);
+
+  // The stale value is served without waiting for the origin; the refresh
+  // only starts when the sequence runs it, after the lookup that queued it
+  // has been deleted.
+  timer_.AdvanceMs(ttl_ms_ + Timer::kHourMs);
+  ClearStats();
+  FetchAndValidate(cache_css_url_, empty_request_headers_, true,
+                   HttpStatus::kOK, cache_body_,
+                   kServeStaleContentWhileRevalidate, true);
+  EXPECT_EQ(1, sequence.size());
+  EXPECT_EQ(0, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, http_cache_->cache_inserts()->Get());
+
+  sequence.RunAll();
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(1, http_cache_->cache_inserts()->Get());
+
+  ClearStats();
+  ExpectServedFromCache(cache_css_url_, cache_body_);
+
+  // A refresh the sequence sheds is dropped, and the next request past
+  // expiry queues another.
+  timer_.AdvanceMs(ttl_ms_ + Timer::kHourMs);
+  ClearStats();
+  FetchAndValidate(cache_css_url_, empty_request_headers_, true,
+                   HttpStatus::kOK, cache_body_,
+                   kServeStaleContentWhileRevalidate, true);
+  EXPECT_EQ(1, sequence.size());
+  sequence.CancelAll();
+  EXPECT_EQ(0, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, http_cache_->cache_inserts()->Get());
+
+  FetchAndValidate(cache_css_url_, empty_request_headers_, true,
+                   HttpStatus::kOK, cache_body_,
+                   kServeStaleContentWhileRevalidate, true);
+  EXPECT_EQ(1, sequence.size());
+  sequence.RunAll();
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(1, http_cache_->cache_inserts()->Get());
+}
+
+TEST_F(CacheUrlAsyncFetcherTest, NoServeStaleWhenRevalidationRequired) {
+  // must-revalidate forbids stale serving even inside a configured window.
+  cache_fetcher_->set_serve_stale_while_revalidate_threshold_sec(
+      Timer::kDayMs / Timer::kSecondMs);
+  const char url[] = "http://www.example.com/revalidate.css";
+  ResponseHeaders response_headers;
+  SetDefaultHeaders(kContentTypeCss, &response_headers);
+  response_headers.SetDate(timer_.NowMs());
+  response_headers.Replace(
+      HttpAttributes::kCacheControl,
+      "max-age=300, must-revalidate, stale-while-revalidate=3600");
+  response_headers.ComputeCaching();
+  mock_fetcher_.SetResponse(url, response_headers, cache_body_);
+  ExpectCache(url, cache_body_);
+
+  timer_.AdvanceMs(10 * Timer::kMinuteMs);
+  ClearStats();
+  FetchAndValidate(url, empty_request_headers_, true, HttpStatus::kOK,
+                   cache_body_, kBackendFetch, true);
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(
+      0, cache_fetcher_->fallback_responses_served_while_revalidate()->Get());
+}
+
 TEST_F(CacheUrlAsyncFetcherTest, CachingWithHttpsHtmlCachingEnabled) {
   // With caching of html on https enabled, both html and css hosted on https
   // get cached.
@@ -1752,6 +1893,56 @@ TEST_F(CacheUrlAsyncFetcherTest, TestParallelBackgroundFreshenCalls) {
   EXPECT_EQ(0, cache_fetcher_->fallback_responses_served()->Get());
 }
 
+TEST_F(CacheUrlAsyncFetcherTest, ConcurrentMissesShareOriginFetch) {
+  WaitUrlAsyncFetcher wait_fetcher(&counting_fetcher_,
+                                   thread_system_->NewMutex());
+  FetchCoalescer coalescer(thread_system_.get());
+  CacheUrlAsyncFetcher fetcher(&mock_hasher_, &lock_manager_, http_cache_.get(),
+                               fragment_, &mock_async_op_hooks_, &wait_fetcher);
+  fetcher.set_fetch_coalescer(&coalescer);
+  Variable* num_coalesced_fetches =
+      statistics_.AddVariable("num_coalesced_fetches");
+  fetcher.set_num_coalesced_fetches(num_coalesced_fetches);
+  ClearStats();
+
+  StringAsyncFetch first(
+      RequestContext::NewTestRequestContext(thread_system_.get()));
+  StringAsyncFetch second(
+      RequestContext::NewTestRequestContext(thread_system_.get()));
+  fetcher.Fetch(cache_css_url_, &handler_, &first);
+  fetcher.Fetch(cache_css_url_, &handler_, &second);
+  EXPECT_EQ(2, http_cache_->cache_misses()->Get());
+  EXPECT_EQ(1, num_coalesced_fetches->Get());
+  EXPECT_FALSE(second.done());
+
+  wait_fetcher.CallCallbacks();
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(1, http_cache_->cache_inserts()->Get());
+  for (StringAsyncFetch* fetch : {&first, &second}) {
+    EXPECT_TRUE(fetch->done());
+    EXPECT_TRUE(fetch->success());
+    EXPECT_EQ(HttpStatus::kOK, fetch->response_headers()->status_code());
+    EXPECT_EQ(cache_body_, fetch->buffer());
+  }
+  EXPECT_EQ(0, coalescer.NumFlights());
+
+  // A conditional request goes to the origin on its own.
+  ClearStats();
+  http_cache_->Delete(cache_css_url_, fragment_);
+  StringAsyncFetch conditional(
+      RequestContext::NewTestRequestContext(thread_system_.get()));
+  conditional.request_headers()->Add(HttpAttributes::kIfNoneMatch, etag_);
+  StringAsyncFetch plain(
+      RequestContext::NewTestRequestContext(thread_system_.get()));
+  fetcher.Fetch(cache_css_url_, &handler_, &plain);
+  fetcher.Fetch(cache_css_url_, &handler_, &conditional);
+  wait_fetcher.CallCallbacks();
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, num_coalesced_fetches->Get());
+  EXPECT_TRUE(plain.done());
+  EXPECT_TRUE(conditional.done());
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
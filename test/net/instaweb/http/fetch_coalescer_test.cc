@@ -0,0 +1,316 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "net/instaweb/http/public/fetch_coalescer.h"
+
+#include <memory>
+#include <vector>
+
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/request_context.h"
+#include "net/instaweb/http/public/url_async_fetcher.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/http_options.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/base/mock_message_handler.h"
+
+namespace net_instaweb {
+namespace {
+
+const char kKey[] = "http://www.example.com/a.css";
+
+// Answers each fetch straight away with a body naming the User-Agent it was
+// sent.
+class EchoUserAgentFetcher : public UrlAsyncFetcher {
+ public:
+  EchoUserAgentFetcher() : num_fetches_(0) {}
+
+  void Fetch(const GoogleString& url, MessageHandler* handler,
+             AsyncFetch* fetch) override {
+    ++num_fetches_;
+    fetch->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+    fetch->response_headers()->Add(HttpAttributes::kVary,
+                                   HttpAttributes::kUserAgent);
+    const char* user_agent =
+        fetch->request_headers()->Lookup1(HttpAttributes::kUserAgent);
+    fetch->Write(user_agent == nullptr ? "" : user_agent, handler);
+    fetch->Done(true);
+  }
+
+  int num_fetches() const { return num_fetches_; }
+
+ private:
+  int num_fetches_;
+};
+
+class FetchCoalescerTest : public testing::Test {
+ protected:
+  FetchCoalescerTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        request_context_(new RequestContext(kDefaultHttpOptionsForTests,
+                                            new NullMutex, nullptr)),
+        coalescer_(thread_system_.get()),
+        handler_(new NullMutex) {}
+
+  StringAsyncFetch* NewFetch() {
+    fetches_.emplace_back(new StringAsyncFetch(request_context_));
+    return fetches_.back().get();
+  }
+
+  // Joins the flight for kKey, as if fetching kKey through fetcher_.
+  AsyncFetch* Join(AsyncFetch* fetch) {
+    return coalescer_.Join(kKey, kKey, &fetcher_, fetch, &handler_);
+  }
+
+  // Starts the origin response on leader.
+  void SendHeaders(AsyncFetch* leader) {
+    leader->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+    leader->response_headers()->Add(HttpAttributes::kContentType, "text/css");
+    leader->HeadersComplete();
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  RequestContextPtr request_context_;
+  FetchCoalescer coalescer_;
+  EchoUserAgentFetcher fetcher_;
+  MockMessageHandler handler_;
+  std::vector<std::unique_ptr<StringAsyncFetch>> fetches_;
+};
+
+TEST_F(FetchCoalescerTest, FollowersShareLeaderResponse) {
+  StringAsyncFetch* first = NewFetch();
+  StringAsyncFetch* second = NewFetch();
+  AsyncFetch* leader = Join(first);
+  ASSERT_TRUE(leader != nullptr);
+  EXPECT_TRUE(Join(second) == nullptr);
+  EXPECT_EQ(1, coalescer_.NumFlights());
+
+  SendHeaders(leader);
+  leader->Write("a{}", &handler_);
+  leader->Write("b{}", &handler_);
+  leader->Done(true);
+  EXPECT_EQ(0, coalescer_.NumFlights());
+
+  for (StringAsyncFetch* fetch : {first, second}) {
+    EXPECT_TRUE(fetch->done());
+    EXPECT_TRUE(fetch->success());
+    EXPECT_EQ(HttpStatus::kOK, fetch->response_headers()->status_code());
+    EXPECT_STREQ("text/css", fetch->response_headers()->Lookup1(
+                                 HttpAttributes::kContentType));
+    EXPECT_EQ("a{}b{}", fetch->buffer());
+  }
+}
+
+TEST_F(FetchCoalescerTest, LateFollowerGetsPartialBodyReplayed) {
+  StringAsyncFetch* first = NewFetch();
+  AsyncFetch* leader = Join(first);
+  ASSERT_TRUE(leader != nullptr);
+  SendHeaders(leader);
+  leader->Write("a{}", &handler_);
+
+  // Joins part way through the body, and is caught up with the headers and
+  // the body so far at the leader's next write.
+  StringAsyncFetch* late = NewFetch();
+  EXPECT_TRUE(Join(late) == nullptr);
+  EXPECT_FALSE(late->headers_complete());
+  leader->Write("b{}", &handler_);
+  EXPECT_TRUE(late->headers_complete());
+  EXPECT_EQ("a{}b{}", late->buffer());
+
+  // Joins after the last write, and is caught up on completion.
+  StringAsyncFetch* later = NewFetch();
+  EXPECT_TRUE(Join(later) == nullptr);
+  leader->Done(true);
+  EXPECT_TRUE(later->done());
+  EXPECT_EQ(HttpStatus::kOK, later->response_headers()->status_code());
+  EXPECT_EQ("a{}b{}", later->buffer());
+  EXPECT_EQ("a{}b{}", first->buffer());
+}
+
+TEST_F(FetchCoalescerTest, FailurePropagates) {
+  StringAsyncFetch* first = NewFetch();
+  StringAsyncFetch* second = NewFetch();
+  AsyncFetch* leader = Join(first);
+  ASSERT_TRUE(leader != nullptr);
+  EXPECT_TRUE(Join(second) == nullptr);
+  leader->Done(false);
+  EXPECT_TRUE(second->done());
+  EXPECT_FALSE(second->success());
+  EXPECT_EQ(HttpStatus::kNotFound, second->response_headers()->status_code());
+}
+
+TEST_F(FetchCoalescerTest, NewFlightAfterCompletion) {
+  AsyncFetch* leader = Join(NewFetch());
+  ASSERT_TRUE(leader != nullptr);
+  SendHeaders(leader);
+  leader->Done(true);
+  AsyncFetch* next = Join(NewFetch());
+  ASSERT_TRUE(next != nullptr);
+  next->Done(false);
+}
+
+TEST_F(FetchCoalescerTest, DistinctKeysDoNotCoalesce) {
+  AsyncFetch* a = Join(NewFetch());
+  AsyncFetch* b = coalescer_.Join("http://www.example.com/b.css",
+                                  "http://www.example.com/b.css", &fetcher_,
+                                  NewFetch(), &handler_);
+  ASSERT_TRUE(a != nullptr);
+  ASSERT_TRUE(b != nullptr);
+  EXPECT_EQ(2, coalescer_.NumFlights());
+  a->Done(false);
+  b->Done(false);
+}
+
+TEST_F(FetchCoalescerTest, LargeResponseStopsTakingFollowers) {
+  coalescer_.set_max_replay_bytes(4);
+  StringAsyncFetch* first = NewFetch();
+  StringAsyncFetch* second = NewFetch();
+  AsyncFetch* leader = Join(first);
+  ASSERT_TRUE(leader != nullptr);
+  EXPECT_TRUE(Join(second) == nullptr);
+  SendHeaders(leader);
+  leader->Write("a{}", &handler_);
+  leader->Write("b{}", &handler_);
+
+  // The body no longer fits in the replay buffer, so this starts its own
+  // flight, while the existing follower keeps streaming.
+  StringAsyncFetch* third = NewFetch();
+  AsyncFetch* next = Join(third);
+  ASSERT_TRUE(next != nullptr);
+  leader->Write("c{}", &handler_);
+  leader->Done(true);
+  EXPECT_EQ("a{}b{}c{}", second->buffer());
+  EXPECT_FALSE(third->done());
+
+  // The old leader must not have unregistered the new flight.
+  EXPECT_EQ(1, coalescer_.NumFlights());
+  next->Done(false);
+  EXPECT_EQ(0, coalescer_.NumFlights());
+}
+
+// A response that varies on headers the key doesn't cover isn't shared.
+TEST_F(FetchCoalescerTest, UnshareableResponseRefetchesFollowers) {
+  StringAsyncFetch* first = NewFetch();
+  StringAsyncFetch* second = NewFetch();
+  first->request_headers()->Add(HttpAttributes::kUserAgent, "first");
+  second->request_headers()->Add(HttpAttributes::kUserAgent, "second");
+  AsyncFetch* leader = Join(first);
+  ASSERT_TRUE(leader != nullptr);
+  EXPECT_TRUE(Join(second) ==
+              nullptr);
+
+  leader->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+  leader->response_headers()->Add(HttpAttributes::kVary, "Accept-Encoding");
+  leader->response_headers()->Add(HttpAttributes::kVary, "User-Agent");
+  leader->HeadersComplete();
+  EXPECT_EQ(1, fetcher_.num_fetches());
+  EXPECT_TRUE(second->done());
+  EXPECT_EQ("second", second->buffer());
+
+  // Nobody else can join it either.
+  StringAsyncFetch* third = NewFetch();
+  AsyncFetch* next = Join(third);
+  ASSERT_TRUE(next != nullptr);
+
+  leader->Write("first", &handler_);
+  leader->Done(true);
+  EXPECT_EQ("first", first->buffer());
+  EXPECT_EQ(1, coalescer_.NumFlights());
+  next->Done(false);
+
+  // A session cookie set for the leader must not reach a follower.
+  StringAsyncFetch* fourth = NewFetch();
+  StringAsyncFetch* fifth = NewFetch();
+  fifth->request_headers()->Add(HttpAttributes::kUserAgent, "fifth");
+  leader = Join(fourth);
+  ASSERT_TRUE(leader != nullptr);
+  EXPECT_TRUE(Join(fifth) == nullptr);
+  leader->response_headers()->SetStatusAndReason(HttpStatus::kOK);
+  leader->response_headers()->Add(HttpAttributes::kSetCookie, "session=4");
+  leader->HeadersComplete();
+  EXPECT_EQ(2, fetcher_.num_fetches());
+  EXPECT_TRUE(fifth->done());
+  EXPECT_EQ("fifth", fifth->buffer());
+  EXPECT_FALSE(fifth->response_headers()->Has(HttpAttributes::kSetCookie));
+  leader->Write("fourth", &handler_);
+  leader->Done(true);
+  EXPECT_EQ("fourth", fourth->buffer());
+}
+
+TEST_F(FetchCoalescerTest, IsShareable) {
+  ResponseHeaders headers;
+  EXPECT_TRUE(FetchCoalescer::IsShareable(headers));
+  headers.Add(HttpAttributes::kVary, "accept-encoding, Cookie");
+  EXPECT_TRUE(FetchCoalescer::IsShareable(headers));
+  headers.Add(HttpAttributes::kVary, "Accept");
+  EXPECT_FALSE(FetchCoalescer::IsShareable(headers));
+  headers.Replace(HttpAttributes::kVary, "*");
+  EXPECT_FALSE(FetchCoalescer::IsShareable(headers));
+
+  headers.RemoveAll(HttpAttributes::kVary);
+  headers.Add(HttpAttributes::kCacheControl, "max-age=60, no-cache");
+  EXPECT_TRUE(FetchCoalescer::IsShareable(headers));
+  headers.Replace(HttpAttributes::kCacheControl, "max-age=60, Private");
+  EXPECT_FALSE(FetchCoalescer::IsShareable(headers));
+  headers.Replace(HttpAttributes::kCacheControl, "private=\"Set-Cookie\"");
+  EXPECT_FALSE(FetchCoalescer::IsShareable(headers));
+  headers.Replace(HttpAttributes::kCacheControl, "no-store");
+  EXPECT_FALSE(FetchCoalescer::IsShareable(headers));
+  headers.RemoveAll(HttpAttributes::kCacheControl);
+  headers.Add(HttpAttributes::kSetCookie, "session=1");
+  EXPECT_FALSE(FetchCoalescer::IsShareable(headers));
+  headers.RemoveAll(HttpAttributes::kSetCookie);
+  headers.Add(HttpAttributes::kSetCookie2, "session=1");
+  EXPECT_FALSE(FetchCoalescer::IsShareable(headers));
+}
+
+TEST_F(FetchCoalescerTest, CoalescingKey) {
+  RequestHeaders request;
+  request.set_method(RequestHeaders::kGet);
+  request.Add(HttpAttributes::kAcceptEncoding, "gzip");
+  GoogleString gzip_key = FetchCoalescer::CoalescingKey(kKey, request);
+  EXPECT_FALSE(gzip_key.empty());
+
+  RequestHeaders identity;
+  identity.set_method(RequestHeaders::kGet);
+  EXPECT_NE(gzip_key, FetchCoalescer::CoalescingKey(kKey, identity));
+
+  RequestHeaders head;
+  head.set_method(RequestHeaders::kHead);
+  EXPECT_EQ("", FetchCoalescer::CoalescingKey(kKey, head));
+
+  for (const char* name :
+       {HttpAttributes::kIfNoneMatch, HttpAttributes::kIfModifiedSince,
+        HttpAttributes::kRange, HttpAttributes::kAuthorization,
+        HttpAttributes::kCookie}) {
+    RequestHeaders uncoalesced;
+    uncoalesced.set_method(RequestHeaders::kGet);
+    uncoalesced.Add(name, "x");
+    EXPECT_EQ("", FetchCoalescer::CoalescingKey(kKey, uncoalesced)) << name;
+  }
+}
+
+}  // namespace
+}  // namespace net_instaweb
@@ -315,6 +315,22 @@ TEST_F(HTTPCacheTest, PutGet) {
   EXPECT_EQ(0, GetStat(HTTPCache::kCacheFallbacks));
 }
 
+// What HTTPCache puts keeps its headers decoded, so a hit in the in-memory
+// cache doesn't parse them, and the cache is charged for them.
+TEST_F(HTTPCacheTest, PutSharesDecodedHeaders) {
+  ResponseHeaders meta_data_in, meta_data_out;
+  InitHeaders(&meta_data_in, "max-age=300");
+  Put(kUrl, kFragment, &meta_data_in, "content");
+  HTTPValue value;
+  ASSERT_EQ(kFoundResult, Find(kUrl, kFragment, &value, &meta_data_out));
+  const SharedString& storage = value.share();
+  ASSERT_TRUE(storage.annotation() != nullptr);
+  EXPECT_LT(static_cast<size_t>(storage.size()),
+            storage.SizeIncludingAnnotation());
+  EXPECT_LT(storage.SizeIncludingAnnotation(), lru_cache_.size_bytes());
+  EXPECT_STREQ("value", meta_data_out.Lookup1("name"));
+}
+
 TEST_F(HTTPCacheTest, PutGetCompressed) {
   // Check to see that when compression is on, data put into the cache is
   // properly compressed, and can be retrieved if the callback accepts gzipped
@@ -172,6 +172,61 @@ TEST_F(HTTPValueTest, TestShare) {
   }
 }
 
+TEST_F(HTTPValueTest, LinkSharesDecodedHeaders) {
+  HTTPValue value;
+  ResponseHeaders headers;
+  FillResponseHeaders(&headers);
+  value.SetHeaders(&headers);
+  value.Write("bo", &message_handler_);
+  value.Write("dy", &message_handler_);
+  EXPECT_TRUE(value.share().annotation() == nullptr);
+  value.ShareDecodedHeaders(headers);
+  SharedString storage(value.share());
+  EXPECT_TRUE(storage.annotation() != nullptr);
+  EXPECT_LT(storage.size(), storage.SizeIncludingAnnotation());
+
+  // Once the storage is shared, adding the annotation could race with
+  // readers, so it is left alone.
+  HTTPValue shared;
+  shared.SetHeaders(&headers);
+  SharedString reader(shared.share());
+  shared.ShareDecodedHeaders(headers);
+  EXPECT_TRUE(reader.annotation() == nullptr);
+
+  // Linking to the same storage, as an in-memory cache hit does, picks up
+  // the decoded headers; a copy of the bytes has to parse them.  Both must
+  // produce the same headers.
+  SharedString copy(storage.Value());
+  EXPECT_TRUE(copy.annotation() == nullptr);
+  for (const SharedString* src : {&storage, &copy}) {
+    HTTPValue linked;
+    ResponseHeaders check_headers;
+    ASSERT_TRUE(linked.Link(*src, &check_headers, &message_handler_));
+    CheckResponseHeaders(check_headers);
+    EXPECT_FALSE(check_headers.cache_fields_dirty());
+    StringPiece body;
+    ASSERT_TRUE(linked.ExtractContents(&body));
+    EXPECT_EQ("body", body);
+  }
+}
+
+TEST_F(HTTPValueTest, ExtractContentsSharesStorage) {
+  SharedString contents;
+  {
+    HTTPValue value;
+    ResponseHeaders headers;
+    FillResponseHeaders(&headers);
+    value.SetHeaders(&headers);
+    value.Write("body", &message_handler_);
+    ASSERT_TRUE(value.ExtractContents(&contents));
+    EXPECT_TRUE(contents.SharesStorage(value.share()));
+  }
+  EXPECT_EQ("body", contents.Value());
+
+  HTTPValue empty;
+  EXPECT_FALSE(empty.ExtractContents(&contents));
+}
+
 TEST_F(HTTPValueTest, LinkEmpty) {
   SharedString storage;
   HTTPValue value;
@@ -62,6 +62,7 @@
 #include "pagespeed/kernel/http/http_options.h"
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/http/semantic_type.h"
+#include "pagespeed/kernel/image/avif_optimizer.h"
 #include "pagespeed/opt/logging/enums.pb.h"
 #include "pagespeed/opt/logging/log_record.h"
 #include "test/net/instaweb/http/log_record_test_helper.h"
@@ -81,6 +82,7 @@
 namespace net_instaweb {
 
 using net_instaweb::ImageRewriteFilter;
+using pagespeed::image_compression::AvifFrameWriter;
 using pagespeed::image_compression::kMessagePatternPixelFormat;
 using pagespeed::image_compression::kMessagePatternStats;
 using pagespeed::image_compression::kMessagePatternWritingToWebp;
@@ -1254,6 +1256,37 @@ class ImageRewriteTest : public RewriteTestBase {
     }
   }
 
+  // Rewrites an image that is over the resolution limit into a tag asking
+  // for a 400x200 image, which does fit in it.
+  void TestResizeOverResolutionLimit(const char* image_file,
+                                     const ContentType& content_type,
+                                     bool expect_rewritten) {
+    options()->set_image_resolution_limit_bytes(kResolutionLimitBytes - 1);
+    options()->EnableFilter(RewriteOptions::kRecompressPng);
+    options()->EnableFilter(RewriteOptions::kRecompressJpeg);
+    options()->EnableFilter(RewriteOptions::kResizeImages);
+    rewrite_driver()->AddFilters();
+
+    const char kDimension[] = " width=400 height=200";
+    TestSingleRewrite(image_file, content_type, content_type, kDimension,
+                      kDimension, expect_rewritten, false);
+
+    EXPECT_EQ(expect_rewritten ? 1 : 0,
+              statistics()
+                  ->GetVariable(ImageRewriteFilter::kImageRewrites)
+                  ->Get());
+    EXPECT_EQ(expect_rewritten ? 1 : 0,
+              statistics()
+                  ->GetVariable(
+                      ImageRewriteFilter::kImageResizedInBandsHighResolution)
+                  ->Get());
+    EXPECT_EQ(expect_rewritten ? 0 : 1,
+              statistics()
+                  ->GetVariable(
+                      ImageRewriteFilter::kImageNoRewritesHighResolution)
+                  ->Get());
+  }
+
   void ResetUserAgent(StringPiece user_agent) {
     ClearRewriteDriver();
     SetCurrentUserAgent(user_agent);
@@ -1266,6 +1299,13 @@ class ImageRewriteTest : public RewriteTestBase {
     SetDriverRequestHeaders();
   }
 
+  void ResetForAvif() {
+    ClearRewriteDriver();
+    SetCurrentUserAgent("avif");
+    AddRequestAttribute(HttpAttributes::kAccept, "image/avif");
+    SetDriverRequestHeaders();
+  }
+
   void MarkTooBusyToWork() {
     // Set the current # of rewrites very high, so we stop doing more
     // due to "load".
@@ -1458,6 +1498,40 @@ TEST_F(ImageRewriteTest, AddDimTest) {
   EXPECT_EQ(1, counting_url_async_fetcher()->fetch_count());
 }
 
+TEST_F(ImageRewriteTest, QualitySearchReusedOnReconstruction) {
+  Variable* searches =
+      statistics()->GetVariable(ImageRewriteFilter::kImageQualitySearches);
+  Variable* searches_reused = statistics()->GetVariable(
+      ImageRewriteFilter::kImageQualitySearchesReused);
+  options()->EnableFilter(RewriteOptions::kRecompressJpeg);
+  // Forces lossy recompression, which the search applies to.
+  options()->set_image_jpeg_num_progressive_scans(1);
+  options()->set_image_target_ssim(0.5);
+  rewrite_driver()->AddFilters();
+
+  GoogleString initial_url = StrCat(kTestDomain, kPuzzleJpgFile);
+  AddFileToMockFetcher(initial_url, kPuzzleJpgFile, kContentTypeJpeg, 100);
+  ParseUrl(StrCat(kTestDomain, "test.html"),
+           StrCat("<img src='", initial_url, "'>"));
+  StringVector image_urls;
+  CollectImgSrcs(initial_url, output_buffer_, &image_urls);
+  ASSERT_EQ(1, image_urls.size());
+  const GoogleString& rewritten_url = image_urls[0];
+  EXPECT_NE(initial_url, rewritten_url);
+  EXPECT_EQ(1, searches->Get());
+  EXPECT_EQ(0, searches_reused->Get());
+
+  // With the output gone from the HTTP cache, fetching it rewrites the image
+  // again alongside the metadata of the first rewrite, whose quality is
+  // used rather than searched for.
+  lru_cache()->Delete(HttpCacheKey(rewritten_url));
+  GoogleString content;
+  EXPECT_TRUE(FetchResourceUrl(rewritten_url, &content));
+  EXPECT_FALSE(content.empty());
+  EXPECT_EQ(1, searches->Get());
+  EXPECT_EQ(1, searches_reused->Get());
+}
+
 TEST_F(ImageRewriteTest, NoDimsInNonImg) {
   // As above, only with an icon.  See:
   // https://github.com/apache/incubator-pagespeed-mod/issues/629
@@ -1489,6 +1563,43 @@ TEST_F(ImageRewriteTest, PngToJpegUnhealthy) {
   TestTranscodeAndOptimizePng(false, "", kContentTypePng);
 }
 
+TEST_F(ImageRewriteTest, AvifAndNonAvifResultsCachedSeparately) {
+  if (RunningOnValgrind() || !AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  options()->EnableFilter(RewriteOptions::kRecompressJpeg);
+  options()->EnableFilter(RewriteOptions::kConvertToAvif);
+  options()->set_image_recompress_quality(85);
+  rewrite_driver()->AddFilters();
+  Variable* image_rewrites =
+      statistics()->GetVariable(ImageRewriteFilter::kImageRewrites);
+  Variable* avif_rewrites =
+      statistics()->GetVariable(ImageRewriteFilter::kImageAvifRewrites);
+
+  ResetForAvif();
+  TestSingleRewrite(kPuzzleJpgFile, kContentTypeJpeg, kContentTypeAvif, "", "",
+                    true, false);
+  EXPECT_EQ(1, image_rewrites->Get());
+  EXPECT_EQ(1, avif_rewrites->Get());
+
+  // A browser without Accept: image/avif must not get the cached AVIF.
+  ResetUserAgent("avif");
+  TestSingleRewrite(kPuzzleJpgFile, kContentTypeJpeg, kContentTypeJpeg, "", "",
+                    true, false);
+  EXPECT_EQ(2, image_rewrites->Get());
+  EXPECT_EQ(1, avif_rewrites->Get());
+
+  // Both results are now cached, so neither is rewritten again.
+  ResetForAvif();
+  TestSingleRewrite(kPuzzleJpgFile, kContentTypeJpeg, kContentTypeAvif, "", "",
+                    true, false);
+  ResetUserAgent("avif");
+  TestSingleRewrite(kPuzzleJpgFile, kContentTypeJpeg, kContentTypeJpeg, "", "",
+                    true, false);
+  EXPECT_EQ(2, image_rewrites->Get());
+  EXPECT_EQ(1, avif_rewrites->Get());
+}
+
 TEST_F(ImageRewriteTest, PngToWebpWithWebpUa) {
   if (RunningOnValgrind()) {
     return;
@@ -1576,6 +1687,40 @@ TEST_F(ImageRewriteTest, PngToWebpWithWebpLaUaAndFlag) {
                              -1 /* resized_height */);
 }
 
+// The settings are the same as "PngToWebpWithWebpLaUaAndFlag", but the
+// rewrite may use a helper thread, which it gets from the idle
+// ImageMaxRewritesAtOnce budget since the image is large enough.
+TEST_F(ImageRewriteTest, PngToWebpWithHelperThread) {
+  if (RunningOnValgrind()) {
+    return;
+  }
+  options()->EnableFilter(RewriteOptions::kConvertPngToJpeg);
+  options()->EnableFilter(RewriteOptions::kConvertJpegToWebp);
+  options()->EnableFilter(RewriteOptions::kInsertImageDimensions);
+  options()->EnableFilter(RewriteOptions::kConvertToWebpLossless);
+  options()->EnableFilter(RewriteOptions::kRecompressPng);
+  options()->set_image_recompress_quality(85);
+  options()->set_image_max_encode_threads(2);
+  rewrite_driver()->AddFilters();
+  SetupForWebpLossless();
+
+  TestSingleRewrite(kRedbrushAlphaPngFile, kContentTypePng, kContentTypeWebp,
+                    "", " width=\"512\" height=\"480\"", true, false);
+  TestConversionVariables(0, 0, 0,  // gif
+                          0, 1, 0,  // png
+                          0, 0, 0,  // jpg
+                          0, 0, 0,  // gif animated
+                          false);
+  EXPECT_EQ(1, statistics()
+                   ->GetVariable(
+                       ImageRewriteFilter::kImageWebpWithAlphaMultithreaded)
+                   ->Get());
+  EXPECT_EQ(
+      0, statistics()
+             ->GetVariable(ImageRewriteFilter::kImageWebpOpaqueMultithreaded)
+             ->Get());
+}
+
 // The settings are the same as "PngToWebpWithWebpLaUaAndFlag" except
 // WebP lossless user agent. So conversion falls back to PNG.
 TEST_F(ImageRewriteTest, PngFallbackToPngLackOfWebpLaUa) {
@@ -4059,6 +4204,19 @@ TEST_F(ImageRewriteTest, JpegExceedResolutionLimit) {
                       false /*try_resize*/, false /*expect_rewritten*/);
 }
 
+TEST_F(ImageRewriteTest, PngExceedResolutionLimitResizedInBands) {
+  // The PNG is not interlaced, so it is decoded a band at a time and only the
+  // 400x200 result is held whole.
+  TestResizeOverResolutionLimit(kResolutionLimitPngFile, kContentTypePng,
+                                true /*expect_rewritten*/);
+}
+
+TEST_F(ImageRewriteTest, ProgressiveJpegExceedResolutionLimitResize) {
+  // libjpeg has to buffer all of a progressive JPEG to decode any of it.
+  TestResizeOverResolutionLimit(kResolutionLimitJpegFile, kContentTypeJpeg,
+                                false /*expect_rewritten*/);
+}
+
 TEST_F(ImageRewriteTest, PngInResolutionLimit) {
   if (RunningOnValgrind()) {
     return;
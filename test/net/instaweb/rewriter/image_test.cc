@@ -39,6 +39,7 @@
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/http/data_url.h"
+#include "pagespeed/kernel/image/avif_optimizer.h"
 #include "pagespeed/kernel/image/image_util.h"
 #include "pagespeed/kernel/image/jpeg_utils.h"
 #include "pagespeed/kernel/image/read_image.h"
@@ -52,6 +53,7 @@
 #include "test/pagespeed/kernel/image/jpeg_optimizer_test_helper.h"
 #include "test/pagespeed/kernel/image/test_utils.h"
 
+using pagespeed::image_compression::AvifFrameWriter;
 using pagespeed::image_compression::JpegUtils;
 using pagespeed::image_compression::kMessagePatternAnimatedGif;
 using pagespeed::image_compression::kMessagePatternPixelFormat;
@@ -212,6 +214,32 @@ class ConversionVarChecker {
   Image::ConversionVariables webp_conversion_variables_;
 };
 
+class AvifVarChecker {
+ public:
+  explicit AvifVarChecker(Image::CompressionOptions* options)
+      : thread_system_(Platform::CreateThreadSystem()),
+        simple_stats_(thread_system_.get()) {
+    avif_conversion_variable_.timeout_count =
+        simple_stats_.AddVariable("avif_timeout");
+    avif_conversion_variable_.success_ms =
+        simple_stats_.AddHistogram("avif_success");
+    avif_conversion_variable_.failure_ms =
+        simple_stats_.AddHistogram("avif_failure");
+    options->avif_conversion_variables = &avif_conversion_variable_;
+  }
+
+  void Test(int timeout, int success, int failure) {
+    EXPECT_EQ(timeout, avif_conversion_variable_.timeout_count->Get());
+    EXPECT_EQ(success, avif_conversion_variable_.success_ms->Count());
+    EXPECT_EQ(failure, avif_conversion_variable_.failure_ms->Count());
+  }
+
+ private:
+  std::unique_ptr<ThreadSystem> thread_system_;
+  SimpleStats simple_stats_;
+  Image::ConversionBySourceVariable avif_conversion_variable_;
+};
+
 }  // namespace
 
 class ImageTest : public ImageTestBase {
@@ -1085,6 +1113,124 @@ TEST_F(ImageTest, WebpNonLaFromJpgTest) {
                               true);
 }
 
+TEST_F(ImageTest, JpegToAvifTest) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  // FYI: This test will probably take very long to run under Valgrind.
+  if (RunningOnValgrind()) {
+    return;
+  }
+  Image::CompressionOptions* options = new Image::CompressionOptions;
+  AvifVarChecker avif_var_checker(options);
+  ConversionVarChecker conversion_var_checker(options);
+  options->allow_avif = true;
+  options->avif_quality = 60;
+  // AVIF is tried before WebP when both are allowed.
+  options->convert_jpeg_to_webp = true;
+  options->preferred_webp = WEBP_LOSSY;
+  options->webp_quality = 75;
+
+  GoogleString buffer;
+  ImagePtr image(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  EXPECT_GT(image->input_size(), image->output_size());
+  EXPECT_EQ(ContentType::kAvif, image->content_type()->type());
+  EXPECT_EQ(IMAGE_AVIF, pagespeed::image_compression::ComputeImageType(
+                            image->Contents()));
+  avif_var_checker.Test(0, 1, 0);
+  conversion_var_checker.Test(0, 0, 0,  // gif
+                              0, 0, 0,  // png
+                              0, 0, 0,  // jpeg
+                              0, 0, 0,  // gif animated
+                              true);
+}
+
+TEST_F(ImageTest, PngToAvifTest) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  // FYI: This test will also probably take very long to run under Valgrind.
+  if (RunningOnValgrind()) {
+    return;
+  }
+  Image::CompressionOptions* options = new Image::CompressionOptions;
+  AvifVarChecker avif_var_checker(options);
+  options->allow_avif = true;
+  options->avif_quality = 60;
+  options->convert_png_to_jpeg = true;
+  options->jpeg_quality = 85;
+
+  // kBikeCrash is an opaque photo, so it may be encoded lossily.
+  GoogleString buffer;
+  ImagePtr image(ReadFromFileWithOptions(kBikeCrash, &buffer, options));
+  EXPECT_GT(image->input_size(), image->output_size());
+  EXPECT_EQ(ContentType::kAvif, image->content_type()->type());
+  avif_var_checker.Test(0, 1, 0);
+}
+
+TEST_F(ImageTest, PngAlphaGraphicIsNotConvertedToAvifTest) {
+  // FYI: This test will also probably take very long to run under Valgrind.
+  if (RunningOnValgrind()) {
+    return;
+  }
+  Image::CompressionOptions* options = new Image::CompressionOptions;
+  AvifVarChecker avif_var_checker(options);
+  options->allow_avif = true;
+  options->avif_quality = 60;
+  options->preferred_webp = WEBP_LOSSLESS;
+  options->allow_webp_alpha = true;
+  options->convert_png_to_jpeg = true;
+  options->convert_jpeg_to_webp = true;
+  options->webp_quality = 75;
+
+  // Transparent images are treated as graphics, which are only compressed
+  // losslessly, so the lossy AVIF encoder is never tried.
+  GoogleString buffer;
+  ImagePtr image(ReadFromFileWithOptions(kCuppaTransparent, &buffer, options));
+  image->output_size();
+  EXPECT_EQ(ContentType::kWebp, image->content_type()->type());
+  avif_var_checker.Test(0, 0, 0);
+}
+
+TEST_F(ImageTest, JpegToAvifTimesOutTest) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  Image::CompressionOptions* options = new Image::CompressionOptions;
+  AvifVarChecker avif_var_checker(options);
+  SetJpegRecompressionAndQuality(options);
+  options->allow_avif = true;
+  options->avif_quality = 60;
+  options->avif_conversion_timeout_ms = 1;
+  timer_.SetTimeDeltaUs(1);  // 1st increment of time, used for setting deadline
+  timer_.SetTimeDeltaUs(1);  // 2nd increment of time, used for setting deadline
+  timer_.SetTimeDeltaUs(1);  // Before encoding
+  timer_.SetTimeDeltaUs(     // During encoding
+      1000 * options->avif_conversion_timeout_ms + 1);
+
+  // The AVIF encode that finished past the deadline is discarded, and the
+  // image is recompressed as JPEG instead.
+  GoogleString buffer;
+  ImagePtr image(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  image->output_size();
+  EXPECT_EQ(ContentType::kJpeg, image->content_type()->type());
+  avif_var_checker.Test(1, 0, 0);
+}
+
+TEST_F(ImageTest, AvifDisabledByZeroQualityTest) {
+  Image::CompressionOptions* options = new Image::CompressionOptions;
+  AvifVarChecker avif_var_checker(options);
+  SetJpegRecompressionAndQuality(options);
+  options->allow_avif = true;
+  options->avif_quality = 0;
+
+  GoogleString buffer;
+  ImagePtr image(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  image->output_size();
+  EXPECT_EQ(ContentType::kJpeg, image->content_type()->type());
+  avif_var_checker.Test(0, 0, 0);
+}
+
 TEST_F(ImageTest, DrawImage) {
   Image::CompressionOptions* options = new Image::CompressionOptions();
   options->recompress_png = true;
@@ -1248,6 +1394,79 @@ TEST_F(ImageTest, CompressJpegUsingLossyOrLossless) {
                                                     &message_handler_));
 }
 
+TEST_F(ImageTest, JpegQualitySearch) {
+  Image::CompressionOptions* options = new Image::CompressionOptions();
+  SetJpegRecompressionAndQuality(options);
+  // Forces lossy recompression, which the search applies to.
+  options->jpeg_num_progressive_scans = 1;
+  GoogleString buffer;
+  ImagePtr image(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  const size_t configured_size = image->output_size();
+  EXPECT_EQ(-1, options->searched_quality);
+
+  // A target that any quality meets settles on the lowest one searched.
+  options = new Image::CompressionOptions();
+  SetJpegRecompressionAndQuality(options);
+  options->jpeg_num_progressive_scans = 1;
+  options->target_ssim = 0.5;
+  buffer.clear();
+  image.reset(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  EXPECT_GT(configured_size, image->output_size());
+  EXPECT_EQ(40, options->searched_quality);
+  EXPECT_EQ(IMAGE_JPEG, options->searched_image_type);
+  EXPECT_EQ(40, JpegUtils::GetImageQualityFromImage(image->Contents().data(),
+                                                    image->Contents().size(),
+                                                    &message_handler_));
+
+  // A quality found before for the same output type is used as is.
+  options = new Image::CompressionOptions();
+  SetJpegRecompressionAndQuality(options);
+  options->jpeg_num_progressive_scans = 1;
+  options->target_ssim = 0.5;
+  options->cached_search_quality = 60;
+  options->cached_search_image_type = IMAGE_JPEG;
+  buffer.clear();
+  image.reset(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  EXPECT_EQ(60, JpegUtils::GetImageQualityFromImage(image->Contents().data(),
+                                                    image->Contents().size(),
+                                                    &message_handler_));
+  EXPECT_EQ(60, options->searched_quality);
+}
+
+TEST_F(ImageTest, JpegQualitySearchTimesOut) {
+  // Time runs out after the first step, at quality (40 + 84) / 2, which
+  // passes and is kept.
+  Image::CompressionOptions* options = new Image::CompressionOptions();
+  SetJpegRecompressionAndQuality(options);
+  options->jpeg_num_progressive_scans = 1;
+  options->target_ssim = 0.5;
+  options->quality_search_timeout_ms = 1;
+  timer_.SetTimeDeltaUs(1);     // When setting deadline
+  timer_.SetTimeDeltaUs(1);     // Before the first step
+  timer_.SetTimeDeltaUs(2000);  // Before the second step
+  GoogleString buffer;
+  ImagePtr image(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  EXPECT_EQ(62, options->searched_quality);
+  EXPECT_EQ(62, JpegUtils::GetImageQualityFromImage(image->Contents().data(),
+                                                    image->Contents().size(),
+                                                    &message_handler_));
+
+  // Time running out before any step leaves the configured quality.
+  options = new Image::CompressionOptions();
+  SetJpegRecompressionAndQuality(options);
+  options->jpeg_num_progressive_scans = 1;
+  options->target_ssim = 0.5;
+  options->quality_search_timeout_ms = 1;
+  timer_.SetTimeDeltaUs(1);     // When setting deadline
+  timer_.SetTimeDeltaUs(2000);  // Before the first step
+  buffer.clear();
+  image.reset(ReadFromFileWithOptions(kPuzzle, &buffer, options));
+  EXPECT_EQ(85, options->searched_quality);
+  EXPECT_EQ(85, JpegUtils::GetImageQualityFromImage(image->Contents().data(),
+                                                    image->Contents().size(),
+                                                    &message_handler_));
+}
+
 void SetBaseJpegOptions(Image::CompressionOptions* options) {
   options->preferred_webp = WEBP_LOSSY;
   options->allow_webp_alpha = true;
@@ -387,6 +387,11 @@ TEST_F(ImageUrlEncoderTest, CacheKey) {
   EXPECT_EQ("amd", ImageUrlEncoder::CacheKeyFromResourceContext(context));
   context.Clear();
 
+  context.set_may_use_avif(true);
+  context.set_libwebp_level(ResourceContext::LIBWEBP_LOSSY_ONLY);
+  EXPECT_EQ("wf", ImageUrlEncoder::CacheKeyFromResourceContext(context));
+  context.Clear();
+
   // When both may_use_small_screen_quality and may_use_save_data_quality are
   // set, may_use_save_data_quality takes precedence.
   context.set_may_use_small_screen_quality(true);
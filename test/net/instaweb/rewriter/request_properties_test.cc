@@ -43,6 +43,17 @@ TEST_F(RequestPropertiesTest, SupportsWebpRewrittenUrls) {
   EXPECT_TRUE(request_properties.SupportsWebpRewrittenUrls());
 }
 
+TEST_F(RequestPropertiesTest, SupportsAvif) {
+  RequestProperties request_properties(&user_agent_matcher_);
+  request_properties.SetUserAgent(UserAgentMatcherTestBase::kChromeUserAgent);
+  EXPECT_FALSE(request_properties.SupportsAvif());
+
+  RequestHeaders headers;
+  headers.Add(HttpAttributes::kAccept, "image/avif,image/webp,*/*");
+  request_properties.ParseRequestHeaders(headers);
+  EXPECT_TRUE(request_properties.SupportsAvif());
+}
+
 TEST_F(RequestPropertiesTest, SupportsImageInliningNoRequestHeaders) {
   RequestProperties request_properties(&user_agent_matcher_);
   request_properties.SetUserAgent(UserAgentMatcherTestBase::kChrome18UserAgent);
@@ -4329,6 +4329,48 @@ TEST_F(RewriteContextTest, TestStaleRewriting) {
   EXPECT_EQ(0, counting_url_async_fetcher()->fetch_count());
 }
 
+// The input's own Cache-Control: stale-while-revalidate permits a stale
+// rewrite even with no staleness threshold configured.
+TEST_F(RewriteContextTest, TestStaleRewritingFromStaleWhileRevalidate) {
+  FetcherUpdateDateHeaders();
+  UseMd5Hasher();
+
+  const int kTtlSec = 100;
+  const char kPath[] = "test.css";
+  const GoogleString kOriginalRewriteUrl(
+      Encode("", "tw", "jXd_OF09_s", "test.css", "css"));
+
+  options()->ClearSignatureForTesting();
+  options()->set_metadata_cache_staleness_threshold_ms(0);
+  options()->ComputeSignature();
+
+  InitTrimFilters(kRewrittenResource);
+  ResponseHeaders response_headers;
+  DefaultResponseHeaders(kContentTypeCss, kTtlSec, &response_headers);
+  response_headers.Replace(
+      HttpAttributes::kCacheControl,
+      StrCat("max-age=", IntegerToString(kTtlSec),
+             ", stale-while-revalidate=", IntegerToString(2 * kTtlSec)));
+  response_headers.ComputeCaching();
+  SetFetchResponse(AbsolutifyUrl(kPath), response_headers, "   data  ");
+
+  ValidateExpected("initial", CssLinkHref(kPath),
+                   CssLinkHref(kOriginalRewriteUrl));
+  EXPECT_EQ(1, trim_filter_->num_rewrites());
+
+  // Expired, but within the input's stale-while-revalidate window: the old
+  // rewrite is served while the input is freshened.
+  AdvanceTimeMs(2 * kTtlSec * Timer::kSecondMs);
+  ClearStats();
+  SetupWaitFetcher();
+  ValidateExpected("stale", CssLinkHref(kPath),
+                   CssLinkHref(kOriginalRewriteUrl));
+  EXPECT_EQ(1, metadata_cache_info().num_hits());
+  EXPECT_EQ(1, metadata_cache_info().num_stale_rewrites());
+  CallFetcherCallbacks();
+  EXPECT_EQ(1, counting_url_async_fetcher()->fetch_count());
+}
+
 // Even though the rewrite delay is more than the deadline, the rewrite is
 // finished by the time the response is completely flushed.
 TEST_F(RewriteContextTest, BlockingRewrite) {
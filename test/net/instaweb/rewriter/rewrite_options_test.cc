@@ -913,11 +913,14 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
       RewriteOptions::kFlushHtml,
       RewriteOptions::kFollowFlushes,
       RewriteOptions::kForbidAllDisabledFilters,
+      RewriteOptions::kFuseStreamingFilters,
       RewriteOptions::kGoogleFontCssInlineMaxBytes,
       RewriteOptions::kHideRefererUsingMeta,
       RewriteOptions::kHttpCacheCompressionLevel,
       RewriteOptions::kHonorCsp,
       RewriteOptions::kIdleFlushTimeMs,
+      RewriteOptions::kImageAvifRecompressionQuality,
+      RewriteOptions::kImageAvifTimeoutMs,
       RewriteOptions::kImageInlineMaxBytes,
       RewriteOptions::kImageJpegNumProgressiveScans,
       RewriteOptions::kImageJpegNumProgressiveScansForSmallScreens,
@@ -927,10 +930,13 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
       RewriteOptions::kImageLimitOptimizedPercent,
       RewriteOptions::kImageLimitRenderedAreaPercent,
       RewriteOptions::kImageLimitResizeAreaPercent,
+      RewriteOptions::kImageMaxEncodeThreads,
       RewriteOptions::kImageMaxRewritesAtOnce,
       RewriteOptions::kImagePreserveURLs,
+      RewriteOptions::kImageQualitySearchTimeoutMs,
       RewriteOptions::kImageRecompressionQuality,
       RewriteOptions::kImageResolutionLimitBytes,
+      RewriteOptions::kImageTargetSsim,
       RewriteOptions::kImageWebpQualityForSaveData,
       RewriteOptions::kImageWebpRecompressionQuality,
       RewriteOptions::kImageWebpRecompressionQualityForSmallScreens,
@@ -1092,15 +1098,21 @@ TEST_F(RewriteOptionsTest, LookupNonBaseOptionByNameTest) {
   FailLookupOptionByName(RewriteOptions::kCacheFlushFilename);
   FailLookupOptionByName(RewriteOptions::kCacheFlushPollIntervalSec);
   FailLookupOptionByName(RewriteOptions::kCompressMetadataCache);
+  FailLookupOptionByName(RewriteOptions::kCompressMetadataCacheDictionaryKb);
   FailLookupOptionByName(RewriteOptions::kFetchHttps);
   FailLookupOptionByName(RewriteOptions::kFetcherProxy);
   FailLookupOptionByName(RewriteOptions::kFileCacheCleanIntervalMs);
   FailLookupOptionByName(RewriteOptions::kFileCachePath);
   FailLookupOptionByName(RewriteOptions::kFileCacheCleanSizeKb);
+  FailLookupOptionByName(RewriteOptions::kFileCacheCleanSliceMs);
   FailLookupOptionByName(RewriteOptions::kFileCacheCleanInodeLimit);
+  FailLookupOptionByName(RewriteOptions::kFileCacheMode);
+  FailLookupOptionByName(RewriteOptions::kFileCacheIoUring);
   FailLookupOptionByName(RewriteOptions::kLogDir);
+  FailLookupOptionByName(RewriteOptions::kLruCacheAdmissionPolicy);
   FailLookupOptionByName(RewriteOptions::kLruCacheByteLimit);
   FailLookupOptionByName(RewriteOptions::kLruCacheKbPerProcess);
+  FailLookupOptionByName(RewriteOptions::kLruCacheShards);
   FailLookupOptionByName(RewriteOptions::kMemcachedServers);
   FailLookupOptionByName(RewriteOptions::kMemcachedThreads);
   FailLookupOptionByName(RewriteOptions::kMemcachedTimeoutUs);
@@ -332,5 +332,55 @@ TEST_F(QueuedExpensiveOperationTest, QueuePopIsReentrant) {
   EXPECT_EQ(0, active_operations());
 }
 
+TEST_F(QueuedExpensiveOperationTest, ClaimUsesFreeSlot) {
+  InitQueueWithSize(2);
+
+  TrackCallsFunction f;
+  controller_->ScheduleExpensiveOperation(&f);
+  EXPECT_TRUE(f.run_called_);
+  EXPECT_TRUE(controller_->TryToClaimExpensiveOperation());
+  EXPECT_EQ(2, active_operations());
+  EXPECT_EQ(2, permitted_operations());
+
+  // No slot left, and a claim never queues.
+  EXPECT_FALSE(controller_->TryToClaimExpensiveOperation());
+  EXPECT_EQ(2, active_operations());
+  EXPECT_EQ(0, queued_operations());
+
+  controller_->NotifyExpensiveOperationComplete();
+  controller_->NotifyExpensiveOperationComplete();
+  EXPECT_EQ(0, active_operations());
+}
+
+TEST_F(QueuedExpensiveOperationTest, ClaimDoesNotJumpQueue) {
+  InitQueueWithSize(2);
+
+  TrackCallsFunction f1;
+  TrackCallsFunction f2;
+  TrackCallsFunction f3;
+  controller_->ScheduleExpensiveOperation(&f1);
+  controller_->ScheduleExpensiveOperation(&f2);
+  controller_->ScheduleExpensiveOperation(&f3);
+  EXPECT_FALSE(f3.run_called_);
+  EXPECT_EQ(1, queued_operations());
+
+  // Finishing f1 hands its slot to f3, not to a helper.
+  controller_->NotifyExpensiveOperationComplete();
+  EXPECT_TRUE(f3.run_called_);
+  EXPECT_FALSE(controller_->TryToClaimExpensiveOperation());
+
+  controller_->NotifyExpensiveOperationComplete();
+  EXPECT_TRUE(controller_->TryToClaimExpensiveOperation());
+  controller_->NotifyExpensiveOperationComplete();
+  controller_->NotifyExpensiveOperationComplete();
+  EXPECT_EQ(0, active_operations());
+}
+
+TEST_F(QueuedExpensiveOperationTest, ClaimWithQueueSize0) {
+  InitQueueWithSize(0);
+  EXPECT_FALSE(controller_->TryToClaimExpensiveOperation());
+  EXPECT_EQ(0, active_operations());
+}
+
 }  // namespace
 }  // namespace net_instaweb
@@ -107,5 +107,20 @@ TEST_F(WorkBoundExpensiveOperationTest, LimitNegativeIsUnlimited) {
   EXPECT_TRUE(TryToWork());
 }
 
+TEST_F(WorkBoundExpensiveOperationTest, ClaimSharesBound) {
+  InitControllerWithLimit(2);
+  EXPECT_TRUE(TryToWork());
+  EXPECT_TRUE(controller_->TryToClaimExpensiveOperation());
+  EXPECT_FALSE(controller_->TryToClaimExpensiveOperation());
+  EXPECT_FALSE(TryToWork());
+  controller_->NotifyExpensiveOperationComplete();
+  EXPECT_TRUE(controller_->TryToClaimExpensiveOperation());
+}
+
+TEST_F(WorkBoundExpensiveOperationTest, ClaimUnlimited) {
+  InitControllerWithLimit(0);
+  EXPECT_TRUE(controller_->TryToClaimExpensiveOperation());
+}
+
 }  // namespace
 }  // namespace net_instaweb
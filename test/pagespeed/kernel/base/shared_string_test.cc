@@ -28,6 +28,21 @@ class SharedStringTest : public testing::Test {
  protected:
 };
 
+// Annotation that records its destruction, so tests can check it is freed.
+class TestAnnotation : public SharedString::Annotation {
+ public:
+  explicit TestAnnotation(bool* destroyed) : destroyed_(destroyed) {
+    *destroyed_ = false;
+  }
+
+  size_t size() const override { return 100; }
+
+ private:
+  ~TestAnnotation() override { *destroyed_ = true; }
+
+  bool* destroyed_;
+};
+
 TEST_F(SharedStringTest, ConstructFromStringPiece) {
   SharedString ss(StringPiece("hello"));
   EXPECT_STREQ("hello", ss.Value());
@@ -230,4 +245,39 @@ TEST_F(SharedStringTest, ExtendUniqueTruncated) {
       << "Re-use the same storage across truncate/extend of unique string";
 }
 
+TEST_F(SharedStringTest, Annotation) {
+  bool destroyed;
+  SharedString ss("hello");
+  EXPECT_TRUE(ss.annotation() == nullptr);
+  TestAnnotation* annotation = new TestAnnotation(&destroyed);
+  EXPECT_EQ(static_cast<size_t>(5), ss.SizeIncludingAnnotation());
+  ss.set_annotation(annotation);
+  EXPECT_EQ(annotation, ss.annotation());
+  EXPECT_EQ(static_cast<size_t>(105), ss.SizeIncludingAnnotation());
+
+  // Linked strings see the annotation, even once created.
+  SharedString ss2(ss);
+  SharedString ss3;
+  ss3 = ss;
+  EXPECT_EQ(annotation, ss2.annotation());
+  EXPECT_EQ(annotation, ss3.annotation());
+
+  // Mutating the storage drops it for everyone, but detaching keeps it
+  // with the old storage.
+  ss.DetachAndClear();
+  EXPECT_TRUE(ss.annotation() == nullptr);
+  EXPECT_EQ(annotation, ss2.annotation());
+  ss2.Append(", World!");
+  EXPECT_TRUE(ss2.annotation() == nullptr);
+  EXPECT_TRUE(ss3.annotation() == nullptr);
+  EXPECT_TRUE(destroyed);
+
+  annotation = new TestAnnotation(&destroyed);
+  ss3.set_annotation(annotation);
+  ss3.WriteAt(0, "j", 1);
+  EXPECT_TRUE(ss3.annotation() == nullptr);
+  EXPECT_TRUE(destroyed);
+  EXPECT_STREQ("jello, World!", ss2.Value());
+}
+
 }  // namespace net_instaweb
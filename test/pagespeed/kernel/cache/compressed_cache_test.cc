@@ -27,9 +27,13 @@
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/stack_buffer.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/util/simple_random.h"
 #include "pagespeed/kernel/util/simple_stats.h"
@@ -65,6 +69,23 @@ class CompressedCacheTest : public CacheTestBase {
     return ret;
   }
 
+  // Replaces compressed_cache_ with one using codec.
+  void ResetCompressedCache(CacheCodec::Type codec) {
+    compressed_cache_ = std::make_unique<CompressedCache>(
+        lru_cache_.get(), codec, thread_system_.get(), &stats_);
+  }
+
+  // A value sharing most of its structure with the others made by this
+  // method, as cached metadata does.
+  GoogleString StructuredValue(int i) {
+    return StrCat(
+        "{\"url\": \"http://www.example.com/images/photo",
+        IntegerToString(i), ".jpg\", \"content-type\": \"image/jpeg\", ",
+        "\"cache-control\": \"max-age=31536000, public\", ",
+        "\"rewritten\": \"http://www.example.com/images/xphoto",
+        IntegerToString(i * 7919), ".jpg.pagespeed.ic.webp\"}");
+  }
+
   CacheInterface* Cache() override { return compressed_cache_.get(); }
 
   GoogleMessageHandler handler_;
@@ -184,4 +205,194 @@ TEST_F(CompressedCacheTest, RemoveOneByteFromMiddle) {
   EXPECT_EQ(1, compressed_cache_->CorruptPayloads());
 }
 
+// Deflate without a dictionary must keep writing the format it always has,
+// so that caches written before codecs were pluggable stay readable and
+// vice versa.
+TEST_F(CompressedCacheTest, DeflateFormatUnchanged) {
+  GoogleString value = StructuredValue(1);
+  CheckPut("key", value);
+  GoogleString expected;
+  StringWriter writer(&expected);
+  ASSERT_TRUE(GzipInflater::Deflate(value, GzipInflater::kDeflate, &writer));
+  StrAppend(&expected, "[[]]");
+  EXPECT_EQ(expected, GetRawValue("key"));
+}
+
+TEST_F(CompressedCacheTest, LzDetectsCorruption) {
+  ResetCompressedCache(CacheCodec::kLz);
+  GoogleString value = random_.GenerateHighEntropyString(5 * kStackBufferSize);
+  CheckPut("key", value);
+  GoogleString raw_value = GetRawValue("key");
+  raw_value[raw_value.size() / 2] ^= 1;
+  lru_cache_->PutSwappingString("key", &raw_value);
+  CheckNotFound("key");
+  EXPECT_EQ(1, compressed_cache_->CorruptPayloads());
+}
+
+TEST_F(CompressedCacheTest, UnknownCodecIsCorrupt) {
+  CheckPut("key", "value");
+  GoogleString raw_value = GetRawValue("key");
+  raw_value.insert(raw_value.size() - 2, "z");
+  lru_cache_->PutSwappingString("key", &raw_value);
+  CheckNotFound("key");
+  EXPECT_EQ(1, compressed_cache_->CorruptPayloads());
+}
+
+TEST_F(CompressedCacheTest, TrainedDictionary) {
+  ResetCompressedCache(CacheCodec::kLz);
+  compressed_cache_->EnableDictionaryTraining(10, 1024);
+  for (int i = 0; i < 10; ++i) {
+    CheckPut(StrCat("sample", IntegerToString(i)), StructuredValue(i));
+  }
+  int64 compressed_before = compressed_cache_->CompressedSize();
+  GoogleString value = StructuredValue(100);
+  CheckPut("key", value);
+  CheckGet("key", value);
+  int64 with_dictionary = compressed_cache_->CompressedSize() -
+                          compressed_before;
+
+  // The dictionary was published alongside the values.
+  GoogleString raw_value = GetRawValue("key");
+  StringPiece trailer = StringPiece(raw_value).substr(raw_value.size() - 13);
+  EXPECT_TRUE(strings::StartsWith(trailer, "[[l")) << trailer;
+  GoogleString dictionary_key =
+      StrCat(CompressedCache::kDictionaryKeyPrefix, trailer.substr(3, 8));
+  EXPECT_FALSE(GetRawValue(dictionary_key).empty());
+
+  // The samples, compressed before the dictionary existed, still read.
+  for (int i = 0; i < 10; ++i) {
+    CheckGet(StrCat("sample", IntegerToString(i)), StructuredValue(i));
+  }
+
+  // And the dictionary pays for itself.
+  ResetCompressedCache(CacheCodec::kLz);
+  compressed_before = compressed_cache_->CompressedSize();
+  CheckPut("plain", value);
+  EXPECT_GT(compressed_cache_->CompressedSize() - compressed_before,
+            with_dictionary);
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+}
+
+TEST_F(CompressedCacheTest, DeflateDictionary) {
+  ResetCompressedCache(CacheCodec::kDeflate);
+  compressed_cache_->SetDictionary(StructuredValue(0));
+  GoogleString value = StructuredValue(1);
+  CheckPut("key", value);
+  CheckGet("key", value);
+  GoogleString raw_value = GetRawValue("key");
+  EXPECT_TRUE(strings::StartsWith(
+      StringPiece(raw_value).substr(raw_value.size() - 13), "[[d"));
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+}
+
+// Another process sharing the underlying cache finds the dictionary there.
+TEST_F(CompressedCacheTest, DictionaryFetchedFromCache) {
+  ResetCompressedCache(CacheCodec::kLz);
+  compressed_cache_->SetDictionary(StructuredValue(0));
+  GoogleString value = StructuredValue(1);
+  CheckPut("key", value);
+
+  CompressedCache other(lru_cache_.get(), CacheCodec::kLz,
+                        thread_system_.get(), &stats_);
+  // The first lookup misses while the dictionary is fetched.
+  CheckNotFound(&other, "key");
+  EXPECT_EQ(1, other.DictionaryMisses());
+  CheckGet(&other, "key", value);
+  EXPECT_EQ(1, other.DictionaryMisses());
+  EXPECT_EQ(0, other.CorruptPayloads());
+}
+
+TEST_F(CompressedCacheTest, DictionaryLost) {
+  ResetCompressedCache(CacheCodec::kLz);
+  compressed_cache_->SetDictionary(StructuredValue(0));
+  CheckPut("key", StructuredValue(1));
+  lru_cache_->DeleteWithPrefixForTesting(CompressedCache::kDictionaryKeyPrefix);
+
+  CompressedCache other(lru_cache_.get(), CacheCodec::kLz,
+                        thread_system_.get(), &stats_);
+  CheckNotFound(&other, "key");
+  CheckNotFound(&other, "key");
+  EXPECT_EQ(2, other.DictionaryMisses());
+  EXPECT_EQ(0, other.CorruptPayloads());
+}
+
+// A process still sampling for its own dictionary adopts one it fetches.
+TEST_F(CompressedCacheTest, FetchedDictionaryAdopted) {
+  ResetCompressedCache(CacheCodec::kLz);
+  compressed_cache_->SetDictionary(StructuredValue(0));
+  CheckPut("key", StructuredValue(1));
+  GoogleString raw_value = GetRawValue("key");
+  GoogleString trailer = raw_value.substr(raw_value.size() - 13);
+
+  CompressedCache other(lru_cache_.get(), CacheCodec::kLz,
+                        thread_system_.get(), &stats_);
+  other.EnableDictionaryTraining(100, 1024);
+  CheckNotFound(&other, "key");
+  CheckPut(&other, "other", StructuredValue(2));
+  raw_value = GetRawValue("other");
+  EXPECT_EQ(trailer, raw_value.substr(raw_value.size() - 13));
+}
+
+class CompressedCacheCodecTest
+    : public CompressedCacheTest,
+      public ::testing::WithParamInterface<CacheCodec::Type> {
+ protected:
+  CompressedCacheCodecTest() { ResetCompressedCache(GetParam()); }
+};
+
+TEST_P(CompressedCacheCodecTest, PutGetDelete) {
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+  Cache()->Delete("Name");
+  CheckNotFound("Name");
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+}
+
+TEST_P(CompressedCacheCodecTest, Values) {
+  GoogleString high_entropy =
+      random_.GenerateHighEntropyString(5 * kStackBufferSize);
+  GoogleString low_entropy;
+  GoogleString chunk = random_.GenerateHighEntropyString(50);
+  while (low_entropy.size() < 5 * kStackBufferSize) {
+    low_entropy += chunk;
+  }
+  CheckPut("empty", "");
+  CheckPut("high", high_entropy);
+  CheckPut("low", low_entropy);
+  CheckGet("empty", "");
+  CheckGet("high", high_entropy);
+  CheckGet("low", low_entropy);
+  EXPECT_GT(kStackBufferSize, GetRawValue("low").size());
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+}
+
+TEST_P(CompressedCacheCodecTest, Garbage) {
+  CheckPut(lru_cache_.get(), "key", "garbage");
+  CheckNotFound("key");
+  CheckPut("key", "garbage");
+  GoogleString raw_value = GetRawValue("key");
+  StrAppend(&raw_value, "crap");
+  lru_cache_->PutSwappingString("key", &raw_value);
+  CheckNotFound("key");
+  EXPECT_EQ(2, compressed_cache_->CorruptPayloads());
+}
+
+// Any CompressedCache reads what any other wrote, whatever their codecs.
+TEST_P(CompressedCacheCodecTest, ReadableByAnyCodec) {
+  GoogleString value = StructuredValue(1);
+  CheckPut("key", value);
+  CompressedCache deflate(lru_cache_.get(), &stats_);
+  CheckGet(&deflate, "key", value);
+  CheckPut(&deflate, "key", value);
+  CheckGet("key", value);
+  EXPECT_EQ(0, compressed_cache_->CorruptPayloads());
+}
+
+INSTANTIATE_TEST_SUITE_P(CompressedCacheCodecTestInstance,
+                         CompressedCacheCodecTest,
+                         ::testing::Values(CacheCodec::kDeflate,
+                                           CacheCodec::kBrotli,
+                                           CacheCodec::kLz));
+
 }  // namespace net_instaweb
@@ -24,6 +24,7 @@
 
 #include <memory>
 
+#include "base/logging.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/condvar.h"
 #include "pagespeed/kernel/base/file_system.h"
@@ -31,11 +32,13 @@
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stdio_file_system.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
+#include "pagespeed/kernel/util/io_uring.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/kernel/util/simple_stats.h"
 #include "test/pagespeed/kernel/base/file_system_test_base.h"
@@ -47,6 +50,29 @@
 
 namespace net_instaweb {
 
+namespace {
+
+// A timer that moves a MockTimer on by tick_us every time it is read.
+class TickingTimer : public Timer {
+ public:
+  TickingTimer(MockTimer* timer, int64 tick_us)
+      : timer_(timer), tick_us_(tick_us) {}
+
+  int64 NowUs() const override {
+    int64 now_us = timer_->NowUs();
+    timer_->AdvanceUs(tick_us_);
+    return now_us;
+  }
+  void SleepUs(int64 us) override { timer_->SleepUs(us); }
+
+ private:
+  MockTimer* timer_;
+  int64 tick_us_;
+  DISALLOW_COPY_AND_ASSIGN(TickingTimer);
+};
+
+}  // namespace
+
 class FileCacheTest : public CacheTestBase {
  protected:
   FileCacheTest()
@@ -100,13 +126,15 @@ class FileCacheTest : public CacheTestBase {
   CacheInterface* Cache() override { return cache_.get(); }
   void PostOpCleanup() override {}
 
-  bool Clean(int64 size, int64 inode_count) {
+  bool Clean(int64 size, int64 inode_count, int64* size_out = nullptr,
+             int64* inode_count_out = nullptr) {
     // Cache expects to be locked when cleaning.
     EXPECT_TRUE(
         file_system_.TryLock(cache_->clean_lock_path_, &message_handler_)
             .is_true());
 
-    bool success = cache_->Clean(size, inode_count);
+    bool success =
+        cache_->Clean(size, inode_count, size_out, inode_count_out);
 
     EXPECT_TRUE(
         file_system_.Unlock(cache_->clean_lock_path_, &message_handler_));
@@ -114,6 +142,43 @@ class FileCacheTest : public CacheTestBase {
     return success;
   }
 
+  bool CleanIncrementally(int64 size, int64 inode_count) {
+    EXPECT_TRUE(
+        file_system_.TryLock(cache_->clean_lock_path_, &message_handler_)
+            .is_true());
+    bool success = cache_->CleanIncrementally(size, inode_count);
+    EXPECT_TRUE(
+        file_system_.Unlock(cache_->clean_lock_path_, &message_handler_));
+    return success;
+  }
+
+  void EnableIncrementalCleaning(int64 clean_slice_ms) {
+    cache_->mutable_cache_policy()->clean_slice_ms = clean_slice_ms;
+  }
+
+  bool ReadLedger(int64* size, int64* inode_count) {
+    return cache_->ReadLedger(size, inode_count);
+  }
+
+  GoogleString LedgerContents() {
+    GoogleString contents;
+    EXPECT_TRUE(file_system_.ReadFile(cache_->ledger_path_.c_str(), &contents,
+                                      &message_handler_));
+    return contents;
+  }
+
+  void WriteLedger(StringPiece contents) {
+    EXPECT_TRUE(file_system_.WriteFileAtomic(cache_->ledger_path_, contents,
+                                             &message_handler_));
+  }
+
+  // Returns a value for entry i that is exactly size bytes long.
+  static GoogleString PaddedValue(int i, int size) {
+    GoogleString value = StrCat("Value", IntegerToString(i));
+    value.resize(size, '.');
+    return value;
+  }
+
   void WaitForWorker(SlowWorker* worker) {
     while (worker->IsBusy()) {
       usleep(10);
@@ -503,4 +568,284 @@ TEST_F(FileCacheTest, MultipleSimultaneousCacheCleans) {
   EXPECT_EQ(1, cleanups_->Get());
 }
 
+// With incremental cleaning, the first clean counts the cache to start the
+// ledger, which Puts and Deletes then keep up to date.
+TEST_F(FileCacheTest, IncrementalCleanKeepsLedger) {
+  ResetFileCache(kCleanIntervalMs, 1000 /* target_size_bytes */);
+  EnableIncrementalCleaning(Timer::kSecondMs);
+  CheckPut("Name1", "Value1");
+  CheckPut("Name2", "Value2");
+  int64 size, inode_count;
+  EXPECT_FALSE(ReadLedger(&size, &inode_count));
+
+  mock_timer_.SleepMs(kCleanIntervalMs + 1);
+  RunClean();
+  EXPECT_EQ(1, started_cleanups_->Get());
+  ASSERT_TRUE(ReadLedger(&size, &inode_count));
+  GoogleString ledger = LedgerContents();
+  FileSystem::DirInfo dir_info;
+  file_system_.GetDirInfo(GTestTempDir(), &dir_info, &message_handler_);
+  // The ledger doesn't count itself.
+  EXPECT_EQ(dir_info.size_bytes - static_cast<int64>(ledger.size()), size);
+  EXPECT_EQ(dir_info.inode_count - 1, inode_count);
+  EXPECT_EQ(size, stats_.GetUpDownCounter(FileCache::kLedgerBytes)->Get());
+  EXPECT_EQ(inode_count,
+            stats_.GetUpDownCounter(FileCache::kLedgerInodes)->Get());
+
+  CheckPut("Name3", "Value3");    // New: 6 bytes, 1 inode.
+  CheckPut("Name1", "Value1.1");  // Replaced: 2 more bytes.
+  cache_->Delete("Name2");        // Deleted: 6 bytes, 1 inode fewer.
+  cache_->Delete("Name4");        // Never there.
+  mock_timer_.SleepMs(kCleanIntervalMs + 1);
+  RunClean();
+  EXPECT_EQ(1, started_cleanups_->Get());  // No more full scans.
+  EXPECT_EQ(2, stats_.GetVariable(FileCache::kCleanerSlices)->Get());
+  EXPECT_EQ(0, evictions_->Get());
+  int64 new_size, new_inode_count;
+  ASSERT_TRUE(ReadLedger(&new_size, &new_inode_count));
+  EXPECT_EQ(size + 2, new_size);
+  EXPECT_EQ(inode_count, new_inode_count);
+}
+
+// Once the ledger is known, growing past the target cleans straight away,
+// evicting the least recently used entries.
+TEST_F(FileCacheTest, IncrementalCleanEvictsWhenOverTarget) {
+  ResetFileCache(kCleanIntervalMs, 100 /* target_size_bytes */);
+  EnableIncrementalCleaning(Timer::kMinuteMs);
+  mock_timer_.SleepMs(kCleanIntervalMs + 1);
+  RunClean();  // Starts the ledger.
+  int64 size, inode_count;
+  ASSERT_TRUE(ReadLedger(&size, &inode_count));
+  EXPECT_EQ(1, stats_.GetVariable(FileCache::kCleanerSlices)->Get());
+
+  // Well within the cleaning interval, but the cache outgrows its target.
+  for (int i = 0; i < 10; ++i) {
+    CheckPut(StrCat("Name", IntegerToString(i)),
+             PaddedValue(i, 20));
+    WaitForWorker(&worker_);
+  }
+  EXPECT_LT(1, stats_.GetVariable(FileCache::kCleanerSlices)->Get());
+  EXPECT_LT(0, evictions_->Get());
+  EXPECT_LT(0, stats_.GetVariable(FileCache::kCleanerFilesSampled)->Get());
+  CheckNotFound("Name0");
+  CheckNotFound("Name1");
+  CheckGet("Name9", PaddedValue(9, 20));
+  ASSERT_TRUE(ReadLedger(&size, &inode_count));
+  EXPECT_GE(100, size);
+  FileSystem::DirInfo dir_info;
+  file_system_.GetDirInfo(GTestTempDir(), &dir_info, &message_handler_);
+  EXPECT_GE(100, dir_info.size_bytes);
+}
+
+// A slice stops evicting when its time is up, leaving the rest to later
+// slices.
+TEST_F(FileCacheTest, IncrementalCleanIsTimeBounded) {
+  // Only clean when we say so.
+  ResetFileCache(Timer::kHourMs, 1000);
+  EnableIncrementalCleaning(2 /* ms */);
+  for (int i = 0; i < 16; ++i) {
+    CheckPut(StrCat("Name", IntegerToString(i)), PaddedValue(i, 10));
+  }
+  // The Puts above are added to this.
+  WriteLedger("0 0");
+
+  // Every look at the clock takes a millisecond, and nothing else does.
+  file_system_.set_advance_time_on_update(false, &mock_timer_);
+  TickingTimer ticking_timer(&mock_timer_, Timer::kMsUs);
+  cache_->mutable_cache_policy()->timer = &ticking_timer;
+  EXPECT_TRUE(CleanIncrementally(40, 0));
+  int64 first_evictions = evictions_->Get();
+  EXPECT_LT(0, first_evictions);
+  EXPECT_GT(13, first_evictions);
+  EXPECT_EQ(16, stats_.GetVariable(FileCache::kCleanerFilesSampled)->Get());
+  CheckNotFound("Name0");
+  CheckGet("Name15", PaddedValue(15, 10));
+  int64 size, inode_count;
+  ASSERT_TRUE(ReadLedger(&size, &inode_count));
+  EXPECT_EQ(160 - 10 * first_evictions, size);
+  EXPECT_EQ(16 - first_evictions, inode_count);
+  EXPECT_EQ(1, stats_.GetHistogram(FileCache::kCleanerSliceLatencyUs)->Count());
+
+  // Later slices get the cache down to 75% of its target.
+  for (int i = 0; i < 16 && size > 30; ++i) {
+    EXPECT_TRUE(CleanIncrementally(40, 0));
+    ASSERT_TRUE(ReadLedger(&size, &inode_count));
+  }
+  cache_->mutable_cache_policy()->timer = &mock_timer_;
+  EXPECT_EQ(30, size);
+  EXPECT_EQ(3, inode_count);
+  CheckNotFound("Name12");
+  CheckGet("Name13", PaddedValue(13, 10));
+  CheckGet("Name15", PaddedValue(15, 10));
+}
+
+// If the ledger counts files that aren't there any more, it's recounted.
+TEST_F(FileCacheTest, IncrementalCleanRecountsStaleLedger) {
+  EnableIncrementalCleaning(Timer::kMinuteMs);
+  CheckPut("Name1", "Value1");
+  WriteLedger("1000000 1000");
+  cache_->Delete("Name1");
+  EXPECT_FALSE(CleanIncrementally(kTargetSize, kTargetInodeLimit));
+  int64 size, inode_count;
+  EXPECT_FALSE(ReadLedger(&size, &inode_count));
+
+  CheckPut("Name2", "Value2");
+  EXPECT_TRUE(CleanIncrementally(kTargetSize, kTargetInodeLimit));
+  ASSERT_TRUE(ReadLedger(&size, &inode_count));
+  EXPECT_EQ(6, size);
+  EXPECT_EQ(1, inode_count);
+}
+
+// Files in the uncleaned directory are neither counted nor evicted, by full or
+// incremental cleans.
+TEST_F(FileCacheTest, CleaningSkipsUncleanedPath) {
+  // As in Clean, make the "directory" entries, so mem_file_system recurses.
+  GoogleString uncleaned_dir = StrCat(cache_->uncleaned_path(), "/");
+  GoogleString other_dir = StrCat(uncleaned_dir, "other/");
+  GoogleString other_file = StrCat(other_dir, "file");
+  ASSERT_TRUE(file_system_.MakeDir(uncleaned_dir.c_str(), &message_handler_));
+  ASSERT_TRUE(file_system_.MakeDir(other_dir.c_str(), &message_handler_));
+  ASSERT_TRUE(file_system_.WriteFile(other_file.c_str(),
+                                     PaddedValue(0, 2 * kTargetSize),
+                                     &message_handler_));
+  CheckPut("Name1", "Value1");
+  mock_timer_.SleepMs(1);
+  CheckPut("Name2", "Value2");
+
+  int64 size, inode_count;
+  EXPECT_TRUE(Clean(kTargetSize + 1, kTargetInodeLimit, &size, &inode_count));
+  EXPECT_EQ(0, evictions_->Get());
+  EXPECT_EQ(12, size);
+  EXPECT_EQ(2, inode_count);
+
+  // Going over the target only evicts cache entries.
+  EnableIncrementalCleaning(Timer::kMinuteMs);
+  WriteLedger("12 2");
+  CheckPut("Name3", "Value3");
+  EXPECT_TRUE(CleanIncrementally(kTargetSize, kTargetInodeLimit));
+  EXPECT_LT(0, evictions_->Get());
+  CheckNotFound("Name1");
+  EXPECT_TRUE(
+      file_system_.Exists(other_file.c_str(), &message_handler_).is_true());
+  ASSERT_TRUE(ReadLedger(&size, &inode_count));
+  EXPECT_GE(kTargetSize, size);
+
+  EXPECT_TRUE(Clean(0, 0));
+  EXPECT_TRUE(
+      file_system_.Exists(other_file.c_str(), &message_handler_).is_true());
+}
+
+// Runs the cache against the real disk with io_uring enabled.  Where the
+// kernel or sandbox doesn't allow io_uring the cache falls back to the file
+// system, which these tests also cover.
+class FileCacheIoUringTest : public CacheTestBase {
+ protected:
+  FileCacheIoUringTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        worker_("cleaner", thread_system_.get()),
+        mock_timer_(thread_system_->NewMutex(), 0),
+        stats_(thread_system_.get()),
+        // A fresh directory for each test, so nothing is left from
+        // earlier runs.
+        path_(StrCat(GTestTempDir(), "/file_cache_io_uring_",
+                     IntegerToString(getpid()), "_",
+                     testing::UnitTest::GetInstance()
+                         ->current_test_info()
+                         ->name(),
+                     "/")) {
+    FileCache::InitStats(&stats_);
+    cache_ = NewCache();
+    cache_->EnableIoUring();
+    std::unique_ptr<IoUring> ring(IoUring::Create(8));
+    io_uring_available_ = (ring != nullptr);
+    if (!io_uring_available_) {
+      LOG(INFO) << "io_uring is unavailable; testing the fallback";
+    }
+  }
+
+  std::unique_ptr<FileCache> NewCache() {
+    return std::make_unique<FileCache>(
+        path_, &file_system_, thread_system_.get(), &worker_,
+        new FileCache::CachePolicy(&mock_timer_, &hasher_,
+                                   FileCache::kDisableCleaning, 0, 0),
+        &stats_, &message_handler_);
+  }
+
+  CacheInterface* Cache() override { return cache_.get(); }
+
+  int64 Batches() {
+    return stats_.GetVariable(FileCache::kIoUringBatches)->Get();
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  SlowWorker worker_;
+  MockTimer mock_timer_;
+  StdioFileSystem file_system_;
+  MD5Hasher hasher_;
+  SimpleStats stats_;
+  GoogleMessageHandler message_handler_;
+  GoogleString path_;
+  std::unique_ptr<FileCache> cache_;
+  bool io_uring_available_;
+};
+
+TEST_F(FileCacheIoUringTest, PutGetDelete) {
+  CheckNotFound("Name");
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+  CheckPut("Empty", "");
+  CheckGet("Empty", "");
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  if (io_uring_available_) {
+    EXPECT_LT(0, Batches());
+  }
+}
+
+TEST_F(FileCacheIoUringTest, MultiGet) {
+  TestMultiGet();
+}
+
+TEST_F(FileCacheIoUringTest, LargeBatch) {
+  // More keys than one ring submission holds, with some values larger
+  // than the default read size.
+  const int kNumKeys = 300;
+  for (int i = 0; i < kNumKeys; i += 2) {
+    CheckPut(StrCat("k", IntegerToString(i)),
+             GoogleString(i * 100, 'a' + i % 26));
+  }
+  std::vector<Callback*> callbacks;
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  for (int i = 0; i < kNumKeys; ++i) {
+    callbacks.push_back(AddCallback());
+    request->push_back(
+        CacheInterface::KeyCallback(StrCat("k", IntegerToString(i)),
+                                    callbacks.back()));
+  }
+  int64 batches = Batches();
+  cache_->MultiGet(request);
+  for (int i = 0; i < kNumKeys; ++i) {
+    if (i % 2 == 0) {
+      WaitAndCheck(callbacks[i], GoogleString(i * 100, 'a' + i % 26));
+    } else {
+      WaitAndCheckNotFound(callbacks[i]);
+    }
+  }
+  if (io_uring_available_) {
+    EXPECT_EQ(batches + 3, Batches());
+  }
+}
+
+TEST_F(FileCacheIoUringTest, InteroperatesWithFileSystem) {
+  // Values written through io_uring can be read without it, and vice versa.
+  std::unique_ptr<FileCache> plain_cache = NewCache();
+  CheckPut("Ring", "ring value");
+  CheckGet(plain_cache.get(), "Ring", "ring value");
+  CheckPut(plain_cache.get(), "Plain", "plain value");
+  CheckGet("Plain", "plain value");
+}
+
 }  // namespace net_instaweb
@@ -0,0 +1,119 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test the frequency sketch used by the LRU admission policy.
+
+#include "pagespeed/kernel/cache/frequency_sketch.h"
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class FrequencySketchTest : public testing::Test {
+ protected:
+  FrequencySketchTest() : sketch_(64) {}
+
+  void Touch(StringPiece key, int times) {
+    for (int i = 0; i < times; ++i) {
+      sketch_.Increment(FrequencySketch::HashKey(key));
+    }
+  }
+
+  int Frequency(StringPiece key) const {
+    return sketch_.Frequency(FrequencySketch::HashKey(key));
+  }
+
+  FrequencySketch sketch_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(FrequencySketchTest);
+};
+
+TEST_F(FrequencySketchTest, CapacityRoundsUp) {
+  EXPECT_EQ(static_cast<size_t>(64), sketch_.capacity());
+  EXPECT_EQ(static_cast<size_t>(640), sketch_.sample_size());
+  FrequencySketch tiny(3);
+  EXPECT_EQ(static_cast<size_t>(16), tiny.capacity());
+  FrequencySketch odd(100);
+  EXPECT_EQ(static_cast<size_t>(128), odd.capacity());
+}
+
+TEST_F(FrequencySketchTest, CountsAndSaturates) {
+  EXPECT_EQ(0, Frequency("a"));
+  Touch("a", 1);
+  EXPECT_EQ(1, Frequency("a"));
+  Touch("a", 4);
+  EXPECT_EQ(5, Frequency("a"));
+  Touch("a", 100);
+  EXPECT_EQ(FrequencySketch::kMaxFrequency, Frequency("a"));
+  EXPECT_EQ(0, Frequency("b"));
+}
+
+TEST_F(FrequencySketchTest, DistinguishesHotFromCold) {
+  for (int i = 0; i < 32; ++i) {
+    Touch(StrCat("cold", IntegerToString(i)), 1);
+  }
+  Touch("hot", 10);
+  EXPECT_LE(10, Frequency("hot"));
+  int total = 0;
+  for (int i = 0; i < 32; ++i) {
+    int frequency = Frequency(StrCat("cold", IntegerToString(i)));
+    EXPECT_LE(1, frequency);  // count-min never under-estimates.
+    total += frequency;
+  }
+  // Collisions can inflate a few estimates, but not most of them.
+  EXPECT_GT(64, total);
+}
+
+TEST_F(FrequencySketchTest, AgingHalvesCounts) {
+  Touch("a", FrequencySketch::kMaxFrequency);
+  EXPECT_EQ(FrequencySketch::kMaxFrequency, Frequency("a"));
+
+  // Feed distinct keys until the sample count wraps, which means the
+  // counters were halved.
+  size_t previous = sketch_.sample_count();
+  for (int i = 0; sketch_.sample_count() >= previous; ++i) {
+    previous = sketch_.sample_count();
+    Touch(StrCat("k", IntegerToString(i)), 1);
+  }
+  EXPECT_EQ(FrequencySketch::kMaxFrequency / 2, Frequency("a"));
+  EXPECT_GT(sketch_.sample_size(), sketch_.sample_count());
+}
+
+TEST_F(FrequencySketchTest, EnsureCapacity) {
+  Touch("a", 3);
+  sketch_.EnsureCapacity(10);  // Shrinking is a no-op.
+  EXPECT_EQ(static_cast<size_t>(64), sketch_.capacity());
+  EXPECT_EQ(3, Frequency("a"));
+
+  sketch_.EnsureCapacity(1000);
+  EXPECT_EQ(static_cast<size_t>(1024), sketch_.capacity());
+  EXPECT_EQ(0, Frequency("a"));
+  EXPECT_EQ(static_cast<size_t>(0), sketch_.sample_count());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,245 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test the log-structured file cache.
+#include "pagespeed/kernel/cache/log_structured_file_cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/google_message_handler.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/cache/cache_test_base.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int64 kSegmentSize = 4096;
+const int64 kTargetSize = 4 * kSegmentSize;
+
+}  // namespace
+
+class LogStructuredFileCacheTest : public CacheTestBase {
+ protected:
+  LogStructuredFileCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()),
+        path_(StrCat(GTestTempDir(), "/log_structured_file_cache")) {
+    LogStructuredFileCache::InitStats(&stats_);
+  }
+
+  void SetUp() override {
+    RemoveFiles(".seg");
+    RemoveFiles(".idx");
+    ResetCache();
+  }
+
+  void ResetCache() { cache_.reset(NewCache()); }
+
+  LogStructuredFileCache* NewCache() {
+    return new LogStructuredFileCache(path_, kTargetSize, kSegmentSize,
+                                      thread_system_.get(), &stats_,
+                                      &message_handler_);
+  }
+
+  CacheInterface* Cache() override { return cache_.get(); }
+
+  // Returns the number of files in the cache directory ending in suffix,
+  // deleting them if remove is set.
+  int CountFiles(const char* suffix, bool remove) {
+    int count = 0;
+    DIR* dir = opendir(path_.c_str());
+    if (dir == nullptr) {
+      return 0;
+    }
+    for (struct dirent* entry; (entry = readdir(dir)) != nullptr;) {
+      if (StringPiece(entry->d_name).ends_with(suffix)) {
+        ++count;
+        if (remove) {
+          unlink(StrCat(path_, "/", entry->d_name).c_str());
+        }
+      }
+    }
+    closedir(dir);
+    return count;
+  }
+  int CountFiles(const char* suffix) { return CountFiles(suffix, false); }
+  void RemoveFiles(const char* suffix) { CountFiles(suffix, true); }
+
+  // Overwrites bytes of a file in the cache directory.
+  void Scribble(const char* name, int64 offset, int count) {
+    int fd = open(StrCat(path_, "/", name).c_str(), O_WRONLY);
+    ASSERT_LE(0, fd);
+    GoogleString junk(count, '\xa5');
+    EXPECT_EQ(count, pwrite(fd, junk.data(), count, offset));
+    close(fd);
+  }
+
+  int64 Stat(const char* name) {
+    return stats_.GetVariable(name)->Get();
+  }
+
+  // Puts 1k values under keys "0".."count-1".
+  void PutValues(int count) {
+    for (int i = 0; i < count; ++i) {
+      CheckPut(IntegerToString(i), Value(i));
+    }
+  }
+
+  GoogleString Value(int i) {
+    return StrCat(IntegerToString(i), GoogleString(1000, 'v'));
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  GoogleMessageHandler message_handler_;
+  GoogleString path_;
+  std::unique_ptr<LogStructuredFileCache> cache_;
+};
+
+TEST_F(LogStructuredFileCacheTest, PutGetDelete) {
+  CheckNotFound("Name");
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+  CheckPut("Empty", "");
+  CheckGet("Empty", "");
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  CheckGet("Empty", "");
+  EXPECT_EQ(1, CountFiles(".seg"));
+}
+
+TEST_F(LogStructuredFileCacheTest, NothingWrittenBeforeFirstUse) {
+  EXPECT_EQ(0, CountFiles(".seg"));
+  CheckNotFound("Name");
+  EXPECT_EQ(0, CountFiles(".seg"));
+  CheckPut("Name", "Value");
+  EXPECT_EQ(1, CountFiles(".seg"));
+}
+
+TEST_F(LogStructuredFileCacheTest, SegmentSizes) {
+  EXPECT_EQ(4, cache_->max_segments());
+  EXPECT_EQ(kSegmentSize, cache_->segment_size());
+  EXPECT_EQ(1 << 20, LogStructuredFileCache::DefaultSegmentSize(1000));
+  EXPECT_EQ(int64{64} << 20,
+            LogStructuredFileCache::DefaultSegmentSize(int64{1} << 30));
+  EXPECT_EQ(int64{256} << 20,
+            LogStructuredFileCache::DefaultSegmentSize(int64{100} << 30));
+}
+
+TEST_F(LogStructuredFileCacheTest, EvictsOldestSegments) {
+  // Four 1k values fill a segment, so this fills eight.
+  PutValues(30);
+  EXPECT_EQ(4, CountFiles(".seg"));
+  EXPECT_LT(0, Stat(LogStructuredFileCache::kSegmentEvictions));
+  CheckNotFound("0");
+  CheckNotFound("10");
+  for (int i = 25; i < 30; ++i) {
+    CheckGet(IntegerToString(i), Value(i));
+  }
+  // All but the two newest segments are sealed with an index file.
+  EXPECT_EQ(2, CountFiles(".idx"));
+}
+
+TEST_F(LogStructuredFileCacheTest, SkipsOversizedValues) {
+  CheckPut("Big", GoogleString(kSegmentSize / 2, 'x'));
+  CheckNotFound("Big");
+  EXPECT_EQ(1, Stat(LogStructuredFileCache::kSkippedPuts));
+}
+
+TEST_F(LogStructuredFileCacheTest, RecoversAfterRestart) {
+  // The Delete starts a fifth segment, evicting the first.
+  PutValues(16);
+  CheckDelete("15");
+  ResetCache();
+  CheckNotFound("3");
+  for (int i = 4; i < 15; ++i) {
+    CheckGet(IntegerToString(i), Value(i));
+  }
+  CheckNotFound("15");
+  EXPECT_EQ(0, Stat(LogStructuredFileCache::kCorruptRecords));
+}
+
+TEST_F(LogStructuredFileCacheTest, RebuildsDamagedIndex) {
+  PutValues(16);
+  ASSERT_EQ(2, CountFiles(".idx"));
+  cache_.reset();
+  Scribble("0000000000000002.idx", 30, 8);
+  ResetCache();
+  for (int i = 0; i < 16; ++i) {
+    CheckGet(IntegerToString(i), Value(i));
+  }
+}
+
+TEST_F(LogStructuredFileCacheTest, SkipsDamagedRecord) {
+  // Each record is a 16-byte header, the key and the value, padded to 8
+  // bytes, so "b" starts at 16 + 1 + 100 rounded up, i.e. 120.
+  GoogleString value(100, 'x');
+  CheckPut("a", value);
+  CheckPut("b", value);
+  CheckPut("c", value);
+  cache_.reset();
+  Scribble("0000000000000001.seg", 120 + 40, 4);
+  ResetCache();
+  CheckGet("a", value);
+  CheckNotFound("b");
+  CheckGet("c", value);
+  EXPECT_EQ(1, Stat(LogStructuredFileCache::kCorruptRecords));
+
+  // A torn record at the end of the log is skipped once more data follows.
+  Scribble("0000000000000001.seg", 360, 16);
+  CheckPut("d", value);
+  CheckGet("d", value);
+}
+
+TEST_F(LogStructuredFileCacheTest, InstancesShareDirectory) {
+  // Two caches on the same directory behave like two processes.
+  std::unique_ptr<LogStructuredFileCache> other(NewCache());
+  CheckPut("Name", "Value");
+  CheckGet(other.get(), "Name", "Value");
+  other->Delete("Name");
+  CheckNotFound("Name");
+
+  // Both follow the other's segment rolls and evictions.
+  PutValues(30);
+  for (int i = 25; i < 30; ++i) {
+    CheckGet(other.get(), IntegerToString(i), Value(i));
+  }
+  for (int i = 30; i < 40; ++i) {
+    CheckPut(other.get(), IntegerToString(i), Value(i));
+  }
+  CheckNotFound("20");
+  CheckGet("39", Value(39));
+  EXPECT_EQ(4, CountFiles(".seg"));
+}
+
+}  // namespace net_instaweb
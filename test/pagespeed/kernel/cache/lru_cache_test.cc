@@ -23,15 +23,32 @@
 
 #include <cstddef>
 
+#include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "test/pagespeed/kernel/base/gtest.h"
 #include "test/pagespeed/kernel/cache/cache_test_base.h"
 
 namespace {
 const size_t kMaxSize = 100;
+// Large enough that the admission window holds an entry.
+const size_t kAdmissionMaxSize = 1000;
 }
 
 namespace net_instaweb {
 
+class SizedAnnotation : public SharedString::Annotation {
+ public:
+  explicit SizedAnnotation(size_t size) : size_(size) {}
+  size_t size() const override { return size_; }
+
+ private:
+  ~SizedAnnotation() override {}
+
+  size_t size_;
+};
+
 class LRUCacheTest : public CacheTestBase {
  protected:
   LRUCacheTest() : cache_(kMaxSize) {}
@@ -213,4 +230,129 @@ TEST_F(LRUCacheTest, DoesNotDeleteWithPrefixWhenUnhealthy) {
   CheckGet("nameA", "valueA");
 }
 
+TEST_F(LRUCacheTest, ChargesForAnnotation) {
+  SharedString value("Value");
+  value.set_annotation(new SizedAnnotation(20));
+  cache_.Put("Name", value);
+  EXPECT_EQ(static_cast<size_t>(29), cache_.size_bytes());
+
+  // Dropping the annotation by mutating the shared storage leaves the entry
+  // charged as it was when it went in, so the byte count stays balanced.
+  value.Append("!");
+  EXPECT_TRUE(value.annotation() == nullptr);
+  cache_.SanityCheck();
+  EXPECT_EQ(static_cast<size_t>(29), cache_.size_bytes());
+  cache_.Delete("Name");
+  EXPECT_EQ(static_cast<size_t>(0), cache_.size_bytes());
+}
+
+class LRUCacheAdmissionTest : public CacheTestBase {
+ protected:
+  LRUCacheAdmissionTest() : cache_(kAdmissionMaxSize) {
+    cache_.EnableAdmissionPolicy();
+  }
+
+  CacheInterface* Cache() override { return &cache_; }
+  void PostOpCleanup() override { cache_.SanityCheck(); }
+
+  // Puts count 10-byte entries named prefix0, prefix1, ... into cache.
+  static void PutRange(LRUCache* cache, const char* prefix, int count) {
+    for (int i = 0; i < count; ++i) {
+      GoogleString key = StrCat(prefix, IntegerToString(i));
+      cache->Put(key, SharedString(GoogleString(10 - key.size(), 'v')));
+    }
+  }
+  void PutRange(const char* prefix, int count) {
+    PutRange(&cache_, prefix, count);
+  }
+
+  // Returns how many of prefix0 .. prefix<count-1> are in cache.  This
+  // counts as an access for each of them.
+  static int CountPresent(LRUCache* cache, const char* prefix, int count) {
+    int present = 0;
+    for (int i = 0; i < count; ++i) {
+      CacheInterface::SynchronousCallback callback;
+      cache->Get(StrCat(prefix, IntegerToString(i)), &callback);
+      if (callback.called() &&
+          (callback.state() == CacheInterface::kAvailable)) {
+        ++present;
+      }
+    }
+    return present;
+  }
+
+  LRUCache cache_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(LRUCacheAdmissionTest);
+};
+
+TEST_F(LRUCacheAdmissionTest, PutGetDelete) {
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+  EXPECT_EQ(static_cast<size_t>(12), cache_.size_bytes());
+  EXPECT_EQ(static_cast<size_t>(1), cache_.num_elements());
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  EXPECT_EQ(static_cast<size_t>(0), cache_.size_bytes());
+}
+
+TEST_F(LRUCacheAdmissionTest, ScanDoesNotEvictPopularEntries) {
+  // 50 popular entries, each read a few times, then a scan over 10x the
+  // cache capacity with each key touched once.
+  PutRange("hot", 50);
+  for (int round = 0; round < 3; ++round) {
+    EXPECT_EQ(50, CountPresent(&cache_, "hot", 50));
+  }
+  PutRange("s", 1000);
+  cache_.SanityCheck();
+  EXPECT_LT(static_cast<size_t>(0), cache_.num_admission_rejections());
+  EXPECT_GE(kAdmissionMaxSize, cache_.size_bytes());
+  EXPECT_EQ(50, CountPresent(&cache_, "hot", 50));
+
+  // The same workload flushes a plain LRU.
+  LRUCache plain(kAdmissionMaxSize);
+  PutRange(&plain, "hot", 50);
+  for (int round = 0; round < 3; ++round) {
+    EXPECT_EQ(50, CountPresent(&plain, "hot", 50));
+  }
+  PutRange(&plain, "s", 1000);
+  EXPECT_EQ(0, CountPresent(&plain, "hot", 50));
+  EXPECT_EQ(static_cast<size_t>(0), plain.num_admission_rejections());
+}
+
+TEST_F(LRUCacheAdmissionTest, NewWorkingSetTakesOver) {
+  // Admission is based on recent popularity, so once the old working set
+  // stops being read and a new one is, the new one takes over.
+  PutRange("old", 100);
+  for (int round = 0; round < 3; ++round) {
+    CountPresent(&cache_, "old", 100);
+  }
+  for (int round = 0; round < 10; ++round) {
+    PutRange("new", 100);
+    CountPresent(&cache_, "new", 100);
+  }
+  EXPECT_LT(90, CountPresent(&cache_, "new", 100));
+}
+
+TEST_F(LRUCacheAdmissionTest, ReplaceKeepsEntry) {
+  PutRange("k", 100);
+  CheckGet("k5", "vvvvvvvv");
+  CheckPut("k5", "replaced");
+  CheckGet("k5", "replaced");
+  CheckPut("k5", "replaced, and now much longer than before");
+  CheckGet("k5", "replaced, and now much longer than before");
+  EXPECT_GE(kAdmissionMaxSize, cache_.size_bytes());
+}
+
+TEST_F(LRUCacheAdmissionTest, TooBigToFit) {
+  CheckPut("big", GoogleString(kAdmissionMaxSize, 'x'));
+  CheckNotFound("big");
+  EXPECT_EQ(static_cast<size_t>(0), cache_.num_elements());
+}
+
+TEST_F(LRUCacheAdmissionTest, MultiGet) { TestMultiGet(); }
+
 }  // namespace net_instaweb
@@ -0,0 +1,240 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test the sharded lru cache.
+
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
+
+#include <cstddef>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/cache/cache_spammer.h"
+#include "test/pagespeed/kernel/cache/cache_test_base.h"
+
+namespace {
+const size_t kMaxSize = 100;
+const int kNumShards = 4;
+const int kNumThreads = 4;
+const int kNumIters = 10000;
+const int kNumInserts = 10;
+}  // namespace
+
+namespace net_instaweb {
+
+class ShardedLRUCacheTest : public CacheTestBase {
+ protected:
+  ShardedLRUCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        cache_(new ShardedLRUCache(kMaxSize, kNumShards,
+                                   thread_system_.get())) {}
+
+  CacheInterface* Cache() override { return cache_.get(); }
+  void PostOpCleanup() override { cache_->SanityCheck(); }
+
+  void ResetCache(size_t max_size, int num_shards) {
+    cache_ = std::make_unique<ShardedLRUCache>(max_size, num_shards,
+                                               thread_system_.get());
+  }
+
+  void SpamHelper(bool expecting_evictions, bool do_deletes,
+                  const char* value_pattern) {
+    CacheSpammer::RunTests(kNumThreads, kNumIters, kNumInserts,
+                           expecting_evictions, do_deletes, value_pattern,
+                           cache_.get(), thread_system_.get());
+    cache_->SanityCheck();
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  std::unique_ptr<ShardedLRUCache> cache_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ShardedLRUCacheTest);
+};
+
+// Callback that writes back into the cache from its validator.  With
+// ThreadsafeCache that would self-deadlock, since the lock is held across
+// the validator.
+class ReentrantCallback : public CacheTestBase::Callback {
+ public:
+  explicit ReentrantCallback(CacheInterface* cache) : cache_(cache) {}
+
+  bool ValidateCandidate(const GoogleString& key,
+                         CacheInterface::KeyState state) override {
+    SharedString refreshed("refreshed");
+    cache_->Put(key, refreshed);
+    return Callback::ValidateCandidate(key, state);
+  }
+
+ private:
+  CacheInterface* cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReentrantCallback);
+};
+
+TEST_F(ShardedLRUCacheTest, PutGetDelete) {
+  EXPECT_EQ(static_cast<size_t>(0), cache_->size_bytes());
+  EXPECT_EQ(static_cast<size_t>(0), cache_->num_elements());
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  EXPECT_EQ(static_cast<size_t>(9), cache_->size_bytes());  // "Name" + "Value"
+  EXPECT_EQ(static_cast<size_t>(1), cache_->num_elements());
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+  EXPECT_EQ(static_cast<size_t>(12),
+            cache_->size_bytes());  // "Name" + "NewValue"
+  EXPECT_EQ(static_cast<size_t>(1), cache_->num_elements());
+
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  EXPECT_EQ(static_cast<size_t>(0), cache_->size_bytes());
+  EXPECT_EQ(static_cast<size_t>(0), cache_->num_elements());
+}
+
+TEST_F(ShardedLRUCacheTest, AggregatedStats) {
+  EXPECT_EQ(kNumShards, cache_->num_shards());
+  EXPECT_EQ(kMaxSize, cache_->max_bytes_in_cache());
+  for (int i = 0; i < 8; ++i) {
+    CheckPut(StrCat("k", IntegerToString(i)), "v");
+  }
+  EXPECT_EQ(static_cast<size_t>(8), cache_->num_elements());
+  EXPECT_EQ(static_cast<size_t>(8), cache_->num_inserts());
+  EXPECT_EQ(static_cast<size_t>(24), cache_->size_bytes());
+  for (int i = 0; i < 8; ++i) {
+    CheckGet(StrCat("k", IntegerToString(i)), "v");
+    CheckNotFound(StrCat("m", IntegerToString(i)).c_str());
+  }
+  EXPECT_EQ(static_cast<size_t>(8), cache_->num_hits());
+  EXPECT_EQ(static_cast<size_t>(8), cache_->num_misses());
+  CheckPut("k0", "v");
+  EXPECT_EQ(static_cast<size_t>(1), cache_->num_identical_reinserts());
+  CheckDelete("k1");
+  EXPECT_EQ(static_cast<size_t>(1), cache_->num_deletes());
+
+  cache_->ClearStats();
+  EXPECT_EQ(static_cast<size_t>(0), cache_->num_hits());
+  EXPECT_EQ(static_cast<size_t>(7), cache_->num_elements());
+  cache_->Clear();
+  EXPECT_EQ(static_cast<size_t>(0), cache_->num_elements());
+  EXPECT_EQ(static_cast<size_t>(0), cache_->size_bytes());
+}
+
+TEST_F(ShardedLRUCacheTest, DeleteWithPrefix) {
+  CheckPut("N1", "Value1");
+  CheckPut("N2", "Value2");
+  CheckPut("M3", "Value3");
+  CheckPut("M4", "Value4");
+  cache_->DeleteWithPrefixForTesting("N");
+  EXPECT_EQ(static_cast<size_t>(16), cache_->size_bytes());
+  CheckNotFound("N1");
+  CheckNotFound("N2");
+  CheckGet("M3", "Value3");
+  CheckGet("M4", "Value4");
+}
+
+// With a single shard the cache must behave exactly like LRUCache.
+TEST_F(ShardedLRUCacheTest, SingleShardIsLeastRecentlyUsed) {
+  ResetCache(kMaxSize, 1);
+  for (int i = 0; i < 10; ++i) {
+    CheckPut(StrCat("name", IntegerToString(i)),
+             StrCat("valu", IntegerToString(i)));
+  }
+  EXPECT_EQ(kMaxSize, cache_->size_bytes());
+  CheckGet("name0", "valu0");
+  CheckPut("nameA", "valuA");
+  CheckGet("name0", "valu0");
+  CheckNotFound("name1");
+  EXPECT_EQ(static_cast<size_t>(1), cache_->num_evictions());
+}
+
+// Each shard enforces its own share of the budget, so the whole cache
+// never exceeds max_size no matter how keys hash.
+TEST_F(ShardedLRUCacheTest, PerShardBudget) {
+  for (int i = 0; i < 100; ++i) {
+    CheckPut(StrCat("name", IntegerToString(i)), "value");
+    EXPECT_GE(kMaxSize, cache_->size_bytes());
+  }
+  EXPECT_LT(static_cast<size_t>(0), cache_->num_evictions());
+  EXPECT_EQ(static_cast<size_t>(100),
+            cache_->num_elements() + cache_->num_evictions());
+}
+
+TEST_F(ShardedLRUCacheTest, InvalidValue) {
+  CheckPut("nameA", "valueA");
+  set_invalid_value("valueA");
+  CheckNotFound("nameA");
+}
+
+TEST_F(ShardedLRUCacheTest, ValidatorMayReenterCache) {
+  CheckPut("Name", "Value");
+  ReentrantCallback callback(cache_.get());
+  cache_->Get("Name", &callback);
+  EXPECT_TRUE(callback.called());
+  EXPECT_EQ(CacheInterface::kAvailable, callback.state());
+  EXPECT_EQ(GoogleString("Value"), callback.value().Value());
+  CheckGet("Name", "refreshed");
+}
+
+TEST_F(ShardedLRUCacheTest, ShutDown) {
+  CheckPut("Name", "Value");
+  EXPECT_TRUE(cache_->IsHealthy());
+  cache_->ShutDown();
+  EXPECT_FALSE(cache_->IsHealthy());
+  CheckNotFound("Name");
+  CheckPut("Other", "Value");
+  cache_->set_is_healthy(true);
+  CheckGet("Name", "Value");
+  CheckNotFound("Other");
+}
+
+TEST_F(ShardedLRUCacheTest, MultiGet) {
+  TestMultiGet();
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheNoEvictionsOrDeletions) {
+  // 10 inserts of "valu%d" plus a 5-byte key is 100 bytes in total, but
+  // the keys do not split evenly across shards, so use a cache large
+  // enough that no shard overflows.
+  ResetCache(kMaxSize * kNumShards, kNumShards);
+  SpamHelper(false, false, "valu");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithEvictions) {
+  SpamHelper(true, false, "value");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithDeletions) {
+  ResetCache(kMaxSize * kNumShards, kNumShards);
+  SpamHelper(false, true, "valu");
+}
+
+TEST_F(ShardedLRUCacheTest, SpamCacheWithDeletionsAndEvictions) {
+  SpamHelper(true, true, "value");
+}
+
+}  // namespace net_instaweb
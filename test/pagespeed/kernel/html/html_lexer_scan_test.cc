@@ -0,0 +1,297 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit tests for HtmlLexerScan, and for the lexer's use of it to skip over
+// text that cannot change the lexer state.
+
+#include "pagespeed/kernel/html/html_lexer_scan.h"
+
+#include <algorithm>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/empty_html_filter.h"
+#include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_node.h"
+#include "pagespeed/kernel/html/html_parse.h"
+#include "pagespeed/kernel/util/simple_random.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/base/mock_message_handler.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const HtmlLexerScan::Implementation kImplementations[] = {
+    HtmlLexerScan::kPortable,
+    HtmlLexerScan::kSse2,
+    HtmlLexerScan::kAvx2,
+};
+
+// Straightforward reference implementation of FindFirstOf.
+size_t ReferenceFindFirstOf(StringPiece text, StringPiece stops) {
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (stops.find(text[i]) != StringPiece::npos) {
+      return i;
+    }
+  }
+  return text.size();
+}
+
+class HtmlLexerScanTest : public testing::Test {
+ protected:
+  HtmlLexerScanTest() : random_(new NullMutex) {}
+
+  // Checks FindFirstOf and CountChar against the reference results for
+  // every supported implementation, and every prefix and suffix of text so
+  // that the vector loops are exercised at all alignments and tail sizes.
+  void CheckAllImplementations(StringPiece text, StringPiece stops) {
+    for (HtmlLexerScan::Implementation impl : kImplementations) {
+      if (!HtmlLexerScan::IsSupported(impl)) {
+        continue;
+      }
+      for (size_t start = 0; start <= text.size(); ++start) {
+        StringPiece suffix = text.substr(start);
+        EXPECT_EQ(ReferenceFindFirstOf(suffix, stops),
+                  HtmlLexerScan::FindFirstOfUsing(impl, suffix.data(),
+                                                  suffix.size(), stops.data(),
+                                                  stops.size()))
+            << "impl=" << impl << " start=" << start;
+        StringPiece prefix = text.substr(0, start);
+        EXPECT_EQ(std::count(prefix.begin(), prefix.end(), stops[0]),
+                  HtmlLexerScan::CountCharUsing(impl, prefix.data(),
+                                                prefix.size(), stops[0]))
+            << "impl=" << impl << " start=" << start;
+      }
+    }
+  }
+
+  GoogleString RandomText(int size, StringPiece alphabet) {
+    GoogleString text;
+    for (int i = 0; i < size; ++i) {
+      text += alphabet[random_.Next() % alphabet.size()];
+    }
+    return text;
+  }
+
+  SimpleRandom random_;
+};
+
+TEST_F(HtmlLexerScanTest, PortableAlwaysSupported) {
+  EXPECT_TRUE(HtmlLexerScan::IsSupported(HtmlLexerScan::kPortable));
+  EXPECT_TRUE(HtmlLexerScan::IsSupported(HtmlLexerScan::best_implementation()));
+}
+
+TEST_F(HtmlLexerScanTest, EmptyInput) {
+  for (HtmlLexerScan::Implementation impl : kImplementations) {
+    if (HtmlLexerScan::IsSupported(impl)) {
+      EXPECT_EQ(0, HtmlLexerScan::FindFirstOfUsing(impl, "", 0, "<", 1));
+      EXPECT_EQ(0, HtmlLexerScan::CountCharUsing(impl, "", 0, '\n'));
+    }
+  }
+}
+
+TEST_F(HtmlLexerScanTest, NoStop) {
+  CheckAllImplementations(GoogleString(100, 'x'), "<");
+  CheckAllImplementations(GoogleString(100, 'x'), "-> /\t\n\r\f");
+}
+
+TEST_F(HtmlLexerScanTest, SingleStop) {
+  GoogleString text(100, 'x');
+  text[37] = '<';
+  text[70] = '<';
+  CheckAllImplementations(text, "<");
+}
+
+TEST_F(HtmlLexerScanTest, HighBitBytes) {
+  // Make sure signed-char comparisons do not confuse the vector code.
+  GoogleString text(80, '\xe9');
+  text[50] = '\x80';
+  CheckAllImplementations(text, "\x80");
+  CheckAllImplementations(text, "<\x80");
+}
+
+TEST_F(HtmlLexerScanTest, RandomMultipleStops) {
+  for (int i = 0; i < 20; ++i) {
+    GoogleString text = RandomText(150, "abcdefghijklmnop-> /\t\n\"'");
+    CheckAllImplementations(text, "\n");
+    CheckAllImplementations(text, "\"");
+    CheckAllImplementations(text, "-> /\t\n\r\f");
+  }
+}
+
+// Records every parser event in enough detail, including line numbers, that
+// any change in lexer behavior shows up as a difference in buffer().
+class EventRecorder : public EmptyHtmlFilter {
+ public:
+  EventRecorder() {}
+
+  void StartElement(HtmlElement* element) override {
+    StrAppend(&buffer_, "+", element->name_str(), "@",
+              IntegerToString(element->begin_line_number()));
+    for (const HtmlElement::Attribute& attr : element->attributes()) {
+      const char* value = attr.escaped_value();
+      StrAppend(&buffer_, " ", attr.name_str(), "=", attr.quote_str(),
+                (value == nullptr) ? "<null>" : value, attr.quote_str());
+    }
+    buffer_ += "\n";
+  }
+  void EndElement(HtmlElement* element) override {
+    StrAppend(&buffer_, "-", element->name_str(), "@",
+              IntegerToString(element->end_line_number()), " style=",
+              IntegerToString(element->style()), "\n");
+  }
+  void Cdata(HtmlCdataNode* cdata) override {
+    StrAppend(&buffer_, "cdata:", cdata->contents(), "\n");
+  }
+  void Comment(HtmlCommentNode* comment) override {
+    StrAppend(&buffer_, "comment:", comment->contents(), "\n");
+  }
+  void IEDirective(HtmlIEDirectiveNode* directive) override {
+    StrAppend(&buffer_, "ie:", directive->contents(), "\n");
+  }
+  void Characters(HtmlCharactersNode* characters) override {
+    StrAppend(&buffer_, "chars:", characters->contents(), "\n");
+  }
+  void Directive(HtmlDirectiveNode* directive) override {
+    StrAppend(&buffer_, "directive:", directive->contents(), "\n");
+  }
+  const char* Name() const override { return "EventRecorder"; }
+
+  const GoogleString& buffer() const { return buffer_; }
+  void Clear() { buffer_.clear(); }
+
+ private:
+  GoogleString buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventRecorder);
+};
+
+class HtmlLexerFastScanTest : public HtmlLexerScanTest {
+ protected:
+  HtmlLexerFastScanTest()
+      : message_handler_(new NullMutex), html_parse_(&message_handler_) {
+    html_parse_.AddFilter(&recorder_);
+  }
+
+  // Parses html, split into chunks of at most max_chunk bytes (or in one
+  // piece if max_chunk is 0), and returns the recorded events.
+  GoogleString ParseEvents(StringPiece html, bool fast_scan, int max_chunk) {
+    recorder_.Clear();
+    html_parse_.set_lexer_fast_scan_enabled(fast_scan);
+    html_parse_.StartParse("http://example.com/fast_scan.html");
+    if (max_chunk == 0) {
+      html_parse_.ParseText(html);
+    } else {
+      while (!html.empty()) {
+        int chunk = 1 + random_.Next() % max_chunk;
+        StringPiece piece = html.substr(0, chunk);
+        html_parse_.ParseText(piece);
+        html.remove_prefix(piece.size());
+      }
+    }
+    html_parse_.FinishParse();
+    return recorder_.buffer();
+  }
+
+  void ExpectSameEvents(StringPiece html) {
+    GoogleString expected = ParseEvents(html, false, 0);
+    EXPECT_EQ(expected, ParseEvents(html, true, 0)) << html;
+    EXPECT_EQ(expected, ParseEvents(html, true, 7)) << html;
+    EXPECT_EQ(expected, ParseEvents(html, true, 40)) << html;
+  }
+
+  MockMessageHandler message_handler_;
+  HtmlParse html_parse_;
+  EventRecorder recorder_;
+};
+
+TEST_F(HtmlLexerFastScanTest, TextAndTags) {
+  ExpectSameEvents(
+      "<html>\n<body>\nSome long text that goes on\nfor a while <b>bold</b>"
+      " and a stray > and a tail</body>\n</html>\n");
+}
+
+TEST_F(HtmlLexerFastScanTest, Comments) {
+  ExpectSameEvents(
+      "<!-- simple -->\n<!-- has - single and -- double dashes -->"
+      "<!-- ends with dashes --->\n<!--[if IE]><p>x</p><![endif]-->"
+      "<!-- unterminated");
+}
+
+TEST_F(HtmlLexerFastScanTest, Cdata) {
+  ExpectSameEvents(
+      "<![CDATA[ a ] b ]] c ]]]>\n<![CDATA[\nmulti\nline]]><![CDATA[ open");
+}
+
+TEST_F(HtmlLexerFastScanTest, Attributes) {
+  ExpectSameEvents(
+      "<a href=\"http://x.com/a?b=c&amp;d\" title='it\"s'\n"
+      "   data-x=\"multi\nline\" checked unquoted=v>link</a>"
+      "<img src='unterminated>");
+}
+
+TEST_F(HtmlLexerFastScanTest, DirectivesAndBogusComments) {
+  ExpectSameEvents(
+      "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\">\n"
+      "<?xml version=\"1.0\"?>\n</?bogus stuff>text<!doctype");
+}
+
+TEST_F(HtmlLexerFastScanTest, LiteralTags) {
+  ExpectSameEvents(
+      "<style>\nbody > p { color: red; }\n</style>"
+      "<textarea>a <b>not bold</b> </TEXTAREA >\n</textarea>"
+      "<title>t</title><xmp><p></xmp><iframe>x</iframe>");
+}
+
+TEST_F(HtmlLexerFastScanTest, Scripts) {
+  ExpectSameEvents(
+      "<script>\nvar a = b > c && d-- - e;\nif (x</y) {}\n</script>"
+      "<script>document.write('<!--<script>');</script>x</script>"
+      "--></script>"
+      "<script> a </script\t>"
+      "<script> b </SCRIPT/>"
+      "<script>c</script foo=bar>after"
+      "<script><!-- <script> --></script><p>end");
+}
+
+TEST_F(HtmlLexerFastScanTest, RandomDocuments) {
+  // Random soup of fragments chosen to hit every lexer state transition.
+  static const char* const kFragments[] = {
+      "<", ">", "/", "-", "--", "!", "?", "]", "]]", "[", "=", "\"", "'",
+      " ", "\n", "\t", "\r", "\f", "a", "t", "T", "text ", "<p>", "</p>",
+      "<div id=x class=\"c\">", "</div>", "<!--", "-->", "<![CDATA[", "]]>",
+      "<!DOCTYPE html>", "<?pi?>", "<script>", "</script>", "<SCRIPT ",
+      "</script ", "<style>", "</style>", "<textarea>", "</textarea>",
+      "<br/>", "<img src='", "<a href=\"", "\xe9\x80", "&amp;",
+  };
+  for (int doc = 0; doc < 200; ++doc) {
+    GoogleString html;
+    for (int i = 0; i < 60; ++i) {
+      html += kFragments[random_.Next() % arraysize(kFragments)];
+    }
+    ExpectSameEvents(html);
+  }
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,265 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit tests for HtmlObjectPool, and for HtmlParse's use of it.
+
+#include "pagespeed/kernel/html/html_object_pool.h"
+
+#include <list>
+#include <set>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/html/empty_html_filter.h"
+#include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_name.h"
+#include "pagespeed/kernel/html/html_parse.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/html/html_parse_test_base.h"
+
+namespace net_instaweb {
+
+namespace {
+
+typedef std::list<int, HtmlObjectPool::Allocator<int> > PooledIntList;
+
+TEST(HtmlObjectPoolTest, RecyclesBlocks) {
+  HtmlObjectPool pool;
+  void* a = pool.Allocate(24);
+  void* b = pool.Allocate(24);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(a) % HtmlObjectPool::kAlign);
+  EXPECT_EQ(2, pool.num_live_blocks());
+  EXPECT_EQ(HtmlObjectPool::kChunkSize, pool.bytes_reserved());
+
+  // A freed block is the next one handed out for the same size class.
+  HtmlObjectPool::Free(a);
+  EXPECT_EQ(1, pool.num_live_blocks());
+  EXPECT_EQ(a, pool.Allocate(20));
+  HtmlObjectPool::Free(a);
+  HtmlObjectPool::Free(b);
+  EXPECT_EQ(0, pool.num_live_blocks());
+}
+
+TEST(HtmlObjectPoolTest, SizeClassesDoNotOverlap) {
+  HtmlObjectPool pool;
+  std::set<char*> blocks;
+  for (size_t size = 0; size <= HtmlObjectPool::kMaxPooledSize; ++size) {
+    char* block = static_cast<char*>(pool.Allocate(size));
+    memset(block, 'x', size);
+    EXPECT_TRUE(blocks.insert(block).second);
+  }
+  EXPECT_EQ(static_cast<int64>(blocks.size()), pool.num_live_blocks());
+  for (char* block : blocks) {
+    HtmlObjectPool::Free(block);
+  }
+  EXPECT_EQ(0, pool.num_live_blocks());
+}
+
+TEST(HtmlObjectPoolTest, HeapFallback) {
+  HtmlObjectPool pool;
+
+  // Oversized requests, requests without a pool, and requests to a
+  // disabled pool all go to the heap, but are freed the same way.
+  void* big = pool.Allocate(HtmlObjectPool::kMaxPooledSize + 1);
+  void* unpooled = HtmlObjectPool::Allocate(NULL, 16);
+  pool.set_enabled(false);
+  void* disabled = pool.Allocate(16);
+  EXPECT_EQ(0, pool.num_live_blocks());
+  EXPECT_EQ(0, pool.bytes_reserved());
+  HtmlObjectPool::Free(big);
+  HtmlObjectPool::Free(unpooled);
+  HtmlObjectPool::Free(disabled);
+  HtmlObjectPool::Free(NULL);
+}
+
+TEST(HtmlObjectPoolTest, Trim) {
+  HtmlObjectPool pool;
+  std::vector<void*> blocks;
+  for (int i = 0; i < 1000; ++i) {
+    blocks.push_back(pool.Allocate(100));
+  }
+  size_t reserved = pool.bytes_reserved();
+  EXPECT_LT(2 * HtmlObjectPool::kChunkSize, reserved);
+
+  // Nothing can be trimmed while blocks are live.
+  pool.Trim(0);
+  EXPECT_EQ(reserved, pool.bytes_reserved());
+
+  for (void* block : blocks) {
+    HtmlObjectPool::Free(block);
+  }
+  pool.Trim(2 * HtmlObjectPool::kChunkSize);
+  EXPECT_EQ(2 * HtmlObjectPool::kChunkSize, pool.bytes_reserved());
+
+  // The retained chunks are reused before any new ones are allocated.
+  blocks.clear();
+  for (int i = 0; i < 100; ++i) {
+    blocks.push_back(pool.Allocate(100));
+  }
+  EXPECT_EQ(2 * HtmlObjectPool::kChunkSize, pool.bytes_reserved());
+  for (void* block : blocks) {
+    HtmlObjectPool::Free(block);
+  }
+  pool.Trim(0);
+  EXPECT_EQ(0, pool.bytes_reserved());
+}
+
+TEST(HtmlObjectPoolTest, SpliceAcrossPools) {
+  HtmlObjectPool pool1, pool2;
+  PooledIntList list1((HtmlObjectPool::Allocator<int>(&pool1)));
+  PooledIntList list2((HtmlObjectPool::Allocator<int>(&pool2)));
+  PooledIntList heap_list;
+  list1.push_back(1);
+  list2.push_back(2);
+  heap_list.push_back(3);
+  EXPECT_EQ(1, pool1.num_live_blocks());
+  EXPECT_EQ(1, pool2.num_live_blocks());
+
+  list1.splice(list1.end(), list2);
+  list1.splice(list1.end(), heap_list);
+  ASSERT_EQ(3, list1.size());
+  EXPECT_EQ(1, list1.front());
+  EXPECT_EQ(3, list1.back());
+
+  // Each node is returned to the pool it came from.
+  list1.pop_front();
+  EXPECT_EQ(0, pool1.num_live_blocks());
+  list1.clear();
+  EXPECT_EQ(0, pool2.num_live_blocks());
+}
+
+// Rewrites every attribute value, adds a copied attribute to each element,
+// and defers the first <div> until the close of the 150th, so that pooled
+// memory is exercised across flush windows.
+class AttributeChurnFilter : public EmptyHtmlFilter {
+ public:
+  explicit AttributeChurnFilter(HtmlParse* html_parse)
+      : html_parse_(html_parse), deferred_(NULL), num_divs_(0) {}
+
+  void StartDocument() override {
+    deferred_ = NULL;
+    num_divs_ = 0;
+  }
+
+  void StartElement(HtmlElement* element) override {
+    HtmlElement::AttributeList* attrs = element->mutable_attributes();
+    for (HtmlElement::AttributeIterator i(attrs->begin()); i != attrs->end();
+         ++i) {
+      const char* value = i->DecodedValueOrNull();
+      if (value != NULL) {
+        i->SetValue(StrCat(value, "!"));
+      }
+    }
+    if (!attrs->IsEmpty()) {
+      HtmlElement::Attribute* first = &*attrs->begin();
+      element->AddAttribute(*first);
+      first->set_name(html_parse_->MakeName("copied"));
+    }
+  }
+
+  void EndElement(HtmlElement* element) override {
+    if (element->keyword() == HtmlName::kDiv) {
+      ++num_divs_;
+      if (num_divs_ == 1) {
+        deferred_ = element;
+        html_parse_->DeferCurrentNode();
+      } else if (num_divs_ == 150) {
+        html_parse_->RestoreDeferredNode(deferred_);
+      }
+    }
+  }
+
+  const char* Name() const override { return "AttributeChurn"; }
+
+ private:
+  HtmlParse* html_parse_;
+  HtmlElement* deferred_;
+  int num_divs_;
+
+  DISALLOW_COPY_AND_ASSIGN(AttributeChurnFilter);
+};
+
+class HtmlObjectPoolParseTest : public HtmlParseTestBase {
+ protected:
+  HtmlObjectPoolParseTest() : filter_(&html_parse_) {
+    html_parse_.AddFilter(&filter_);
+  }
+
+  bool AddBody() const override { return true; }
+
+  // Parses html, flushing every flush_bytes, and returns the serialization.
+  GoogleString ParseFlushing(StringPiece html, int flush_bytes) {
+    SetupWriter();
+    output_buffer_.clear();
+    html_parse_.StartParse("http://example.com/pool.html");
+    for (int pos = 0; pos < static_cast<int>(html.size());
+         pos += flush_bytes) {
+      html_parse_.ParseText(html.substr(pos, flush_bytes));
+      html_parse_.Flush();
+    }
+    html_parse_.FinishParse();
+    return output_buffer_;
+  }
+
+  GoogleString MakeHtml() {
+    GoogleString html;
+    for (int i = 0; i < 200; ++i) {
+      StrAppend(&html, "<div id=d", IntegerToString(i),
+                " class='a&amp;b'><a href=\"/link", IntegerToString(i),
+                "\" title=t>text</a><br/><!-- comment --></div>\n");
+    }
+    return html;
+  }
+
+  AttributeChurnFilter filter_;
+};
+
+TEST_F(HtmlObjectPoolParseTest, PoolingDoesNotChangeOutput) {
+  GoogleString html = MakeHtml();
+  GoogleString pooled = ParseFlushing(html, 97);
+  EXPECT_EQ(0, html_parse_.object_pool()->num_live_blocks());
+
+  html_parse_.set_object_pool_enabled(false);
+  GoogleString unpooled = ParseFlushing(html, 97);
+  EXPECT_EQ(pooled, unpooled);
+  EXPECT_NE(GoogleString::npos, pooled.find("copied=d0!"));
+  EXPECT_NE(GoogleString::npos, pooled.find("class='a&amp;b!'"));
+  EXPECT_LT(pooled.find("id=d149"), pooled.find("copied=d0!"));
+}
+
+TEST_F(HtmlObjectPoolParseTest, MemoryIsReusedAcrossDocuments) {
+  GoogleString html = MakeHtml();
+  GoogleString first = ParseFlushing(html, 256);
+  EXPECT_EQ(0, html_parse_.object_pool()->num_live_blocks());
+  size_t reserved = html_parse_.object_pool()->bytes_reserved();
+  EXPECT_LT(0, reserved);
+  EXPECT_GE(HtmlObjectPool::kDefaultRetainedBytes, reserved);
+
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(first, ParseFlushing(html, 256));
+    EXPECT_EQ(0, html_parse_.object_pool()->num_live_blocks());
+    EXPECT_EQ(reserved, html_parse_.object_pool()->bytes_reserved());
+  }
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -30,8 +30,11 @@
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/html/collapse_whitespace_filter.h"
+#include "pagespeed/kernel/html/elide_attributes_filter.h"
 #include "pagespeed/kernel/html/empty_html_filter.h"
 #include "pagespeed/kernel/html/explicit_close_tag.h"
+#include "pagespeed/kernel/html/html_attribute_quote_removal.h"
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_event.h"
 #include "pagespeed/kernel/html/html_filter.h"
@@ -3181,4 +3184,106 @@ TEST_F(HtmlParseTestNoBody, InsertExternalScriptAfterEndOfHead) {
                    "<head>text</head><script src=\"inserted\"></script>");
 }
 
+// Logs the elements it sees, optionally declaring itself streaming-safe.
+class ElementLogFilter : public EmptyHtmlFilter {
+ public:
+  ElementLogFilter(const char* name, bool streaming_safe, GoogleString* log)
+      : name_(name), streaming_safe_(streaming_safe), enabled_(true),
+        log_(log) {}
+
+  void set_enabled(bool x) { enabled_ = x; }
+  void DetermineEnabled(GoogleString* disabled_reason) override {
+    set_is_enabled(enabled_);
+  }
+
+  void StartElement(HtmlElement* element) override {
+    StrAppend(log_, name_, ":", element->name_str(), " ");
+  }
+  bool IsStreamingSafe() const override { return streaming_safe_; }
+  const char* Name() const override { return name_; }
+
+ private:
+  const char* name_;
+  bool streaming_safe_;
+  bool enabled_;
+  GoogleString* log_;
+
+  DISALLOW_COPY_AND_ASSIGN(ElementLogFilter);
+};
+
+class FuseStreamingFiltersTest : public HtmlParseTest {
+ protected:
+  bool AddBody() const override { return false; }
+  bool AddHtmlTags() const override { return false; }
+};
+
+TEST_F(FuseStreamingFiltersTest, AdjacentStreamingFiltersShareAPass) {
+  GoogleString log;
+  ElementLogFilter a("a", true, &log);
+  ElementLogFilter b("b", true, &log);
+  ElementLogFilter c("c", false, &log);
+  html_parse_.AddFilter(&a);
+  html_parse_.AddFilter(&b);
+  html_parse_.AddFilter(&c);
+  SetupWriter();
+
+  ValidateNoChanges("unfused", "<div><p></p></div>");
+  EXPECT_EQ("a:div a:p b:div b:p c:div c:p ", log);
+  EXPECT_EQ(4, html_parse_.filter_passes_in_last_flush());
+
+  // a and b now run in one pass, with each element delivered to both.
+  // c is not streaming-safe and the writer is alone after it, so they
+  // still have their own passes.
+  log.clear();
+  html_parse_.set_fuse_streaming_filters(true);
+  ValidateNoChanges("fused", "<div><p></p></div>");
+  EXPECT_EQ("a:div b:div a:p b:p c:div c:p ", log);
+  EXPECT_EQ(3, html_parse_.filter_passes_in_last_flush());
+}
+
+TEST_F(FuseStreamingFiltersTest, DisabledFiltersDoNotSplitRuns) {
+  GoogleString log;
+  ElementLogFilter a("a", true, &log);
+  ElementLogFilter b("b", false, &log);
+  ElementLogFilter c("c", true, &log);
+  html_parse_.AddFilter(&a);
+  html_parse_.AddFilter(&b);
+  html_parse_.AddFilter(&c);
+  SetupWriter();
+  html_parse_.set_fuse_streaming_filters(true);
+  b.set_enabled(false);
+
+  ValidateNoChanges("disabled", "<div><p></p></div>");
+  EXPECT_EQ("a:div c:div a:p c:p ", log);
+  EXPECT_EQ(1, html_parse_.filter_passes_in_last_flush());
+}
+
+TEST_F(FuseStreamingFiltersTest, SameOutputAsSeparatePasses) {
+  CollapseWhitespaceFilter collapse_whitespace(&html_parse_);
+  ElideAttributesFilter elide_attributes(&html_parse_);
+  HtmlAttributeQuoteRemoval quote_removal(&html_parse_);
+  html_parse_.AddFilter(&collapse_whitespace);
+  html_parse_.AddFilter(&elide_attributes);
+  html_parse_.AddFilter(&quote_removal);
+  SetupWriter();
+
+  static const char kInput[] =
+      "<form method=\"get\">  <input type=\"text\" value=\"a  b\">\n"
+      "\n  <pre>  x  </pre> <option selected=\"selected\">o</option>"
+      "</form>";
+  static const char kExpected[] =
+      "<form> <input type=text value=\"a  b\">\n<pre>  x  </pre> "
+      "<option selected>o</option></form>";
+  for (int flush_index = 0; flush_index <= static_cast<int>(STATIC_STRLEN(kInput));
+       flush_index += 7) {
+    html_parse_.set_fuse_streaming_filters(false);
+    ParseWithFlush(kInput, flush_index);
+    EXPECT_EQ(kExpected, output_buffer_) << flush_index;
+    html_parse_.set_fuse_streaming_filters(true);
+    ParseWithFlush(kInput, flush_index);
+    EXPECT_EQ(kExpected, output_buffer_) << flush_index;
+    EXPECT_EQ(1, html_parse_.filter_passes_in_last_flush());
+  }
+}
+
 }  // namespace net_instaweb
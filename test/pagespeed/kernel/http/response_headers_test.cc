@@ -1382,6 +1382,33 @@ TEST_F(ResponseHeadersTest, TestProxyAndMustRevalidate) {
   EXPECT_TRUE(response_headers_.IsProxyCacheable());
 }
 
+TEST_F(ResponseHeadersTest, TestStaleWhileRevalidate) {
+  ParseHeaders(StrCat("HTTP/1.0 200 (OK)\r\nDate: ", start_time_string_,
+                      "\r\nCache-Control: max-age=360, "
+                      "stale-while-revalidate=60\r\n\r\n"));
+  EXPECT_EQ(60 * Timer::kSecondMs,
+            response_headers_.stale_while_revalidate_ms());
+
+  // Malformed values are ignored.
+  response_headers_.Clear();
+  ParseHeaders(StrCat("HTTP/1.0 200 (OK)\r\nDate: ", start_time_string_,
+                      "\r\nCache-Control: max-age=360, "
+                      "stale-while-revalidate=soon\r\n\r\n"));
+  EXPECT_EQ(0, response_headers_.stale_while_revalidate_ms());
+
+  // Revalidation and privacy both rule out serving stale from a proxy.
+  response_headers_.Clear();
+  ParseHeaders(StrCat("HTTP/1.0 200 (OK)\r\nDate: ", start_time_string_,
+                      "\r\nCache-Control: max-age=360, must-revalidate, "
+                      "stale-while-revalidate=60\r\n\r\n"));
+  EXPECT_EQ(0, response_headers_.stale_while_revalidate_ms());
+  response_headers_.Clear();
+  ParseHeaders(StrCat("HTTP/1.0 200 (OK)\r\nDate: ", start_time_string_,
+                      "\r\nCache-Control: private, max-age=360, "
+                      "stale-while-revalidate=60\r\n\r\n"));
+  EXPECT_EQ(0, response_headers_.stale_while_revalidate_ms());
+}
+
 // There was a bug that calling RemoveAll would re-populate the proto from
 // map_ which would separate all comma-separated values.
 TEST_F(ResponseHeadersTest, TestRemoveDoesntSeparateCommaValues) {
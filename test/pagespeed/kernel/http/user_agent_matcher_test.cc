@@ -372,6 +372,23 @@ TEST_F(UserAgentMatcherTest, DoesntSupportWebpLosslessAlpha) {
       user_agent_matcher_->SupportsWebpLosslessAlpha(kWindowsPhoneUserAgent));
 }
 
+TEST_F(UserAgentMatcherTest, SupportsAvif) {
+  // AVIF support is decided by the Accept header; the user agent only
+  // vetoes browsers that advertise it without decoding it reliably.
+  EXPECT_TRUE(user_agent_matcher_->SupportsAvif(kChromeUserAgent));
+  EXPECT_TRUE(user_agent_matcher_->SupportsAvif(kFirefoxUserAgent));
+  EXPECT_TRUE(user_agent_matcher_->SupportsAvif(
+      "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+      "(KHTML, like Gecko) Chrome/121.0.0.0 Safari/537.36 Edg/121.0.0.0"));
+  EXPECT_FALSE(user_agent_matcher_->SupportsAvif(
+      "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+      "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36 Edg/120.0.2210.91"));
+  EXPECT_FALSE(user_agent_matcher_->SupportsAvif(
+      "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+      "(KHTML, like Gecko) Chrome/92.0.4515.131 Safari/537.36 "
+      "Edg/92.0.902.67"));
+}
+
 TEST_F(UserAgentMatcherTest, SupportsDnsPrefetchUsingRelPrefetch) {
   EXPECT_FALSE(
       user_agent_matcher_->SupportsDnsPrefetchUsingRelPrefetch(kIe6UserAgent));
@@ -0,0 +1,291 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/image/avif_optimizer.h"
+
+#include <memory>
+
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/http/image_types.pb.h"
+#include "pagespeed/kernel/image/image_frame_interface.h"
+#include "pagespeed/kernel/image/image_util.h"
+#include "pagespeed/kernel/image/read_image.h"
+#include "pagespeed/kernel/image/scanline_interface.h"
+#include "pagespeed/kernel/image/scanline_status.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/base/mock_message_handler.h"
+#include "test/pagespeed/kernel/image/test_utils.h"
+
+namespace {
+
+using net_instaweb::MockMessageHandler;
+using net_instaweb::NullMutex;
+using pagespeed::image_compression::AvifConfiguration;
+using pagespeed::image_compression::AvifFrameWriter;
+using pagespeed::image_compression::ComputeImageType;
+using pagespeed::image_compression::CreateScanlineReader;
+using pagespeed::image_compression::CreateScanlineWriter;
+using pagespeed::image_compression::FrameSpec;
+using pagespeed::image_compression::IMAGE_AVIF;
+using pagespeed::image_compression::IMAGE_JPEG;
+using pagespeed::image_compression::IMAGE_PNG;
+using pagespeed::image_compression::ImageFormat;
+using pagespeed::image_compression::ImageSpec;
+using pagespeed::image_compression::kJpegTestDir;
+using pagespeed::image_compression::kPngSuiteTestDir;
+using pagespeed::image_compression::kPngTestDir;
+using pagespeed::image_compression::ReadTestFile;
+using pagespeed::image_compression::RGB_888;
+using pagespeed::image_compression::SCANLINE_STATUS_TIMEOUT_ERROR;
+using pagespeed::image_compression::SCANLINE_STATUS_UNSUPPORTED_FEATURE;
+using pagespeed::image_compression::ScanlineReaderInterface;
+using pagespeed::image_compression::ScanlineStatus;
+using pagespeed::image_compression::ScanlineWriterInterface;
+
+// libavif stores an alpha channel as an auxiliary image tagged with this URN.
+const char kAlphaUrn[] = "urn:mpeg:mpegB:cicp:systems:auxiliary:alpha";
+
+// 32-by-32 test images: GRAY_8, RGB_888 (from a palette), and RGBA_8888.
+const char kGrayImage[] = "basi0g04";
+const char kRgbImage[] = "basi3p02";
+const char kRgbaImage[] = "basn6a16";
+
+// RGB_888 image with 640-by-400 pixels.
+const char kLargeRgbImage[] = "this_is_a_test";
+
+const char kJpegImage[] = "sjpeg1";
+
+// Progress hook that fails once percent reaches *user_data.
+bool FailAtPercent(int percent, void* user_data) {
+  return percent < *static_cast<int*>(user_data);
+}
+
+class AvifOptimizerTest : public testing::Test {
+ public:
+  AvifOptimizerTest() : message_handler_(new NullMutex) {}
+
+ protected:
+  // Reads file_name from dir, decodes it as format, and encodes it to AVIF
+  // in avif_image.
+  ScanlineStatus Encode(const char* dir, const char* file_name,
+                        const char* extension, ImageFormat format,
+                        const AvifConfiguration& config,
+                        GoogleString* avif_image) {
+    GoogleString input_image;
+    EXPECT_TRUE(ReadTestFile(dir, file_name, extension, &input_image));
+    ScanlineStatus status;
+    std::unique_ptr<ScanlineReaderInterface> reader(CreateScanlineReader(
+        format, input_image.data(), input_image.length(), &message_handler_,
+        &status));
+    if (!status.Success()) {
+      return status;
+    }
+    std::unique_ptr<ScanlineWriterInterface> writer(CreateScanlineWriter(
+        IMAGE_AVIF, reader->GetPixelFormat(), reader->GetImageWidth(),
+        reader->GetImageHeight(), &config, avif_image, &message_handler_,
+        &status));
+    while (status.Success() && reader->HasMoreScanLines()) {
+      void* scanline = nullptr;
+      status = reader->ReadNextScanlineWithStatus(&scanline);
+      if (status.Success()) {
+        status = writer->WriteNextScanlineWithStatus(scanline);
+      }
+    }
+    if (status.Success()) {
+      status = writer->FinalizeWriteWithStatus();
+    }
+    return status;
+  }
+
+  ScanlineStatus EncodePng(const char* dir, const char* file_name,
+                           const AvifConfiguration& config,
+                           GoogleString* avif_image) {
+    return Encode(dir, file_name, "png", IMAGE_PNG, config, avif_image);
+  }
+
+  MockMessageHandler message_handler_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AvifOptimizerTest);
+};
+
+TEST_F(AvifOptimizerTest, UnsupportedWithoutLibavif) {
+  if (AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  AvifConfiguration config;
+  GoogleString avif_image;
+  EXPECT_EQ(SCANLINE_STATUS_UNSUPPORTED_FEATURE,
+            EncodePng(kPngSuiteTestDir, kRgbImage, config, &avif_image).type());
+  EXPECT_TRUE(avif_image.empty());
+}
+
+TEST_F(AvifOptimizerTest, EncodesEachPixelFormat) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  const char* kImages[] = {kGrayImage, kRgbImage, kRgbaImage};
+  AvifConfiguration config;
+  for (const char* image : kImages) {
+    GoogleString avif_image;
+    ScanlineStatus status =
+        EncodePng(kPngSuiteTestDir, image, config, &avif_image);
+    ASSERT_TRUE(status.Success()) << image << ": " << status.ToString();
+    EXPECT_EQ(net_instaweb::IMAGE_AVIF, ComputeImageType(avif_image))
+        << image;
+  }
+}
+
+TEST_F(AvifOptimizerTest, EncodesJpeg) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  AvifConfiguration config;
+  GoogleString avif_image;
+  ScanlineStatus status =
+      Encode(kJpegTestDir, kJpegImage, "jpg", IMAGE_JPEG, config, &avif_image);
+  ASSERT_TRUE(status.Success()) << status.ToString();
+  EXPECT_EQ(net_instaweb::IMAGE_AVIF, ComputeImageType(avif_image));
+}
+
+TEST_F(AvifOptimizerTest, KeepsAlphaOnlyWhenPresent) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  AvifConfiguration config;
+  GoogleString rgba_avif;
+  ASSERT_TRUE(
+      EncodePng(kPngSuiteTestDir, kRgbaImage, config, &rgba_avif).Success());
+  EXPECT_NE(GoogleString::npos, rgba_avif.find(kAlphaUrn));
+
+  GoogleString rgb_avif;
+  ASSERT_TRUE(
+      EncodePng(kPngSuiteTestDir, kRgbImage, config, &rgb_avif).Success());
+  EXPECT_EQ(GoogleString::npos, rgb_avif.find(kAlphaUrn));
+}
+
+TEST_F(AvifOptimizerTest, LowerQualityIsSmaller) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  AvifConfiguration config;
+  config.quality = 90;
+  GoogleString high_quality;
+  ASSERT_TRUE(
+      EncodePng(kPngTestDir, kLargeRgbImage, config, &high_quality).Success());
+  config.quality = 20;
+  GoogleString low_quality;
+  ASSERT_TRUE(
+      EncodePng(kPngTestDir, kLargeRgbImage, config, &low_quality).Success());
+  EXPECT_LT(low_quality.size(), high_quality.size());
+}
+
+TEST_F(AvifOptimizerTest, RejectsImagesOverPixelLimit) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  AvifConfiguration config;
+  config.max_pixels = 640 * 400 - 1;
+  GoogleString avif_image;
+  ScanlineStatus status =
+      EncodePng(kPngTestDir, kLargeRgbImage, config, &avif_image);
+  EXPECT_EQ(SCANLINE_STATUS_UNSUPPORTED_FEATURE, status.type());
+  EXPECT_TRUE(avif_image.empty());
+
+  // Exactly at the limit is fine.
+  config.max_pixels = 640 * 400;
+  status = EncodePng(kPngTestDir, kLargeRgbImage, config, &avif_image);
+  EXPECT_TRUE(status.Success()) << status.ToString();
+}
+
+TEST_F(AvifOptimizerTest, RejectsAnimation) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  AvifConfiguration config;
+  GoogleString avif_image;
+  AvifFrameWriter writer(&message_handler_);
+  ASSERT_TRUE(writer.Initialize(&config, &avif_image).Success());
+  ImageSpec image_spec;
+  image_spec.width = 8;
+  image_spec.height = 8;
+  image_spec.num_frames = 2;
+  EXPECT_EQ(SCANLINE_STATUS_UNSUPPORTED_FEATURE,
+            writer.PrepareImage(&image_spec).type());
+}
+
+TEST_F(AvifOptimizerTest, ProgressHookCanAbandonEncode) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  AvifConfiguration config;
+  config.progress_hook = FailAtPercent;
+
+  // Refused before the encode starts.
+  int fail_at = 0;
+  config.user_data = &fail_at;
+  GoogleString avif_image;
+  EXPECT_EQ(SCANLINE_STATUS_TIMEOUT_ERROR,
+            EncodePng(kPngSuiteTestDir, kRgbImage, config, &avif_image).type());
+  EXPECT_TRUE(avif_image.empty());
+
+  // Discarded once the encode has finished.
+  fail_at = 100;
+  EXPECT_EQ(SCANLINE_STATUS_TIMEOUT_ERROR,
+            EncodePng(kPngSuiteTestDir, kRgbImage, config, &avif_image).type());
+  EXPECT_TRUE(avif_image.empty());
+
+  fail_at = 101;
+  EXPECT_TRUE(
+      EncodePng(kPngSuiteTestDir, kRgbImage, config, &avif_image).Success());
+  EXPECT_FALSE(avif_image.empty());
+}
+
+TEST_F(AvifOptimizerTest, WritesSmallerFrameOntoTransparentCanvas) {
+  if (!AvifFrameWriter::IsAvailable()) {
+    return;
+  }
+  AvifConfiguration config;
+  GoogleString avif_image;
+  AvifFrameWriter writer(&message_handler_);
+  ASSERT_TRUE(writer.Initialize(&config, &avif_image).Success());
+  ImageSpec image_spec;
+  image_spec.width = 4;
+  image_spec.height = 4;
+  image_spec.num_frames = 1;
+  ASSERT_TRUE(writer.PrepareImage(&image_spec).Success());
+  FrameSpec frame_spec;
+  frame_spec.width = 2;
+  frame_spec.height = 2;
+  frame_spec.top = 1;
+  frame_spec.left = 1;
+  frame_spec.pixel_format = RGB_888;
+  ASSERT_TRUE(writer.PrepareNextFrame(&frame_spec).Success());
+  const uint8_t kRow[] = {0xff, 0, 0, 0, 0xff, 0};
+  for (int row = 0; row < 2; ++row) {
+    ASSERT_TRUE(writer.WriteNextScanline(kRow).Success());
+  }
+  ASSERT_TRUE(writer.FinalizeWrite().Success());
+  // The uncovered border is transparent, so the output has alpha.
+  EXPECT_NE(GoogleString::npos, avif_image.find(kAlphaUrn));
+}
+
+}  // namespace
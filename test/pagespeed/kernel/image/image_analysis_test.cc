@@ -23,6 +23,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <vector>
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/null_mutex.h"
@@ -40,6 +41,7 @@ namespace {
 using net_instaweb::MessageHandler;
 using net_instaweb::MockMessageHandler;
 using net_instaweb::NullMutex;
+using pagespeed::image_compression::ComputeDownscaledLuma;
 using pagespeed::image_compression::GRAY_8;
 using pagespeed::image_compression::Histogram;
 using pagespeed::image_compression::IMAGE_GIF;
@@ -57,6 +59,7 @@ using pagespeed::image_compression::ReadTestFile;
 using pagespeed::image_compression::RGB_888;
 using pagespeed::image_compression::RGBA_8888;
 using pagespeed::image_compression::ScanlineReaderInterface;
+using pagespeed::image_compression::Ssim;
 using pagespeed::image_compression::SynthesizeImage;
 
 struct ImageInfo {
@@ -356,6 +359,65 @@ TEST_F(ImageAnalysisTest, PhotoMetric) {
   }
 }
 
+TEST_F(ImageAnalysisTest, SsimOfIdenticalPlanes) {
+  const int kWidth = 37;
+  const int kHeight = 29;
+  std::vector<float> luma(kWidth * kHeight);
+  for (size_t i = 0; i < luma.size(); ++i) {
+    luma[i] = (i * 37) % 251;
+  }
+  EXPECT_DOUBLE_EQ(1.0, Ssim(luma.data(), luma.data(), kWidth, kHeight));
+  // Smaller than one window.
+  EXPECT_DOUBLE_EQ(1.0, Ssim(luma.data(), luma.data(), 5, 5));
+}
+
+TEST_F(ImageAnalysisTest, SsimDecreasesWithNoise) {
+  const int kWidth = 37;
+  const int kHeight = 29;
+  std::vector<float> luma(kWidth * kHeight);
+  std::vector<float> slightly_noisy(luma.size());
+  std::vector<float> very_noisy(luma.size());
+  for (size_t i = 0; i < luma.size(); ++i) {
+    luma[i] = 8 + (i * 37) % 240;
+    const int noise = static_cast<int>(i % 3) - 1;
+    slightly_noisy[i] = luma[i] + 2 * noise;
+    very_noisy[i] = luma[i] + 8 * noise;
+  }
+  const double slight = Ssim(luma.data(), slightly_noisy.data(), kWidth,
+                             kHeight);
+  const double heavy = Ssim(luma.data(), very_noisy.data(), kWidth, kHeight);
+  EXPECT_LT(slight, 1.0);
+  EXPECT_LT(heavy, slight);
+  EXPECT_GT(heavy, 0.0);
+}
+
+TEST_F(ImageAnalysisTest, DownscaledLuma) {
+  // A 512x512 image is halved, while a 120x90 one is kept as is.
+  const struct {
+    const char* file_name;
+    int width;
+    int height;
+  } kImages[] = {
+      {"sjpeg6", 256, 256},
+      {"sjpeg1", 120, 90},
+  };
+  for (size_t i = 0; i < arraysize(kImages); ++i) {
+    GoogleString image_string;
+    ASSERT_TRUE(ReadTestFile(kJpegTestDir, kImages[i].file_name, "jpg",
+                             &image_string));
+    std::vector<float> luma;
+    int width = 0;
+    int height = 0;
+    ASSERT_TRUE(ComputeDownscaledLuma(IMAGE_JPEG, image_string.data(),
+                                      image_string.length(), &luma, &width,
+                                      &height, &message_handler_));
+    EXPECT_EQ(kImages[i].width, width);
+    EXPECT_EQ(kImages[i].height, height);
+    ASSERT_EQ(static_cast<size_t>(width * height), luma.size());
+    EXPECT_DOUBLE_EQ(1.0, Ssim(luma.data(), luma.data(), width, height));
+  }
+}
+
 TEST_F(ImageAnalysisTest, KeyInformation) {
   VerifyKeyInformation(IMAGE_GIF, kGifTestDir, "gif", kGifImages,
                        kGifImageCount);
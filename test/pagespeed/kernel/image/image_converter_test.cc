@@ -25,11 +25,13 @@
 #include "pagespeed/kernel/base/null_mutex.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/image/gif_reader.h"
 #include "pagespeed/kernel/image/image_util.h"
 #include "pagespeed/kernel/image/png_optimizer.h"
 #include "pagespeed/kernel/image/read_image.h"
 #include "pagespeed/kernel/image/scanline_interface.h"
+#include "pagespeed/kernel/util/platform.h"
 #include "test/pagespeed/kernel/base/gtest.h"
 #include "test/pagespeed/kernel/base/mock_message_handler.h"
 #include "test/pagespeed/kernel/image/test_utils.h"
@@ -38,6 +40,8 @@ namespace {
 
 using net_instaweb::MockMessageHandler;
 using net_instaweb::NullMutex;
+using net_instaweb::Platform;
+using net_instaweb::ThreadSystem;
 using pagespeed::image_compression::GifReader;
 using pagespeed::image_compression::IMAGE_GIF;
 using pagespeed::image_compression::IMAGE_PNG;
@@ -237,6 +241,28 @@ TEST_F(ImageConverterTest, OptimizePngOrConvertToJpeg) {
   }
 }
 
+TEST_F(ImageConverterTest, OptimizePngOrConvertToJpeg_helperThread) {
+  // Both trials log, so the handler needs a real mutex here.
+  std::unique_ptr<ThreadSystem> thread_system(Platform::CreateThreadSystem());
+  MockMessageHandler handler(thread_system->NewMutex());
+  PngReader png_reader(&handler);
+  pagespeed::image_compression::JpegCompressionOptions options;
+  options.lossy = true;
+  options.progressive = false;
+  for (size_t i = 0; i < kValidImageCount; i++) {
+    GoogleString in, out, threaded_out;
+    bool is_out_png, threaded_is_out_png;
+    ReadTestFile(kPngSuiteTestDir, kValidImages[i].filename, "png", &in);
+    ASSERT_TRUE(ImageConverter::OptimizePngOrConvertToJpeg(
+        png_reader, in, options, &out, &is_out_png, &handler));
+    ASSERT_TRUE(ImageConverter::OptimizePngOrConvertToJpeg(
+        png_reader, in, options, thread_system.get(), &threaded_out,
+        &threaded_is_out_png, &handler));
+    EXPECT_EQ(out, threaded_out) << kValidImages[i].filename;
+    EXPECT_EQ(is_out_png, threaded_is_out_png) << kValidImages[i].filename;
+  }
+}
+
 TEST_F(ImageConverterTest, ConvertPngToWebp_invalidPngs) {
   png_struct_reader_ = std::make_unique<PngReader>(&message_handler_);
   WebpConfiguration webp_config;
@@ -75,6 +75,8 @@ const char kImagePagespeed[] = "pagespeed-128";
 const char kImagePageSpeed33x34[] = "pagespeed-33x34";
 // Image with 4096-by-2048 pixels.
 const char kLarge4096x2048[] = "large";
+// Image of RGB_888 format. Size is 640-by-400 pixels.
+const char kImageThisIsATest[] = "this_is_a_test";
 
 // Size of the output image [width, height]. The size of the input image
 // is 32-by-32. We would like to test resizing ratios of both integers
@@ -110,6 +112,12 @@ class ScanlineResizerTest : public testing::Test {
 
   void ResizeAndValidateImage(const char* file_name, const GoogleString& image);
 
+  // Resizes file_name with every supported SIMD implementation and expects
+  // the same pixels as the portable one.
+  void ExpectImplementationsAgree(const char* dir, const char* file_name,
+                                  ScanlineResizer::Filter filter, size_t width,
+                                  size_t height);
+
   MockMessageHandler message_handler_;
   PngScanlineReaderRaw reader_;
   ScanlineResizer resizer_;
@@ -347,6 +355,89 @@ TEST_F(ScanlineResizerTest, ResizeFractionalRatio) {
   EXPECT_EQ(new_height, num_rows);
 }
 
+// Reads every scanline of 'resizer' into 'pixels'.
+void ReadAllScanlines(ScanlineResizer* resizer, GoogleString* pixels) {
+  pixels->clear();
+  while (resizer->HasMoreScanLines()) {
+    void* scanline = nullptr;
+    ASSERT_TRUE(resizer->ReadNextScanline(&scanline));
+    pixels->append(static_cast<const char*>(scanline),
+                   resizer->GetBytesPerScanline());
+  }
+}
+
+// The vectorized kernels must produce exactly the same pixels as the
+// portable ones, for both filters, all pixel formats, and all ratios.
+void ScanlineResizerTest::ExpectImplementationsAgree(
+    const char* dir, const char* file_name, ScanlineResizer::Filter filter,
+    size_t width, size_t height) {
+  const ScanlineResizer::Implementation kImplementations[] = {
+      ScanlineResizer::kSse2, ScanlineResizer::kAvx2};
+  ASSERT_TRUE(ReadTestFile(dir, file_name, "png", &input_image_));
+  ASSERT_TRUE(reader_.Initialize(input_image_.data(), input_image_.length()));
+  resizer_.set_filter(filter);
+  resizer_.set_implementation(ScanlineResizer::kPortable);
+  ASSERT_TRUE(resizer_.Initialize(&reader_, width, height));
+  GoogleString expected;
+  ReadAllScanlines(&resizer_, &expected);
+
+  for (ScanlineResizer::Implementation impl : kImplementations) {
+    if (!ScanlineResizer::IsSupported(impl)) {
+      continue;
+    }
+    ASSERT_TRUE(reader_.Initialize(input_image_.data(), input_image_.length()));
+    resizer_.set_implementation(impl);
+    ASSERT_TRUE(resizer_.Initialize(&reader_, width, height));
+    GoogleString actual;
+    ReadAllScanlines(&resizer_, &actual);
+    EXPECT_EQ(expected, actual)
+        << file_name << " " << width << "x" << height << " filter " << filter
+        << " implementation " << impl;
+  }
+}
+
+TEST_F(ScanlineResizerTest, ImplementationsAgree) {
+  const ScanlineResizer::Filter kFilters[] = {ScanlineResizer::kArea,
+                                              ScanlineResizer::kLanczos3};
+  for (ScanlineResizer::Filter filter : kFilters) {
+    for (size_t index_image = 0; index_image < kValidImageCount;
+         ++index_image) {
+      for (size_t index_size = 0; index_size < KOutputSizeCount;
+           ++index_size) {
+        ExpectImplementationsAgree(kPngSuiteTestDir, kValidImages[index_image],
+                                   filter, kOutputSize[index_size][0],
+                                   kOutputSize[index_size][1]);
+      }
+    }
+    // A non-square RGB image resized by a single dimension, where the last
+    // output pixel of a row need not reach the last input pixel.
+    ExpectImplementationsAgree(kPngTestDir, kImageThisIsATest, filter,
+                               kPreserveAspectRatio, 7);
+    ExpectImplementationsAgree(kPngTestDir, kImageThisIsATest, filter, 11,
+                               kPreserveAspectRatio);
+  }
+}
+
+// Lanczos3 produces the requested number of rows at non-integer ratios,
+// including when it has to buffer input rows past the end of the image.
+TEST_F(ScanlineResizerTest, LanczosFractionalRatio) {
+  const int new_width = 11;
+  const int new_height = 19;
+  ASSERT_TRUE(ReadTestFile(kPngTestDir, kImagePagespeed, "png", &input_image_));
+
+  ASSERT_TRUE(reader_.Initialize(input_image_.data(), input_image_.length()));
+  resizer_.set_filter(ScanlineResizer::kLanczos3);
+  ASSERT_TRUE(resizer_.Initialize(&reader_, new_width, new_height));
+  EXPECT_EQ(new_width, resizer_.GetImageWidth());
+
+  int num_rows = 0;
+  while (resizer_.HasMoreScanLines()) {
+    ASSERT_TRUE(resizer_.ReadNextScanline(&scanline_));
+    ++num_rows;
+  }
+  EXPECT_EQ(new_height, num_rows);
+}
+
 TEST_F(ScanlineResizerTest, LargeImage) {
   ASSERT_TRUE(ReadTestFile(kPngTestDir, kLarge4096x2048, "png", &input_image_));
   ResizeAndValidateImage(kLarge4096x2048, input_image_);
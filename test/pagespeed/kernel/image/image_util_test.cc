@@ -42,6 +42,7 @@ using pagespeed::image_compression::ImageFormat;
 using pagespeed::image_compression::PixelFormat;
 
 // Image formats.
+using pagespeed::image_compression::IMAGE_AVIF;
 using pagespeed::image_compression::IMAGE_GIF;
 using pagespeed::image_compression::IMAGE_JPEG;
 using pagespeed::image_compression::IMAGE_PNG;
@@ -77,8 +78,9 @@ TEST(ImageUtilTest, ImageFormatToMimeTypeString) {
   EXPECT_STREQ("image/gif", ImageFormatToMimeTypeString(IMAGE_GIF));
   EXPECT_STREQ("image/webp", ImageFormatToMimeTypeString(IMAGE_WEBP));
   EXPECT_STREQ("image/webp", ImageFormatToMimeTypeString(IMAGE_WEBP));
+  EXPECT_STREQ("image/avif", ImageFormatToMimeTypeString(IMAGE_AVIF));
   EXPECT_STREQ(kInvalidImageFormat,
-               ImageFormatToMimeTypeString(static_cast<ImageFormat>(5)));
+               ImageFormatToMimeTypeString(static_cast<ImageFormat>(6)));
 }
 
 TEST(ImageUtilTest, ImageFormatToString) {
@@ -87,8 +89,9 @@ TEST(ImageUtilTest, ImageFormatToString) {
   EXPECT_STREQ("IMAGE_PNG", ImageFormatToString(IMAGE_PNG));
   EXPECT_STREQ("IMAGE_GIF", ImageFormatToString(IMAGE_GIF));
   EXPECT_STREQ("IMAGE_WEBP", ImageFormatToString(IMAGE_WEBP));
+  EXPECT_STREQ("IMAGE_AVIF", ImageFormatToString(IMAGE_AVIF));
   EXPECT_STREQ(kInvalidImageFormat,
-               ImageFormatToMimeTypeString(static_cast<ImageFormat>(5)));
+               ImageFormatToMimeTypeString(static_cast<ImageFormat>(6)));
 }
 
 TEST(ImageUtilTest, GetPixelFormatString) {
@@ -131,4 +134,25 @@ TEST(ImageUtilTest, ImageFormat) {
   EXPECT_EQ(net_instaweb::IMAGE_WEBP, ComputeImageType(buffer));
 }
 
+TEST(ImageUtilTest, ImageFormatAvif) {
+  // ISO BMFF "ftyp" box: size, type, major brand, minor version, then the
+  // compatible brands.
+  const char kAvifHeader[] =
+      "\x00\x00\x00\x1c" "ftyp" "avif" "\x00\x00\x00\x00" "avif" "mif1" "miaf";
+  GoogleString buffer(kAvifHeader, sizeof(kAvifHeader) - 1);
+  EXPECT_EQ(net_instaweb::IMAGE_AVIF, ComputeImageType(buffer));
+
+  // An image sequence is identified by the compatible brand alone.
+  const char kAvisHeader[] =
+      "\x00\x00\x00\x18" "ftyp" "msf1" "\x00\x00\x00\x00" "mif1" "avis";
+  buffer.assign(kAvisHeader, sizeof(kAvisHeader) - 1);
+  EXPECT_EQ(net_instaweb::IMAGE_AVIF, ComputeImageType(buffer));
+
+  // HEIC shares the container but not the brands.
+  const char kHeicHeader[] =
+      "\x00\x00\x00\x18" "ftyp" "heic" "\x00\x00\x00\x00" "mif1" "heic";
+  buffer.assign(kHeicHeader, sizeof(kHeicHeader) - 1);
+  EXPECT_EQ(net_instaweb::IMAGE_UNKNOWN, ComputeImageType(buffer));
+}
+
 }  // namespace
@@ -20,6 +20,7 @@
 #include "test/pagespeed/kernel/sharedmem/shared_mem_cache_data_test_base.h"
 
 #include <cstddef>  // for size_t
+#include <cstring>
 #include <set>
 
 #include "pagespeed/kernel/base/function.h"
@@ -34,11 +35,14 @@ using SharedMemCacheData::BlockVector;
 using SharedMemCacheData::CacheEntry;
 using SharedMemCacheData::EntryNum;
 using SharedMemCacheData::kInvalidEntry;
+using SharedMemCacheData::kNoTag;
+using SharedMemCacheData::kTagBucketWays;
 using SharedMemCacheData::Sector;
 
 namespace {
 
 const char kSegment[] = "cache";
+const char kTaggedSegment[] = "tagged_cache";
 const size_t kExtra = 8192;  // we only allocate one segment,
                              // so we prepend these many bytes to make
                              // sure the offset is actually honored.
@@ -290,6 +294,51 @@ void SharedMemCacheDataTestBase::TestBlockLists() NO_THREAD_SAFETY_ANALYSIS {
   ParentCleanup();
 }
 
+void SharedMemCacheDataTestBase::TestKeyTags() NO_THREAD_SAFETY_ANALYSIS {
+  const int kTaggedEntries = 2 * kTagBucketWays;
+  size_t bytes = Sector<kBlockSize>::RequiredSize(
+      shmem_runtime_.get(), kTaggedEntries, kBlocks, true /* key_tags */);
+  EXPECT_LE(Sector<kBlockSize>::RequiredSize(shmem_runtime_.get(),
+                                             kTaggedEntries, kBlocks),
+            bytes);
+  std::unique_ptr<AbstractSharedMemSegment> seg(
+      shmem_runtime_->CreateSegment(kTaggedSegment, bytes + kExtra, &handler_));
+  ASSERT_TRUE(seg != nullptr);
+  std::unique_ptr<Sector<kBlockSize>> sector(new Sector<kBlockSize>(
+      seg.get(), kExtra, kTaggedEntries, kBlocks, true /* key_tags */));
+  ASSERT_TRUE(sector->Initialize(&handler_));
+  ASSERT_TRUE(sector->has_key_tags());
+
+  // Everything starts out free.
+  EXPECT_EQ(0xFFFFu, sector->MatchKeyTags(0, kNoTag));
+  EXPECT_EQ(0xFFFFu, sector->MatchKeyTags(kTagBucketWays, kNoTag));
+  EXPECT_EQ(0u, sector->MatchKeyTags(0, 7));
+
+  // Each bucket only reports its own entries.
+  sector->SetKeyTag(3, 7);
+  sector->SetKeyTag(kTagBucketWays + 1, 7);
+  sector->SetKeyTag(kTagBucketWays + 4, 200);
+  EXPECT_EQ(1u << 3, sector->MatchKeyTags(0, 7));
+  EXPECT_EQ(1u << 1, sector->MatchKeyTags(kTagBucketWays, 7));
+  EXPECT_EQ(1u << 4, sector->MatchKeyTags(kTagBucketWays, 200));
+  EXPECT_EQ(0xFFFFu & ~((1u << 1) | (1u << 4)),
+            sector->MatchKeyTags(kTagBucketWays, kNoTag));
+
+  // The tags are separate from the directory entries and the blocks.
+  for (EntryNum e = 0; e < kTaggedEntries; ++e) {
+    std::memset(sector->EntryAt(e)->hash_bytes, 0xFF,
+                SharedMemCacheData::kHashSize);
+  }
+  for (BlockNum b = 0; b < kBlocks; ++b) {
+    std::memset(sector->BlockBytes(b), 0xFF, kBlockSize);
+  }
+  EXPECT_EQ(7, sector->GetKeyTag(3));
+  EXPECT_EQ(0u, sector->MatchKeyTags(0, 0xFF));
+  EXPECT_EQ(0u, sector->MatchKeyTags(kTagBucketWays, 0xFF));
+
+  shmem_runtime_->DestroySegment(kTaggedSegment, &handler_);
+}
+
 bool SharedMemCacheDataTestBase::ParentInit(AbstractSharedMemSegment** out_seg,
                                             Sector<kBlockSize>** out_sector) {
   size_t bytes =
@@ -45,6 +45,7 @@ class SharedMemCacheDataTestBase : public testing::Test {
   void TestFreeList();
   void TestLRU();
   void TestBlockLists();
+  void TestKeyTags();
 
  private:
   bool CreateChild(TestMethod method);
@@ -95,8 +96,12 @@ TYPED_TEST_P(SharedMemCacheDataTestTemplate, TestBlockLists) {
   SharedMemCacheDataTestBase::TestBlockLists();
 }
 
+TYPED_TEST_P(SharedMemCacheDataTestTemplate, TestKeyTags) {
+  SharedMemCacheDataTestBase::TestKeyTags();
+}
+
 REGISTER_TYPED_TEST_SUITE_P(SharedMemCacheDataTestTemplate, TestFreeList,
-                            TestLRU, TestBlockLists);
+                            TestLRU, TestBlockLists, TestKeyTags);
 
 GTEST_ALLOW_UNINSTANTIATED_PARAMETERIZED_TEST(SharedMemCacheDataTestTemplate);
 
@@ -21,6 +21,7 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstddef>  // for size_t
 #include <map>
 #include <memory>
@@ -33,6 +34,7 @@
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
+#include "pagespeed/kernel/sharedmem/shared_mem_cache_checkpoint.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache_snapshot.pb.h"
 #include "pagespeed/kernel/util/platform.h"
 
@@ -48,6 +50,13 @@ const int kSectorEntries = 256;
 const int kSpinRuns = 100;
 // Tests don't actually rely on this value, it just needs to be >0.
 const int kSnapshotIntervalMs = 1000;
+// Geometry of the resizable cache used by the resize tests, and the most it
+// is allowed to grow to.
+const int kResizeSectors = 1;
+const int kResizeEntries = 256;
+const int kResizeBlocks = 100;
+const int64 kResizeMaxKb = 1024;
+const int kResizeKeys = 16;
 
 // In some tests we have tight consumer/producer spinloops assuming they'll get
 // preempted to let other end proceed. Valgrind does not actually do that
@@ -292,6 +301,247 @@ void SharedMemCacheTestBase::TestEvict() {
   small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
 }
 
+void SharedMemCacheTestBase::TestAdmissionPolicy() {
+  const int kAssociativity = SharedMemCache<kBlockSize>::kAssociativity;
+
+  // As in TestConflict, a single associativity set makes every put compete
+  // with the same few entries.
+  std::unique_ptr<SharedMemCache<kBlockSize>> small_cache(
+      new SharedMemCache<kBlockSize>(
+          shmem_runtime_.get(), kAltSegment, &timer_, &hasher_, 1 /* sectors*/,
+          kAssociativity /* entries / sector */, kSectorBlocks, &handler_));
+  small_cache->EnableAdmissionPolicy();
+  ASSERT_TRUE(small_cache->Initialize());
+
+  // A popular key survives a sweep of keys that are each written once,
+  // since none of them has been seen as often.
+  CheckPut(small_cache.get(), "hot", "value");
+  for (int i = 0; i < 5; ++i) {
+    timer_.AdvanceMs(1);
+    CheckGet(small_cache.get(), "hot", "value");
+  }
+  for (int c = 0; c < 20 * kAssociativity; ++c) {
+    timer_.AdvanceMs(1);
+    GoogleString key = IntegerToString(c);
+    CheckPut(small_cache.get(), key, key);
+  }
+  CheckGet(small_cache.get(), "hot", "value");
+  small_cache->SanityCheck();
+
+  small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
+SharedMemCache<SharedMemCacheTestBase::kBlockSize>*
+SharedMemCacheTestBase::MakeResizableCache() {
+  SharedMemCache<kBlockSize>* cache = new SharedMemCache<kBlockSize>(
+      shmem_runtime_.get(), kAltSegment, &timer_, &hasher_, kResizeSectors,
+      kResizeEntries, kResizeBlocks, &handler_);
+  cache->EnableResizing(kResizeMaxKb);
+  return cache;
+}
+
+void SharedMemCacheTestBase::TestResize() {
+  // Resizing needs to be enabled up front.
+  EXPECT_FALSE(cache_->Resize(kSectors * 2, kSectorEntries, kSectorBlocks));
+
+  std::unique_ptr<SharedMemCache<kBlockSize>> cache(MakeResizableCache());
+  ASSERT_TRUE(cache->Initialize());
+  EXPECT_EQ(kResizeSectors, cache->num_sectors());
+  for (int i = 0; i < kResizeKeys; ++i) {
+    GoogleString key = IntegerToString(i);
+    CheckPut(cache.get(), key, key);
+  }
+  CheckPut(cache.get(), "big", large_);
+
+  // Too large for the reservation.
+  EXPECT_FALSE(cache->Resize(8, kSectorEntries, kSectorBlocks));
+  EXPECT_EQ(kResizeSectors, cache->num_sectors());
+
+  // Grow, keeping everything.
+  ASSERT_TRUE(cache->Resize(4, 256, 400));
+  EXPECT_EQ(4, cache->num_sectors());
+  for (int i = 0; i < kResizeKeys; ++i) {
+    GoogleString key = IntegerToString(i);
+    CheckGet(cache.get(), key, key);
+  }
+  CheckGet(cache.get(), "big", large_);
+  cache->SanityCheck();
+
+  // Values too large for the old sectors now fit, too.
+  const GoogleString huge(kResizeBlocks * kBlockSize / 4, 'h');
+  EXPECT_LT(huge.size(), cache->MaxValueSize());
+  CheckPut(cache.get(), "huge", huge);
+  CheckGet(cache.get(), "huge", huge);
+
+  // Shrink back down; small entries still fit, and the cache stays usable.
+  ASSERT_TRUE(cache->Resize(2, kResizeEntries, kResizeBlocks));
+  EXPECT_EQ(2, cache->num_sectors());
+  for (int i = 0; i < kResizeKeys; ++i) {
+    GoogleString key = IntegerToString(i);
+    CheckGet(cache.get(), key, key);
+  }
+  CheckNotFound(cache.get(), "huge");
+  CheckPut(cache.get(), "after", "shrink");
+  CheckGet(cache.get(), "after", "shrink");
+  cache->SanityCheck();
+
+  cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
+void SharedMemCacheTestBase::TestResizeMigration() {
+  std::unique_ptr<SharedMemCache<kBlockSize>> cache(MakeResizableCache());
+  ASSERT_TRUE(cache->Initialize());
+  for (int i = 0; i < kResizeKeys; ++i) {
+    GoogleString key = IntegerToString(i);
+    CheckPut(cache.get(), key, key);
+  }
+
+  ASSERT_TRUE(cache->StartResize(2, kResizeEntries, 200));
+  EXPECT_FALSE(cache->StartResize(4, kResizeEntries, 200));  // One at a time.
+
+  // Nothing has moved yet, so these are served by the old sectors.
+  for (int i = 0; i < kResizeKeys; ++i) {
+    GoogleString key = IntegerToString(i);
+    CheckGet(cache.get(), key, key);
+  }
+
+  // Writes and deletes made mid-resize must not be undone by migration.
+  CheckPut(cache.get(), "0", "new");
+  cache->Delete("1");
+  CheckPut(cache.get(), "fresh", "value");
+
+  // An operation that starts now and never finishes, as if its process had
+  // died, keeps the old sectors pinned.
+  auto* stuck_view = cache->PinView();
+
+  int migrations = 0;
+  while (cache->MigrateNextSector()) {
+    ++migrations;
+  }
+  EXPECT_EQ(kResizeSectors, migrations);
+  EXPECT_FALSE(cache->MigrateNextSector());
+
+  CheckGet(cache.get(), "0", "new");
+  CheckNotFound(cache.get(), "1");
+  CheckGet(cache.get(), "fresh", "value");
+  for (int i = 2; i < kResizeKeys; ++i) {
+    GoogleString key = IntegerToString(i);
+    CheckGet(cache.get(), key, key);
+  }
+  cache->SanityCheck();
+
+  // So the next resize gives up rather than wait for it forever, leaving the
+  // cache alone.
+  EXPECT_FALSE(cache->Resize(1, kResizeEntries, kResizeBlocks));
+  EXPECT_EQ(2, cache->num_sectors());
+  CheckGet(cache.get(), "fresh", "value");
+
+  // With the migration done and the old sectors free, a new resize may start.
+  cache->UnpinView(stuck_view);
+  EXPECT_TRUE(cache->Resize(1, kResizeEntries, kResizeBlocks));
+  CheckGet(cache.get(), "fresh", "value");
+
+  cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
+void SharedMemCacheTestBase::TestResizeWithChild() {
+  std::unique_ptr<SharedMemCache<kBlockSize>> cache(MakeResizableCache());
+  ASSERT_TRUE(cache->Initialize());
+  CheckPut(cache.get(), "parent", "before");
+  CreateChild(&SharedMemCacheTestBase::TestResizeWithChildChild);
+
+  // Wait for the child to attach and write, then resize under it.
+  CacheTestBase::Callback callback;
+  while (callback.state() != CacheInterface::kAvailable) {
+    cache->Get("child", callback.Reset());
+    ASSERT_TRUE(callback.called());
+    YieldToThread();
+  }
+  ASSERT_TRUE(cache->Resize(4, kResizeEntries, 200));
+  CheckPut(cache.get(), "go", "resized");
+
+  // The child sees the new geometry and writes through it.
+  callback.Reset();
+  while (callback.state() != CacheInterface::kAvailable) {
+    cache->Get("done", callback.Reset());
+    ASSERT_TRUE(callback.called());
+    YieldToThread();
+  }
+  EXPECT_EQ("ok", callback.value().Value());
+  test_env_->WaitForChildren();
+
+  cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
+void SharedMemCacheTestBase::TestResizeWithChildChild() {
+  std::unique_ptr<SharedMemCache<kBlockSize>> child_cache(
+      MakeResizableCache());
+  if (!child_cache->Attach()) {
+    test_env_->ChildFailed();
+  }
+  child_cache->Put("child", SharedString("hello"));
+
+  CacheTestBase::Callback callback;
+  while (callback.state() != CacheInterface::kAvailable) {
+    child_cache->Get("go", callback.Reset());
+    YieldToThread();
+  }
+
+  callback.Reset();
+  child_cache->Get("parent", &callback);
+  if (callback.state() != CacheInterface::kAvailable ||
+      callback.value().Value() != "before" ||
+      child_cache->num_sectors() != 4) {
+    test_env_->ChildFailed();
+  }
+  child_cache->Put("done", SharedString("ok"));
+}
+
+void SharedMemCacheTestBase::TestTaggedDirectory() {
+  const int kWays = SharedMemCacheData::kTagBucketWays;
+
+  // A single sector with a single bucket, so every key competes for the
+  // same entries.  The entry count is rounded up to a whole bucket.
+  std::unique_ptr<SharedMemCache<kBlockSize>> small_cache(
+      new SharedMemCache<kBlockSize>(
+          shmem_runtime_.get(), kAltSegment, &timer_, &hasher_, 1 /* sectors*/,
+          kWays - 3 /* entries / sector */, kSectorBlocks, &handler_));
+  small_cache->set_directory_layout(
+      SharedMemCache<kBlockSize>::kTaggedBuckets);
+  ASSERT_TRUE(small_cache->Initialize());
+
+  // Unlike with 4-way skew associativity, a full bucket's worth of keys all
+  // fit without conflicts.
+  for (int c = 0; c < kWays; ++c) {
+    timer_.AdvanceMs(1);
+    GoogleString key = IntegerToString(c);
+    CheckPut(small_cache.get(), key, key);
+  }
+  for (int c = 0; c < kWays; ++c) {
+    GoogleString key = IntegerToString(c);
+    CheckGet(small_cache.get(), key, key);
+    timer_.AdvanceMs(1);
+  }
+  small_cache->SanityCheck();
+
+  // One more key replaces the least recently used one.
+  CheckGet(small_cache.get(), "0", "0");
+  timer_.AdvanceMs(1);
+  CheckPut(small_cache.get(), "new", "value");
+  CheckGet(small_cache.get(), "new", "value");
+  CheckNotFound(small_cache.get(), "1");
+  CheckGet(small_cache.get(), "0", "0");
+
+  // Overwrites and deletes keep the tags in step with the keys.
+  CheckPut(small_cache.get(), "2", large_);
+  CheckGet(small_cache.get(), "2", large_);
+  small_cache->Delete("3");
+  CheckNotFound(small_cache.get(), "3");
+  small_cache->SanityCheck();
+
+  small_cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
 void SharedMemCacheTestBase::CheckDumpsEqual(const SharedMemCacheDump& a,
                                              const SharedMemCacheDump& b,
                                              const char* test_label) {
@@ -539,4 +789,219 @@ void SharedMemCacheTestBase::TestCheckpointAndRestore() {
   CheckNotFound("200");
 }
 
+StringVector SharedMemCacheTestBase::CheckpointFiles() {
+  StringVector files;
+  for (int sector_num = 0; sector_num < cache_->num_sectors(); ++sector_num) {
+    files.push_back(cache_->CheckpointPathForTesting(sector_num));
+  }
+  return files;
+}
+
+int SharedMemCacheTestBase::CountCheckpointRecords(FileSystem* file_system) {
+  int records = 0;
+  for (const GoogleString& file : CheckpointFiles()) {
+    SharedMemCacheCheckpointReader reader(file_system, file, &handler_);
+    EXPECT_TRUE(reader.Open());
+    StringPiece raw_key, value;
+    int64 last_use_timestamp_ms;
+    while (reader.Next(&raw_key, &last_use_timestamp_ms, &value)) {
+    }
+    EXPECT_FALSE(reader.damaged());
+    records += reader.records();
+  }
+  return records;
+}
+
+void SharedMemCacheTestBase::CheckpointAllSectors() {
+  for (int sector_num = 0; sector_num < cache_->num_sectors(); ++sector_num) {
+    cache_->WriteOutSnapshotForTesting(
+        sector_num, cache_->GetLastWriteMsForTesting(sector_num));
+  }
+}
+
+void SharedMemCacheTestBase::TestIncrementalCheckpoint() {
+  const GoogleString kPath = "/incremental-path";
+  std::unique_ptr<FileCacheTestWrapper> file_cache_wrapper(
+      new FileCacheTestWrapper(kPath, thread_system_.get(), &timer_,
+                               &handler_));
+  MemFileSystem* file_system = file_cache_wrapper->filesystem();
+  auto restart_cache = [&]() {
+    cache_ = std::make_unique<SharedMemCache<kBlockSize>>(
+        shmem_runtime_.get(), kPath, &timer_, &hasher_, kSectors,
+        kSectorEntries, kSectorBlocks, &handler_);
+    cache_->RegisterSnapshotFileCache(file_cache_wrapper->file_cache(),
+                                      kSnapshotIntervalMs);
+    EXPECT_TRUE(cache_->Initialize());
+  };
+  restart_cache();
+
+  // The first checkpoint writes out everything.
+  CheckPut("a", "1");
+  CheckPut("b", "2");
+  CheckPut("c", large_);
+  timer_.AdvanceMs(1);
+  CheckpointAllSectors();
+  EXPECT_EQ(3, CountCheckpointRecords(file_system));
+
+  // The files are kept where the file cache's cleaner won't remove them.
+  for (const GoogleString& file : CheckpointFiles()) {
+    EXPECT_TRUE(StringPiece(file).starts_with(
+        file_cache_wrapper->file_cache()->uncleaned_path()))
+        << file;
+  }
+
+  // Later ones only append what was written since: a new entry, but not one
+  // that was only read.
+  timer_.AdvanceMs(10);
+  CheckPut("d", "4");
+  CheckGet("a", "1");
+  timer_.AdvanceMs(1);
+  CheckpointAllSectors();
+  EXPECT_EQ(4, CountCheckpointRecords(file_system));
+
+  // Nothing was written since, so nothing is appended.
+  timer_.AdvanceMs(10);
+  CheckGet("b", "2");
+  CheckpointAllSectors();
+  EXPECT_EQ(4, CountCheckpointRecords(file_system));
+
+  // Everything is restored, including the update to "a" made after the
+  // first checkpoint.
+  timer_.AdvanceMs(10);
+  CheckPut("a", "new");
+  timer_.AdvanceMs(1);
+  CheckpointAllSectors();
+  restart_cache();
+  CheckGet("a", "new");
+  CheckGet("b", "2");
+  CheckGet("c", large_);
+  CheckGet("d", "4");
+
+  // The first checkpoint after a restart rewrites the files, dropping the
+  // stale copies of "a".
+  timer_.AdvanceMs(1);
+  CheckpointAllSectors();
+  EXPECT_EQ(4, CountCheckpointRecords(file_system));
+
+  // A delete can't be appended, so it makes the sector's next checkpoint a
+  // rewrite.
+  timer_.AdvanceMs(10);
+  CheckDelete("b");
+  timer_.AdvanceMs(1);
+  CheckpointAllSectors();
+  EXPECT_EQ(3, CountCheckpointRecords(file_system));
+  restart_cache();
+  CheckNotFound("b");
+  CheckGet("a", "new");
+
+  // A torn record at the end of a file, as left by a crash while appending,
+  // loses nothing before it.
+  for (const GoogleString& file : CheckpointFiles()) {
+    GoogleString contents;
+    ASSERT_TRUE(file_system->ReadFile(file.c_str(), &contents, &handler_));
+    contents.append(contents.substr(0, contents.size() / 2));
+    ASSERT_TRUE(file_system->WriteFile(file.c_str(), contents, &handler_));
+  }
+  restart_cache();
+  CheckGet("a", "new");
+  CheckGet("c", large_);
+  CheckGet("d", "4");
+  CheckNotFound("b");
+}
+
+StringVector SharedMemCacheTestBase::ListCheckpointDir(
+    SharedMemCache<kBlockSize>* cache, FileSystem* file_system) {
+  GoogleString path = cache->CheckpointPathForTesting(0);
+  StringPiece dir = StringPiece(path).substr(0, path.rfind('/'));
+  StringVector files;
+  EXPECT_TRUE(file_system->ListContents(dir, &files, &handler_));
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+void SharedMemCacheTestBase::TestCheckpointAcrossGeometries() {
+  const GoogleString kPath = "/geometry-path";
+  std::unique_ptr<FileCacheTestWrapper> file_cache_wrapper(
+      new FileCacheTestWrapper(kPath, thread_system_.get(), &timer_,
+                               &handler_));
+  MemFileSystem* file_system = file_cache_wrapper->filesystem();
+  auto restart_cache = [&](int sectors, int blocks_per_sector) {
+    cache_ = std::make_unique<SharedMemCache<kBlockSize>>(
+        shmem_runtime_.get(), kPath, &timer_, &hasher_, sectors,
+        kSectorEntries, blocks_per_sector, &handler_);
+    cache_->RegisterSnapshotFileCache(file_cache_wrapper->file_cache(),
+                                      kSnapshotIntervalMs);
+    EXPECT_TRUE(cache_->Initialize());
+  };
+  restart_cache(kSectors, kSectorBlocks);
+  CheckPut("a", "1");
+  CheckPut("b", large_);
+  timer_.AdvanceMs(1);
+  CheckpointAllSectors();
+  StringVector files = CheckpointFiles();
+  std::sort(files.begin(), files.end());
+  EXPECT_EQ(files, ListCheckpointDir(cache_.get(), file_system));
+
+  // Restarting with another size restores the entries, checkpoints them
+  // with the new size, and removes the old size's files.  File times are in
+  // seconds, so let one pass to tell the checkpoints apart.
+  timer_.AdvanceMs(Timer::kSecondMs);
+  restart_cache(kSectors * 2, kSectorBlocks / 2);
+  CheckGet("a", "1");
+  CheckGet("b", large_);
+  files = CheckpointFiles();
+  std::sort(files.begin(), files.end());
+  EXPECT_EQ(kSectors * 2, files.size());
+  EXPECT_EQ(files, ListCheckpointDir(cache_.get(), file_system));
+
+  // Entries written since are found after going back to the original size.
+  CheckPut("c", "3");
+  timer_.AdvanceMs(Timer::kSecondMs);
+  CheckpointAllSectors();
+  timer_.AdvanceMs(Timer::kSecondMs);
+  restart_cache(kSectors, kSectorBlocks);
+  CheckGet("a", "1");
+  CheckGet("b", large_);
+  CheckGet("c", "3");
+  files = CheckpointFiles();
+  std::sort(files.begin(), files.end());
+  EXPECT_EQ(files, ListCheckpointDir(cache_.get(), file_system));
+
+  // An online resize does the same once the entries have moved.
+  std::unique_ptr<SharedMemCache<kBlockSize>> cache(MakeResizableCache());
+  cache->RegisterSnapshotFileCache(file_cache_wrapper->file_cache(),
+                                   kSnapshotIntervalMs);
+  ASSERT_TRUE(cache->Initialize());
+  for (int i = 0; i < kResizeKeys; ++i) {
+    GoogleString key = IntegerToString(i);
+    CheckPut(cache.get(), key, key);
+  }
+  timer_.AdvanceMs(1);
+  cache->WriteOutSnapshotForTesting(0, 0);
+  StringVector before = ListCheckpointDir(cache.get(), file_system);
+  EXPECT_EQ(1, before.size());
+  timer_.AdvanceMs(Timer::kSecondMs);
+  ASSERT_TRUE(cache->Resize(4, kResizeEntries, 200));
+  StringVector after = ListCheckpointDir(cache.get(), file_system);
+  EXPECT_EQ(4, after.size());
+  for (const GoogleString& file : before) {
+    EXPECT_TRUE(std::find(after.begin(), after.end(), file) == after.end())
+        << file;
+  }
+  cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+
+  // A restart at the original size finds them in the resized checkpoints.
+  timer_.AdvanceMs(Timer::kSecondMs);
+  cache.reset(MakeResizableCache());
+  cache->RegisterSnapshotFileCache(file_cache_wrapper->file_cache(),
+                                   kSnapshotIntervalMs);
+  ASSERT_TRUE(cache->Initialize());
+  for (int i = 0; i < kResizeKeys; ++i) {
+    GoogleString key = IntegerToString(i);
+    CheckGet(cache.get(), key, key);
+  }
+  EXPECT_EQ(1, ListCheckpointDir(cache.get(), file_system).size());
+  cache->GlobalCleanup(shmem_runtime_.get(), kAltSegment, &handler_);
+}
+
 }  // namespace net_instaweb
@@ -25,6 +25,7 @@
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/sharedmem/shared_mem_cache.h"
 #include "pagespeed/kernel/thread/slow_worker.h"
 #include "pagespeed/kernel/util/simple_stats.h"
@@ -37,6 +38,7 @@
 
 namespace net_instaweb {
 
+class FileSystem;
 class SharedMemCacheDump;
 class ThreadSystem;
 
@@ -61,6 +63,13 @@ class SharedMemCacheTestBase : public CacheTestBase {
   void TestSnapshot();
   void TestRegisterSnapshotFileCache();
   void TestCheckpointAndRestore();
+  void TestIncrementalCheckpoint();
+  void TestCheckpointAcrossGeometries();
+  void TestAdmissionPolicy();
+  void TestResize();
+  void TestResizeMigration();
+  void TestResizeWithChild();
+  void TestTaggedDirectory();
 
   void ResetCache();
 
@@ -72,7 +81,17 @@ class SharedMemCacheTestBase : public CacheTestBase {
 
   SharedMemCache<kBlockSize>* MakeCache();
   void CheckDelete(const char* key);
+  // Checkpoints every sector of cache_, whenever it was last checkpointed.
+  void CheckpointAllSectors();
+  // The checkpoint files of cache_, and the intact records in them.
+  StringVector CheckpointFiles();
+  int CountCheckpointRecords(FileSystem* file_system);
+  // Everything in the directory holding cache's checkpoints, sorted.
+  StringVector ListCheckpointDir(SharedMemCache<kBlockSize>* cache,
+                                 FileSystem* file_system);
   void TestReaderWriterChild();
+  SharedMemCache<kBlockSize>* MakeResizableCache();
+  void TestResizeWithChildChild();
 
   std::unique_ptr<SharedMemTestEnv> test_env_;
   std::unique_ptr<AbstractSharedMem> shmem_runtime_;
@@ -164,11 +183,44 @@ TYPED_TEST_P(SharedMemCacheTestTemplate, TestCheckpointAndRestore) {
   SharedMemCacheTestBase::TestCheckpointAndRestore();
 }
 
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestIncrementalCheckpoint) {
+  SharedMemCacheTestBase::TestIncrementalCheckpoint();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestCheckpointAcrossGeometries) {
+  SharedMemCacheTestBase::TestCheckpointAcrossGeometries();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestAdmissionPolicy) {
+  SharedMemCacheTestBase::TestAdmissionPolicy();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestResize) {
+  SharedMemCacheTestBase::TestResize();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestResizeMigration) {
+  SharedMemCacheTestBase::TestResizeMigration();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestResizeWithChild) {
+  SharedMemCacheTestBase::TestResizeWithChild();
+}
+
+TYPED_TEST_P(SharedMemCacheTestTemplate, TestTaggedDirectory) {
+  SharedMemCacheTestBase::TestTaggedDirectory();
+}
+
 REGISTER_TYPED_TEST_SUITE_P(SharedMemCacheTestTemplate, TestBasic, TestReinsert,
                             TestReplacement, TestReaderWriter, TestConflict,
                             TestEvict, TestSnapshot,
                             TestRegisterSnapshotFileCache,
-                            TestCheckpointAndRestore);
+                            TestCheckpointAndRestore,
+                            TestIncrementalCheckpoint,
+                            TestCheckpointAcrossGeometries,
+                            TestAdmissionPolicy, TestResize,
+                            TestResizeMigration, TestResizeWithChild,
+                            TestTaggedDirectory);
 GTEST_ALLOW_UNINSTANTIATED_PARAMETERIZED_TEST(SharedMemCacheTestTemplate);
 
 }  // namespace net_instaweb
@@ -51,6 +51,7 @@ const char kStatsLogFile[] = "";
 const int64 SharedMemStatisticsTestBase::kLogIntervalMs = 3 * Timer::kSecondMs;
 // Set this small for TestLogfileTrimming.
 const int64 SharedMemStatisticsTestBase::kMaxLogfileSizeKb = 10;
+const int SharedMemStatisticsTestBase::kConcurrentAdds;
 
 SharedMemStatisticsTestBase::SharedMemStatisticsTestBase(
     SharedMemTestEnv* test_env)
@@ -290,6 +291,41 @@ void SharedMemStatisticsTestBase::TestAddChild() {
   hist2->Add(4);
 }
 
+void SharedMemStatisticsTestBase::TestConcurrentAdd() {
+  ParentInit();
+  UpDownCounter* v1 = stats_->GetUpDownCounter(kVar1);
+  Histogram* hist1 = stats_->GetHistogram(kHist1);
+
+  // The children all add at once, and more of them than there are histogram
+  // stripes, so some of them share one.
+  const int kChildren = SharedMemHistogram::kStripes + 2;
+  for (int i = 0; i < kChildren; ++i) {
+    ASSERT_TRUE(
+        CreateChild(&SharedMemStatisticsTestBase::TestConcurrentAddChild));
+  }
+  test_env_->WaitForChildren();
+  EXPECT_EQ(kChildren * kConcurrentAdds, v1->Get());
+  EXPECT_EQ(kChildren * kConcurrentAdds, hist1->Count());
+  EXPECT_EQ(0, hist1->Minimum());
+  EXPECT_EQ(99, hist1->Maximum());
+  EXPECT_DOUBLE_EQ(49.5, hist1->Average());
+  double bucket_total = 0;
+  for (int i = 0; i < hist1->NumBuckets(); ++i) {
+    bucket_total += hist1->BucketCount(i);
+  }
+  EXPECT_EQ(kChildren * kConcurrentAdds, bucket_total);
+}
+
+void SharedMemStatisticsTestBase::TestConcurrentAddChild() {
+  std::unique_ptr<SharedMemStatistics> stats(ChildInit());
+  UpDownCounter* v1 = stats->GetUpDownCounter(kVar1);
+  Histogram* hist1 = stats->GetHistogram(kHist1);
+  for (int i = 0; i < kConcurrentAdds; ++i) {
+    v1->Add(1);
+    hist1->Add(i % 100);
+  }
+}
+
 // This function tests the Histogram options with multi-processes.
 void SharedMemStatisticsTestBase::TestHistogram() {
   ParentInit();
@@ -42,6 +42,7 @@ class SharedMemStatisticsTestBase : public testing::Test {
 
   static const int64 kLogIntervalMs;
   static const int64 kMaxLogfileSizeKb;
+  static const int kConcurrentAdds = 10000;
 
   SharedMemStatisticsTestBase();
   explicit SharedMemStatisticsTestBase(SharedMemTestEnv* test_env);
@@ -54,6 +55,7 @@ class SharedMemStatisticsTestBase : public testing::Test {
   void TestSet();
   void TestClear();
   void TestAdd();
+  void TestConcurrentAdd();
   void TestSetReturningPrevious();
   void TestHistogram();
   void TestHistogramRender();
@@ -79,6 +81,8 @@ class SharedMemStatisticsTestBase : public testing::Test {
 
   // Adds 10x +1 to variable 1, and 10x +2 to variable 2.
   void TestAddChild();
+  // Adds kConcurrentAdds to variable 1, and as many values to histogram 1.
+  void TestConcurrentAddChild();
   bool AddVars(SharedMemStatistics* stats);
   bool AddHistograms(SharedMemStatistics* stats);
   // Helper function for TestHistogramRender().
@@ -120,6 +124,10 @@ TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestAdd) {
   SharedMemStatisticsTestBase::TestAdd();
 }
 
+TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestConcurrentAdd) {
+  SharedMemStatisticsTestBase::TestConcurrentAdd();
+}
+
 TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestSetReturningPrevious) {
   SharedMemStatisticsTestBase::TestSetReturningPrevious();
 }
@@ -145,7 +153,7 @@ TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestTimedVariableEmulation) {
 }
 
 REGISTER_TYPED_TEST_SUITE_P(SharedMemStatisticsTestTemplate, TestCreate,
-                            TestSet, TestClear, TestAdd,
+                            TestSet, TestClear, TestAdd, TestConcurrentAdd,
                             TestSetReturningPrevious, TestHistogram,
                             TestHistogramRender, TestHistogramNoExtraClear,
                             TestHistogramExtremeBuckets,
@@ -0,0 +1,146 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test for MpscQueue.
+
+#include "pagespeed/kernel/thread/mpsc_queue.h"
+
+#include <memory>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+TEST(MpscQueueTest, Fifo) {
+  MpscQueue<int> queue;
+  int value = 0;
+  EXPECT_TRUE(queue.Empty());
+  EXPECT_FALSE(queue.Pop(&value));
+  for (int i = 1; i <= 10; ++i) {
+    queue.Push(i);
+  }
+  EXPECT_FALSE(queue.Empty());
+  for (int i = 1; i <= 5; ++i) {
+    ASSERT_TRUE(queue.Pop(&value));
+    EXPECT_EQ(i, value);
+  }
+  queue.Push(11);
+  for (int i = 6; i <= 11; ++i) {
+    ASSERT_TRUE(queue.Pop(&value));
+    EXPECT_EQ(i, value);
+  }
+  EXPECT_TRUE(queue.Empty());
+  EXPECT_FALSE(queue.Pop(&value));
+}
+
+// Nodes freed by one queue's Pop are reused by later Pushes, including
+// into another queue, and must come back clean.
+TEST(MpscQueueTest, RecycledNodes) {
+  MpscQueue<int> first;
+  int value = 0;
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 1000; ++i) {
+      first.Push(i);
+    }
+    for (int i = 0; i < 1000; ++i) {
+      ASSERT_TRUE(first.Pop(&value));
+      EXPECT_EQ(i, value);
+    }
+    EXPECT_TRUE(first.Empty());
+  }
+
+  std::unique_ptr<MpscQueue<int>> second(new MpscQueue<int>);
+  for (int i = 0; i < 10; ++i) {
+    second->Push(100 + i);
+  }
+  ASSERT_TRUE(second->Pop(&value));
+  EXPECT_EQ(100, value);
+  // Destroying a queue that still holds recycled nodes must free them.
+  second.reset();
+  first.Push(7);
+  ASSERT_TRUE(first.Pop(&value));
+  EXPECT_EQ(7, value);
+  EXPECT_FALSE(first.Pop(&value));
+}
+
+// Pushes kCount consecutive integers starting at 'first'.
+class Producer : public ThreadSystem::Thread {
+ public:
+  static const int kCount = 20000;
+
+  Producer(ThreadSystem* thread_system, MpscQueue<int>* queue, int first)
+      : Thread(thread_system, "mpsc_producer", ThreadSystem::kJoinable),
+        queue_(queue),
+        first_(first) {}
+
+  void Run() override {
+    for (int i = 0; i < kCount; ++i) {
+      queue_->Push(first_ + i);
+    }
+  }
+
+ private:
+  MpscQueue<int>* queue_;
+  int first_;
+
+  DISALLOW_COPY_AND_ASSIGN(Producer);
+};
+
+const int Producer::kCount;
+
+// Each producer's values must come out in the order it pushed them, and
+// none may be lost.
+TEST(MpscQueueTest, ConcurrentProducers) {
+  const int kProducers = 4;
+  std::unique_ptr<ThreadSystem> thread_system(Platform::CreateThreadSystem());
+  MpscQueue<int> queue;
+  std::vector<std::unique_ptr<Producer>> producers;
+  for (int i = 0; i < kProducers; ++i) {
+    producers.emplace_back(
+        new Producer(thread_system.get(), &queue, i * Producer::kCount));
+    ASSERT_TRUE(producers.back()->Start());
+  }
+
+  std::vector<int> next(kProducers, 0);
+  int popped = 0;
+  while (popped < kProducers * Producer::kCount) {
+    int value;
+    if (queue.Pop(&value)) {
+      int producer = value / Producer::kCount;
+      ASSERT_EQ(next[producer], value % Producer::kCount);
+      ++next[producer];
+      ++popped;
+    }
+  }
+  for (int i = 0; i < kProducers; ++i) {
+    producers[i]->Join();
+  }
+  EXPECT_TRUE(queue.Empty());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
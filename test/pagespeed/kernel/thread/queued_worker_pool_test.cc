@@ -21,6 +21,8 @@
 
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 
+#include <vector>
+
 #include "base/logging.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/function.h"
@@ -31,11 +33,17 @@
 namespace net_instaweb {
 namespace {
 
-class QueuedWorkerPoolTest : public WorkerTestBase {
+// Parameterized by whether the pool uses work stealing.
+class QueuedWorkerPoolTest : public WorkerTestBase,
+                             public ::testing::WithParamInterface<bool> {
  public:
   QueuedWorkerPoolTest()
       : worker_(new QueuedWorkerPool(2, "queued_worker_pool_test",
-                                     thread_runtime_.get())) {}
+                                     thread_runtime_.get())) {
+    if (GetParam()) {
+      worker_->EnableWorkStealing();
+    }
+  }
 
  protected:
   std::unique_ptr<QueuedWorkerPool> worker_;
@@ -78,7 +86,7 @@ class Increment : public Function {
 };
 
 // Tests that all the jobs queued in one sequence should run sequentially.
-TEST_F(QueuedWorkerPoolTest, BasicOperation) {
+TEST_P(QueuedWorkerPoolTest, BasicOperation) {
   const int kBound = 42;
   int count = 0;
   SyncPoint sync(thread_runtime_.get());
@@ -95,7 +103,7 @@ TEST_F(QueuedWorkerPoolTest, BasicOperation) {
 }
 
 // Test ordinary and cancelled AddFunction callback.
-TEST_F(QueuedWorkerPoolTest, AddFunctionTest) {
+TEST_P(QueuedWorkerPoolTest, AddFunctionTest) {
   const int kBound = 5;
   int count1 = 0;
   int count2 = 0;
@@ -123,7 +131,7 @@ TEST_F(QueuedWorkerPoolTest, AddFunctionTest) {
 // Makes sure that even if one sequence is blocked, another can
 // complete, because we have more than one thread at our disposal in
 // this worker.
-TEST_F(QueuedWorkerPoolTest, SlowAndFastSequences) {
+TEST_P(QueuedWorkerPoolTest, SlowAndFastSequences) {
   const int kBound = 42;
   int count = 0;
   SyncPoint sync(thread_runtime_.get());
@@ -168,7 +176,7 @@ class MakeNewSequence : public Function {
   DISALLOW_COPY_AND_ASSIGN(MakeNewSequence);
 };
 
-TEST_F(QueuedWorkerPoolTest, RestartSequenceFromFunction) {
+TEST_P(QueuedWorkerPoolTest, RestartSequenceFromFunction) {
   SyncPoint sync(thread_runtime_.get());
   QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
   sequence->Add(new MakeNewSequence(&sync, worker_.get(), sequence));
@@ -197,7 +205,7 @@ class LogOpsFunction : public Function {
 
 // Make sure calling add after worker was shut down Cancel()s the function
 // properly.
-TEST_F(QueuedWorkerPoolTest, AddAfterShutDown) {
+TEST_P(QueuedWorkerPoolTest, AddAfterShutDown) {
   QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
   worker_->ShutDown();
   LogOpsFunction f;
@@ -207,7 +215,7 @@ TEST_F(QueuedWorkerPoolTest, AddAfterShutDown) {
   EXPECT_FALSE(f.run_called());
 }
 
-TEST_F(QueuedWorkerPoolTest, LoadShedding) {
+TEST_P(QueuedWorkerPoolTest, LoadShedding) {
   const int kThresh = 100;
   worker_->SetLoadSheddingThreshold(kThresh);
   // Tests that load shedding works, and does so in FIFO order.
@@ -283,7 +291,7 @@ class NotifyAndWait : public Function {
   WorkerTestBase::SyncPoint* wait_;
 };
 
-TEST_F(QueuedWorkerPoolTest, MaxQueueSize) {
+TEST_P(QueuedWorkerPoolTest, MaxQueueSize) {
   SyncPoint started(thread_runtime_.get());
   SyncPoint wait(thread_runtime_.get());
   SyncPoint done(thread_runtime_.get());
@@ -303,7 +311,7 @@ TEST_F(QueuedWorkerPoolTest, MaxQueueSize) {
   EXPECT_EQ(-97, count);
 }
 
-TEST_F(QueuedWorkerPoolTest, CancelPending) {
+TEST_P(QueuedWorkerPoolTest, CancelPending) {
   SyncPoint wait(thread_runtime_.get());
   SyncPoint done(thread_runtime_.get());
   QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
@@ -319,6 +327,84 @@ TEST_F(QueuedWorkerPoolTest, CancelPending) {
   EXPECT_EQ(-300, count);
 }
 
+// Adds 'count' functions to a sequence, each of which checks it runs in
+// order and that no other function of the sequence is running.
+class FanOut : public Function {
+ public:
+  FanOut(QueuedWorkerPool::Sequence* sequence, int count, int* counter,
+         WorkerTestBase::SyncPoint* done)
+      : sequence_(sequence), count_(count), counter_(counter), done_(done) {}
+
+ protected:
+  void Run() override {
+    for (int i = 0; i < count_; ++i) {
+      sequence_->Add(new Increment(i + 1, counter_));
+    }
+    sequence_->Add(new WorkerTestBase::NotifyRunFunction(done_));
+  }
+
+ private:
+  QueuedWorkerPool::Sequence* sequence_;
+  int count_;
+  int* counter_;
+  WorkerTestBase::SyncPoint* done_;
+
+  DISALLOW_COPY_AND_ASSIGN(FanOut);
+};
+
+// Makes sequences runnable from inside worker threads, which with work
+// stealing puts them on the workers' own deques for others to steal.
+TEST_P(QueuedWorkerPoolTest, AddFromWorkers) {
+  const int kSequences = 20;
+  const int kBound = 50;
+  QueuedWorkerPool::Sequence* spawner = worker_->NewSequence();
+  std::vector<QueuedWorkerPool::Sequence*> sequences;
+  std::vector<int> counts(kSequences, 0);
+  std::vector<SyncPoint*> done;
+  for (int i = 0; i < kSequences; ++i) {
+    sequences.push_back(worker_->NewSequence());
+    done.push_back(new SyncPoint(thread_runtime_.get()));
+    spawner->Add(new FanOut(sequences[i], kBound, &counts[i], done[i]));
+  }
+  for (int i = 0; i < kSequences; ++i) {
+    done[i]->Wait();
+    EXPECT_EQ(kBound, counts[i]);
+    delete done[i];
+    worker_->FreeSequence(sequences[i]);
+  }
+  worker_->FreeSequence(spawner);
+}
+
+// Adds to one sequence from several threads at once.
+TEST_P(QueuedWorkerPoolTest, ConcurrentAdds) {
+  const int kProducers = 4;
+  const int kBound = 200;
+  QueuedWorkerPool producers(kProducers, "queued_worker_pool_producers",
+                             thread_runtime_.get());
+  QueuedWorkerPool::Sequence* sequence = worker_->NewSequence();
+  int count = 0;
+  std::vector<SyncPoint*> added;
+  for (int i = 0; i < kProducers; ++i) {
+    added.push_back(new SyncPoint(thread_runtime_.get()));
+    QueuedWorkerPool::Sequence* producer = producers.NewSequence();
+    for (int j = 0; j < kBound; ++j) {
+      producer->Add(new QueuedWorkerPool::Sequence::AddFunction(
+          sequence, new CountFunction(&count)));
+    }
+    producer->Add(new NotifyRunFunction(added[i]));
+  }
+  for (int i = 0; i < kProducers; ++i) {
+    added[i]->Wait();
+    delete added[i];
+  }
+  WaitUntilSequenceCompletes(sequence);
+  EXPECT_EQ(kProducers * kBound, count);
+  worker_->FreeSequence(sequence);
+}
+
+INSTANTIATE_TEST_SUITE_P(QueuedWorkerPoolTestInstance, QueuedWorkerPoolTest,
+                         ::testing::Bool());
+
 }  // namespace
 
 }  // namespace net_instaweb
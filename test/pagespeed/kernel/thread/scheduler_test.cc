@@ -33,12 +33,17 @@ namespace net_instaweb {
 // Many tests cribbed from mock_timer_test, only without the mockery.  This
 // actually restricts the timing dependencies we can detect, though not in a
 // terrible way.
-class SchedulerTest : public WorkerTestBase {
+//
+// Each test runs with both the timer-wheel and the std::set alarm queues.
+class SchedulerTest : public WorkerTestBase,
+                      public ::testing::WithParamInterface<bool> {
  protected:
   SchedulerTest()
       : thread_system_(Platform::CreateThreadSystem()),
         timer_(thread_system_->NewTimer()),
-        scheduler_(thread_system_.get(), timer_.get()) {}
+        scheduler_(thread_system_.get(), timer_.get()) {
+    scheduler_.set_use_timer_wheel(GetParam());
+  }
 
   int Compare(const Scheduler::Alarm* a, const Scheduler::Alarm* b) const {
     Scheduler::CompareAlarms comparator;
@@ -70,7 +75,7 @@ class SchedulerTest : public WorkerTestBase {
 
 namespace {
 
-TEST_F(SchedulerTest, AlarmsGetRun) {
+TEST_P(SchedulerTest, AlarmsGetRun) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   // Note that we give this test extra time (50ms) to start up so that
@@ -109,7 +114,7 @@ TEST_F(SchedulerTest, AlarmsGetRun) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, MidpointBlock) {
+TEST_P(SchedulerTest, MidpointBlock) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   scheduler_.AddAlarmAtUs(start_us + 2 * Timer::kMsUs,
@@ -134,7 +139,7 @@ TEST_F(SchedulerTest, MidpointBlock) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, AlarmInPastRuns) {
+TEST_P(SchedulerTest, AlarmInPastRuns) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   scheduler_.AddAlarmAtUs(start_us - 2 * Timer::kMsUs,
@@ -152,7 +157,7 @@ TEST_F(SchedulerTest, AlarmInPastRuns) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, MidpointCancellation) {
+TEST_P(SchedulerTest, MidpointCancellation) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   scheduler_.AddAlarmAtUs(start_us + 3 * Timer::kMsUs,
@@ -182,7 +187,7 @@ TEST_F(SchedulerTest, MidpointCancellation) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, SimultaneousAlarms) {
+TEST_P(SchedulerTest, SimultaneousAlarms) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   scheduler_.AddAlarmAtUs(start_us + 2 * Timer::kMsUs,
@@ -200,7 +205,7 @@ TEST_F(SchedulerTest, SimultaneousAlarms) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, TimedWaitExpire) {
+TEST_P(SchedulerTest, TimedWaitExpire) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   {
@@ -218,7 +223,7 @@ TEST_F(SchedulerTest, TimedWaitExpire) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, TimedWaitSignal) {
+TEST_P(SchedulerTest, TimedWaitSignal) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   {
@@ -235,7 +240,7 @@ TEST_F(SchedulerTest, TimedWaitSignal) {
   EXPECT_GT(start_us + Timer::kMinuteUs, end_us);
 }
 
-TEST_F(SchedulerTest, TimedWaitMidpointSignal) {
+TEST_P(SchedulerTest, TimedWaitMidpointSignal) {
   int64 start_us = timer_->NowUs();
   int counter = 0;
   {
@@ -287,7 +292,7 @@ class RetryWaitFunction : public Function {
   DISALLOW_COPY_AND_ASSIGN(RetryWaitFunction);
 };
 
-TEST_F(SchedulerTest, TimedWaitFromSignalWakeup) {
+TEST_P(SchedulerTest, TimedWaitFromSignalWakeup) {
   int counter = 0;
   int64 start_ms = timer_->NowMs();
   {
@@ -300,6 +305,9 @@ TEST_F(SchedulerTest, TimedWaitFromSignalWakeup) {
   EXPECT_GE(2, counter);
 }
 
+INSTANTIATE_TEST_SUITE_P(SchedulerTestInstance, SchedulerTest,
+                         ::testing::Bool());
+
 }  // namespace
 
 }  // namespace net_instaweb
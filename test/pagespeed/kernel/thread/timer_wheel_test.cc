@@ -0,0 +1,206 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test for TimerWheel.
+
+#include "pagespeed/kernel/thread/timer_wheel.h"
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/util/simple_random.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+typedef TimerWheel::Entry Entry;
+
+struct CompareEntries {
+  bool operator()(const Entry* a, const Entry* b) const {
+    return TimerWheel::Less(a, b);
+  }
+};
+
+class TimerWheelTest : public testing::Test {
+ protected:
+  TimerWheelTest() : next_index_(0), random_(new NullMutex) {}
+
+  Entry* NewEntry(int64 wakeup_time_us) {
+    entries_.emplace_back(new Entry);
+    Entry* entry = entries_.back().get();
+    entry->set_wakeup_time_us(wakeup_time_us);
+    entry->set_index(++next_index_);
+    return entry;
+  }
+
+  Entry* Add(int64 wakeup_time_us) {
+    Entry* entry = NewEntry(wakeup_time_us);
+    wheel_.Insert(entry);
+    return entry;
+  }
+
+  TimerWheel wheel_;
+  std::vector<std::unique_ptr<Entry>> entries_;
+  uint32 next_index_;
+  SimpleRandom random_;
+};
+
+TEST_F(TimerWheelTest, Empty) {
+  EXPECT_TRUE(wheel_.empty());
+  EXPECT_EQ(nullptr, wheel_.Earliest());
+  EXPECT_EQ(nullptr, wheel_.PopExpired(1000000));
+}
+
+TEST_F(TimerWheelTest, ExpiresInOrder) {
+  // Spread over several levels, with a tie broken by insertion order.
+  Entry* e5000 = Add(5000);
+  Entry* e70 = Add(70);
+  Entry* e5000b = Add(5000);
+  Entry* e3 = Add(3);
+  Entry* e1000000 = Add(1000000);
+  EXPECT_EQ(5, wheel_.size());
+  EXPECT_EQ(e3, wheel_.Earliest());
+  EXPECT_EQ(nullptr, wheel_.PopExpired(2));
+  EXPECT_EQ(e3, wheel_.PopExpired(3));
+  EXPECT_EQ(nullptr, wheel_.PopExpired(69));
+  EXPECT_EQ(e70, wheel_.Earliest());
+  EXPECT_EQ(e70, wheel_.PopExpired(10000));
+  EXPECT_EQ(e5000, wheel_.PopExpired(10000));
+  EXPECT_EQ(e5000b, wheel_.PopExpired(10000));
+  EXPECT_EQ(nullptr, wheel_.PopExpired(10000));
+  EXPECT_EQ(e1000000, wheel_.Earliest());
+  EXPECT_EQ(e1000000, wheel_.PopExpired(2000000));
+  EXPECT_TRUE(wheel_.empty());
+}
+
+TEST_F(TimerWheelTest, Erase) {
+  Entry* e100 = Add(100);
+  Entry* e200 = Add(200);
+  EXPECT_TRUE(e100->in_wheel());
+  EXPECT_TRUE(wheel_.Erase(e100));
+  EXPECT_FALSE(e100->in_wheel());
+  EXPECT_FALSE(wheel_.Erase(e100));
+  EXPECT_EQ(e200, wheel_.Earliest());
+  EXPECT_EQ(e200, wheel_.PopExpired(300));
+  EXPECT_FALSE(wheel_.Erase(e200));  // Already handed out.
+  EXPECT_TRUE(wheel_.empty());
+}
+
+TEST_F(TimerWheelTest, PastEntriesAreDue) {
+  Entry* e1000 = Add(1000);
+  EXPECT_EQ(nullptr, wheel_.PopExpired(900));
+  Entry* e500 = Add(500);
+  EXPECT_EQ(e500, wheel_.Earliest());
+  EXPECT_EQ(e500, wheel_.PopExpired(900));
+  EXPECT_EQ(e1000, wheel_.PopExpired(1000));
+}
+
+TEST_F(TimerWheelTest, ClockGoesBackwards) {
+  wheel_.PopExpired(1000);
+  Entry* e900 = Add(900);
+  EXPECT_EQ(nullptr, wheel_.PopExpired(800));
+  EXPECT_EQ(e900, wheel_.Earliest());
+  EXPECT_EQ(e900, wheel_.PopExpired(950));
+}
+
+TEST_F(TimerWheelTest, EraseEarliestOfUnsortedSlot) {
+  // All of these land in one level-2 slot, out of order, so removing the
+  // earliest one forces the slot to be sorted.
+  Entry* e4000 = Add(4000);
+  Entry* e4090 = Add(4090);
+  Entry* e4010 = Add(4010);
+  Entry* e4050 = Add(4050);
+  Entry* e4001 = Add(4001);
+  EXPECT_EQ(e4000, wheel_.Earliest());
+  EXPECT_TRUE(wheel_.Erase(e4000));
+  EXPECT_EQ(e4001, wheel_.Earliest());
+  EXPECT_TRUE(wheel_.Erase(e4001));
+  EXPECT_EQ(e4010, wheel_.Earliest());
+  EXPECT_EQ(e4010, wheel_.PopExpired(5000));
+  EXPECT_EQ(e4050, wheel_.PopExpired(5000));
+  EXPECT_EQ(e4090, wheel_.PopExpired(5000));
+  EXPECT_TRUE(wheel_.empty());
+}
+
+// Drives the wheel and a std::set through the same random operations, with
+// deadlines spread over many levels, and checks they always agree.
+TEST_F(TimerWheelTest, MatchesSet) {
+  std::set<Entry*, CompareEntries> expected;
+  std::vector<Entry*> live;
+  int64 now_us = 0;
+  for (int i = 0; i < 200000; ++i) {
+    uint32 op = random_.Next() % 8;
+    if (op < 4) {
+      // Deadlines from the recent past to about an hour out, favoring the
+      // near future.
+      int shift = random_.Next() % 33;
+      int64 delta = (random_.Next() % (static_cast<uint64>(1) << shift)) -
+                    static_cast<int64>(random_.Next() % 100);
+      Entry* entry = Add(now_us + delta);
+      expected.insert(entry);
+      live.push_back(entry);
+    } else if (op < 6) {
+      if (!live.empty()) {
+        int pos = random_.Next() % live.size();
+        Entry* entry = live[pos];
+        bool in_set = (expected.erase(entry) != 0);
+        ASSERT_EQ(in_set, wheel_.Erase(entry));
+        live[pos] = live.back();
+        live.pop_back();
+      }
+    } else if (op < 7) {
+      // Cancel whatever is due first, as happens when a fetch beats its
+      // timeout.
+      if (!expected.empty()) {
+        Entry* entry = *expected.begin();
+        ASSERT_EQ(entry, wheel_.Earliest());
+        expected.erase(expected.begin());
+        ASSERT_TRUE(wheel_.Erase(entry));
+      }
+    } else {
+      int shift = random_.Next() % 30;
+      now_us += random_.Next() % (static_cast<uint64>(1) << shift);
+      for (;;) {
+        Entry* entry = wheel_.PopExpired(now_us);
+        if (expected.empty() ||
+            ((*expected.begin())->wakeup_time_us() > now_us)) {
+          ASSERT_EQ(nullptr, entry);
+          break;
+        }
+        ASSERT_EQ(*expected.begin(), entry);
+        expected.erase(expected.begin());
+      }
+    }
+    ASSERT_EQ(expected.size(), wheel_.size());
+    if (expected.empty()) {
+      ASSERT_EQ(nullptr, wheel_.Earliest());
+    } else {
+      ASSERT_EQ(*expected.begin(), wheel_.Earliest());
+    }
+  }
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,124 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test for WorkStealingDeque.
+
+#include "pagespeed/kernel/thread/work_stealing_deque.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+TEST(WorkStealingDequeTest, PopIsLifoStealIsFifo) {
+  int items[4];
+  WorkStealingDeque<int> deque(2);
+  EXPECT_TRUE(deque.Empty());
+  EXPECT_EQ(nullptr, deque.Pop());
+  EXPECT_EQ(nullptr, deque.Steal());
+  for (int i = 0; i < 4; ++i) {
+    deque.Push(&items[i]);  // Grows past the initial capacity.
+  }
+  EXPECT_FALSE(deque.Empty());
+  EXPECT_EQ(&items[0], deque.Steal());
+  EXPECT_EQ(&items[3], deque.Pop());
+  EXPECT_EQ(&items[1], deque.Steal());
+  EXPECT_EQ(&items[2], deque.Pop());
+  EXPECT_EQ(nullptr, deque.Pop());
+  EXPECT_EQ(nullptr, deque.Steal());
+  EXPECT_TRUE(deque.Empty());
+}
+
+// Steals until told to stop, marking each item it gets.
+class Thief : public ThreadSystem::Thread {
+ public:
+  Thief(ThreadSystem* thread_system, WorkStealingDeque<std::atomic<int>>* deque,
+        std::atomic<bool>* stop)
+      : Thread(thread_system, "thief", ThreadSystem::kJoinable),
+        deque_(deque),
+        stop_(stop) {}
+
+  void Run() override {
+    while (!stop_->load()) {
+      std::atomic<int>* item = deque_->Steal();
+      if (item != nullptr) {
+        ++*item;
+      }
+    }
+  }
+
+ private:
+  WorkStealingDeque<std::atomic<int>>* deque_;
+  std::atomic<bool>* stop_;
+
+  DISALLOW_COPY_AND_ASSIGN(Thief);
+};
+
+// While thieves steal, the owner pushes and pops; every item must be
+// taken exactly once.
+TEST(WorkStealingDequeTest, ConcurrentSteals) {
+  const int kThieves = 3;
+  const int kItems = 100000;
+  std::unique_ptr<ThreadSystem> thread_system(Platform::CreateThreadSystem());
+  std::unique_ptr<std::atomic<int>[]> items(new std::atomic<int>[kItems]);
+  for (int i = 0; i < kItems; ++i) {
+    items[i] = 0;
+  }
+  WorkStealingDeque<std::atomic<int>> deque(4);
+  std::atomic<bool> stop(false);
+  std::vector<std::unique_ptr<Thief>> thieves;
+  for (int i = 0; i < kThieves; ++i) {
+    thieves.emplace_back(new Thief(thread_system.get(), &deque, &stop));
+    ASSERT_TRUE(thieves.back()->Start());
+  }
+
+  for (int i = 0; i < kItems; ++i) {
+    deque.Push(&items[i]);
+    if ((i % 3) == 0) {
+      std::atomic<int>* item = deque.Pop();
+      if (item != nullptr) {
+        ++*item;
+      }
+    }
+  }
+  while (std::atomic<int>* item = deque.Pop()) {
+    ++*item;
+  }
+  stop = true;
+  for (int i = 0; i < kThieves; ++i) {
+    thieves[i]->Join();
+  }
+
+  for (int i = 0; i < kItems; ++i) {
+    ASSERT_EQ(1, items[i].load()) << i;
+  }
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
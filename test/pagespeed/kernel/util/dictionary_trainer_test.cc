@@ -0,0 +1,81 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/dictionary_trainer.h"
+
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/util/simple_random.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class DictionaryTrainerTest : public testing::Test {
+ protected:
+  DictionaryTrainerTest() : random_(new NullMutex) {}
+
+  SimpleRandom random_;
+};
+
+TEST_F(DictionaryTrainerTest, NoSamples) {
+  EXPECT_EQ("", DictionaryTrainer::Train(StringVector(), 1024));
+}
+
+TEST_F(DictionaryTrainerTest, NothingInCommon) {
+  StringVector samples;
+  for (int i = 0; i < 10; ++i) {
+    samples.push_back(random_.GenerateHighEntropyString(500));
+  }
+  EXPECT_EQ("", DictionaryTrainer::Train(samples, 1024));
+}
+
+TEST_F(DictionaryTrainerTest, FindsSharedStrings) {
+  GoogleString common = "Content-Type: text/html; charset=utf-8";
+  GoogleString rare = "Cache-Control: max-age=300";
+  StringVector samples;
+  for (int i = 0; i < 20; ++i) {
+    GoogleString sample = random_.GenerateHighEntropyString(200);
+    StrAppend(&sample, common, random_.GenerateHighEntropyString(200));
+    if (i < 2) {
+      StrAppend(&sample, rare);
+    }
+    samples.push_back(sample);
+  }
+  GoogleString dictionary = DictionaryTrainer::Train(samples, 1024);
+  EXPECT_NE(GoogleString::npos, dictionary.find("text/html"));
+  EXPECT_NE(GoogleString::npos, dictionary.find("max-age"));
+  // Strings in more samples score higher, and go at the end.
+  EXPECT_GT(dictionary.find("text/html"), dictionary.find("max-age"));
+}
+
+TEST_F(DictionaryTrainerTest, SizeLimit) {
+  StringVector samples;
+  GoogleString common = random_.GenerateHighEntropyString(5000);
+  for (int i = 0; i < 10; ++i) {
+    samples.push_back(common);
+  }
+  EXPECT_EQ(1000, DictionaryTrainer::Train(samples, 1000).size());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,247 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/io_uring.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class IoUringTest : public testing::Test {
+ protected:
+  IoUringTest()
+      : ring_(IoUring::Create(8)),
+        path_(StrCat(GTestTempDir(), "/io_uring_test_",
+                     IntegerToString(getpid()))) {
+    if (ring_ == nullptr) {
+      LOG(INFO) << "io_uring is unavailable; skipping";
+    }
+    unlink(path_.c_str());
+  }
+
+  ~IoUringTest() override { unlink(path_.c_str()); }
+
+  // Submits and waits, returning the single completion's result.
+  int32 RunOne() {
+    std::vector<IoUring::Completion> completions;
+    EXPECT_TRUE(ring_->SubmitAndWait(&completions));
+    EXPECT_EQ(1, completions.size());
+    return completions.empty() ? -1 : completions[0].result;
+  }
+
+  std::unique_ptr<IoUring> ring_;
+  GoogleString path_;
+};
+
+TEST_F(IoUringTest, WriteRenameStatRead) {
+  if (ring_ == nullptr) {
+    return;
+  }
+  EXPECT_LE(8U, ring_->capacity());
+
+  GoogleString temp_path = StrCat(path_, ".temp");
+  ASSERT_TRUE(ring_->QueueOpenAt(temp_path.c_str(),
+                                 O_WRONLY | O_CREAT | O_TRUNC, 0600, 1));
+  int fd = RunOne();
+  ASSERT_LE(0, fd);
+
+  // A write hard-linked to a close: both complete, in order.
+  const char kData[] = "hello, ring";
+  ASSERT_TRUE(ring_->QueueWrite(fd, kData, STATIC_STRLEN(kData), 2, true));
+  ASSERT_TRUE(ring_->QueueClose(fd, 3));
+  EXPECT_EQ(2, ring_->queued());
+  std::vector<IoUring::Completion> completions;
+  ASSERT_TRUE(ring_->SubmitAndWait(&completions));
+  ASSERT_EQ(2, completions.size());
+  EXPECT_EQ(2, completions[0].user_data);
+  EXPECT_EQ(STATIC_STRLEN(kData), completions[0].result);
+  EXPECT_EQ(3, completions[1].user_data);
+  EXPECT_EQ(0, completions[1].result);
+  EXPECT_EQ(0, ring_->queued());
+
+  ASSERT_TRUE(ring_->QueueRenameAt(temp_path.c_str(), path_.c_str(), 4));
+  EXPECT_EQ(0, RunOne());
+
+  // Open and stat in one submission.
+  struct statx stat_buffer;
+  ASSERT_TRUE(ring_->QueueOpenAt(path_.c_str(), O_RDONLY, 0, 5));
+  ASSERT_TRUE(ring_->QueueStatx(path_.c_str(), STATX_SIZE, &stat_buffer, 6));
+  completions.clear();
+  ASSERT_TRUE(ring_->SubmitAndWait(&completions));
+  ASSERT_EQ(2, completions.size());
+  fd = -1;
+  for (const IoUring::Completion& completion : completions) {
+    if (completion.user_data == 5) {
+      fd = completion.result;
+    } else {
+      EXPECT_EQ(0, completion.result);
+    }
+  }
+  ASSERT_LE(0, fd);
+  EXPECT_EQ(STATIC_STRLEN(kData), stat_buffer.stx_size);
+
+  char buffer[64];
+  ASSERT_TRUE(ring_->QueueRead(fd, buffer, sizeof(buffer), 7, true));
+  ASSERT_TRUE(ring_->QueueClose(fd, 8));
+  completions.clear();
+  ASSERT_TRUE(ring_->SubmitAndWait(&completions));
+  ASSERT_EQ(2, completions.size());
+  EXPECT_EQ(STATIC_STRLEN(kData), completions[0].result);
+  EXPECT_EQ(kData, GoogleString(buffer, completions[0].result));
+}
+
+TEST_F(IoUringTest, Errors) {
+  if (ring_ == nullptr) {
+    return;
+  }
+  // A failed read still runs the hard-linked close.
+  ASSERT_TRUE(ring_->QueueOpenAt(path_.c_str(), O_RDONLY, 0, 1));
+  EXPECT_EQ(-ENOENT, RunOne());
+  int fd = open("/dev/null", O_WRONLY);
+  ASSERT_LE(0, fd);
+  char buffer[8];
+  ASSERT_TRUE(ring_->QueueRead(fd, buffer, sizeof(buffer), 2, true));
+  ASSERT_TRUE(ring_->QueueClose(fd, 3));
+  std::vector<IoUring::Completion> completions;
+  ASSERT_TRUE(ring_->SubmitAndWait(&completions));
+  ASSERT_EQ(2, completions.size());
+  EXPECT_EQ(-EBADF, completions[0].result);
+  EXPECT_EQ(0, completions[1].result);
+}
+
+TEST_F(IoUringTest, FailedSubmitWaitsForOperations) {
+  if (ring_ == nullptr) {
+    return;
+  }
+  // The operations are running when io_uring_enter fails, and are still
+  // reported once they finish, so their buffers are free afterwards.
+  ASSERT_TRUE(ring_->QueueOpenAt(path_.c_str(), O_RDONLY, 0, 1));
+  ASSERT_TRUE(ring_->QueueOpenAt(path_.c_str(), O_RDONLY, 0, 2));
+  ring_->FailNextEnterForTesting();
+  std::vector<IoUring::Completion> completions;
+  EXPECT_FALSE(ring_->SubmitAndWait(&completions));
+  EXPECT_EQ(0, ring_->in_flight());
+  ASSERT_EQ(2, completions.size());
+  EXPECT_EQ(-ENOENT, completions[0].result);
+  EXPECT_EQ(-ENOENT, completions[1].result);
+  EXPECT_EQ(0, ring_->queued());
+}
+
+TEST_F(IoUringTest, QueueFull) {
+  if (ring_ == nullptr) {
+    return;
+  }
+  unsigned capacity = ring_->capacity();
+  for (unsigned i = 0; i < capacity; ++i) {
+    EXPECT_TRUE(ring_->QueueOpenAt(path_.c_str(), O_RDONLY, 0, i));
+  }
+  EXPECT_FALSE(ring_->QueueOpenAt(path_.c_str(), O_RDONLY, 0, capacity));
+  std::vector<IoUring::Completion> completions;
+  ASSERT_TRUE(ring_->SubmitAndWait(&completions));
+  EXPECT_EQ(capacity, completions.size());
+}
+
+TEST_F(IoUringTest, Pool) {
+  std::unique_ptr<ThreadSystem> thread_system(Platform::CreateThreadSystem());
+  IoUringPool pool(8, thread_system.get());
+  IoUring* a = pool.Acquire();
+  if (a == nullptr) {
+    EXPECT_FALSE(pool.available());
+    EXPECT_TRUE(pool.Acquire() == nullptr);
+    return;
+  }
+  // Concurrent users get distinct rings, and released rings are reused.
+  IoUring* b = pool.Acquire();
+  ASSERT_TRUE(b != nullptr);
+  EXPECT_NE(a, b);
+  pool.Release(a, true);
+  EXPECT_EQ(a, pool.Acquire());
+  pool.Release(a, true);
+  pool.Release(b, false);  // Destroyed.
+  EXPECT_TRUE(pool.available());
+}
+
+// Returns the number of descriptors this process has open.
+int CountOpenFiles() {
+  int count = 0;
+  DIR* dir = opendir("/proc/self/fd");
+  if (dir != nullptr) {
+    while (readdir(dir) != nullptr) {
+      ++count;
+    }
+    closedir(dir);
+  }
+  return count;
+}
+
+TEST_F(IoUringTest, PoolDropsRingsAfterFork) {
+  std::unique_ptr<ThreadSystem> thread_system(Platform::CreateThreadSystem());
+  IoUringPool pool(8, thread_system.get());
+  IoUring* a = pool.Acquire();
+  if (a == nullptr) {
+    return;
+  }
+  IoUring* b = pool.Acquire();
+  ASSERT_TRUE(b != nullptr);
+  pool.Release(a, true);
+  pool.Release(b, true);
+
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    // The child closes both inherited rings and opens one of its own.
+    int before = CountOpenFiles();
+    IoUring* ring = pool.Acquire();
+    bool ok = (ring != nullptr) && (CountOpenFiles() == before - 1);
+    if (ring != nullptr) {
+      pool.Release(ring, true);
+    }
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+
+  // The parent's rings are untouched.
+  IoUring* ring = pool.Acquire();
+  EXPECT_TRUE(ring == a || ring == b);
+  pool.Release(ring, true);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
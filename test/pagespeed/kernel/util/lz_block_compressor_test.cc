@@ -0,0 +1,129 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/lz_block_compressor.h"
+
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/util/simple_random.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+class LzBlockCompressorTest : public testing::Test {
+ protected:
+  LzBlockCompressorTest() : random_(new NullMutex) {}
+
+  // Compresses and decompresses payload, returning the compressed size.
+  static size_t RoundTrip(const LzBlockCompressor& compressor,
+                          StringPiece payload) {
+    GoogleString compressed, decompressed;
+    compressor.Compress(payload, &compressed);
+    EXPECT_TRUE(compressor.Decompress(compressed, &decompressed));
+    EXPECT_EQ(payload, decompressed);
+    return compressed.size();
+  }
+
+  SimpleRandom random_;
+};
+
+TEST_F(LzBlockCompressorTest, Empty) {
+  LzBlockCompressor compressor;
+  RoundTrip(compressor, "");
+}
+
+TEST_F(LzBlockCompressorTest, ShortInputs) {
+  LzBlockCompressor compressor;
+  GoogleString payload;
+  for (int i = 0; i < 40; ++i) {
+    RoundTrip(compressor, payload);
+    payload.push_back('a' + (i % 3));
+  }
+}
+
+TEST_F(LzBlockCompressorTest, Repetitive) {
+  LzBlockCompressor compressor;
+  // Long runs exercise the extended match lengths and overlapping copies.
+  GoogleString payload(100000, 'x');
+  EXPECT_GT(1000, RoundTrip(compressor, payload));
+
+  GoogleString chunk = random_.GenerateHighEntropyString(300);
+  payload.clear();
+  for (int i = 0; i < 100; ++i) {
+    payload += chunk;
+  }
+  EXPECT_GT(2000, RoundTrip(compressor, payload));
+}
+
+TEST_F(LzBlockCompressorTest, HighEntropy) {
+  LzBlockCompressor compressor;
+  // Long runs of literals exercise the extended literal lengths.
+  GoogleString payload = random_.GenerateHighEntropyString(100000);
+  EXPECT_GT(payload.size() + 1000, RoundTrip(compressor, payload));
+}
+
+TEST_F(LzBlockCompressorTest, Dictionary) {
+  GoogleString dictionary = random_.GenerateHighEntropyString(1000);
+  LzBlockCompressor with_dictionary(dictionary);
+  LzBlockCompressor without_dictionary;
+  GoogleString payload =
+      StrCat(dictionary.substr(500, 200), "glue", dictionary.substr(0, 300));
+  EXPECT_GT(RoundTrip(without_dictionary, payload),
+            RoundTrip(with_dictionary, payload) + 400);
+
+  // Blocks compressed against a dictionary need it to decompress.
+  GoogleString compressed, decompressed;
+  with_dictionary.Compress(payload, &compressed);
+  EXPECT_FALSE(without_dictionary.Decompress(compressed, &decompressed));
+}
+
+TEST_F(LzBlockCompressorTest, Corruption) {
+  LzBlockCompressor compressor;
+  GoogleString chunk = random_.GenerateHighEntropyString(50);
+  GoogleString payload;
+  for (int i = 0; i < 100; ++i) {
+    payload += chunk;
+    payload += random_.GenerateHighEntropyString(10);
+  }
+  GoogleString compressed;
+  compressor.Compress(payload, &compressed);
+
+  // Every truncation and every single-bit flip must be rejected.
+  GoogleString decompressed;
+  for (size_t i = 0; i < compressed.size(); ++i) {
+    decompressed.clear();
+    EXPECT_FALSE(
+        compressor.Decompress(StringPiece(compressed).substr(0, i),
+                              &decompressed));
+    GoogleString corrupt = compressed;
+    corrupt[i] ^= 1 << (i % 8);
+    decompressed.clear();
+    EXPECT_FALSE(compressor.Decompress(corrupt, &decompressed)) << i;
+  }
+  decompressed.clear();
+  EXPECT_FALSE(
+      compressor.Decompress(StrCat(compressed, "x"), &decompressed));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -21,9 +21,13 @@
 
 #include "pagespeed/kernel/util/simple_stats.h"
 
+#include <memory>
+#include <vector>
+
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/thread.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "test/pagespeed/kernel/base/gtest.h"
@@ -32,11 +36,33 @@ namespace {
 
 const int64 kOneMilion = 1000LL * 1000LL;
 const int64 kTenBillion = 10000LL * kOneMilion;
+const int kAddsPerThread = 10000;
 
 }  // namespace
 
 namespace net_instaweb {
 
+// Bumps a variable and an up/down counter kAddsPerThread times each.
+class AddThread : public ThreadSystem::Thread {
+ public:
+  AddThread(ThreadSystem* thread_system, Variable* var, UpDownCounter* counter)
+      : Thread(thread_system, "add", ThreadSystem::kJoinable),
+        var_(var),
+        counter_(counter) {}
+
+  void Run() override {
+    for (int i = 0; i < kAddsPerThread; ++i) {
+      var_->Add(1);
+      counter_->Add(i % 2 == 0 ? 3 : -1);
+    }
+  }
+
+ private:
+  Variable* var_;
+  UpDownCounter* counter_;
+  DISALLOW_COPY_AND_ASSIGN(AddThread);
+};
+
 class SimpleStatsTest : public testing::Test {
  public:
   SimpleStatsTest()
@@ -97,17 +123,59 @@ TEST_F(SimpleStatsTest, TestSetReturningPrevious) {
 
 TEST_F(SimpleStatsTest, CounterHugeValues) {
   UpDownCounter* var = stats_.AddUpDownCounter("c0");
-  EXPECT_EQ(kTenBillion, var->Add(kTenBillion));
-  EXPECT_EQ(2 * kTenBillion, var->Add(kTenBillion));
-  EXPECT_EQ(kTenBillion, var->Add(-kTenBillion));
-  EXPECT_EQ(0, var->Add(-kTenBillion));
-  EXPECT_EQ(-kTenBillion, var->Add(-kTenBillion));
+  var->Add(kTenBillion);
+  EXPECT_EQ(kTenBillion, var->Get());
+  var->Add(kTenBillion);
+  EXPECT_EQ(2 * kTenBillion, var->Get());
+  var->Add(-kTenBillion);
+  EXPECT_EQ(kTenBillion, var->Get());
+  var->Add(-kTenBillion);
+  EXPECT_EQ(0, var->Get());
+  var->Add(-kTenBillion);
+  EXPECT_EQ(-kTenBillion, var->Get());
 }
 
 TEST_F(SimpleStatsTest, VariableHugeValues) {
   Variable* var = stats_.AddVariable("v0");
-  EXPECT_EQ(kTenBillion, var->Add(kTenBillion));
-  EXPECT_EQ(2 * kTenBillion, var->Add(kTenBillion));
+  var->Add(kTenBillion);
+  EXPECT_EQ(kTenBillion, var->Get());
+  var->Add(kTenBillion);
+  EXPECT_EQ(2 * kTenBillion, var->Get());
+}
+
+TEST_F(SimpleStatsTest, AddReturnsDelta) {
+  // Add doesn't sum the shards, so it can't return the total.
+  Variable* var = stats_.AddVariable("v0");
+  var->Add(5);
+  EXPECT_EQ(3, var->Add(3));
+  EXPECT_EQ(8, var->Get());
+}
+
+TEST_F(SimpleStatsTest, ConcurrentAdds) {
+  // Use more threads than shards so that some threads share one.
+  const int kThreads = SimpleStatsVariable::kNumShards + 4;
+  Variable* var = stats_.AddVariable("v0");
+  UpDownCounter* counter = stats_.AddUpDownCounter("c0");
+  std::vector<std::unique_ptr<AddThread>> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back(new AddThread(thread_system_.get(), var, counter));
+    ASSERT_TRUE(threads.back()->Start());
+  }
+  for (int i = 0; i < kThreads; ++i) {
+    threads[i]->Join();
+  }
+  EXPECT_EQ(kThreads * kAddsPerThread, var->Get());
+  EXPECT_EQ(kThreads * kAddsPerThread, counter->Get());
+
+  // Set and Clear must discard what every thread's shard has accumulated.
+  EXPECT_EQ(kThreads * kAddsPerThread, counter->SetReturningPreviousValue(7));
+  EXPECT_EQ(7, counter->Get());
+  counter->Add(1);
+  EXPECT_EQ(8, counter->Get());
+  var->Clear();
+  EXPECT_EQ(0, var->Get());
+  var->Add(1);
+  EXPECT_EQ(1, var->Get());
 }
 
 }  // namespace net_instaweb
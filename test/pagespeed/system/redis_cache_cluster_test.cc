@@ -233,6 +233,48 @@ TEST_F(RedisCacheClusterTest, SlotBoundaries) {
   }
 }
 
+TEST_F(RedisCacheClusterTest, MultiGetAcrossNodes) {
+  if (!InitRedisClusterOrSkip()) {
+    return;
+  }
+  CheckPut(kKeyOnNode1, kValue1);
+  CheckPut(kKeyOnNode2, kValue2);
+  CheckPut(kKeyOnNode3, kValue3);
+  EXPECT_EQ(1, cache_->Redirections());
+  EXPECT_EQ(1, cache_->ClusterSlotsFetches());
+
+  // A new cache doesn't know the slot mapping yet, so sends every key to the
+  // first node.  The keys on the other two nodes are redirected, which
+  // fetches the mapping, and are then looked up on the right nodes.  The
+  // two caches share statistics.
+  RedisCache new_cache("localhost", ports_[0], thread_system_.get(), &handler_,
+                       &timer_, kReconnectionDelayMs, kTimeoutUs, &statistics_,
+                       kDatabaseIndex, kTTLSec);
+  new_cache.StartUp();
+  for (int round = 0; round < 2; ++round) {
+    Callback* callback1 = AddCallback();
+    Callback* callback1b = AddCallback();
+    Callback* callback2 = AddCallback();
+    Callback* callback3 = AddCallback();
+    CacheInterface::MultiGetRequest* request =
+        new CacheInterface::MultiGetRequest;
+    request->push_back(CacheInterface::KeyCallback(kKeyOnNode1, callback1));
+    request->push_back(CacheInterface::KeyCallback(kKeyOnNode1b, callback1b));
+    request->push_back(CacheInterface::KeyCallback(kKeyOnNode2, callback2));
+    request->push_back(CacheInterface::KeyCallback(kKeyOnNode3, callback3));
+    new_cache.MultiGet(request);
+    WaitAndCheck(callback1, kValue1);
+    WaitAndCheckNotFound(callback1b);
+    WaitAndCheck(callback2, kValue2);
+    WaitAndCheck(callback3, kValue3);
+
+    // Nothing more happens the second time round.
+    EXPECT_EQ(3, new_cache.Redirections());
+    EXPECT_EQ(2, new_cache.ClusterSlotsFetches());
+  }
+  new_cache.ShutDown();
+}
+
 int CountSubstring(const GoogleString& haystack, const GoogleString& needle) {
   size_t pos = -1;
   int count = 0;
@@ -363,11 +405,22 @@ TEST_F(RedisCacheClusterTestWithReconfiguration, HandlesMigrations) {
   EXPECT_EQ(4, cache_->Redirections());
   EXPECT_EQ(1, cache_->ClusterSlotsFetches());
 
+  // MultiGet carries on from the ASK its GET gets, sending ASKING and the
+  // key to the importing node, so it sees a single redirection too.
+  Callback* callback = AddCallback();
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  request->push_back(CacheInterface::KeyCallback(kKeyOnNode1, callback));
+  cache_->MultiGet(request);
+  WaitAndCheck(callback, kValue3);
+  EXPECT_EQ(5, cache_->Redirections());
+  EXPECT_EQ(1, cache_->ClusterSlotsFetches());
+
   // But not for the second key, which is still on the first node.
   CheckGet(kKeyOnNode1b, kValue2);
   CheckPut(kKeyOnNode1b, kValue3);
   CheckGet(kKeyOnNode1b, kValue3);
-  EXPECT_EQ(4, cache_->Redirections());
+  EXPECT_EQ(5, cache_->Redirections());
   EXPECT_EQ(1, cache_->ClusterSlotsFetches());
 
   LOG(INFO) << "Moving the second key as well";
@@ -391,7 +444,7 @@ TEST_F(RedisCacheClusterTestWithReconfiguration, HandlesMigrations) {
   CheckGet(kKeyOnNode1, kValue3);
   // Now that the migration is complete and we've called SETSLOT we'll get a
   // MOVED instead of an ASK, so we'll fetch slots.
-  EXPECT_EQ(5, cache_->Redirections());
+  EXPECT_EQ(6, cache_->Redirections());
   EXPECT_EQ(2, cache_->ClusterSlotsFetches());
 
   CheckPut(kKeyOnNode1, kValue4);
@@ -402,7 +455,7 @@ TEST_F(RedisCacheClusterTestWithReconfiguration, HandlesMigrations) {
   CheckGet(kKeyOnNode1b, kValue4);
 
   // No more redirections or slots fetches.
-  EXPECT_EQ(5, cache_->Redirections());
+  EXPECT_EQ(6, cache_->Redirections());
   EXPECT_EQ(2, cache_->ClusterSlotsFetches());
 }
 
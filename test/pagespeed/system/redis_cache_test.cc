@@ -218,6 +218,45 @@ TEST_F(RedisCacheTest, MultiGet) {
   TestMultiGet();  // Test from CacheTestBase is just fine.
 }
 
+// Keys that share a {}-section also share a hash slot, so are fetched with a
+// single MGET; the others each get their own GET in the same batch.
+TEST_F(RedisCacheTest, MultiGetManyKeys) {
+  if (!PrepareRedisOrSkip()) {
+    return;
+  }
+  InitRedisWithCustomDatabaseIndex(0);
+
+  const int kNumKeys = 20;
+  StringVector keys;
+  for (int i = 0; i < kNumKeys; ++i) {
+    keys.push_back(StrCat("{tag}Key", IntegerToString(i)));
+    keys.push_back(StrCat("Key", IntegerToString(i)));
+  }
+  // Only store every other key.
+  for (int i = 0; i < static_cast<int>(keys.size()); i += 4) {
+    CheckPut(keys[i], StrCat("Value", keys[i]));
+    CheckPut(keys[i + 1], StrCat("Value", keys[i + 1]));
+  }
+
+  CacheInterface::MultiGetRequest* request =
+      new CacheInterface::MultiGetRequest;
+  std::vector<Callback*> callbacks;
+  for (const GoogleString& key : keys) {
+    callbacks.push_back(AddCallback());
+    request->push_back(CacheInterface::KeyCallback(key, callbacks.back()));
+  }
+  Cache()->MultiGet(request);
+  for (int i = 0; i < static_cast<int>(keys.size()); ++i) {
+    if (i % 4 < 2) {
+      WaitAndCheck(callbacks[i], StrCat("Value", keys[i]));
+    } else {
+      WaitAndCheckNotFound(callbacks[i]);
+    }
+  }
+  EXPECT_EQ(0, cache_[0]->Redirections());
+  EXPECT_EQ(0, cache_[0]->ClusterSlotsFetches());
+}
+
 TEST_F(RedisCacheTest, BasicInvalid) {
   if (!PrepareRedisOrSkip()) {
     return;
@@ -55,11 +55,14 @@
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/cache/async_cache.h"
 #include "pagespeed/kernel/cache/cache_batcher.h"
+#include "pagespeed/kernel/cache/cache_codec.h"
 #include "pagespeed/kernel/cache/cache_stats.h"
 #include "pagespeed/kernel/cache/compressed_cache.h"
 #include "pagespeed/kernel/cache/fallback_cache.h"
 #include "pagespeed/kernel/cache/file_cache.h"
+#include "pagespeed/kernel/cache/log_structured_file_cache.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
+#include "pagespeed/kernel/cache/sharded_lru_cache.h"
 #include "pagespeed/kernel/cache/threadsafe_cache.h"
 #include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/http/content_type.h"
@@ -312,6 +315,10 @@ class SystemCachesTest : public CustomRewriteTestBase<SystemRewriteOptions> {
     return ThreadsafeCache::FormatName(LRUCache::FormatName());
   }
 
+  GoogleString ShardedLRU(int num_shards) {
+    return ShardedLRUCache::FormatName(num_shards);
+  }
+
   GoogleString FileCacheName() { return FileCache::FormatName(); }
 
   GoogleString FileCacheWithStats() {
@@ -389,6 +396,37 @@ TEST_F(SystemCachesTest, BasicFileAndLruCache) {
                                       FileCacheWithStats())),
                server_context->http_cache()->Name());
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == nullptr);
+
+  // The metadata cache is fronted by memory, the property cache is not.
+  CompressedCache* metadata_cache =
+      dynamic_cast<CompressedCache*>(server_context->metadata_cache());
+  ASSERT_TRUE(metadata_cache != nullptr);
+  EXPECT_EQ(CacheCodec::kLz, metadata_cache->codec());
+  CachePropertyStore* property_store = dynamic_cast<CachePropertyStore*>(
+      server_context->page_property_cache()->property_store());
+  ASSERT_TRUE(property_store != nullptr);
+  const CompressedCache* property_store_cache =
+      dynamic_cast<const CompressedCache*>(property_store->cache_backend());
+  ASSERT_TRUE(property_store_cache != nullptr);
+  EXPECT_EQ(CacheCodec::kBrotli, property_store_cache->codec());
+}
+
+TEST_F(SystemCachesTest, ShardedLruCache) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_use_shared_mem_locking(false);
+  options_->set_lru_cache_kb_per_process(100);
+  options_->set_lru_cache_shards(8);
+  options_->set_default_shared_memory_cache_kb(0);
+  PrepareWithConfig(options_.get());
+
+  std::unique_ptr<ServerContext> server_context(
+      SetupServerContext(options_.release()));
+  EXPECT_STREQ(Compressed(WriteThrough(Stats("lru_cache", ShardedLRU(8)),
+                                       FileCacheWithStats())),
+               server_context->metadata_cache()->Name());
+  EXPECT_STREQ(HttpCache(WriteThrough(Stats("lru_cache", ShardedLRU(8)),
+                                      FileCacheWithStats())),
+               server_context->http_cache()->Name());
 }
 
 TEST_F(SystemCachesTest, BasicFileOnlyCache) {
@@ -404,6 +442,10 @@ TEST_F(SystemCachesTest, BasicFileOnlyCache) {
                server_context->metadata_cache()->Name());
   EXPECT_STREQ(HttpCache(FileCacheWithStats()),
                server_context->http_cache()->Name());
+  CompressedCache* metadata_cache =
+      dynamic_cast<CompressedCache*>(server_context->metadata_cache());
+  ASSERT_TRUE(metadata_cache != nullptr);
+  EXPECT_EQ(CacheCodec::kBrotli, metadata_cache->codec());
   EXPECT_TRUE(server_context->filesystem_metadata_cache() == nullptr);
 }
 
@@ -1034,6 +1076,7 @@ TEST_F(SystemCachesTest, FileCacheSettings) {
   options_->set_file_cache_clean_interval_ms(3 * Timer::kHourMs);
   options_->set_file_cache_clean_size_kb(1024);
   options_->set_file_cache_clean_inode_limit(50000);
+  options_->set_file_cache_clean_slice_ms(100);
   options_->set_use_shared_mem_locking(false);
   options_->set_lru_cache_kb_per_process(0);
   options_->set_default_shared_memory_cache_kb(0);
@@ -1056,6 +1099,7 @@ TEST_F(SystemCachesTest, FileCacheSettings) {
   // Note: this is in bytes, the setting is in kb.
   EXPECT_EQ(1024 * 1024, file_cache->cache_policy()->target_size_bytes);
   EXPECT_EQ(50000, file_cache->cache_policy()->target_inode_count);
+  EXPECT_EQ(100, file_cache->cache_policy()->clean_slice_ms);
   EXPECT_TRUE(file_cache->worker() != nullptr);
 }
 
@@ -1257,6 +1301,48 @@ TEST_F(SystemCachesTest, FileCacheNoConflictOnDefaults) {
   EXPECT_EQ(0, message_handler()->MessagesOfType(kWarning));
 }
 
+TEST_F(SystemCachesTest, LogStructuredFileCache) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_file_cache_mode(SystemCachePath::kFileCacheModeLog);
+  options_->set_file_cache_clean_size_kb(64 * 1024);
+  SystemCachePath* path = system_caches_->GetCache(options_.get());
+  EXPECT_EQ(nullptr, path->file_cache_backend());
+  LogStructuredFileCache* log_cache = path->log_file_cache_backend();
+  ASSERT_NE(nullptr, log_cache);
+  EXPECT_EQ(StrCat(kCachePath, SystemCachePath::kLogStructuredDir),
+            log_cache->path());
+  EXPECT_EQ(4 * 1024 * 1024, log_cache->segment_size());
+  EXPECT_EQ(16, log_cache->max_segments());
+
+  // A second vhost sharing the path keeps the first one's mode.
+  SystemRewriteOptions options2(thread_system_.get());
+  options2.set_file_cache_path(kCachePath);
+  SystemCachePath* path2 = system_caches_->GetCache(&options2);
+  EXPECT_EQ(path, path2);
+  EXPECT_EQ(1, message_handler()->MessagesOfType(kWarning));
+}
+
+TEST_F(SystemCachesTest, FileCacheIoUring) {
+  options_->set_file_cache_path(kCachePath);
+  SystemCachePath* path = system_caches_->GetCache(options_.get());
+  EXPECT_FALSE(path->file_cache_backend()->io_uring_enabled());
+
+  SystemRewriteOptions options2(thread_system_.get());
+  options2.set_file_cache_path("/mem/path2/");
+  options2.set_file_cache_io_uring(true);
+  SystemCachePath* path2 = system_caches_->GetCache(&options2);
+  EXPECT_TRUE(path2->file_cache_backend()->io_uring_enabled());
+}
+
+TEST_F(SystemCachesTest, UnknownFileCacheMode) {
+  options_->set_file_cache_path(kCachePath);
+  options_->set_file_cache_mode("bogus");
+  SystemCachePath* path = system_caches_->GetCache(options_.get());
+  EXPECT_NE(nullptr, path->file_cache_backend());
+  EXPECT_EQ(nullptr, path->log_file_cache_backend());
+  EXPECT_EQ(1, message_handler()->MessagesOfType(kWarning));
+}
+
 TEST_F(SystemCachesTest, PurgeUrl) {
   options_->set_enable_cache_purge(true);
   SystemServerContext* server_context = PopulateCacheForPurgeTest();